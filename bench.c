@@ -0,0 +1,596 @@
+
+/*
+ * s3backer - FUSE-based single file backing store via Amazon S3
+ *
+ * Copyright 2008-2020 Archie L. Cobbs <archie.cobbs@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations including
+ * the two.
+ *
+ * You must obey the GNU General Public License in all respects for all
+ * of the code used other than OpenSSL. If you modify file(s) with this
+ * exception, you may extend this exception to your version of the
+ * file(s), but you are not obligated to do so. If you do not wish to do
+ * so, delete this exception statement from your version. If you delete
+ * this exception statement from all source files in the program, then
+ * also delete it here.
+ */
+
+#include "s3backer.h"
+#include "block_cache.h"
+#include "ec_protect.h"
+#include "dedup.h"
+#include "zero_cache.h"
+#include "fuse_ops.h"
+#include "http_io.h"
+#include "test_io.h"
+#include "localfs_io.h"
+#include "s3b_config.h"
+#include "util.h"
+
+/*
+ * Benchmark driver for the s3backer layer stack.
+ *
+ * Builds the same stack of layers that s3backer would (using the normal command line flags, which follow
+ * a "--" separator), then drives it with an fio-like workload using one thread per outstanding request.
+ * Combine with `--test' and `--test-latency' to measure cache and concurrency changes without a network.
+ *
+ * Random offsets are generated from a per-thread generator seeded from `--seed', so runs are reproducible
+ * (modulo thread scheduling).
+ */
+
+// Workload profiles (same names as fio(1))
+#define PROFILE_READ            "read"
+#define PROFILE_WRITE           "write"
+#define PROFILE_RW              "rw"
+#define PROFILE_RANDREAD        "randread"
+#define PROFILE_RANDWRITE       "randwrite"
+#define PROFILE_RANDRW          "randrw"
+
+// Defaults
+#define DEFAULT_PROFILE         PROFILE_RANDREAD
+#define DEFAULT_IODEPTH         8
+#define DEFAULT_READ_PERCENT    50
+#define DEFAULT_RUNTIME         30
+#define DEFAULT_SEED            1
+
+// How often the main thread checks for completion (milliseconds)
+#define POLL_MILLIS             100
+
+// Benchmark parameters
+struct bench_params {
+    const char          *profile;
+    u_int               iodepth;                // number of concurrent requests (threads)
+    u_int               read_percent;           // for mixed profiles, percentage of requests that are reads
+    u_int               io_size;                // bytes per request, or zero for one block
+    double              zipf_theta;             // zipfian skew for random profiles, or zero for uniform
+    u_int               runtime;                // seconds
+    u_int               prefill;                // write every block before starting
+    uint64_t            seed;
+    int                 random;                 // derived from profile
+    int                 reads;                  // derived from profile
+    int                 writes;                 // derived from profile
+};
+
+// Zipfian generator state (Gray et al., "Quickly Generating Billion-Record Synthetic Databases")
+struct zipf {
+    uint64_t            n;
+    double              theta;
+    double              alpha;
+    double              zetan;
+    double              eta;
+};
+
+// Per-thread state
+struct bench_thread {
+    pthread_t           thread;
+    u_int               id;
+    uint64_t            rng;
+    char                *buf;
+    s3b_block_t         seq_min;                // sequential region start (inclusive)
+    s3b_block_t         seq_max;                // sequential region end (exclusive)
+    s3b_block_t         seq_block;              // next sequential block
+    u_int               seq_off;                // next sequential offset within block (partial requests)
+    uint64_t            bytes_read;
+    uint64_t            bytes_written;
+    uint64_t            errors;
+    struct latency_hist reads;
+    struct latency_hist writes;
+};
+
+// Internal functions
+static int parse_bench_args(int argc, char **argv);
+static void bench_usage(void);
+static void *bench_thread_main(void *arg);
+static void bench_pick(struct bench_thread *t, s3b_block_t *block_nump, u_int *offp);
+static void bench_report(const char *label, const struct latency_hist *hist, uint64_t bytes, double elapsed);
+static void bench_print(void *prarg, const char *fmt, ...) __attribute__ ((__format__ (__printf__, 2, 3)));
+static void zipf_init(struct zipf *z, uint64_t n, double theta);
+static uint64_t zipf_next(const struct zipf *z, double u);
+static uint64_t rng_next(uint64_t *state);
+static double rng_double(uint64_t *state);
+static void catch_signal(int sig);
+
+// Internal variables
+static struct bench_params params = {
+    .profile=           DEFAULT_PROFILE,
+    .iodepth=           DEFAULT_IODEPTH,
+    .read_percent=      DEFAULT_READ_PERCENT,
+    .runtime=           DEFAULT_RUNTIME,
+    .seed=              DEFAULT_SEED,
+};
+static struct s3b_config *config;
+static struct s3backer_store *store;
+static struct zipf zipf;
+static u_int io_blocks;                         // blocks per request, or zero for partial block requests
+static volatile int stop_threads;
+
+int
+main(int argc, char **argv)
+{
+    struct bench_thread *threads;
+    struct latency_hist reads;
+    struct latency_hist writes;
+    uint64_t bytes_read = 0;
+    uint64_t bytes_written = 0;
+    uint64_t errors = 0;
+    s3b_block_t block_num;
+    s3b_block_t slice;
+    double start_time;
+    double elapsed;
+    double flush_time;
+    char *buf;
+    int nargs;
+    u_int i;
+    int r;
+
+    // Get benchmark parameters, then configuration from what follows them
+    if ((nargs = parse_bench_args(argc, argv)) == -1) {
+        bench_usage();
+        exit(1);
+    }
+    argv[nargs] = argv[0];
+    if ((config = s3backer_get_config(argc - nargs, argv + nargs, 0, 0)) == NULL)
+        exit(1);
+
+    // Check request size
+    if (params.io_size == 0)
+        params.io_size = config->block_size;
+    if (params.io_size >= config->block_size) {
+        if (params.io_size % config->block_size != 0)
+            errx(1, "request size must be a multiple of the block size %u", config->block_size);
+        io_blocks = params.io_size / config->block_size;
+        if (io_blocks > config->num_blocks)
+            errx(1, "request size is larger than the file");
+    } else if (config->block_size % params.io_size != 0)
+        errx(1, "request size must evenly divide the block size %u", config->block_size);
+
+    // Open store
+    warnx("creating s3backer store");
+    if ((store = s3backer_create_store(config)) == NULL)
+        err(1, "s3backer_create_store");
+    if ((r = (*store->create_threads)(store)) != 0) {
+        errno = r;
+        err(1, "create_threads");
+    }
+
+    // Initialize zipfian generator over the possible request starting positions
+    if (params.random && params.zipf_theta > 0.0 && config->num_blocks > (io_blocks > 0 ? io_blocks : 1))
+        zipf_init(&zipf, config->num_blocks - (io_blocks > 0 ? io_blocks - 1 : 0), params.zipf_theta);
+
+    // Prefill
+    if (params.prefill) {
+        warnx("prefilling %ju blocks", (uintmax_t)config->num_blocks);
+        if ((buf = malloc(config->block_size)) == NULL)
+            err(1, "malloc");
+        for (i = 0; i < config->block_size; i++)
+            buf[i] = (char)(i * 251 + 1);
+        for (block_num = 0; block_num < config->num_blocks; block_num++) {
+            memcpy(buf, &block_num, sizeof(block_num));
+            if ((r = (*store->write_block)(store, block_num, buf, NULL, NULL, NULL)) != 0) {
+                errno = r;
+                err(1, "prefill write error");
+            }
+        }
+        free(buf);
+        if ((r = (*store->flush_blocks)(store, NULL, 0, 0)) != 0)
+            warnx("prefill flush failed: %s", strerror(r));
+        (*config->fuse_ops.clear_stats)();
+    }
+
+    // Create threads, each with its own region of the file for the sequential profiles
+    if ((threads = calloc(params.iodepth, sizeof(*threads))) == NULL)
+        err(1, "calloc");
+    slice = config->num_blocks / params.iodepth;
+    if (slice < (io_blocks > 0 ? io_blocks : 1))
+        errx(1, "file is too small for %u sequential streams", params.iodepth);
+    signal(SIGINT, catch_signal);
+    signal(SIGTERM, catch_signal);
+    warnx("running `%s' with iodepth=%u, request size=%u for %u seconds",
+      params.profile, params.iodepth, params.io_size, params.runtime);
+    start_time = monotonic_time();
+    for (i = 0; i < params.iodepth; i++) {
+        struct bench_thread *const t = &threads[i];
+        u_int j;
+
+        t->id = i;
+        t->rng = params.seed * 0x9e3779b97f4a7c15ULL + i + 1;
+        t->seq_min = (s3b_block_t)(slice * i);
+        t->seq_max = i == params.iodepth - 1 ? config->num_blocks : (s3b_block_t)(slice * (i + 1));
+        t->seq_block = t->seq_min;
+        if ((t->buf = block_buf_alloc(io_blocks > 0 ? params.io_size : config->block_size)) == NULL)
+            err(1, "malloc");
+        for (j = 0; j < params.io_size; j++)
+            t->buf[j] = (char)rng_next(&t->rng);
+        if ((r = pthread_create(&t->thread, NULL, bench_thread_main, t)) != 0) {
+            errno = r;
+            err(1, "pthread_create");
+        }
+    }
+
+    // Wait for the run to complete
+    while (!stop_threads && monotonic_time() - start_time < params.runtime)
+        usleep(POLL_MILLIS * 1000);
+    stop_threads = 1;
+    memset(&reads, 0, sizeof(reads));
+    memset(&writes, 0, sizeof(writes));
+    for (i = 0; i < params.iodepth; i++) {
+        struct bench_thread *const t = &threads[i];
+
+        pthread_join(t->thread, NULL);
+        latency_merge(&reads, &t->reads);
+        latency_merge(&writes, &t->writes);
+        bytes_read += t->bytes_read;
+        bytes_written += t->bytes_written;
+        errors += t->errors;
+        block_buf_free(t->buf);
+    }
+    elapsed = monotonic_time() - start_time;
+    free(threads);
+
+    // Flush any dirty data, so write-back caching doesn't hide the cost of writes
+    flush_time = monotonic_time();
+    if (params.writes && (r = (*store->flush_blocks)(store, NULL, 0, 0)) != 0)
+        warnx("final flush failed: %s", strerror(r));
+    flush_time = monotonic_time() - flush_time;
+
+    // Report results
+    printf("%-28s %s\n", "profile", params.profile);
+    printf("%-28s %u\n", "iodepth", params.iodepth);
+    printf("%-28s %u\n", "request_size", params.io_size);
+    if (params.random)
+        printf("%-28s %.3f\n", "zipf_theta", params.zipf_theta);
+    printf("%-28s %.3f sec\n", "elapsed", elapsed);
+    if (params.reads)
+        bench_report("read", &reads, bytes_read, elapsed);
+    if (params.writes) {
+        bench_report("write", &writes, bytes_written, elapsed);
+        printf("%-28s %.3f sec\n", "final_flush_time", flush_time);
+    }
+    printf("%-28s %ju\n", "errors", (uintmax_t)errors);
+
+    // Report per-layer statistics
+    printf("\n");
+    (*config->fuse_ops.print_stats)(NULL, bench_print);
+
+    // Shut down
+    (*store->shutdown)(store);
+    (*store->destroy)(store);
+    return errors > 0 ? 2 : 0;
+}
+
+/*
+ * Parse the benchmark flags preceding the "--" separator, if any.
+ *
+ * Returns the index of the separator (or zero if none), or -1 on error.
+ */
+static int
+parse_bench_args(int argc, char **argv)
+{
+    uintmax_t value;
+    int nargs;
+    int i;
+
+    // Find separator
+    for (nargs = 1; nargs < argc && strcmp(argv[nargs], "--") != 0; nargs++)
+        ;
+    if (nargs == argc)
+        return 0;
+
+    // Parse flags
+    for (i = 1; i < nargs; i++) {
+        const char *const arg = argv[i];
+        const char *const eq = strchr(arg, '=');
+        const char *const val = eq != NULL ? eq + 1 : "";
+        char *end;
+
+        if (strncmp(arg, "--profile=", 10) == 0)
+            params.profile = val;
+        else if (strncmp(arg, "--iodepth=", 10) == 0)
+            params.iodepth = (u_int)strtoul(val, &end, 10);
+        else if (strncmp(arg, "--readPercent=", 14) == 0)
+            params.read_percent = (u_int)strtoul(val, &end, 10);
+        else if (strncmp(arg, "--runtime=", 10) == 0)
+            params.runtime = (u_int)strtoul(val, &end, 10);
+        else if (strncmp(arg, "--seed=", 7) == 0)
+            params.seed = strtoull(val, &end, 10);
+        else if (strncmp(arg, "--zipf=", 7) == 0)
+            params.zipf_theta = strtod(val, &end);
+        else if (strncmp(arg, "--ioSize=", 9) == 0) {
+            if (parse_size_string(val, "request size", sizeof(u_int), &value) == -1)
+                return -1;
+            params.io_size = (u_int)value;
+            continue;
+        } else if (strcmp(arg, "--prefill") == 0) {
+            params.prefill = 1;
+            continue;
+        } else {
+            warnx("unknown benchmark flag `%s'", arg);
+            return -1;
+        }
+        if (*val == '\0' || *end != '\0') {
+            warnx("invalid benchmark flag `%s'", arg);
+            return -1;
+        }
+    }
+
+    // Validate
+    if (strcmp(params.profile, PROFILE_READ) == 0)
+        params.reads = 1;
+    else if (strcmp(params.profile, PROFILE_WRITE) == 0)
+        params.writes = 1;
+    else if (strcmp(params.profile, PROFILE_RW) == 0)
+        params.reads = params.writes = 1;
+    else if (strcmp(params.profile, PROFILE_RANDREAD) == 0)
+        params.random = params.reads = 1;
+    else if (strcmp(params.profile, PROFILE_RANDWRITE) == 0)
+        params.random = params.writes = 1;
+    else if (strcmp(params.profile, PROFILE_RANDRW) == 0)
+        params.random = params.reads = params.writes = 1;
+    else {
+        warnx("invalid profile `%s'", params.profile);
+        return -1;
+    }
+    if (!params.reads)
+        params.read_percent = 0;
+    else if (!params.writes)
+        params.read_percent = 100;
+    if (params.iodepth == 0 || params.read_percent > 100 || params.runtime == 0) {
+        warnx("invalid benchmark parameters");
+        return -1;
+    }
+    if (params.zipf_theta < 0.0 || params.zipf_theta >= 1.0) {
+        warnx("zipf theta must be in the range [0, 1)");
+        return -1;
+    }
+
+    // Done
+    return nargs;
+}
+
+static void
+bench_usage(void)
+{
+    fprintf(stderr, "Usage:\n");
+    fprintf(stderr, "\tbench [benchmark-options] -- [s3backer-options] bucket[/subdir] /mount/point\n");
+    fprintf(stderr, "Benchmark options:\n");
+    fprintf(stderr, "\t--%-27s %s\n", "profile=TYPE", "One of: read, write, rw, randread, randwrite, randrw");
+    fprintf(stderr, "\t--%-27s %s\n", "iodepth=NUM", "Number of concurrent requests");
+    fprintf(stderr, "\t--%-27s %s\n", "ioSize=SIZE", "Request size; smaller than the block size means partial blocks");
+    fprintf(stderr, "\t--%-27s %s\n", "prefill", "Write every block before starting");
+    fprintf(stderr, "\t--%-27s %s\n", "readPercent=NUM", "Percentage of reads for mixed profiles");
+    fprintf(stderr, "\t--%-27s %s\n", "runtime=SECONDS", "Duration of the run");
+    fprintf(stderr, "\t--%-27s %s\n", "seed=NUM", "Random number generator seed");
+    fprintf(stderr, "\t--%-27s %s\n", "zipf=THETA", "Zipfian skew (0 <= THETA < 1) of random profiles; 0 means uniform");
+    fprintf(stderr, "Default values:\n");
+    fprintf(stderr, "\t--%-27s %s\n", "profile", DEFAULT_PROFILE);
+    fprintf(stderr, "\t--%-27s %u\n", "iodepth", DEFAULT_IODEPTH);
+    fprintf(stderr, "\t--%-27s %s\n", "ioSize", "the block size");
+    fprintf(stderr, "\t--%-27s %u\n", "readPercent", DEFAULT_READ_PERCENT);
+    fprintf(stderr, "\t--%-27s %u\n", "runtime", DEFAULT_RUNTIME);
+    fprintf(stderr, "\t--%-27s %u\n", "seed", DEFAULT_SEED);
+}
+
+static void *
+bench_thread_main(void *arg)
+{
+    struct bench_thread *const t = arg;
+    s3b_block_t block_num;
+    uint64_t counter = 0;
+    double start;
+    u_int off;
+    int is_read;
+    int r;
+
+    while (!stop_threads) {
+
+        // Choose request
+        is_read = params.read_percent == 100
+          || (params.read_percent > 0 && rng_next(&t->rng) % 100 < params.read_percent);
+        bench_pick(t, &block_num, &off);
+
+        // Make written data unique so it isn't mistaken for a zero or duplicate block
+        if (!is_read) {
+            counter++;
+            memcpy(t->buf, &counter, sizeof(counter));
+        }
+
+        // Perform request
+        start = monotonic_time();
+        if (io_blocks == 0) {
+            r = is_read ?
+              (*store->read_block_part)(store, block_num, off, params.io_size, t->buf) :
+              (*store->write_block_part)(store, block_num, off, params.io_size, t->buf);
+        } else if (io_blocks == 1) {
+            r = is_read ?
+              (*store->read_block)(store, block_num, t->buf, NULL, NULL, 0) :
+              (*store->write_block)(store, block_num, t->buf, NULL, NULL, NULL);
+        } else {
+            r = is_read ?
+              read_block_range(store, config->block_size, block_num, io_blocks, t->buf) :
+              write_block_range(store, config->block_size, block_num, io_blocks, t->buf);
+        }
+
+        // Record result
+        if (r != 0) {
+            if (t->errors++ == 0)
+                warnx("thread %u: %s error: %s", t->id, is_read ? "read" : "write", strerror(r));
+            continue;
+        }
+        if (is_read) {
+            latency_record(&t->reads, monotonic_time() - start);
+            t->bytes_read += params.io_size;
+        } else {
+            latency_record(&t->writes, monotonic_time() - start);
+            t->bytes_written += params.io_size;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Choose the location of the next request.
+ */
+static void
+bench_pick(struct bench_thread *t, s3b_block_t *block_nump, u_int *offp)
+{
+    const u_int parts = io_blocks == 0 ? config->block_size / params.io_size : 1;
+    const uint64_t positions = config->num_blocks - (io_blocks > 0 ? io_blocks - 1 : 0);
+    uint64_t pos;
+
+    // Sequential: walk this thread's region, wrapping around at the end
+    if (!params.random) {
+        if (io_blocks == 0) {
+            *block_nump = t->seq_block;
+            *offp = t->seq_off;
+            if ((t->seq_off += params.io_size) < config->block_size)
+                return;
+            t->seq_off = 0;
+            if (++t->seq_block >= t->seq_max)
+                t->seq_block = t->seq_min;
+            return;
+        }
+        if (t->seq_block + io_blocks > t->seq_max)
+            t->seq_block = t->seq_min;
+        *block_nump = t->seq_block;
+        *offp = 0;
+        t->seq_block += io_blocks;
+        return;
+    }
+
+    // Random: uniform, or zipfian with the hot positions scattered across the file
+    if (zipf.n > 0) {
+        pos = zipf_next(&zipf, rng_double(&t->rng));
+        pos = (pos * 0x9e3779b97f4a7c15ULL) % positions;
+    } else
+        pos = rng_next(&t->rng) % positions;
+    *block_nump = (s3b_block_t)pos;
+    *offp = io_blocks == 0 ? (u_int)(rng_next(&t->rng) % parts) * params.io_size : 0;
+}
+
+static void
+bench_report(const char *label, const struct latency_hist *hist, uint64_t bytes, double elapsed)
+{
+    char name[64];
+
+    snvprintf(name, sizeof(name), "%s_requests", label);
+    printf("%-28s %ju\n", name, (uintmax_t)hist->count);
+    snvprintf(name, sizeof(name), "%s_iops", label);
+    printf("%-28s %.1f\n", name, elapsed > 0.0 ? hist->count / elapsed : 0.0);
+    snvprintf(name, sizeof(name), "%s_throughput", label);
+    printf("%-28s %.3f MiB/sec\n", name, elapsed > 0.0 ? bytes / elapsed / (1024.0 * 1024.0) : 0.0);
+    snvprintf(name, sizeof(name), "%s_avg_time", label);
+    printf("%-28s %.6f sec\n", name, hist->count > 0 ? hist->time / hist->count : 0.0);
+    snvprintf(name, sizeof(name), "%s_p50_time", label);
+    printf("%-28s %.3f sec\n", name, latency_percentile(hist, 50));
+    snvprintf(name, sizeof(name), "%s_p90_time", label);
+    printf("%-28s %.3f sec\n", name, latency_percentile(hist, 90));
+    snvprintf(name, sizeof(name), "%s_p99_time", label);
+    printf("%-28s %.3f sec\n", name, latency_percentile(hist, 99));
+}
+
+static void
+bench_print(void *prarg, const char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    vfprintf(stdout, fmt, args);
+    va_end(args);
+}
+
+static void
+zipf_init(struct zipf *z, uint64_t n, double theta)
+{
+    double zeta2;
+    uint64_t i;
+
+    z->n = n;
+    z->theta = theta;
+    z->alpha = 1.0 / (1.0 - theta);
+    z->zetan = 0.0;
+    for (i = 1; i <= n; i++)
+        z->zetan += 1.0 / pow((double)i, theta);
+    zeta2 = 1.0 + 1.0 / pow(2.0, theta);
+    z->eta = (1.0 - pow(2.0 / (double)n, 1.0 - theta)) / (1.0 - zeta2 / z->zetan);
+}
+
+/*
+ * Map a uniform value in [0, 1) to a zipfian rank in [0, n), with rank zero being the most popular.
+ */
+static uint64_t
+zipf_next(const struct zipf *z, double u)
+{
+    const double uz = u * z->zetan;
+    uint64_t rank;
+
+    if (uz < 1.0)
+        return 0;
+    if (uz < 1.0 + pow(0.5, z->theta))
+        return 1;
+    rank = (uint64_t)((double)z->n * pow(z->eta * u - z->eta + 1.0, z->alpha));
+    return rank < z->n ? rank : z->n - 1;
+}
+
+// xorshift64*
+static uint64_t
+rng_next(uint64_t *state)
+{
+    uint64_t x = *state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545f4914f6cdd1dULL;
+}
+
+static double
+rng_double(uint64_t *state)
+{
+    return (double)(rng_next(state) >> 11) / (double)(1ULL << 53);
+}
+
+static void
+catch_signal(int sig)
+{
+    stop_threads = 1;
+}
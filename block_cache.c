@@ -36,6 +36,7 @@
 
 #include "s3backer.h"
 #include "block_cache.h"
+#include "ctier.h"
 #include "dcache.h"
 #include "hash.h"
 #include "util.h"
@@ -79,6 +80,46 @@
  *
  * Only CLEAN and CLEAN2 blocks are eligible to be evicted from the cache. We evict entries
  * either when they timeout or the cache is full and we need to add a new entry to it.
+ *
+ * With the "2q" eviction policy, low priority clean blocks are further split to resist
+ * flushing of the working set by large scans. New blocks go into the new_cleans list, which
+ * is limited to a fraction of the cache and evicted first. When a block is evicted from
+ * new_cleans, its block number is remembered in a "ghost" list; if the block is loaded again
+ * while still remembered, it is considered frequently used and goes into lo_cleans instead.
+ * A block read only once (e.g., by a scan) therefore never displaces blocks in lo_cleans.
+ *
+ * To reduce contention on the mutex, the cache may be split into config->num_shards shards.
+ * Each shard is a complete block cache instance (with its own mutex, hashtable, lists, and
+ * worker threads) that owns every block in every num_shards'th run of SHARD_CHUNK_BLOCKS
+ * blocks; a thin top level instance dispatches each operation to the owning shard(s). The
+ * chunking keeps sequential streams within a single shard for read-ahead. Shards never
+ * touch blocks they don't own, so no cross-shard locking is required. Sharding is not
+ * supported with a cache file.
+ *
+ * With config->partial_writes, a write of part of a block that is not in the cache does not wait
+ * to read the rest of the block first. Instead, the block becomes DIRTY with a "partial" record
+ * in priv->partials noting which SECTOR_SIZE sectors hold valid data. The missing sectors are
+ * read and merged only when needed: when a reader wants them, when a later write only partly
+ * covers one of them, or when the block is written back. If the block gets completely overwritten
+ * first, they are never read at all. Only DIRTY and WRITING[2] blocks can be partial; partial
+ * writes are not supported with a cache file.
+ *
+ * With config->hot_file, we save the block numbers of the blocks in the cache to that file at shutdown
+ * and (at most every HOT_SAVE_INTERVAL milliseconds) when all blocks are flushed, in priority order:
+ * high priority clean blocks, then the other clean blocks (frequent before new under 2Q), each from most
+ * to least recently used, then dirty blocks. On the next startup, worker threads with nothing better to
+ * do read those blocks back into the cache, using at most config->prefetch_threads threads at a time and
+ * never evicting anything to make room. Blocks still in the cache file are already present and skipped.
+ * Blocks hinted via prefetch_blocks() are appended to the same list and read back the same way, except that
+ * they may evict clean blocks just like a normal read would; once the cache is full, any hot blocks still
+ * ahead of them in the list are discarded.
+ *
+ * Hot file format:
+ *
+ *  [ struct hot_header ]
+ *  s3b_block_t hottest block
+ *  s3b_block_t next hottest block
+ *  ...
  */
 
 // Cache entry states
@@ -114,8 +155,8 @@
  *  WRITING2    NO                  YES      NO               ?     allocated
  *
  * Timeouts: we track time in units of TIME_UNIT_MILLIS milliseconds from when we start.
- * This is so we can jam them into 30 bits instead of 64. It's possible for the time value
- * to wrap after about two years; the effect would be mis-timed writes and evictions.
+ * This is so we can jam them into 29 bits instead of 64. It's possible for the time value
+ * to wrap after about one year; the effect would be mis-timed writes and evictions.
  *
  * In state CLEAN2 only, the ETag to verify immediately follows the structure.
  */
@@ -123,7 +164,8 @@ struct cache_entry {
     s3b_block_t                     block_num;      // block number - MUST BE FIRST
     u_int                           dirty:1;        // indicates state DIRTY or WRITING2
     u_int                           verify:1;       // data should be verified first
-    uint32_t                        timeout:30;     // when to evict (CLEAN[2]) or write (DIRTY)
+    u_int                           frequent:1;     // block was recently evicted and reloaded (2Q only)
+    uint32_t                        timeout:29;     // when to evict (CLEAN[2]) or write (DIRTY)
     TAILQ_ENTRY(cache_entry)        link;           // next in list (cleans or dirties)
     union {
         void                        *data;          // data buffer in memory
@@ -147,11 +189,122 @@ struct cache_entry {
 #define DIRTY_RATIO_WRITE_ASAP      0.90            // 90%
 
 // Special timeout value for entries in state READING and READING2
-#define READING_TIMEOUT             ((uint32_t)0x3fffffff)
+#define READING_TIMEOUT             ((uint32_t)0x1fffffff)
+
+// Fraction of cache that new_cleans may occupy before it is evicted first (2Q only)
+#define TWOQ_NEW_RATIO              0.25
+
+// Number of ghost entries to remember as a fraction of cache size (2Q only)
+#define TWOQ_GHOST_RATIO            0.50
+
+// Granularity of valid data tracking for partially written blocks
+#define SECTOR_SIZE                 512
+
+// Hot block file definitions
+#define HOT_SIGNATURE               0x5b07e1a9
+#define HOT_TEMP_SUFFIX             ".new"
+#define HOT_SAVE_INTERVAL           60000           // 60s
 
 // Declare the list "head" struct
 TAILQ_HEAD(list_head, cache_entry);
 
+// Hot block file header
+struct hot_header {
+    uint32_t                        signature;
+    uint32_t                        header_size;
+    uint32_t                        entry_size;
+    uint32_t                        block_size;
+    uint32_t                        num_entries;
+    uint32_t                        crc;            // CRC-32 of the entries
+} __attribute__ ((packed));
+
+/*
+ * The valid sectors of a partially written block (see config->partial_writes).
+ */
+struct partial_entry {
+    s3b_block_t                     block_num;      // block number - MUST BE FIRST
+    int                             filling;        // a thread is reading the missing sectors
+    bitmap_t                        valid[0];       // sectors containing valid data
+};
+
+/*
+ * A block that one or more threads are waiting to have written back (see block_cache_flush_blocks2()).
+ */
+struct flush_waiter {
+    s3b_block_t                     block_num;      // block number - MUST BE FIRST
+    u_int                           count;          // number of waiting threads
+};
+
+/*
+ * The block number of a block recently evicted from new_cleans (2Q only).
+ */
+struct ghost_entry {
+    s3b_block_t                     block_num;      // block number - MUST BE FIRST
+    TAILQ_ENTRY(ghost_entry)        link;           // next in list
+};
+TAILQ_HEAD(ghost_head, ghost_entry);
+
+/*
+ * A multi-block read in progress. Worker threads help out by claiming blocks from
+ * the front of the range and reading them into the cache, while the calling thread
+ * copies blocks out of the cache in order. The structure lives on the caller's stack
+ * and remains in the 'fetches' list as long as there are unclaimed blocks.
+ */
+struct block_fetch {
+    s3b_block_t                     block_num;      // first block in range
+    u_int                           num_blocks;     // number of blocks in range
+    u_int                           next;           // index of next unclaimed block
+    int                             queued;         // this fetch is in priv->fetches
+    TAILQ_ENTRY(block_fetch)        link;           // next in list
+};
+TAILQ_HEAD(fetch_head, block_fetch);
+
+/*
+ * Read-ahead stream detection.
+ *
+ * We track up to config->read_ahead_streams independent streams of reads from the upper layer.
+ * Each stream may proceed forward, backward, or with a fixed stride of up to RA_MAX_STRIDE blocks.
+ * Once a stream has seen config->read_ahead_trigger reads, worker threads read ahead of it by up
+ * to 'window' blocks. When all streams are in use, the least recently used stream is replaced.
+ *
+ * The window starts at config->read_ahead and adapts between that and config->read_ahead_max.
+ * It grows when the upper layer catches up with a read-ahead block still being read, or when the
+ * measured read latency of the underlying store divided by the stream's average interval between
+ * reads indicates that more blocks need to be in flight to keep up. It shrinks when read-ahead
+ * blocks turn out to have been evicted before being used.
+ */
+struct ra_stream {
+    s3b_block_t                     last;           // last block read by upper layer
+    int                             stride;         // distance between consecutive reads, or zero if not known
+    u_int                           count;          // # of blocks read by upper layer (zero if slot unused)
+    u_int                           ra_count;       // # of blocks of read-ahead initiated beyond 'last'
+    u_int                           window;         // current read-ahead window
+    uint64_t                        last_time;      // time of last read in milliseconds
+    double                          interval;       // average milliseconds between reads
+    uint64_t                        lru;            // value of priv->ra_clock when last used
+};
+
+// Maximum read-ahead stride
+#define RA_MAX_STRIDE               16
+
+// Weight given to each new sample in moving averages
+#define RA_AVERAGE_WEIGHT           0.125
+
+// Number of consecutive blocks assigned to the same shard
+#define SHARD_CHUNK_BLOCKS          256
+
+// Maximum number of clean blocks read from the cache file, or missing blocks read from the underlying store, in one batch
+#define READ_BATCH_MAX_BLOCKS       32
+
+// Maximum number of pending background reads of blocks previously read in part using a range read
+#define RANGE_FETCH_MAX             64
+
+// Writeback classes, in priority order; each class of DIRTY blocks has its own list in priv->dirties[]
+#define WB_FLUSH                    0               // blocks some thread is waiting to have flushed
+#define WB_PRIORITY                 1               // blocks within config->priority_blocks
+#define WB_BACKGROUND               2               // all other blocks
+#define WB_NUM_CLASSES              3
+
 // Private data
 struct block_cache_private {
     struct block_cache_conf         *config;        // configuration
@@ -159,32 +312,68 @@ struct block_cache_private {
     struct block_cache_stats        stats;          // statistics
     struct list_head                lo_cleans;      // list of low priority clean blocks (LRU order)
     struct list_head                hi_cleans;      // list of high priority clean blocks (LRU order)
-    struct list_head                dirties;        // list of dirty blocks (write order)
+    struct list_head                new_cleans;     // list of low priority clean blocks not yet frequent (LRU order)
+    struct ghost_head               ghosts;         // blocks recently evicted from 'new_cleans' (FIFO order)
+    struct s3b_hash                 *ghost_table;   // hashtable of 'ghosts'
+    struct list_head                dirties[WB_NUM_CLASSES];// lists of dirty blocks in each writeback class (write order)
+    struct s3b_hash                 *flushing;      // hashtable of blocks being waited on in block_cache_flush_blocks2()
+    u_int                           num_writing[WB_NUM_CLASSES];// number of worker threads writing each class
+    u_int                           wb_limit[WB_NUM_CLASSES];// max worker threads writing each class, or zero for no limit
+    struct fetch_head               fetches;        // multi-block reads with unclaimed blocks
+    s3b_block_t                     range_fetches[RANGE_FETCH_MAX];// blocks to read in the background (circular)
+    u_int                           range_fetch_first;// index of first block in 'range_fetches'
+    u_int                           num_range_fetches;// number of blocks in 'range_fetches'
+    s3b_block_t                     *prefetch;      // hot blocks from the previous run, etc., to read in the background
+    u_int                           num_prefetch;   // length of 'prefetch'
+    u_int                           prefetch_alloc; // allocated length of 'prefetch'
+    u_int                           prefetch_next;  // index of next unclaimed block in 'prefetch'
+    u_int                           num_prefetching;// number of worker threads reading 'prefetch' blocks
+    u_int                           prefetch_hints; // index in 'prefetch' of the first block hinted via prefetch_blocks()
+    uint64_t                        hot_saved;      // when we last saved config->hot_file, in milliseconds
     struct s3b_hash                 *hashtable;     // hashtable of all cached blocks
+    struct s3b_hash                 *partials;      // hashtable of partially written blocks, or NULL if disabled
+    u_int                           num_sectors;    // number of SECTOR_SIZE sectors per block
     struct s3b_dcache               *dcache;        // on-disk persistent cache
-    u_int                           num_cleans;     // combined lengths of 'lo_cleans' and 'hi_cleans'
+    struct s3b_ctier                *ctier;         // compressed copies of evicted clean blocks, or NULL if disabled
+    u_int                           store_encoded;  // store clean blocks in the cache file as read from 'inner'
+    u_int                           num_cleans;     // combined lengths of 'lo_cleans', 'hi_cleans', and 'new_cleans'
+    u_int                           num_new_cleans; // length of 'new_cleans'
+    u_int                           max_new_cleans; // length of 'new_cleans' beyond which it is evicted first
+    u_int                           max_ghosts;     // maximum length of 'ghosts' (zero unless using 2Q)
     u_int                           num_dirties;    // # blocks that are DIRTY, WRITING, or WRITING2
     u_int64_t                       start_time;     // when we started
     u_int32_t                       clean_timeout;  // timeout for clean entries in time units
     u_int32_t                       dirty_timeout;  // timeout for dirty entries in time units
     double                          max_dirty_ratio;// dirty ratio at which we write immediately
-    s3b_block_t                     seq_last;       // last block read in sequence by upper layer
-    u_int                           seq_count;      // # of blocks read in sequence by upper layer
-    u_int                           ra_count;       // # of blocks of read-ahead initiated
+    struct ra_stream                *streams;       // read-ahead streams
+    u_int                           num_streams;    // length of 'streams' (zero if read-ahead disabled)
+    uint64_t                        ra_clock;       // incremented on each read (for stream LRU replacement)
+    double                          read_latency;   // average underlying read latency in milliseconds
     u_int                           thread_id;      // next thread id
     u_int                           num_threads;    // number of alive worker threads
     pthread_t                       *threads;       // worker threads
     int                             stopping;       // signals worker threads to exit
     block_list_func_t               *survey_callback;// non-zero survey is running and this is the callback
     void                            *survey_arg;    // non-zero survey is running and this is the arg
+    u_int                           shard;          // my shard index (if sharded)
+    u_int                           num_shards;     // total number of shards, or zero if not sharded
     pthread_mutex_t                 mutex;          // my mutex
     pthread_cond_t                  space_avail;    // there is new space available in cache
-    pthread_cond_t                  end_reading;    // some entry in state READING[2] changed state
+    pthread_cond_t                  end_reading;    // some entry in state READING[2] changed state, or a fill finished
     pthread_cond_t                  worker_work;    // there is new work for worker thread(s)
     pthread_cond_t                  worker_exit;    // a worker thread has exited
     pthread_cond_t                  write_complete; // a write has completed
 };
 
+// Private data for the top level of a sharded cache
+struct block_cache_shards {
+    struct block_cache_conf         *config;        // configuration
+    struct s3backer_store           *inner;         // underlying s3backer store
+    struct block_cache_conf         *confs;         // per-shard configurations
+    struct s3backer_store           **shards;       // shards
+    u_int                           num_shards;     // number of shards
+};
+
 // s3backer_store functions
 static int block_cache_create_threads(struct s3backer_store *s3b);
 static int block_cache_meta_data(struct s3backer_store *s3b, off_t *file_sizep, u_int *block_sizep);
@@ -195,34 +384,113 @@ static int block_cache_write_block(struct s3backer_store *s3b, s3b_block_t block
   check_cancel_t *check_cancel, void *check_cancel_arg);
 static int block_cache_read_block_part(struct s3backer_store *s3b, s3b_block_t block_num, u_int off, u_int len, void *dest);
 static int block_cache_write_block_part(struct s3backer_store *s3b, s3b_block_t block_num, u_int off, u_int len, const void *src);
+static int block_cache_read_blocks(struct s3backer_store *s3b, s3b_block_t block_num, u_int num_blocks, void *dest);
+static int block_cache_write_blocks(struct s3backer_store *s3b, s3b_block_t block_num, u_int num_blocks, const void *src,
+    u_char *etags, check_cancel_t *check_cancel, void *check_cancel_arg);
 static int block_cache_flush_blocks(struct s3backer_store *s3b, const s3b_block_t *block_nums, u_int num_blocks, long timeout);
 static int block_cache_flush_blocks2(struct s3backer_store *s3b, const s3b_block_t *block_nums, u_int num_blocks, long timeout);
-static int block_cache_survey_non_zero(struct s3backer_store *s3b, block_list_func_t *callback, void *arg);
+static int block_cache_survey_non_zero(struct s3backer_store *s3b, const struct survey_params *params);
+static int block_cache_prefetch_blocks(struct s3backer_store *s3b, s3b_block_t block_num, u_int num_blocks);
 static int block_cache_shutdown(struct s3backer_store *s3b);
 static void block_cache_destroy(struct s3backer_store *s3b);
 
+// Sharded s3backer_store functions
+static int block_cache_shards_create_threads(struct s3backer_store *s3b);
+static int block_cache_shards_meta_data(struct s3backer_store *s3b, off_t *file_sizep, u_int *block_sizep);
+static int block_cache_shards_set_mount_token(struct s3backer_store *s3b, int32_t *old_valuep, int32_t new_value);
+static int block_cache_shards_read_block(struct s3backer_store *s3b, s3b_block_t block_num, void *dest,
+  u_char *actual_etag, const u_char *expect_etag, int strict);
+static int block_cache_shards_write_block(struct s3backer_store *s3b, s3b_block_t block_num, const void *src, u_char *etag,
+  check_cancel_t *check_cancel, void *check_cancel_arg);
+static int block_cache_shards_read_block_part(struct s3backer_store *s3b, s3b_block_t block_num, u_int off, u_int len,
+  void *dest);
+static int block_cache_shards_write_block_part(struct s3backer_store *s3b, s3b_block_t block_num, u_int off, u_int len,
+  const void *src);
+static int block_cache_shards_read_blocks(struct s3backer_store *s3b, s3b_block_t block_num, u_int num_blocks, void *dest);
+static int block_cache_shards_write_blocks(struct s3backer_store *s3b, s3b_block_t block_num, u_int num_blocks,
+  const void *src, u_char *etags, check_cancel_t *check_cancel, void *check_cancel_arg);
+static int block_cache_shards_flush_blocks(struct s3backer_store *s3b, const s3b_block_t *block_nums, u_int num_blocks,
+  long timeout);
+static int block_cache_shards_survey_non_zero(struct s3backer_store *s3b, const struct survey_params *params);
+static int block_cache_shards_prefetch_blocks(struct s3backer_store *s3b, s3b_block_t block_num, u_int num_blocks);
+static int block_cache_shards_shutdown(struct s3backer_store *s3b);
+static void block_cache_shards_destroy(struct s3backer_store *s3b);
+
 // Other functions
+static struct s3backer_store *block_cache_create2(struct block_cache_conf *config, struct s3backer_store *inner,
+  u_int shard, u_int num_shards);
+static struct s3backer_store *block_cache_shards_create(struct block_cache_conf *config, struct s3backer_store *inner);
+static struct s3backer_store *block_cache_shard_for(struct block_cache_shards *priv, s3b_block_t block_num);
+static u_int block_cache_shard_index(u_int num_shards, s3b_block_t block_num);
+static int block_cache_survey_start(struct block_cache_private *priv, block_list_func_t *callback, void *arg);
+static void block_cache_survey_finish(struct block_cache_private *priv);
 static s3b_dcache_visit_t block_cache_dcache_load;
 static s3b_hash_visit_t block_cache_append_block_list;
 static int block_cache_read(struct block_cache_private *priv, s3b_block_t block_num, u_int off, u_int len, void *dest);
+static int block_cache_range_read(struct block_cache_private *priv, s3b_block_t block_num, u_int off, u_int len,
+  void *dest);
+static void block_cache_track_read(struct block_cache_private *priv, s3b_block_t block_num);
+static void block_cache_ra_adapt(struct block_cache_private *priv, struct ra_stream *stream, s3b_block_t block_num,
+  uint64_t now);
+static struct ra_stream *block_cache_ra_ready(struct block_cache_private *priv);
 static int block_cache_do_read(struct block_cache_private *priv, s3b_block_t block_num, u_int off, u_int len, void *dest, int stats);
-static int block_cache_write(struct block_cache_private *priv, s3b_block_t block_num, u_int off, u_int len, const void *src);
+static int block_cache_read_misses(struct block_cache_private *priv, s3b_block_t block_num, u_int max_blocks, void *dest,
+    u_int *nump);
+static int block_cache_read_batch(struct block_cache_private *priv, s3b_block_t block_num, u_int max_blocks, void *dest,
+    u_int *nump);
+static void block_cache_count_hit(struct block_cache_private *priv, struct cache_entry *entry);
+static int block_cache_write(struct block_cache_private *priv, s3b_block_t block_num, u_int off, u_int len, const void *src,
+  int sync);
+static void block_cache_wait_written(struct block_cache_private *priv, s3b_block_t block_num);
+static void block_cache_unqueue_fetch(struct block_cache_private *priv, struct block_fetch *fetch);
+static int block_cache_space_available(struct block_cache_private *priv);
 static void *block_cache_worker_main(void *arg);
+static int block_cache_write_coalesced(struct block_cache_private *priv, struct cache_entry *entry, u_int wbclass, void *buf,
+    u_char *etags);
+static struct cache_entry *block_cache_next_dirty(struct block_cache_private *priv, uint32_t now, u_int *wbclassp,
+    struct cache_entry **waitp);
+static struct list_head *block_cache_dirty_list(struct block_cache_private *priv, struct cache_entry *entry);
+static int block_cache_have_dirties(struct block_cache_private *priv);
+static int block_cache_flush_wait(struct block_cache_private *priv, s3b_block_t block_num);
+static void block_cache_flush_unwait(struct block_cache_private *priv, s3b_block_t block_num);
+static void block_cache_count_writeback(struct block_cache_private *priv, u_int wbclass, u_int num_blocks);
+static void block_cache_write_complete(struct block_cache_private *priv, struct cache_entry *entry, const u_char *etag,
+  uint32_t now);
 static int block_cache_check_cancel(void *arg, s3b_block_t block_num);
+static struct partial_entry *block_cache_partial_get(struct block_cache_private *priv, s3b_block_t block_num);
+static struct partial_entry *block_cache_partial_new(struct block_cache_private *priv, s3b_block_t block_num);
+static void block_cache_partial_free(struct block_cache_private *priv, struct partial_entry *part);
+static int block_cache_partial_covers(struct block_cache_private *priv, struct partial_entry *part, u_int off, u_int len);
+static void block_cache_partial_mark(struct block_cache_private *priv, struct partial_entry *part, u_int off, u_int len);
+static void block_cache_partial_merge(struct block_cache_private *priv, const bitmap_t *valid, const void *src, void *dest);
+static int block_cache_partial_fill(struct block_cache_private *priv, struct cache_entry *entry, struct partial_entry *part);
 static int block_cache_get_entry(struct block_cache_private *priv, struct cache_entry **entryp, void **datap);
 static void block_cache_free_entry(struct block_cache_private *priv, struct cache_entry **entryp);
+static void block_cache_evict_compressed(struct block_cache_private *priv, struct cache_entry *entry);
 static s3b_hash_visit_t block_cache_free_one;
 static struct cache_entry *block_cache_verified(struct block_cache_private *priv, struct cache_entry *entry);
 static double block_cache_dirty_ratio(struct block_cache_private *priv);
 static void block_cache_worker_wait(struct block_cache_private *priv, struct cache_entry *entry);
 static int block_cache_cond_timedwait(struct block_cache_private *priv, pthread_cond_t *cond, uint64_t wake_time_millis);
-static struct list_head *block_cache_cleans_list(struct block_cache_private *priv, s3b_block_t block_num);
+static struct list_head *block_cache_cleans_list(struct block_cache_private *priv, struct cache_entry *entry);
+static void block_cache_clean_insert(struct block_cache_private *priv, struct cache_entry *entry);
+static void block_cache_clean_remove(struct block_cache_private *priv, struct cache_entry *entry);
+static struct cache_entry *block_cache_evict_candidate(struct block_cache_private *priv);
+static void block_cache_ghost_add(struct block_cache_private *priv, s3b_block_t block_num);
+static int block_cache_ghost_take(struct block_cache_private *priv, s3b_block_t block_num);
+static s3b_hash_visit_t block_cache_free_ghost;
 static int block_cache_high_prio(struct block_cache_conf *conf, s3b_block_t block_num);
 static uint32_t block_cache_get_time(struct block_cache_private *priv);
 static uint64_t block_cache_get_time_millis(void);
 static int block_cache_read_data(struct block_cache_private *priv, struct cache_entry *entry, void *dest, u_int off, u_int len);
+static int block_cache_decode(struct block_cache_private *priv, s3b_block_t block_num, const void *src, void *dest,
+    u_int off, u_int len);
 static int block_cache_write_data(struct block_cache_private *priv, struct cache_entry *entry, const void *src, u_int off,
   u_int len);
+static int block_cache_hot_load(struct block_cache_private *priv);
+static void block_cache_hot_save(struct block_cache_private *priv);
+static int block_cache_hot_list(struct block_cache_private *priv, struct block_list *list);
+static int block_cache_hot_io(int fd, void *buf, size_t len, int writing);
 
 // Invariants checking
 #ifndef NDEBUG
@@ -241,10 +509,23 @@ static s3b_hash_visit_t block_cache_check_one;
  */
 struct s3backer_store *
 block_cache_create(struct block_cache_conf *config, struct s3backer_store *inner)
+{
+    if (config->num_shards > 1)
+        return block_cache_shards_create(config, inner);
+    return block_cache_create2(config, inner, 0, 0);
+}
+
+/*
+ * Create a block cache instance. If "num_shards" is non-zero, the instance is shard number "shard"
+ * and the lifecycle of the inner store (creating threads, shutdown, and destroy) is left to the caller.
+ */
+static struct s3backer_store *
+block_cache_create2(struct block_cache_conf *config, struct s3backer_store *inner, u_int shard, u_int num_shards)
 {
     struct s3backer_store *s3b;
     struct block_cache_private *priv;
     struct cache_entry *entry;
+    u_int i;
     int r;
 
     // Initialize s3backer_store structure
@@ -260,9 +541,13 @@ block_cache_create(struct block_cache_conf *config, struct s3backer_store *inner
     s3b->write_block = block_cache_write_block;
     s3b->read_block_part = block_cache_read_block_part;
     s3b->write_block_part = block_cache_write_block_part;
+    s3b->read_blocks = block_cache_read_blocks;
+    s3b->write_blocks = block_cache_write_blocks;
     s3b->flush_blocks = block_cache_flush_blocks;
     s3b->bulk_zero = generic_bulk_zero;
     s3b->survey_non_zero = block_cache_survey_non_zero;
+    if (config->prefetch_threads > 0)
+        s3b->prefetch_blocks = block_cache_prefetch_blocks;
     s3b->shutdown = block_cache_shutdown;
     s3b->destroy = block_cache_destroy;
 
@@ -274,6 +559,8 @@ block_cache_create(struct block_cache_conf *config, struct s3backer_store *inner
     }
     priv->config = config;
     priv->inner = inner;
+    priv->shard = shard;
+    priv->num_shards = num_shards;
     priv->start_time = block_cache_get_time_millis();
     priv->clean_timeout = (config->timeout + TIME_UNIT_MILLIS - 1) / TIME_UNIT_MILLIS;
     priv->dirty_timeout = (config->write_delay + TIME_UNIT_MILLIS - 1) / TIME_UNIT_MILLIS;
@@ -291,13 +578,67 @@ block_cache_create(struct block_cache_conf *config, struct s3backer_store *inner
         goto fail7;
     if ((priv->threads = calloc(config->num_threads, sizeof(*priv->threads))) == NULL)
         goto fail8;
+    if (config->read_ahead > 0) {
+        if ((priv->streams = calloc(config->read_ahead_streams, sizeof(*priv->streams))) == NULL) {
+            r = errno;
+            goto fail9;
+        }
+        priv->num_streams = config->read_ahead_streams;
+    }
     TAILQ_INIT(&priv->lo_cleans);
     TAILQ_INIT(&priv->hi_cleans);
-    TAILQ_INIT(&priv->dirties);
+    TAILQ_INIT(&priv->new_cleans);
+    for (i = 0; i < WB_NUM_CLASSES; i++)
+        TAILQ_INIT(&priv->dirties[i]);
+    TAILQ_INIT(&priv->fetches);
+    TAILQ_INIT(&priv->ghosts);
     if ((r = s3b_hash_create(&priv->hashtable, config->cache_size)) != 0)
-        goto fail9;
+        goto fail10;
+    if ((r = s3b_hash_create(&priv->flushing, config->cache_size)) != 0)
+        goto fail11;
+    priv->wb_limit[WB_PRIORITY] = config->priority_threads;
+    priv->wb_limit[WB_BACKGROUND] = config->background_threads;
     s3b->data = priv;
 
+    // Initialize 2Q eviction
+    if (strcmp(config->eviction, BLOCK_CACHE_EVICTION_2Q) == 0) {
+        priv->max_new_cleans = (u_int)(config->cache_size * TWOQ_NEW_RATIO);
+        priv->max_ghosts = (u_int)(config->cache_size * TWOQ_GHOST_RATIO);
+        if (priv->max_ghosts < 1)
+            priv->max_ghosts = 1;
+        if ((r = s3b_hash_create(&priv->ghost_table, priv->max_ghosts)) != 0)
+            goto fail12;
+    }
+
+    // Initialize partial write tracking
+    if (config->partial_writes) {
+        if (config->cache_file != NULL || config->block_size % SECTOR_SIZE != 0)
+            (*config->log)(LOG_WARNING, "partial block writes require an in-memory cache and block size multiple of %u",
+              SECTOR_SIZE);
+        else {
+            priv->num_sectors = config->block_size / SECTOR_SIZE;
+            if ((r = s3b_hash_create(&priv->partials, config->cache_size)) != 0)
+                goto fail12;
+        }
+    }
+
+    // Initialize compressed tier
+    if (config->compressed_size != 0) {
+        if (config->cache_file != NULL)
+            (*config->log)(LOG_WARNING, "a compressed block cache tier requires an in-memory cache");
+        else if ((r = s3b_ctier_create(&priv->ctier, config->log, config->block_size, config->compressed_size,
+          config->compressed_alg, config->compressed_level)) != 0)
+            goto fail12;
+    }
+
+    // Store blocks in the cache file in encoded form if so configured
+    if (config->store_encoded) {
+        if (config->cache_file == NULL || inner->read_block_encoded == NULL)
+            (*config->log)(LOG_WARNING, "storing encoded blocks requires a cache file and compression or encryption");
+        else
+            priv->store_encoded = 1;
+    }
+
     // Compute dirty ratio at which we will be writing immediately
     priv->max_dirty_ratio = (double)(config->max_dirty != 0 ? config->max_dirty : config->cache_size) / (double)config->cache_size;
     if (priv->max_dirty_ratio > DIRTY_RATIO_WRITE_ASAP)
@@ -306,7 +647,7 @@ block_cache_create(struct block_cache_conf *config, struct s3backer_store *inner
     // Initialize on-disk cache and read in directory
     if (config->cache_file != NULL) {
         if ((r = s3b_dcache_open(&priv->dcache, config, block_cache_dcache_load, priv, config->perform_flush)) != 0)
-            goto fail10;
+            goto fail12;
         if (config->perform_flush && priv->num_dirties > 0)
             (*config->log)(LOG_INFO, "%u dirty blocks in cache file `%s' will be recovered", priv->num_dirties, config->cache_file);
         priv->stats.initial_size = priv->num_cleans + priv->num_dirties;
@@ -320,7 +661,7 @@ block_cache_create(struct block_cache_conf *config, struct s3backer_store *inner
     CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
     return s3b;
 
-fail10:
+fail12:
     if (config->cache_file != NULL) {
         while ((entry = TAILQ_FIRST(&priv->lo_cleans)) != NULL) {
             TAILQ_REMOVE(&priv->lo_cleans, entry, link);
@@ -333,7 +674,17 @@ fail10:
         if (priv->dcache != NULL)
             s3b_dcache_close(priv->dcache);
     }
+    if (priv->ctier != NULL)
+        s3b_ctier_destroy(priv->ctier);
+    if (priv->partials != NULL)
+        s3b_hash_destroy(priv->partials);
+    if (priv->ghost_table != NULL)
+        s3b_hash_destroy(priv->ghost_table);
+    s3b_hash_destroy(priv->flushing);
+fail11:
     s3b_hash_destroy(priv->hashtable);
+fail10:
+    free(priv->streams);
 fail9:
     free(priv->threads);
 fail8:
@@ -367,7 +718,6 @@ block_cache_dcache_load(void *arg, s3b_block_t dslot, s3b_block_t block_num, con
     const u_int dirty = etag == NULL;
     struct block_cache_private *const priv = arg;
     struct block_cache_conf *const config = priv->config;
-    struct list_head *const cleans_list = block_cache_cleans_list(priv, block_num);
     struct cache_entry *entry;
     int r;
 
@@ -391,27 +741,230 @@ block_cache_dcache_load(void *arg, s3b_block_t dslot, s3b_block_t block_num, con
         return r;
     }
     entry->block_num = block_num;
+    entry->frequent = priv->max_ghosts > 0;             // blocks that survived in the cache file are presumed useful
     entry->timeout = block_cache_get_time(priv) + priv->clean_timeout;
     entry->u.dslot = dslot;
 
     // Mark as clean or dirty accordingly
     if (dirty) {
         entry->dirty = 1;
-        TAILQ_INSERT_TAIL(&priv->dirties, entry, link);
+        TAILQ_INSERT_TAIL(block_cache_dirty_list(priv, entry), entry, link);
         priv->num_dirties++;
         assert(ENTRY_GET_STATE(entry) == DIRTY);
     } else {
         entry->verify = !config->no_verify;
         if (entry->verify)
             memcpy(&entry->etag, etag, MD5_DIGEST_LENGTH);
-        TAILQ_INSERT_TAIL(cleans_list, entry, link);
-        priv->num_cleans++;
+        block_cache_clean_insert(priv, entry);
         assert(ENTRY_GET_STATE(entry) == (config->no_verify ? CLEAN : CLEAN2));
     }
     s3b_hash_put_new(priv->hashtable, entry);
     return 0;
 }
 
+/*
+ * Load the hot block list saved by the previous run, to be read in the background by the worker threads.
+ *
+ * A missing, stale, or corrupted file is not an error; we just start cold.
+ */
+static int
+block_cache_hot_load(struct block_cache_private *priv)
+{
+    struct block_cache_conf *const config = priv->config;
+    struct hot_header header;
+    s3b_block_t *blocks;
+    size_t entries_len;
+    struct stat sb;
+    uLong crc;
+    int fd;
+    int r;
+
+    // Open file
+    if ((fd = open(config->hot_file, O_RDONLY|O_CLOEXEC)) == -1) {
+        if ((r = errno) != ENOENT)
+            (*config->log)(LOG_WARNING, "can't open hot block file `%s': %s", config->hot_file, strerror(r));
+        return 0;
+    }
+
+    // Read and verify header
+    if (fstat(fd, &sb) == -1 || (r = block_cache_hot_io(fd, &header, sizeof(header), 0)) != 0)
+        goto invalid;
+    entries_len = (size_t)header.num_entries * sizeof(*blocks);
+    if (header.signature != HOT_SIGNATURE
+      || header.header_size != sizeof(header)
+      || header.entry_size != sizeof(*blocks)
+      || header.block_size != config->block_size
+      || sb.st_size != (off_t)(sizeof(header) + entries_len))
+        goto invalid;
+
+    // Read entries
+    if ((blocks = malloc(entries_len > 0 ? entries_len : 1)) == NULL) {
+        r = errno;
+        (*config->log)(LOG_ERR, "can't allocate hot block list: %s", strerror(r));
+        priv->stats.out_of_memory_errors++;
+        (void)close(fd);
+        return r;
+    }
+    if ((r = block_cache_hot_io(fd, blocks, entries_len, 0)) != 0)
+        goto invalid2;
+
+    // Verify CRC
+    crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, (const Bytef *)blocks, entries_len);
+    if ((uint32_t)crc != header.crc)
+        goto invalid2;
+    (void)close(fd);
+
+    // There's no point in prefetching more than will fit
+    priv->prefetch = blocks;
+    priv->prefetch_alloc = header.num_entries;
+    priv->num_prefetch = header.num_entries < config->cache_size ? header.num_entries : config->cache_size;
+    if (priv->num_prefetch == 0) {
+        free(priv->prefetch);
+        priv->prefetch = NULL;
+        priv->prefetch_alloc = 0;
+        return 0;
+    }
+    priv->prefetch_hints = priv->num_prefetch;
+    (*config->log)(LOG_INFO, "prefetching %u hot blocks listed in `%s'", priv->num_prefetch, config->hot_file);
+    return 0;
+
+invalid2:
+    free(blocks);
+invalid:
+    (*config->log)(LOG_WARNING, "ignoring invalid hot block file `%s'", config->hot_file);
+    (void)close(fd);
+    return 0;
+}
+
+/*
+ * Save the block numbers of the blocks currently in the cache, hottest first.
+ *
+ * Assumes the mutex is NOT held.
+ */
+static void
+block_cache_hot_save(struct block_cache_private *priv)
+{
+    struct block_cache_conf *const config = priv->config;
+    struct hot_header header;
+    struct block_list list;
+    char *tempfile;
+    uLong crc;
+    int fd;
+    int r;
+
+    // Gather block numbers
+    block_list_init(&list);
+    pthread_mutex_lock(&priv->mutex);
+    priv->hot_saved = block_cache_get_time_millis();
+    r = block_cache_hot_list(priv, &list);
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+    if (r != 0) {
+        (*config->log)(LOG_ERR, "can't save hot block file `%s': %s", config->hot_file, strerror(r));
+        goto done;
+    }
+
+    // Build header
+    crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, (const Bytef *)list.blocks, list.num_blocks * sizeof(*list.blocks));
+    memset(&header, 0, sizeof(header));
+    header.signature = HOT_SIGNATURE;
+    header.header_size = sizeof(header);
+    header.entry_size = sizeof(*list.blocks);
+    header.block_size = config->block_size;
+    header.num_entries = list.num_blocks;
+    header.crc = (uint32_t)crc;
+
+    // Write to a temporary file, then atomically replace the old file
+    if (asprintf(&tempfile, "%s%s", config->hot_file, HOT_TEMP_SUFFIX) == -1) {
+        (*config->log)(LOG_ERR, "can't save hot block file `%s': %s", config->hot_file, strerror(errno));
+        goto done;
+    }
+    if ((fd = open(tempfile, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644)) == -1) {
+        (*config->log)(LOG_ERR, "can't create file `%s': %s", tempfile, strerror(errno));
+        goto done2;
+    }
+    if ((r = block_cache_hot_io(fd, &header, sizeof(header), 1)) != 0
+      || (r = block_cache_hot_io(fd, list.blocks, list.num_blocks * sizeof(*list.blocks), 1)) != 0) {
+        (*config->log)(LOG_ERR, "error writing `%s': %s", tempfile, strerror(r));
+        (void)close(fd);
+        goto fail;
+    }
+    if (fsync(fd) == -1) {
+        (*config->log)(LOG_ERR, "error fsync'ing `%s': %s", tempfile, strerror(errno));
+        (void)close(fd);
+        goto fail;
+    }
+    if (close(fd) == -1) {
+        (*config->log)(LOG_ERR, "error closing `%s': %s", tempfile, strerror(errno));
+        goto fail;
+    }
+    if (rename(tempfile, config->hot_file) == -1) {
+        (*config->log)(LOG_ERR, "error renaming `%s' to `%s': %s", tempfile, config->hot_file, strerror(errno));
+        goto fail;
+    }
+    (*config->log)(LOG_DEBUG, "saved %u hot blocks to `%s'", (u_int)list.num_blocks, config->hot_file);
+    goto done2;
+
+fail:
+    (void)unlink(tempfile);
+done2:
+    free(tempfile);
+done:
+    block_list_free(&list);
+}
+
+/*
+ * List the blocks in the cache in priority order (see the comment at the top of this file).
+ *
+ * Assumes the mutex is held.
+ */
+static int
+block_cache_hot_list(struct block_cache_private *priv, struct block_list *list)
+{
+    struct list_head *const cleans[] = { &priv->hi_cleans, &priv->lo_cleans, &priv->new_cleans };
+    struct cache_entry *entry;
+    u_int i;
+    int r;
+
+    for (i = 0; i < sizeof(cleans) / sizeof(*cleans); i++) {
+        for (entry = TAILQ_LAST(cleans[i], list_head); entry != NULL; entry = TAILQ_PREV(entry, list_head, link)) {
+            if ((r = block_list_append(list, entry->block_num)) != 0)
+                return r;
+        }
+    }
+    for (i = 0; i < WB_NUM_CLASSES; i++) {
+        TAILQ_FOREACH(entry, &priv->dirties[i], link) {
+            if ((r = block_list_append(list, entry->block_num)) != 0)
+                return r;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Read or write the next "len" bytes of a hot block file.
+ */
+static int
+block_cache_hot_io(int fd, void *buf, size_t len, int writing)
+{
+    size_t sofar;
+    ssize_t r;
+
+    for (sofar = 0; sofar < len; sofar += r) {
+        if ((r = writing ? write(fd, (char *)buf + sofar, len - sofar) : read(fd, (char *)buf + sofar, len - sofar)) == -1) {
+            if (errno == EINTR) {
+                r = 0;
+                continue;
+            }
+            return errno;
+        }
+        if (r == 0)
+            return EIO;
+    }
+    return 0;
+}
+
 static int
 block_cache_create_threads(struct s3backer_store *s3b)
 {
@@ -419,8 +972,12 @@ block_cache_create_threads(struct s3backer_store *s3b)
     struct block_cache_conf *const config = priv->config;
     int r;
 
-    // Create threads in lower layer
-    if ((r = (*priv->inner->create_threads)(priv->inner)) != 0)
+    // Create threads in lower layer (unless we are a shard)
+    if (priv->num_shards == 0 && (r = (*priv->inner->create_threads)(priv->inner)) != 0)
+        return r;
+
+    // Load the hot blocks from the previous run, if any
+    if (config->hot_file != NULL && (r = block_cache_hot_load(priv)) != 0)
         return r;
 
     // Grab lock
@@ -469,8 +1026,10 @@ static int
 block_cache_flush_blocks(struct s3backer_store *s3b, const s3b_block_t *block_nums, u_int num_blocks, long timeout)
 {
     struct block_cache_private *const priv = s3b->data;
+    const int flush_all = block_nums == NULL;
     struct block_list block_list;
     struct cache_entry *entry;
+    u_int i;
     int r = 0;
 
     // Initialize block list
@@ -484,10 +1043,12 @@ block_cache_flush_blocks(struct s3backer_store *s3b, const s3b_block_t *block_nu
         S3BCACHE_CHECK_INVARIANTS(priv, 0);
 
         // Add all DIRTYs to the block list
-        for (entry = TAILQ_FIRST(&priv->dirties); entry != NULL; entry = TAILQ_NEXT(entry, link)) {
-            assert(ENTRY_GET_STATE(entry) == DIRTY);
-            if ((r = block_list_append(&block_list, entry->block_num)) != 0)
-                break;
+        for (i = 0; i < WB_NUM_CLASSES && r == 0; i++) {
+            for (entry = TAILQ_FIRST(&priv->dirties[i]); entry != NULL; entry = TAILQ_NEXT(entry, link)) {
+                assert(ENTRY_GET_STATE(entry) == DIRTY);
+                if ((r = block_list_append(&block_list, entry->block_num)) != 0)
+                    break;
+            }
         }
 
         // Release lock
@@ -506,6 +1067,11 @@ block_cache_flush_blocks(struct s3backer_store *s3b, const s3b_block_t *block_nu
     r = block_cache_flush_blocks2(s3b, block_nums, num_blocks, timeout);
 
 done:
+    // Save hot blocks when flushing everything, but not too often
+    if (r == 0 && flush_all && priv->config->hot_file != NULL
+      && block_cache_get_time_millis() >= priv->hot_saved + HOT_SAVE_INTERVAL)
+        block_cache_hot_save(priv);
+
     // Done
     block_list_free(&block_list);
     return r;
@@ -518,6 +1084,7 @@ block_cache_flush_blocks2(struct s3backer_store *s3b, const s3b_block_t *const b
     const uint32_t now = block_cache_get_time(priv);
     struct cache_entry *entry;
     uint64_t absolute_timeout;
+    bitmap_t *waiting;
     int need_signal = 0;
     int r = 0;
     u_int i;
@@ -532,25 +1099,40 @@ block_cache_flush_blocks2(struct s3backer_store *s3b, const s3b_block_t *const b
     pthread_mutex_lock(&priv->mutex);
     S3BCACHE_CHECK_INVARIANTS(priv, 0);
 
-    // Move all DIRTY blocks to the front of the queue (in the order given to us) so they will be written first
+    // Remember which blocks we are waiting on, so we can stop waiting on them when we're done
+    if ((waiting = bitmap_init(num_blocks, 0)) == NULL) {
+        r = errno;
+        priv->stats.out_of_memory_errors++;
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+        return r;
+    }
+
+    // Move all DIRTY blocks to the front of the flush queue (in the order given to us) so they will be written first
     for (i = num_blocks; i > 0; i--) {
         const s3b_block_t block_num = block_nums[i - 1];
+        int state;
 
-        // Check if block exists and is DIRTY
+        // Check if block exists and is not clean
         if ((entry = s3b_hash_get(priv->hashtable, block_num)) == NULL)
             continue;
-        if (ENTRY_GET_STATE(entry) != DIRTY)
+        state = ENTRY_GET_STATE(entry);
+        if (state != DIRTY && state != WRITING && state != WRITING2)
             continue;
 
-        // Move it to the front of the queue if not there already
-        if (entry != TAILQ_FIRST(&priv->dirties)) {
-            TAILQ_REMOVE(&priv->dirties, entry, link);
-            TAILQ_INSERT_HEAD(&priv->dirties, entry, link);
-        }
+        // Take it out of its current queue, if any, because its writeback class is about to change
+        if (state == DIRTY)
+            TAILQ_REMOVE(block_cache_dirty_list(priv, entry), entry, link);
+
+        // Note that we are waiting for it; a WRITING2 block will go into the flush queue when its write completes
+        if (block_cache_flush_wait(priv, block_num) == 0)
+            bitmap_set(waiting, i - 1, 1);
 
-        // Set for immediate write timeout
-        entry->timeout = now;
-        need_signal = 1;
+        // Put DIRTY blocks at the front of their (normally the flush) queue for immediate write
+        if (state == DIRTY) {
+            TAILQ_INSERT_HEAD(block_cache_dirty_list(priv, entry), entry, link);
+            entry->timeout = now;
+            need_signal = 1;
+        }
     }
     if (need_signal)
         pthread_cond_signal(&priv->worker_work);
@@ -597,6 +1179,13 @@ block_cache_flush_blocks2(struct s3backer_store *s3b, const s3b_block_t *const b
             pthread_cond_wait(&priv->write_complete, &priv->mutex);
     }
 
+    // Stop waiting on our blocks
+    for (i = 0; i < num_blocks; i++) {
+        if (bitmap_test(waiting, i))
+            block_cache_flush_unwait(priv, block_nums[i]);
+    }
+    bitmap_free(&waiting);
+
     // Release lock
     CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
 
@@ -631,7 +1220,7 @@ block_cache_shutdown(struct s3backer_store *const s3b)
     // Wait for all dirty blocks to be written and all worker threads to exit
     orig_num_threads = priv->num_threads;
     priv->stopping = 1;
-    while (TAILQ_FIRST(&priv->dirties) != NULL || priv->num_threads > 0) {
+    while (block_cache_have_dirties(priv) || priv->num_threads > 0) {
         pthread_cond_broadcast(&priv->worker_work);
         pthread_cond_wait(&priv->worker_exit, &priv->mutex);
     }
@@ -643,8 +1232,12 @@ block_cache_shutdown(struct s3backer_store *const s3b)
     // Release lock
     CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
 
-    // Propagate to lower layer
-    return (*priv->inner->shutdown)(priv->inner);
+    // Save hot blocks for next time
+    if (config->hot_file != NULL)
+        block_cache_hot_save(priv);
+
+    // Propagate to lower layer (unless we are a shard)
+    return priv->num_shards == 0 ? (*priv->inner->shutdown)(priv->inner) : 0;
 }
 
 static void
@@ -656,16 +1249,29 @@ block_cache_destroy(struct s3backer_store *const s3b)
     // Grab lock and sanity check
     pthread_mutex_lock(&priv->mutex);
     S3BCACHE_CHECK_INVARIANTS(priv, 1);
-    assert(TAILQ_FIRST(&priv->dirties) == NULL && priv->num_threads == 0);
+    assert(!block_cache_have_dirties(priv) && priv->num_threads == 0);
 
-    // Destroy inner store
-    (*priv->inner->destroy)(priv->inner);
+    // Destroy inner store (unless we are a shard)
+    if (priv->num_shards == 0)
+        (*priv->inner->destroy)(priv->inner);
 
     // Free structures
     if (config->cache_file != NULL)
         s3b_dcache_close(priv->dcache);
     s3b_hash_foreach(priv->hashtable, block_cache_free_one, priv);
     s3b_hash_destroy(priv->hashtable);
+    assert(s3b_hash_size(priv->flushing) == 0);
+    s3b_hash_destroy(priv->flushing);
+    if (priv->partials != NULL) {
+        s3b_hash_foreach(priv->partials, block_cache_free_ghost, NULL);
+        s3b_hash_destroy(priv->partials);
+    }
+    if (priv->ctier != NULL)
+        s3b_ctier_destroy(priv->ctier);
+    if (priv->ghost_table != NULL) {
+        s3b_hash_foreach(priv->ghost_table, block_cache_free_ghost, NULL);
+        s3b_hash_destroy(priv->ghost_table);
+    }
     pthread_cond_destroy(&priv->write_complete);
     pthread_cond_destroy(&priv->worker_exit);
     pthread_cond_destroy(&priv->worker_work);
@@ -673,6 +1279,8 @@ block_cache_destroy(struct s3backer_store *const s3b)
     pthread_cond_destroy(&priv->space_avail);
     CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
     pthread_mutex_destroy(&priv->mutex);
+    free(priv->prefetch);
+    free(priv->streams);
     free(priv->threads);
     free(priv);
     free(s3b);
@@ -683,10 +1291,76 @@ block_cache_get_stats(struct s3backer_store *s3b, struct block_cache_stats *stat
 {
     struct block_cache_private *const priv = s3b->data;
 
+    // Sum over shards if sharded
+    if (s3b->destroy == block_cache_shards_destroy) {
+        struct block_cache_shards *const spriv = s3b->data;
+        struct block_cache_stats shard_stats;
+        u_int i;
+
+        memset(stats, 0, sizeof(*stats));
+        for (i = 0; i < spriv->num_shards; i++) {
+            block_cache_get_stats(spriv->shards[i], &shard_stats);
+            stats->initial_size += shard_stats.initial_size;
+            stats->current_size += shard_stats.current_size;
+            stats->dirty_ratio += shard_stats.dirty_ratio * spriv->confs[i].cache_size / spriv->config->cache_size;
+            stats->read_hits += shard_stats.read_hits;
+            stats->read_misses += shard_stats.read_misses;
+            stats->write_hits += shard_stats.write_hits;
+            stats->write_misses += shard_stats.write_misses;
+            stats->verified += shard_stats.verified;
+            stats->mismatch += shard_stats.mismatch;
+            stats->read_ahead_hits += shard_stats.read_ahead_hits;
+            stats->read_ahead_late += shard_stats.read_ahead_late;
+            stats->read_ahead_wasted += shard_stats.read_ahead_wasted;
+            stats->recent_hits += shard_stats.recent_hits;
+            stats->frequent_hits += shard_stats.frequent_hits;
+            stats->ghost_hits += shard_stats.ghost_hits;
+            stats->evictions += shard_stats.evictions;
+            stats->coalesced_writes += shard_stats.coalesced_writes;
+            stats->coalesced_blocks += shard_stats.coalesced_blocks;
+            stats->partial_writes += shard_stats.partial_writes;
+            stats->partial_fills += shard_stats.partial_fills;
+            stats->partial_skips += shard_stats.partial_skips;
+            stats->range_reads += shard_stats.range_reads;
+            stats->range_fetches += shard_stats.range_fetches;
+            stats->prefetches += shard_stats.prefetches;
+            stats->ctier_blocks += shard_stats.ctier_blocks;
+            stats->ctier_bytes += shard_stats.ctier_bytes;
+            stats->ctier_data_bytes += shard_stats.ctier_data_bytes;
+            stats->ctier_hits += shard_stats.ctier_hits;
+            stats->ctier_stores += shard_stats.ctier_stores;
+            stats->ctier_rejects += shard_stats.ctier_rejects;
+            stats->ctier_evictions += shard_stats.ctier_evictions;
+            stats->encoded_stores += shard_stats.encoded_stores;
+            stats->encoded_decodes += shard_stats.encoded_decodes;
+            stats->flush_writebacks += shard_stats.flush_writebacks;
+            stats->priority_writebacks += shard_stats.priority_writebacks;
+            stats->out_of_memory_errors += shard_stats.out_of_memory_errors;
+            latency_merge(&stats->miss_reads, &shard_stats.miss_reads);
+            latency_merge(&stats->writebacks, &shard_stats.writebacks);
+            latency_merge(&stats->dcache_reads, &shard_stats.dcache_reads);
+            latency_merge(&stats->dcache_writes, &shard_stats.dcache_writes);
+        }
+        return;
+    }
+
+    // Copy stats
     pthread_mutex_lock(&priv->mutex);
     memcpy(stats, &priv->stats, sizeof(*stats));
     stats->current_size = s3b_hash_size(priv->hashtable);
     stats->dirty_ratio = block_cache_dirty_ratio(priv);
+    if (priv->ctier != NULL) {
+        struct s3b_ctier_stats ctier_stats;
+
+        s3b_ctier_get_stats(priv->ctier, &ctier_stats);
+        stats->ctier_blocks = ctier_stats.num_blocks;
+        stats->ctier_bytes = ctier_stats.used_bytes;
+        stats->ctier_data_bytes = ctier_stats.data_bytes;
+        stats->ctier_hits = ctier_stats.hits;
+        stats->ctier_stores = ctier_stats.stores;
+        stats->ctier_rejects = ctier_stats.rejects;
+        stats->ctier_evictions = ctier_stats.evictions;
+    }
     CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
 }
 
@@ -695,15 +1369,107 @@ block_cache_clear_stats(struct s3backer_store *s3b)
 {
     struct block_cache_private *const priv = s3b->data;
 
+    // Clear each shard if sharded
+    if (s3b->destroy == block_cache_shards_destroy) {
+        struct block_cache_shards *const spriv = s3b->data;
+        u_int i;
+
+        for (i = 0; i < spriv->num_shards; i++)
+            block_cache_clear_stats(spriv->shards[i]);
+        return;
+    }
+
+    // Clear stats
     pthread_mutex_lock(&priv->mutex);
     memset(&priv->stats, 0, sizeof(priv->stats));
+    if (priv->ctier != NULL)
+        s3b_ctier_clear_stats(priv->ctier);
     CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
 }
 
 static int
-block_cache_survey_non_zero(struct s3backer_store *s3b, block_list_func_t *callback, void *arg)
+block_cache_survey_non_zero(struct s3backer_store *s3b, const struct survey_params *params)
+{
+    struct block_cache_private *const priv = s3b->data;
+    int r;
+
+    // Report blocks in the cache and start monitoring cache reads
+    if ((r = block_cache_survey_start(priv, params->callback, params->arg)) != 0)
+        return r;
+
+    // Invoke lower layer
+    r = (*priv->inner->survey_non_zero)(priv->inner, params);
+
+    // Finish up
+    block_cache_survey_finish(priv);
+    return r;
+}
+
+/*
+ * Queue the blocks not already in the cache to be read by the worker threads, like hot blocks at startup.
+ *
+ * There's no point in queueing more blocks than will fit in the cache, so any beyond that are ignored.
+ */
+static int
+block_cache_prefetch_blocks(struct s3backer_store *s3b, s3b_block_t block_num, u_int num_blocks)
 {
     struct block_cache_private *const priv = s3b->data;
+    struct block_cache_conf *const config = priv->config;
+    s3b_block_t *new_prefetch;
+    u_int new_alloc;
+    int r = 0;
+
+    // Grab lock and sanity check
+    pthread_mutex_lock(&priv->mutex);
+    S3BCACHE_CHECK_INVARIANTS(priv, 0);
+
+    // Discard the blocks already claimed from the list
+    if (priv->prefetch_next > 0) {
+        memmove(priv->prefetch, priv->prefetch + priv->prefetch_next,
+          (priv->num_prefetch - priv->prefetch_next) * sizeof(*priv->prefetch));
+        priv->num_prefetch -= priv->prefetch_next;
+        priv->prefetch_hints = priv->prefetch_hints > priv->prefetch_next ? priv->prefetch_hints - priv->prefetch_next : 0;
+        priv->prefetch_next = 0;
+    }
+
+    // Limit the list to the size of the cache
+    if (num_blocks > config->cache_size - priv->num_prefetch)
+        num_blocks = config->cache_size - priv->num_prefetch;
+
+    // Make room in the list
+    if ((new_alloc = priv->num_prefetch + num_blocks) > priv->prefetch_alloc) {
+        if ((new_prefetch = realloc(priv->prefetch, new_alloc * sizeof(*priv->prefetch))) == NULL) {
+            r = errno;
+            (*config->log)(LOG_ERR, "can't allocate block cache prefetch list: %s", strerror(r));
+            goto done;
+        }
+        priv->prefetch = new_prefetch;
+        priv->prefetch_alloc = new_alloc;
+    }
+
+    // Add the blocks that we don't already have
+    while (num_blocks-- > 0) {
+        if (s3b_hash_get(priv->hashtable, block_num) == NULL)
+            priv->prefetch[priv->num_prefetch++] = block_num;
+        block_num++;
+    }
+
+    // Wake up a worker thread
+    if (priv->num_prefetch > 0)
+        pthread_cond_signal(&priv->worker_work);
+
+done:
+    // Done
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+    return r;
+}
+
+/*
+ * Record a non-zero survey in progress and report all blocks currently in the cache to the callback.
+ */
+static int
+block_cache_survey_start(struct block_cache_private *priv, block_list_func_t *callback, void *arg)
+{
     struct block_list list;
     int r;
 
@@ -711,37 +1477,38 @@ block_cache_survey_non_zero(struct s3backer_store *s3b, block_list_func_t *callb
     pthread_mutex_lock(&priv->mutex);
     assert(priv->survey_callback == NULL);
 
+    // Inventory all blocks currently in the cache; we don't bother trying to discern the zero blocks
+    block_list_init(&list);
+    if ((r = s3b_hash_foreach(priv->hashtable, block_cache_append_block_list, &list)) != 0) {
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+        block_list_free(&list);
+        return r;
+    }
+
     // Record survey in progress
     priv->survey_callback = callback;
     priv->survey_arg = arg;
 
-    // Inventory all blocks currently in the cache; we don't bother trying to discern the zero blocks
-    block_list_init(&list);
-    if ((r = s3b_hash_foreach(priv->hashtable, block_cache_append_block_list, &list)) != 0)
-        goto done;
-
     // Unlock mutex
     CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
 
     // Report all blocks inventoried above
     (*callback)(arg, list.blocks, list.num_blocks);
     block_list_free(&list);
+    return 0;
+}
 
-    // Invoke lower layer
-    r = (*priv->inner->survey_non_zero)(priv->inner, callback, arg);
-
-    // Lock mutex
+/*
+ * Record that a non-zero survey has completed.
+ */
+static void
+block_cache_survey_finish(struct block_cache_private *priv)
+{
     pthread_mutex_lock(&priv->mutex);
-
-    // Finish up
     assert(priv->survey_callback != NULL);
     priv->survey_callback = NULL;
     priv->survey_arg = NULL;
-
-done:
-    // Done
     CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
-    return r;
 }
 
 static int
@@ -801,20 +1568,16 @@ block_cache_read(struct block_cache_private *const priv, s3b_block_t block_num,
         goto done;
     }
 
-    // Update count of block(s) read sequentially by the upper layer
-    if (block_num == priv->seq_last + 1) {
-        priv->seq_count++;
-        if (priv->ra_count > 0)
-            priv->ra_count--;
-    } else if (block_num != priv->seq_last) {
-        priv->seq_count = 1;
-        priv->ra_count = 0;
-    }
-    priv->seq_last = block_num;
+    // Update read-ahead state
+    block_cache_track_read(priv, block_num);
 
-    // Wakeup a worker thread to read the next read-ahead block if needed
-    if (priv->seq_count >= config->read_ahead_trigger && priv->ra_count < config->read_ahead)
-        pthread_cond_signal(&priv->worker_work);
+    // Read small parts of blocks that aren't cached directly from the underlying store, if so configured
+    if (len < config->block_size && len <= config->range_read_max && priv->inner->read_block_part != NULL
+      && s3b_hash_get(priv->hashtable, block_num) == NULL
+      && (priv->ctier == NULL || !s3b_ctier_contains(priv->ctier, block_num))) {
+        r = block_cache_range_read(priv, block_num, off, len, dest);
+        goto done;
+    }
 
     // Peform the read
     r = block_cache_do_read(priv, block_num, off, len, dest, 1);
@@ -825,6 +1588,330 @@ done:
     return r;
 }
 
+/*
+ * Read part of a block that is not in the cache from the underlying store, without caching it.
+ * Afterwards, optionally have a worker thread read the whole block into the cache.
+ *
+ * This assumes the mutex is held. Note the mutex is temporarily released.
+ */
+static int
+block_cache_range_read(struct block_cache_private *const priv, s3b_block_t block_num, u_int off, u_int len, void *dest)
+{
+    struct block_cache_conf *const config = priv->config;
+    int r;
+
+    // Update stats
+    priv->stats.range_reads++;
+
+    // Read the data
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+    r = (*priv->inner->read_block_part)(priv->inner, block_num, off, len, dest);
+    pthread_mutex_lock(&priv->mutex);
+    S3BCACHE_CHECK_INVARIANTS(priv, 0);
+    if (r != 0)
+        return r;
+
+    // Schedule a background read of the whole block, unless the queue is full or somebody already read it
+    if (config->range_read_fetch && priv->num_range_fetches < RANGE_FETCH_MAX
+      && s3b_hash_get(priv->hashtable, block_num) == NULL) {
+        priv->range_fetches[(priv->range_fetch_first + priv->num_range_fetches++) % RANGE_FETCH_MAX] = block_num;
+        priv->stats.range_fetches++;
+        pthread_cond_signal(&priv->worker_work);
+    }
+    return 0;
+}
+
+/*
+ * Read a range of blocks. Missing blocks are read concurrently with help from the worker threads.
+ */
+static int
+block_cache_read_blocks(struct s3backer_store *const s3b, s3b_block_t block_num, u_int num_blocks, void *dest)
+{
+    struct block_cache_private *const priv = s3b->data;
+    struct block_cache_conf *const config = priv->config;
+    struct block_fetch fetch;
+    u_int num_batch;
+    u_int i;
+    int r = 0;
+
+    // Grab lock
+    pthread_mutex_lock(&priv->mutex);
+    S3BCACHE_CHECK_INVARIANTS(priv, 0);
+
+    // Sanity check
+    if (priv->num_threads == 0) {
+        (*config->log)(LOG_ERR, "block_cache_read_blocks(): no threads created yet");
+        r = ENOTCONN;
+        goto done;
+    }
+
+    // Update read-ahead state as if the blocks were read one at a time
+    for (i = 0; i < num_blocks; i++)
+        block_cache_track_read(priv, block_num + i);
+
+    // Let worker threads help read the blocks after the first one
+    memset(&fetch, 0, sizeof(fetch));
+    fetch.block_num = block_num;
+    fetch.num_blocks = num_blocks;
+    fetch.next = 1;
+    if (fetch.next < fetch.num_blocks) {
+        TAILQ_INSERT_TAIL(&priv->fetches, &fetch, link);
+        fetch.queued = 1;
+        pthread_cond_broadcast(&priv->worker_work);
+    }
+
+    // Read the blocks in order; any that a worker thread is already reading we will wait for
+    for (i = 0; i < num_blocks; i++) {
+
+        // Claim this block (and any before it) so worker threads don't bother with it
+        if (fetch.queued && fetch.next <= i) {
+            fetch.next = i + 1;
+            if (fetch.next == fetch.num_blocks)
+                block_cache_unqueue_fetch(priv, &fetch);
+        }
+
+        // Read any run of clean blocks in the cache file as a single batch
+        if (config->cache_file != NULL) {
+            if ((r = block_cache_read_batch(priv, block_num + i, num_blocks - i,
+              (char *)dest + (size_t)i * config->block_size, &num_batch)) != 0)
+                break;
+            if (num_batch > 0) {
+                i += num_batch - 1;
+                if (fetch.queued && fetch.next <= i) {
+                    fetch.next = i + 1;
+                    if (fetch.next == fetch.num_blocks)
+                        block_cache_unqueue_fetch(priv, &fetch);
+                }
+                continue;
+            }
+        }
+
+        // Read any run of missing blocks from the underlying store as a single batch
+        if ((r = block_cache_read_misses(priv, block_num + i, num_blocks - i,
+          (char *)dest + (size_t)i * config->block_size, &num_batch)) != 0)
+            break;
+        if (num_batch > 0) {
+            i += num_batch - 1;
+            if (fetch.queued && fetch.next <= i) {
+                fetch.next = i + 1;
+                if (fetch.next == fetch.num_blocks)
+                    block_cache_unqueue_fetch(priv, &fetch);
+            }
+            continue;
+        }
+
+        // Read block
+        if ((r = block_cache_do_read(priv, block_num + i, 0, config->block_size,
+          (char *)dest + (size_t)i * config->block_size, 1)) != 0)
+            break;
+    }
+
+    // Make sure fetch is no longer visible to worker threads
+    if (fetch.queued)
+        block_cache_unqueue_fetch(priv, &fetch);
+
+done:
+    // Release lock
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+    return r;
+}
+
+/*
+ * Assign a block read by the upper layer to a read-ahead stream, and
+ * wake up a worker thread to perform read-ahead if appropriate.
+ *
+ * Assumes the mutex is held.
+ */
+static void
+block_cache_track_read(struct block_cache_private *const priv, s3b_block_t block_num)
+{
+    struct block_cache_conf *const config = priv->config;
+    const uint64_t now = block_cache_get_time_millis();
+    struct ra_stream *stream = NULL;
+    struct ra_stream *victim = NULL;
+    struct ra_stream *best = NULL;
+    int64_t best_delta = 0;
+    int64_t delta;
+    u_int i;
+
+    // Is read-ahead enabled?
+    if (priv->num_streams == 0)
+        return;
+    priv->ra_clock++;
+
+    /*
+     * Find the stream this read belongs to. A read either repeats the last block of some stream,
+     * continues some stream with a known stride, or establishes the stride of the stream whose
+     * last block is nearest. Otherwise we start a new stream, replacing the least recently used one.
+     */
+    for (i = 0; i < priv->num_streams; i++) {
+        struct ra_stream *const s = &priv->streams[i];
+
+        // Skip unused slots, but remember them as replacement candidates
+        if (s->count == 0) {
+            if (victim == NULL || victim->count != 0)
+                victim = s;
+            continue;
+        }
+
+        // Check for an exact match
+        delta = (int64_t)block_num - (int64_t)s->last;
+        if (delta == 0 || (s->stride != 0 && delta == s->stride)) {
+            stream = s;
+            break;
+        }
+
+        // Check for a stream that this read could determine the stride of
+        if (s->stride == 0 && delta >= -RA_MAX_STRIDE && delta <= RA_MAX_STRIDE
+          && (best == NULL || llabs(delta) < llabs(best_delta))) {
+            best = s;
+            best_delta = delta;
+        }
+
+        // Track least recently used stream
+        if (victim == NULL || (victim->count != 0 && s->lru < victim->lru))
+            victim = s;
+    }
+
+    // Update stream
+    if (stream != NULL) {
+        if (block_num != stream->last) {
+            if (stream->ra_count > 0) {
+                block_cache_ra_adapt(priv, stream, block_num, now);
+                stream->ra_count--;
+            }
+            stream->count++;
+        }
+    } else if (best != NULL) {
+        stream = best;
+        stream->stride = (int)best_delta;
+        stream->ra_count = stream->ra_count > 0 && best_delta == 1 ? stream->ra_count - 1 : 0;   // we guessed +1
+        stream->count++;
+    } else {
+        assert(victim != NULL);
+        stream = victim;
+        memset(stream, 0, sizeof(*stream));
+        stream->window = config->read_ahead;
+        stream->count = 1;
+    }
+    if (stream->count > 1 && block_num != stream->last) {
+        const double interval = (double)(now - stream->last_time);
+
+        stream->interval = stream->count == 2 ? interval :
+          (1.0 - RA_AVERAGE_WEIGHT) * stream->interval + RA_AVERAGE_WEIGHT * interval;
+    }
+    stream->last = block_num;
+    stream->last_time = now;
+    stream->lru = priv->ra_clock;
+
+    // Wakeup a worker thread to read the next read-ahead block if needed
+    if (block_cache_ra_ready(priv) != NULL)
+        pthread_cond_signal(&priv->worker_work);
+}
+
+/*
+ * Adjust a stream's read-ahead window when the upper layer reads a block that should have been read ahead.
+ *
+ * Assumes the mutex is held.
+ */
+static void
+block_cache_ra_adapt(struct block_cache_private *priv, struct ra_stream *stream, s3b_block_t block_num, uint64_t now)
+{
+    struct block_cache_conf *const config = priv->config;
+    struct cache_entry *entry;
+    double interval;
+    u_int needed;
+
+    // See how many blocks need to be in flight to cover the latency of the underlying store
+    interval = (double)(now - stream->last_time);
+    if (stream->interval > 0.0)
+        interval = (1.0 - RA_AVERAGE_WEIGHT) * stream->interval + RA_AVERAGE_WEIGHT * interval;
+    if (interval < 1.0)
+        interval = 1.0;
+    needed = (u_int)(priv->read_latency / interval) + 1;
+
+    // Check what happened to the read-ahead block
+    if ((entry = s3b_hash_get(priv->hashtable, block_num)) == NULL) {
+
+        // The block was evicted before it was used, so we are reading too far ahead for the cache to hold
+        priv->stats.read_ahead_wasted++;
+        stream->window = stream->window / 2;
+        if (stream->window < config->read_ahead)
+            stream->window = config->read_ahead;
+        return;
+    }
+    switch (ENTRY_GET_STATE(entry)) {
+    case READING:
+    case READING2:
+
+        // The block didn't arrive in time, so we are not reading far enough ahead
+        priv->stats.read_ahead_late++;
+        if (needed < stream->window * 2)
+            needed = stream->window * 2;
+        break;
+    default:
+
+        // The block arrived in time; slowly give back any window we no longer need
+        priv->stats.read_ahead_hits++;
+        if (needed < stream->window / 2 && stream->window > config->read_ahead)
+            stream->window--;
+        break;
+    }
+
+    // Grow the window if necessary
+    if (needed > config->read_ahead_max)
+        needed = config->read_ahead_max;
+    if (needed > stream->window)
+        stream->window = needed;
+}
+
+/*
+ * Find a stream that has been triggered and wants more read-ahead, if any.
+ *
+ * Assumes the mutex is held.
+ */
+static struct ra_stream *
+block_cache_ra_ready(struct block_cache_private *priv)
+{
+    struct block_cache_conf *const config = priv->config;
+    u_int i;
+
+    for (i = 0; i < priv->num_streams; i++) {
+        struct ra_stream *const stream = &priv->streams[i];
+
+        if (stream->count > 0 && stream->count >= config->read_ahead_trigger && stream->ra_count < stream->window)
+            return stream;
+    }
+    return NULL;
+}
+
+/*
+ * Remove a multi-block read from the list of fetches.
+ *
+ * Assumes the mutex is held.
+ */
+static void
+block_cache_unqueue_fetch(struct block_cache_private *priv, struct block_fetch *fetch)
+{
+    assert(fetch->queued);
+    TAILQ_REMOVE(&priv->fetches, fetch, link);
+    fetch->queued = 0;
+}
+
+/*
+ * Determine whether a new cache entry could be acquired without having to wait.
+ *
+ * Assumes the mutex is held.
+ */
+static int
+block_cache_space_available(struct block_cache_private *priv)
+{
+    struct block_cache_conf *const config = priv->config;
+
+    return s3b_hash_size(priv->hashtable) < config->cache_size
+      || priv->num_cleans > 0;
+}
+
 /*
  * Read a block or a portion thereof.
  *
@@ -834,11 +1921,15 @@ static int
 block_cache_do_read(struct block_cache_private *const priv, s3b_block_t block_num, u_int off, u_int len, void *dest, int stats)
 {
     struct block_cache_conf *const config = priv->config;
-    struct list_head *const cleans_list = block_cache_cleans_list(priv, block_num);
     struct cache_entry *entry;
+    struct partial_entry *part;
     u_char etag[MD5_DIGEST_LENGTH];
     int verified_but_not_read = 0;
+    double read_start;
     void *data = NULL;
+    int encoded = 0;
+    void *cbuf;
+    size_t clen;
     int r;
 
     // Sanity check
@@ -859,7 +1950,7 @@ again:
 
             // Allocate temporary buffer for reading the data if necessary
             if (config->cache_file != NULL) {
-                if ((data = malloc(config->block_size)) == NULL) {
+                if ((data = block_buf_alloc(config->block_size)) == NULL) {
                     r = errno;
                     (*config->log)(LOG_ERR, "can't allocate block cache buffer: %s", strerror(r));
                     return r;
@@ -872,9 +1963,8 @@ again:
                 if ((r = s3b_dcache_erase_block(priv->dcache, entry->u.dslot)) != 0)
                     (*config->log)(LOG_ERR, "can't erase cached block! %s", strerror(r));
             }
-            TAILQ_REMOVE(cleans_list, entry, link);
+            block_cache_clean_remove(priv, entry);
             ENTRY_RESET_LINK(entry);
-            priv->num_cleans--;
             entry->timeout = READING_TIMEOUT;
             assert(entry->verify);
             assert(ENTRY_GET_STATE(entry) == READING2);
@@ -882,13 +1972,19 @@ again:
             // Now go read/verify the data
             goto read;
         case CLEAN:         // Update timestamp and move to the end of the list to maintain LRU ordering
-            TAILQ_REMOVE(cleans_list, entry, link);
-            TAILQ_INSERT_TAIL(cleans_list, entry, link);
+            block_cache_clean_remove(priv, entry);
+            block_cache_clean_insert(priv, entry);
             entry->timeout = block_cache_get_time(priv) + priv->clean_timeout;
             // FALLTHROUGH
-        case DIRTY:         // Copy the cached data
+        case DIRTY:         // Copy the cached data (after reading any missing sectors)
         case WRITING:
         case WRITING2:
+            if (len > 0 && (part = block_cache_partial_get(priv, block_num)) != NULL
+              && !block_cache_partial_covers(priv, part, off, len)) {
+                if ((r = block_cache_partial_fill(priv, entry, part)) != 0)
+                    return r;
+                goto again;
+            }
             if ((r = block_cache_read_data(priv, entry, dest, off, len)) != 0)
                 return r;
             break;
@@ -897,12 +1993,14 @@ again:
             break;
         }
         if (stats)
-            priv->stats.read_hits++;
+            block_cache_count_hit(priv, entry);
         return 0;
     }
 
     // Create a new cache entry in state READING
-    if ((r = block_cache_get_entry(priv, &entry, &data)) != 0)
+    if ((r = block_cache_get_entry(priv, &entry, &data)) == EAGAIN)     // the cache may have changed
+        goto again;
+    if (r != 0)
         return r;
     if (entry == NULL) {                                            // no free entries right now
         pthread_cond_wait(&priv->space_avail, &priv->mutex);
@@ -911,27 +2009,62 @@ again:
     entry->block_num = block_num;
     entry->dirty = 0;
     entry->verify = 0;
+    entry->frequent = block_cache_ghost_take(priv, block_num);
     entry->timeout = READING_TIMEOUT;
     ENTRY_RESET_LINK(entry);
     s3b_hash_put_new(priv->hashtable, entry);
     assert(ENTRY_GET_STATE(entry) == READING);
 
     // Update stats
-    if (stats)
+    if (stats) {
         priv->stats.read_misses++;
+        if (entry->frequent)
+            priv->stats.ghost_hits++;
+    }
 
     // Conservatively disqualify this block as zero in any ongoing non-zero survey
     if (priv->survey_callback != NULL)
         (*priv->survey_callback)(priv->survey_arg, &block_num, 1);
 
+    // If the compressed tier has the block, we don't need to read it; decompress it while unlocked
+    if (priv->ctier != NULL && s3b_ctier_take(priv->ctier, block_num, &cbuf, &clen) == 0) {
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+        r = s3b_ctier_decompress(priv->ctier, block_num, cbuf, clen, data);
+        block_buf_free(cbuf);
+        pthread_mutex_lock(&priv->mutex);
+        S3BCACHE_CHECK_INVARIANTS(priv, 0);
+        if (r == 0) {
+            memset(etag, 0, sizeof(etag));
+            goto got_data;
+        }
+    }
+
 read:
     // Read the block from the underlying s3backer_store
     assert(ENTRY_GET_STATE(entry) == READING || ENTRY_GET_STATE(entry) == READING2);
+    read_start = monotonic_time();
     CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
-    r = (*priv->inner->read_block)(priv->inner, block_num, data, etag, entry->verify ? entry->etag : NULL, 0);
+    if (priv->store_encoded) {
+        r = (*priv->inner->read_block_encoded)(priv->inner, block_num, data, &encoded,
+          etag, entry->verify ? entry->etag : NULL, 0);
+        if (r == 0 && encoded && len > 0)                           // decode what the caller wants while unlocked
+            r = block_cache_decode(priv, block_num, data, dest, off, len);
+    } else
+        r = (*priv->inner->read_block)(priv->inner, block_num, data, etag, entry->verify ? entry->etag : NULL, 0);
     pthread_mutex_lock(&priv->mutex);
     S3BCACHE_CHECK_INVARIANTS(priv, 0);
 
+    // Update read latency stats and average read latency (used to size read-ahead windows)
+    if (r == 0) {
+        const double seconds = monotonic_time() - read_start;
+        const double latency = seconds * 1000.0;
+
+        latency_record(&priv->stats.miss_reads, seconds);
+        priv->read_latency = priv->read_latency == 0.0 ? latency :
+          (1.0 - RA_AVERAGE_WEIGHT) * priv->read_latency + RA_AVERAGE_WEIGHT * latency;
+    }
+
+got_data:
     // The entry should still exist and be in state READING[2]
     assert(s3b_hash_get(priv->hashtable, block_num) == entry);
     assert(ENTRY_GET_STATE(entry) == READING || ENTRY_GET_STATE(entry) == READING2);
@@ -965,17 +2098,24 @@ read:
         assert(ENTRY_GET_STATE(entry) == READING);
     }
 
-    // Copy the block data's into the destination buffer
-    if (!verified_but_not_read)
+    // Copy the block data's into the destination buffer (unless already decoded there)
+    if (!verified_but_not_read && !encoded)
         memcpy(dest, (char *)data + off, len);
 
     // Copy data into the disk cache and free temporary buffer (if necessary)
     if (config->cache_file != NULL) {
         if (!verified_but_not_read) {
-            if ((r = s3b_dcache_write_block(priv->dcache, entry->u.dslot, data, 0, config->block_size)) != 0)
+            const double write_start = monotonic_time();
+
+            if (encoded) {
+                if ((r = s3b_dcache_write_encoded(priv->dcache, entry->u.dslot, data)) != 0)
+                    goto fail;
+                priv->stats.encoded_stores++;
+            } else if ((r = s3b_dcache_write_block(priv->dcache, entry->u.dslot, data, 0, config->block_size)) != 0)
                 goto fail;
+            latency_record(&priv->stats.dcache_writes, monotonic_time() - write_start);
         }
-        free(data);
+        block_buf_free(data);
     }
 
     // Change entry from READING to CLEAN
@@ -986,8 +2126,7 @@ read:
             (*config->log)(LOG_ERR, "can't record cached block! %s", strerror(r));
     }
     entry->timeout = block_cache_get_time(priv) + priv->clean_timeout;
-    TAILQ_INSERT_TAIL(cleans_list, entry, link);
-    priv->num_cleans++;
+    block_cache_clean_insert(priv, entry);
     assert(ENTRY_GET_STATE(entry) == CLEAN);
 
     // If data was only verified, we have to actually go read it now
@@ -1003,59 +2142,296 @@ fail:
     if (config->cache_file != NULL)
         s3b_dcache_free_block(priv->dcache, entry->u.dslot);
     s3b_hash_remove(priv->hashtable, entry->block_num);
-    free(data);
+    block_buf_free(data);
     free(entry);
     return r;
 }
 
+/*
+ * Read a run of consecutive blocks that are not in the cache from the underlying store using one read_blocks() call,
+ * adding them to the cache as CLEAN entries. This lets the underlying store fetch them concurrently. Sets *nump to
+ * the number of blocks read, which is zero unless there are at least two.
+ *
+ * Blocks in the compressed tier, and stores that keep encoded data in the cache file, are left to block_cache_do_read().
+ *
+ * Assumes the mutex is held.
+ */
 static int
-block_cache_write_block(struct s3backer_store *const s3b, s3b_block_t block_num, const void *src, u_char *etag,
-  check_cancel_t *check_cancel, void *check_cancel_arg)
+block_cache_read_misses(struct block_cache_private *const priv, s3b_block_t block_num, u_int max_blocks, void *dest,
+    u_int *nump)
 {
-    struct block_cache_private *const priv = s3b->data;
     struct block_cache_conf *const config = priv->config;
+    struct cache_entry *run[READ_BATCH_MAX_BLOCKS];
+    u_char etag[MD5_DIGEST_LENGTH];
+    struct cache_entry *entry;
+    double read_start;
+    double seconds;
+    u_int num_blocks;
+    u_int i;
+    int r;
 
-    assert(etag == NULL);
-    return block_cache_write(priv, block_num, 0, config->block_size, src);
-}
+    // Is batching possible?
+    *nump = 0;
+    if (priv->inner->read_blocks == NULL || priv->store_encoded)
+        return 0;
 
-static int
-block_cache_write_block_part(struct s3backer_store *s3b, s3b_block_t block_num, u_int off, u_int len, const void *src)
-{
-    struct block_cache_private *const priv = s3b->data;
-    struct block_cache_conf *const config = priv->config;
+    // Find the run of missing blocks
+    if (max_blocks > READ_BATCH_MAX_BLOCKS)
+        max_blocks = READ_BATCH_MAX_BLOCKS;
+    for (num_blocks = 0; num_blocks < max_blocks; num_blocks++) {
+        if (s3b_hash_get(priv->hashtable, block_num + num_blocks) != NULL
+          || (priv->ctier != NULL && s3b_ctier_contains(priv->ctier, block_num + num_blocks)))
+            break;
+    }
+    if (num_blocks < 2)
+        return 0;
 
-    // Sanity check
-    (void)config;
-    assert(len > 0);
-    assert(len < config->block_size);
-    assert(off + len <= config->block_size);
+    // Create new cache entries in state READING, as many as we can get without waiting (or the cache changing)
+    max_blocks = num_blocks;
+    for (num_blocks = 0; num_blocks < max_blocks; num_blocks++) {
+        if ((r = block_cache_get_entry(priv, &entry, NULL)) != 0 || entry == NULL)
+            break;
+        entry->block_num = block_num + num_blocks;
+        entry->dirty = 0;
+        entry->verify = 0;
+        entry->frequent = block_cache_ghost_take(priv, entry->block_num);
+        entry->timeout = READING_TIMEOUT;
+        ENTRY_RESET_LINK(entry);
+        s3b_hash_put_new(priv->hashtable, entry);
+        assert(ENTRY_GET_STATE(entry) == READING);
+        priv->stats.read_misses++;
+        if (entry->frequent)
+            priv->stats.ghost_hits++;
+        run[num_blocks] = entry;
+    }
+    if (num_blocks == 0)
+        return 0;
 
-    // Write data
-    return block_cache_write(priv, block_num, off, len, src);
+    // Conservatively disqualify these blocks as zero in any ongoing non-zero survey
+    if (priv->survey_callback != NULL) {
+        for (i = 0; i < num_blocks; i++)
+            (*priv->survey_callback)(priv->survey_arg, &run[i]->block_num, 1);
+    }
+
+    // Read the blocks from the underlying s3backer_store
+    read_start = monotonic_time();
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+    r = (*priv->inner->read_blocks)(priv->inner, block_num, num_blocks, dest);
+    pthread_mutex_lock(&priv->mutex);
+    S3BCACHE_CHECK_INVARIANTS(priv, 0);
+
+    // Wake up any threads waiting for these blocks, or for space
+    pthread_cond_broadcast(&priv->end_reading);
+    pthread_cond_signal(&priv->space_avail);
+
+    // Update read latency stats and average read latency, counting the batch like a single read
+    if (r == 0) {
+        seconds = monotonic_time() - read_start;
+        for (i = 0; i < num_blocks; i++)
+            latency_record(&priv->stats.miss_reads, seconds);
+        priv->read_latency = priv->read_latency == 0.0 ? seconds * 1000.0 :
+          (1.0 - RA_AVERAGE_WEIGHT) * priv->read_latency + RA_AVERAGE_WEIGHT * seconds * 1000.0;
+    }
+
+    // Store the data and change each entry from READING to CLEAN; on error, discard them all
+    memset(etag, 0, sizeof(etag));
+    for (i = 0; i < num_blocks; i++) {
+        const void *const src = (const char *)dest + (size_t)i * config->block_size;
+
+        entry = run[i];
+        assert(s3b_hash_get(priv->hashtable, entry->block_num) == entry);
+        assert(ENTRY_GET_STATE(entry) == READING);
+        if (r == 0) {
+            if (config->cache_file == NULL)
+                memcpy(entry->u.data, src, config->block_size);
+            else if ((r = s3b_dcache_write_block(priv->dcache, entry->u.dslot, src, 0, config->block_size)) != 0)
+                (*config->log)(LOG_ERR, "can't write cached block! %s", strerror(r));
+            else if ((r = s3b_dcache_record_block(priv->dcache, entry->u.dslot, entry->block_num, etag)) != 0)
+                (*config->log)(LOG_ERR, "can't record cached block! %s", strerror(r));
+        }
+        if (r != 0) {
+            if (config->cache_file != NULL)
+                s3b_dcache_free_block(priv->dcache, entry->u.dslot);
+            else
+                block_buf_free(entry->u.data);
+            s3b_hash_remove(priv->hashtable, entry->block_num);
+            free(entry);
+            continue;
+        }
+        entry->timeout = block_cache_get_time(priv) + priv->clean_timeout;
+        block_cache_clean_insert(priv, entry);
+        assert(ENTRY_GET_STATE(entry) == CLEAN);
+    }
+    if (r != 0)
+        return r;
+
+    // Done
+    *nump = num_blocks;
+    return 0;
 }
 
 /*
- * Write a block or a portion thereof.
+ * Read a run of consecutive CLEAN blocks from the cache file using one batch of I/O.
+ * Sets *nump to the number of blocks read, which is zero unless there are at least two.
+ *
+ * Assumes the mutex is held.
  */
 static int
-block_cache_write(struct block_cache_private *const priv, s3b_block_t block_num, u_int off, u_int len, const void *src)
+block_cache_read_batch(struct block_cache_private *const priv, s3b_block_t block_num, u_int max_blocks, void *dest,
+    u_int *nump)
 {
     struct block_cache_conf *const config = priv->config;
-    struct list_head *const cleans_list = block_cache_cleans_list(priv, block_num);
+    struct s3b_dcache_io ios[READ_BATCH_MAX_BLOCKS];
     struct cache_entry *entry;
-    int partial_miss = 0;
+    double read_start;
+    u_int num_ios;
+    u_int i;
     int r;
 
     // Sanity check
-    assert(off <= config->block_size);
-    assert(len <= config->block_size);
-    assert(off + len <= config->block_size);
+    assert(config->cache_file != NULL);
 
-    // Grab lock
-    pthread_mutex_lock(&priv->mutex);
+    // Find the run of CLEAN blocks
+    *nump = 0;
+    if (max_blocks > READ_BATCH_MAX_BLOCKS)
+        max_blocks = READ_BATCH_MAX_BLOCKS;
+    for (num_ios = 0; num_ios < max_blocks; num_ios++) {
+        if ((entry = s3b_hash_get(priv->hashtable, block_num + num_ios)) == NULL || ENTRY_GET_STATE(entry) != CLEAN
+          || s3b_dcache_is_encoded(priv->dcache, entry->u.dslot))
+            break;
+        ios[num_ios].dslot = entry->u.dslot;
+        ios[num_ios].buf = (char *)dest + (size_t)num_ios * config->block_size;
+    }
+    if (num_ios < 2)
+        return 0;
 
-again:
+    // Read the data
+    read_start = monotonic_time();
+    if ((r = s3b_dcache_read_blocks(priv->dcache, ios, num_ios)) != 0)
+        return r;
+    latency_record(&priv->stats.dcache_reads, monotonic_time() - read_start);
+
+    // Update timestamps and LRU ordering, just like block_cache_do_read()
+    for (i = 0; i < num_ios; i++) {
+        entry = s3b_hash_get(priv->hashtable, block_num + i);
+        assert(entry != NULL && ENTRY_GET_STATE(entry) == CLEAN);
+        block_cache_clean_remove(priv, entry);
+        block_cache_clean_insert(priv, entry);
+        entry->timeout = block_cache_get_time(priv) + priv->clean_timeout;
+        block_cache_count_hit(priv, entry);
+    }
+
+    // Done
+    *nump = num_ios;
+    return 0;
+}
+
+/*
+ * Update stats for a read cache hit.
+ *
+ * Assumes the mutex is held.
+ */
+static void
+block_cache_count_hit(struct block_cache_private *priv, struct cache_entry *entry)
+{
+    priv->stats.read_hits++;
+    if (priv->max_ghosts > 0) {
+        if (entry->frequent)
+            priv->stats.frequent_hits++;
+        else
+            priv->stats.recent_hits++;
+    }
+}
+
+static int
+block_cache_write_block(struct s3backer_store *const s3b, s3b_block_t block_num, const void *src, u_char *etag,
+  check_cancel_t *check_cancel, void *check_cancel_arg)
+{
+    struct block_cache_private *const priv = s3b->data;
+    struct block_cache_conf *const config = priv->config;
+
+    assert(etag == NULL);
+    return block_cache_write(priv, block_num, 0, config->block_size, src, config->synchronous);
+}
+
+static int
+block_cache_write_block_part(struct s3backer_store *s3b, s3b_block_t block_num, u_int off, u_int len, const void *src)
+{
+    struct block_cache_private *const priv = s3b->data;
+    struct block_cache_conf *const config = priv->config;
+
+    // Sanity check
+    (void)config;
+    assert(len > 0);
+    assert(len < config->block_size);
+    assert(off + len <= config->block_size);
+
+    // Write data
+    return block_cache_write(priv, block_num, off, len, src, config->synchronous);
+}
+
+/*
+ * Write a range of blocks. If doing synchronous writes, all of the blocks are handed
+ * off to the worker threads before we wait for any of them to complete.
+ */
+static int
+block_cache_write_blocks(struct s3backer_store *const s3b, s3b_block_t block_num, u_int num_blocks, const void *src,
+  u_char *etags, check_cancel_t *check_cancel, void *check_cancel_arg)
+{
+    struct block_cache_private *const priv = s3b->data;
+    struct block_cache_conf *const config = priv->config;
+    u_int i;
+    int r;
+
+    // Sanity check
+    assert(etags == NULL);
+
+    // Write data
+    for (i = 0; i < num_blocks; i++) {
+        const void *const block_src = src != NULL ? (const char *)src + (size_t)i * config->block_size : NULL;
+
+        if ((r = block_cache_write(priv, block_num + i, 0, config->block_size, block_src, 0)) != 0)
+            return r;
+    }
+
+    // If doing synchronous writes, wait for writes to complete
+    if (config->synchronous) {
+        pthread_mutex_lock(&priv->mutex);
+        for (i = 0; i < num_blocks; i++)
+            block_cache_wait_written(priv, block_num + i);
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+    }
+
+    // Done
+    return 0;
+}
+
+/*
+ * Write a block or a portion thereof.
+ *
+ * If "sync" is true, wait for the write to complete.
+ */
+static int
+block_cache_write(struct block_cache_private *const priv, s3b_block_t block_num, u_int off, u_int len, const void *src,
+  int sync)
+{
+    struct block_cache_conf *const config = priv->config;
+    const int partial_write = off != 0 || len != config->block_size;
+    struct partial_entry *new_part = NULL;
+    struct partial_entry *part;
+    struct cache_entry *entry;
+    int partial_miss = 0;
+    int r;
+
+    // Sanity check
+    assert(off <= config->block_size);
+    assert(len <= config->block_size);
+    assert(off + len <= config->block_size);
+
+    // Grab lock
+    pthread_mutex_lock(&priv->mutex);
+
+again:
     // Sanity check
     S3BCACHE_CHECK_INVARIANTS(priv, 0);
     if (priv->num_threads == 0) {
@@ -1091,9 +2467,8 @@ again:
             }
 
             // Change from CLEAN to DIRTY
-            TAILQ_REMOVE(cleans_list, entry, link);
-            priv->num_cleans--;
-            TAILQ_INSERT_TAIL(&priv->dirties, entry, link);
+            block_cache_clean_remove(priv, entry);
+            TAILQ_INSERT_TAIL(block_cache_dirty_list(priv, entry), entry, link);
             priv->num_dirties++;
             entry->timeout = block_cache_get_time(priv) + priv->dirty_timeout;
             pthread_cond_signal(&priv->worker_work);
@@ -1101,8 +2476,21 @@ again:
         case WRITING2:              // update data, stay in state WRITING2
         case WRITING:               // update data, move to state WRITING2
         case DIRTY:                 // update data, stay in state DIRTY
+
+            // If we would only partly overwrite a missing sector, read the missing sectors first
+            if ((part = block_cache_partial_get(priv, block_num)) != NULL && len > 0
+              && ((off % SECTOR_SIZE != 0 && !block_cache_partial_covers(priv, part, off, 1))
+               || ((off + len) % SECTOR_SIZE != 0 && !block_cache_partial_covers(priv, part, off + len - 1, 1)))) {
+                if ((r = block_cache_partial_fill(priv, entry, part)) != 0)
+                    goto fail;
+                goto again;
+            }
+
+            // Update data
             if ((r = block_cache_write_data(priv, entry, src, off, len)) != 0)
                 (*config->log)(LOG_ERR, "error updating dirty block! %s", strerror(r));
+            if (part != NULL)
+                block_cache_partial_mark(priv, part, off, len);
             entry->dirty = 1;
             if (!partial_miss)
                 priv->stats.write_hits++;
@@ -1119,10 +2507,12 @@ again:
         (*priv->survey_callback)(priv->survey_arg, &block_num, 1);
 
     /*
-     * The block is not in the cache. If we're writing a partial block,
-     * we have to read it into the cache first.
+     * The block is not in the cache. If we're writing a partial block, we have to read it into the cache
+     * first, unless we can track which sectors are valid and read the rest later. The latter requires the
+     * write to be sector aligned, and no leftover partial record from an earlier incarnation of the entry.
      */
-    if (off != 0 || len != config->block_size) {
+    if (partial_write && (priv->partials == NULL || len == 0 || off % SECTOR_SIZE != 0 || len % SECTOR_SIZE != 0
+      || block_cache_partial_get(priv, block_num) != NULL)) {
         if ((r = block_cache_do_read(priv, block_num, 0, 0, NULL, 0)) != 0)
             goto fail;
         if (partial_miss++ == 0)
@@ -1130,6 +2520,12 @@ again:
         goto again;
     }
 
+    // Allocate the partial record now, so we can't fail after creating the entry
+    if (partial_write && new_part == NULL && (new_part = block_cache_partial_new(priv, block_num)) == NULL) {
+        r = errno;
+        goto fail;
+    }
+
     // If there are too many dirty blocks, we have to wait
     if (config->max_dirty != 0 && priv->num_dirties >= config->max_dirty) {
         pthread_cond_signal(&priv->worker_work);
@@ -1138,7 +2534,9 @@ again:
     }
 
     // Get a cache entry, evicting a CLEAN[2] entry if necessary
-    if ((r = block_cache_get_entry(priv, &entry, NULL)) != 0)
+    if ((r = block_cache_get_entry(priv, &entry, NULL)) == EAGAIN)      // the cache may have changed
+        goto again;
+    if (r != 0)
         goto fail;
 
     // If cache is full, wait for an entry to go CLEAN[2] so we can evict it
@@ -1147,6 +2545,10 @@ again:
         goto again;
     }
 
+    // Any compressed copy of the block is now out of date
+    if (priv->ctier != NULL)
+        s3b_ctier_remove(priv->ctier, block_num);
+
     // Record block data
     if ((r = block_cache_write_data(priv, entry, src, off, len)) != 0)
         (*config->log)(LOG_ERR, "error updating dirty block! %s", strerror(r));
@@ -1156,12 +2558,21 @@ again:
     entry->block_num = block_num;
     entry->timeout = block_cache_get_time(priv) + priv->dirty_timeout;
     entry->dirty = 1;
-    assert(off == 0 && len == config->block_size);
+    entry->frequent = block_cache_ghost_take(priv, block_num);
     s3b_hash_put_new(priv->hashtable, entry);
-    TAILQ_INSERT_TAIL(&priv->dirties, entry, link);
+    TAILQ_INSERT_TAIL(block_cache_dirty_list(priv, entry), entry, link);
     priv->num_dirties++;
     assert(ENTRY_GET_STATE(entry) == DIRTY);
 
+    // Remember which sectors are valid if only part of the block was written
+    if (new_part != NULL) {
+        assert(partial_write);
+        s3b_hash_put_new(priv->partials, new_part);
+        block_cache_partial_mark(priv, new_part, off, len);
+        new_part = NULL;
+        priv->stats.partial_writes++;
+    }
+
     // Record dirty disk cache entry
     if (config->cache_file != NULL) {
         if ((r = s3b_dcache_record_block(priv->dcache, entry->u.dslot, entry->block_num, NULL)) != 0)
@@ -1173,46 +2584,57 @@ again:
 
 success:
     // If doing synchronous writes, wait for write to complete
-    if (config->synchronous) {
-        while (1) {
-            int state;
-
-            // Wait for notification
-            pthread_cond_wait(&priv->write_complete, &priv->mutex);
-
-            // Sanity check
-            S3BCACHE_CHECK_INVARIANTS(priv, 0);
-
-            // Find cache entry
-            if ((entry = s3b_hash_get(priv->hashtable, block_num)) == NULL)
-                break;
-
-            // See if it is now clean
-            state = ENTRY_GET_STATE(entry);
-            if (state == CLEAN || state == CLEAN2 || state == READING || state == READING2)
-                break;
-
-            // Not written yet, go back to sleep
-            continue;
-        }
-    }
+    if (sync)
+        block_cache_wait_written(priv, block_num);
     r = 0;
 
 fail:
     // Done
     CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+    free(new_part);
     return r;
 }
 
+/*
+ * Wait for a block that was just written to be written back to the underlying store.
+ *
+ * This assumes the mutex is held.
+ */
+static void
+block_cache_wait_written(struct block_cache_private *const priv, s3b_block_t block_num)
+{
+    struct cache_entry *entry;
+    int state;
+
+    while (1) {
+
+        // Find cache entry
+        if ((entry = s3b_hash_get(priv->hashtable, block_num)) == NULL)
+            break;
+
+        // See if it is now clean
+        state = ENTRY_GET_STATE(entry);
+        if (state == CLEAN || state == CLEAN2 || state == READING || state == READING2)
+            break;
+
+        // Not written yet, wait for notification
+        pthread_cond_wait(&priv->write_complete, &priv->mutex);
+
+        // Sanity check
+        S3BCACHE_CHECK_INVARIANTS(priv, 0);
+    }
+}
+
 /*
  * Acquire a new cache entry. If the cache is full, and there is at least one
  * CLEAN[2] entry, evict and return it (uninitialized). Otherwise, return NULL entry.
  *
- * On successful return, *datap will point to a malloc'd buffer for the data. If using
+ * On successful return, *datap will point to a block_buf_alloc()'d buffer for the data. If using
  * the disk cache, this will be a temporary buffer, otherwise it's the in-memory buffer.
  * If datap == NULL, then in the case of the disk cache only, no buffer is allocated.
  *
- * This assumes the mutex is held.
+ * This assumes the mutex is held. Evicting a block into the compressed tier requires temporarily
+ * releasing it; in that case, EAGAIN is returned and the caller must start over.
  *
  * Returns non-zero on error.
  */
@@ -1227,11 +2649,11 @@ block_cache_get_entry(struct block_cache_private *priv, struct cache_entry **ent
 again:
     /*
      * If cache is not full, allocate a new entry. We allocate the structure
-     * and the data separately in hopes that the malloc() implementation will
-     * put the data into its own page of virtual memory.
+     * separately from the data, which comes from the shared block buffer pool
+     * so it can be recycled without going back to malloc().
      *
      * If the cache is full, try to evict a clean entry. Evict low priority
-     * blocks before high priority blocks.
+     * blocks before high priority blocks (see block_cache_evict_candidate()).
      */
     if (s3b_hash_size(priv->hashtable) < config->cache_size) {
         if ((entry = calloc(1, sizeof(*entry))) == NULL) {
@@ -1240,18 +2662,21 @@ again:
             priv->stats.out_of_memory_errors++;
             return r;
         }
-    } else if ((entry = TAILQ_FIRST(&priv->lo_cleans)) != NULL) {
-        block_cache_free_entry(priv, &entry);
-        goto again;
-    } else if ((entry = TAILQ_FIRST(&priv->hi_cleans)) != NULL) {
+    } else if ((entry = block_cache_evict_candidate(priv)) != NULL) {
+        if (priv->ctier != NULL && ENTRY_GET_STATE(entry) == CLEAN) {
+            block_cache_evict_compressed(priv, entry);
+            priv->stats.evictions++;
+            return EAGAIN;
+        }
         block_cache_free_entry(priv, &entry);
+        priv->stats.evictions++;
         goto again;
     } else
         goto done;
 
     // Get associated data buffer
     if (datap != NULL || config->cache_file == NULL) {
-        if ((data = malloc(config->block_size)) == NULL) {
+        if ((data = block_buf_alloc(config->block_size)) == NULL) {
             r = errno;
             (*config->log)(LOG_ERR, "can't allocate block cache buffer: %s", strerror(r));
             priv->stats.out_of_memory_errors++;
@@ -1265,7 +2690,7 @@ again:
         entry->u.data = data;
     else if ((r = s3b_dcache_alloc_block(priv->dcache, &entry->u.dslot)) != 0) {    // should not happen
         (*config->log)(LOG_ERR, "can't alloc cached block! %s", strerror(r));
-        free(data);             // OK if NULL
+        block_buf_free(data);   // OK if NULL
         data = NULL;
         free(entry);
         entry = NULL;
@@ -1288,7 +2713,6 @@ block_cache_free_entry(struct block_cache_private *priv, struct cache_entry **en
 {
     struct block_cache_conf *const config = priv->config;
     struct cache_entry *const entry = *entryp;
-    struct list_head *const cleans_list = block_cache_cleans_list(priv, entry->block_num);
     int r;
 
     // Sanity check
@@ -1304,17 +2728,72 @@ block_cache_free_entry(struct block_cache_private *priv, struct cache_entry **en
         if ((r = s3b_dcache_free_block(priv->dcache, entry->u.dslot)) != 0)
             (*config->log)(LOG_ERR, "can't free cached block! %s", strerror(r));
     } else
-        free(entry->u.data);
+        block_buf_free(entry->u.data);
+
+    // Remember blocks evicted before becoming frequent (2Q only)
+    if (block_cache_cleans_list(priv, entry) == &priv->new_cleans)
+        block_cache_ghost_add(priv, entry->block_num);
 
     // Remove entry from the clean list
-    TAILQ_REMOVE(cleans_list, entry, link);
+    block_cache_clean_remove(priv, entry);
     s3b_hash_remove(priv->hashtable, entry->block_num);
-    priv->num_cleans--;
 
     // Free the entry
     free(entry);
 }
 
+/*
+ * Evict a CLEAN entry into the compressed tier.
+ *
+ * The entry is put into state READING while we compress its data with the mutex released, so other threads
+ * can't use, modify, or evict the block meanwhile; anyone who wants it waits for end_reading and then finds
+ * it in the compressed tier.
+ *
+ * This assumes the mutex is held, but temporarily releases it.
+ */
+static void
+block_cache_evict_compressed(struct block_cache_private *priv, struct cache_entry *entry)
+{
+    const s3b_block_t block_num = entry->block_num;
+    void *cbuf;
+    size_t clen;
+    int r;
+
+    // Sanity check
+    assert(ENTRY_GET_STATE(entry) == CLEAN);
+    assert(priv->config->cache_file == NULL);
+
+    // Remember blocks evicted before becoming frequent (2Q only)
+    if (block_cache_cleans_list(priv, entry) == &priv->new_cleans)
+        block_cache_ghost_add(priv, block_num);
+
+    // Change from CLEAN to READING
+    block_cache_clean_remove(priv, entry);
+    ENTRY_RESET_LINK(entry);
+    entry->timeout = READING_TIMEOUT;
+    assert(ENTRY_GET_STATE(entry) == READING);
+
+    // Compress the data while unlocked
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+    r = s3b_ctier_compress(priv->ctier, entry->u.data, &cbuf, &clen);
+    pthread_mutex_lock(&priv->mutex);
+
+    // Store the compressed copy; the entry is ours, so there can't be any newer version of the block
+    assert(s3b_hash_get(priv->hashtable, block_num) == entry);
+    if (r == 0)
+        s3b_ctier_store(priv->ctier, block_num, cbuf, clen);
+
+    // Free the entry
+    s3b_hash_remove(priv->hashtable, block_num);
+    block_buf_free(entry->u.data);
+    free(entry);
+
+    // Wake up threads waiting for the block or for space
+    pthread_cond_broadcast(&priv->end_reading);
+    pthread_cond_signal(&priv->space_avail);
+    S3BCACHE_CHECK_INVARIANTS(priv, 0);
+}
+
 /*
  * Worker thread main entry point.
  */
@@ -1325,11 +2804,21 @@ block_cache_worker_main(void *arg)
     struct block_cache_conf *const config = priv->config;
     struct cache_entry *entry;
     struct cache_entry *clean_entry = NULL;
-    struct list_head *cleans_list;
+    struct cache_entry *wait_entry;
+    struct block_fetch *fetch;
+    struct ra_stream *stream;
     u_char etag[MD5_DIGEST_LENGTH];
+    u_char *coalesce_etags = NULL;
+    void *coalesce_buf = NULL;
+    struct partial_entry *part;
+    bitmap_t *fill_valid = NULL;
+    void *fill_buf = NULL;
+    int fill_r;
     uint32_t adjusted_now;
+    double write_start;
     uint32_t now;
     u_int thread_id;
+    u_int wbclass;
     void *buf;
     int r;
 
@@ -1343,11 +2832,31 @@ block_cache_worker_main(void *arg)
      * Allocate buffer for outgoing block data. We have to copy it before we send it in case
      * another write to this block comes in and updates the data associated with the cache entry.
      */
-    if ((buf = malloc(config->block_size)) == NULL) {
+    if ((buf = block_buf_alloc(config->block_size)) == NULL) {
         (*config->log)(LOG_ERR, "block_cache worker %u can't alloc buffer, exiting: %s", thread_id, strerror(errno));
         goto done;
     }
 
+    // Allocate buffers for reading the missing sectors of partially written blocks (if enabled)
+    if (priv->partials != NULL) {
+        if ((fill_buf = block_buf_alloc(config->block_size)) == NULL
+          || (fill_valid = bitmap_init(priv->num_sectors, 0)) == NULL) {
+            (*config->log)(LOG_ERR, "block_cache worker %u can't alloc buffer, exiting: %s", thread_id, strerror(errno));
+            goto done;
+        }
+    }
+
+    // Allocate buffers for coalesced writebacks (if enabled); if we can't, just write blocks one at a time
+    if (config->write_coalesce > 1 && priv->inner->write_blocks != NULL) {
+        if ((coalesce_buf = block_buf_alloc((size_t)config->write_coalesce * config->block_size)) == NULL
+          || (coalesce_etags = malloc((size_t)config->write_coalesce * MD5_DIGEST_LENGTH)) == NULL) {
+            (*config->log)(LOG_WARNING, "block_cache worker %u can't alloc coalescing buffer: %s",
+              thread_id, strerror(errno));
+            block_buf_free(coalesce_buf);
+            coalesce_buf = NULL;
+        }
+    }
+
     // Repeatedly do stuff until told to stop
     while (1) {
 
@@ -1359,6 +2868,10 @@ block_cache_worker_main(void *arg)
 
         // Evict any CLEAN[2] blocks that have timed out (if enabled)
         if (priv->clean_timeout != 0) {
+            while ((clean_entry = TAILQ_FIRST(&priv->new_cleans)) != NULL && now >= clean_entry->timeout) {
+                block_cache_free_entry(priv, &clean_entry);
+                pthread_cond_signal(&priv->space_avail);
+            }
             while ((clean_entry = TAILQ_FIRST(&priv->lo_cleans)) != NULL && now >= clean_entry->timeout) {
                 block_cache_free_entry(priv, &clean_entry);
                 pthread_cond_signal(&priv->space_avail);
@@ -1373,12 +2886,23 @@ block_cache_worker_main(void *arg)
         adjusted_now = now + (uint32_t)(priv->dirty_timeout * (block_cache_dirty_ratio(priv) / priv->max_dirty_ratio));
 
         // See if there is a block that needs writing
-        if ((entry = TAILQ_FIRST(&priv->dirties)) != NULL && (priv->stopping || adjusted_now >= entry->timeout)) {
+        if ((entry = block_cache_next_dirty(priv, adjusted_now, &wbclass, &wait_entry)) != NULL) {
 
             // If we are also supposed to do read-ahead, wake up a sibling to handle it
-            if (priv->seq_count >= config->read_ahead_trigger && priv->ra_count < config->read_ahead)
+            if (block_cache_ra_ready(priv) != NULL)
                 pthread_cond_signal(&priv->worker_work);
 
+            // If another thread is reading the missing sectors of this block, let it finish first
+            if ((part = block_cache_partial_get(priv, entry->block_num)) != NULL && part->filling) {
+                pthread_cond_wait(&priv->end_reading, &priv->mutex);
+                continue;
+            }
+
+            // Write back this block together with any immediately following dirty blocks, if possible
+            if (part == NULL && coalesce_buf != NULL
+              && block_cache_write_coalesced(priv, entry, wbclass, coalesce_buf, coalesce_etags))
+                continue;
+
             // Copy data to our private buffer; it may change while we're writing
             if ((r = block_cache_read_data(priv, entry, buf, 0, config->block_size)) != 0) {
                 (*config->log)(LOG_ERR, "error reading cached block! %s", strerror(r));
@@ -1388,17 +2912,43 @@ block_cache_worker_main(void *arg)
 
             // Move to WRITING state
             assert(ENTRY_GET_STATE(entry) == DIRTY);
-            TAILQ_REMOVE(&priv->dirties, entry, link);
+            TAILQ_REMOVE(block_cache_dirty_list(priv, entry), entry, link);
             ENTRY_RESET_LINK(entry);
             entry->dirty = 0;
             entry->timeout = 0;
             assert(ENTRY_GET_STATE(entry) == WRITING);
 
-            // Attempt to write the block
+            // If the block is partially written, remember which sectors we have
+            if (part != NULL)
+                memcpy(fill_valid, part->valid, bitmap_size(priv->num_sectors) * sizeof(*fill_valid));
+
+            // Attempt to write the block, first reading and merging any missing sectors
+            priv->num_writing[wbclass]++;
+            write_start = monotonic_time();
             CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
-            r = (*priv->inner->write_block)(priv->inner, entry->block_num, buf, etag, block_cache_check_cancel, priv);
+            fill_r = 0;
+            if (part != NULL && (fill_r = (*priv->inner->read_block)(priv->inner, entry->block_num, fill_buf, NULL, NULL, 0)) == 0)
+                block_cache_partial_merge(priv, fill_valid, fill_buf, buf);
+            r = fill_r == 0 ?
+              (*priv->inner->write_block)(priv->inner, entry->block_num, buf, etag, block_cache_check_cancel, priv) : fill_r;
             pthread_mutex_lock(&priv->mutex);
             S3BCACHE_CHECK_INVARIANTS(priv, 1);
+            priv->num_writing[wbclass]--;
+            if (r == 0) {
+                latency_record(&priv->stats.writebacks, monotonic_time() - write_start);
+                block_cache_count_writeback(priv, wbclass, 1);
+            }
+
+            // Merge the sectors we read into the cached copy too, unless somebody already did
+            if (part != NULL && fill_r == 0 && (part = block_cache_partial_get(priv, entry->block_num)) != NULL) {
+                block_cache_partial_merge(priv, part->valid, fill_buf, entry->u.data);
+                priv->stats.partial_fills++;
+                if (part->filling)
+                    memset(part->valid, 0xff, bitmap_size(priv->num_sectors) * sizeof(*part->valid));
+                else
+                    block_cache_partial_free(priv, part);
+                pthread_cond_broadcast(&priv->end_reading);
+            }
 
             // Sanity checks
             assert(ENTRY_GET_STATE(entry) == WRITING || ENTRY_GET_STATE(entry) == WRITING2);
@@ -1406,31 +2956,12 @@ block_cache_worker_main(void *arg)
             // If write attempt failed (or we canceled it), go back to the DIRTY state and try again later
             if (r != 0) {
                 entry->dirty = 1;
-                TAILQ_INSERT_HEAD(&priv->dirties, entry, link);
-                continue;
-            }
-
-            // If block was not modified while being written (WRITING), it is now CLEAN
-            if (!entry->dirty) {
-                if (config->cache_file != NULL) {
-                    if ((r = s3b_dcache_record_block(priv->dcache, entry->u.dslot, entry->block_num, etag)) != 0)
-                        (*config->log)(LOG_ERR, "can't record cached block! %s", strerror(r));
-                }
-                priv->num_dirties--;
-                cleans_list = block_cache_cleans_list(priv, entry->block_num);
-                TAILQ_INSERT_TAIL(cleans_list, entry, link);
-                entry->verify = 0;
-                entry->timeout = block_cache_get_time(priv) + priv->clean_timeout;
-                priv->num_cleans++;
-                assert(ENTRY_GET_STATE(entry) == CLEAN);
-                pthread_cond_signal(&priv->space_avail);
-                pthread_cond_broadcast(&priv->write_complete);
+                TAILQ_INSERT_HEAD(block_cache_dirty_list(priv, entry), entry, link);
                 continue;
             }
 
-            // Block was modified while being written (WRITING2), so it stays DIRTY
-            TAILQ_INSERT_TAIL(&priv->dirties, entry, link);
-            entry->timeout = now + priv->dirty_timeout;     // update for 2nd write timing conservatively
+            // Update the block's state
+            block_cache_write_complete(priv, entry, etag, now);
             continue;
         }
 
@@ -1438,13 +2969,58 @@ block_cache_worker_main(void *arg)
         if (priv->stopping != 0)
             break;
 
+        // See if there is a multi-block read we can help with (as long as we wouldn't have to wait for space)
+        if ((fetch = TAILQ_FIRST(&priv->fetches)) != NULL && block_cache_space_available(priv)) {
+            const s3b_block_t fetch_block = fetch->block_num + fetch->next++;
+
+            // Claim the next block, and remove the fetch from the list if there are no more
+            assert(fetch->queued);
+            assert(fetch->next <= fetch->num_blocks);
+            if (fetch->next == fetch->num_blocks)
+                block_cache_unqueue_fetch(priv, fetch);
+
+            // Read the block into the cache (if not already there)
+            if (s3b_hash_get(priv->hashtable, fetch_block) == NULL)
+                (void)block_cache_do_read(priv, fetch_block, 0, 0, NULL, 0);
+            continue;
+        }
+
+        // See if there is a block that was read in part that we should now read in full
+        if (priv->num_range_fetches > 0 && block_cache_space_available(priv)) {
+            const s3b_block_t fetch_block = priv->range_fetches[priv->range_fetch_first];
+
+            // Claim the block
+            priv->range_fetch_first = (priv->range_fetch_first + 1) % RANGE_FETCH_MAX;
+            priv->num_range_fetches--;
+
+            // Read the block into the cache (if not already there)
+            if (s3b_hash_get(priv->hashtable, fetch_block) == NULL)
+                (void)block_cache_do_read(priv, fetch_block, 0, 0, NULL, 0);
+            continue;
+        }
+
         // See if there is a read-ahead block that needs to be read
-        if (priv->seq_count >= config->read_ahead_trigger && priv->ra_count < config->read_ahead) {
-            while (priv->ra_count < config->read_ahead) {
+        if ((stream = block_cache_ra_ready(priv)) != NULL) {
+            while (stream->ra_count < stream->window) {
+                const int stride = stream->stride != 0 ? stream->stride : 1;
                 s3b_block_t ra_block;
+                int64_t next;
 
                 // We will handle read-ahead for the next read-ahead block; claim it now
-                ra_block = priv->seq_last + ++priv->ra_count;
+                next = (int64_t)stream->last + (int64_t)stride * ++stream->ra_count;
+
+                // Stop if reading backwards and we've reached the beginning
+                if (next < 0) {
+                    stream->ra_count = stream->window;
+                    break;
+                }
+                ra_block = (s3b_block_t)next;
+
+                // Stop if the block belongs to some other shard
+                if (priv->num_shards > 0 && block_cache_shard_index(priv->num_shards, ra_block) != priv->shard) {
+                    stream->ra_count = stream->window;
+                    break;
+                }
 
                 // If block already exists in the cache, nothing needs to be done
                 if (s3b_hash_get(priv->hashtable, ra_block) != NULL)
@@ -1457,8 +3033,49 @@ block_cache_worker_main(void *arg)
             continue;
         }
 
+        // Once the cache is full, hot blocks from the previous run are no longer worth reading; skip to any hinted blocks
+        if (priv->prefetch_next < priv->prefetch_hints && s3b_hash_size(priv->hashtable) >= config->cache_size) {
+            if ((priv->prefetch_next = priv->prefetch_hints) == priv->num_prefetch) {
+                free(priv->prefetch);
+                priv->prefetch = NULL;
+                priv->num_prefetch = 0;
+                priv->prefetch_alloc = 0;
+                priv->prefetch_next = 0;
+                priv->prefetch_hints = 0;
+            }
+        }
+
+        // See if there is a hot block from the previous run (as long as we wouldn't evict anything) or a hinted
+        // block (as long as a normal read could proceed without waiting for space) to prefetch
+        if (priv->prefetch_next < priv->num_prefetch
+          && priv->num_prefetching < config->prefetch_threads
+          && (s3b_hash_size(priv->hashtable) < config->cache_size
+           || (priv->prefetch_next >= priv->prefetch_hints && block_cache_space_available(priv)))) {
+            const s3b_block_t fetch_block = priv->prefetch[priv->prefetch_next++];
+
+            // Claim the block, and free the list if there are no more
+            if (priv->prefetch_next == priv->num_prefetch) {
+                free(priv->prefetch);
+                priv->prefetch = NULL;
+                priv->num_prefetch = 0;
+                priv->prefetch_alloc = 0;
+                priv->prefetch_next = 0;
+                priv->prefetch_hints = 0;
+            }
+
+            // Read the block into the cache (if not already there), letting a sibling start on the next one
+            if (s3b_hash_get(priv->hashtable, fetch_block) == NULL) {
+                if (++priv->num_prefetching < config->prefetch_threads && priv->prefetch_next < priv->num_prefetch)
+                    pthread_cond_signal(&priv->worker_work);
+                if (block_cache_do_read(priv, fetch_block, 0, 0, NULL, 0) == 0)
+                    priv->stats.prefetches++;
+                priv->num_prefetching--;
+            }
+            continue;
+        }
+
         // There is nothing to do at this time; sleep until there is something to do
-        if (entry == NULL || (clean_entry != NULL && clean_entry->timeout < entry->timeout))
+        if ((entry = wait_entry) == NULL || (clean_entry != NULL && clean_entry->timeout < entry->timeout))
             entry = clean_entry;
         block_cache_worker_wait(priv, entry);
     }
@@ -1470,223 +3087,1243 @@ block_cache_worker_main(void *arg)
 done:
     // Done
     CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
-    free(buf);
+    block_buf_free(coalesce_buf);
+    free(coalesce_etags);
+    block_buf_free(fill_buf);
+    bitmap_free(&fill_valid);
+    block_buf_free(buf);
     return NULL;
 }
 
 /*
- * See if we want to cancel the current write for the given block.
+ * Write back the dirty block "entry" along with any dirty blocks immediately following it, all in one
+ * write_blocks() call to the underlying store. "buf" and "etags" must have room for config->write_coalesce blocks.
+ *
+ * Returns zero (having done nothing) if there is no following dirty block, otherwise non-zero.
+ *
+ * This assumes the mutex is held.
  */
 static int
-block_cache_check_cancel(void *arg, s3b_block_t block_num)
+block_cache_write_coalesced(struct block_cache_private *priv, struct cache_entry *entry, u_int wbclass, void *buf,
+    u_char *etags)
 {
-    struct block_cache_private *const priv = arg;
-    struct cache_entry *entry;
+    struct block_cache_conf *const config = priv->config;
+    struct cache_entry *run[BLOCK_CACHE_MAX_WRITE_COALESCE];
+    const s3b_block_t block_num = entry->block_num;
+    struct cache_entry *next;
+    double write_start;
+    double write_time;
+    uint32_t now;
+    u_int num_blocks;
+    u_int i;
     int r;
 
-    // Lock mutex
-    pthread_mutex_lock(&priv->mutex);
-    S3BCACHE_CHECK_INVARIANTS(priv, 1);
-
-    // Find cache entry
-    entry = s3b_hash_get(priv->hashtable, block_num);
-
     // Sanity check
-    assert(entry != NULL);
-    assert(entry->block_num == block_num);
-    assert(ENTRY_GET_STATE(entry) == WRITING || ENTRY_GET_STATE(entry) == WRITING2);
+    assert(ENTRY_GET_STATE(entry) == DIRTY);
+    assert(config->write_coalesce <= BLOCK_CACHE_MAX_WRITE_COALESCE);
+
+    // Find the run of dirty blocks starting with this one, copying their data as we go
+    for (num_blocks = 0; num_blocks < config->write_coalesce; num_blocks++) {
+        if (num_blocks == 0)
+            next = entry;
+        else if ((next = s3b_hash_get(priv->hashtable, block_num + num_blocks)) == NULL || ENTRY_GET_STATE(next) != DIRTY
+          || block_cache_partial_get(priv, next->block_num) != NULL)
+            break;
+        if (block_cache_read_data(priv, next, (char *)buf + (size_t)num_blocks * config->block_size,
+          0, config->block_size) != 0)
+            break;
+        run[num_blocks] = next;
+    }
+    if (num_blocks < 2)
+        return 0;
 
-    // If block is in the WRITING2 state, cancel the current (obsolete) write operation
-    r = entry->dirty;
+    // Move all of them to WRITING state
+    for (i = 0; i < num_blocks; i++) {
+        next = run[i];
+        TAILQ_REMOVE(block_cache_dirty_list(priv, next), next, link);
+        ENTRY_RESET_LINK(next);
+        next->dirty = 0;
+        next->timeout = 0;
+        assert(ENTRY_GET_STATE(next) == WRITING);
+    }
 
-    // Unlock mutex
+    // Attempt to write the blocks
+    priv->num_writing[wbclass]++;
+    write_start = monotonic_time();
     CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
-    return r;
+    r = (*priv->inner->write_blocks)(priv->inner, block_num, num_blocks, buf, etags, block_cache_check_cancel, priv);
+    pthread_mutex_lock(&priv->mutex);
+    S3BCACHE_CHECK_INVARIANTS(priv, 1);
+    priv->num_writing[wbclass]--;
+    now = block_cache_get_time(priv);
+
+    // If write attempt failed, put them all back in the DIRTY state (keeping their order) and try again later
+    if (r != 0) {
+        for (i = num_blocks; i-- > 0; ) {
+            next = run[i];
+            assert(ENTRY_GET_STATE(next) == WRITING || ENTRY_GET_STATE(next) == WRITING2);
+            next->dirty = 1;
+            TAILQ_INSERT_HEAD(block_cache_dirty_list(priv, next), next, link);
+        }
+        return 1;
+    }
+
+    // Update stats
+    write_time = monotonic_time() - write_start;
+    priv->stats.coalesced_writes++;
+    priv->stats.coalesced_blocks += num_blocks;
+    block_cache_count_writeback(priv, wbclass, num_blocks);
+    for (i = 0; i < num_blocks; i++)
+        latency_record(&priv->stats.writebacks, write_time);
+
+    // Update each block's state
+    for (i = 0; i < num_blocks; i++)
+        block_cache_write_complete(priv, run[i], etags + (size_t)i * MD5_DIGEST_LENGTH, now);
+    return 1;
 }
 
 /*
- * Sleep until either the 'worker_work' condition becomes true, or the
- * entry (if any) times out.
+ * Update a block's state after it has been successfully written back.
  *
  * This assumes the mutex is held.
  */
 static void
-block_cache_worker_wait(struct block_cache_private *priv, struct cache_entry *entry)
+block_cache_write_complete(struct block_cache_private *priv, struct cache_entry *entry, const u_char *etag, uint32_t now)
 {
-    uint64_t wake_time_millis;
+    struct block_cache_conf *const config = priv->config;
+    int r;
+
+    // Sanity check
+    assert(ENTRY_GET_STATE(entry) == WRITING || ENTRY_GET_STATE(entry) == WRITING2);
+
+    // If block was not modified while being written (WRITING), it is now CLEAN
+    if (!entry->dirty) {
+        if (config->cache_file != NULL) {
+            if ((r = s3b_dcache_record_block(priv->dcache, entry->u.dslot, entry->block_num, etag)) != 0)
+                (*config->log)(LOG_ERR, "can't record cached block! %s", strerror(r));
+        }
+        priv->num_dirties--;
+        entry->verify = 0;
+        entry->timeout = block_cache_get_time(priv) + priv->clean_timeout;
+        block_cache_clean_insert(priv, entry);
+        assert(ENTRY_GET_STATE(entry) == CLEAN);
+        pthread_cond_signal(&priv->space_avail);
+        pthread_cond_broadcast(&priv->write_complete);
+        return;
+    }
+
+    // Block was modified while being written (WRITING2), so it stays DIRTY
+    TAILQ_INSERT_TAIL(block_cache_dirty_list(priv, entry), entry, link);
+    entry->timeout = now + priv->dirty_timeout;     // update for 2nd write timing conservatively
+}
+
+/*
+ * Find the next DIRTY block to write back, if any, taking the writeback classes in priority order and
+ * honoring their concurrency limits. Blocks in the WB_FLUSH class are written immediately; others wait
+ * until their (adjusted) timeout. If there is no such block, set *waitp to the block whose timeout we
+ * should sleep until, if any.
+ *
+ * This assumes the mutex is held.
+ */
+static struct cache_entry *
+block_cache_next_dirty(struct block_cache_private *priv, uint32_t now, u_int *wbclassp, struct cache_entry **waitp)
+{
+    struct cache_entry *entry;
+    u_int wbclass;
+
+    *waitp = NULL;
+    for (wbclass = 0; wbclass < WB_NUM_CLASSES; wbclass++) {
+        if ((entry = TAILQ_FIRST(&priv->dirties[wbclass])) == NULL)
+            continue;
+        if (!priv->stopping && priv->wb_limit[wbclass] != 0 && priv->num_writing[wbclass] >= priv->wb_limit[wbclass])
+            continue;                       // a thread writing this class will come back for it when done
+        if (priv->stopping || wbclass == WB_FLUSH || now >= entry->timeout) {
+            *wbclassp = wbclass;
+            return entry;
+        }
+        if (*waitp == NULL || entry->timeout < (*waitp)->timeout)
+            *waitp = entry;
+    }
+    return NULL;
+}
+
+/*
+ * Get the list for a DIRTY block, which depends on its writeback class.
+ *
+ * This assumes the mutex is held.
+ */
+static struct list_head *
+block_cache_dirty_list(struct block_cache_private *priv, struct cache_entry *entry)
+{
+    if (s3b_hash_get(priv->flushing, entry->block_num) != NULL)
+        return &priv->dirties[WB_FLUSH];
+    if (entry->block_num < priv->config->priority_blocks)
+        return &priv->dirties[WB_PRIORITY];
+    return &priv->dirties[WB_BACKGROUND];
+}
+
+/*
+ * Determine whether there are any DIRTY blocks.
+ *
+ * This assumes the mutex is held.
+ */
+static int
+block_cache_have_dirties(struct block_cache_private *priv)
+{
+    u_int i;
+
+    for (i = 0; i < WB_NUM_CLASSES; i++) {
+        if (TAILQ_FIRST(&priv->dirties[i]) != NULL)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * Note that a thread is waiting for a block to be written back, which puts it in the WB_FLUSH class.
+ * If the block is DIRTY, the caller must remove it from its list first and put it back after.
+ *
+ * This assumes the mutex is held.
+ */
+static int
+block_cache_flush_wait(struct block_cache_private *priv, s3b_block_t block_num)
+{
+    struct flush_waiter *waiter;
+
+    if ((waiter = s3b_hash_get(priv->flushing, block_num)) == NULL) {
+        if (s3b_hash_size(priv->flushing) >= priv->config->cache_size)
+            return ENOSPC;
+        if ((waiter = calloc(1, sizeof(*waiter))) == NULL) {
+            priv->stats.out_of_memory_errors++;
+            return ENOMEM;
+        }
+        waiter->block_num = block_num;
+        s3b_hash_put_new(priv->flushing, waiter);
+    }
+    waiter->count++;
+    return 0;
+}
+
+/*
+ * Undo block_cache_flush_wait(). When the last waiting thread is done, the block returns to its normal class.
+ *
+ * This assumes the mutex is held.
+ */
+static void
+block_cache_flush_unwait(struct block_cache_private *priv, s3b_block_t block_num)
+{
+    struct flush_waiter *const waiter = s3b_hash_get(priv->flushing, block_num);
+    struct cache_entry *entry;
+    int dirty;
+
+    // Sanity check
+    assert(waiter != NULL && waiter->count > 0);
+
+    // Any other waiters?
+    if (--waiter->count > 0)
+        return;
+
+    // Remove from the flush class, moving a DIRTY block to the front of its normal list
+    entry = s3b_hash_get(priv->hashtable, block_num);
+    if ((dirty = entry != NULL && ENTRY_GET_STATE(entry) == DIRTY))
+        TAILQ_REMOVE(&priv->dirties[WB_FLUSH], entry, link);
+    s3b_hash_remove(priv->flushing, block_num);
+    if (dirty)
+        TAILQ_INSERT_HEAD(block_cache_dirty_list(priv, entry), entry, link);
+    free(waiter);
+}
+
+/*
+ * Update stats for blocks successfully written back from the given class.
+ *
+ * This assumes the mutex is held.
+ */
+static void
+block_cache_count_writeback(struct block_cache_private *priv, u_int wbclass, u_int num_blocks)
+{
+    switch (wbclass) {
+    case WB_FLUSH:
+        priv->stats.flush_writebacks += num_blocks;
+        break;
+    case WB_PRIORITY:
+        priv->stats.priority_writebacks += num_blocks;
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * Find the partial record for a block, if any.
+ *
+ * This assumes the mutex is held.
+ */
+static struct partial_entry *
+block_cache_partial_get(struct block_cache_private *priv, s3b_block_t block_num)
+{
+    if (priv->partials == NULL)
+        return NULL;
+    return s3b_hash_get(priv->partials, block_num);
+}
+
+/*
+ * Allocate a new partial record with no valid sectors. The caller is responsible for adding it to priv->partials.
+ *
+ * This assumes the mutex is held.
+ */
+static struct partial_entry *
+block_cache_partial_new(struct block_cache_private *priv, s3b_block_t block_num)
+{
+    struct partial_entry *part;
+
+    if ((part = calloc(1, sizeof(*part) + bitmap_size(priv->num_sectors) * sizeof(*part->valid))) == NULL) {
+        priv->stats.out_of_memory_errors++;
+        return NULL;
+    }
+    part->block_num = block_num;
+    return part;
+}
+
+/*
+ * Remove a partial record and free it.
+ *
+ * This assumes the mutex is held.
+ */
+static void
+block_cache_partial_free(struct block_cache_private *priv, struct partial_entry *part)
+{
+    s3b_hash_remove(priv->partials, part->block_num);
+    free(part);
+}
+
+/*
+ * Determine whether every sector overlapping the given range of the block is valid.
+ *
+ * This assumes the mutex is held.
+ */
+static int
+block_cache_partial_covers(struct block_cache_private *priv, struct partial_entry *part, u_int off, u_int len)
+{
+    const u_int end = (off + len + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    u_int sector;
+
+    for (sector = off / SECTOR_SIZE; sector < end; sector++) {
+        if (!bitmap_test(part->valid, sector))
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Mark the sectors completely contained in the given range of the block as valid.
+ * If that makes the whole block valid, the partial record is no longer needed.
+ *
+ * This assumes the mutex is held.
+ */
+static void
+block_cache_partial_mark(struct block_cache_private *priv, struct partial_entry *part, u_int off, u_int len)
+{
+    const u_int end = (off + len) / SECTOR_SIZE;
+    u_int sector;
+
+    // Mark sectors
+    for (sector = (off + SECTOR_SIZE - 1) / SECTOR_SIZE; sector < end; sector++)
+        bitmap_set(part->valid, sector, 1);
+
+    // If the whole block has now been written, we will never need to read it (unless somebody already is)
+    if (part->filling || !block_cache_partial_covers(priv, part, 0, priv->config->block_size))
+        return;
+    block_cache_partial_free(priv, part);
+    priv->stats.partial_skips++;
+}
+
+/*
+ * Copy the sectors that are not valid according to "valid" from "src" into "dest".
+ */
+static void
+block_cache_partial_merge(struct block_cache_private *priv, const bitmap_t *valid, const void *src, void *dest)
+{
+    u_int sector;
+    u_int run;
+
+    for (sector = 0; sector < priv->num_sectors; sector += run) {
+        if (bitmap_test(valid, sector)) {
+            run = 1;
+            continue;
+        }
+        for (run = 1; sector + run < priv->num_sectors && !bitmap_test(valid, sector + run); run++)
+            ;
+        memcpy((char *)dest + (size_t)sector * SECTOR_SIZE, (const char *)src + (size_t)sector * SECTOR_SIZE,
+          (size_t)run * SECTOR_SIZE);
+    }
+}
+
+/*
+ * Read the missing sectors of a partially written block from the underlying store and merge them into the cached data.
+ * If another thread is already doing this, just wait for it to finish. Either way, the caller must start over.
+ *
+ * This assumes the mutex is held. Note the mutex is temporarily released.
+ */
+static int
+block_cache_partial_fill(struct block_cache_private *priv, struct cache_entry *entry, struct partial_entry *part)
+{
+    struct block_cache_conf *const config = priv->config;
+    const s3b_block_t block_num = entry->block_num;
+    void *buf;
+    int r;
+
+    // Sanity check
+    assert(ENTRY_GET_STATE(entry) == DIRTY || ENTRY_GET_STATE(entry) == WRITING || ENTRY_GET_STATE(entry) == WRITING2);
+
+    // If someone else is already reading, wait for them
+    if (part->filling) {
+        pthread_cond_wait(&priv->end_reading, &priv->mutex);
+        return 0;
+    }
+
+    // Allocate a buffer
+    if ((buf = block_buf_alloc(config->block_size)) == NULL) {
+        r = errno;
+        priv->stats.out_of_memory_errors++;
+        return r;
+    }
+
+    // Read the block
+    part->filling = 1;
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+    r = (*priv->inner->read_block)(priv->inner, block_num, buf, NULL, NULL, 0);
+    pthread_mutex_lock(&priv->mutex);
+    S3BCACHE_CHECK_INVARIANTS(priv, 1);
+
+    // Merge in the sectors that are still missing (if a worker already did, the entry may even be gone)
+    if ((part = block_cache_partial_get(priv, block_num)) != NULL) {
+        if (r == 0) {
+            if ((entry = s3b_hash_get(priv->hashtable, block_num)) != NULL)
+                block_cache_partial_merge(priv, part->valid, buf, entry->u.data);
+            block_cache_partial_free(priv, part);
+            priv->stats.partial_fills++;
+        } else
+            part->filling = 0;
+    }
+
+    // Wake up anyone waiting for us
+    pthread_cond_broadcast(&priv->end_reading);
+    block_buf_free(buf);
+    return r;
+}
+
+/*
+ * See if we want to cancel the current write for the given block.
+ */
+static int
+block_cache_check_cancel(void *arg, s3b_block_t block_num)
+{
+    struct block_cache_private *const priv = arg;
+    struct cache_entry *entry;
+    int r;
+
+    // Lock mutex
+    pthread_mutex_lock(&priv->mutex);
+    S3BCACHE_CHECK_INVARIANTS(priv, 1);
+
+    // Find cache entry
+    entry = s3b_hash_get(priv->hashtable, block_num);
+
+    // Sanity check
+    assert(entry != NULL);
+    assert(entry->block_num == block_num);
+    assert(ENTRY_GET_STATE(entry) == WRITING || ENTRY_GET_STATE(entry) == WRITING2);
+
+    // If block is in the WRITING2 state, cancel the current (obsolete) write operation
+    r = entry->dirty;
+
+    // Unlock mutex
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+    return r;
+}
+
+/*
+ * Sleep until either the 'worker_work' condition becomes true, or the
+ * entry (if any) times out.
+ *
+ * This assumes the mutex is held.
+ */
+static void
+block_cache_worker_wait(struct block_cache_private *priv, struct cache_entry *entry)
+{
+    uint64_t wake_time_millis;
+
+    if (entry == NULL) {
+        pthread_cond_wait(&priv->worker_work, &priv->mutex);
+        return;
+    }
+    wake_time_millis = priv->start_time + ((uint64_t)entry->timeout * TIME_UNIT_MILLIS);
+    block_cache_cond_timedwait(priv, &priv->worker_work, wake_time_millis);
+}
+
+/*
+ * Sleep until the specified condition becomes true, or the specified wakeup time is reached.
+ *
+ * Returns ETIMEDOUT if we timed out.
+ */
+static int
+block_cache_cond_timedwait(struct block_cache_private *priv, pthread_cond_t *cond, uint64_t wake_time_millis)
+{
+    struct timespec wake_time;
+
+    wake_time.tv_sec = wake_time_millis / 1000;
+    wake_time.tv_nsec = (wake_time_millis % 1000) * 1000000;
+    return pthread_cond_timedwait(cond, &priv->mutex, &wake_time);
+}
+
+/*
+ * Return current time in units of TIME_UNIT_MILLIS milliseconds since startup.
+ */
+static uint32_t
+block_cache_get_time(struct block_cache_private *priv)
+{
+    uint64_t since_start;
+
+    since_start = block_cache_get_time_millis() - priv->start_time;
+    return (uint32_t)(since_start / TIME_UNIT_MILLIS);
+}
+
+/*
+ * Get the head of the appropriate clean list for an entry, based on whether the block
+ * is low or high priority and, when using 2Q, whether the block is frequently used.
+ */
+static struct list_head *
+block_cache_cleans_list(struct block_cache_private *const priv, struct cache_entry *entry)
+{
+    if (block_cache_high_prio(priv->config, entry->block_num))
+        return &priv->hi_cleans;
+    return priv->max_ghosts == 0 || entry->frequent ? &priv->lo_cleans : &priv->new_cleans;
+}
+
+/*
+ * Add an entry to the tail of its clean list.
+ */
+static void
+block_cache_clean_insert(struct block_cache_private *const priv, struct cache_entry *entry)
+{
+    struct list_head *const cleans_list = block_cache_cleans_list(priv, entry);
+
+    TAILQ_INSERT_TAIL(cleans_list, entry, link);
+    if (cleans_list == &priv->new_cleans)
+        priv->num_new_cleans++;
+    priv->num_cleans++;
+}
+
+/*
+ * Remove an entry from its clean list.
+ */
+static void
+block_cache_clean_remove(struct block_cache_private *const priv, struct cache_entry *entry)
+{
+    struct list_head *const cleans_list = block_cache_cleans_list(priv, entry);
+
+    TAILQ_REMOVE(cleans_list, entry, link);
+    if (cleans_list == &priv->new_cleans)
+        priv->num_new_cleans--;
+    priv->num_cleans--;
+}
+
+/*
+ * Choose the next clean entry to evict, if any.
+ *
+ * With 2Q, new_cleans is evicted first once it exceeds its share of the cache; otherwise, low
+ * priority blocks are evicted before high priority blocks, as with plain LRU.
+ */
+static struct cache_entry *
+block_cache_evict_candidate(struct block_cache_private *priv)
+{
+    struct cache_entry *entry;
+
+    if (priv->num_new_cleans > priv->max_new_cleans && (entry = TAILQ_FIRST(&priv->new_cleans)) != NULL)
+        return entry;
+    if ((entry = TAILQ_FIRST(&priv->lo_cleans)) != NULL)
+        return entry;
+    if ((entry = TAILQ_FIRST(&priv->new_cleans)) != NULL)
+        return entry;
+    return TAILQ_FIRST(&priv->hi_cleans);
+}
+
+/*
+ * Remember a block evicted from new_cleans, forgetting the oldest remembered block if necessary.
+ */
+static void
+block_cache_ghost_add(struct block_cache_private *priv, s3b_block_t block_num)
+{
+    struct ghost_entry *ghost;
+
+    // Sanity check
+    assert(priv->max_ghosts > 0);
+    assert(s3b_hash_get(priv->ghost_table, block_num) == NULL);
+
+    // Recycle the oldest ghost if we have too many, otherwise allocate a new one
+    if (s3b_hash_size(priv->ghost_table) >= priv->max_ghosts) {
+        ghost = TAILQ_FIRST(&priv->ghosts);
+        TAILQ_REMOVE(&priv->ghosts, ghost, link);
+        s3b_hash_remove(priv->ghost_table, ghost->block_num);
+    } else if ((ghost = malloc(sizeof(*ghost))) == NULL)
+        return;                                 // no big deal
+
+    // Add ghost
+    ghost->block_num = block_num;
+    TAILQ_INSERT_TAIL(&priv->ghosts, ghost, link);
+    s3b_hash_put_new(priv->ghost_table, ghost);
+}
+
+/*
+ * Check whether a block was recently evicted from new_cleans, and forget it if so.
+ */
+static int
+block_cache_ghost_take(struct block_cache_private *priv, s3b_block_t block_num)
+{
+    struct ghost_entry *ghost;
+
+    if (priv->max_ghosts == 0 || (ghost = s3b_hash_get(priv->ghost_table, block_num)) == NULL)
+        return 0;
+    TAILQ_REMOVE(&priv->ghosts, ghost, link);
+    s3b_hash_remove(priv->ghost_table, block_num);
+    free(ghost);
+    return 1;
+}
+
+/*
+ * Classify a block as either low or high priority.
+ *
+ * NOTE: this function must always return the same value for any given block number.
+ */
+static int
+block_cache_high_prio(struct block_cache_conf *const config, s3b_block_t block_num)
+{
+    return block_num < config->num_protected;
+}
+
+/*
+ * Return current time in milliseconds.
+ */
+static uint64_t
+block_cache_get_time_millis(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000 + (uint64_t)tv.tv_usec / 1000;
+}
+
+static int
+block_cache_free_one(void *arg, void *value)
+{
+    struct block_cache_private *const priv = arg;
+    struct block_cache_conf *const config = priv->config;
+    struct cache_entry *const entry = value;
+
+    if (config->cache_file == NULL)
+        block_buf_free(entry->u.data);
+    free(entry);
+    return 0;
+}
+
+static int
+block_cache_free_ghost(void *arg, void *value)
+{
+    free(value);
+    return 0;
+}
+
+/*
+ * Mark an entry verified and free the extra bytes we allocated for the ETag.
+ */
+static struct cache_entry *
+block_cache_verified(struct block_cache_private *priv, struct cache_entry *entry)
+{
+    struct list_head *const cleans_list = block_cache_cleans_list(priv, entry);
+    struct cache_entry *new_entry;
+
+    // Sanity check
+    assert(entry->verify);
+    assert(ENTRY_GET_STATE(entry) == CLEAN2 || ENTRY_GET_STATE(entry) == READING2);
+
+    // Allocate new, smaller entry; if we can't no big deal
+    if ((new_entry = malloc(sizeof(*entry))) == NULL)
+        goto done;
+    memcpy(new_entry, entry, sizeof(*entry));
+
+    // Update all references that point to the entry
+    s3b_hash_put(priv->hashtable, new_entry);
+    if (ENTRY_IN_LIST(entry)) {
+        TAILQ_REMOVE(cleans_list, entry, link);
+        TAILQ_INSERT_TAIL(cleans_list, new_entry, link);
+    }
+    free(entry);
+    entry = new_entry;
+
+done:
+    // Mark entry as verified
+    entry->verify = 0;
+    return entry;
+}
+
+/*
+ * Read the data from a cached block into a buffer.
+ */
+static int
+block_cache_read_data(struct block_cache_private *priv, struct cache_entry *entry, void *dest, u_int off, u_int len)
+{
+    struct block_cache_conf *const config = priv->config;
+    double start;
+    void *buf;
+    int r;
+
+    // Sanity check
+    assert(off <= config->block_size);
+    assert(len <= config->block_size);
+    assert(off + len <= config->block_size);
+
+    // Handle easy in-memory case
+    if (config->cache_file == NULL) {
+        memcpy(dest, (char *)entry->u.data + off, len);
+        return 0;
+    }
+
+    // Handle on-disk case
+    start = monotonic_time();
+    if (!s3b_dcache_is_encoded(priv->dcache, entry->u.dslot)) {
+        if ((r = s3b_dcache_read_block(priv->dcache, entry->u.dslot, dest, off, len)) == 0)
+            latency_record(&priv->stats.dcache_reads, monotonic_time() - start);
+        return r;
+    }
+
+    // Handle on-disk encoded case: read the whole block and decode it
+    if ((buf = block_buf_alloc(config->block_size)) == NULL) {
+        r = errno;
+        (*config->log)(LOG_ERR, "can't allocate block cache buffer: %s", strerror(r));
+        priv->stats.out_of_memory_errors++;
+        return r;
+    }
+    if ((r = s3b_dcache_read_block(priv->dcache, entry->u.dslot, buf, 0, config->block_size)) == 0) {
+        latency_record(&priv->stats.dcache_reads, monotonic_time() - start);
+        if ((r = block_cache_decode(priv, entry->block_num, buf, dest, off, len)) == 0)
+            priv->stats.encoded_decodes++;
+    }
+    block_buf_free(buf);
+    return r;
+}
+
+/*
+ * Decode part of a block previously read from the underlying store via read_block_encoded().
+ *
+ * This does not require the mutex to be held.
+ */
+static int
+block_cache_decode(struct block_cache_private *priv, s3b_block_t block_num, const void *src, void *dest, u_int off, u_int len)
+{
+    struct block_cache_conf *const config = priv->config;
+    void *buf;
+    int r;
+
+    // Any decoder?
+    if (priv->inner->decode_block == NULL) {
+        (*config->log)(LOG_ERR, "can't decode encoded block %0*jx from cache file", S3B_BLOCK_NUM_DIGITS, (uintmax_t)block_num);
+        return EIO;
+    }
+
+    // Decode whole block directly if possible
+    if (off == 0 && len == config->block_size)
+        return (*priv->inner->decode_block)(priv->inner, block_num, src, dest);
+
+    // Decode into a temporary buffer and copy out the part we want
+    if ((buf = block_buf_alloc(config->block_size)) == NULL) {
+        r = errno;
+        (*config->log)(LOG_ERR, "can't allocate block cache buffer: %s", strerror(r));
+        return r;
+    }
+    if ((r = (*priv->inner->decode_block)(priv->inner, block_num, src, buf)) == 0)
+        memcpy(dest, (char *)buf + off, len);
+    block_buf_free(buf);
+    return r;
+}
+
+/*
+ * Write the data in a buffer to a cached block.
+ */
+static int
+block_cache_write_data(struct block_cache_private *priv, struct cache_entry *entry, const void *src, u_int off, u_int len)
+{
+    struct block_cache_conf *const config = priv->config;
+    double start;
+    void *buf;
+    int r;
+
+    // Sanity check
+    assert(off <= config->block_size);
+    assert(len <= config->block_size);
+    assert(off + len <= config->block_size);
+
+    // Handle easy in-memory case
+    if (config->cache_file == NULL) {
+        if (src == NULL)
+            memset((char *)entry->u.data + off, 0, len);
+        else
+            memcpy((char *)entry->u.data + off, src, len);
+        return 0;
+    }
+
+    // Handle on-disk encoded case when writing part of the block: first convert the whole block into plain form
+    if ((off != 0 || len != config->block_size) && s3b_dcache_is_encoded(priv->dcache, entry->u.dslot)) {
+        if ((buf = block_buf_alloc(config->block_size)) == NULL) {
+            r = errno;
+            (*config->log)(LOG_ERR, "can't allocate block cache buffer: %s", strerror(r));
+            priv->stats.out_of_memory_errors++;
+            return r;
+        }
+        if ((r = block_cache_read_data(priv, entry, buf, 0, config->block_size)) == 0) {
+            if (src == NULL)
+                memset((char *)buf + off, 0, len);
+            else
+                memcpy((char *)buf + off, src, len);
+            r = block_cache_write_data(priv, entry, buf, 0, config->block_size);
+        }
+        block_buf_free(buf);
+        return r;
+    }
+
+    // Handle on-disk case
+    start = monotonic_time();
+    if ((r = s3b_dcache_write_block(priv->dcache, entry->u.dslot, src, off, len)) == 0)
+        latency_record(&priv->stats.dcache_writes, monotonic_time() - start);
+    return r;
+}
+
+/*
+ * Compute dirty ratio, i.e., percent of total cache space occupied by entries
+ * that are not CLEAN[2] or READING[2].
+ */
+static double
+block_cache_dirty_ratio(struct block_cache_private *priv)
+{
+    struct block_cache_conf *const config = priv->config;
+
+    return (double)priv->num_dirties / (double)config->cache_size;
+}
+
+/*
+ * Create a sharded block cache. Each shard gets an equal share of the cache size, dirty block limit,
+ * and worker threads.
+ */
+static struct s3backer_store *
+block_cache_shards_create(struct block_cache_conf *config, struct s3backer_store *inner)
+{
+    struct s3backer_store *s3b;
+    struct block_cache_shards *priv;
+    const u_int num_shards = config->num_shards;
+    u_int i;
+    int r;
+
+    // Sanity check
+    assert(num_shards > 1);
+    if (config->cache_file != NULL || config->cache_size < num_shards) {
+        r = EINVAL;
+        goto fail0;
+    }
+
+    // Initialize s3backer_store structure
+    if ((s3b = calloc(1, sizeof(*s3b))) == NULL) {
+        r = errno;
+        (*config->log)(LOG_ERR, "calloc(): %s", strerror(r));
+        goto fail0;
+    }
+    s3b->create_threads = block_cache_shards_create_threads;
+    s3b->meta_data = block_cache_shards_meta_data;
+    s3b->set_mount_token = block_cache_shards_set_mount_token;
+    s3b->read_block = block_cache_shards_read_block;
+    s3b->write_block = block_cache_shards_write_block;
+    s3b->read_block_part = block_cache_shards_read_block_part;
+    s3b->write_block_part = block_cache_shards_write_block_part;
+    s3b->read_blocks = block_cache_shards_read_blocks;
+    s3b->write_blocks = block_cache_shards_write_blocks;
+    s3b->flush_blocks = block_cache_shards_flush_blocks;
+    s3b->bulk_zero = generic_bulk_zero;
+    s3b->survey_non_zero = block_cache_shards_survey_non_zero;
+    if (config->prefetch_threads > 0)
+        s3b->prefetch_blocks = block_cache_shards_prefetch_blocks;
+    s3b->shutdown = block_cache_shards_shutdown;
+    s3b->destroy = block_cache_shards_destroy;
+
+    // Initialize block_cache_shards structure
+    if ((priv = calloc(1, sizeof(*priv))) == NULL) {
+        r = errno;
+        (*config->log)(LOG_ERR, "calloc(): %s", strerror(r));
+        goto fail1;
+    }
+    priv->config = config;
+    priv->inner = inner;
+    if ((priv->confs = calloc(num_shards, sizeof(*priv->confs))) == NULL) {
+        r = errno;
+        (*config->log)(LOG_ERR, "calloc(): %s", strerror(r));
+        goto fail2;
+    }
+    if ((priv->shards = calloc(num_shards, sizeof(*priv->shards))) == NULL) {
+        r = errno;
+        (*config->log)(LOG_ERR, "calloc(): %s", strerror(r));
+        goto fail3;
+    }
+    s3b->data = priv;
 
-    if (entry == NULL) {
-        pthread_cond_wait(&priv->worker_work, &priv->mutex);
-        return;
+    // Create shards, dividing up the resources evenly
+    for (i = 0; i < num_shards; i++) {
+        struct block_cache_conf *const conf = &priv->confs[i];
+
+        memcpy(conf, config, sizeof(*conf));
+        conf->num_shards = 0;
+        conf->cache_size = config->cache_size / num_shards + (i < config->cache_size % num_shards);
+        if (config->max_dirty != 0) {
+            conf->max_dirty = config->max_dirty / num_shards + (i < config->max_dirty % num_shards);
+            if (conf->max_dirty == 0)
+                conf->max_dirty = 1;
+        }
+        conf->num_threads = config->num_threads / num_shards + (i < config->num_threads % num_shards);
+        if (conf->num_threads == 0)
+            conf->num_threads = 1;
+        if (config->priority_threads != 0) {
+            conf->priority_threads = config->priority_threads / num_shards + (i < config->priority_threads % num_shards);
+            if (conf->priority_threads == 0)
+                conf->priority_threads = 1;
+        }
+        if (config->background_threads != 0) {
+            conf->background_threads = config->background_threads / num_shards + (i < config->background_threads % num_shards);
+            if (conf->background_threads == 0)
+                conf->background_threads = 1;
+        }
+        conf->compressed_size = config->compressed_size / num_shards;
+        if ((priv->shards[i] = block_cache_create2(conf, inner, i, num_shards)) == NULL) {
+            r = errno;
+            goto fail4;
+        }
+        priv->num_shards++;
     }
-    wake_time_millis = priv->start_time + ((uint64_t)entry->timeout * TIME_UNIT_MILLIS);
-    block_cache_cond_timedwait(priv, &priv->worker_work, wake_time_millis);
+
+    // Done
+    return s3b;
+
+fail4:
+    while (priv->num_shards > 0) {
+        struct s3backer_store *const shard = priv->shards[--priv->num_shards];
+
+        (*shard->destroy)(shard);
+    }
+    free(priv->shards);
+fail3:
+    free(priv->confs);
+fail2:
+    free(priv);
+fail1:
+    free(s3b);
+fail0:
+    (*config->log)(LOG_ERR, "block_cache creation failed: %s", strerror(r));
+    errno = r;
+    return NULL;
 }
 
-/*
- * Sleep until the specified condition becomes true, or the specified wakeup time is reached.
- *
- * Returns ETIMEDOUT if we timed out.
- */
 static int
-block_cache_cond_timedwait(struct block_cache_private *priv, pthread_cond_t *cond, uint64_t wake_time_millis)
+block_cache_shards_create_threads(struct s3backer_store *s3b)
 {
-    struct timespec wake_time;
+    struct block_cache_shards *const priv = s3b->data;
+    u_int i;
+    int r;
 
-    wake_time.tv_sec = wake_time_millis / 1000;
-    wake_time.tv_nsec = (wake_time_millis % 1000) * 1000000;
-    return pthread_cond_timedwait(cond, &priv->mutex, &wake_time);
+    // Create threads in lower layer
+    if ((r = (*priv->inner->create_threads)(priv->inner)) != 0)
+        return r;
+
+    // Create threads in each shard
+    for (i = 0; i < priv->num_shards; i++) {
+        struct s3backer_store *const shard = priv->shards[i];
+
+        if ((r = (*shard->create_threads)(shard)) != 0)
+            return r;
+    }
+    return 0;
 }
 
-/*
- * Return current time in units of TIME_UNIT_MILLIS milliseconds since startup.
- */
-static uint32_t
-block_cache_get_time(struct block_cache_private *priv)
+static int
+block_cache_shards_meta_data(struct s3backer_store *s3b, off_t *file_sizep, u_int *block_sizep)
 {
-    uint64_t since_start;
+    struct block_cache_shards *const priv = s3b->data;
 
-    since_start = block_cache_get_time_millis() - priv->start_time;
-    return (uint32_t)(since_start / TIME_UNIT_MILLIS);
+    return (*priv->inner->meta_data)(priv->inner, file_sizep, block_sizep);
 }
 
-/*
- * Get the head of the appropriate clean list, based on whether the block is low or high priority.
- */
-static struct list_head *
-block_cache_cleans_list(struct block_cache_private *const priv, s3b_block_t block_num)
+static int
+block_cache_shards_set_mount_token(struct s3backer_store *s3b, int32_t *old_valuep, int32_t new_value)
 {
-    return block_cache_high_prio(priv->config, block_num) ? &priv->hi_cleans : &priv->lo_cleans;
+    struct block_cache_shards *const priv = s3b->data;
+
+    return (*priv->inner->set_mount_token)(priv->inner, old_valuep, new_value);
 }
 
-/*
- * Classify a block as either low or high priority.
- *
- * NOTE: this function must always return the same value for any given block number.
- */
 static int
-block_cache_high_prio(struct block_cache_conf *const config, s3b_block_t block_num)
+block_cache_shards_read_block(struct s3backer_store *const s3b, s3b_block_t block_num, void *dest,
+  u_char *actual_etag, const u_char *expect_etag, int strict)
 {
-    return block_num < config->num_protected;
+    struct s3backer_store *const shard = block_cache_shard_for(s3b->data, block_num);
+
+    return (*shard->read_block)(shard, block_num, dest, actual_etag, expect_etag, strict);
+}
+
+static int
+block_cache_shards_write_block(struct s3backer_store *const s3b, s3b_block_t block_num, const void *src, u_char *etag,
+  check_cancel_t *check_cancel, void *check_cancel_arg)
+{
+    struct s3backer_store *const shard = block_cache_shard_for(s3b->data, block_num);
+
+    return (*shard->write_block)(shard, block_num, src, etag, check_cancel, check_cancel_arg);
+}
+
+static int
+block_cache_shards_read_block_part(struct s3backer_store *s3b, s3b_block_t block_num, u_int off, u_int len, void *dest)
+{
+    struct s3backer_store *const shard = block_cache_shard_for(s3b->data, block_num);
+
+    return (*shard->read_block_part)(shard, block_num, off, len, dest);
+}
+
+static int
+block_cache_shards_write_block_part(struct s3backer_store *s3b, s3b_block_t block_num, u_int off, u_int len,
+  const void *src)
+{
+    struct s3backer_store *const shard = block_cache_shard_for(s3b->data, block_num);
+
+    return (*shard->write_block_part)(shard, block_num, off, len, src);
 }
 
 /*
- * Return current time in milliseconds.
+ * Read a range of blocks, one shard chunk at a time.
  */
-static uint64_t
-block_cache_get_time_millis(void)
+static int
+block_cache_shards_read_blocks(struct s3backer_store *s3b, s3b_block_t block_num, u_int num_blocks, void *dest)
 {
-    struct timeval tv;
+    struct block_cache_shards *const priv = s3b->data;
+    struct block_cache_conf *const config = priv->config;
+    int r;
 
-    gettimeofday(&tv, NULL);
-    return (uint64_t)tv.tv_sec * 1000 + (uint64_t)tv.tv_usec / 1000;
+    while (num_blocks > 0) {
+        struct s3backer_store *const shard = block_cache_shard_for(priv, block_num);
+        u_int count = SHARD_CHUNK_BLOCKS - block_num % SHARD_CHUNK_BLOCKS;
+
+        if (count > num_blocks)
+            count = num_blocks;
+        if ((r = (*shard->read_blocks)(shard, block_num, count, dest)) != 0)
+            return r;
+        dest = (char *)dest + (size_t)count * config->block_size;
+        block_num += count;
+        num_blocks -= count;
+    }
+    return 0;
 }
 
+/*
+ * Write a range of blocks, one shard chunk at a time.
+ */
 static int
-block_cache_free_one(void *arg, void *value)
+block_cache_shards_write_blocks(struct s3backer_store *s3b, s3b_block_t block_num, u_int num_blocks, const void *src,
+  u_char *etags, check_cancel_t *check_cancel, void *check_cancel_arg)
 {
-    struct block_cache_private *const priv = arg;
+    struct block_cache_shards *const priv = s3b->data;
     struct block_cache_conf *const config = priv->config;
-    struct cache_entry *const entry = value;
+    int r;
 
-    if (config->cache_file == NULL)
-        free(entry->u.data);
-    free(entry);
+    while (num_blocks > 0) {
+        struct s3backer_store *const shard = block_cache_shard_for(priv, block_num);
+        u_int count = SHARD_CHUNK_BLOCKS - block_num % SHARD_CHUNK_BLOCKS;
+
+        if (count > num_blocks)
+            count = num_blocks;
+        if ((r = (*shard->write_blocks)(shard, block_num, count, src, etags, check_cancel, check_cancel_arg)) != 0)
+            return r;
+        if (src != NULL)
+            src = (const char *)src + (size_t)count * config->block_size;
+        if (etags != NULL)
+            etags += (size_t)count * MD5_DIGEST_LENGTH;
+        block_num += count;
+        num_blocks -= count;
+    }
     return 0;
 }
 
 /*
- * Mark an entry verified and free the extra bytes we allocated for the ETag.
+ * Flush blocks by having each shard flush the blocks it owns.
  */
-static struct cache_entry *
-block_cache_verified(struct block_cache_private *priv, struct cache_entry *entry)
+static int
+block_cache_shards_flush_blocks(struct s3backer_store *s3b, const s3b_block_t *block_nums, u_int num_blocks, long timeout)
 {
-    struct list_head *const cleans_list = block_cache_cleans_list(priv, entry->block_num);
-    struct cache_entry *new_entry;
+    struct block_cache_shards *const priv = s3b->data;
+    struct block_list *lists = NULL;
+    uint64_t absolute_timeout;
+    u_int i;
+    int r = 0;
 
-    // Sanity check
-    assert(entry->verify);
-    assert(ENTRY_GET_STATE(entry) == CLEAN2 || ENTRY_GET_STATE(entry) == READING2);
+    // Calculate absolute timeout
+    absolute_timeout = timeout > 0 ? block_cache_get_time_millis() + timeout : 0;
 
-    // Allocate new, smaller entry; if we can't no big deal
-    if ((new_entry = malloc(sizeof(*entry))) == NULL)
-        goto done;
-    memcpy(new_entry, entry, sizeof(*entry));
+    // Partition the given blocks by shard
+    if (block_nums != NULL) {
+        if ((lists = calloc(priv->num_shards, sizeof(*lists))) == NULL)
+            return errno;
+        for (i = 0; i < priv->num_shards; i++)
+            block_list_init(&lists[i]);
+        for (i = 0; i < num_blocks; i++) {
+            const s3b_block_t block_num = block_nums[i];
+
+            if ((r = block_list_append(&lists[block_cache_shard_index(priv->num_shards, block_num)], block_num)) != 0)
+                goto done;
+        }
+    }
 
-    // Update all references that point to the entry
-    s3b_hash_put(priv->hashtable, new_entry);
-    if (ENTRY_IN_LIST(entry)) {
-        TAILQ_REMOVE(cleans_list, entry, link);
-        TAILQ_INSERT_TAIL(cleans_list, new_entry, link);
+    // Flush each shard
+    for (i = 0; i < priv->num_shards; i++) {
+        struct s3backer_store *const shard = priv->shards[i];
+
+        // Skip shards with nothing to do
+        if (lists != NULL && lists[i].num_blocks == 0)
+            continue;
+
+        // Adjust timeout (if any) for the time we have spent so far, but don't go zero/negative
+        if (timeout > 0) {
+            if ((timeout = absolute_timeout - block_cache_get_time_millis()) <= 0)
+                timeout = 1;
+        }
+
+        // Flush shard
+        if (lists != NULL)
+            r = (*shard->flush_blocks)(shard, lists[i].blocks, lists[i].num_blocks, timeout);
+        else
+            r = (*shard->flush_blocks)(shard, NULL, 0, timeout);
+        if (r != 0)
+            break;
     }
-    free(entry);
-    entry = new_entry;
 
 done:
-    // Mark entry as verified
-    entry->verify = 0;
-    return entry;
+    // Done
+    if (lists != NULL) {
+        for (i = 0; i < priv->num_shards; i++)
+            block_list_free(&lists[i]);
+        free(lists);
+    }
+    return r;
 }
 
-/*
- * Read the data from a cached block into a buffer.
- */
 static int
-block_cache_read_data(struct block_cache_private *priv, struct cache_entry *entry, void *dest, u_int off, u_int len)
+block_cache_shards_survey_non_zero(struct s3backer_store *s3b, const struct survey_params *params)
 {
-    struct block_cache_conf *const config = priv->config;
-
-    // Sanity check
-    assert(off <= config->block_size);
-    assert(len <= config->block_size);
-    assert(off + len <= config->block_size);
+    struct block_cache_shards *const priv = s3b->data;
+    u_int num_started;
+    int r = 0;
 
-    // Handle easy in-memory case
-    if (config->cache_file == NULL) {
-        memcpy(dest, (char *)entry->u.data + off, len);
-        return 0;
+    // Report blocks in each shard and start monitoring its reads
+    for (num_started = 0; num_started < priv->num_shards; num_started++) {
+        if ((r = block_cache_survey_start(priv->shards[num_started]->data, params->callback, params->arg)) != 0)
+            goto done;
     }
 
-    // Handle on-disk case
-    return s3b_dcache_read_block(priv->dcache, entry->u.dslot, dest, off, len);
+    // Invoke lower layer
+    r = (*priv->inner->survey_non_zero)(priv->inner, params);
+
+done:
+    // Finish up
+    while (num_started > 0)
+        block_cache_survey_finish(priv->shards[--num_started]->data);
+    return r;
 }
 
 /*
- * Write the data in a buffer to a cached block.
+ * Queue a range of blocks for prefetch, one shard chunk at a time.
  */
 static int
-block_cache_write_data(struct block_cache_private *priv, struct cache_entry *entry, const void *src, u_int off, u_int len)
+block_cache_shards_prefetch_blocks(struct s3backer_store *s3b, s3b_block_t block_num, u_int num_blocks)
 {
-    struct block_cache_conf *const config = priv->config;
+    struct block_cache_shards *const priv = s3b->data;
+    int r;
 
-    // Sanity check
-    assert(off <= config->block_size);
-    assert(len <= config->block_size);
-    assert(off + len <= config->block_size);
+    while (num_blocks > 0) {
+        struct s3backer_store *const shard = block_cache_shard_for(priv, block_num);
+        u_int count = SHARD_CHUNK_BLOCKS - block_num % SHARD_CHUNK_BLOCKS;
 
-    // Handle easy in-memory case
-    if (config->cache_file == NULL) {
-        if (src == NULL)
-            memset((char *)entry->u.data + off, 0, len);
-        else
-            memcpy((char *)entry->u.data + off, src, len);
-        return 0;
+        if (count > num_blocks)
+            count = num_blocks;
+        if ((r = (*shard->prefetch_blocks)(shard, block_num, count)) != 0)
+            return r;
+        block_num += count;
+        num_blocks -= count;
     }
+    return 0;
+}
 
-    // Handle on-disk case
-    return s3b_dcache_write_block(priv->dcache, entry->u.dslot, src, off, len);
+static int
+block_cache_shards_shutdown(struct s3backer_store *const s3b)
+{
+    struct block_cache_shards *const priv = s3b->data;
+    u_int i;
+    int r2;
+    int r = 0;
+
+    // Shut down each shard, which waits for its dirty blocks to be written
+    for (i = 0; i < priv->num_shards; i++) {
+        struct s3backer_store *const shard = priv->shards[i];
+
+        if ((r2 = (*shard->shutdown)(shard)) != 0 && r == 0)
+            r = r2;
+    }
+
+    // Propagate to lower layer
+    if ((r2 = (*priv->inner->shutdown)(priv->inner)) != 0 && r == 0)
+        r = r2;
+    return r;
+}
+
+static void
+block_cache_shards_destroy(struct s3backer_store *const s3b)
+{
+    struct block_cache_shards *const priv = s3b->data;
+    u_int i;
+
+    // Destroy shards
+    for (i = 0; i < priv->num_shards; i++) {
+        struct s3backer_store *const shard = priv->shards[i];
+
+        (*shard->destroy)(shard);
+    }
+
+    // Destroy inner store
+    (*priv->inner->destroy)(priv->inner);
+
+    // Free structures
+    free(priv->shards);
+    free(priv->confs);
+    free(priv);
+    free(s3b);
 }
 
 /*
- * Compute dirty ratio, i.e., percent of total cache space occupied by entries
- * that are not CLEAN[2] or READING[2].
+ * Get the shard that owns the given block.
  */
-static double
-block_cache_dirty_ratio(struct block_cache_private *priv)
+static struct s3backer_store *
+block_cache_shard_for(struct block_cache_shards *priv, s3b_block_t block_num)
 {
-    struct block_cache_conf *const config = priv->config;
+    return priv->shards[block_cache_shard_index(priv->num_shards, block_num)];
+}
 
-    return (double)priv->num_dirties / (double)config->cache_size;
+/*
+ * Get the index of the shard that owns the given block.
+ *
+ * NOTE: this function must always return the same value for any given block number.
+ */
+static u_int
+block_cache_shard_index(u_int num_shards, s3b_block_t block_num)
+{
+    return (block_num / SHARD_CHUNK_BLOCKS) % num_shards;
 }
 
 #ifndef NDEBUG
@@ -1705,9 +4342,13 @@ block_cache_check_invariants(struct block_cache_private *priv, int allow_stoppin
 {
     struct block_cache_conf *const config = priv->config;
     struct cache_entry *entry;
+    struct ghost_entry *ghost;
     struct check_info info;
     int clean_len = 0;
+    int new_clean_len = 0;
     int dirty_len = 0;
+    u_int ghost_len = 0;
+    u_int i;
 
     // Check for stopping
     assert(allow_stopping || !priv->stopping);
@@ -1717,6 +4358,15 @@ block_cache_check_invariants(struct block_cache_private *priv, int allow_stoppin
         assert(ENTRY_GET_STATE(entry) == CLEAN || ENTRY_GET_STATE(entry) == CLEAN2);
         assert(s3b_hash_get(priv->hashtable, entry->block_num) == entry);
         assert(!block_cache_high_prio(config, entry->block_num));
+        assert(priv->max_ghosts == 0 || entry->frequent);
+        clean_len++;
+    }
+    for (entry = TAILQ_FIRST(&priv->new_cleans); entry != NULL; entry = TAILQ_NEXT(entry, link)) {
+        assert(ENTRY_GET_STATE(entry) == CLEAN || ENTRY_GET_STATE(entry) == CLEAN2);
+        assert(s3b_hash_get(priv->hashtable, entry->block_num) == entry);
+        assert(!block_cache_high_prio(config, entry->block_num));
+        assert(priv->max_ghosts > 0 && !entry->frequent);
+        new_clean_len++;
         clean_len++;
     }
     for (entry = TAILQ_FIRST(&priv->hi_cleans); entry != NULL; entry = TAILQ_NEXT(entry, link)) {
@@ -1726,12 +4376,24 @@ block_cache_check_invariants(struct block_cache_private *priv, int allow_stoppin
         clean_len++;
     }
     assert(clean_len == priv->num_cleans);
+    assert(new_clean_len == priv->num_new_cleans);
+
+    // Check ghosts
+    for (ghost = TAILQ_FIRST(&priv->ghosts); ghost != NULL; ghost = TAILQ_NEXT(ghost, link)) {
+        assert(s3b_hash_get(priv->ghost_table, ghost->block_num) == ghost);
+        ghost_len++;
+    }
+    assert(ghost_len <= priv->max_ghosts);
+    assert(priv->ghost_table == NULL || ghost_len == s3b_hash_size(priv->ghost_table));
 
     // Check DIRTYs
-    for (entry = TAILQ_FIRST(&priv->dirties); entry != NULL; entry = TAILQ_NEXT(entry, link)) {
-        assert(ENTRY_GET_STATE(entry) == DIRTY);
-        assert(s3b_hash_get(priv->hashtable, entry->block_num) == entry);
-        dirty_len++;
+    for (i = 0; i < WB_NUM_CLASSES; i++) {
+        for (entry = TAILQ_FIRST(&priv->dirties[i]); entry != NULL; entry = TAILQ_NEXT(entry, link)) {
+            assert(ENTRY_GET_STATE(entry) == DIRTY);
+            assert(s3b_hash_get(priv->hashtable, entry->block_num) == entry);
+            assert(block_cache_dirty_list(priv, entry) == &priv->dirties[i]);
+            dirty_len++;
+        }
     }
 
     // Check hash table size
@@ -1749,7 +4411,12 @@ block_cache_check_invariants(struct block_cache_private *priv, int allow_stoppin
     assert(priv->num_dirties == info.num_dirty + info.num_writing + info.num_writing2);
 
     // Check read-ahead
-    assert(priv->ra_count <= config->read_ahead);
+    for (i = 0; i < priv->num_streams; i++) {
+        const struct ra_stream *const stream = &priv->streams[i];
+
+        assert(stream->count == 0 || stream->window >= config->read_ahead);
+        assert(stream->window <= config->read_ahead_max);
+    }
 }
 
 static int
@@ -34,23 +34,53 @@
  * also delete it here.
  */
 
+// Forward decl's
+struct comp_alg;
+
+// Eviction policies
+#define BLOCK_CACHE_EVICTION_LRU    "lru"
+#define BLOCK_CACHE_EVICTION_2Q     "2q"
+
+// Maximum number of blocks in one coalesced writeback
+#define BLOCK_CACHE_MAX_WRITE_COALESCE  256
+
 // Configuration info structure for block_cache
 struct block_cache_conf {
     u_int               block_size;
     u_int               cache_size;
     u_int               write_delay;
     u_int               max_dirty;
+    u_int               write_coalesce;             // max adjacent dirty blocks written back together
+    u_int               partial_writes;             // don't read a block before a partial write to it
+    u_int               priority_blocks;            // blocks below this number get priority writeback
+    u_int               priority_threads;           // max threads writing back priority blocks (zero for no limit)
+    u_int               background_threads;         // max threads writing back other blocks (zero for no limit)
+    u_int               range_read_max;             // max bytes to read without caching the block (zero to disable)
+    u_int               range_read_fetch;           // after a range read, read the whole block in the background
+    size_t              compressed_size;            // memory for compressed evicted blocks (zero to disable)
+    const struct comp_alg *compressed_alg;          // compression algorithm for evicted blocks
+    void                *compressed_level;          // compression level for evicted blocks
     u_int               synchronous;
     u_int               timeout;
     u_int               num_threads;
     u_int               read_ahead;
     u_int               read_ahead_trigger;
+    u_int               read_ahead_max;
+    u_int               read_ahead_streams;
     u_int               no_verify;
     u_int               fadvise;
+    u_int               use_mmap;
+    u_int               use_io_uring;
+    u_int               use_index;
+    u_int               prefetch_threads;           // max threads prefetching blocks in the background
+    u_int               store_encoded;              // store clean blocks in the cache file still compressed/encrypted
     u_int               recover_dirty_blocks;
     u_int               perform_flush;
     u_int               num_protected;
+    u_int               num_shards;
+    const char          *eviction;
     const char          *cache_file;
+    const char          *hot_file;                  // where to save and load hot block numbers, or NULL
     log_func_t          *log;
 };
 
@@ -59,13 +89,43 @@ struct block_cache_stats {
     u_int               initial_size;
     u_int               current_size;
     double              dirty_ratio;
-    u_int               read_hits;
-    u_int               read_misses;
-    u_int               write_hits;
-    u_int               write_misses;
-    u_int               verified;
-    u_int               mismatch;
-    u_int               out_of_memory_errors;
+    uint64_t            read_hits;
+    uint64_t            read_misses;
+    uint64_t            write_hits;
+    uint64_t            write_misses;
+    uint64_t            verified;
+    uint64_t            mismatch;
+    uint64_t            read_ahead_hits;            // read-ahead block was ready in time
+    uint64_t            read_ahead_late;            // read-ahead block was still being read
+    uint64_t            read_ahead_wasted;          // read-ahead block was evicted before being used
+    uint64_t            recent_hits;                // read hit on a block not yet frequent (2Q only)
+    uint64_t            frequent_hits;              // read hit on a frequent block (2Q only)
+    uint64_t            ghost_hits;                 // read miss on a recently evicted block (2Q only)
+    uint64_t            evictions;                  // clean blocks evicted to make room
+    uint64_t            coalesced_writes;           // writebacks of multiple adjacent blocks at once
+    uint64_t            coalesced_blocks;           // blocks written back as part of a coalesced writeback
+    uint64_t            flush_writebacks;           // blocks written back because a thread was waiting to flush them
+    uint64_t            priority_writebacks;        // priority blocks written back in the background
+    uint64_t            partial_writes;             // write misses that didn't read the block first
+    uint64_t            partial_fills;              // partially written blocks whose missing sectors were read later
+    uint64_t            partial_skips;              // partially written blocks filled in entirely by writes
+    uint64_t            range_reads;                // read misses served by reading only part of the block
+    uint64_t            range_fetches;              // blocks read in full in the background after a range read
+    uint64_t            prefetches;                 // hot and requested blocks read in the background
+    u_int               ctier_blocks;               // evicted blocks currently stored compressed
+    size_t              ctier_bytes;                // memory used by compressed blocks
+    size_t              ctier_data_bytes;           // uncompressed size of compressed blocks
+    uint64_t            ctier_hits;                 // read misses satisfied by decompressing a block
+    uint64_t            ctier_stores;               // evicted blocks compressed and stored
+    uint64_t            ctier_rejects;              // evicted blocks that didn't compress well enough to store
+    uint64_t            ctier_evictions;            // compressed blocks discarded to make room
+    uint64_t            encoded_stores;             // blocks stored in the cache file in encoded form
+    uint64_t            encoded_decodes;            // cache file reads that required decoding a block
+    uint64_t            out_of_memory_errors;
+    struct latency_hist miss_reads;                 // reads from the underlying store on a cache miss
+    struct latency_hist writebacks;                 // successful writes of dirty blocks to the underlying store
+    struct latency_hist dcache_reads;               // cache file reads (only with a cache file)
+    struct latency_hist dcache_writes;              // cache file writes (only with a cache file)
 };
 
 // block_cache.c
@@ -121,7 +121,7 @@ block_part_read_block_part(struct s3backer_store *s3b, struct block_part *const
         return (*s3b->read_block_part)(s3b, edge->block, edge->offset, edge->length, edge->data);
 
     // Allocate buffer
-    if ((buf = malloc(priv->block_size)) == NULL)
+    if ((buf = block_buf_alloc(priv->block_size)) == NULL)
         return errno;
 
     // Increment readers count
@@ -161,7 +161,7 @@ done:
     pthread_mutex_unlock(&priv->mutex);
 
     // Done
-    free(buf);
+    block_buf_free(buf);
     return r;
 }
 
@@ -176,6 +176,7 @@ int
 block_part_write_block_part(struct s3backer_store *s3b, struct block_part *const priv, const struct boundary_edge *const edge)
 {
     const void *data = edge->data != NULL ? edge->data : zero_block;        // if edge->data is NULL then write zeros
+    int zero_fragment;
     u_char *buf;
     int r;
 
@@ -190,9 +191,12 @@ block_part_write_block_part(struct s3backer_store *s3b, struct block_part *const
         return (*s3b->write_block_part)(s3b, edge->block, edge->offset, edge->length, edge->data);
 
     // Allocate buffer
-    if ((buf = malloc(priv->block_size)) == NULL)
+    if ((buf = block_buf_alloc(priv->block_size)) == NULL)
         return errno;
 
+    // Check whether we're writing zeros
+    zero_fragment = edge->data == NULL || mem_is_zeros(edge->data, edge->length);
+
     // Grab exclusive lock on this block
     pthread_mutex_lock(&priv->mutex);
     while (1) {
@@ -209,11 +213,15 @@ block_part_write_block_part(struct s3backer_store *s3b, struct block_part *const
     if ((r = (*s3b->read_block)(s3b, edge->block, buf, NULL, NULL, 0)) != 0)
         goto done;
 
+    // If we're writing zeros over zeros, there's nothing to do
+    if (zero_fragment && mem_is_zeros(buf + edge->offset, edge->length))
+        goto done;
+
     // Write in supplied fragment
     memcpy(buf + edge->offset, data, edge->length);
 
-    // Write back entire block
-    r = (*s3b->write_block)(s3b, edge->block, buf, NULL, NULL, NULL);
+    // Write back entire block; if it's now all zeros, say so, which saves the lower layers from checking again
+    r = (*s3b->write_block)(s3b, edge->block, block_is_zeros(buf) ? NULL : buf, NULL, NULL, NULL);
 
 done:
     // Release exclusive lock on this block
@@ -224,6 +232,6 @@ done:
     pthread_mutex_unlock(&priv->mutex);
 
     // Done
-    free(buf);
+    block_buf_free(buf);
     return r;
 }
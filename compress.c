@@ -36,6 +36,7 @@
 
 #include "s3backer.h"
 #include "compress.h"
+#include "util.h"
 
 #if ZSTD
 #include <zstd.h>
@@ -104,6 +105,18 @@ comp_find(const char *name)
     return NULL;
 }
 
+size_t
+comp_bound(size_t inlen)
+{
+    size_t bound = compressBound(inlen);
+
+#if ZSTD
+    if (ZSTD_compressBound(inlen) > bound)
+        bound = ZSTD_compressBound(inlen);
+#endif
+    return bound;
+}
+
 /****************************************************************************
  *                                DEFLATE                                   *
  ****************************************************************************/
@@ -118,7 +131,7 @@ deflate_compress(log_func_t *log, const void *input, size_t inlen, void **output
 
     // Allocate buffer
     clen = compressBound(inlen);
-    if ((cbuf = malloc(clen)) == NULL) {
+    if ((cbuf = block_buf_alloc(clen)) == NULL) {
         r = errno;
         (*log)(LOG_ERR, "malloc: %s", strerror(r));
         return r;
@@ -145,7 +158,7 @@ deflate_compress(log_func_t *log, const void *input, size_t inlen, void **output
     }
 
     // Fail
-    free(cbuf);
+    block_buf_free(cbuf);
     return r;
 }
 
@@ -220,7 +233,7 @@ zstd_compress(log_func_t *log, const void *input, size_t inlen, void **outputp,
 
     // Allocate buffer
     clen = ZSTD_compressBound(inlen);
-    if ((cbuf = malloc(clen)) == NULL) {
+    if ((cbuf = block_buf_alloc(clen)) == NULL) {
         r = errno;
         (*log)(LOG_ERR, "malloc: %s", strerror(r));
         return r;
@@ -233,7 +246,7 @@ zstd_compress(log_func_t *log, const void *input, size_t inlen, void **outputp,
     clen = ZSTD_compress(cbuf, clen, input, inlen, level);
     if (ZSTD_isError(clen)) {
         (*log)(LOG_ERR, "zstd compress: error, %s", ZSTD_getErrorName(clen));
-        free(cbuf);
+        block_buf_free(cbuf);
         return EIO;
     }
 
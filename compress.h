@@ -42,7 +42,7 @@
  * log - where to log errors
  * input - the data to compress
  * inlen - length of input
- * outputp - on successful return, points to compressed data in a malloc'd buffer
+ * outputp - on successful return, points to compressed data in a buffer from block_buf_alloc()
  * outlenp - on successful return, length of *outputp
  * level - compression level info from parse function, or NULL for default
  */
@@ -98,3 +98,4 @@ extern const struct comp_alg comp_algs[];
 
 // Functions
 extern const struct comp_alg *comp_find(const char *name);
+extern size_t comp_bound(size_t inlen);
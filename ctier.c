@@ -0,0 +1,375 @@
+
+/*
+ * s3backer - FUSE-based single file backing store via Amazon S3
+ *
+ * Copyright 2008-2020 Archie L. Cobbs <archie.cobbs@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations including
+ * the two.
+ *
+ * You must obey the GNU General Public License in all respects for all
+ * of the code used other than OpenSSL. If you modify file(s) with this
+ * exception, you may extend this exception to your version of the
+ * file(s), but you are not obligated to do so. If you do not wish to do
+ * so, delete this exception statement from your version. If you delete
+ * this exception statement from all source files in the program, then
+ * also delete it here.
+ */
+
+#include "s3backer.h"
+#include "compress.h"
+#include "ctier.h"
+#include "hash.h"
+#include "util.h"
+
+/*
+ * This file implements an in-memory store for compressed copies of clean blocks.
+ *
+ * Memory is a single slab divided into fixed-size chunks. A compressed block occupies as many chunks as it needs,
+ * which need not be contiguous; the chunks of each block are linked through the 'next' array. Because all chunks
+ * are the same size, freed space can always be reused, and the only waste is the unused part of each block's last
+ * chunk. When there aren't enough free chunks, the least recently stored blocks are discarded.
+ *
+ * Blocks that don't compress to less than CTIER_MAX_RATIO of their original size are not worth storing.
+ *
+ * Compression and decompression are done by s3b_ctier_compress() and s3b_ctier_decompress(), which only read
+ * fields that never change and so may be called without any locking; this keeps the expensive part out of the
+ * caller's lock. None of the other functions are thread safe; the caller must provide locking.
+ */
+
+// Tunable parameters
+#define CTIER_MIN_CHUNK_SIZE    256                     // minimum chunk size in bytes
+#define CTIER_CHUNKS_PER_BLOCK  64                      // maximum chunks per uncompressed block
+#define CTIER_MAX_RATIO         0.875                   // store blocks compressing to less than this fraction
+
+// End-of-chain marker
+#define CTIER_NO_CHUNK          ((u_int)~0)
+
+// One stored block (must have block_num as the first field for s3b_hash)
+struct ctier_entry {
+    s3b_block_t                 block_num;              // block number
+    u_int                       clen;                   // compressed length
+    u_int                       first;                  // first chunk
+    TAILQ_ENTRY(ctier_entry)    link;                   // next in LRU list
+};
+TAILQ_HEAD(ctier_list, ctier_entry);
+
+// Private data
+struct s3b_ctier {
+    log_func_t                  *log;                   // logging
+    const struct comp_alg       *calg;                  // compression algorithm
+    void                        *level;                 // compression level
+    u_int                       block_size;             // uncompressed block size
+    u_int                       chunk_size;             // size of each chunk
+    u_int                       num_chunks;             // total number of chunks
+    u_int                       num_free;               // number of free chunks
+    u_int                       free_list;              // first free chunk
+    u_int                       *next;                  // next chunk in block or free list
+    char                        *slab;                  // chunk memory
+    struct s3b_hash             *hashtable;             // block number -> struct ctier_entry
+    struct ctier_list           lru;                    // blocks in the order stored
+    struct s3b_ctier_stats      stats;                  // statistics
+};
+
+// Internal functions
+static void ctier_discard(struct s3b_ctier *tier, struct ctier_entry *entry);
+
+/*
+ * Create a new compressed tier using up to "max_bytes" of chunk memory.
+ */
+int
+s3b_ctier_create(struct s3b_ctier **tierp, log_func_t *log, u_int block_size, size_t max_bytes,
+  const struct comp_alg *calg, void *level)
+{
+    struct s3b_ctier *tier;
+    u_int i;
+    int r;
+
+    // Initialize structure
+    if ((tier = calloc(1, sizeof(*tier))) == NULL) {
+        r = errno;
+        (*log)(LOG_ERR, "calloc(): %s", strerror(r));
+        goto fail0;
+    }
+    tier->log = log;
+    tier->calg = calg;
+    tier->level = level;
+    tier->block_size = block_size;
+    tier->chunk_size = block_size / CTIER_CHUNKS_PER_BLOCK;
+    if (tier->chunk_size < CTIER_MIN_CHUNK_SIZE)
+        tier->chunk_size = CTIER_MIN_CHUNK_SIZE;
+    if (max_bytes / tier->chunk_size >= CTIER_NO_CHUNK) {
+        (*log)(LOG_ERR, "compressed block cache size is too large");
+        r = EINVAL;
+        goto fail1;
+    }
+    tier->num_chunks = max_bytes / tier->chunk_size;
+    if (tier->num_chunks < (block_size + tier->chunk_size - 1) / tier->chunk_size) {
+        (*log)(LOG_ERR, "compressed block cache size is too small for block size %u", block_size);
+        r = EINVAL;
+        goto fail1;
+    }
+    TAILQ_INIT(&tier->lru);
+
+    // Allocate memory; the slab is only touched as it gets used
+    if ((tier->slab = malloc((size_t)tier->num_chunks * tier->chunk_size)) == NULL) {
+        r = errno;
+        (*log)(LOG_ERR, "malloc(): %s", strerror(r));
+        goto fail1;
+    }
+    if ((tier->next = malloc(tier->num_chunks * sizeof(*tier->next))) == NULL) {
+        r = errno;
+        (*log)(LOG_ERR, "malloc(): %s", strerror(r));
+        goto fail2;
+    }
+    if ((r = s3b_hash_create(&tier->hashtable, tier->num_chunks)) != 0) {
+        (*log)(LOG_ERR, "can't create hash table: %s", strerror(r));
+        goto fail3;
+    }
+
+    // Put all chunks on the free list
+    for (i = 0; i < tier->num_chunks; i++)
+        tier->next[i] = i + 1 < tier->num_chunks ? i + 1 : CTIER_NO_CHUNK;
+    tier->free_list = 0;
+    tier->num_free = tier->num_chunks;
+
+    // Done
+    *tierp = tier;
+    return 0;
+
+fail3:
+    free(tier->next);
+fail2:
+    free(tier->slab);
+fail1:
+    free(tier);
+fail0:
+    return r;
+}
+
+void
+s3b_ctier_destroy(struct s3b_ctier *tier)
+{
+    struct ctier_entry *entry;
+
+    while ((entry = TAILQ_FIRST(&tier->lru)) != NULL) {
+        TAILQ_REMOVE(&tier->lru, entry, link);
+        free(entry);
+    }
+    s3b_hash_destroy(tier->hashtable);
+    free(tier->next);
+    free(tier->slab);
+    free(tier);
+}
+
+/*
+ * Compress a block into a new buffer, which the caller passes to s3b_ctier_store() or frees via block_buf_free().
+ *
+ * This function is thread safe.
+ */
+int
+s3b_ctier_compress(struct s3b_ctier *tier, const void *data, void **cbufp, size_t *clenp)
+{
+    return (*tier->calg->cfunc)(tier->log, data, tier->block_size, cbufp, clenp, tier->level);
+}
+
+/*
+ * Store a block compressed via s3b_ctier_compress(), replacing any previous version, and free "cbuf".
+ * Failures only mean the block is not stored.
+ */
+void
+s3b_ctier_store(struct s3b_ctier *tier, s3b_block_t block_num, void *cbuf, size_t clen)
+{
+    struct ctier_entry *entry;
+    u_int need_chunks;
+    u_int chunk;
+    u_int prev;
+    size_t off;
+
+    // Discard any previous version
+    s3b_ctier_remove(tier, block_num);
+
+    // Is it worth storing?
+    if (clen >= (size_t)(tier->block_size * CTIER_MAX_RATIO)) {
+        tier->stats.rejects++;
+        goto done;
+    }
+    need_chunks = (clen + tier->chunk_size - 1) / tier->chunk_size;
+
+    // Allocate entry
+    if ((entry = malloc(sizeof(*entry))) == NULL)
+        goto done;
+    entry->block_num = block_num;
+    entry->clen = clen;
+
+    // Make room
+    while (tier->num_free < need_chunks) {
+        ctier_discard(tier, TAILQ_FIRST(&tier->lru));
+        tier->stats.evictions++;
+    }
+
+    // Copy the compressed data into chunks taken from the free list
+    entry->first = tier->free_list;
+    for (off = 0, prev = CTIER_NO_CHUNK, chunk = tier->free_list; off < clen; off += tier->chunk_size) {
+        const size_t len = clen - off < tier->chunk_size ? clen - off : tier->chunk_size;
+
+        assert(chunk != CTIER_NO_CHUNK);
+        memcpy(tier->slab + (size_t)chunk * tier->chunk_size, (const char *)cbuf + off, len);
+        prev = chunk;
+        chunk = tier->next[chunk];
+    }
+    assert(prev != CTIER_NO_CHUNK);
+    tier->free_list = chunk;
+    tier->next[prev] = CTIER_NO_CHUNK;
+    tier->num_free -= need_chunks;
+
+    // Add entry
+    s3b_hash_put_new(tier->hashtable, entry);
+    TAILQ_INSERT_TAIL(&tier->lru, entry, link);
+    tier->stats.num_blocks++;
+    tier->stats.used_bytes += (size_t)need_chunks * tier->chunk_size;
+    tier->stats.data_bytes += tier->block_size;
+    tier->stats.stores++;
+
+done:
+    block_buf_free(cbuf);
+}
+
+/*
+ * Remove a block and return a copy of its compressed data in a new buffer, which the caller passes
+ * to s3b_ctier_decompress() and then frees via block_buf_free(). The block is going back into the
+ * main cache, so there's no point in keeping it here.
+ *
+ * Returns zero on success, ENOENT if the block is not stored, or other error code.
+ */
+int
+s3b_ctier_take(struct s3b_ctier *tier, s3b_block_t block_num, void **cbufp, size_t *clenp)
+{
+    struct ctier_entry *entry;
+    u_int chunk;
+    size_t off;
+    char *cbuf;
+
+    // Find block
+    if ((entry = s3b_hash_get(tier->hashtable, block_num)) == NULL)
+        return ENOENT;
+
+    // Reassemble the compressed data
+    if ((cbuf = block_buf_alloc(tier->block_size)) == NULL)
+        return errno;
+    for (off = 0, chunk = entry->first; off < entry->clen; off += tier->chunk_size, chunk = tier->next[chunk]) {
+        const size_t len = entry->clen - off < tier->chunk_size ? entry->clen - off : tier->chunk_size;
+
+        assert(chunk != CTIER_NO_CHUNK);
+        memcpy(cbuf + off, tier->slab + (size_t)chunk * tier->chunk_size, len);
+    }
+    *cbufp = cbuf;
+    *clenp = entry->clen;
+
+    // Remove it
+    ctier_discard(tier, entry);
+    tier->stats.hits++;
+    return 0;
+}
+
+/*
+ * Decompress a block returned by s3b_ctier_take() into "dest".
+ *
+ * This function is thread safe.
+ *
+ * Returns zero on success, or error code if the block can't be decompressed.
+ */
+int
+s3b_ctier_decompress(struct s3b_ctier *tier, s3b_block_t block_num, const void *cbuf, size_t clen, void *dest)
+{
+    size_t uclen;
+    int r;
+
+    uclen = tier->block_size;
+    if ((r = (*tier->calg->dfunc)(tier->log, cbuf, clen, dest, &uclen)) != 0)
+        return r;
+    if (uclen != tier->block_size) {
+        (*tier->log)(LOG_ERR, "compressed block %0*jx decompressed to %lu != %lu bytes",
+          S3B_BLOCK_NUM_DIGITS, (uintmax_t)block_num, (u_long)uclen, (u_long)tier->block_size);
+        return EIO;
+    }
+    return 0;
+}
+
+int
+s3b_ctier_contains(struct s3b_ctier *tier, s3b_block_t block_num)
+{
+    return s3b_hash_get(tier->hashtable, block_num) != NULL;
+}
+
+/*
+ * Discard a block if stored, e.g., because it's about to be modified.
+ */
+void
+s3b_ctier_remove(struct s3b_ctier *tier, s3b_block_t block_num)
+{
+    struct ctier_entry *entry;
+
+    if ((entry = s3b_hash_get(tier->hashtable, block_num)) != NULL)
+        ctier_discard(tier, entry);
+}
+
+void
+s3b_ctier_get_stats(struct s3b_ctier *tier, struct s3b_ctier_stats *stats)
+{
+    memcpy(stats, &tier->stats, sizeof(*stats));
+}
+
+void
+s3b_ctier_clear_stats(struct s3b_ctier *tier)
+{
+    tier->stats.hits = 0;
+    tier->stats.stores = 0;
+    tier->stats.rejects = 0;
+    tier->stats.evictions = 0;
+}
+
+/*
+ * Remove an entry and return its chunks to the free list.
+ */
+static void
+ctier_discard(struct s3b_ctier *tier, struct ctier_entry *entry)
+{
+    u_int num_chunks;
+    u_int chunk;
+
+    // Find the last chunk
+    for (num_chunks = 1, chunk = entry->first; tier->next[chunk] != CTIER_NO_CHUNK; num_chunks++)
+        chunk = tier->next[chunk];
+
+    // Prepend the chain to the free list
+    tier->next[chunk] = tier->free_list;
+    tier->free_list = entry->first;
+    tier->num_free += num_chunks;
+
+    // Remove entry
+    s3b_hash_remove(tier->hashtable, entry->block_num);
+    TAILQ_REMOVE(&tier->lru, entry, link);
+    tier->stats.num_blocks--;
+    tier->stats.used_bytes -= (size_t)num_chunks * tier->chunk_size;
+    tier->stats.data_bytes -= tier->block_size;
+    free(entry);
+}
@@ -0,0 +1,67 @@
+
+/*
+ * s3backer - FUSE-based single file backing store via Amazon S3
+ *
+ * Copyright 2008-2020 Archie L. Cobbs <archie.cobbs@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations including
+ * the two.
+ *
+ * You must obey the GNU General Public License in all respects for all
+ * of the code used other than OpenSSL. If you modify file(s) with this
+ * exception, you may extend this exception to your version of the
+ * file(s), but you are not obligated to do so. If you do not wish to do
+ * so, delete this exception statement from your version. If you delete
+ * this exception statement from all source files in the program, then
+ * also delete it here.
+ */
+
+/*
+ * In-memory compressed storage for clean blocks evicted from the block cache.
+ */
+
+// Declarations
+struct s3b_ctier;
+struct comp_alg;
+
+// Statistics
+struct s3b_ctier_stats {
+    u_int           num_blocks;                 // blocks currently stored
+    size_t          used_bytes;                 // bytes of chunk space in use
+    size_t          data_bytes;                 // uncompressed size of the blocks currently stored
+    uint64_t        hits;                       // blocks found and taken back
+    uint64_t        stores;                     // blocks compressed and stored
+    uint64_t        rejects;                    // blocks not stored because they didn't compress well enough
+    uint64_t        evictions;                  // blocks discarded to make room
+};
+
+// ctier.c
+extern int s3b_ctier_create(struct s3b_ctier **tierp, log_func_t *log, u_int block_size, size_t max_bytes,
+  const struct comp_alg *calg, void *level);
+extern void s3b_ctier_destroy(struct s3b_ctier *tier);
+extern int s3b_ctier_compress(struct s3b_ctier *tier, const void *data, void **cbufp, size_t *clenp);
+extern void s3b_ctier_store(struct s3b_ctier *tier, s3b_block_t block_num, void *cbuf, size_t clen);
+extern int s3b_ctier_take(struct s3b_ctier *tier, s3b_block_t block_num, void **cbufp, size_t *clenp);
+extern int s3b_ctier_decompress(struct s3b_ctier *tier, s3b_block_t block_num, const void *cbuf, size_t clen, void *dest);
+extern int s3b_ctier_contains(struct s3b_ctier *tier, s3b_block_t block_num);
+extern void s3b_ctier_remove(struct s3b_ctier *tier, s3b_block_t block_num);
+extern void s3b_ctier_get_stats(struct s3b_ctier *tier, struct s3b_ctier_stats *stats);
+extern void s3b_ctier_clear_stats(struct s3b_ctier *tier);
@@ -60,10 +60,37 @@
  *  data slot #1
  *  ...
  *  data slot #N-1
+ *
+ * If configured, the file is accessed via mmap(2). The directory is mapped first so it can be
+ * scanned at startup without any read(2) calls; once the directory is loaded, the file is extended
+ * (sparsely) to its maximum size and mapped in its entirety, so that reading and writing the
+ * directory and data slots is just a memcpy(), and s3b_dcache_fsync() uses msync(2).
+ *
+ * Alternately, if configured and supported, reads, writes, posix_fadvise(2) and fsync(2) are
+ * submitted via io_uring(7) using the cache file as a registered file. This allows batches of
+ * block reads (see s3b_dcache_read_blocks()) to be performed in parallel with one system call.
+ * Each thread gets its own ring, created on first use, so threads never wait for each other's I/O.
+ * The directory is still scanned at startup using normal pread(2) calls. If the ring fails, we
+ * permanently fall back to normal system calls.
+ *
+ * If configured, on close we write a compact index of the non-empty directory entries to a separate
+ * file (the cache file name plus ".index"), and record it in the file header. On the next open, if
+ * the index is present, matches the header, and passes its CRC check, we load it instead of scanning
+ * the entire directory. The index fields in the header are cleared (and synced) before the directory
+ * is modified, so after an unclean shutdown the index is ignored and we fall back to the full scan.
+ *
+ * Index file format:
+ *
+ *  [ struct index_header ]
+ *  struct index_entry for the first non-empty dslot
+ *  struct index_entry for the second non-empty dslot
+ *  ...
  */
 
 // Definitions
 #define DCACHE_SIGNATURE            0xe496f17b
+#define INDEX_SIGNATURE             0x4c8b0a3e
+#define INDEX_SUFFIX                ".index"
 #define ROUNDUP2(x, y)              (((x) + (y) - 1) & ~((y) - 1))
 #define DIRECTORY_READ_CHUNK        1024
 #define MIN_FILESYSTEM_BLOCK_SIZE   4096
@@ -75,11 +102,20 @@
 
 // Bits for file_header.flags
 #define HDRFLG_NEW_FORMAT           0x00000001
-#define HDRFLG_MASK                 0x00000001
+#define HDRFLG_ENCODED              0x00000002          // directory may contain ENTFLG_ENCODED entries
+#define HDRFLG_MASK                 0x00000003
 
 // Bits for dir_entry.flags
 #define ENTFLG_DIRTY                0x00000001
-#define ENTFLG_MASK                 0x00000001
+#define ENTFLG_ENCODED              0x00000002          // data is a struct encoded_header followed by encoded data
+#define ENTFLG_MASK                 0x00000003
+
+// io_uring(7) stuff
+#if HAVE_LIBURING_H && HAVE_LIBURING
+#define USE_IO_URING                1
+#define RING_ENTRIES                64
+#define RING_READ_BATCH             (RING_ENTRIES / 2)  // each read is followed by a posix_fadvise()
+#endif
 
 // File header (old format)
 struct ofile_header {
@@ -104,7 +140,10 @@ struct file_header {
     uint32_t                        flags;
     u_int                           max_blocks;
     int32_t                         mount_token;
-    uint32_t                        spare[7];           // future expansion
+    uint32_t                        index_token;        // matches index_header.token if index is valid, else zero
+    uint32_t                        index_entries;      // number of entries in the index
+    uint32_t                        index_crc;          // CRC-32 of the index entries
+    uint32_t                        spare[4];           // future expansion
 } __attribute__ ((packed));
 
 // One directory entry (old format)
@@ -120,6 +159,50 @@ struct dir_entry {
     uint32_t                        flags;
 } __attribute__ ((packed));
 
+#if USE_IO_URING
+// One I/O operation submitted through the ring
+struct ring_op {
+    int                             opcode;             // IORING_OP_READ, IORING_OP_WRITE, etc.
+    off_t                           offset;
+    char                            *buf;
+    size_t                          len;
+    size_t                          done;               // how much has been transferred so far
+    u_int                           advise;             // follow with POSIX_FADV_DONTNEED (the whole dslot)
+    off_t                           advise_offset;
+    u_int                           advise_len;
+    int                             state;              // RING_OP_IDLE, etc.
+    int                             error;
+};
+#define RING_OP_IDLE                0
+#define RING_OP_INFLIGHT            1
+#define RING_OP_DONE                2
+
+// One thread's ring
+struct dcache_ring {
+    struct io_uring                 ring;
+    struct s3b_dcache               *dcache;
+    struct dcache_ring              *next;              // next ring in dcache->rings
+};
+#endif
+
+// Index file header
+struct index_header {
+    uint32_t                        signature;
+    uint32_t                        header_size;
+    uint32_t                        entry_size;
+    uint32_t                        block_size;
+    u_int                           max_blocks;
+    uint32_t                        token;
+    uint32_t                        num_entries;
+    uint32_t                        crc;
+} __attribute__ ((packed));
+
+// One index entry
+struct index_entry {
+    u_int                           dslot;
+    struct dir_entry                entry;
+} __attribute__ ((packed));
+
 // Private structure
 struct s3b_dcache {
     int                             fd;
@@ -129,13 +212,24 @@ struct s3b_dcache {
     u_int                           max_blocks;
     u_int                           num_alloc;
     u_int                           fadvise;
+    u_int                           write_index;        // write an index file on close
     uint32_t                        flags;              // copy of file_header.flags
+    char                            *map;               // memory mapped file, or NULL if not mapped
+    size_t                          map_size;           // length of the memory mapped region
+#if USE_IO_URING
+    pthread_key_t                   ring_key;           // each thread's struct dcache_ring
+    pthread_mutex_t                 ring_mutex;         // protects "rings"
+    struct dcache_ring              *rings;             // all threads' rings
+    u_int                           ring_init;          // rings have been initialized
+    volatile u_int                  ring_ok;            // rings are usable
+#endif
     off_t                           data;
     off_t                           file_size;
     u_int                           file_block_size;
     u_int                           free_list_len;
     u_int                           free_list_alloc;
     s3b_block_t                     *free_list;
+    bitmap_t                        *encoded;           // which dslots contain encoded data
 };
 
 // Internal functions
@@ -149,11 +243,21 @@ static int s3b_dcache_create_file(struct s3b_dcache *priv, int *fdp, const char
             struct file_header *headerp);
 static int s3b_dcache_resize_file(struct s3b_dcache *priv, const struct file_header *header);
 static int s3b_dcache_init_free_list(struct s3b_dcache *priv, s3b_dcache_visit_t *visitor, void *arg, u_int visit_dirty);
+static int s3b_dcache_check_size(struct s3b_dcache *priv, u_int num_dslots_used);
+static int s3b_dcache_read_index(struct s3b_dcache *priv, const struct file_header *header, struct index_entry **entriesp);
+static int s3b_dcache_load_index(struct s3b_dcache *priv, struct index_entry *entries, u_int num_entries,
+            s3b_dcache_visit_t *visitor, void *arg, u_int visit_dirty);
+static int s3b_dcache_set_index(struct s3b_dcache *priv, uint32_t token, uint32_t num_entries, uint32_t crc);
+static void s3b_dcache_write_index(struct s3b_dcache *priv);
+static int s3b_dcache_map(struct s3b_dcache *priv, off_t size);
+static void s3b_dcache_unmap(struct s3b_dcache *priv);
 static int s3b_dcache_push(struct s3b_dcache *priv, u_int dslot);
 static void s3b_dcache_pop(struct s3b_dcache *priv, u_int *dslotp);
 static int s3b_dcache_read(struct s3b_dcache *priv, off_t offset, void *data, size_t len);
 static int s3b_dcache_write(struct s3b_dcache *priv, off_t offset, const void *data, size_t len);
+static int s3b_dcache_read2(struct s3b_dcache *priv, int fd, const char *filename, off_t offset, void *data, size_t len);
 static int s3b_dcache_write2(struct s3b_dcache *priv, int fd, const char *filename, off_t offset, const void *data, size_t len);
+static void s3b_dcache_advise(struct s3b_dcache *priv, u_int dslot);
 
 // fallocate(2) stuff
 #if HAVE_DECL_FALLOCATE && HAVE_DECL_FALLOC_FL_PUNCH_HOLE && HAVE_DECL_FALLOC_FL_KEEP_SIZE
@@ -165,6 +269,15 @@ static u_int s3b_dcache_count_zero_fs_blocks(struct s3b_dcache *priv, const char
 #else
 static int s3b_dcache_write_block_simple(struct s3b_dcache *priv, u_int dslot, const void *src, u_int off, u_int len);
 #endif
+#if USE_IO_URING
+static void s3b_dcache_ring_init(struct s3b_dcache *priv);
+static void s3b_dcache_ring_close(struct s3b_dcache *priv);
+static struct dcache_ring *s3b_dcache_ring_get(struct s3b_dcache *priv);
+static void s3b_dcache_ring_free(void *arg);
+static int s3b_dcache_ring_run(struct s3b_dcache *priv, struct ring_op *ops, u_int num_ops);
+static int s3b_dcache_ring_queue(struct io_uring *ring, struct ring_op *op);
+static void s3b_dcache_ring_complete(struct s3b_dcache *priv, struct ring_op *op, int res);
+#endif
 
 // Internal variables
 static const struct dir_entry zero_entry;
@@ -196,7 +309,11 @@ s3b_dcache_open(struct s3b_dcache **dcachep, struct block_cache_conf *config,
     priv->log = config->log;
     priv->block_size = config->block_size;
     priv->max_blocks = config->cache_size;
-    priv->fadvise = config->fadvise;
+    priv->fadvise = config->fadvise && !config->use_mmap;      // the mapping keeps the pages cached anyway
+    if ((priv->encoded = bitmap_init(priv->max_blocks, 0)) == NULL) {
+        r = errno;
+        goto fail1;
+    }
     if ((priv->filename = strdup(config->cache_file)) == NULL) {
         r = errno;
         goto fail1;
@@ -323,9 +440,61 @@ retry:
     // Compute offset of first data block
     priv->data = ROUNDUP2(DIR_OFFSET(priv->flags, priv->max_blocks), header.data_align);
 
-    // Read the directory to build the free list and visit allocated blocks
-    if (visitor != NULL && (r = s3b_dcache_init_free_list(priv, visitor, arg, visit_dirty)) != 0)
-        goto fail3;
+    // Map the directory, if so configured
+    if (config->use_mmap) {
+        if ((r = s3b_dcache_map(priv, priv->data)) != 0)
+            goto fail3;
+        (void)posix_madvise(priv->map, priv->map_size, POSIX_MADV_SEQUENTIAL);
+    }
+
+    // Read the directory to build the free list and visit allocated blocks, using the index file if possible
+    if (visitor != NULL) {
+        struct index_entry *entries = NULL;
+        int r2 = ENOENT;
+
+        // Read and validate the index, then invalidate it before we make any changes to the directory
+        if (header.index_token != 0) {
+            if (config->use_index && (r2 = s3b_dcache_read_index(priv, &header, &entries)) != 0) {
+                (*priv->log)(LOG_NOTICE, "ignoring index for cache file `%s': %s; scanning the directory instead",
+                  priv->filename, strerror(r2));
+            }
+            if ((r = s3b_dcache_set_index(priv, 0, 0, 0)) != 0) {
+                free(entries);
+                goto fail4;
+            }
+        }
+
+        // Load the index or scan the directory
+        if (r2 == 0) {
+            r = s3b_dcache_load_index(priv, entries, header.index_entries, visitor, arg, visit_dirty);
+            free(entries);
+        } else
+            r = s3b_dcache_init_free_list(priv, visitor, arg, visit_dirty);
+        if (r != 0)
+            goto fail4;
+        priv->write_index = config->use_index && (priv->flags & HDRFLG_NEW_FORMAT) != 0;
+    }
+
+    // Extend the file to its maximum size and map the whole thing, if so configured
+    if (config->use_mmap) {
+        const off_t full_size = DATA_OFFSET(priv, priv->max_blocks);
+
+        if (fstat(priv->fd, &sb) == -1) {
+            r = errno;
+            goto fail4;
+        }
+        if (sb.st_size < full_size && ftruncate(priv->fd, full_size) == -1) {
+            r = errno;
+            (*priv->log)(LOG_ERR, "error extending cache file `%s' to %ju bytes: %s",
+              priv->filename, (uintmax_t)full_size, strerror(r));
+            goto fail4;
+        }
+        if (priv->file_size < full_size)
+            priv->file_size = full_size;
+        if ((r = s3b_dcache_map(priv, full_size)) != 0)
+            goto fail4;
+        (void)posix_madvise(priv->map, priv->map_size, POSIX_MADV_RANDOM);
+    }
 
 #if HAVE_SYS_STATVFS_H
 
@@ -349,15 +518,24 @@ retry:
 
 #endif
 
+#if USE_IO_URING
+    // Set up io_uring, if so configured
+    if (config->use_io_uring && priv->map == NULL)
+        s3b_dcache_ring_init(priv);
+#endif
+
     // Done
     *dcachep = priv;
     return 0;
 
+fail4:
+    s3b_dcache_unmap(priv);
 fail3:
     close(priv->fd);
 fail2:
     free(priv->filename);
 fail1:
+    bitmap_free(&priv->encoded);
     free(priv->free_list);
     free(priv);
     return r;
@@ -398,9 +576,16 @@ s3b_dcache_set_mount_token(struct s3b_dcache *priv, int32_t *old_valuep, int32_t
 void
 s3b_dcache_close(struct s3b_dcache *priv)
 {
+    if (priv->write_index)
+        s3b_dcache_write_index(priv);
+#if USE_IO_URING
+    s3b_dcache_ring_close(priv);
+#endif
+    s3b_dcache_unmap(priv);
     close(priv->fd);
     free(priv->filename);
     free(priv->free_list);
+    bitmap_free(&priv->encoded);
     free(priv);
 }
 
@@ -455,12 +640,21 @@ s3b_dcache_record_block(struct s3b_dcache *priv, u_int dslot, s3b_block_t block_
     // Directory entry should be writable
     assert(s3b_dcache_entry_write_ok(priv, dslot, block_num, dirty));
 
-    // If cache file is older format, it doesn't store dirty blocks, so just erase it instead (prior behavior)
-    if (dirty && (priv->flags & HDRFLG_NEW_FORMAT) == 0) {
+    // If cache file is older format, it doesn't store dirty or encoded blocks, so just erase it instead (prior behavior)
+    if ((dirty || bitmap_test(priv->encoded, dslot)) && (priv->flags & HDRFLG_NEW_FORMAT) == 0) {
         s3b_dcache_erase_block(priv, dslot);
         return 0;
     }
 
+    // Mark the file as containing encoded blocks, so older versions that don't understand them will refuse it
+    if (!dirty && bitmap_test(priv->encoded, dslot) && (priv->flags & HDRFLG_ENCODED) == 0) {
+        const uint32_t flags = priv->flags | HDRFLG_ENCODED;
+
+        if ((r = s3b_dcache_write(priv, offsetof(struct file_header, flags), &flags, sizeof(flags))) != 0)
+            return r;
+        priv->flags = flags;
+    }
+
     // Make sure any new data is written to disk before updating the directory
     if ((r = s3b_dcache_fsync(priv)) != 0)
         return r;
@@ -469,6 +663,8 @@ s3b_dcache_record_block(struct s3b_dcache *priv, u_int dslot, s3b_block_t block_
     memset(&entry, 0, sizeof(entry));
     entry.block_num = block_num;
     entry.flags = dirty ? ENTFLG_DIRTY : 0;
+    if (!dirty && bitmap_test(priv->encoded, dslot))
+        entry.flags |= ENTFLG_ENCODED;
     if (!dirty)
         memcpy(&entry.etag, etag, MD5_DIGEST_LENGTH);
     if ((r = s3b_dcache_write_entry(priv, dslot, &entry)) != 0)
@@ -525,6 +721,7 @@ s3b_dcache_free_block(struct s3b_dcache *priv, u_int dslot)
     // Push dslot onto free list
     if ((r = s3b_dcache_push(priv, dslot)) != 0)
         return r;
+    bitmap_set(priv->encoded, dslot, 0);
 
     // Done
     priv->num_alloc--;
@@ -545,26 +742,92 @@ s3b_dcache_read_block(struct s3b_dcache *priv, u_int dslot, void *dest, u_int of
     assert(len <= priv->block_size);
     assert(off + len <= priv->block_size);
 
+#if USE_IO_URING
+    // Read data and advise the kernel with a single submission
+    if (priv->ring_ok && off == 0 && len == priv->block_size) {
+        struct s3b_dcache_io io;
+
+        io.dslot = dslot;
+        io.buf = dest;
+        return s3b_dcache_read_blocks(priv, &io, 1);
+    }
+#endif
+
     // Read data
     if ((r = s3b_dcache_read(priv, DATA_OFFSET(priv, dslot) + off, dest, len)) != 0)
         return r;
 
-    // Advise the kernel to not cache this data block (note this may or may not work if transparent huge pages are being used)
-#if HAVE_DECL_POSIX_FADVISE
-    if (priv->fadvise && (r = posix_fadvise(priv->fd, DATA_OFFSET(priv, dslot), priv->block_size, POSIX_FADV_DONTNEED)) != 0)
-        (*priv->log)(LOG_WARNING, "posix_fadvise(\"%s\"): %s", priv->filename, strerror(r));
-#endif
+    // Advise the kernel to not cache this data block
+    s3b_dcache_advise(priv, dslot);
 
     // Done
     return 0;
 }
 
+/*
+ * Read the entire contents of several dslots.
+ *
+ * When using io_uring, the reads (and any posix_fadvise() calls) are submitted together in batches.
+ */
+int
+s3b_dcache_read_blocks(struct s3b_dcache *priv, const struct s3b_dcache_io *ios, u_int num_ios)
+{
+    u_int i;
+    int r;
+
+#if USE_IO_URING
+    while (priv->ring_ok && num_ios > 0) {
+        struct ring_op ops[RING_READ_BATCH];
+        u_int num_ops;
+
+        // Build the next batch
+        num_ops = num_ios < RING_READ_BATCH ? num_ios : RING_READ_BATCH;
+        memset(ops, 0, num_ops * sizeof(*ops));
+        for (i = 0; i < num_ops; i++) {
+            struct ring_op *const op = &ops[i];
+
+            assert(ios[i].dslot < priv->max_blocks);
+            op->opcode = IORING_OP_READ;
+            op->offset = DATA_OFFSET(priv, ios[i].dslot);
+            op->buf = ios[i].buf;
+            op->len = priv->block_size;
+            op->advise = priv->fadvise;
+            op->advise_offset = op->offset;
+            op->advise_len = priv->block_size;
+        }
+
+        // Perform the reads; if the ring failed, retry using normal system calls
+        if ((r = s3b_dcache_ring_run(priv, ops, num_ops)) != 0) {
+            if (priv->ring_ok)
+                return r;
+            break;
+        }
+        ios += num_ops;
+        num_ios -= num_ops;
+    }
+#endif
+
+    // Read blocks one at a time
+    for (i = 0; i < num_ios; i++) {
+        if ((r = s3b_dcache_read_block(priv, ios[i].dslot, ios[i].buf, 0, priv->block_size)) != 0)
+            return r;
+    }
+    return 0;
+}
+
 /*
  * Write data into one dslot.
  */
 int
 s3b_dcache_write_block(struct s3b_dcache *priv, u_int dslot, const void *src, u_int off, u_int len)
 {
+    // Sanity check
+    assert(dslot < priv->max_blocks);
+    assert((off == 0 && len == priv->block_size) || !bitmap_test(priv->encoded, dslot));
+
+    // Whatever is there now is no longer encoded data
+    bitmap_set(priv->encoded, dslot, 0);
+
 #if USE_FALLOCATE
     return s3b_dcache_write_block_falloc(priv, dslot, src, off, len);
 #else
@@ -572,6 +835,35 @@ s3b_dcache_write_block(struct s3b_dcache *priv, u_int dslot, const void *src, u_
 #endif
 }
 
+/*
+ * Write an encoded block (a struct encoded_header followed by the encoded data) into one dslot.
+ *
+ * The next call to s3b_dcache_record_block() will record the dslot as containing encoded data.
+ */
+int
+s3b_dcache_write_encoded(struct s3b_dcache *priv, u_int dslot, const void *src)
+{
+    int r;
+
+    // Write the whole dslot
+    if ((r = s3b_dcache_write_block(priv, dslot, src, 0, priv->block_size)) != 0)
+        return r;
+
+    // Mark it as encoded
+    bitmap_set(priv->encoded, dslot, 1);
+    return 0;
+}
+
+/*
+ * Determine whether a dslot contains encoded data.
+ */
+int
+s3b_dcache_is_encoded(struct s3b_dcache *priv, u_int dslot)
+{
+    assert(dslot < priv->max_blocks);
+    return bitmap_test(priv->encoded, dslot);
+}
+
 #if USE_FALLOCATE
 
 /*
@@ -658,11 +950,8 @@ s3b_dcache_write_block_falloc(struct s3b_dcache *priv, u_int dslot, const char *
             return r;
     }
 
-    // Advise the kernel to not cache this data block (note this may or may not work if transparent huge pages are being used)
-#if HAVE_DECL_POSIX_FADVISE
-    if (priv->fadvise && (r = posix_fadvise(priv->fd, DATA_OFFSET(priv, dslot), priv->block_size, POSIX_FADV_DONTNEED)) != 0)
-        (*priv->log)(LOG_WARNING, "posix_fadvise(\"%s\"): %s", priv->filename, strerror(r));
-#endif
+    // Advise the kernel to not cache this data block
+    s3b_dcache_advise(priv, dslot);
 
     // Done
     return 0;
@@ -716,11 +1005,8 @@ s3b_dcache_write_block_simple(struct s3b_dcache *priv, u_int dslot, const void *
     if ((r = s3b_dcache_write(priv, DATA_OFFSET(priv, dslot) + off, src != NULL ? src : zero_block, len)) != 0)
         return r;
 
-    // Advise the kernel to not cache this data block (note this may or may not work if transparent huge pages are being used)
-#if HAVE_DECL_POSIX_FADVISE
-    if (priv->fadvise && (r = posix_fadvise(priv->fd, DATA_OFFSET(priv, dslot), priv->block_size, POSIX_FADV_DONTNEED)) != 0)
-        (*priv->log)(LOG_WARNING, "posix_fadvise(\"%s\"): %s", priv->filename, strerror(r));
-#endif
+    // Advise the kernel to not cache this data block
+    s3b_dcache_advise(priv, dslot);
 
     // Done
     return 0;
@@ -736,11 +1022,25 @@ s3b_dcache_fsync(struct s3b_dcache *priv)
 {
     int r;
 
+#if USE_IO_URING
+    if (priv->ring_ok) {
+        struct ring_op op;
+
+        memset(&op, 0, sizeof(op));
+        op.opcode = IORING_OP_FSYNC;
+        if ((r = s3b_dcache_ring_run(priv, &op, 1)) == 0 || priv->ring_ok)
+            return 0;
+    }
+#endif
+    if (priv->map != NULL)
+        r = msync(priv->map, priv->map_size, MS_SYNC);
+    else {
 #if HAVE_DECL_FDATASYNC
-    r = fdatasync(priv->fd);
+        r = fdatasync(priv->fd);
 #else
-    r = fsync(priv->fd);
+        r = fsync(priv->fd);
 #endif
+    }
     if (r == -1) {
         r = errno;
         (*priv->log)(LOG_ERR, "error fsync'ing cache file `%s': %s", priv->filename, strerror(r));
@@ -869,6 +1169,14 @@ s3b_dcache_resize_file(struct s3b_dcache *priv, const struct file_header *old_he
                 goto done;
             }
 
+            // Carry over the encoded blocks marker
+            if ((entry.flags & ENTFLG_ENCODED) != 0 && (new_header.flags & HDRFLG_ENCODED) == 0) {
+                new_header.flags |= HDRFLG_ENCODED;
+                if ((r = s3b_dcache_write2(priv, new_fd, tempfile, offsetof(struct file_header, flags),
+                  &new_header.flags, sizeof(new_header.flags))) != 0)
+                    goto fail;
+            }
+
             // Copy the directory entry
             assert(DIR_ENTSIZE(new_header.flags) == sizeof(entry));
             if ((r = s3b_dcache_write2(priv, new_fd, tempfile,
@@ -978,8 +1286,6 @@ fail:
 static int
 s3b_dcache_init_free_list(struct s3b_dcache *priv, s3b_dcache_visit_t *visitor, void *arg, u_int visit_dirty)
 {
-    off_t required_size;
-    struct stat sb;
     u_int num_entries;
     u_int num_dslots_used;
     u_int base_dslot;
@@ -1013,6 +1319,9 @@ s3b_dcache_init_free_list(struct s3b_dcache *priv, s3b_dcache_visit_t *visitor,
             if (memcmp(&entry, &zero_entry, sizeof(entry)) == 0) {
                 if ((r = s3b_dcache_push(priv, dslot)) != 0)
                     return r;
+            } else if ((entry.flags & ~ENTFLG_MASK) != 0) {
+                (*priv->log)(LOG_ERR, "invalid cache file `%s': %s", priv->filename, "unrecognized directory entry flags present");
+                return EINVAL;
             } else if ((entry.flags & ENTFLG_DIRTY) != 0 && !visit_dirty) {     // visitor doesn't want dirties, so just nuke it
                 if ((r = s3b_dcache_write_entry(priv, dslot, &zero_entry)) != 0)
                     return r;
@@ -1022,6 +1331,7 @@ s3b_dcache_init_free_list(struct s3b_dcache *priv, s3b_dcache_visit_t *visitor,
                 priv->num_alloc++;
                 if (dslot + 1 > num_dslots_used)                    // keep track of the number of dslots in use
                     num_dslots_used = dslot + 1;
+                bitmap_set(priv->encoded, dslot, (entry.flags & ENTFLG_ENCODED) != 0);
                 if ((r = (*visitor)(arg, dslot, entry.block_num, (entry.flags & ENTFLG_DIRTY) == 0 ? entry.etag : NULL)) != 0)
                     return r;
             }
@@ -1036,6 +1346,28 @@ s3b_dcache_init_free_list(struct s3b_dcache *priv, s3b_dcache_visit_t *visitor,
         priv->free_list[priv->free_list_len - i - 1] = temp;
     }
 
+    // Verify the cache file size
+    if ((r = s3b_dcache_check_size(priv, num_dslots_used)) != 0)
+        return r;
+
+    // Report results
+    (*priv->log)(LOG_INFO, "loaded cache file `%s' with %u free and %u used blocks (max index %u)",
+      priv->filename, priv->free_list_len, priv->max_blocks - priv->free_list_len, num_dslots_used);
+
+    // Done
+    return 0;
+}
+
+/*
+ * Verify the cache file is not truncated, and discard any unreferenced data beyond the last used dslot.
+ */
+static int
+s3b_dcache_check_size(struct s3b_dcache *priv, u_int num_dslots_used)
+{
+    off_t required_size;
+    struct stat sb;
+    int r;
+
     // Verify the cache file is not truncated
     required_size = DIR_OFFSET(priv->flags, priv->max_blocks);
     if (num_dslots_used > 0) {
@@ -1061,14 +1393,302 @@ s3b_dcache_init_free_list(struct s3b_dcache *priv, s3b_dcache_visit_t *visitor,
         return EINVAL;
     }
 
+    // Done
+    return 0;
+}
+
+/*
+ * Read and validate the index file, which must match the index fields in the cache file header.
+ * On success, *entriesp is set to a malloc'd array of header->index_entries entries.
+ */
+static int
+s3b_dcache_read_index(struct s3b_dcache *priv, const struct file_header *header, struct index_entry **entriesp)
+{
+    struct index_header iheader;
+    struct index_entry *entries = NULL;
+    char *index_file;
+    struct stat sb;
+    size_t entries_len;
+    size_t sofar;
+    uLong crc;
+    u_int i;
+    int fd;
+    int r;
+
+    // Open index file
+    if (asprintf(&index_file, "%s%s", priv->filename, INDEX_SUFFIX) == -1)
+        return errno;
+    if ((fd = open(index_file, O_RDONLY|O_CLOEXEC)) == -1) {
+        r = errno;
+        goto fail1;
+    }
+
+    // Check file length
+    entries_len = (size_t)header->index_entries * sizeof(*entries);
+    if (fstat(fd, &sb) == -1) {
+        r = errno;
+        goto fail2;
+    }
+    if (sb.st_size != (off_t)(sizeof(iheader) + entries_len)) {
+        r = EINVAL;
+        goto fail2;
+    }
+
+    // Read and verify index header
+    if ((r = s3b_dcache_read2(priv, fd, index_file, (off_t)0, &iheader, sizeof(iheader))) != 0)
+        goto fail2;
+    if (iheader.signature != INDEX_SIGNATURE
+      || iheader.header_size != sizeof(iheader)
+      || iheader.entry_size != sizeof(*entries)
+      || iheader.block_size != priv->block_size
+      || iheader.max_blocks != priv->max_blocks
+      || iheader.token != header->index_token
+      || iheader.num_entries != header->index_entries
+      || iheader.crc != header->index_crc) {
+        r = EINVAL;
+        goto fail2;
+    }
+
+    // Read entries
+    if ((entries = malloc(entries_len > 0 ? entries_len : 1)) == NULL) {
+        r = errno;
+        goto fail2;
+    }
+    if ((r = s3b_dcache_read2(priv, fd, index_file, (off_t)sizeof(iheader), entries, entries_len)) != 0)
+        goto fail3;
+
+    // Verify CRC
+    crc = crc32(0L, Z_NULL, 0);
+    for (sofar = 0; sofar < entries_len; ) {
+        const uInt chunk = entries_len - sofar > (1 << 30) ? (1 << 30) : (uInt)(entries_len - sofar);
+
+        crc = crc32(crc, (const Bytef *)entries + sofar, chunk);
+        sofar += chunk;
+    }
+    if ((uint32_t)crc != header->index_crc) {
+        r = EINVAL;
+        goto fail3;
+    }
+
+    // Sanity check entries
+    for (i = 0; i < header->index_entries; i++) {
+        const struct index_entry *const ientry = &entries[i];
+
+        if (ientry->dslot >= priv->max_blocks
+          || (i > 0 && ientry->dslot <= entries[i - 1].dslot)
+          || (ientry->entry.flags & ~ENTFLG_MASK) != 0
+          || memcmp(&ientry->entry, &zero_entry, sizeof(zero_entry)) == 0) {
+            r = EINVAL;
+            goto fail3;
+        }
+    }
+
+    // Done
+    (void)close(fd);
+    free(index_file);
+    *entriesp = entries;
+    return 0;
+
+fail3:
+    free(entries);
+fail2:
+    (void)close(fd);
+fail1:
+    free(index_file);
+    return r;
+}
+
+/*
+ * Build the free list and visit allocated blocks using the (validated) index instead of the directory.
+ */
+static int
+s3b_dcache_load_index(struct s3b_dcache *priv, struct index_entry *entries, u_int num_entries,
+    s3b_dcache_visit_t *visitor, void *arg, u_int visit_dirty)
+{
+    u_int num_dslots_used = 0;
+    u_int dslot;
+    u_int i;
+    int r;
+
+    // Logging
+    (*priv->log)(LOG_INFO, "reading meta-data from index for cache file `%s'", priv->filename);
+    assert(visitor != NULL);
+
+    // Visit allocated blocks
+    for (i = 0; i < num_entries; i++) {
+        struct index_entry *const ientry = &entries[i];
+
+        if ((ientry->entry.flags & ENTFLG_DIRTY) != 0 && !visit_dirty) {    // visitor doesn't want dirties, so just nuke it
+            if ((r = s3b_dcache_write_entry(priv, ientry->dslot, &zero_entry)) != 0)
+                return r;
+            memset(&ientry->entry, 0, sizeof(ientry->entry));               // now it's free
+            continue;
+        }
+        priv->num_alloc++;
+        num_dslots_used = ientry->dslot + 1;                                // entries are sorted by dslot
+        bitmap_set(priv->encoded, ientry->dslot, (ientry->entry.flags & ENTFLG_ENCODED) != 0);
+        if ((r = (*visitor)(arg, ientry->dslot, ientry->entry.block_num,
+          (ientry->entry.flags & ENTFLG_DIRTY) == 0 ? ientry->entry.etag : NULL)) != 0)
+            return r;
+    }
+
+    // Build the free list in reverse order so we allocate lower numbered slots first
+    for (dslot = priv->max_blocks, i = num_entries; dslot-- > 0; ) {
+        if (i > 0 && entries[i - 1].dslot == dslot) {
+            if (memcmp(&entries[--i].entry, &zero_entry, sizeof(zero_entry)) != 0)
+                continue;
+        }
+        if ((r = s3b_dcache_push(priv, dslot)) != 0)
+            return r;
+    }
+
+    // Verify the cache file size
+    if ((r = s3b_dcache_check_size(priv, num_dslots_used)) != 0)
+        return r;
+
     // Report results
-    (*priv->log)(LOG_INFO, "loaded cache file `%s' with %u free and %u used blocks (max index %u)",
+    (*priv->log)(LOG_INFO, "loaded cache file `%s' from index with %u free and %u used blocks (max index %u)",
       priv->filename, priv->free_list_len, priv->max_blocks - priv->free_list_len, num_dslots_used);
 
     // Done
     return 0;
 }
 
+/*
+ * Update the index fields in the cache file header and sync to disk.
+ */
+static int
+s3b_dcache_set_index(struct s3b_dcache *priv, uint32_t token, uint32_t num_entries, uint32_t crc)
+{
+    uint32_t fields[3];
+    int r;
+
+    // Sanity check
+    assert(offsetof(struct file_header, index_entries) == offsetof(struct file_header, index_token) + sizeof(uint32_t));
+    assert(offsetof(struct file_header, index_crc) == offsetof(struct file_header, index_entries) + sizeof(uint32_t));
+
+    // Update file
+    fields[0] = token;
+    fields[1] = num_entries;
+    fields[2] = crc;
+    if ((r = s3b_dcache_write(priv, offsetof(struct file_header, index_token), fields, sizeof(fields))) != 0)
+        return r;
+
+    // Sync to disk
+    s3b_dcache_fsync(priv);
+    return 0;
+}
+
+/*
+ * Write out the index file and record it in the cache file header. Errors are logged but otherwise ignored;
+ * the only consequence is that the directory will be scanned on the next startup.
+ */
+static void
+s3b_dcache_write_index(struct s3b_dcache *priv)
+{
+    char buffer[DIRECTORY_READ_CHUNK * sizeof(struct dir_entry)];
+    struct index_entry ientries[DIRECTORY_READ_CHUNK];
+    struct index_header iheader;
+    char *index_file;
+    off_t offset;
+    uLong crc;
+    uint32_t num_ientries;
+    u_int num_entries;
+    u_int base_dslot;
+    u_int i;
+    int fd;
+    int r;
+
+    // Make sure the directory is on disk before the index that describes it
+    s3b_dcache_fsync(priv);
+
+    // Create index file
+    if (asprintf(&index_file, "%s%s", priv->filename, INDEX_SUFFIX) == -1) {
+        (*priv->log)(LOG_ERR, "can't write cache file index: %s", strerror(errno));
+        return;
+    }
+    if ((fd = open(index_file, O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC, 0644)) == -1) {
+        (*priv->log)(LOG_ERR, "can't create file `%s': %s", index_file, strerror(errno));
+        goto done;
+    }
+
+    // Copy non-empty directory entries into the index
+    crc = crc32(0L, Z_NULL, 0);
+    offset = sizeof(iheader);
+    for (num_ientries = base_dslot = 0; base_dslot < priv->max_blocks; base_dslot += num_entries) {
+        u_int count = 0;
+
+        // Read in the next chunk of directory entries
+        num_entries = priv->max_blocks - base_dslot;
+        if (num_entries > DIRECTORY_READ_CHUNK)
+            num_entries = DIRECTORY_READ_CHUNK;
+        if ((r = s3b_dcache_read(priv, DIR_OFFSET(priv->flags, base_dslot), buffer, num_entries * DIR_ENTSIZE(priv->flags))) != 0)
+            goto fail;
+
+        // Gather the non-empty ones
+        for (i = 0; i < num_entries; i++) {
+            struct index_entry *const ientry = &ientries[count];
+
+            memset(&ientry->entry, 0, sizeof(ientry->entry));
+            memcpy(&ientry->entry, buffer + i * DIR_ENTSIZE(priv->flags), DIR_ENTSIZE(priv->flags));
+            if (memcmp(&ientry->entry, &zero_entry, sizeof(zero_entry)) == 0)
+                continue;
+            ientry->dslot = base_dslot + i;
+            count++;
+        }
+
+        // Write them out
+        if (count > 0) {
+            crc = crc32(crc, (const Bytef *)ientries, count * sizeof(*ientries));
+            if ((r = s3b_dcache_write2(priv, fd, index_file, offset, ientries, count * sizeof(*ientries))) != 0)
+                goto fail;
+            offset += count * sizeof(*ientries);
+            num_ientries += count;
+        }
+    }
+
+    // Write index header
+    memset(&iheader, 0, sizeof(iheader));
+    iheader.signature = INDEX_SIGNATURE;
+    iheader.header_size = sizeof(iheader);
+    iheader.entry_size = sizeof(struct index_entry);
+    iheader.block_size = priv->block_size;
+    iheader.max_blocks = priv->max_blocks;
+    while ((iheader.token = (uint32_t)random()) == 0)
+        ;
+    iheader.num_entries = num_ientries;
+    iheader.crc = (uint32_t)crc;
+    if ((r = s3b_dcache_write2(priv, fd, index_file, (off_t)0, &iheader, sizeof(iheader))) != 0)
+        goto fail;
+
+    // Sync index to disk
+    if (fsync(fd) == -1) {
+        (*priv->log)(LOG_ERR, "error fsync'ing `%s': %s", index_file, strerror(errno));
+        goto fail;
+    }
+    if (close(fd) == -1) {
+        fd = -1;
+        (*priv->log)(LOG_ERR, "error closing `%s': %s", index_file, strerror(errno));
+        goto fail;
+    }
+    fd = -1;
+
+    // Record index in the cache file header
+    if ((r = s3b_dcache_set_index(priv, iheader.token, iheader.num_entries, iheader.crc)) != 0)
+        goto fail;
+    (*priv->log)(LOG_INFO, "wrote index for cache file `%s' with %u entries", priv->filename, (u_int)num_ientries);
+    goto done;
+
+fail:
+    (*priv->log)(LOG_ERR, "failed to write index for cache file `%s'; the directory will be scanned on next startup",
+      priv->filename);
+    if (fd != -1)
+        (void)close(fd);
+    (void)unlink(index_file);
+done:
+    free(index_file);
+}
+
 /*
  * Push a dslot onto the free list.
  */
@@ -1130,8 +1750,77 @@ s3b_dcache_pop(struct s3b_dcache *priv, u_int *dslotp)
     assert(priv->free_list_len <= priv->free_list_alloc);
 }
 
+/*
+ * Map the first "size" bytes of the cache file into memory, replacing any previous mapping.
+ */
+static int
+s3b_dcache_map(struct s3b_dcache *priv, off_t size)
+{
+    void *map;
+    int r;
+
+    // Sanity check
+    if ((size_t)size != size) {
+        (*priv->log)(LOG_ERR, "can't mmap cache file `%s': file is too large", priv->filename);
+        return EFBIG;
+    }
+
+    // Create new mapping
+    if ((map = mmap(NULL, (size_t)size, PROT_READ|PROT_WRITE, MAP_SHARED, priv->fd, 0)) == MAP_FAILED) {
+        r = errno;
+        (*priv->log)(LOG_ERR, "can't mmap cache file `%s': %s", priv->filename, strerror(r));
+        return r;
+    }
+
+    // Replace old mapping
+    s3b_dcache_unmap(priv);
+    priv->map = map;
+    priv->map_size = (size_t)size;
+    return 0;
+}
+
+static void
+s3b_dcache_unmap(struct s3b_dcache *priv)
+{
+    if (priv->map == NULL)
+        return;
+    if (munmap(priv->map, priv->map_size) == -1)
+        (*priv->log)(LOG_ERR, "can't munmap cache file `%s': %s", priv->filename, strerror(errno));
+    priv->map = NULL;
+    priv->map_size = 0;
+}
+
 static int
 s3b_dcache_read(struct s3b_dcache *priv, off_t offset, void *data, size_t len)
+{
+
+    // Use the memory mapping if possible
+    if (priv->map != NULL && offset + len <= priv->map_size) {
+        memcpy(data, priv->map + offset, len);
+        return 0;
+    }
+
+#if USE_IO_URING
+    // Use the ring if possible, falling back to pread(2) if the ring fails
+    if (priv->ring_ok && len > 0) {
+        struct ring_op op;
+        int r;
+
+        memset(&op, 0, sizeof(op));
+        op.opcode = IORING_OP_READ;
+        op.offset = offset;
+        op.buf = data;
+        op.len = len;
+        if ((r = s3b_dcache_ring_run(priv, &op, 1)) == 0 || priv->ring_ok)
+            return r;
+    }
+#endif
+
+    return s3b_dcache_read2(priv, priv->fd, priv->filename, offset, data, len);
+}
+
+static int
+s3b_dcache_read2(struct s3b_dcache *priv, int fd, const char *filename, off_t offset, void *data, size_t len)
 {
     size_t sofar;
     ssize_t r;
@@ -1139,15 +1828,15 @@ s3b_dcache_read(struct s3b_dcache *priv, off_t offset, void *data, size_t len)
     for (sofar = 0; sofar < len; sofar += r) {
         const off_t posn = offset + sofar;
 
-        if ((r = pread(priv->fd, (char *)data + sofar, len - sofar, offset + sofar)) == -1) {
+        if ((r = pread(fd, (char *)data + sofar, len - sofar, offset + sofar)) == -1) {
             r = errno;
             (*priv->log)(LOG_ERR, "error reading cache file `%s' at offset %ju: %s",
-              priv->filename, (uintmax_t)posn, strerror(r));
+              filename, (uintmax_t)posn, strerror(r));
             return r;
         }
         if (r == 0) {           // truncated input
             (*priv->log)(LOG_ERR, "error reading cache file `%s' at offset %ju: file is truncated",
-              priv->filename, (uintmax_t)posn);
+              filename, (uintmax_t)posn);
             return EINVAL;
         }
     }
@@ -1157,6 +1846,28 @@ s3b_dcache_read(struct s3b_dcache *priv, off_t offset, void *data, size_t len)
 static int
 s3b_dcache_write(struct s3b_dcache *priv, off_t offset, const void *data, size_t len)
 {
+    // Use the memory mapping if possible
+    if (priv->map != NULL && offset + len <= priv->map_size) {
+        memcpy(priv->map + offset, data, len);
+        return 0;
+    }
+
+#if USE_IO_URING
+    // Use the ring if possible, falling back to pwrite(2) if the ring fails
+    if (priv->ring_ok && len > 0) {
+        struct ring_op op;
+        int r;
+
+        memset(&op, 0, sizeof(op));
+        op.opcode = IORING_OP_WRITE;
+        op.offset = offset;
+        op.buf = (char *)(uintptr_t)data;               // not modified
+        op.len = len;
+        if ((r = s3b_dcache_ring_run(priv, &op, 1)) == 0 || priv->ring_ok)
+            return r;
+    }
+#endif
+
     return s3b_dcache_write2(priv, priv->fd, priv->filename, offset, data, len);
 }
 
@@ -1181,3 +1892,372 @@ s3b_dcache_write2(struct s3b_dcache *priv, int fd, const char *filename, off_t o
     }
     return 0;
 }
+
+/*
+ * Advise the kernel to not cache a data block (note this may or may not work if transparent huge pages are being used).
+ */
+static void
+s3b_dcache_advise(struct s3b_dcache *priv, u_int dslot)
+{
+    int r;
+
+    if (!priv->fadvise)
+        return;
+#if USE_IO_URING
+    if (priv->ring_ok) {
+        struct ring_op op;
+
+        memset(&op, 0, sizeof(op));
+        op.opcode = IORING_OP_FADVISE;
+        op.offset = DATA_OFFSET(priv, dslot);
+        op.len = priv->block_size;
+        if (s3b_dcache_ring_run(priv, &op, 1) == 0 || priv->ring_ok)
+            return;
+    }
+#endif
+#if HAVE_DECL_POSIX_FADVISE
+    if ((r = posix_fadvise(priv->fd, DATA_OFFSET(priv, dslot), priv->block_size, POSIX_FADV_DONTNEED)) != 0)
+        (*priv->log)(LOG_WARNING, "posix_fadvise(\"%s\"): %s", priv->filename, strerror(r));
+#else
+    (void)r;
+#endif
+}
+
+#if USE_IO_URING
+
+/*
+ * Set up the rings, and create one for the current thread to verify io_uring works.
+ * On failure, a warning is logged and we just use normal system calls.
+ */
+static void
+s3b_dcache_ring_init(struct s3b_dcache *priv)
+{
+    int r;
+
+    // Initialize mutex and key
+    if ((r = pthread_mutex_init(&priv->ring_mutex, NULL)) != 0) {
+        (*priv->log)(LOG_WARNING, "can't set up io_uring for cache file `%s': %s", priv->filename, strerror(r));
+        return;
+    }
+    if ((r = pthread_key_create(&priv->ring_key, s3b_dcache_ring_free)) != 0) {
+        (*priv->log)(LOG_WARNING, "can't set up io_uring for cache file `%s': %s", priv->filename, strerror(r));
+        pthread_mutex_destroy(&priv->ring_mutex);
+        return;
+    }
+    priv->ring_init = 1;
+    priv->ring_ok = 1;
+
+    // Try it out
+    if (s3b_dcache_ring_get(priv) == NULL)
+        s3b_dcache_ring_close(priv);
+}
+
+/*
+ * Free all rings. This assumes no other threads are using the cache file.
+ */
+static void
+s3b_dcache_ring_close(struct s3b_dcache *priv)
+{
+    struct dcache_ring *dring;
+
+    if (!priv->ring_init)
+        return;
+    pthread_key_delete(priv->ring_key);
+    while ((dring = priv->rings) != NULL) {
+        priv->rings = dring->next;
+        io_uring_queue_exit(&dring->ring);
+        free(dring);
+    }
+    pthread_mutex_destroy(&priv->ring_mutex);
+    priv->ring_init = 0;
+    priv->ring_ok = 0;
+}
+
+/*
+ * Get the current thread's ring, creating it if necessary.
+ *
+ * If the ring can't be created, priv->ring_ok is cleared and NULL is returned.
+ */
+static struct dcache_ring *
+s3b_dcache_ring_get(struct s3b_dcache *priv)
+{
+    struct dcache_ring *dring;
+    int r;
+
+    // Already created?
+    if ((dring = pthread_getspecific(priv->ring_key)) != NULL)
+        return dring;
+
+    // Create the ring
+    if ((dring = calloc(1, sizeof(*dring))) == NULL) {
+        r = errno;
+        (*priv->log)(LOG_ERR, "can't set up io_uring for cache file `%s': %s (reverting to normal I/O)",
+          priv->filename, strerror(r));
+        goto fail0;
+    }
+    dring->dcache = priv;
+    if ((r = io_uring_queue_init(RING_ENTRIES, &dring->ring, 0)) < 0) {
+        (*priv->log)(LOG_ERR, "can't set up io_uring for cache file `%s': %s (reverting to normal I/O)",
+          priv->filename, strerror(-r));
+        goto fail1;
+    }
+
+    // Register the cache file; it becomes fixed file #0
+    if ((r = io_uring_register_files(&dring->ring, &priv->fd, 1)) < 0) {
+        (*priv->log)(LOG_ERR, "can't register cache file `%s' with io_uring: %s (reverting to normal I/O)",
+          priv->filename, strerror(-r));
+        goto fail2;
+    }
+
+    // Associate it with this thread
+    if ((r = pthread_setspecific(priv->ring_key, dring)) != 0) {
+        (*priv->log)(LOG_ERR, "can't set up io_uring for cache file `%s': %s (reverting to normal I/O)",
+          priv->filename, strerror(r));
+        goto fail2;
+    }
+    pthread_mutex_lock(&priv->ring_mutex);
+    dring->next = priv->rings;
+    priv->rings = dring;
+    CHECK_RETURN(pthread_mutex_unlock(&priv->ring_mutex));
+
+    // Done
+    return dring;
+
+fail2:
+    io_uring_queue_exit(&dring->ring);
+fail1:
+    free(dring);
+fail0:
+    priv->ring_ok = 0;
+    return NULL;
+}
+
+/*
+ * Free a thread's ring when the thread exits.
+ */
+static void
+s3b_dcache_ring_free(void *arg)
+{
+    struct dcache_ring *const dring = arg;
+    struct s3b_dcache *const priv = dring->dcache;
+    struct dcache_ring **dringp;
+
+    // Remove from list
+    pthread_mutex_lock(&priv->ring_mutex);
+    for (dringp = &priv->rings; *dringp != dring; dringp = &(*dringp)->next)
+        assert(*dringp != NULL);
+    *dringp = dring->next;
+    CHECK_RETURN(pthread_mutex_unlock(&priv->ring_mutex));
+
+    // Free ring
+    io_uring_queue_exit(&dring->ring);
+    free(dring);
+}
+
+/*
+ * Perform the given operations using the current thread's ring and wait for them all to complete.
+ *
+ * Returns the error from the first failed operation, if any. If the ring itself fails,
+ * priv->ring_ok is cleared and the caller should fall back to normal system calls.
+ */
+static int
+s3b_dcache_ring_run(struct s3b_dcache *priv, struct ring_op *ops, u_int num_ops)
+{
+    struct dcache_ring *dring;
+    struct io_uring *ring;
+    struct io_uring_cqe *cqe;
+    u_int num_queued = 0;                               // queued but not yet submitted
+    u_int num_pending = 0;                              // submitted but not yet reaped
+    u_int num_done = 0;
+    u_int i;
+    int r;
+
+    // Initialize ops
+    for (i = 0; i < num_ops; i++) {
+        ops[i].done = 0;
+        ops[i].state = RING_OP_IDLE;
+        ops[i].error = 0;
+    }
+
+    // Get our ring
+    if (!priv->ring_ok || (dring = s3b_dcache_ring_get(priv)) == NULL)
+        return ENXIO;
+    ring = &dring->ring;
+
+    // Loop until all operations are complete
+    while (num_done < num_ops) {
+
+        // Queue any operations that need (re)submitting
+        for (i = 0; i < num_ops; i++) {
+            if (ops[i].state == RING_OP_IDLE)
+                num_queued += s3b_dcache_ring_queue(ring, &ops[i]);
+        }
+
+        // Submit and wait for at least one completion
+        if ((r = io_uring_submit_and_wait(ring, 1)) < 0) {
+            if (r == -EINTR || r == -EAGAIN || r == -EBUSY) {
+                if (num_pending > 0 && (r = io_uring_wait_cqe(ring, &cqe)) < 0 && r != -EINTR)
+                    goto broken;
+                goto reap;
+            }
+            goto broken;
+        }
+        assert((u_int)r <= num_queued);
+        num_queued -= r;
+        num_pending += r;
+
+    reap:
+        // Reap completions
+        while (num_pending > 0 && io_uring_peek_cqe(ring, &cqe) == 0) {
+            struct ring_op *const op = io_uring_cqe_get_data(cqe);
+
+            if (op != NULL) {
+                s3b_dcache_ring_complete(priv, op, cqe->res);
+                if (op->state == RING_OP_DONE)
+                    num_done++;
+            }
+            io_uring_cqe_seen(ring, cqe);
+            num_pending--;
+        }
+    }
+
+    // Find the first error, if any
+    r = 0;
+    for (i = 0; i < num_ops; i++) {
+        if ((r = ops[i].error) != 0)
+            break;
+    }
+    return r;
+
+broken:
+    // The ring itself has failed; wait for in-flight operations (they reference caller buffers), then give up on rings
+    (*priv->log)(LOG_ERR, "io_uring failure for cache file `%s': %s (reverting to normal I/O)", priv->filename, strerror(-r));
+    priv->ring_ok = 0;
+    while (num_pending > 0) {
+        if ((r = io_uring_wait_cqe(ring, &cqe)) < 0) {
+            if (r == -EINTR)
+                continue;
+            break;
+        }
+        io_uring_cqe_seen(ring, cqe);
+        num_pending--;
+    }
+    return ENXIO;
+}
+
+/*
+ * Queue one operation (plus any following posix_fadvise()) if there is room in the submission queue.
+ * Returns the number of SQE's queued.
+ */
+static int
+s3b_dcache_ring_queue(struct io_uring *ring, struct ring_op *op)
+{
+    const u_int num_sqes = op->advise ? 2 : 1;
+    struct io_uring_sqe *sqe;
+
+    // Check for room
+    if (io_uring_sq_space_left(ring) < num_sqes)
+        return 0;
+
+    // Prepare the operation itself
+    sqe = io_uring_get_sqe(ring);
+    switch (op->opcode) {
+    case IORING_OP_READ:
+        io_uring_prep_read(sqe, 0, op->buf + op->done, op->len - op->done, op->offset + op->done);
+        break;
+    case IORING_OP_WRITE:
+        io_uring_prep_write(sqe, 0, op->buf + op->done, op->len - op->done, op->offset + op->done);
+        break;
+    case IORING_OP_FSYNC:
+        io_uring_prep_fsync(sqe, 0, IORING_FSYNC_DATASYNC);
+        break;
+    case IORING_OP_FADVISE:
+        io_uring_prep_fadvise(sqe, 0, op->offset, op->len, POSIX_FADV_DONTNEED);
+        break;
+    default:
+        assert(0);
+        break;
+    }
+    sqe->flags |= IOSQE_FIXED_FILE;
+    io_uring_sqe_set_data(sqe, op);
+    op->state = RING_OP_INFLIGHT;
+
+    // Link in the posix_fadvise(), if any, so it happens after the I/O; we don't care about its result
+    if (op->advise) {
+        sqe->flags |= IOSQE_IO_LINK;
+        sqe = io_uring_get_sqe(ring);
+        io_uring_prep_fadvise(sqe, 0, op->advise_offset, op->advise_len, POSIX_FADV_DONTNEED);
+        sqe->flags |= IOSQE_FIXED_FILE;
+        io_uring_sqe_set_data(sqe, NULL);
+    }
+
+    // Done
+    return num_sqes;
+}
+
+/*
+ * Process the completion of one operation. Short reads and writes are put back in the IDLE state to be resubmitted.
+ */
+static void
+s3b_dcache_ring_complete(struct s3b_dcache *priv, struct ring_op *op, int res)
+{
+    const off_t posn = op->offset + op->done;
+
+    // Sanity check
+    assert(op->state == RING_OP_INFLIGHT);
+
+    // Handle errors
+    if (res < 0) {
+        switch (op->opcode) {
+        case IORING_OP_READ:
+            (*priv->log)(LOG_ERR, "error reading cache file `%s' at offset %ju: %s",
+              priv->filename, (uintmax_t)posn, strerror(-res));
+            break;
+        case IORING_OP_WRITE:
+            (*priv->log)(LOG_ERR, "error writing cache file `%s' at offset %ju: %s",
+              priv->filename, (uintmax_t)posn, strerror(-res));
+            break;
+        case IORING_OP_FSYNC:
+            (*priv->log)(LOG_ERR, "error fsync'ing cache file `%s': %s", priv->filename, strerror(-res));
+            break;
+        case IORING_OP_FADVISE:
+            (*priv->log)(LOG_WARNING, "posix_fadvise(\"%s\"): %s", priv->filename, strerror(-res));
+            break;
+        default:
+            break;
+        }
+        op->error = -res;
+        op->state = RING_OP_DONE;
+        return;
+    }
+
+    // Handle reads and writes, which may be short
+    switch (op->opcode) {
+    case IORING_OP_READ:
+        if (res == 0) {           // truncated input
+            (*priv->log)(LOG_ERR, "error reading cache file `%s' at offset %ju: file is truncated",
+              priv->filename, (uintmax_t)posn);
+            op->error = EINVAL;
+            break;
+        }
+        op->done += res;
+        break;
+    case IORING_OP_WRITE:
+        if (res == 0) {           // no progress
+            (*priv->log)(LOG_ERR, "error writing cache file `%s' at offset %ju: %s",
+              priv->filename, (uintmax_t)posn, strerror(EIO));
+            op->error = EIO;
+            break;
+        }
+        op->done += res;
+        if (op->offset + op->done > priv->file_size)
+            priv->file_size = op->offset + op->done;
+        break;
+    default:
+        op->done = op->len;
+        break;
+    }
+    op->state = op->error == 0 && op->done < op->len ? RING_OP_IDLE : RING_OP_DONE;
+}
+
+#endif  /* USE_IO_URING */
@@ -49,6 +49,12 @@ struct block_cache_conf;
  */
 typedef int s3b_dcache_visit_t(void *arg, s3b_block_t dslot, s3b_block_t block_num, const u_char *etag);
 
+// One block in a batch of reads
+struct s3b_dcache_io {
+    u_int           dslot;
+    void            *buf;
+};
+
 // dcache.c
 extern int s3b_dcache_open(struct s3b_dcache **dcachep,
   struct block_cache_conf *config, s3b_dcache_visit_t *visitor, void *arg, u_int visit_dirty);
@@ -59,7 +65,10 @@ extern int s3b_dcache_record_block(struct s3b_dcache *priv, u_int dslot, s3b_blo
 extern int s3b_dcache_erase_block(struct s3b_dcache *priv, u_int dslot);
 extern int s3b_dcache_free_block(struct s3b_dcache *dcache, u_int dslot);
 extern int s3b_dcache_read_block(struct s3b_dcache *dcache, u_int dslot, void *dest, u_int off, u_int len);
+extern int s3b_dcache_read_blocks(struct s3b_dcache *dcache, const struct s3b_dcache_io *ios, u_int num_ios);
 extern int s3b_dcache_write_block(struct s3b_dcache *dcache, u_int dslot, const void *src, u_int off, u_int len);
+extern int s3b_dcache_write_encoded(struct s3b_dcache *dcache, u_int dslot, const void *src);
+extern int s3b_dcache_is_encoded(struct s3b_dcache *dcache, u_int dslot);
 extern int s3b_dcache_fsync(struct s3b_dcache *dcache);
 extern int s3b_dcache_has_mount_token(struct s3b_dcache *priv);
 extern int s3b_dcache_set_mount_token(struct s3b_dcache *priv, int32_t *old_valuep, int32_t new_value);
@@ -0,0 +1,1306 @@
+
+/*
+ * s3backer - FUSE-based single file backing store via Amazon S3
+ *
+ * Copyright 2008-2020 Archie L. Cobbs <archie.cobbs@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations including
+ * the two.
+ *
+ * You must obey the GNU General Public License in all respects for all
+ * of the code used other than OpenSSL. If you modify file(s) with this
+ * exception, you may extend this exception to your version of the
+ * file(s), but you are not obligated to do so. If you do not wish to do
+ * so, delete this exception statement from your version. If you delete
+ * this exception statement from all source files in the program, then
+ * also delete it here.
+ */
+
+#include "s3backer.h"
+#include "dedup.h"
+#include "util.h"
+
+/*
+ * Content-addressed block deduplication.
+ *
+ * Every virtual block V normally lives in physical slot V of the underlying store. When a block is written
+ * whose content is known to already exist in some slot S, nothing is written; instead we record that V
+ * now lives in slot S. Since lower layers (the block cache in particular) are keyed by slot, identical blocks
+ * then also share a single cache entry.
+ *
+ * The block -> slot map is persisted in R index blocks stored in slots N+1 .. N+R of the underlying store,
+ * where N is the number of virtual blocks. Each index block is an array of little endian 32 bit entries,
+ * one per virtual block: zero means "in its own slot" and S + 1 means "in slot S". So an all-zeros (i.e.,
+ * never written) index is the identity mapping, and dedup can be enabled on an existing disk image.
+ *
+ * Slot N holds a header block recording the signature, block size, and N; it is written along with the first
+ * index blocks. On startup, a header that doesn't match our configuration means the disk was created with
+ * a different size or block size, so the index is somewhere else and we refuse to start; dedup_probe() lets
+ * a mount without dedup detect a deduplicated disk the same way.
+ *
+ * Content is matched using a bounded, in-memory table of SHA-256 digests of blocks written since startup.
+ * Each table entry records the slot's generation number, which is bumped whenever the slot is overwritten,
+ * so stale entries are detected on lookup.
+ *
+ * A slot is "in use" if its own virtual block lives there, or if any other virtual block points to it.
+ * Overwriting a virtual block whose slot is also in use by other blocks is done copy-on-write: the new content
+ * goes to some free slot instead (there must be one, by pigeonhole). A slot is only ever overwritten if it's
+ * free according to both the in-memory map and the map as last persisted (including an index flush that is
+ * in progress), so a crash can't leave the persisted map pointing to the wrong content. If no such slot exists,
+ * we flush the index and try again.
+ *
+ * Flushing the index first flushes all data in the lower layers, then writes the dirty index blocks, so the
+ * index never refers to data that hasn't been persisted. Flushing any block whose mapping has changed implies
+ * flushing the index.
+ *
+ * Once a disk image has been written with dedup enabled, it must always be used with dedup enabled.
+ */
+
+// Map entry value meaning "in its own slot"
+#define DEDUP_IDENTITY          ((s3b_block_t)~0)
+
+// Number of table slots probed when looking up or inserting a digest
+#define DEDUP_TABLE_PROBES      8
+
+// Bytes per index entry
+#define DEDUP_ENTRY_SIZE        4
+
+// Header block definitions
+#define DEDUP_SIGNATURE         0xded0b10c              // followed by block size and number of blocks
+
+// Slot containing the header block or an index block
+#define DEDUP_HEADER_SLOT(config)       ((config)->num_blocks)
+#define DEDUP_INDEX_SLOT(config, index) ((config)->num_blocks + 1 + (index))
+
+// Content table entry
+struct dedup_entry {
+    u_char                      digest[SHA256_DIGEST_LENGTH];
+    s3b_block_t                 slot;
+    uint32_t                    gen;                    // generation of slot when entry was created
+    int                         valid;
+};
+
+// A persisted map change that is being flushed
+struct dedup_change {
+    s3b_block_t                 block_num;
+    s3b_block_t                 slot;                   // new map entry
+};
+
+// Survey state
+struct dedup_survey {
+    bitmap_t                    *non_zero;              // slots possibly containing non-zero data
+    s3b_block_t                 num_blocks;
+};
+
+// Internal state
+struct dedup_private {
+    struct dedup_conf           *config;
+    struct s3backer_store       *inner;
+    struct dedup_stats          stats;
+    s3b_block_t                 num_index;              // number of index blocks (not including the header block)
+    s3b_block_t                 *map;                   // current block -> slot map (or DEDUP_IDENTITY)
+    s3b_block_t                 *pmap;                  // block -> slot map as last persisted
+    uint32_t                    *refs;                  // number of other blocks pointing to each slot in "map"
+    uint32_t                    *prefs;                 // same for "pmap", plus pending changes being flushed
+    uint32_t                    *gens;                  // slot generation numbers
+    bitmap_t                    *busy;                  // slot is being written
+    bitmap_t                    *writing;               // virtual block is being written
+    bitmap_t                    *pending_identity;      // block's change to identity is being flushed
+    bitmap_t                    *dirty;                 // index block needs to be written
+    struct dedup_change         *unconfirmed;           // changes from failed flushes, still protected
+    s3b_block_t                 num_unconfirmed;
+    struct dedup_entry          *table;
+    u_int                       table_mask;
+    s3b_block_t                 free_cursor;            // where to start looking for a free slot
+    u_int                       num_busy;               // number of slots being written
+    int                         loaded;                 // index has been loaded
+    int                         have_header;            // header block has been written
+    int                         flushing;               // an index flush is in progress
+    pthread_mutex_t             mutex;
+    pthread_cond_t              cond;                   // signaled when a write or index flush completes
+};
+
+// s3backer_store functions
+static int dedup_create_threads(struct s3backer_store *s3b);
+static int dedup_meta_data(struct s3backer_store *s3b, off_t *file_sizep, u_int *block_sizep);
+static int dedup_set_mount_token(struct s3backer_store *s3b, int32_t *old_valuep, int32_t new_value);
+static int dedup_read_block(struct s3backer_store *s3b, s3b_block_t block_num, void *dest,
+  u_char *actual_etag, const u_char *expect_etag, int strict);
+static int dedup_read_block_part(struct s3backer_store *s3b, s3b_block_t block_num, u_int off, u_int len, void *dest);
+static int dedup_write_block(struct s3backer_store *s3b, s3b_block_t block_num, const void *src, u_char *etag,
+  check_cancel_t *check_cancel, void *check_cancel_arg);
+static int dedup_write_block_part(struct s3backer_store *s3b, s3b_block_t block_num, u_int off, u_int len, const void *src);
+static int dedup_read_blocks(struct s3backer_store *s3b, s3b_block_t block_num, u_int num_blocks, void *dest);
+static int dedup_write_blocks(struct s3backer_store *s3b, s3b_block_t block_num, u_int num_blocks, const void *src,
+    u_char *etags, check_cancel_t *check_cancel, void *check_cancel_arg);
+static int dedup_flush_blocks(struct s3backer_store *s3b, const s3b_block_t *block_nums, u_int num_blocks, long timeout);
+static int dedup_survey_non_zero(struct s3backer_store *s3b, const struct survey_params *params);
+static int dedup_prefetch_blocks(struct s3backer_store *s3b, s3b_block_t block_num, u_int num_blocks);
+static int dedup_shutdown(struct s3backer_store *s3b);
+static void dedup_destroy(struct s3backer_store *s3b);
+
+// Misc
+static int dedup_load_index(struct dedup_private *priv);
+static int dedup_check_header(struct dedup_private *priv, const u_char *buf);
+static int dedup_parse_header(const u_char *buf, u_int *block_sizep, s3b_block_t *num_blocksp);
+static uint32_t dedup_decode32(const u_char *buf);
+static void dedup_encode32(u_char *buf, uint32_t value);
+static int dedup_flush_index(struct dedup_private *priv, long timeout);
+static void dedup_add_unconfirmed(struct dedup_private *priv, const struct dedup_change *changes, s3b_block_t num_changes);
+static int dedup_change_cmp(const struct dedup_change *change1, const struct dedup_change *change2);
+static int dedup_write_block2(struct dedup_private *priv, s3b_block_t block_num, const void *src, u_char *etag,
+  check_cancel_t *check_cancel, void *check_cancel_arg);
+static void dedup_begin_write(struct dedup_private *priv, s3b_block_t block_num);
+static void dedup_end_write(struct dedup_private *priv, s3b_block_t block_num);
+static void dedup_set_map(struct dedup_private *priv, s3b_block_t block_num, s3b_block_t slot);
+static int dedup_slot_is_free(struct dedup_private *priv, s3b_block_t slot);
+static s3b_block_t dedup_find_free(struct dedup_private *priv, s3b_block_t block_num);
+static struct dedup_entry *dedup_table_find(struct dedup_private *priv, const u_char *digest);
+static void dedup_table_insert(struct dedup_private *priv, const u_char *digest, s3b_block_t slot);
+static block_list_func_t dedup_survey_callback;
+
+// Resolve a virtual block to its slot
+#define DEDUP_SLOT(priv, block_num)     ((priv)->map[(block_num)] == DEDUP_IDENTITY ? (block_num) : (priv)->map[(block_num)])
+
+/*
+ * Returns the number of blocks (the header block plus the index blocks) that follow the N data blocks
+ * in the underlying store.
+ */
+s3b_block_t
+dedup_index_blocks(u_int block_size, s3b_block_t num_blocks)
+{
+    const s3b_block_t per_block = block_size / DEDUP_ENTRY_SIZE;
+
+    return 1 + (num_blocks + per_block - 1) / per_block;
+}
+
+/*
+ * Returns the largest number of data blocks that, along with their index, fit in "total_blocks".
+ */
+s3b_block_t
+dedup_data_blocks(u_int block_size, s3b_block_t total_blocks)
+{
+    s3b_block_t num_blocks = total_blocks;
+
+    while (num_blocks > 0 && (off_t)num_blocks + dedup_index_blocks(block_size, num_blocks) > total_blocks)
+        num_blocks--;
+    return num_blocks;
+}
+
+/*
+ * Check whether slot "num_blocks" of the given store contains a dedup header block, i.e., whether
+ * the store holds a deduplicated disk with "num_blocks" blocks of "block_size" bytes.
+ *
+ * Returns zero if not, EEXIST if so, or other error code.
+ */
+int
+dedup_probe(struct s3backer_store *s3b, u_int block_size, s3b_block_t num_blocks)
+{
+    u_int header_block_size;
+    s3b_block_t header_num_blocks;
+    u_char *buf;
+    int r;
+
+    if ((buf = block_buf_alloc(block_size)) == NULL)
+        return errno;
+    if ((r = (*s3b->read_block)(s3b, num_blocks, buf, NULL, NULL, 0)) == 0
+      && dedup_parse_header(buf, &header_block_size, &header_num_blocks) && header_num_blocks == num_blocks)
+        r = EEXIST;
+    block_buf_free(buf);
+    return r;
+}
+
+/*
+ * Constructor
+ *
+ * On error, returns NULL and sets `errno'.
+ */
+struct s3backer_store *
+dedup_create(struct dedup_conf *config, struct s3backer_store *inner)
+{
+    const s3b_block_t num_blocks = config->num_blocks;
+    struct s3backer_store *s3b;
+    struct dedup_private *priv;
+    u_int table_size;
+    s3b_block_t i;
+    int r;
+
+    // Sanity check
+    if (config->block_size < DEDUP_ENTRY_SIZE || num_blocks >= DEDUP_IDENTITY) {
+        r = EINVAL;
+        goto fail0;
+    }
+
+    // Initialize structures
+    if ((s3b = calloc(1, sizeof(*s3b))) == NULL) {
+        r = errno;
+        (*config->log)(LOG_ERR, "calloc(): %s", strerror(r));
+        goto fail0;
+    }
+    s3b->create_threads = dedup_create_threads;
+    s3b->meta_data = dedup_meta_data;
+    s3b->set_mount_token = dedup_set_mount_token;
+    s3b->read_block = dedup_read_block;
+    s3b->write_block = dedup_write_block;
+    if (inner->read_block_part != NULL)
+        s3b->read_block_part = dedup_read_block_part;
+    s3b->write_block_part = dedup_write_block_part;
+    s3b->read_blocks = dedup_read_blocks;
+    s3b->write_blocks = dedup_write_blocks;
+    s3b->bulk_zero = generic_bulk_zero;
+    s3b->flush_blocks = dedup_flush_blocks;
+    s3b->survey_non_zero = dedup_survey_non_zero;
+    if (inner->prefetch_blocks != NULL)
+        s3b->prefetch_blocks = dedup_prefetch_blocks;
+    s3b->shutdown = dedup_shutdown;
+    s3b->destroy = dedup_destroy;
+    if ((priv = calloc(1, sizeof(*priv))) == NULL) {
+        r = errno;
+        (*config->log)(LOG_ERR, "calloc(): %s", strerror(r));
+        goto fail1;
+    }
+    priv->config = config;
+    priv->inner = inner;
+    priv->num_index = dedup_index_blocks(config->block_size, num_blocks) - 1;
+    if ((r = pthread_mutex_init(&priv->mutex, NULL)) != 0)
+        goto fail2;
+    if ((r = pthread_cond_init(&priv->cond, NULL)) != 0)
+        goto fail3;
+
+    // Allocate the map and associated per-slot state
+    if ((priv->map = malloc(num_blocks * sizeof(*priv->map))) == NULL
+      || (priv->pmap = malloc(num_blocks * sizeof(*priv->pmap))) == NULL
+      || (priv->refs = calloc(num_blocks, sizeof(*priv->refs))) == NULL
+      || (priv->prefs = calloc(num_blocks, sizeof(*priv->prefs))) == NULL
+      || (priv->gens = calloc(num_blocks, sizeof(*priv->gens))) == NULL
+      || (priv->busy = bitmap_init(num_blocks, 0)) == NULL
+      || (priv->writing = bitmap_init(num_blocks, 0)) == NULL
+      || (priv->pending_identity = bitmap_init(num_blocks, 0)) == NULL
+      || (priv->dirty = bitmap_init(priv->num_index, 0)) == NULL) {
+        r = errno;
+        (*config->log)(LOG_ERR, "can't allocate dedup map: %s", strerror(r));
+        goto fail4;
+    }
+    for (i = 0; i < num_blocks; i++)
+        priv->map[i] = priv->pmap[i] = DEDUP_IDENTITY;
+
+    // Allocate content table, rounding size up to a power of two
+    for (table_size = 1; table_size < config->table_size && table_size < (1U << 31); table_size <<= 1)
+        ;
+    if ((priv->table = calloc(table_size, sizeof(*priv->table))) == NULL) {
+        r = errno;
+        (*config->log)(LOG_ERR, "can't allocate dedup table: %s", strerror(r));
+        goto fail4;
+    }
+    priv->table_mask = table_size - 1;
+    s3b->data = priv;
+
+    // Done
+    return s3b;
+
+fail4:
+    free(priv->table);
+    free(priv->dirty);
+    free(priv->pending_identity);
+    free(priv->writing);
+    free(priv->busy);
+    free(priv->gens);
+    free(priv->prefs);
+    free(priv->refs);
+    free(priv->pmap);
+    free(priv->map);
+    pthread_cond_destroy(&priv->cond);
+fail3:
+    pthread_mutex_destroy(&priv->mutex);
+fail2:
+    free(priv);
+fail1:
+    free(s3b);
+fail0:
+    (*config->log)(LOG_ERR, "dedup creation failed: %s", strerror(r));
+    errno = r;
+    return NULL;
+}
+
+static int
+dedup_create_threads(struct s3backer_store *s3b)
+{
+    struct dedup_private *const priv = s3b->data;
+    int r;
+
+    if ((r = (*priv->inner->create_threads)(priv->inner)) != 0)
+        return r;
+    return dedup_load_index(priv);
+}
+
+static int
+dedup_meta_data(struct s3backer_store *s3b, off_t *file_sizep, u_int *block_sizep)
+{
+    struct dedup_private *const priv = s3b->data;
+
+    return (*priv->inner->meta_data)(priv->inner, file_sizep, block_sizep);
+}
+
+static int
+dedup_set_mount_token(struct s3backer_store *s3b, int32_t *old_valuep, int32_t new_value)
+{
+    struct dedup_private *const priv = s3b->data;
+
+    return (*priv->inner->set_mount_token)(priv->inner, old_valuep, new_value);
+}
+
+static int
+dedup_shutdown(struct s3backer_store *const s3b)
+{
+    struct dedup_private *const priv = s3b->data;
+    int r;
+
+    // Persist the index
+    if (priv->loaded && (r = dedup_flush_index(priv, 0)) != 0)
+        (*priv->config->log)(LOG_ERR, "dedup: failed to write index: %s", strerror(r));
+
+    // Shut down lower layer
+    return (*priv->inner->shutdown)(priv->inner);
+}
+
+static void
+dedup_destroy(struct s3backer_store *const s3b)
+{
+    struct dedup_private *const priv = s3b->data;
+
+    // Destroy inner store
+    (*priv->inner->destroy)(priv->inner);
+
+    // Free structures
+    free(priv->unconfirmed);
+    free(priv->table);
+    free(priv->dirty);
+    free(priv->pending_identity);
+    free(priv->writing);
+    free(priv->busy);
+    free(priv->gens);
+    free(priv->prefs);
+    free(priv->refs);
+    free(priv->pmap);
+    free(priv->map);
+    pthread_cond_destroy(&priv->cond);
+    pthread_mutex_destroy(&priv->mutex);
+    free(priv);
+    free(s3b);
+}
+
+void
+dedup_get_stats(struct s3backer_store *s3b, struct dedup_stats *stats)
+{
+    struct dedup_private *const priv = s3b->data;
+
+    pthread_mutex_lock(&priv->mutex);
+    memcpy(stats, &priv->stats, sizeof(*stats));
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+}
+
+void
+dedup_clear_stats(struct s3backer_store *s3b)
+{
+    struct dedup_private *const priv = s3b->data;
+
+    pthread_mutex_lock(&priv->mutex);
+    priv->stats.dedup_writes = 0;
+    priv->stats.unchanged_writes = 0;
+    priv->stats.relocated_writes = 0;
+    priv->stats.index_flushes = 0;
+    priv->stats.index_blocks_written = 0;
+    priv->stats.out_of_memory_errors = 0;
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+}
+
+static int
+dedup_read_block(struct s3backer_store *const s3b, s3b_block_t block_num, void *dest,
+  u_char *actual_etag, const u_char *expect_etag, int strict)
+{
+    struct dedup_private *const priv = s3b->data;
+    s3b_block_t slot;
+
+    // Sanity check
+    if (block_num >= priv->config->num_blocks)
+        return EINVAL;
+
+    // Find slot (it can't be reused until this block is written, and a concurrent write gives undefined results anyway)
+    pthread_mutex_lock(&priv->mutex);
+    slot = DEDUP_SLOT(priv, block_num);
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+
+    // Read it
+    return (*priv->inner->read_block)(priv->inner, slot, dest, actual_etag, expect_etag, strict);
+}
+
+static int
+dedup_read_block_part(struct s3backer_store *s3b, s3b_block_t block_num, u_int off, u_int len, void *dest)
+{
+    struct dedup_private *const priv = s3b->data;
+    s3b_block_t slot;
+
+    // Sanity check
+    if (block_num >= priv->config->num_blocks)
+        return EINVAL;
+
+    // Find slot and read it
+    pthread_mutex_lock(&priv->mutex);
+    slot = DEDUP_SLOT(priv, block_num);
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+    return (*priv->inner->read_block_part)(priv->inner, slot, off, len, dest);
+}
+
+/*
+ * Read blocks, combining runs of blocks that live in consecutive slots into a single lower layer read.
+ */
+static int
+dedup_read_blocks(struct s3backer_store *s3b, s3b_block_t block_num, u_int num_blocks, void *dest)
+{
+    struct dedup_private *const priv = s3b->data;
+    struct dedup_conf *const config = priv->config;
+    s3b_block_t slot;
+    u_int run;
+    int r;
+
+    // Sanity check
+    if (block_num >= config->num_blocks || num_blocks > config->num_blocks - block_num)
+        return EINVAL;
+
+    // Read each run of consecutive slots
+    while (num_blocks > 0) {
+        pthread_mutex_lock(&priv->mutex);
+        slot = DEDUP_SLOT(priv, block_num);
+        for (run = 1; run < num_blocks && DEDUP_SLOT(priv, block_num + run) == slot + run; run++)
+            ;
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+        if ((r = read_block_range(priv->inner, config->block_size, slot, run, dest)) != 0)
+            return r;
+        block_num += run;
+        num_blocks -= run;
+        dest = (char *)dest + (size_t)run * config->block_size;
+    }
+    return 0;
+}
+
+static int
+dedup_write_blocks(struct s3backer_store *const s3b, s3b_block_t block_num, u_int num_blocks, const void *src,
+  u_char *etags, check_cancel_t *check_cancel, void *check_cancel_arg)
+{
+    struct dedup_private *const priv = s3b->data;
+    struct dedup_conf *const config = priv->config;
+
+    return parallel_write_blocks(s3b, config->block_size, config->io_threads, block_num, num_blocks, src, etags,
+      check_cancel, check_cancel_arg);
+}
+
+static int
+dedup_write_block(struct s3backer_store *const s3b, s3b_block_t block_num, const void *src, u_char *etag,
+  check_cancel_t *check_cancel, void *check_cancel_arg)
+{
+    struct dedup_private *const priv = s3b->data;
+    int r;
+
+    // Sanity check
+    if (block_num >= priv->config->num_blocks)
+        return EINVAL;
+
+    // Write block
+    dedup_begin_write(priv, block_num);
+    r = dedup_write_block2(priv, block_num, src, etag, check_cancel, check_cancel_arg);
+    dedup_end_write(priv, block_num);
+    return r;
+}
+
+/*
+ * Partial writes go straight down when the block is alone in its own slot; otherwise, we read-modify-write.
+ */
+static int
+dedup_write_block_part(struct s3backer_store *s3b, s3b_block_t block_num, u_int off, u_int len, const void *src)
+{
+    struct dedup_private *const priv = s3b->data;
+    struct dedup_conf *const config = priv->config;
+    s3b_block_t slot;
+    char *buf;
+    int r;
+
+    // Sanity check
+    if (block_num >= config->num_blocks || off > config->block_size || len > config->block_size - off)
+        return EINVAL;
+
+    // Lock out other writes to this block
+    dedup_begin_write(priv, block_num);
+
+    // Can we write directly into the block's own slot?
+    pthread_mutex_lock(&priv->mutex);
+    slot = DEDUP_SLOT(priv, block_num);
+    if (priv->inner->write_block_part != NULL && slot == block_num && dedup_slot_is_free(priv, block_num)) {
+        bitmap_set(priv->busy, block_num, 1);
+        priv->num_busy++;
+        priv->gens[block_num]++;
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+        r = (*priv->inner->write_block_part)(priv->inner, block_num, off, len, src);
+        pthread_mutex_lock(&priv->mutex);
+        bitmap_set(priv->busy, block_num, 0);
+        priv->num_busy--;
+        CHECK_RETURN(pthread_cond_broadcast(&priv->cond));
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+        goto done;
+    }
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+
+    // Read-modify-write
+    if ((buf = block_buf_alloc(config->block_size)) == NULL) {
+        r = errno;
+        pthread_mutex_lock(&priv->mutex);
+        priv->stats.out_of_memory_errors++;
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+        goto done;
+    }
+    if ((r = (*priv->inner->read_block)(priv->inner, slot, buf, NULL, NULL, 0)) == 0) {
+        memcpy(buf + off, src, len);
+        r = dedup_write_block2(priv, block_num, buf, NULL, NULL, NULL);
+    }
+    block_buf_free(buf);
+
+done:
+    dedup_end_write(priv, block_num);
+    return r;
+}
+
+/*
+ * Write a block. The caller must have invoked dedup_begin_write().
+ */
+static int
+dedup_write_block2(struct dedup_private *priv, s3b_block_t block_num, const void *src, u_char *etag,
+  check_cancel_t *check_cancel, void *check_cancel_arg)
+{
+    struct dedup_conf *const config = priv->config;
+    u_char digest[SHA256_DIGEST_LENGTH];
+    struct dedup_entry *entry;
+    s3b_block_t slot;
+    int r;
+
+    // Zero blocks are not deduplicated (the zero cache and the lower layers already handle them efficiently)
+    if (src != NULL && block_is_zeros(src))
+        src = NULL;
+    if (src != NULL)
+        sha256_quick(src, config->block_size, digest);
+
+    // Lock mutex
+    pthread_mutex_lock(&priv->mutex);
+    assert(priv->loaded);
+
+again:
+    // Look for identical content
+    if (src != NULL && (entry = dedup_table_find(priv, digest)) != NULL) {
+        if (entry->slot == DEDUP_SLOT(priv, block_num))
+            priv->stats.unchanged_writes++;
+        else {
+            dedup_set_map(priv, block_num, entry->slot);
+            priv->stats.dedup_writes++;
+        }
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+        if (etag != NULL)
+            md5_quick(src, config->block_size, etag);
+        return 0;
+    }
+
+    // Choose a slot to write: our own if we can, otherwise a free one; if neither, flush the index and retry
+    if (dedup_slot_is_free(priv, block_num))
+        slot = block_num;
+    else if ((slot = dedup_find_free(priv, block_num)) == DEDUP_IDENTITY) {
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+        if ((r = dedup_flush_index(priv, 0)) != 0)
+            return r;
+        pthread_mutex_lock(&priv->mutex);
+        if (!dedup_slot_is_free(priv, block_num) && dedup_find_free(priv, block_num) == DEDUP_IDENTITY) {
+
+            // Slots could be temporarily held by in-progress writes; if so, wait for one to finish
+            if (priv->num_busy == 0) {
+                CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+                (*config->log)(LOG_ERR, "dedup: no free slot for block %0*jx", S3B_BLOCK_NUM_DIGITS, (uintmax_t)block_num);
+                return ENOSPC;
+            }
+            CHECK_RETURN(pthread_cond_wait(&priv->cond, &priv->mutex));
+        }
+        goto again;
+    }
+
+    // Mark slot busy and invalidate any table entries for its previous content
+    bitmap_set(priv->busy, slot, 1);
+    priv->num_busy++;
+    priv->gens[slot]++;
+    if (slot != block_num)
+        priv->stats.relocated_writes++;
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+
+    // Write the data
+    r = (*priv->inner->write_block)(priv->inner, slot, src, etag, check_cancel, check_cancel_arg);
+
+    // Update state
+    pthread_mutex_lock(&priv->mutex);
+    bitmap_set(priv->busy, slot, 0);
+    priv->num_busy--;
+    if (r == 0) {
+        dedup_set_map(priv, block_num, slot);
+        if (src != NULL)
+            dedup_table_insert(priv, digest, slot);
+    }
+    CHECK_RETURN(pthread_cond_broadcast(&priv->cond));
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+    return r;
+}
+
+static int
+dedup_flush_blocks(struct s3backer_store *s3b, const s3b_block_t *block_nums, u_int num_blocks, long timeout)
+{
+    struct dedup_private *const priv = s3b->data;
+    struct dedup_conf *const config = priv->config;
+    s3b_block_t *slots;
+    u_int per_index;
+    u_int i;
+    int r;
+
+    // Flushing everything?
+    if (block_nums == NULL)
+        return dedup_flush_index(priv, timeout);
+
+    // If any of the blocks' mappings need to be persisted, we have to flush the index
+    per_index = config->block_size / DEDUP_ENTRY_SIZE;
+    pthread_mutex_lock(&priv->mutex);
+    for (i = 0; i < num_blocks; i++) {
+        if (block_nums[i] < config->num_blocks && bitmap_test(priv->dirty, block_nums[i] / per_index)) {
+            CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+            return dedup_flush_index(priv, timeout);
+        }
+    }
+
+    // Otherwise, just flush the corresponding slots
+    if ((slots = malloc(num_blocks * sizeof(*slots))) == NULL) {
+        r = errno;
+        priv->stats.out_of_memory_errors++;
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+        return r;
+    }
+    for (i = 0; i < num_blocks; i++)
+        slots[i] = block_nums[i] < config->num_blocks ? DEDUP_SLOT(priv, block_nums[i]) : block_nums[i];
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+    r = (*priv->inner->flush_blocks)(priv->inner, slots, num_blocks, timeout);
+    free(slots);
+    return r;
+}
+
+/*
+ * Prefetch the slots holding the blocks, one run of consecutive slots at a time.
+ */
+static int
+dedup_prefetch_blocks(struct s3backer_store *s3b, s3b_block_t block_num, u_int num_blocks)
+{
+    struct dedup_private *const priv = s3b->data;
+    struct dedup_conf *const config = priv->config;
+    s3b_block_t slot;
+    u_int run;
+    int r;
+
+    // Sanity check
+    if (block_num >= config->num_blocks || num_blocks > config->num_blocks - block_num)
+        return EINVAL;
+
+    // Prefetch each run of consecutive slots
+    while (num_blocks > 0) {
+        pthread_mutex_lock(&priv->mutex);
+        slot = DEDUP_SLOT(priv, block_num);
+        for (run = 1; run < num_blocks && DEDUP_SLOT(priv, block_num + run) == slot + run; run++)
+            ;
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+        if ((r = (*priv->inner->prefetch_blocks)(priv->inner, slot, run)) != 0)
+            return r;
+        block_num += run;
+        num_blocks -= run;
+    }
+    return 0;
+}
+
+/*
+ * Survey the lower layer for non-zero slots, then report every block living in one.
+ */
+static int
+dedup_survey_non_zero(struct s3backer_store *s3b, const struct survey_params *params)
+{
+    struct dedup_private *const priv = s3b->data;
+    struct dedup_conf *const config = priv->config;
+    struct survey_params inner_params;
+    struct dedup_survey survey;
+    struct block_list list;
+    s3b_block_t block_num;
+    int r;
+
+    // Survey slots
+    if ((survey.non_zero = bitmap_init(config->num_blocks, 0)) == NULL)
+        return errno;
+    survey.num_blocks = config->num_blocks;
+    memset(&inner_params, 0, sizeof(inner_params));
+    inner_params.callback = dedup_survey_callback;
+    inner_params.arg = &survey;
+    if ((r = (*priv->inner->survey_non_zero)(priv->inner, &inner_params)) != 0)
+        goto done;
+
+    // Map slots back to blocks
+    block_list_init(&list);
+    pthread_mutex_lock(&priv->mutex);
+    for (block_num = 0; block_num < config->num_blocks; block_num++) {
+        if (bitmap_test(survey.non_zero, DEDUP_SLOT(priv, block_num)) && (r = block_list_append(&list, block_num)) != 0)
+            break;
+    }
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+    if (r == 0 && list.num_blocks > 0)
+        r = (*params->callback)(params->arg, list.blocks, list.num_blocks);
+    block_list_free(&list);
+
+done:
+    bitmap_free(&survey.non_zero);
+    return r;
+}
+
+static int
+dedup_survey_callback(void *arg, const s3b_block_t *block_nums, u_int num_blocks)
+{
+    struct dedup_survey *const survey = arg;
+    u_int i;
+
+    for (i = 0; i < num_blocks; i++) {
+        if (block_nums[i] < survey->num_blocks)
+            bitmap_set(survey->non_zero, block_nums[i], 1);
+    }
+    return 0;
+}
+
+/*
+ * Load the index from the lower layer.
+ */
+static int
+dedup_load_index(struct dedup_private *priv)
+{
+    struct dedup_conf *const config = priv->config;
+    const u_int per_index = config->block_size / DEDUP_ENTRY_SIZE;
+    const u_char *entry;
+    s3b_block_t block_num;
+    s3b_block_t index;
+    s3b_block_t slot;
+    uint32_t value;
+    u_char *buf;
+    u_int i;
+    int r;
+
+    // Allocate buffer
+    if ((buf = block_buf_alloc(config->block_size)) == NULL) {
+        r = errno;
+        (*config->log)(LOG_ERR, "dedup: can't allocate index buffer: %s", strerror(r));
+        return r;
+    }
+
+    // Read and check the header block
+    if ((r = (*priv->inner->read_block)(priv->inner, DEDUP_HEADER_SLOT(config), buf, NULL, NULL, 0)) != 0) {
+        (*config->log)(LOG_ERR, "dedup: error reading header block %0*jx: %s",
+          S3B_BLOCK_NUM_DIGITS, (uintmax_t)DEDUP_HEADER_SLOT(config), strerror(r));
+        block_buf_free(buf);
+        return r;
+    }
+    if ((r = dedup_check_header(priv, buf)) != 0) {
+        block_buf_free(buf);
+        return r;
+    }
+
+    // Read index blocks
+    pthread_mutex_lock(&priv->mutex);
+    for (index = 0; index < priv->num_index; index++) {
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+        r = (*priv->inner->read_block)(priv->inner, DEDUP_INDEX_SLOT(config, index), buf, NULL, NULL, 0);
+        pthread_mutex_lock(&priv->mutex);
+        if (r != 0) {
+            (*config->log)(LOG_ERR, "dedup: error reading index block %0*jx: %s",
+              S3B_BLOCK_NUM_DIGITS, (uintmax_t)DEDUP_INDEX_SLOT(config, index), strerror(r));
+            goto done;
+        }
+        for (i = 0; i < per_index; i++) {
+            if ((block_num = index * per_index + i) >= config->num_blocks)
+                break;
+            entry = buf + i * DEDUP_ENTRY_SIZE;
+            value = dedup_decode32(entry);
+            if (value == 0 || (slot = value - 1) == block_num)
+                continue;
+            if (slot >= config->num_blocks) {
+                (*config->log)(LOG_ERR, "dedup: corrupt index entry for block %0*jx",
+                  S3B_BLOCK_NUM_DIGITS, (uintmax_t)block_num);
+                r = EINVAL;
+                goto done;
+            }
+            priv->map[block_num] = priv->pmap[block_num] = slot;
+            priv->refs[slot]++;
+            priv->prefs[slot]++;
+            priv->stats.shared_blocks++;
+        }
+    }
+    priv->loaded = 1;
+    r = 0;
+
+done:
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+    block_buf_free(buf);
+    return r;
+}
+
+/*
+ * Check the header block read from the lower layer.
+ *
+ * A block of zeros means the disk has never been used with dedup, so the index is all zeros too.
+ */
+static int
+dedup_check_header(struct dedup_private *priv, const u_char *buf)
+{
+    struct dedup_conf *const config = priv->config;
+    s3b_block_t num_blocks;
+    u_int block_size;
+
+    // Never used with dedup?
+    if (block_is_zeros(buf))
+        return 0;
+
+    // Check header
+    if (!dedup_parse_header(buf, &block_size, &num_blocks)) {
+        (*config->log)(LOG_ERR, "dedup: block %0*jx is not a dedup header block; was the disk created with a different"
+          " size, or is it too small to hold the dedup index?", S3B_BLOCK_NUM_DIGITS, (uintmax_t)DEDUP_HEADER_SLOT(config));
+        return EINVAL;
+    }
+    if (block_size != config->block_size || num_blocks != config->num_blocks) {
+        (*config->log)(LOG_ERR, "dedup: disk was created with %ju blocks of size %u, not %ju blocks of size %u",
+          (uintmax_t)num_blocks, block_size, (uintmax_t)config->num_blocks, config->block_size);
+        return EINVAL;
+    }
+    priv->have_header = 1;
+    return 0;
+}
+
+/*
+ * Parse a header block. Returns true if it is one.
+ */
+static int
+dedup_parse_header(const u_char *buf, u_int *block_sizep, s3b_block_t *num_blocksp)
+{
+    if (dedup_decode32(buf) != DEDUP_SIGNATURE)
+        return 0;
+    *block_sizep = dedup_decode32(buf + 4);
+    *num_blocksp = dedup_decode32(buf + 8);
+    return 1;
+}
+
+static uint32_t
+dedup_decode32(const u_char *buf)
+{
+    return (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) | ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+static void
+dedup_encode32(u_char *buf, uint32_t value)
+{
+    buf[0] = (u_char)value;
+    buf[1] = (u_char)(value >> 8);
+    buf[2] = (u_char)(value >> 16);
+    buf[3] = (u_char)(value >> 24);
+}
+
+/*
+ * Persist the changed parts of the index.
+ *
+ * Changes being written protect both the old and the new slots from reuse until the flush completes.
+ * If the flush fails, the index blocks may have been partially written, so the protections are kept
+ * in the "unconfirmed" list and the index blocks are marked dirty again. The retry recomputes and
+ * protects the same changes, so duplicates are dropped from the list; the next successful flush rewrites
+ * those index blocks and releases everything on the list.
+ */
+static int
+dedup_flush_index(struct dedup_private *priv, long timeout)
+{
+    struct dedup_conf *const config = priv->config;
+    const u_int per_index = config->block_size / DEDUP_ENTRY_SIZE;
+    struct dedup_change *changes = NULL;
+    s3b_block_t *index_nums = NULL;
+    u_char *bufs = NULL;
+    s3b_block_t num_changes = 0;
+    s3b_block_t num_flush = 0;
+    s3b_block_t block_num;
+    s3b_block_t index;
+    s3b_block_t n;
+    s3b_block_t slot;
+    u_char *entry;
+    u_int i;
+    int r;
+
+    // Wait for any other flush to complete
+    pthread_mutex_lock(&priv->mutex);
+    while (priv->flushing)
+        CHECK_RETURN(pthread_cond_wait(&priv->cond, &priv->mutex));
+
+    // Count dirty index blocks and changed entries
+    for (index = 0; index < priv->num_index; index++) {
+        if (!bitmap_test(priv->dirty, index))
+            continue;
+        num_flush++;
+        for (i = 0; i < per_index && (block_num = index * per_index + i) < config->num_blocks; i++) {
+            if (priv->map[block_num] != priv->pmap[block_num])
+                num_changes++;
+        }
+    }
+
+    // Allocate snapshot buffers
+    if (num_flush > 0
+      && ((index_nums = malloc(num_flush * sizeof(*index_nums))) == NULL
+       || (changes = malloc((num_changes > 0 ? num_changes : 1) * sizeof(*changes))) == NULL
+       || (bufs = malloc((size_t)num_flush * config->block_size)) == NULL)) {
+        r = errno;
+        priv->stats.out_of_memory_errors++;
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+        goto done;
+    }
+
+    // Snapshot dirty index blocks and mark the changes as pending
+    num_flush = 0;
+    num_changes = 0;
+    for (index = 0; index < priv->num_index; index++) {
+        if (!bitmap_test(priv->dirty, index))
+            continue;
+        bitmap_set(priv->dirty, index, 0);
+        memset(bufs + (size_t)num_flush * config->block_size, 0, config->block_size);
+        for (i = 0; i < per_index && (block_num = index * per_index + i) < config->num_blocks; i++) {
+            if ((slot = priv->map[block_num]) != DEDUP_IDENTITY) {
+                entry = bufs + (size_t)num_flush * config->block_size + i * DEDUP_ENTRY_SIZE;
+                dedup_encode32(entry, slot + 1);
+            }
+            if (slot == priv->pmap[block_num])
+                continue;
+            if (slot != DEDUP_IDENTITY)
+                priv->prefs[slot]++;
+            else
+                bitmap_set(priv->pending_identity, block_num, 1);
+            changes[num_changes].block_num = block_num;
+            changes[num_changes].slot = slot;
+            num_changes++;
+        }
+        index_nums[num_flush++] = DEDUP_INDEX_SLOT(config, index);
+    }
+    priv->flushing = 1;
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+
+    // Flush data in the lower layers, so the index never refers to data that isn't persisted yet
+    if ((r = (*priv->inner->flush_blocks)(priv->inner, NULL, 0, timeout)) != 0)
+        goto fail;
+    if (num_flush == 0)
+        goto finish;
+
+    // Write the header block before the first index blocks, so a mount with the wrong size can tell
+    if (!priv->have_header) {
+        const s3b_block_t header_slot = DEDUP_HEADER_SLOT(config);
+        u_char *header;
+
+        if ((header = block_buf_alloc(config->block_size)) == NULL) {
+            r = errno;
+            priv->stats.out_of_memory_errors++;
+            goto fail;
+        }
+        memset(header, 0, config->block_size);
+        dedup_encode32(header, DEDUP_SIGNATURE);
+        dedup_encode32(header + 4, config->block_size);
+        dedup_encode32(header + 8, config->num_blocks);
+        if ((r = (*priv->inner->write_block)(priv->inner, header_slot, header, NULL, NULL, NULL)) == 0)
+            r = (*priv->inner->flush_blocks)(priv->inner, &header_slot, 1, timeout);
+        block_buf_free(header);
+        if (r != 0) {
+            (*config->log)(LOG_ERR, "dedup: error writing header block %0*jx: %s",
+              S3B_BLOCK_NUM_DIGITS, (uintmax_t)header_slot, strerror(r));
+            goto fail;
+        }
+        priv->have_header = 1;
+    }
+
+    // Write and flush index blocks
+    for (i = 0; i < num_flush; i++) {
+        const u_char *const buf = bufs + (size_t)i * config->block_size;
+
+        if ((r = (*priv->inner->write_block)(priv->inner, index_nums[i],
+          block_is_zeros(buf) ? NULL : buf, NULL, NULL, NULL)) != 0) {
+            (*config->log)(LOG_ERR, "dedup: error writing index block %0*jx: %s",
+              S3B_BLOCK_NUM_DIGITS, (uintmax_t)index_nums[i], strerror(r));
+            goto fail;
+        }
+    }
+    if ((r = (*priv->inner->flush_blocks)(priv->inner, index_nums, num_flush, timeout)) != 0)
+        goto fail;
+
+finish:
+    // Release protections left over from failed flushes; the index blocks they were in have now been rewritten
+    pthread_mutex_lock(&priv->mutex);
+    for (n = 0; n < priv->num_unconfirmed; n++) {
+        const struct dedup_change *const change = &priv->unconfirmed[n];
+
+        if (change->slot != DEDUP_IDENTITY) {
+            assert(priv->prefs[change->slot] > 0);
+            priv->prefs[change->slot]--;
+        } else
+            bitmap_set(priv->pending_identity, change->block_num, 0);
+    }
+    free(priv->unconfirmed);
+    priv->unconfirmed = NULL;
+    priv->num_unconfirmed = 0;
+
+    // Commit changes
+    for (i = 0; i < num_changes; i++) {
+        block_num = changes[i].block_num;
+        if ((slot = priv->pmap[block_num]) != DEDUP_IDENTITY) {
+            assert(priv->prefs[slot] > 0);
+            priv->prefs[slot]--;
+        }
+        priv->pmap[block_num] = changes[i].slot;
+        bitmap_set(priv->pending_identity, block_num, 0);
+    }
+    priv->stats.index_flushes++;
+    priv->stats.index_blocks_written += num_flush;
+    goto unlock;
+
+fail:
+    // Keep changes protected and try again next time
+    pthread_mutex_lock(&priv->mutex);
+    dedup_add_unconfirmed(priv, changes, num_changes);
+    for (i = 0; i < num_flush; i++)
+        bitmap_set(priv->dirty, index_nums[i] - DEDUP_INDEX_SLOT(config, 0), 1);
+
+unlock:
+    priv->flushing = 0;
+    CHECK_RETURN(pthread_cond_broadcast(&priv->cond));
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+
+done:
+    free(bufs);
+    free(changes);
+    free(index_nums);
+    return r;
+}
+
+/*
+ * Merge the changes from a failed flush into the "unconfirmed" list, which is sorted by block number and then slot.
+ * A change already on the list is already protected, so the protection just added for it is undone. Mutex must be held.
+ */
+static void
+dedup_add_unconfirmed(struct dedup_private *priv, const struct dedup_change *changes, s3b_block_t num_changes)
+{
+    struct dedup_change *merged;
+    s3b_block_t i;
+    s3b_block_t j;
+    s3b_block_t k;
+    int diff;
+
+    // Anything to do?
+    if (num_changes == 0)
+        return;
+
+    // Allocate merged list; if we can't, the new protections just stay in place forever, which is safe
+    if ((merged = malloc((priv->num_unconfirmed + num_changes) * sizeof(*merged))) == NULL) {
+        (*priv->config->log)(LOG_ERR, "dedup: malloc(): %s", strerror(errno));
+        priv->stats.out_of_memory_errors++;
+        return;
+    }
+
+    // Merge, dropping duplicates; "changes" is sorted by block number with at most one change per block
+    for (i = j = k = 0; i < priv->num_unconfirmed || j < num_changes; ) {
+        if (i == priv->num_unconfirmed)
+            diff = 1;
+        else if (j == num_changes)
+            diff = -1;
+        else
+            diff = dedup_change_cmp(&priv->unconfirmed[i], &changes[j]);
+        if (diff > 0) {
+            merged[k++] = changes[j++];
+            continue;
+        }
+        if (diff == 0) {
+            if (changes[j].slot != DEDUP_IDENTITY) {
+                assert(priv->prefs[changes[j].slot] > 1);
+                priv->prefs[changes[j].slot]--;
+            }
+            j++;
+        }
+        merged[k++] = priv->unconfirmed[i++];
+    }
+    free(priv->unconfirmed);
+    priv->unconfirmed = merged;
+    priv->num_unconfirmed = k;
+}
+
+static int
+dedup_change_cmp(const struct dedup_change *change1, const struct dedup_change *change2)
+{
+    if (change1->block_num != change2->block_num)
+        return change1->block_num < change2->block_num ? -1 : 1;
+    if (change1->slot != change2->slot)
+        return change1->slot < change2->slot ? -1 : 1;
+    return 0;
+}
+
+/*
+ * Wait for any other write of the block to complete, then claim it.
+ */
+static void
+dedup_begin_write(struct dedup_private *priv, s3b_block_t block_num)
+{
+    pthread_mutex_lock(&priv->mutex);
+    while (bitmap_test(priv->writing, block_num))
+        CHECK_RETURN(pthread_cond_wait(&priv->cond, &priv->mutex));
+    bitmap_set(priv->writing, block_num, 1);
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+}
+
+static void
+dedup_end_write(struct dedup_private *priv, s3b_block_t block_num)
+{
+    pthread_mutex_lock(&priv->mutex);
+    bitmap_set(priv->writing, block_num, 0);
+    CHECK_RETURN(pthread_cond_broadcast(&priv->cond));
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+}
+
+/*
+ * Point a block at a slot and mark its index block dirty. Mutex must be held.
+ */
+static void
+dedup_set_map(struct dedup_private *priv, s3b_block_t block_num, s3b_block_t slot)
+{
+    const s3b_block_t old_slot = DEDUP_SLOT(priv, block_num);
+
+    // Anything to do?
+    if (slot == old_slot)
+        return;
+
+    // Release the old slot
+    if (old_slot != block_num) {
+        assert(priv->refs[old_slot] > 0);
+        priv->refs[old_slot]--;
+        priv->stats.shared_blocks--;
+    }
+
+    // Reference the new slot
+    if (slot != block_num) {
+        priv->map[block_num] = slot;
+        priv->refs[slot]++;
+        priv->stats.shared_blocks++;
+    } else
+        priv->map[block_num] = DEDUP_IDENTITY;
+
+    // Mark index block dirty
+    bitmap_set(priv->dirty, block_num / (priv->config->block_size / DEDUP_ENTRY_SIZE), 1);
+}
+
+/*
+ * Determine whether no other block uses the given slot, either currently or as persisted. Mutex must be held.
+ */
+static int
+dedup_slot_is_free(struct dedup_private *priv, s3b_block_t slot)
+{
+    return priv->refs[slot] == 0 && priv->prefs[slot] == 0 && !bitmap_test(priv->busy, slot);
+}
+
+/*
+ * Find a slot not used by any block, including its own, currently or as persisted. Mutex must be held.
+ *
+ * Returns DEDUP_IDENTITY if there is none.
+ */
+static s3b_block_t
+dedup_find_free(struct dedup_private *priv, s3b_block_t block_num)
+{
+    const s3b_block_t num_blocks = priv->config->num_blocks;
+    s3b_block_t slot;
+    s3b_block_t i;
+
+    for (i = 0; i < num_blocks; i++) {
+        slot = (priv->free_cursor + i) % num_blocks;
+        if (slot == block_num
+          || priv->map[slot] == DEDUP_IDENTITY
+          || priv->pmap[slot] == DEDUP_IDENTITY
+          || bitmap_test(priv->pending_identity, slot)
+          || !dedup_slot_is_free(priv, slot))
+            continue;
+        priv->free_cursor = (slot + 1) % num_blocks;
+        return slot;
+    }
+    return DEDUP_IDENTITY;
+}
+
+/*
+ * Find a valid content table entry matching the digest. Mutex must be held.
+ */
+static struct dedup_entry *
+dedup_table_find(struct dedup_private *priv, const u_char *digest)
+{
+    struct dedup_entry *entry;
+    uint32_t hash;
+    u_int i;
+
+    memcpy(&hash, digest, sizeof(hash));
+    for (i = 0; i < DEDUP_TABLE_PROBES; i++) {
+        entry = &priv->table[(hash + i) & priv->table_mask];
+        if (entry->valid
+          && entry->gen == priv->gens[entry->slot]
+          && memcmp(entry->digest, digest, sizeof(entry->digest)) == 0)
+            return entry;
+    }
+    return NULL;
+}
+
+/*
+ * Record that a slot contains the content with the given digest. Mutex must be held.
+ *
+ * Prefers an unused or stale entry; if there is none, the first entry probed is replaced.
+ */
+static void
+dedup_table_insert(struct dedup_private *priv, const u_char *digest, s3b_block_t slot)
+{
+    struct dedup_entry *entry = NULL;
+    struct dedup_entry *probe;
+    uint32_t hash;
+    u_int i;
+
+    memcpy(&hash, digest, sizeof(hash));
+    for (i = 0; i < DEDUP_TABLE_PROBES; i++) {
+        probe = &priv->table[(hash + i) & priv->table_mask];
+        if (!probe->valid || probe->gen != priv->gens[probe->slot]) {
+            entry = probe;
+            break;
+        }
+    }
+    if (entry == NULL)
+        entry = &priv->table[hash & priv->table_mask];
+    if (!entry->valid) {
+        entry->valid = 1;
+        priv->stats.table_entries++;
+    }
+    memcpy(entry->digest, digest, sizeof(entry->digest));
+    entry->slot = slot;
+    entry->gen = priv->gens[slot];
+}
@@ -106,12 +106,25 @@
  * is simply so we can quickly find the structure associated with a specific block.
  *
  * The linked list contains WRITTEN blocks, and is sorted in increasing order by timestamp,
- * so the entries that will expire first are at the front of the list.
+ * so the entries that will expire first are at the front of the list. Because every entry
+ * lives for the same cache_time, appending at the tail keeps the list sorted, so expiring
+ * entries costs O(1) each and there is no need for a more general timer structure.
+ *
+ * Threads that want to write a block that is WRITING wait on their own condition variable,
+ * linked into the block's list of waiters, and are woken as soon as that write completes;
+ * writes of other blocks don't wake them.
  */
+struct block_waiter {
+    pthread_cond_t              cond;           // signaled when the block's write completes
+    int                         done;           // the block's write has completed
+    LIST_ENTRY(block_waiter)    link;           // entry in block's list of waiters
+};
+
 struct block_info {
     s3b_block_t             block_num;          // block number - MUST BE FIRST
     uint64_t                timestamp;          // time PUT/DELETE completed (if WRITTEN)
     TAILQ_ENTRY(block_info) link;               // list entry link
+    LIST_HEAD(, block_waiter) waiters;          // threads waiting for the write to complete (if WRITING)
     union {
         const void      *data;                  // block's actual content (if WRITING)
         u_char          etag[MD5_DIGEST_LENGTH];// block's ETag (if WRITTEN)
@@ -142,15 +155,26 @@ static int ec_protect_read_block(struct s3backer_store *s3b, s3b_block_t block_n
   u_char *actual_etag, const u_char *expect_etag, int strict);
 static int ec_protect_write_block(struct s3backer_store *s3b, s3b_block_t block_num, const void *src, u_char *etag,
   check_cancel_t *check_cancel, void *check_cancel_arg);
+static int ec_protect_read_blocks(struct s3backer_store *s3b, s3b_block_t block_num, u_int num_blocks, void *dest);
+static int ec_protect_read_block_part(struct s3backer_store *s3b, s3b_block_t block_num, u_int off, u_int len, void *dest);
+static int ec_protect_read_block_encoded(struct s3backer_store *s3b, s3b_block_t block_num, void *dest, int *encodedp,
+  u_char *actual_etag, const u_char *expect_etag, int strict);
+static int ec_protect_decode_block(struct s3backer_store *s3b, s3b_block_t block_num, const void *src, void *dest);
+static int ec_protect_write_blocks(struct s3backer_store *s3b, s3b_block_t block_num, u_int num_blocks, const void *src,
+    u_char *etags, check_cancel_t *check_cancel, void *check_cancel_arg);
 static int ec_protect_flush_blocks(struct s3backer_store *s3b, const s3b_block_t *block_nums, u_int num_blocks, long timeout);
 static int ec_protect_shutdown(struct s3backer_store *s3b);
 static void ec_protect_destroy(struct s3backer_store *s3b);
 
 // Misc
+static int ec_protect_read_block2(struct s3backer_store *s3b, s3b_block_t block_num, void *dest, int *encodedp,
+  u_char *actual_etag, const u_char *expect_etag, int strict);
 static uint64_t ec_protect_sleep_until(struct ec_protect_private *priv, pthread_cond_t *cond, uint64_t wake_time_millis);
 static void ec_protect_scrub_expired_writtens(struct ec_protect_private *priv, uint64_t current_time);
+static int ec_protect_wait_for_write(struct ec_protect_private *priv, struct block_info *binfo, uint64_t *delayp);
+static void ec_protect_wake_waiters(struct block_info *binfo);
 static uint64_t ec_protect_get_time(void);
-static int ec_protect_survey_non_zero(struct s3backer_store *s3b, block_list_func_t *callback, void *arg);
+static int ec_protect_survey_non_zero(struct s3backer_store *s3b, const struct survey_params *params);
 static s3b_hash_visit_t ec_protect_append_block_list;
 static s3b_hash_visit_t ec_protect_free_one;
 
@@ -193,6 +217,14 @@ ec_protect_create(struct ec_protect_conf *config, struct s3backer_store *inner)
     s3b->set_mount_token = ec_protect_set_mount_token;
     s3b->read_block = ec_protect_read_block;
     s3b->write_block = ec_protect_write_block;
+    s3b->read_blocks = ec_protect_read_blocks;
+    s3b->write_blocks = ec_protect_write_blocks;
+    if (inner->read_block_part != NULL)
+        s3b->read_block_part = ec_protect_read_block_part;
+    if (inner->read_block_encoded != NULL) {
+        s3b->read_block_encoded = ec_protect_read_block_encoded;
+        s3b->decode_block = ec_protect_decode_block;
+    }
     s3b->bulk_zero = generic_bulk_zero;
     s3b->flush_blocks = ec_protect_flush_blocks;
     s3b->survey_non_zero = ec_protect_survey_non_zero;
@@ -214,7 +246,7 @@ ec_protect_create(struct ec_protect_conf *config, struct s3backer_store *inner)
     if ((r = pthread_cond_init(&priv->never_cond, NULL)) != 0)
         goto fail5;
     TAILQ_INIT(&priv->list);
-    if ((r = s3b_hash_create(&priv->hashtable, config->cache_size)) != 0)
+    if ((r = s3b_hash_create_concurrent(&priv->hashtable, config->cache_size)) != 0)
         goto fail6;
     s3b->data = priv;
     memset(unknown_etag, 0xff, sizeof(unknown_etag));
@@ -340,7 +372,7 @@ ec_protect_clear_stats(struct s3backer_store *s3b)
 }
 
 static int
-ec_protect_survey_non_zero(struct s3backer_store *s3b, block_list_func_t *callback, void *arg)
+ec_protect_survey_non_zero(struct s3backer_store *s3b, const struct survey_params *params)
 {
     struct ec_protect_private *const priv = s3b->data;
     struct block_list list;
@@ -351,8 +383,8 @@ ec_protect_survey_non_zero(struct s3backer_store *s3b, block_list_func_t *callba
     assert(priv->survey_callback == NULL);
 
     // Record survey in progress
-    priv->survey_callback = callback;
-    priv->survey_arg = arg;
+    priv->survey_callback = params->callback;
+    priv->survey_arg = params->arg;
 
     // Inventory all blocks currently in the cache; we don't bother trying to discern the zero blocks
     block_list_init(&list);
@@ -363,11 +395,11 @@ ec_protect_survey_non_zero(struct s3backer_store *s3b, block_list_func_t *callba
     CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
 
     // Report all blocks inventoried above
-    (*callback)(arg, list.blocks, list.num_blocks);
+    (*params->callback)(params->arg, list.blocks, list.num_blocks);
     block_list_free(&list);
 
     // Invoke lower layer
-    r = (*priv->inner->survey_non_zero)(priv->inner, callback, arg);
+    r = (*priv->inner->survey_non_zero)(priv->inner, params);
 
     // Lock mutex
     pthread_mutex_lock(&priv->mutex);
@@ -395,6 +427,31 @@ ec_protect_append_block_list(void *arg, void *value)
 static int
 ec_protect_read_block(struct s3backer_store *const s3b, s3b_block_t block_num, void *dest,
   u_char *actual_etag, const u_char *expect_etag, int strict)
+{
+    return ec_protect_read_block2(s3b, block_num, dest, NULL, actual_etag, expect_etag, strict);
+}
+
+static int
+ec_protect_read_block_encoded(struct s3backer_store *const s3b, s3b_block_t block_num, void *dest, int *encodedp,
+  u_char *actual_etag, const u_char *expect_etag, int strict)
+{
+    return ec_protect_read_block2(s3b, block_num, dest, encodedp, actual_etag, expect_etag, strict);
+}
+
+static int
+ec_protect_decode_block(struct s3backer_store *const s3b, s3b_block_t block_num, const void *src, void *dest)
+{
+    struct ec_protect_private *const priv = s3b->data;
+
+    return (*priv->inner->decode_block)(priv->inner, block_num, src, dest);
+}
+
+/*
+ * Read a block, returning it encoded if encodedp != NULL and the inner store can (see read_block_encoded()).
+ */
+static int
+ec_protect_read_block2(struct s3backer_store *const s3b, s3b_block_t block_num, void *dest, int *encodedp,
+  u_char *actual_etag, const u_char *expect_etag, int strict)
 {
     struct ec_protect_private *const priv = s3b->data;
     struct ec_protect_conf *const config = priv->config;
@@ -405,6 +462,14 @@ ec_protect_read_block(struct s3backer_store *const s3b, s3b_block_t block_num, v
     if (config->block_size == 0)
         return EINVAL;
 
+    // Data we have here is never encoded
+    if (encodedp != NULL)
+        *encodedp = 0;
+
+    // If the block hasn't been written recently, there's nothing for us to do, so don't bother with the lock
+    if (!s3b_hash_contains_concurrent(priv->hashtable, block_num))
+        goto read;
+
     // Grab lock and sanity check
     pthread_mutex_lock(&priv->mutex);
     EC_PROTECT_CHECK_INVARIANTS(priv);
@@ -468,7 +533,10 @@ again:
     // Release lock
     CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
 
+read:
     // Read block normally
+    if (encodedp != NULL)
+        return (*priv->inner->read_block_encoded)(priv->inner, block_num, dest, encodedp, actual_etag, expect_etag, strict);
     return (*priv->inner->read_block)(priv->inner, block_num, dest, actual_etag, expect_etag, strict);
 }
 
@@ -522,6 +590,7 @@ again:
             else
                 delay = ec_protect_sleep_until(priv, &priv->space_cond, 0);         // sleep indefinitely...
             priv->stats.cache_full_delay += delay;
+            latency_record(&priv->stats.write_delays, delay / 1000.0);
             goto again;
         }
 
@@ -535,6 +604,7 @@ again:
         }
         binfo->block_num = block_num;
         binfo->u.data = src;
+        LIST_INIT(&binfo->waiters);
         s3b_hash_put_new(priv->hashtable, binfo);
 
 writeit:
@@ -561,6 +631,9 @@ writeit:
         binfo->timestamp = ec_protect_get_time();
         memcpy(binfo->u.etag, r == 0 ? etag : unknown_etag, MD5_DIGEST_LENGTH);
         TAILQ_INSERT_TAIL(&priv->list, binfo, link);
+
+        // Wake up any threads waiting to write this same block
+        ec_protect_wake_waiters(binfo);
         CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
 
         // Copy expected ETag for caller
@@ -571,13 +644,15 @@ writeit:
 
     /*
      * WRITING case: wait until current write completes (hmm, why is kernel doing overlapping writes?).
-     * Since we know after current write completes we'll have to wait another 'min_write_time' milliseconds
-     * anyway, we conservatively just wait exactly that long now. There may be an extra wakeup or two,
-     * but that's OK.
+     * After that, we'll be in the WRITTEN case and wait out the remaining 'min_write_time' milliseconds.
      */
     if (binfo->timestamp == 0) {
-        delay = ec_protect_sleep_until(priv, NULL, current_time + config->min_write_delay);
+        if ((r = ec_protect_wait_for_write(priv, binfo, &delay)) != 0) {
+            CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+            return r;
+        }
         priv->stats.repeated_write_delay += delay;
+        latency_record(&priv->stats.write_delays, delay / 1000.0);
         goto again;
     }
 
@@ -587,6 +662,7 @@ writeit:
     if (current_time < binfo->timestamp + config->min_write_delay) {
         delay = ec_protect_sleep_until(priv, NULL, binfo->timestamp + config->min_write_delay);
         priv->stats.repeated_write_delay += delay;
+        latency_record(&priv->stats.write_delays, delay / 1000.0);
         goto again;
     }
 
@@ -599,6 +675,180 @@ writeit:
     goto writeit;
 }
 
+/*
+ * Multi-block reads of ranges containing no recently written blocks need no protection, so they are
+ * passed straight through to the underlying store. Otherwise, the blocks are read in parallel one block
+ * at a time, so that each individual block gets the normal protection provided by ec_protect_read_block().
+ */
+static int
+ec_protect_read_blocks(struct s3backer_store *const s3b, s3b_block_t block_num, u_int num_blocks, void *dest)
+{
+    struct ec_protect_private *const priv = s3b->data;
+    struct ec_protect_conf *const config = priv->config;
+    int recent = 0;
+    u_int i;
+
+    // See if we have recently written any of these blocks
+    if (priv->inner->read_blocks != NULL) {
+        pthread_mutex_lock(&priv->mutex);
+        EC_PROTECT_CHECK_INVARIANTS(priv);
+        ec_protect_scrub_expired_writtens(priv, ec_protect_get_time());
+        for (i = 0; i < num_blocks && !recent; i++)
+            recent = s3b_hash_get(priv->hashtable, block_num + i) != NULL;
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+        if (!recent)
+            return (*priv->inner->read_blocks)(priv->inner, block_num, num_blocks, dest);
+    }
+
+    // Read the blocks one at a time
+    return parallel_read_blocks(s3b, config->block_size, config->io_threads, block_num, num_blocks, dest);
+}
+
+/*
+ * Read part of a block. Blocks we have recently written need the full protection of ec_protect_read_block(),
+ * which can only check whole blocks; any other block can be read directly from the underlying store.
+ */
+static int
+ec_protect_read_block_part(struct s3backer_store *const s3b, s3b_block_t block_num, u_int off, u_int len, void *dest)
+{
+    struct ec_protect_private *const priv = s3b->data;
+    struct ec_protect_conf *const config = priv->config;
+    int recent;
+    void *buf;
+    int r;
+
+    // See if we have recently written this block
+    pthread_mutex_lock(&priv->mutex);
+    EC_PROTECT_CHECK_INVARIANTS(priv);
+    ec_protect_scrub_expired_writtens(priv, ec_protect_get_time());
+    recent = s3b_hash_get(priv->hashtable, block_num) != NULL;
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+
+    // If not, read the part normally
+    if (!recent)
+        return (*priv->inner->read_block_part)(priv->inner, block_num, off, len, dest);
+
+    // Read the whole block and extract the part
+    if ((buf = block_buf_alloc(config->block_size)) == NULL)
+        return errno;
+    if ((r = ec_protect_read_block(s3b, block_num, buf, NULL, NULL, 0)) == 0)
+        memcpy(dest, (char *)buf + off, len);
+    block_buf_free(buf);
+    return r;
+}
+
+/*
+ * Multi-block writes of ranges in which no block is being or was recently written, and for which there is room
+ * in the cache, are passed through to the underlying store as a whole, with every block going through the WRITING
+ * and WRITTEN states together, just as in ec_protect_write_block(). Otherwise, the blocks are written in parallel
+ * one block at a time, so that each individual block gets the normal protection provided by ec_protect_write_block().
+ */
+static int
+ec_protect_write_blocks(struct s3backer_store *const s3b, s3b_block_t block_num, u_int num_blocks, const void *src,
+  u_char *etags, check_cancel_t *check_cancel, void *check_cancel_arg)
+{
+    struct ec_protect_private *const priv = s3b->data;
+    struct ec_protect_conf *const config = priv->config;
+    struct block_info **binfos = NULL;
+    u_char *block_etags = NULL;
+    struct block_info *binfo;
+    uint64_t timestamp;
+    u_int num_binfos = 0;
+    u_int i;
+    int r;
+
+    // Sanity check
+    if (config->block_size == 0)
+        return EINVAL;
+    if (num_blocks == 0)
+        return 0;
+
+    // Allocate info structures and ETag buffer up front; if we can't, just do it the slow way
+    if (priv->inner->write_blocks == NULL || (binfos = malloc(num_blocks * sizeof(*binfos))) == NULL)
+        goto one_at_a_time;
+    for (num_binfos = 0; num_binfos < num_blocks; num_binfos++) {
+        if ((binfos[num_binfos] = calloc(1, sizeof(**binfos))) == NULL)
+            goto one_at_a_time;
+    }
+    if (etags == NULL && (block_etags = malloc((size_t)num_blocks * MD5_DIGEST_LENGTH)) == NULL)
+        goto one_at_a_time;
+
+    // Grab lock and sanity check
+    pthread_mutex_lock(&priv->mutex);
+    EC_PROTECT_CHECK_INVARIANTS(priv);
+
+    // Scrub the list of WRITTENs
+    ec_protect_scrub_expired_writtens(priv, ec_protect_get_time());
+
+    // All of the blocks must be CLEAN and there must be room for all of them
+    if (s3b_hash_size(priv->hashtable) + num_blocks > config->cache_size) {
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+        goto one_at_a_time;
+    }
+    for (i = 0; i < num_blocks; i++) {
+        if (s3b_hash_get(priv->hashtable, block_num + i) != NULL) {
+            CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+            goto one_at_a_time;
+        }
+    }
+
+    // Conservatively disqualify any non-zero block as being zero in any ongoing non-zero survey
+    if (src != NULL && priv->survey_callback != NULL) {
+        for (i = 0; i < num_blocks; i++) {
+            const s3b_block_t survey_block = block_num + i;
+
+            (*priv->survey_callback)(priv->survey_arg, &survey_block, 1);
+        }
+    }
+
+    // Create new entries in WRITING state
+    for (i = 0; i < num_blocks; i++) {
+        binfo = binfos[i];
+        binfo->block_num = block_num + i;
+        binfo->u.data = src != NULL ? (const char *)src + (size_t)i * config->block_size : NULL;
+        LIST_INIT(&binfo->waiters);
+        s3b_hash_put_new(priv->hashtable, binfo);
+    }
+
+    // Write the blocks
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+    if (etags != NULL)
+        block_etags = etags;
+    r = (*priv->inner->write_blocks)(priv->inner, block_num, num_blocks, src, block_etags, check_cancel, check_cancel_arg);
+    pthread_mutex_lock(&priv->mutex);
+    EC_PROTECT_CHECK_INVARIANTS(priv);
+
+    // Wake up any thread sleeping indefinitely for space (see ec_protect_write_block())
+    pthread_cond_signal(&priv->space_cond);
+
+    // Move all of the blocks to state WRITTEN; if there was an error, we don't know which ones succeeded
+    timestamp = ec_protect_get_time();
+    for (i = 0; i < num_blocks; i++) {
+        binfo = binfos[i];
+        binfo->timestamp = timestamp;
+        memcpy(binfo->u.etag, r == 0 ? block_etags + (size_t)i * MD5_DIGEST_LENGTH : unknown_etag, MD5_DIGEST_LENGTH);
+        TAILQ_INSERT_TAIL(&priv->list, binfo, link);
+        ec_protect_wake_waiters(binfo);
+    }
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+
+    // Done
+    if (block_etags != etags)
+        free(block_etags);
+    free(binfos);
+    return r;
+
+one_at_a_time:
+    if (binfos != NULL) {
+        while (num_binfos > 0)
+            free(binfos[--num_binfos]);
+        free(binfos);
+    }
+    free(block_etags);
+    return parallel_write_blocks(s3b, config->block_size, config->io_threads, block_num, num_blocks, src, etags,
+      check_cancel, check_cancel_arg);
+}
+
 /*
  * Return current time in milliseconds.
  */
@@ -679,6 +929,57 @@ ec_protect_sleep_until(struct ec_protect_private *priv, pthread_cond_t *cond, ui
     return time_after - time_before;
 }
 
+/*
+ * Wait for the current write of a WRITING block to complete.
+ * Returns zero on success, otherwise an error code.
+ *
+ * This assumes the mutex is locked.
+ */
+static int
+ec_protect_wait_for_write(struct ec_protect_private *priv, struct block_info *binfo, uint64_t *delayp)
+{
+    struct ec_protect_conf *const config = priv->config;
+    struct block_waiter waiter;
+    int r;
+
+    // Sanity check
+    assert(binfo->timestamp == 0);
+
+    // Initialize waiter
+    memset(&waiter, 0, sizeof(waiter));
+    if ((r = pthread_cond_init(&waiter.cond, NULL)) != 0) {
+        (*config->log)(LOG_ERR, "pthread_cond_init: %s", strerror(r));
+        return r;
+    }
+
+    // Wait for the writing thread to wake us up (note "binfo" can't go away while in the WRITING state)
+    *delayp = 0;
+    LIST_INSERT_HEAD(&binfo->waiters, &waiter, link);
+    while (!waiter.done)
+        *delayp += ec_protect_sleep_until(priv, &waiter.cond, 0);
+
+    // Done
+    pthread_cond_destroy(&waiter.cond);
+    return 0;
+}
+
+/*
+ * Wake up all threads waiting for the write of a block to complete.
+ *
+ * This assumes the mutex is locked.
+ */
+static void
+ec_protect_wake_waiters(struct block_info *binfo)
+{
+    struct block_waiter *waiter;
+
+    while ((waiter = LIST_FIRST(&binfo->waiters)) != NULL) {
+        LIST_REMOVE(waiter, link);
+        waiter->done = 1;
+        pthread_cond_signal(&waiter->cond);
+    }
+}
+
 static int
 ec_protect_free_one(void *arg, void *value)
 {
@@ -703,8 +1004,10 @@ ec_protect_check_one(void *arg, void *value)
 
     if (binfo->timestamp == 0)
         info->writing++;
-    else
+    else {
+        assert(LIST_EMPTY(&binfo->waiters));
         info->written++;
+    }
     return 0;
 }
 
@@ -40,16 +40,18 @@ struct ec_protect_conf {
     u_int               min_write_delay;
     u_int               cache_time;
     u_int               cache_size;
+    u_int               io_threads;
     log_func_t          *log;
 };
 
 // Statistics structure for ec_protect store
 struct ec_protect_stats {
     u_int               current_cache_size;
-    u_int               cache_data_hits;
+    uint64_t            cache_data_hits;
     uint64_t            cache_full_delay;
     uint64_t            repeated_write_delay;
-    u_int               out_of_memory_errors;
+    uint64_t            out_of_memory_errors;
+    struct latency_hist write_delays;               // individual cache full and repeated write delays
 };
 
 // ec_protect.c
@@ -37,10 +37,12 @@
 #include "s3backer.h"
 #include "block_cache.h"
 #include "ec_protect.h"
+#include "dedup.h"
 #include "zero_cache.h"
 #include "fuse_ops.h"
 #include "http_io.h"
 #include "test_io.h"
+#include "localfs_io.h"
 #include "s3b_config.h"
 #include "erase.h"
 #include "util.h"
@@ -48,6 +50,7 @@
 #define BLOCKS_PER_DOT          0x100
 #define MAX_QUEUE_LENGTH        100000
 #define NUM_ERASURE_THREADS     25
+#define ERASE_BATCH_SIZE        1000
 
 // Erasure state
 struct erase_state {
@@ -74,6 +77,7 @@ s3backer_erase(struct s3b_config *config)
 {
     struct erase_state state;
     struct erase_state *const priv = &state;
+    struct survey_params survey;
     char response[10];
     int num_threads;
     int ok = 0;
@@ -130,13 +134,22 @@ s3backer_erase(struct s3b_config *config)
     }
 
     // Create temporary lower layer
-    if ((priv->s3b = config->test ? test_io_create(&config->test_io) : http_io_create(&config->http_io)) == NULL) {
-        warnx(config->test ? "test_io_create" : "http_io_create");
+    if (config->test)
+        priv->s3b = test_io_create(&config->test_io);
+    else if (config->localfs)
+        priv->s3b = localfs_io_create(&config->localfs_io);
+    else
+        priv->s3b = http_io_create(&config->http_io);
+    if (priv->s3b == NULL) {
+        warnx(config->test ? "test_io_create" : config->localfs ? "localfs_io_create" : "http_io_create");
         goto fail5;
     }
 
     // Iterate over non-zero blocks
-    if ((r = (*priv->s3b->survey_non_zero)(priv->s3b, erase_list_callback, priv)) != 0) {
+    memset(&survey, 0, sizeof(survey));
+    survey.callback = erase_list_callback;
+    survey.arg = priv;
+    if ((r = (*priv->s3b->survey_non_zero)(priv->s3b, &survey)) != 0) {
         warnx("can't list blocks: %s", strerror(r));
         goto fail5;
     }
@@ -212,7 +225,9 @@ static void *
 erase_thread_main(void *arg)
 {
     struct erase_state *const priv = arg;
-    s3b_block_t block_num;
+    s3b_block_t batch[ERASE_BATCH_SIZE];
+    uintmax_t old_count;
+    u_int count;
     int r;
 
     // Acquire lock
@@ -224,27 +239,35 @@ erase_thread_main(void *arg)
         // Is there a block to erase?
         if (priv->qlen > 0) {
 
-            // Grab next bock
+            // Grab the next batch of blocks
             if (priv->qlen == MAX_QUEUE_LENGTH)
                 pthread_cond_broadcast(&priv->queue_not_full);
-            block_num = priv->queue[--priv->qlen];
+            count = priv->qlen < ERASE_BATCH_SIZE ? priv->qlen : ERASE_BATCH_SIZE;
+            priv->qlen -= count;
+            memcpy(batch, priv->queue + priv->qlen, count * sizeof(*batch));
             if (priv->qlen == 0)
                 pthread_cond_signal(&priv->queue_empty);
 
-            // Do block deletion
+            // Delete them with a single bulk delete
             CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
-            r = (*priv->s3b->write_block)(priv->s3b, block_num, NULL, NULL, NULL, NULL);
+            r = (*priv->s3b->bulk_zero)(priv->s3b, batch, count);
             pthread_mutex_lock(&priv->mutex);
 
             // Check for error
             if (r != 0) {
-                warnx("can't delete block %0*jx: %s", S3B_BLOCK_NUM_DIGITS, (uintmax_t)block_num, strerror(r));
+                warnx("can't delete %u block(s) starting with %0*jx: %s",
+                  count, S3B_BLOCK_NUM_DIGITS, (uintmax_t)batch[0], strerror(r));
                 continue;
             }
 
-            // Update count and output a dot
-            if ((++priv->count % BLOCKS_PER_DOT) == 0 && !priv->quiet) {
-                fprintf(stderr, ".");
+            // Update count and output dots
+            old_count = priv->count;
+            priv->count += count;
+            if (!priv->quiet && priv->count / BLOCKS_PER_DOT > old_count / BLOCKS_PER_DOT) {
+                while (old_count / BLOCKS_PER_DOT < priv->count / BLOCKS_PER_DOT) {
+                    fprintf(stderr, ".");
+                    old_count += BLOCKS_PER_DOT;
+                }
                 fflush(stderr);
             }
 
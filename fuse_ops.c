@@ -38,10 +38,13 @@
 #include "block_cache.h"
 #include "block_part.h"
 #include "ec_protect.h"
+#include "dedup.h"
 #include "zero_cache.h"
 #include "fuse_ops.h"
+#include "metrics.h"
 #include "http_io.h"
 #include "test_io.h"
+#include "localfs_io.h"
 #include "s3b_config.h"
 #include "util.h"
 
@@ -78,6 +81,9 @@ static int fuse_op_read(const char *path, char *buf, size_t size, off_t offset,
     struct fuse_file_info *fi);
 static int fuse_op_write(const char *path, const char *buf, size_t size, off_t offset,
     struct fuse_file_info *fi);
+#if FUSE_WRITE_BUF
+static int fuse_op_write_buf(const char *path, struct fuse_bufvec *src, off_t offset, struct fuse_file_info *fi);
+#endif
 static int fuse_op_statfs(const char *path, struct statvfs *st);
 static int fuse_op_truncate(const char *path, off_t size);
 static int fuse_op_flush(const char *path, struct fuse_file_info *fi);
@@ -110,6 +116,9 @@ const struct fuse_operations s3backer_fuse_ops = {
     .open       = fuse_op_open,
     .read       = fuse_op_read,
     .write      = fuse_op_write,
+#if FUSE_WRITE_BUF
+    .write_buf  = fuse_op_write_buf,
+#endif
     .statfs     = fuse_op_statfs,
     .truncate   = fuse_op_truncate,
     .flush      = fuse_op_flush,
@@ -124,6 +133,7 @@ const struct fuse_operations s3backer_fuse_ops = {
 // Configuration and underlying s3backer_store
 static struct fuse_ops_conf *config;
 static struct fuse_ops_private *the_priv;
+static struct metrics_conf metrics_conf;
 
 /****************************************************************************
  *                      PUBLIC FUNCTION DEFINITIONS                         *
@@ -200,6 +210,15 @@ fuse_op_init(struct fuse_conn_info *conn)
         return NULL;
     }
 
+    // Start metrics server (not fatal if this fails)
+    if (config->metrics_socket != NULL && config->print_metrics != NULL) {
+        metrics_conf.address = config->metrics_socket;
+        metrics_conf.print_metrics = config->print_metrics;
+        metrics_conf.log = config->log;
+        if ((r = metrics_start(&metrics_conf)) != 0)
+            (*config->log)(LOG_ERR, "fuse_op_init(): can't start metrics server: %s", strerror(r));
+    }
+
     // Done
     (*config->log)(LOG_INFO, "mounting %s", s3bconf->mount);
     return priv;
@@ -230,6 +249,9 @@ fuse_op_destroy(void *data)
             (*config->log)(LOG_ERR, "unmount %s: clearing mount token failed: %s", s3bconf->mount, strerror(r));
     }
 
+    // Stop metrics server
+    metrics_stop();
+
     // Destroy
     (*s3b->destroy)(s3b);
     (*config->log)(LOG_INFO, "unmount %s: completed", s3bconf->mount);
@@ -424,11 +446,9 @@ fuse_op_read(const char *path, char *buf, size_t size, off_t offset, struct fuse
     calculate_boundary_info(&info, config->block_size, buf, size, offset);
     if (info.header.length > 0 && (r = block_part_read_block_part(priv->s3b, priv->block_part, &info.header)) != 0)
         return -r;
-    while (info.mid_block_count-- > 0) {
-        if ((r = (*priv->s3b->read_block)(priv->s3b, info.mid_block_start++, info.mid_data, NULL, NULL, 0)) != 0)
-            return -r;
-        info.mid_data += config->block_size;
-    }
+    if (info.mid_block_count > 0
+      && (r = read_block_range(priv->s3b, config->block_size, info.mid_block_start, info.mid_block_count, info.mid_data)) != 0)
+        return -r;
     if (info.footer.length > 0 && (r = block_part_read_block_part(priv->s3b, priv->block_part, &info.footer)) != 0)
         return -r;
 
@@ -471,11 +491,9 @@ fuse_op_write(const char *path, const char *buf, size_t size, off_t offset, stru
     calculate_boundary_info(&info, config->block_size, buf, size, offset);
     if (info.header.length > 0 && (r = block_part_write_block_part(priv->s3b, priv->block_part, &info.header)) != 0)
         return -r;
-    while (info.mid_block_count-- > 0) {
-        if ((r = (*priv->s3b->write_block)(priv->s3b, info.mid_block_start++, info.mid_data, NULL, NULL, NULL)) != 0)
-            return -r;
-        info.mid_data += config->block_size;
-    }
+    if (info.mid_block_count > 0
+      && (r = write_block_range(priv->s3b, config->block_size, info.mid_block_start, info.mid_block_count, info.mid_data)) != 0)
+        return -r;
     if (info.footer.length > 0 && (r = block_part_write_block_part(priv->s3b, priv->block_part, &info.footer)) != 0)
         return -r;
 
@@ -484,6 +502,48 @@ fuse_op_write(const char *path, const char *buf, size_t size, off_t offset, stru
     return orig_size;
 }
 
+#if FUSE_WRITE_BUF
+/*
+ * Write from a FUSE buffer vector.
+ *
+ * By default, libfuse reads each request into a single in-memory buffer, which we pass to fuse_op_write()
+ * as is; this saves nothing compared to libfuse doing the same. Only with `-o splice_read' can the data still
+ * be sitting in a pipe spliced from /dev/fuse; then we copy it once, as libfuse would, but into a pooled block
+ * buffer, which avoids a malloc() per request when the write is no bigger than a block buffer.
+ */
+static int
+fuse_op_write_buf(const char *path, struct fuse_bufvec *src, off_t offset, struct fuse_file_info *fi)
+{
+    const size_t size = fuse_buf_size(src);
+    struct fuse_bufvec dst = FUSE_BUFVEC_INIT(size);
+    ssize_t len;
+    int r;
+
+    // Handle read-only flag and stats file before copying anything
+    if (config->read_only)
+        return -EROFS;
+    if (fi->fh != 0)
+        return -EINVAL;
+
+    // Handle the simple case of a single memory buffer
+    if (src->count == 1 && src->idx == 0 && (src->buf[0].flags & FUSE_BUF_IS_FD) == 0)
+        return fuse_op_write(path, (const char *)src->buf[0].mem + src->off, size, offset, fi);
+
+    // Copy the data into a block buffer
+    if ((dst.buf[0].mem = block_buf_alloc(size)) == NULL)
+        return -ENOMEM;
+    if ((len = fuse_buf_copy(&dst, src, 0)) < 0) {
+        block_buf_free(dst.buf[0].mem);
+        return (int)len;
+    }
+
+    // Write it
+    r = fuse_op_write(path, dst.buf[0].mem, (size_t)len, offset, fi);
+    block_buf_free(dst.buf[0].mem);
+    return r;
+}
+#endif
+
 static int
 fuse_op_statfs(const char *path, struct statvfs *st)
 {
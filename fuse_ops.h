@@ -49,10 +49,12 @@ struct fuse_ops_conf {
     struct s3b_config       *s3bconf;
     print_stats_t           *print_stats;
     clear_stats_t           *clear_stats;
+    print_stats_t           *print_metrics;
     int                     read_only;
     int                     direct_io;
     const char              *filename;
     const char              *stats_filename;
+    const char              *metrics_socket;        // serve metrics here, or NULL for none
     uid_t                   uid;
     gid_t                   gid;
     u_int                   block_size;
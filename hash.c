@@ -33,10 +33,19 @@
  * this exception statement from all source files in the program, then
  * also delete it here.
  */
-
 /*
  * This is a simple closed hash table implementation with linear probing.
  * We pre-allocate the hash array based on the expected maximum size.
+ *
+ * Each slot stores the key alongside the value pointer, so probing never has to dereference values.
+ *
+ * A table created by s3b_hash_create_concurrent() also supports lookups by readers that don't hold the lock
+ * that serializes modifications. Each key maps to one of a fixed number of sequence counters ("seqlocks"),
+ * which writers bump around any change that could make that key invisible to a concurrent probe: inserting,
+ * replacing, or removing it, or moving it to a different slot while repairing the probe sequence after a
+ * removal. A reader samples the key's counter, probes, and retries if the counter was odd or has changed.
+ * Changes to other keys can't affect the outcome of a probe, so readers only ever retry due to writes of
+ * keys in the same sequence counter group.
  */
 
 #include "s3backer.h"
@@ -44,22 +53,34 @@
 
 // Definitions
 #define LOAD_FACTOR                 0.666666
+#define NUM_SEQS                    256             // number of sequence counters in a concurrent table
 #define FIRST(hash, key)            (s3b_hash_index((hash), (key)))
 #define NEXT(hash, index)           ((index) + 1 < (hash)->alen ? (index) + 1 : 0)
-#define EMPTY(value)                ((value) == NULL)
-#define VALUE(hash, index)          ((hash)->array[(index)])
+#define SLOT(hash, index)           (&(hash)->array[(index)])
+#define EMPTY(slot)                 ((slot)->value == NULL)
 #define KEY(value)                  (*(s3b_block_t *)(value))
+#define SEQ(hash, key)              (&(hash)->seqs[(key) % NUM_SEQS])
+
+// Hash table slot
+struct s3b_hash_slot {
+    s3b_block_t key;                // copy of the value's key
+    void        *value;             // value, or NULL if slot is empty
+};
 
 // Hash table structure
 struct s3b_hash {
-    u_int       maxkeys;            // max capacity
-    u_int       numkeys;            // number of keys in table
-    u_int       alen;               // hash array length
-    void        *array[0];          // hash array
+    u_int                   maxkeys;            // max capacity
+    u_int                   numkeys;            // number of keys in table
+    u_int                   alen;               // hash array length
+    u_int                   *seqs;              // sequence counters, or NULL if not concurrent
+    struct s3b_hash_slot    array[0];           // hash array
 };
 
 // Declarations
 static u_int s3b_hash_index(struct s3b_hash *hash, s3b_block_t key);
+static void s3b_hash_set(struct s3b_hash *hash, u_int index, s3b_block_t key, void *value);
+static void s3b_hash_write_begin(struct s3b_hash *hash, s3b_block_t key);
+static void s3b_hash_write_end(struct s3b_hash *hash, s3b_block_t key);
 
 // Public functions
 
@@ -80,9 +101,31 @@ s3b_hash_create(struct s3b_hash **hashp, u_int maxkeys)
     return 0;
 }
 
+/*
+ * Create a hash table that supports s3b_hash_contains_concurrent().
+ *
+ * Modifications must still be serialized by the caller.
+ */
+int
+s3b_hash_create_concurrent(struct s3b_hash **hashp, u_int maxkeys)
+{
+    struct s3b_hash *hash;
+    int r;
+
+    if ((r = s3b_hash_create(&hash, maxkeys)) != 0)
+        return r;
+    if ((hash->seqs = calloc(NUM_SEQS, sizeof(*hash->seqs))) == NULL) {
+        s3b_hash_destroy(hash);
+        return ENOMEM;
+    }
+    *hashp = hash;
+    return 0;
+}
+
 void
 s3b_hash_destroy(struct s3b_hash *hash)
 {
+    free(hash->seqs);
     free(hash);
 }
 
@@ -98,12 +141,52 @@ s3b_hash_get(struct s3b_hash *hash, s3b_block_t key)
     u_int i;
 
     for (i = FIRST(hash, key); 1; i = NEXT(hash, i)) {
-        void *const value = VALUE(hash, i);
+        struct s3b_hash_slot *const slot = SLOT(hash, i);
 
-        if (EMPTY(value))
+        if (EMPTY(slot))
             return NULL;
-        if (KEY(value) == key)
-            return value;
+        if (slot->key == key)
+            return slot->value;
+    }
+}
+
+/*
+ * Determine whether the table contains the key, without holding the lock that serializes modifications.
+ *
+ * The hash table must have been created via s3b_hash_create_concurrent(). The result reflects the state
+ * of the table at some instant during the call, just as if the lock had been briefly acquired.
+ */
+int
+s3b_hash_contains_concurrent(struct s3b_hash *hash, s3b_block_t key)
+{
+    u_int *const seq = SEQ(hash, key);
+    u_int seq1;
+    int found;
+    u_int i;
+
+    assert(hash->seqs != NULL);
+    while (1) {
+
+        // Wait for any in-progress modification to finish
+        if (((seq1 = __atomic_load_n(seq, __ATOMIC_ACQUIRE)) & 1) != 0)
+            continue;
+
+        // Probe for the key
+        for (found = 0, i = FIRST(hash, key); 1; i = NEXT(hash, i)) {
+            struct s3b_hash_slot *const slot = SLOT(hash, i);
+
+            if (__atomic_load_n(&slot->value, __ATOMIC_RELAXED) == NULL)
+                break;
+            if (__atomic_load_n(&slot->key, __ATOMIC_RELAXED) == key) {
+                found = 1;
+                break;
+            }
+        }
+
+        // Retry if the key was modified in the meantime
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(seq, __ATOMIC_RELAXED) == seq1)
+            return found;
     }
 }
 
@@ -120,17 +203,20 @@ s3b_hash_put(struct s3b_hash *hash, void *value)
     u_int i;
 
     for (i = FIRST(hash, key); 1; i = NEXT(hash, i)) {
-        void *const value2 = VALUE(hash, i);
+        struct s3b_hash_slot *const slot = SLOT(hash, i);
+        void *const value2 = slot->value;
 
-        if (EMPTY(value))
+        if (value2 == NULL)
             break;
-        if (KEY(value2) == key) {
-            VALUE(hash, i) = value;         // replace existing value having the same key with new value
+        if (slot->key == key) {
+            s3b_hash_set(hash, i, key, value);      // replace existing value having the same key with new value
             return value2;
         }
     }
     assert(hash->numkeys < hash->maxkeys);
-    VALUE(hash, i) = value;
+    s3b_hash_write_begin(hash, key);
+    s3b_hash_set(hash, i, key, value);
+    s3b_hash_write_end(hash, key);
     hash->numkeys++;
     return NULL;
 }
@@ -145,14 +231,16 @@ s3b_hash_put_new(struct s3b_hash *hash, void *value)
     u_int i;
 
     for (i = FIRST(hash, key); 1; i = NEXT(hash, i)) {
-        void *const value2 = VALUE(hash, i);
+        struct s3b_hash_slot *const slot = SLOT(hash, i);
 
-        if (EMPTY(value2))
+        if (EMPTY(slot))
             break;
-        assert(KEY(value2) != key);
+        assert(slot->key != key);
     }
     assert(hash->numkeys < hash->maxkeys);
-    VALUE(hash, i) = value;
+    s3b_hash_write_begin(hash, key);
+    s3b_hash_set(hash, i, key, value);
+    s3b_hash_write_end(hash, key);
     hash->numkeys++;
 }
 
@@ -165,31 +253,37 @@ s3b_hash_remove(struct s3b_hash *hash, s3b_block_t key)
 
     // Find entry
     for (i = FIRST(hash, key); 1; i = NEXT(hash, i)) {
-        void *const value = VALUE(hash, i);
+        struct s3b_hash_slot *const slot = SLOT(hash, i);
 
-        if (EMPTY(value))               // no such entry
+        if (EMPTY(slot))                // no such entry
             return;
-        if (KEY(value) == key)          // entry found
+        if (slot->key == key)           // entry found
             break;
     }
+    s3b_hash_write_begin(hash, key);
 
     // Repair subsequent entries as necessary
     for (j = NEXT(hash, i); 1; j = NEXT(hash, j)) {
-        void *const value = VALUE(hash, j);
+        struct s3b_hash_slot *const slot = SLOT(hash, j);
 
-        if (value == NULL)
+        if (EMPTY(slot))
             break;
-        k = FIRST(hash, KEY(value));
+        k = FIRST(hash, slot->key);
         if (j > i ? (k <= i || k > j) : (k <= i && k > j)) {
-            VALUE(hash, i) = value;
+            const s3b_block_t key2 = slot->key;
+
+            s3b_hash_write_begin(hash, key2);
+            s3b_hash_set(hash, i, key2, slot->value);
+            s3b_hash_write_end(hash, key2);
             i = j;
         }
     }
 
     // Remove entry
-    assert(VALUE(hash, i) != NULL);
-    VALUE(hash, i) = NULL;
+    assert(!EMPTY(SLOT(hash, i)));
+    s3b_hash_set(hash, i, 0, NULL);
     hash->numkeys--;
+    s3b_hash_write_end(hash, key);
 }
 
 int
@@ -198,7 +292,7 @@ s3b_hash_foreach(struct s3b_hash *hash, s3b_hash_visit_t *visitor, void *arg)
     u_int i;
 
     for (i = 0; i < hash->alen; i++) {
-        void *const value = VALUE(hash, i);
+        void *const value = SLOT(hash, i)->value;
         int r;
 
         if (value != NULL && (r = (*visitor)(arg, value)) != 0)
@@ -207,6 +301,47 @@ s3b_hash_foreach(struct s3b_hash *hash, s3b_hash_visit_t *visitor, void *arg)
     return 0;
 }
 
+/*
+ * Update a slot. The stores are atomic so concurrent readers never see torn values.
+ */
+static void
+s3b_hash_set(struct s3b_hash *hash, u_int index, s3b_block_t key, void *value)
+{
+    struct s3b_hash_slot *const slot = SLOT(hash, index);
+
+    __atomic_store_n(&slot->key, key, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->value, value, __ATOMIC_RELAXED);
+}
+
+/*
+ * Mark the start of a modification that could affect concurrent lookups of the key.
+ */
+static void
+s3b_hash_write_begin(struct s3b_hash *hash, s3b_block_t key)
+{
+    u_int *seq;
+
+    if (hash->seqs == NULL)
+        return;
+    seq = SEQ(hash, key);
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/*
+ * Mark the end of a modification started by s3b_hash_write_begin().
+ */
+static void
+s3b_hash_write_end(struct s3b_hash *hash, s3b_block_t key)
+{
+    u_int *seq;
+
+    if (hash->seqs == NULL)
+        return;
+    seq = SEQ(hash, key);
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
 /*
  * Jenkins one-at-a-time hash
  */
@@ -226,4 +361,3 @@ s3b_hash_index(struct s3b_hash *hash, s3b_block_t key)
     value += (value << 15);
     return value % hash->alen;
 }
-
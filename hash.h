@@ -42,6 +42,7 @@
  * 1.  Keys are of type s3b_block_t
  * 2.  Values are structures in which the first field is the key
  * 3.  No attempts will be made to overload the table
+ * 4.  Modifications are serialized by the caller; only s3b_hash_contains_concurrent() may be invoked without doing so
  */
 
 // Definitions
@@ -52,9 +53,11 @@ struct s3b_hash;
 
 // hash.c
 extern int s3b_hash_create(struct s3b_hash **hashp, u_int maxkeys);
+extern int s3b_hash_create_concurrent(struct s3b_hash **hashp, u_int maxkeys);
 extern void s3b_hash_destroy(struct s3b_hash *hash);
 extern u_int s3b_hash_size(struct s3b_hash *hash);
 extern void *s3b_hash_get(struct s3b_hash *hash, s3b_block_t key);
+extern int s3b_hash_contains_concurrent(struct s3b_hash *hash, s3b_block_t key);
 extern void *s3b_hash_put(struct s3b_hash *hash, void *value);
 extern void s3b_hash_put_new(struct s3b_hash *hash, void *value);
 extern void s3b_hash_remove(struct s3b_hash *hash, s3b_block_t key);
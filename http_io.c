@@ -37,6 +37,7 @@
 #include "s3backer.h"
 #include "http_io.h"
 #include "compress.h"
+#include "sbitmap.h"
 #include "util.h"
 
 // HTTP definitions
@@ -54,6 +55,7 @@
 #define HTTP_FORBIDDEN              403
 #define HTTP_NOT_FOUND              404
 #define HTTP_PRECONDITION_FAILED    412
+#define HTTP_SERVICE_UNAVAILABLE    503
 #define AUTH_HEADER                 "Authorization"
 #define CTYPE_HEADER                "Content-Type"
 #define CONTENT_ENCODING_HEADER     "Content-Encoding"
@@ -72,6 +74,7 @@
 #define HMAC_HEADER                 "x-amz-meta-s3backer-hmac"
 #define IF_MATCH_HEADER             "If-Match"
 #define IF_NONE_MATCH_HEADER        "If-None-Match"
+#define RANGE_HEADER                "Range"
 
 // Minumum HTTP status code we consider an error
 #define HTTP_STATUS_ERROR_MINIMUM   300                     // we don't support redirects
@@ -146,6 +149,10 @@
 #define S3_SERVICE_NAME             "s3"
 #define SIGNATURE_TERMINATOR        "aws4_request"
 #define SECURITY_TOKEN_HEADER       "x-amz-security-token"
+#define UNSIGNED_PAYLOAD            "UNSIGNED-PAYLOAD"
+
+// How many bytes to feed to each digest at a time when hashing a payload in a single pass
+#define PAYLOAD_HASH_CHUNK          4096
 
 // EC2 IAM info URL
 #define EC2_IAM_META_DATA_URLBASE   "http://169.254.169.254/latest/meta-data/iam/security-credentials/"
@@ -153,6 +160,21 @@
 #define EC2_IAM_META_DATA_ACCESSKEY "SecretAccessKey"
 #define EC2_IAM_META_DATA_TOKEN     "Token"
 
+// Minimum number of successful GETs before their latency percentiles are used for hedging
+#define HEDGE_MIN_SAMPLES           100
+
+// Request rate and bandwidth limiting
+#define RATE_BUCKET_BITS            4                       // with --blockHashPrefix, limit 16 key prefix ranges separately
+#define RATE_NUM_BUCKETS            (1 << RATE_BUCKET_BITS)
+#define RATE_BURST_MILLIS           1000                    // allowed burst, in milliseconds worth of the limit
+#define RATE_SLOWDOWN_FACTOR        0.75                    // multiplicative rate decrease after a 503 Slow Down
+#define RATE_SLOWDOWN_HOLDOFF       1000                    // minimum milliseconds between decreases
+#define RATE_RECOVERY               0.05                    // additive rate increase per second, as a fraction of the limit
+#define RATE_MIN_FRACTION           0.05                    // never decrease below this fraction of the limit
+
+// Returned by http_io_attempt_finish() when the operation should be retried
+#define HTTP_ATTEMPT_RETRY          (-1)
+
 // TCP keep-alive
 #define TCP_KEEP_ALIVE_IDLE         200
 #define TCP_KEEP_ALIVE_INTERVAL     60
@@ -184,8 +206,31 @@ struct http_io_survey {
     pthread_t                   thread;
     s3b_block_t                 min_name;
     s3b_block_t                 max_name;
-    block_list_func_t           *callback;
-    void                        *callback_arg;
+    const struct survey_params  *params;
+};
+
+// Pipelined bulk delete state
+struct http_io_bulk_delete {
+    struct http_io_private      *priv;
+    pthread_mutex_t             mutex;
+    const s3b_block_t           *block_nums;                    // blocks not yet claimed by any thread
+    u_int                       num_blocks;                     // number of blocks in "block_nums"
+    int                         error;                          // first error encountered, if any
+};
+
+/*
+ * Token bucket state for request rate and bandwidth limiting.
+ *
+ * The bucket is represented by its "theoretical arrival time" (as in the generic cell rate algorithm): the time
+ * at which it would be completely full, if nothing else were taken from it. A request may start once the bucket
+ * contains no more than RATE_BURST_MILLIS worth of debt, i.e., once "tat" is at most that far in the future.
+ */
+struct http_io_rate {
+    double                      tat;                            // theoretical arrival time, in milliseconds
+    double                      limit;                          // configured limit in units per millisecond, or zero
+    double                      rate;                           // current (adaptive) limit in units per millisecond
+    uint64_t                    updated;                        // when "rate" was last recovered
+    uint64_t                    slowdown;                       // when "rate" was last decreased
 };
 
 // Internal state
@@ -194,7 +239,14 @@ struct http_io_private {
     struct http_io_stats        stats;
     LIST_HEAD(, curl_holder)    curls;
     pthread_mutex_t             mutex;
-    bitmap_t                    *non_zero;                      // config->nonzero_bitmap is moved to here
+    CURLSH                      *share;                         // shared DNS and TLS session caches
+    pthread_mutex_t             share_locks[CURL_LOCK_DATA_LAST];
+    uint64_t                    hedge_eligible;                 // block reads that could have been hedged
+    uint64_t                    hedge_issued;                   // block reads that actually were hedged
+    struct http_io_rate         request_rate[RATE_NUM_BUCKETS]; // request rate limiters (protected by "mutex")
+    u_int                       num_request_rates;              // number of request rate limiters in use
+    struct http_io_rate         bandwidth;                      // aggregate bandwidth limiter (protected by "mutex")
+    struct sbitmap              *non_zero;                      // config->nonzero_bitmap is moved to here
     pthread_t                   iam_thread;                     // IAM credentials refresh thread
     u_char                      iam_thread_alive;               // IAM thread was successfully created
     u_char                      iam_thread_shutdown;            // Flag to the IAM thread telling it to exit
@@ -207,12 +259,30 @@ struct http_io_private {
     volatile int                abort_survey;                   // set to 1 to abort block survey
     int                         survey_error;                   // error from any survey thread
 
+    // Asynchronous I/O engine
+    struct http_io_loop         *loops;                         // event loops, or NULL if not running
+    u_int                       num_loops;                      // number of event loops
+    u_int                       next_loop;                      // next event loop to use
+
+    // Transform thread pool
+    struct http_io_xform        *xforms;                        // transform threads, or NULL if not running
+    u_int                       num_xforms;                     // number of transform threads
+    pthread_mutex_t             xform_mutex;                    // protects "xform_queue" and "xform_shutdown"
+    pthread_cond_t              xform_work;                     // signaled when work is added to "xform_queue"
+    TAILQ_HEAD(, http_io_op)    xform_queue;                    // operations waiting to be transformed
+    int                         xform_shutdown;                 // flag telling the transform threads to exit
+
     // Encryption info
     const EVP_CIPHER            *cipher;
     u_int                       keylen;                         // length of key and ivkey
     u_char                      key[EVP_MAX_KEY_LENGTH];        // key used to encrypt data
     u_char                      ivkey[EVP_MAX_KEY_LENGTH];      // key used to encrypt block number to get IV for data
     struct hmac_engine          *hmac;
+
+    // AWS version 4 signing key cache (protected by "mutex")
+    u_int                       cred_generation;                // incremented whenever credentials change
+    char                        sigkey_date[8];                 // date (YYYYMMDD) of cached signing key, if any
+    u_char                      sigkey[SHA256_DIGEST_LENGTH];   // cached signing key
 };
 
 // I/O buffers
@@ -246,7 +316,7 @@ struct http_io {
     char                *start_after;           // where to start next round of listing
     s3b_block_t         min_name;               // inclusive lower bound for block name/prefix
     s3b_block_t         max_name;               // inclusive upper bound for block name/prefix
-    s3b_block_t         *block_list;            // the blocks we found this iteration
+    s3b_block_t         *block_list;            // the blocks we found this iteration (or bulk delete keys to retry)
     u_int               num_blocks;             // number of blocks in "block_list"
 
     // Bulk delete info
@@ -262,6 +332,7 @@ struct http_io {
     const char          *sse;                   // Server Side Encryption
     void                *dest;                  // Block data (when reading)
     const void          *src;                   // Block data (when writing)
+    const u_char        *payload_sha256;        // precomputed SHA-256 of "src", or NULL
     s3b_block_t         block_num;              // The block we're reading/writing
     u_int               buf_size;               // Size of data buffer
     u_int               *content_lengthp;       // Returned Content-Length
@@ -269,6 +340,7 @@ struct http_io {
     u_int               block_size;             // block size from "x-amz-meta-s3backer-blocksize"
     int32_t             mount_token;            // mount_token from "x-amz-meta-s3backer-mount-token"
     u_int               expect_304;             // a verify request; expect a 304 response
+    u_int               hedge;                  // a block read that may be hedged
     u_char              etag[MD5_DIGEST_LENGTH];// parsed ETag header (must look like an MD5 hash)
     u_char              hmac[SHA_DIGEST_LENGTH];// parsed "x-amz-meta-s3backer-hmac" header
     char                content_encoding[32];   // received content encoding
@@ -279,11 +351,107 @@ struct http_io {
     long                http_status;            // response status, if known, else zero
     char                *error_payload;         // payload of error response
     size_t              error_payload_len;      // error response length
+
+    // Retry state
+    int                 attempt;                // current attempt number (zero based)
+    u_int               retry_pause;            // most recent retry pause in milliseconds
+    u_int               total_pause;            // total retry pause so far in milliseconds
 };
 
 // CURL prepper function type
 typedef void http_io_curl_prepper_t(CURL *curl, struct http_io *io);
 
+/*
+ * Asynchronous I/O engine.
+ *
+ * Each event loop thread owns a curl_multi handle and drives any number of concurrent transfers.
+ * An operation is submitted to a loop, which (re)starts it, waits for it to finish, performs any
+ * retries (without blocking), and then invokes the operation's completion callback from the loop thread.
+ */
+struct http_io_op;
+struct http_io_xform;
+typedef void http_io_op_done_t(struct http_io_op *op, int r);
+typedef void http_io_xform_t(struct http_io_xform *xform, struct http_io_op *op, int r);
+
+struct http_io_op {
+    struct http_io              *io;                            // I/O state
+    http_io_curl_prepper_t      *prepper;                       // CURL prepper function
+    http_io_op_done_t           *done;                          // completion callback
+    void                        *arg;                           // completion callback argument
+    uint64_t                    start_time;                     // when to (re)start, in milliseconds
+    http_io_xform_t             *xform;                         // transform function to run in the thread pool
+    int                         xform_r;                        // parameter for "xform"
+    TAILQ_ENTRY(http_io_op)     link;                           // next in loop's pending list or transform queue
+};
+
+struct http_io_loop {
+    struct http_io_private      *priv;
+    pthread_t                   thread;
+    CURLM                       *multi;
+    pthread_mutex_t             mutex;                          // protects "pending" and "shutdown"
+    TAILQ_HEAD(, http_io_op)    pending;                        // operations waiting to be (re)started
+    int                         wakeup[2];                      // pipe used to wake up the loop thread
+    u_int                       num_active;                     // number of transfers in progress
+    int                         shutdown;                       // flag telling the loop thread to exit
+};
+
+/*
+ * Transform thread pool.
+ *
+ * If configured, the CPU-heavy encoding (compression, encryption, and signing) of all written blocks,
+ * and the decoding of blocks read via the asynchronous I/O engine, are handed off to a pool of threads,
+ * instead of being done serially by the calling thread (writes) or by the event loop thread (reads).
+ * Single-block writes go through the engine as a batch of one for this purpose. Each block is submitted
+ * to an event loop as soon as it has been encoded, so the transforms are spread across cores and overlap
+ * with the network I/O of other blocks.
+ *
+ * Encoding output buffers come from block_buf_alloc(), whose per-thread cache and shared pool are sized for
+ * an encoded block, so in steady state they are recycled rather than allocated; decryption on a transform
+ * thread uses that thread's own scratch buffer.
+ */
+struct http_io_xform {
+    struct http_io_private      *priv;
+    pthread_t                   thread;
+    u_char                      *scratch;                       // reusable buffer for decrypting blocks
+    size_t                      scratch_size;
+};
+
+// A group of asynchronous operations whose completion the caller waits for
+struct http_io_batch {
+    struct http_io_private      *priv;
+    pthread_cond_t              done;                           // signaled when "remaining" reaches zero
+    u_int                       remaining;                      // number of operations not yet complete
+    int                         error;                          // first error encountered
+    check_cancel_t              *check_cancel;                  // write check-for-cancel callback, or NULL
+    void                        *check_cancel_arg;              // write check-for-cancel callback argument
+};
+
+// Block read request
+struct http_io_read_req {
+    struct http_io              io;
+    struct http_io_op           op;
+    struct http_io_batch        *batch;
+    void                        *dest;
+    u_char                      *actual_etag;
+    const u_char                *expect_etag;
+    int                         strict;
+    u_char                      *scratch;                       // optional buffer for decryption
+    size_t                      scratch_size;
+    int                         *encodedp;                      // if not NULL, return the block encoded if possible
+};
+
+// Block write request
+struct http_io_write_req {
+    struct http_io              io;
+    struct http_io_op           op;
+    struct http_io_batch        *batch;
+    const void                  *src;
+    u_char                      *caller_etag;
+    void                        *encoded_buf;
+    s3b_block_t                 block_num;                      // for deferred http_io_write_start()
+    char                        *urlbuf;                        // for deferred http_io_write_start()
+};
+
 // s3backer_store functions
 static int http_io_create_threads(struct s3backer_store *s3b);
 static int http_io_meta_data(struct s3backer_store *s3b, off_t *file_sizep, u_int *block_sizep);
@@ -292,9 +460,16 @@ static int http_io_read_block(struct s3backer_store *s3b, s3b_block_t block_num,
   u_char *actual_etag, const u_char *expect_etag, int strict);
 static int http_io_write_block(struct s3backer_store *s3b, s3b_block_t block_num, const void *src, u_char *etag,
   check_cancel_t *check_cancel, void *check_cancel_arg);
+static int http_io_read_blocks(struct s3backer_store *s3b, s3b_block_t block_num, u_int num_blocks, void *dest);
+static int http_io_read_block_part(struct s3backer_store *s3b, s3b_block_t block_num, u_int off, u_int len, void *dest);
+static int http_io_read_block_encoded(struct s3backer_store *s3b, s3b_block_t block_num, void *dest, int *encodedp,
+  u_char *actual_etag, const u_char *expect_etag, int strict);
+static int http_io_decode_block(struct s3backer_store *s3b, s3b_block_t block_num, const void *src, void *dest);
+static int http_io_write_blocks(struct s3backer_store *s3b, s3b_block_t block_num, u_int num_blocks, const void *src,
+    u_char *etags, check_cancel_t *check_cancel, void *check_cancel_arg);
 static int http_io_flush_blocks(struct s3backer_store *s3b, const s3b_block_t *block_nums, u_int num_blocks, long timeout);
 static int http_io_bulk_zero(struct s3backer_store *const s3b, const s3b_block_t *block_nums, u_int num_blocks);
-static int http_io_survey_non_zero(struct s3backer_store *s3b, block_list_func_t *callback, void *arg);
+static int http_io_survey_non_zero(struct s3backer_store *s3b, const struct survey_params *params);
 static int http_io_shutdown(struct s3backer_store *s3b);
 static void http_io_destroy(struct s3backer_store *s3b);
 
@@ -320,16 +495,55 @@ static int update_iam_credentials(struct http_io_private *priv);
 static char *parse_json_field(struct http_io_private *priv, const char *json, const char *field);
 
 // Block survey functions
-static int http_io_list_blocks_range(struct http_io_private *priv,
-    s3b_block_t min, s3b_block_t max, block_list_func_t *callback, void *arg);
+static int http_io_list_blocks_range(struct http_io_private *priv, s3b_block_t min, s3b_block_t max,
+    block_list_func_t *callback, block_range_func_t *progress, void *arg);
+static int http_io_list_blocks_progress_name(const char *prefix, const char *last_key, s3b_block_t *namep);
 static void *http_io_list_blocks_worker_main(void *arg);
 static void http_io_list_blocks_elem_end(void *arg, const XML_Char *name);
 static block_list_func_t http_io_list_blocks_callback;
+static block_range_func_t http_io_list_blocks_progress;
 static void http_io_wait_for_survey_threads_to_exit(struct http_io_private *const priv);
 
 // Bulk delete
+static void *http_io_bulk_delete_main(void *arg);
+static int http_io_bulk_delete_chunk(struct http_io_private *priv, const s3b_block_t *block_nums, u_int num_blocks);
 static void http_io_bulk_delete_elem_end(void *arg, const XML_Char *name);
 
+// Block read/write functions
+static int http_io_read_empty(struct http_io_private *priv, s3b_block_t block_num, void *dest, u_int len,
+  u_char *actual_etag);
+static int http_io_read_start(struct http_io_private *priv, struct http_io_read_req *req, char *urlbuf, size_t urlbuf_size,
+    s3b_block_t block_num, void *dest, u_char *actual_etag, const u_char *expect_etag, int strict);
+static int http_io_read_finish(struct http_io_private *priv, struct http_io_read_req *req, int r);
+static int http_io_decode(struct http_io_private *priv, s3b_block_t block_num, char *content_encoding, const u_char *sig,
+  void **bufp, u_int did_read, void *dest, u_char *scratch, size_t scratch_size);
+static int http_io_write_empty(struct http_io_private *priv, s3b_block_t block_num, const void *src, u_char *caller_etag);
+static int http_io_write_start(struct http_io_private *priv, struct http_io_write_req *req, char *urlbuf, size_t urlbuf_size,
+    s3b_block_t block_num, const void *src, u_char *caller_etag, check_cancel_t *check_cancel, void *check_cancel_arg);
+static int http_io_write_finish(struct http_io_private *priv, struct http_io_write_req *req, int r);
+
+// Asynchronous I/O engine
+static int http_io_start_loops(struct http_io_private *priv);
+static void http_io_stop_loops(struct http_io_private *priv);
+static int http_io_start_xforms(struct http_io_private *priv);
+static void http_io_stop_xforms(struct http_io_private *priv);
+static void *http_io_xform_main(void *arg);
+static void http_io_xform_queue(struct http_io_private *priv, struct http_io_op *op, http_io_xform_t *xform, int r);
+static void *http_io_loop_main(void *arg);
+static void http_io_loop_start_op(struct http_io_loop *loop, struct http_io_op *op);
+static void http_io_loop_finish_op(struct http_io_loop *loop, struct http_io_op *op, CURL *curl, CURLcode curl_code);
+static void http_io_loop_wakeup(struct http_io_loop *loop);
+static int http_io_submit(struct http_io_private *priv, struct http_io_op *op);
+static int http_io_async_read_blocks(struct http_io_private *priv, s3b_block_t block_num, u_int num_blocks, void *dest);
+static int http_io_async_write_blocks(struct http_io_private *priv, s3b_block_t block_num, u_int num_blocks, const void *src,
+    u_char *etags, check_cancel_t *check_cancel, void *check_cancel_arg);
+static http_io_op_done_t http_io_async_read_done;
+static http_io_op_done_t http_io_async_write_done;
+static void http_io_batch_complete(struct http_io_private *priv, struct http_io_batch *batch, int r);
+static http_io_xform_t http_io_async_read_xform;
+static http_io_xform_t http_io_async_write_xform;
+static uint64_t http_io_get_time_millis(void);
+
 // XML query functions
 static int http_io_xml_io_init(struct http_io_private *const priv, struct http_io *io, const char *method, char *url);
 static int http_io_xml_io_exec(struct http_io_private *const priv, struct http_io *io,
@@ -341,6 +555,19 @@ static void http_io_xml_text(void *arg, const XML_Char *s, int len);
 
 // HTTP and curl functions
 static int http_io_perform_io(struct http_io_private *priv, struct http_io *io, http_io_curl_prepper_t *prepper);
+static CURL *http_io_attempt_start(struct http_io_private *priv, struct http_io *io, http_io_curl_prepper_t *prepper);
+static int http_io_attempt_finish(struct http_io_private *priv, struct http_io *io, CURL *curl, CURLcode curl_code);
+static int http_io_retry_pause(struct http_io_private *priv, struct http_io *io);
+static void http_io_rate_init(struct http_io_rate *rate, double per_second, uint64_t now);
+static void http_io_rate_recover(struct http_io_rate *rate, uint64_t now);
+static uint64_t http_io_rate_reserve(struct http_io_private *priv, struct http_io *io, uint64_t when, int optional);
+static void http_io_rate_sleep(struct http_io_private *priv, struct http_io *io);
+static void http_io_rate_charge(struct http_io_private *priv, CURL *curl);
+static void http_io_rate_slowdown(struct http_io_private *priv, struct http_io *io);
+static struct http_io_rate *http_io_rate_bucket(struct http_io_private *priv, struct http_io *io);
+static u_int http_io_hedge_deadline(struct http_io_private *priv, struct http_io *io);
+static int http_io_hedged_attempt(struct http_io_private *priv, struct http_io *io,
+    http_io_curl_prepper_t *prepper, u_int deadline);
 static size_t http_io_curl_reader(const void *ptr, size_t size, size_t nmemb, void *stream);
 static size_t http_io_curl_writer(void *ptr, size_t size, size_t nmemb, void *stream);
 static size_t http_io_curl_header(void *ptr, size_t size, size_t nmemb, void *stream);
@@ -354,6 +581,12 @@ static int http_io_reader_error_check(struct http_io *const io, const void *ptr,
 static void http_io_free_error_payload(struct http_io *const io);
 static void http_io_log_error_payload(struct http_io *const io);
 static int http_io_sockopt_callback(void *clientp, curl_socket_t curlfd, curlsocktype purpose);
+static int http_io_share_create(struct http_io_private *priv);
+static void http_io_share_destroy(struct http_io_private *priv);
+static void http_io_share_lock(CURL *curl, curl_lock_data data, curl_lock_access access, void *arg);
+static void http_io_share_unlock(CURL *curl, curl_lock_data data, void *arg);
+static void http_io_prewarm_connections(struct http_io_private *priv);
+static void *http_io_prewarm_main(void *arg);
 
 // Misc
 static void http_io_openssl_locker(int mode, int i, const char *file, int line);
@@ -362,6 +595,7 @@ static void http_io_base64_encode(char *buf, size_t bufsiz, const void *data, si
 static u_int http_io_crypt(struct http_io_private *priv,
     s3b_block_t block_num, int enc, const u_char *src, u_int len, u_char *dst, u_int dmax);
 static void http_io_authsig(struct http_io_private *priv, s3b_block_t block_num, const u_char *src, u_int len, u_char *hmac);
+static void http_io_hash_payload(const void *data, size_t len, u_char *md5, u_char *sha256);
 static void update_hmac_from_header(struct hmac_ctx *ctx, struct http_io *io,
   const char *name, int value_only, char *sigbuf, size_t sigbuflen);
 static s3b_block_t http_io_block_hash_prefix(s3b_block_t block_num);
@@ -381,6 +615,15 @@ static int num_openssl_locks;
 static u_char zero_etag[MD5_DIGEST_LENGTH];
 static u_char zero_hmac[SHA_DIGEST_LENGTH];
 
+// Bulk delete per-key error codes that are worth retrying
+static const char *const bulk_delete_retry_codes[] = {
+    "InternalError",
+    "OperationAborted",
+    "ServiceUnavailable",
+    "SlowDown",
+    NULL
+};
+
 /*
  * Constructor
  *
@@ -392,7 +635,9 @@ http_io_create(struct http_io_conf *config)
     struct s3backer_store *s3b;
     struct http_io_private *priv;
     struct curl_holder *holder;
+    uint64_t now;
     int nlocks;
+    u_int i;
     int r;
 
     // Sanity check: we can really only handle one instance
@@ -412,6 +657,12 @@ http_io_create(struct http_io_conf *config)
     s3b->set_mount_token = http_io_set_mount_token;
     s3b->read_block = http_io_read_block;
     s3b->write_block = http_io_write_block;
+    s3b->read_blocks = http_io_read_blocks;
+    s3b->write_blocks = http_io_write_blocks;
+    if (config->encryption == NULL && config->compress_alg == NULL && config->default_ce == NULL)
+        s3b->read_block_part = http_io_read_block_part;         // only possible when blocks are stored as-is
+    s3b->read_block_encoded = http_io_read_block_encoded;
+    s3b->decode_block = http_io_decode_block;
     s3b->bulk_zero = http_io_bulk_zero;
     s3b->flush_blocks = http_io_flush_blocks;
     s3b->survey_non_zero = http_io_survey_non_zero;
@@ -430,6 +681,13 @@ http_io_create(struct http_io_conf *config)
     LIST_INIT(&priv->curls);
     s3b->data = priv;
 
+    // Initialize rate limiters
+    now = http_io_get_time_millis();
+    priv->num_request_rates = config->blockHashPrefix ? RATE_NUM_BUCKETS : 1;
+    for (i = 0; i < priv->num_request_rates; i++)
+        http_io_rate_init(&priv->request_rate[i], config->max_request_rate, now);
+    http_io_rate_init(&priv->bandwidth, (double)(config->max_total_speed / 8), now);
+
     // Initialize openssl
     num_openssl_locks = CRYPTO_num_locks();
     if ((openssl_locks = malloc(num_openssl_locks * sizeof(*openssl_locks))) == NULL) {
@@ -519,9 +777,13 @@ http_io_create(struct http_io_conf *config)
     // Initialize cURL
     curl_global_init(CURL_GLOBAL_ALL);
 
+    // Create cURL share handle
+    if ((r = http_io_share_create(priv)) != 0)
+        goto fail7;
+
     // Initialize IAM credentials
     if (config->ec2iam_role != NULL && (r = update_iam_credentials(priv)) != 0)
-        goto fail7;
+        goto fail8;
 
     // Take ownership of non-zero block bitmap
     priv->non_zero = config->nonzero_bitmap;
@@ -530,12 +792,14 @@ http_io_create(struct http_io_conf *config)
     // Done
     return s3b;
 
-fail7:
+fail8:
     while ((holder = LIST_FIRST(&priv->curls)) != NULL) {
         curl_easy_cleanup(holder->curl);
         LIST_REMOVE(holder, link);
         free(holder);
     }
+    http_io_share_destroy(priv);
+fail7:
     curl_global_cleanup();
 fail6:
     hmac_engine_free(priv->hmac);
@@ -585,12 +849,13 @@ http_io_destroy(struct s3backer_store *const s3b)
         LIST_REMOVE(holder, link);
         free(holder);
     }
+    http_io_share_destroy(priv);
     curl_global_cleanup();
 
     // Free structures
     pthread_cond_destroy(&priv->survey_done);
     pthread_mutex_destroy(&priv->mutex);
-    bitmap_free(&priv->non_zero);
+    sbitmap_free(&priv->non_zero);
     free(priv);
     free(s3b);
 }
@@ -605,6 +870,10 @@ http_io_shutdown(struct s3backer_store *const s3b)
     // Signal survey threads to stop
     priv->abort_survey = 1;
 
+    // Shut down transform threads and asynchronous I/O event loops, if any
+    http_io_stop_xforms(priv);
+    http_io_stop_loops(priv);
+
     // Lock mutex
     pthread_mutex_lock(&priv->mutex);
 
@@ -664,7 +933,7 @@ http_io_flush_blocks(struct s3backer_store *s3b, const s3b_block_t *block_nums,
 }
 
 static int
-http_io_survey_non_zero(struct s3backer_store *s3b, block_list_func_t *callback, void *arg)
+http_io_survey_non_zero(struct s3backer_store *s3b, const struct survey_params *params)
 {
     struct http_io_private *const priv = s3b->data;
     struct http_io_conf *const config = priv->config;
@@ -699,8 +968,7 @@ http_io_survey_non_zero(struct s3backer_store *s3b, block_list_func_t *callback,
 
         // Configure this thread
         survey->priv = priv;
-        survey->callback = callback;
-        survey->callback_arg = arg;
+        survey->params = params;
 
         // Configure this thread's portion of the range, but being careful to handle weird corner cases
         survey->min_name = thread_index > 0 ? survey[-1].max_name + 1 : (s3b_block_t)0;
@@ -759,16 +1027,52 @@ http_io_wait_for_survey_threads_to_exit(struct http_io_private *const priv)
     priv->survey_threads = NULL;
 }
 
+/*
+ * Scan this thread's range of names, leaving out any portions the caller asked us to skip.
+ *
+ * Names and block numbers are only the same thing without "--blockHashPrefix", so that's the only
+ * case where we can skip ranges or report progress.
+ */
 static void *
 http_io_list_blocks_worker_main(void *arg)
 {
     struct http_io_survey *const info = arg;
     struct http_io_private *const priv = info->priv;
+    struct http_io_conf *const config = priv->config;
+    const struct survey_params *const params = info->params;
+    const u_int num_skip = config->blockHashPrefix ? 0 : params->num_skip;
+    block_range_func_t *const progress = config->blockHashPrefix || params->progress == NULL ?
+      NULL : http_io_list_blocks_progress;
+    s3b_block_t min = info->min_name;
+    s3b_block_t max;
+    u_int skip_index = 0;
     int r = 0;
 
-    // Scan my range (if non-empty)
-    if (info->min_name <= info->max_name)
-        r = http_io_list_blocks_range(priv, info->min_name, info->max_name, http_io_list_blocks_callback, info);
+    // Scan each unskipped portion of my range (if non-empty)
+    while (min <= info->max_name) {
+
+        // Find the first skip range that doesn't end before "min"
+        while (skip_index < num_skip && params->skip[skip_index].max < min)
+            skip_index++;
+
+        // If "min" is within a skip range, jump past it
+        if (skip_index < num_skip && params->skip[skip_index].min <= min) {
+            if (params->skip[skip_index].max >= info->max_name)
+                break;
+            min = params->skip[skip_index].max + 1;
+            continue;
+        }
+
+        // Scan up to the next skip range, if any
+        max = info->max_name;
+        if (skip_index < num_skip && params->skip[skip_index].min <= max)
+            max = params->skip[skip_index].min - 1;
+        if ((r = http_io_list_blocks_range(priv, min, max, http_io_list_blocks_callback, progress, info)) != 0)
+            break;
+        if (max == info->max_name)
+            break;
+        min = max + 1;
+    }
 
     // Finish up
     pthread_mutex_lock(&priv->mutex);
@@ -787,17 +1091,59 @@ http_io_list_blocks_callback(void *arg, const s3b_block_t *block_nums, u_int num
 
     if (info->priv->abort_survey)
         return ECANCELED;
-    return (*info->callback)(info->callback_arg, block_nums, num_blocks);
+    return (*info->params->callback)(info->params->arg, block_nums, num_blocks);
+}
+
+static int
+http_io_list_blocks_progress(void *arg, s3b_block_t min_block, s3b_block_t max_block)
+{
+    struct http_io_survey *const info = arg;
+
+    if (info->priv->abort_survey)
+        return ECANCELED;
+    return (*info->params->progress)(info->params->arg, min_block, max_block);
+}
+
+/*
+ * Given the last key returned by a listing, determine the highest name such that all names up to and
+ * including it have been listed. Returns zero on success, or -1 if the key doesn't tell us anything.
+ */
+static int
+http_io_list_blocks_progress_name(const char *prefix, const char *last_key, s3b_block_t *namep)
+{
+    const size_t plen = strlen(prefix);
+    s3b_block_t name = 0;
+    int i;
+
+    if (strncmp(last_key, prefix, plen) != 0)
+        return -1;
+    last_key += plen;
+    for (i = 0; i < S3B_BLOCK_NUM_DIGITS; i++) {
+        const char ch = last_key[i];
+
+        if (ch >= '0' && ch <= '9')
+            name = (name << 4) | (ch - '0');
+        else if (ch >= 'a' && ch <= 'f')
+            name = (name << 4) | (ch - 'a' + 10);
+        else
+            return -1;
+    }
+    *namep = name;
+    return 0;
 }
 
 //
 // Scan blocks in the range "min" (inclusive) to "max" (inclusive).
 //
+// If "progress" is not NULL, it's invoked after each page of results with the range of names that have been
+// completely listed so far; this is only meaningful when names are block numbers.
+//
 // Note "min" and "max" refer to the first S3B_BLOCK_NUM_DIGITS characters of the block's S3 object name (after any "--prefix"),
 // not necessarily the block number; these are different things when "--blockHashPrefix" is used, otherwise they are the same.
 //
 static int
-http_io_list_blocks_range(struct http_io_private *priv, s3b_block_t min, s3b_block_t max, block_list_func_t *callback, void *arg)
+http_io_list_blocks_range(struct http_io_private *priv, s3b_block_t min, s3b_block_t max,
+    block_list_func_t *callback, block_range_func_t *progress, void *arg)
 {
     struct http_io_conf *const config = priv->config;
     char last_possible_path[strlen(config->prefix) + S3B_BLOCK_NUM_DIGITS + 1];
@@ -858,8 +1204,20 @@ http_io_list_blocks_range(struct http_io_private *priv, s3b_block_t min, s3b_blo
         }
 
         // Are we done?
-        if (!io.list_truncated || strcmp(io.start_after, last_possible_path) >= 0)
+        if (!io.list_truncated || strcmp(io.start_after, last_possible_path) >= 0) {
+            if (progress != NULL)
+                r = (*progress)(arg, min, max);
             break;
+        }
+
+        // Report progress so far
+        if (progress != NULL) {
+            s3b_block_t name;
+
+            if (http_io_list_blocks_progress_name(config->prefix, io.start_after, &name) == 0 && name >= min
+              && (r = (*progress)(arg, min, name < max ? name : max)) != 0)
+                break;
+        }
     }
 
 done:
@@ -1161,6 +1519,22 @@ http_io_create_threads(struct s3backer_store *s3b)
             (*config->log)(LOG_ERR, "failed to create IAM updater thread: %s", strerror(r));
     }
     CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+    if (r != 0)
+        return r;
+
+    // Open connections ahead of time if configured
+    if (config->prewarm_connections > 0)
+        http_io_prewarm_connections(priv);
+
+    // Start asynchronous I/O event loops if configured
+    if (config->event_threads > 0 && (r = http_io_start_loops(priv)) != 0) {
+        (*config->log)(LOG_ERR, "failed to create event loop threads: %s", strerror(r));
+        return r;
+    }
+
+    // Start transform threads if configured
+    if (priv->loops != NULL && config->transform_threads > 0 && (r = http_io_start_xforms(priv)) != 0)
+        (*config->log)(LOG_ERR, "failed to create transform threads: %s", strerror(r));
 
     // Done
     return r;
@@ -1391,6 +1765,8 @@ update_iam_credentials(struct http_io_private *const priv)
     config->accessId = access_id;
     config->accessKey = access_key;
     config->iam_token = iam_token;
+    priv->cred_generation++;
+    memset(priv->sigkey_date, 0, sizeof(priv->sigkey_date));
     CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
     (*config->log)(LOG_INFO, "successfully updated EC2 IAM credentials from %s", io.url);
     free(urlbuf);
@@ -1480,13 +1856,7 @@ http_io_read_block(struct s3backer_store *const s3b, s3b_block_t block_num, void
     struct http_io_private *const priv = s3b->data;
     struct http_io_conf *const config = priv->config;
     char urlbuf[URL_BUF_SIZE(config)];
-    char accept_encoding[128];
-    const time_t now = time(NULL);
-    int encrypted = 0;
-    struct http_io io;
-    u_int did_read;
-    char *layer;
-    int i;
+    struct http_io_read_req req;
     int r;
 
     // Sanity check
@@ -1494,26 +1864,146 @@ http_io_read_block(struct s3backer_store *const s3b, s3b_block_t block_num, void
         return EINVAL;
 
     // Read zero blocks when bitmap indicates empty until non-zero content is written
-    if (priv->non_zero != NULL) {
+    if (http_io_read_empty(priv, block_num, dest, config->block_size, actual_etag))
+        return 0;
+
+    // Prepare request
+    if ((r = http_io_read_start(priv, &req, urlbuf, sizeof(urlbuf), block_num, dest, actual_etag, expect_etag, strict)) != 0)
+        return r;
+
+    // Perform operation
+    req.io.hedge = 1;
+    r = http_io_perform_io(priv, &req.io, http_io_read_prepper);
+
+    // Process the response
+    return http_io_read_finish(priv, &req, r);
+}
+
+static int
+http_io_read_block_encoded(struct s3backer_store *const s3b, s3b_block_t block_num, void *dest, int *encodedp,
+  u_char *actual_etag, const u_char *expect_etag, int strict)
+{
+    struct http_io_private *const priv = s3b->data;
+    struct http_io_conf *const config = priv->config;
+    char urlbuf[URL_BUF_SIZE(config)];
+    struct http_io_read_req req;
+    int r;
+
+    // Sanity check
+    if (config->block_size == 0 || block_num >= config->num_blocks)
+        return EINVAL;
+
+    // Read zero blocks when bitmap indicates empty until non-zero content is written
+    *encodedp = 0;
+    if (http_io_read_empty(priv, block_num, dest, config->block_size, actual_etag))
+        return 0;
+
+    // Prepare request
+    if ((r = http_io_read_start(priv, &req, urlbuf, sizeof(urlbuf), block_num, dest, actual_etag, expect_etag, strict)) != 0)
+        return r;
+    req.encodedp = encodedp;
+
+    // Perform operation
+    req.io.hedge = 1;
+    r = http_io_perform_io(priv, &req.io, http_io_read_prepper);
+
+    // Process the response
+    return http_io_read_finish(priv, &req, r);
+}
+
+static int
+http_io_decode_block(struct s3backer_store *const s3b, s3b_block_t block_num, const void *src, void *dest)
+{
+    struct http_io_private *const priv = s3b->data;
+    struct http_io_conf *const config = priv->config;
+    const struct encoded_header *const hdr = src;
+    char content_encoding[sizeof(hdr->encoding)];
+    void *buf;
+    int r;
+
+    // Sanity check
+    if (hdr->length > config->block_size - sizeof(*hdr))
+        return EINVAL;
+
+    // Copy the encoded data into a buffer we can decode in place
+    if ((buf = block_buf_alloc(comp_bound(config->block_size) + EVP_MAX_IV_LENGTH)) == NULL) {
+        (*config->log)(LOG_ERR, "malloc: %s", strerror(errno));
         pthread_mutex_lock(&priv->mutex);
-        if (!bitmap_test(priv->non_zero, block_num)) {
-            priv->stats.empty_blocks_read++;
-            CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
-            memset(dest, 0, config->block_size);
-            if (actual_etag != NULL)
-                memset(actual_etag, 0, MD5_DIGEST_LENGTH);
-            return 0;
-        }
+        priv->stats.out_of_memory_errors++;
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+        return ENOMEM;
+    }
+    memcpy(buf, hdr + 1, hdr->length);
+    snvprintf(content_encoding, sizeof(content_encoding), "%.*s", (int)sizeof(hdr->encoding) - 1, hdr->encoding);
+
+    // Decode it
+    r = http_io_decode(priv, block_num, content_encoding, hdr->hmac, &buf, hdr->length, dest, NULL, 0);
+
+    // Done
+    block_buf_free(buf);                // OK if NULL
+    return r;
+}
+
+/*
+ * Check whether the non-zero bitmap tells us the block is empty, and if so, zero "len" bytes of the destination buffer.
+ *
+ * Returns true if the block was empty.
+ */
+static int
+http_io_read_empty(struct http_io_private *priv, s3b_block_t block_num, void *dest, u_int len, u_char *actual_etag)
+{
+    // Any bitmap?
+    if (priv->non_zero == NULL)
+        return 0;
+
+    // Check bitmap
+    pthread_mutex_lock(&priv->mutex);
+    if (sbitmap_test(priv->non_zero, block_num)) {
         CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+        return 0;
     }
+    priv->stats.empty_blocks_read++;
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+
+    // Return zeros
+    memset(dest, 0, len);
+    if (actual_etag != NULL)
+        memset(actual_etag, 0, MD5_DIGEST_LENGTH);
+    return 1;
+}
+
+/*
+ * Prepare a block read request: allocate the receive buffer and set up the URL and headers.
+ *
+ * On failure, everything is cleaned up and an error is returned.
+ */
+static int
+http_io_read_start(struct http_io_private *priv, struct http_io_read_req *req, char *urlbuf, size_t urlbuf_size,
+  s3b_block_t block_num, void *dest, u_char *actual_etag, const u_char *expect_etag, int strict)
+{
+    struct http_io_conf *const config = priv->config;
+    struct http_io *const io = &req->io;
+    char accept_encoding[128];
+    const time_t now = time(NULL);
+    int i;
+    int r;
+
+    // Remember caller's parameters
+    req->dest = dest;
+    req->actual_etag = actual_etag;
+    req->expect_etag = expect_etag;
+    req->strict = strict;
+    req->scratch = NULL;
+    req->scratch_size = 0;
+    req->encodedp = NULL;
 
     // Initialize I/O info
-    http_io_init_io(priv, &io, HTTP_GET, urlbuf);
-    io.block_num = block_num;
+    http_io_init_io(priv, io, HTTP_GET, urlbuf);
+    io->block_num = block_num;
 
     // Allocate a buffer in case compressed and/or encrypted data is larger
-    io.buf_size = compressBound(config->block_size) + EVP_MAX_IV_LENGTH;
-    if ((io.dest = malloc(io.buf_size)) == NULL) {
+    io->buf_size = comp_bound(config->block_size) + EVP_MAX_IV_LENGTH;
+    if ((io->dest = block_buf_alloc(io->buf_size)) == NULL) {
         (*config->log)(LOG_ERR, "malloc: %s", strerror(errno));
         pthread_mutex_lock(&priv->mutex);
         priv->stats.out_of_memory_errors++;
@@ -1522,10 +2012,10 @@ http_io_read_block(struct s3backer_store *const s3b, s3b_block_t block_num, void
     }
 
     // Construct URL for this block
-    http_io_get_block_url(urlbuf, sizeof(urlbuf), config, block_num);
+    http_io_get_block_url(urlbuf, urlbuf_size, config, block_num);
 
     // Add Date header
-    http_io_add_date(priv, &io, now);
+    http_io_add_date(priv, io, now);
 
     // Add If-Match or If-None-Match header as required
     if (expect_etag != NULL && memcmp(expect_etag, zero_etag, MD5_DIGEST_LENGTH) != 0) {
@@ -1536,10 +2026,10 @@ http_io_read_block(struct s3backer_store *const s3b, s3b_block_t block_num, void
             header = IF_MATCH_HEADER;
         else {
             header = IF_NONE_MATCH_HEADER;
-            io.expect_304 = 1;
+            io->expect_304 = 1;
         }
         http_io_prhex(etagbuf, expect_etag, MD5_DIGEST_LENGTH);
-        io.headers = http_io_add_header(priv, io.headers, "%s: \"%s\"", header, etagbuf);
+        io->headers = http_io_add_header(priv, io->headers, "%s: \"%s\"", header, etagbuf);
     }
 
     // Set Accept-Encoding header
@@ -1557,48 +2047,169 @@ http_io_read_block(struct s3backer_store *const s3b, s3b_block_t block_num, void
         snvprintf(accept_encoding + strlen(accept_encoding), sizeof(accept_encoding) - strlen(accept_encoding),
           "%s-%s", CONTENT_ENCODING_ENCRYPT, config->encryption);
     }
-    io.headers = http_io_add_header(priv, io.headers, "%s: %s", ACCEPT_ENCODING_HEADER, accept_encoding);
+    io->headers = http_io_add_header(priv, io->headers, "%s: %s", ACCEPT_ENCODING_HEADER, accept_encoding);
 
     // Add Authorization header
-    if ((r = http_io_add_auth(priv, &io, now, NULL, 0)) != 0)
-        goto fail;
+    if ((r = http_io_add_auth(priv, io, now, NULL, 0)) != 0) {
+        block_buf_free(io->dest);
+        curl_slist_free_all(io->headers);
+        return r;
+    }
 
-    // Perform operation
-    r = http_io_perform_io(priv, &io, http_io_read_prepper);
+    // Done
+    return 0;
+}
+
+/*
+ * Complete a block read request after the HTTP operation has been performed with result "r":
+ * decode the response, copy it into the caller's buffer, and clean up.
+ */
+static int
+http_io_read_finish(struct http_io_private *priv, struct http_io_read_req *req, int r)
+{
+    struct http_io_conf *const config = priv->config;
+    struct http_io *const io = &req->io;
+    const s3b_block_t block_num = io->block_num;
+    const u_char *const expect_etag = req->expect_etag;
+    u_char *const actual_etag = req->actual_etag;
+    void *const dest = req->dest;
+    const int strict = req->strict;
+    u_int did_read;
 
     // Verify an ETag was provided by server if caller wants it
     if (r == 0 && actual_etag != NULL)
-        r = http_io_verify_etag_provided(&io);
+        r = http_io_verify_etag_provided(io);
 
     // Determine how many bytes we read
-    did_read = io.buf_size - io.bufs.rdremain;
+    did_read = io->buf_size - io->bufs.rdremain;
+
+    // Apply default Content-Encoding if none was given
+    if (*io->content_encoding == '\0' && config->default_ce != NULL)
+        snvprintf(io->content_encoding, sizeof(io->content_encoding), "%s", config->default_ce);
+
+    // Return the block still encoded if so requested and it fits, otherwise decode it
+    if (req->encodedp != NULL)
+        *req->encodedp = 0;
+    if (r == 0 && req->encodedp != NULL && *io->content_encoding != '\0'
+      && sizeof(struct encoded_header) + did_read <= config->block_size) {
+        struct encoded_header *const hdr = dest;
+
+        memset(hdr, 0, sizeof(*hdr));
+        hdr->length = did_read;
+        snvprintf(hdr->encoding, sizeof(hdr->encoding), "%s", io->content_encoding);
+        memcpy(hdr->hmac, io->hmac, sizeof(hdr->hmac));
+        memcpy(hdr + 1, io->dest, did_read);
+        memset((char *)(hdr + 1) + did_read, 0, config->block_size - sizeof(*hdr) - did_read);
+        *req->encodedp = 1;
+    } else if (r == 0)
+        r = http_io_decode(priv, block_num, io->content_encoding, io->hmac, &io->dest, did_read, dest, req->scratch, req->scratch_size);
 
-    // Check Content-Encoding and decode if necessary
-    if (*io.content_encoding == '\0' && config->default_ce != NULL)
-        snvprintf(io.content_encoding, sizeof(io.content_encoding), "%s", config->default_ce);
-    for ( ; r == 0 && *io.content_encoding != '\0'; *layer = '\0') {
-        const struct comp_alg *calg;
+    // Update stats
+    pthread_mutex_lock(&priv->mutex);
+    switch (r) {
+    case 0:
+        priv->stats.normal_blocks_read++;
+        break;
+    case ENOENT:
+        priv->stats.zero_blocks_read++;
+        break;
+    default:
+        break;
+    }
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
 
-        // Find next encoding layer, starting from the end and working backwards, trimming any whitespace
-        if ((layer = strrchr(io.content_encoding, ',')) != NULL)
-            *layer++ = '\0';
-        else
-            layer = io.content_encoding;
-        while (isspace(*layer))
-            layer++;
-        while (*layer != '\0' && isspace(layer[strlen(layer) - 1]))
-            layer[strlen(layer) - 1] = '\0';
+    // Check expected ETag
+    if (expect_etag != NULL) {
+        const int expected_not_found = memcmp(expect_etag, zero_etag, MD5_DIGEST_LENGTH) == 0;
 
-        // Sanity check
-        if (io.dest == NULL)
-            goto bad_encoding;
+        // Compare result with expectation
+        switch (r) {
+        case 0:
+            if (expected_not_found)
+                r = strict ? EIO : 0;
+            break;
+        case ENOENT:
+            if (expected_not_found)
+                r = strict ? 0 : EEXIST;
+            break;
+        default:
+            break;
+        }
 
-        // Check for encryption (which must have been applied after compression)
-        if (strncasecmp(layer, CONTENT_ENCODING_ENCRYPT "-", sizeof(CONTENT_ENCODING_ENCRYPT)) == 0) {
-            const char *const block_cipher = layer + sizeof(CONTENT_ENCODING_ENCRYPT);
-            u_char hmac[SHA_DIGEST_LENGTH];
-            u_int decrypt_buflen;
-            u_char *buf;
+        // Update stats
+        if (!strict) {
+            switch (r) {
+            case 0:
+                pthread_mutex_lock(&priv->mutex);
+                priv->stats.http_mismatch++;
+                CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+                break;
+            case EEXIST:
+                pthread_mutex_lock(&priv->mutex);
+                priv->stats.http_verified++;
+                CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    // Treat `404 Not Found' all zeros
+    if (r == ENOENT) {
+        memset(dest, 0, config->block_size);
+        r = 0;
+    }
+
+    // Copy actual ETag
+    if (actual_etag != NULL)
+        memcpy(actual_etag, io->etag, MD5_DIGEST_LENGTH);
+
+    //  Clean up
+    block_buf_free(io->dest);           // OK if NULL
+    curl_slist_free_all(io->headers);
+    return r;
+}
+
+/*
+ * Decode a block having the given Content-Encoding, which is modified in the process.
+ *
+ * The encoded data is in *bufp, which must be a buffer allocated by block_buf_alloc() with room for
+ * any decryption; it may be freed and set to NULL. The decoded block is written to "dest".
+ */
+static int
+http_io_decode(struct http_io_private *priv, s3b_block_t block_num, char *content_encoding, const u_char *sig,
+  void **bufp, u_int did_read, void *dest, u_char *scratch, size_t scratch_size)
+{
+    struct http_io_conf *const config = priv->config;
+    int encrypted = 0;
+    char *layer;
+    int r = 0;
+
+    // Decode each encoding layer
+    for ( ; r == 0 && *content_encoding != '\0'; *layer = '\0') {
+        const struct comp_alg *calg;
+
+        // Find next encoding layer, starting from the end and working backwards, trimming any whitespace
+        if ((layer = strrchr(content_encoding, ',')) != NULL)
+            *layer++ = '\0';
+        else
+            layer = content_encoding;
+        while (isspace(*layer))
+            layer++;
+        while (*layer != '\0' && isspace(layer[strlen(layer) - 1]))
+            layer[strlen(layer) - 1] = '\0';
+
+        // Sanity check
+        if (*bufp == NULL)
+            goto bad_encoding;
+
+        // Check for encryption (which must have been applied after compression)
+        if (strncasecmp(layer, CONTENT_ENCODING_ENCRYPT "-", sizeof(CONTENT_ENCODING_ENCRYPT)) == 0) {
+            const char *const block_cipher = layer + sizeof(CONTENT_ENCODING_ENCRYPT);
+            u_char hmac[SHA_DIGEST_LENGTH];
+            u_int decrypt_buflen;
+            u_char *buf;
 
             // Encryption must be enabled
             if (config->encryption == NULL) {
@@ -1617,23 +2228,25 @@ http_io_read_block(struct s3backer_store *const s3b, s3b_block_t block_num, void
             }
 
             // Verify block's signature
-            if (memcmp(io.hmac, zero_hmac, sizeof(io.hmac)) == 0) {
+            if (memcmp(sig, zero_hmac, SHA_DIGEST_LENGTH) == 0) {
                 (*config->log)(LOG_ERR, "block %0*jx is encrypted, but no signature was found",
                   S3B_BLOCK_NUM_DIGITS, (uintmax_t)block_num);
                 r = EIO;
                 break;
             }
-            http_io_authsig(priv, block_num, io.dest, did_read, hmac);
-            if (memcmp(io.hmac, hmac, sizeof(hmac)) != 0) {
+            http_io_authsig(priv, block_num, *bufp, did_read, hmac);
+            if (memcmp(sig, hmac, sizeof(hmac)) != 0) {
                 (*config->log)(LOG_ERR, "block %0*jx has an incorrect signature (did you provide the right password?)",
                   S3B_BLOCK_NUM_DIGITS, (uintmax_t)block_num);
                 r = EIO;
                 break;
             }
 
-            // Allocate buffer for the decrypted data
+            // Allocate buffer for the decrypted data, unless we have a big enough scratch buffer
             decrypt_buflen = did_read + EVP_MAX_IV_LENGTH;
-            if ((buf = malloc(decrypt_buflen)) == NULL) {
+            if (scratch != NULL && decrypt_buflen <= scratch_size)
+                buf = scratch;
+            else if ((buf = block_buf_alloc(decrypt_buflen)) == NULL) {
                 (*config->log)(LOG_ERR, "malloc: %s", strerror(errno));
                 pthread_mutex_lock(&priv->mutex);
                 priv->stats.out_of_memory_errors++;
@@ -1643,9 +2256,10 @@ http_io_read_block(struct s3backer_store *const s3b, s3b_block_t block_num, void
             }
 
             // Decrypt the block
-            did_read = http_io_crypt(priv, block_num, 0, io.dest, did_read, buf, decrypt_buflen);
-            memcpy(io.dest, buf, did_read);
-            free(buf);
+            did_read = http_io_crypt(priv, block_num, 0, *bufp, did_read, buf, decrypt_buflen);
+            memcpy(*bufp, buf, did_read);
+            if (buf != scratch)
+                block_buf_free(buf);
 
             // Proceed
             encrypted = 1;
@@ -1656,7 +2270,7 @@ http_io_read_block(struct s3backer_store *const s3b, s3b_block_t block_num, void
         if ((calg = comp_find(layer)) != NULL) {
             size_t uclen = config->block_size;
 
-            if ((r = (*calg->dfunc)(config->log, io.dest, did_read, dest, &uclen)) != 0)  {
+            if ((r = (*calg->dfunc)(config->log, *bufp, did_read, dest, &uclen)) != 0)  {
                 if (r == ENOMEM) {
                     pthread_mutex_lock(&priv->mutex);
                     priv->stats.out_of_memory_errors++;
@@ -1667,8 +2281,8 @@ http_io_read_block(struct s3backer_store *const s3b, s3b_block_t block_num, void
 
             // Update data
             did_read = uclen;
-            free(io.dest);
-            io.dest = NULL;         // compression should have been first, so decompression should always be last
+            block_buf_free(*bufp);
+            *bufp = NULL;         // compression should have been first, so decompression should always be last
 
             // Proceed
             continue;
@@ -1696,75 +2310,10 @@ bad_encoding:
     }
 
     // Copy the data to the desination buffer (if we haven't already)
-    if (r == 0 && io.dest != NULL)
-        memcpy(dest, io.dest, config->block_size);
-
-    // Update stats
-    pthread_mutex_lock(&priv->mutex);
-    switch (r) {
-    case 0:
-        priv->stats.normal_blocks_read++;
-        break;
-    case ENOENT:
-        priv->stats.zero_blocks_read++;
-        break;
-    default:
-        break;
-    }
-    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
-
-    // Check expected ETag
-    if (expect_etag != NULL) {
-        const int expected_not_found = memcmp(expect_etag, zero_etag, MD5_DIGEST_LENGTH) == 0;
-
-        // Compare result with expectation
-        switch (r) {
-        case 0:
-            if (expected_not_found)
-                r = strict ? EIO : 0;
-            break;
-        case ENOENT:
-            if (expected_not_found)
-                r = strict ? 0 : EEXIST;
-            break;
-        default:
-            break;
-        }
-
-        // Update stats
-        if (!strict) {
-            switch (r) {
-            case 0:
-                pthread_mutex_lock(&priv->mutex);
-                priv->stats.http_mismatch++;
-                CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
-                break;
-            case EEXIST:
-                pthread_mutex_lock(&priv->mutex);
-                priv->stats.http_verified++;
-                CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
-                break;
-            default:
-                break;
-            }
-        }
-    }
-
-    // Treat `404 Not Found' all zeros
-    if (r == ENOENT) {
-        memset(dest, 0, config->block_size);
-        r = 0;
-    }
-
-    // Copy actual ETag
-    if (actual_etag != NULL)
-        memcpy(actual_etag, io.etag, MD5_DIGEST_LENGTH);
+    if (r == 0 && *bufp != NULL)
+        memcpy(dest, *bufp, config->block_size);
 
-fail:
-    //  Clean up
-    if (io.dest != NULL)
-        free(io.dest);
-    curl_slist_free_all(io.headers);
+    // Done
     return r;
 }
 
@@ -1786,188 +2335,401 @@ http_io_read_prepper(CURL *curl, struct http_io *io)
 }
 
 /*
- * Write block if src != NULL, otherwise delete block.
+ * Read part of a block using an HTTP range request.
+ *
+ * This is only used when we don't encode blocks, but the block could still have been written with compression or
+ * encryption enabled; if the response indicates that, we fall back to reading (and decoding) the whole block.
  */
 static int
-http_io_write_block(struct s3backer_store *const s3b, s3b_block_t block_num, const void *src, u_char *caller_etag,
-  check_cancel_t *check_cancel, void *check_cancel_arg)
+http_io_read_block_part(struct s3backer_store *const s3b, s3b_block_t block_num, u_int off, u_int len, void *dest)
 {
     struct http_io_private *const priv = s3b->data;
     struct http_io_conf *const config = priv->config;
     char urlbuf[URL_BUF_SIZE(config)];
-    char hmacbuf[SHA_DIGEST_LENGTH * 2 + 1];
-    u_char hmac[SHA_DIGEST_LENGTH];
-    u_char md5[MD5_DIGEST_LENGTH];
     const time_t now = time(NULL);
-    void *encoded_buf = NULL;
     struct http_io io;
-    int compressed = 0;
-    int encrypted = 0;
+    u_int did_read;
+    void *buf;
     int r;
 
     // Sanity check
-    if (config->block_size == 0 || block_num >= config->num_blocks)
+    if (config->block_size == 0 || block_num >= config->num_blocks || len == 0 || off + len > config->block_size)
         return EINVAL;
 
-    // Detect zero blocks (if not done already by upper layer)
-    if (src != NULL && block_is_zeros(src))
-        src = NULL;
+    // Read zero blocks when bitmap indicates empty until non-zero content is written
+    if (http_io_read_empty(priv, block_num, dest, len, NULL))
+        return 0;
 
-    // Don't write zero blocks when bitmap indicates empty until non-zero content is written
-    if (priv->non_zero != NULL) {
+    // Initialize I/O info
+    http_io_init_io(priv, &io, HTTP_GET, urlbuf);
+    io.block_num = block_num;
+
+    // Allocate a buffer big enough for the whole block, in case the server ignores our range
+    io.buf_size = config->block_size;
+    if ((io.dest = block_buf_alloc(io.buf_size)) == NULL) {
+        (*config->log)(LOG_ERR, "malloc: %s", strerror(errno));
         pthread_mutex_lock(&priv->mutex);
-        if (src == NULL) {
-            if (!bitmap_test(priv->non_zero, block_num)) {
-                priv->stats.empty_blocks_written++;
-                CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
-                if (caller_etag != NULL)
-                    memset(caller_etag, 0, MD5_DIGEST_LENGTH);
-                return 0;
-            }
-        } else
-            bitmap_set(priv->non_zero, block_num, 1);
+        priv->stats.out_of_memory_errors++;
         CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+        return ENOMEM;
     }
 
-    // Initialize I/O info
-    http_io_init_io(priv, &io, src != NULL ? HTTP_PUT : HTTP_DELETE, urlbuf);
-    io.src = src;
-    io.buf_size = config->block_size;
-    io.block_num = block_num;
-    io.check_cancel = check_cancel;
-    io.check_cancel_arg = check_cancel_arg;
-
-    // Compress block if desired
-    if (src != NULL && config->compress_alg != NULL) {
-        size_t compress_len;
+    // Construct URL for this block
+    http_io_get_block_url(urlbuf, sizeof(urlbuf), config, block_num);
 
-        // Compress data
-        if ((r = (*config->compress_alg->cfunc)(config->log, io.src,
-          io.buf_size, &encoded_buf, &compress_len, config->compress_level)) != 0) {
-            if (r == ENOMEM) {
-                pthread_mutex_lock(&priv->mutex);
-                priv->stats.out_of_memory_errors++;
-                CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
-            }
-            goto fail;
-        }
+    // Add Date and Range headers
+    http_io_add_date(priv, &io, now);
+    io.headers = http_io_add_header(priv, io.headers, "%s: bytes=%u-%u", RANGE_HEADER, off, off + len - 1);
 
-        // Update POST data
-        io.src = encoded_buf;
-        io.buf_size = compress_len;
-        compressed = 1;
-    }
+    // Add Authorization header
+    if ((r = http_io_add_auth(priv, &io, now, NULL, 0)) != 0)
+        goto done;
 
-    // Encrypt data if desired
-    if (src != NULL && config->encryption != NULL) {
-        void *encrypt_buf;
-        u_int encrypt_len;
-        u_int encrypt_buflen;
+    // Perform operation
+    io.hedge = 1;
+    r = http_io_perform_io(priv, &io, http_io_read_prepper);
+    did_read = io.buf_size - io.bufs.rdremain;
 
-        // Allocate buffer
-        encrypt_buflen = io.buf_size + EVP_MAX_IV_LENGTH;
-        if ((encrypt_buf = malloc(encrypt_buflen)) == NULL) {
-            (*config->log)(LOG_ERR, "malloc: %s", strerror(errno));
-            pthread_mutex_lock(&priv->mutex);
-            priv->stats.out_of_memory_errors++;
-            CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+    // If the block is encoded, we have to read the whole thing
+    if (r == 0 && *io.content_encoding != '\0') {
+        if ((buf = block_buf_alloc(config->block_size)) == NULL) {
             r = ENOMEM;
-            goto fail;
+            goto done;
         }
-
-        // Encrypt the block
-        encrypt_len = http_io_crypt(priv, block_num, 1, io.src, io.buf_size, encrypt_buf, encrypt_buflen);
-
-        // Compute block signature
-        http_io_authsig(priv, block_num, encrypt_buf, encrypt_len, hmac);
-        http_io_prhex(hmacbuf, hmac, SHA_DIGEST_LENGTH);
-
-        // Update POST data
-        io.src = encrypt_buf;
-        io.buf_size = encrypt_len;
-        free(encoded_buf);              // OK if NULL
-        encoded_buf = encrypt_buf;
-        encrypted = 1;
+        if ((r = http_io_read_block(s3b, block_num, buf, NULL, NULL, 0)) == 0)
+            memcpy(dest, (char *)buf + off, len);
+        block_buf_free(buf);
+        goto done;
     }
 
-    // Set Content-Encoding HTTP header
-    if (compressed || encrypted) {
-        char ebuf[128];
-
-        snvprintf(ebuf, sizeof(ebuf), "%s: ", CONTENT_ENCODING_HEADER);
-        if (compressed)
-            snvprintf(ebuf + strlen(ebuf), sizeof(ebuf) - strlen(ebuf), "%s", config->compress_alg->name);
-        if (encrypted) {
-            snvprintf(ebuf + strlen(ebuf), sizeof(ebuf) - strlen(ebuf), "%s%s-%s",
-              compressed ? ", " : "", CONTENT_ENCODING_ENCRYPT, config->encryption);
+    // Copy out the data; a full length response means the server ignored the range
+    switch (r) {
+    case 0:
+        if (did_read == len)
+            memcpy(dest, io.dest, len);
+        else if (did_read == config->block_size)
+            memcpy(dest, (char *)io.dest + off, len);
+        else {
+            (*config->log)(LOG_ERR, "range read of block %0*jx returned %lu != %lu bytes",
+              S3B_BLOCK_NUM_DIGITS, (uintmax_t)block_num, (u_long)did_read, (u_long)len);
+            r = EIO;
         }
-        io.headers = http_io_add_header(priv, io.headers, "%s", ebuf);
+        break;
+    case ENOENT:                        // treat `404 Not Found' all zeros
+        memset(dest, 0, len);
+        break;
+    default:
+        break;
     }
 
-    // Compute MD5 checksum
-    if (src != NULL)
-        md5_quick(io.src, io.buf_size, md5);
-    else
-        memset(md5, 0, MD5_DIGEST_LENGTH);
+    // Update stats
+    pthread_mutex_lock(&priv->mutex);
+    switch (r) {
+    case 0:
+        priv->stats.partial_blocks_read++;
+        break;
+    case ENOENT:
+        priv->stats.zero_blocks_read++;
+        r = 0;
+        break;
+    default:
+        break;
+    }
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
 
-    // Construct URL for this block
-    http_io_get_block_url(urlbuf, sizeof(urlbuf), config, block_num);
+done:
+    //  Clean up
+    block_buf_free(io.dest);
+    curl_slist_free_all(io.headers);
+    return r;
+}
 
-    // Add Date header
-    http_io_add_date(priv, &io, now);
+/*
+ * Read or write multiple blocks. If the asynchronous I/O engine is running, all of the requests are
+ * handed to it at once; otherwise, we issue up to "io_threads" concurrent requests using blocking threads.
+ */
+static int
+http_io_read_blocks(struct s3backer_store *const s3b, s3b_block_t block_num, u_int num_blocks, void *dest)
+{
+    struct http_io_private *const priv = s3b->data;
+    struct http_io_conf *const config = priv->config;
 
-    // Add PUT-only headers
-    if (src != NULL) {
-        char md5buf[(MD5_DIGEST_LENGTH * 4) / 3 + 4];
+    if (priv->loops != NULL)
+        return http_io_async_read_blocks(priv, block_num, num_blocks, dest);
+    return parallel_read_blocks(s3b, config->block_size, config->io_threads, block_num, num_blocks, dest);
+}
+
+static int
+http_io_write_blocks(struct s3backer_store *const s3b, s3b_block_t block_num, u_int num_blocks, const void *src,
+  u_char *etags, check_cancel_t *check_cancel, void *check_cancel_arg)
+{
+    struct http_io_private *const priv = s3b->data;
+    struct http_io_conf *const config = priv->config;
+
+    if (priv->loops != NULL)
+        return http_io_async_write_blocks(priv, block_num, num_blocks, src, etags, check_cancel, check_cancel_arg);
+    return parallel_write_blocks(s3b, config->block_size, config->io_threads, block_num, num_blocks, src, etags,
+      check_cancel, check_cancel_arg);
+}
+
+/*
+ * Write block if src != NULL, otherwise delete block.
+ */
+static int
+http_io_write_block(struct s3backer_store *const s3b, s3b_block_t block_num, const void *src, u_char *caller_etag,
+  check_cancel_t *check_cancel, void *check_cancel_arg)
+{
+    struct http_io_private *const priv = s3b->data;
+    struct http_io_conf *const config = priv->config;
+    char urlbuf[URL_BUF_SIZE(config)];
+    struct http_io_write_req req;
+    int r;
+
+    // Sanity check
+    if (config->block_size == 0 || block_num >= config->num_blocks)
+        return EINVAL;
+
+    // If there are transform threads, let them do the encoding and hand the upload to the event loops
+    if (priv->xforms != NULL)
+        return http_io_async_write_blocks(priv, block_num, 1, src, caller_etag, check_cancel, check_cancel_arg);
+
+    // Detect zero blocks (if not done already by upper layer)
+    if (src != NULL && block_is_zeros(src))
+        src = NULL;
+
+    // Don't write zero blocks when bitmap indicates empty until non-zero content is written
+    if (http_io_write_empty(priv, block_num, src, caller_etag))
+        return 0;
+
+    // Prepare request
+    if ((r = http_io_write_start(priv, &req, urlbuf, sizeof(urlbuf), block_num, src, caller_etag,
+      check_cancel, check_cancel_arg)) != 0)
+        return r;
+
+    // Perform operation
+    r = http_io_perform_io(priv, &req.io, http_io_write_prepper);
+
+    // Process the response
+    return http_io_write_finish(priv, &req, r);
+}
+
+/*
+ * Update the non-zero bitmap, if any, for a block about to be written, and check whether
+ * the block is already known to be empty and is being zeroed, in which case nothing needs to be done.
+ *
+ * Returns true if the write can be skipped.
+ */
+static int
+http_io_write_empty(struct http_io_private *priv, s3b_block_t block_num, const void *src, u_char *caller_etag)
+{
+    // Any bitmap?
+    if (priv->non_zero == NULL)
+        return 0;
+
+    // Check/update bitmap
+    pthread_mutex_lock(&priv->mutex);
+    if (src == NULL) {
+        if (!sbitmap_test(priv->non_zero, block_num)) {
+            priv->stats.empty_blocks_written++;
+            CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+            if (caller_etag != NULL)
+                memset(caller_etag, 0, MD5_DIGEST_LENGTH);
+            return 1;
+        }
+    } else
+        sbitmap_set(priv->non_zero, block_num, 1);
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+    return 0;
+}
+
+/*
+ * Prepare a block write request: encode the data and set up the URL and headers.
+ *
+ * On failure, everything is cleaned up and an error is returned.
+ */
+static int
+http_io_write_start(struct http_io_private *priv, struct http_io_write_req *req, char *urlbuf, size_t urlbuf_size,
+  s3b_block_t block_num, const void *src, u_char *caller_etag, check_cancel_t *check_cancel, void *check_cancel_arg)
+{
+    struct http_io_conf *const config = priv->config;
+    struct http_io *const io = &req->io;
+    char hmacbuf[SHA_DIGEST_LENGTH * 2 + 1];
+    u_char hmac[SHA_DIGEST_LENGTH];
+    u_char md5[MD5_DIGEST_LENGTH];
+    u_char sha256[SHA256_DIGEST_LENGTH];
+    const time_t now = time(NULL);
+    int compressed = 0;
+    int encrypted = 0;
+    int r;
+
+    // Remember caller's parameters
+    req->src = src;
+    req->caller_etag = caller_etag;
+    req->encoded_buf = NULL;
+
+    // Initialize I/O info
+    http_io_init_io(priv, io, src != NULL ? HTTP_PUT : HTTP_DELETE, urlbuf);
+    io->src = src;
+    io->buf_size = config->block_size;
+    io->block_num = block_num;
+    io->check_cancel = check_cancel;
+    io->check_cancel_arg = check_cancel_arg;
+
+    // Compress block if desired
+    if (src != NULL && config->compress_alg != NULL) {
+        size_t compress_len;
+
+        // Compress data
+        if ((r = (*config->compress_alg->cfunc)(config->log, io->src,
+          io->buf_size, &req->encoded_buf, &compress_len, config->compress_level)) != 0) {
+            if (r == ENOMEM) {
+                pthread_mutex_lock(&priv->mutex);
+                priv->stats.out_of_memory_errors++;
+                CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+            }
+            goto fail;
+        }
+
+        // Update POST data
+        io->src = req->encoded_buf;
+        io->buf_size = compress_len;
+        compressed = 1;
+    }
+
+    // Encrypt data if desired
+    if (src != NULL && config->encryption != NULL) {
+        void *encrypt_buf;
+        u_int encrypt_len;
+        u_int encrypt_buflen;
+
+        // Allocate buffer
+        encrypt_buflen = io->buf_size + EVP_MAX_IV_LENGTH;
+        if ((encrypt_buf = block_buf_alloc(encrypt_buflen)) == NULL) {
+            (*config->log)(LOG_ERR, "malloc: %s", strerror(errno));
+            pthread_mutex_lock(&priv->mutex);
+            priv->stats.out_of_memory_errors++;
+            CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+            r = ENOMEM;
+            goto fail;
+        }
+
+        // Encrypt the block
+        encrypt_len = http_io_crypt(priv, block_num, 1, io->src, io->buf_size, encrypt_buf, encrypt_buflen);
+
+        // Compute block signature
+        http_io_authsig(priv, block_num, encrypt_buf, encrypt_len, hmac);
+        http_io_prhex(hmacbuf, hmac, SHA_DIGEST_LENGTH);
+
+        // Update POST data
+        io->src = encrypt_buf;
+        io->buf_size = encrypt_len;
+        block_buf_free(req->encoded_buf);   // OK if NULL
+        req->encoded_buf = encrypt_buf;
+        encrypted = 1;
+    }
+
+    // Set Content-Encoding HTTP header
+    if (compressed || encrypted) {
+        char ebuf[128];
+
+        snvprintf(ebuf, sizeof(ebuf), "%s: ", CONTENT_ENCODING_HEADER);
+        if (compressed)
+            snvprintf(ebuf + strlen(ebuf), sizeof(ebuf) - strlen(ebuf), "%s", config->compress_alg->name);
+        if (encrypted) {
+            snvprintf(ebuf + strlen(ebuf), sizeof(ebuf) - strlen(ebuf), "%s%s-%s",
+              compressed ? ", " : "", CONTENT_ENCODING_ENCRYPT, config->encryption);
+        }
+        io->headers = http_io_add_header(priv, io->headers, "%s", ebuf);
+    }
+
+    // Compute MD5 checksum, and the SHA-256 payload hash at the same time if it will be needed
+    if (src != NULL) {
+        const int need_sha256 = config->accessId != NULL
+          && strcmp(config->authVersion, AUTH_VERSION_AWS4) == 0 && !config->unsigned_payload;
+
+        http_io_hash_payload(io->src, io->buf_size, md5, need_sha256 ? sha256 : NULL);
+        if (need_sha256)
+            io->payload_sha256 = sha256;
+    } else
+        memset(md5, 0, MD5_DIGEST_LENGTH);
+
+    // Construct URL for this block
+    http_io_get_block_url(urlbuf, urlbuf_size, config, block_num);
+
+    // Add Date header
+    http_io_add_date(priv, io, now);
+
+    // Add PUT-only headers
+    if (src != NULL) {
+        char md5buf[(MD5_DIGEST_LENGTH * 4) / 3 + 4];
 
         // Add Content-Type header
-        io.headers = http_io_add_header(priv, io.headers, "%s: %s", CTYPE_HEADER, CONTENT_TYPE);
+        io->headers = http_io_add_header(priv, io->headers, "%s: %s", CTYPE_HEADER, CONTENT_TYPE);
 
         // Add Content-MD5 header
         http_io_base64_encode(md5buf, sizeof(md5buf), md5, MD5_DIGEST_LENGTH);
-        io.headers = http_io_add_header(priv, io.headers, "%s: %s", MD5_HEADER, md5buf);
+        io->headers = http_io_add_header(priv, io->headers, "%s: %s", MD5_HEADER, md5buf);
     }
 
     // Add ACL header (PUT only)
     if (src != NULL)
-        io.headers = http_io_add_header(priv, io.headers, "%s: %s", ACL_HEADER, config->accessType);
+        io->headers = http_io_add_header(priv, io->headers, "%s: %s", ACL_HEADER, config->accessType);
 
     // Add file size meta-data to zero'th block
     if (src != NULL && block_num == 0) {
-        io.headers = http_io_add_header(priv, io.headers, "%s: %u", BLOCK_SIZE_HEADER, config->block_size);
-        io.headers = http_io_add_header(priv, io.headers, "%s: %ju",
-          FILE_SIZE_HEADER, (uintmax_t)config->block_size * (uintmax_t)config->num_blocks);
+        io->headers = http_io_add_header(priv, io->headers, "%s: %u", BLOCK_SIZE_HEADER, config->block_size);
+        io->headers = http_io_add_header(priv, io->headers, "%s: %ju",
+          FILE_SIZE_HEADER, (uintmax_t)config->block_size * (uintmax_t)config->file_blocks);
     }
 
     // Add signature header (if encrypting)
     if (src != NULL && config->encryption != NULL)
-        io.headers = http_io_add_header(priv, io.headers, "%s: \"%s\"", HMAC_HEADER, hmacbuf);
+        io->headers = http_io_add_header(priv, io->headers, "%s: \"%s\"", HMAC_HEADER, hmacbuf);
 
     // Add Server Side Encryption header(s) (if needed)
     if (config->sse != NULL && src != NULL) {
-        io.headers = http_io_add_header(priv, io.headers, "%s: %s", SSE_HEADER, config->sse);
+        io->headers = http_io_add_header(priv, io->headers, "%s: %s", SSE_HEADER, config->sse);
         if (strcmp(config->sse, SSE_AWS_KMS) == 0)
-            io.headers = http_io_add_header(priv, io.headers, "%s: %s", SSE_KEY_ID_HEADER, config->sse_key_id);
+            io->headers = http_io_add_header(priv, io->headers, "%s: %s", SSE_KEY_ID_HEADER, config->sse_key_id);
     }
 
     // Add storage class header (if needed)
     if (config->storage_class != NULL)
-        io.headers = http_io_add_header(priv, io.headers, "%s: %s", STORAGE_CLASS_HEADER, config->storage_class);
+        io->headers = http_io_add_header(priv, io->headers, "%s: %s", STORAGE_CLASS_HEADER, config->storage_class);
 
     // Add Authorization header
-    if ((r = http_io_add_auth(priv, &io, now, io.src, io.buf_size)) != 0)
+    r = http_io_add_auth(priv, io, now, io->src, io->buf_size);
+    io->payload_sha256 = NULL;
+    if (r != 0)
         goto fail;
 
-    // Perform operation
-    r = http_io_perform_io(priv, &io, http_io_write_prepper);
+    // Done
+    return 0;
+
+fail:
+    //  Clean up
+    curl_slist_free_all(io->headers);
+    block_buf_free(req->encoded_buf);   // OK if NULL
+    return r;
+}
+
+/*
+ * Complete a block write request after the HTTP operation has been performed with result "r".
+ */
+static int
+http_io_write_finish(struct http_io_private *priv, struct http_io_write_req *req, int r)
+{
+    struct http_io *const io = &req->io;
+    u_char *const caller_etag = req->caller_etag;
+    const void *const src = req->src;
 
     // Verify ETag was provided by server if we did a PUT and caller wants it
     if (r == 0 && caller_etag != NULL && src != NULL)
-        r = http_io_verify_etag_provided(&io);
+        r = http_io_verify_etag_provided(io);
 
     // Report ETag back to caller if requested
     if (r == 0 && caller_etag != NULL)
-        memcpy(caller_etag, src != NULL ? io.etag : zero_etag, MD5_DIGEST_LENGTH);
+        memcpy(caller_etag, src != NULL ? io->etag : zero_etag, MD5_DIGEST_LENGTH);
 
     // Update stats
     if (r == 0) {
@@ -1979,11 +2741,9 @@ http_io_write_block(struct s3backer_store *const s3b, s3b_block_t block_num, con
         CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
     }
 
-fail:
     //  Clean up
-    curl_slist_free_all(io.headers);
-    if (encoded_buf != NULL)
-        free(encoded_buf);
+    curl_slist_free_all(io->headers);
+    block_buf_free(req->encoded_buf);   // OK if NULL
     return r;
 }
 
@@ -2020,57 +2780,185 @@ http_io_write_prepper(CURL *curl, struct http_io *io)
     http_io_curl_header_reset(io);
 }
 
+/*
+ * Delete blocks using DeleteObjects requests of up to DELETE_BLOCKS_CHUNK keys each, with up to
+ * "io_threads" requests in flight at once.
+ *
+ * Blocks that the non-zero bitmap (if any) says don't exist are left out.
+ */
 static int
 http_io_bulk_zero(struct s3backer_store *const s3b, const s3b_block_t *block_nums, u_int num_blocks)
 {
     struct http_io_private *const priv = s3b->data;
     struct http_io_conf *const config = priv->config;
+    struct http_io_bulk_delete state;
+    s3b_block_t *edited_block_nums = NULL;
+    pthread_t *threads = NULL;
+    u_int num_threads;
+    u_int max_threads;
+    u_int i;
+    int r;
+
+    // Filter out blocks we know don't exist
+    if (priv->non_zero != NULL) {
+        u_int edited_num_blocks = 0;
+
+        if ((edited_block_nums = malloc(num_blocks * sizeof(*edited_block_nums))) == NULL) {
+            r = errno;
+            (*config->log)(LOG_ERR, "malloc: %s", strerror(r));
+            return r;
+        }
+        pthread_mutex_lock(&priv->mutex);
+        for (i = 0; i < num_blocks; i++) {
+            if (sbitmap_test(priv->non_zero, block_nums[i]))
+                edited_block_nums[edited_num_blocks++] = block_nums[i];
+            else
+                priv->stats.empty_blocks_written++;
+        }
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+        block_nums = edited_block_nums;
+        num_blocks = edited_num_blocks;
+    }
+
+    // Initialize state
+    memset(&state, 0, sizeof(state));
+    state.priv = priv;
+    state.block_nums = block_nums;
+    state.num_blocks = num_blocks;
+    if ((r = pthread_mutex_init(&state.mutex, NULL)) != 0)
+        goto fail0;
+
+    // Start additional threads if there is more than one chunk; the calling thread is always one of the workers
+    max_threads = (num_blocks + DELETE_BLOCKS_CHUNK - 1) / DELETE_BLOCKS_CHUNK;
+    if (max_threads > config->io_threads)
+        max_threads = config->io_threads;
+    num_threads = 0;
+    if (max_threads > 1) {
+        if ((threads = malloc((max_threads - 1) * sizeof(*threads))) == NULL) {
+            r = errno;
+            (*config->log)(LOG_ERR, "malloc: %s", strerror(r));
+            goto fail1;
+        }
+        while (num_threads < max_threads - 1) {
+            if ((r = pthread_create(&threads[num_threads], NULL, http_io_bulk_delete_main, &state)) != 0) {
+                (*config->log)(LOG_ERR, "pthread_create: %s", strerror(r));
+                break;                                  // just proceed with the threads we have
+            }
+            num_threads++;
+        }
+    }
+
+    // Do our share of the work, then wait for the other threads to finish
+    http_io_bulk_delete_main(&state);
+    while (num_threads > 0) {
+        if ((r = pthread_join(threads[--num_threads], NULL)) != 0)
+            (*config->log)(LOG_ERR, "pthread_join: %s", strerror(r));
+    }
+    r = state.error;
+
+    // Done
+    free(threads);
+fail1:
+    pthread_mutex_destroy(&state.mutex);
+fail0:
+    free(edited_block_nums);
+    return r;
+}
+
+/*
+ * Bulk delete worker: claim and delete chunks of blocks until there are none left or there is an error.
+ */
+static void *
+http_io_bulk_delete_main(void *arg)
+{
+    struct http_io_bulk_delete *const state = arg;
+    const s3b_block_t *block_nums;
+    u_int count;
+    int r;
+
+    pthread_mutex_lock(&state->mutex);
+    while (state->num_blocks > 0 && state->error == 0) {
+
+        // Claim the next chunk
+        block_nums = state->block_nums;
+        count = state->num_blocks <= DELETE_BLOCKS_CHUNK ? state->num_blocks : DELETE_BLOCKS_CHUNK;
+        state->block_nums += count;
+        state->num_blocks -= count;
+        CHECK_RETURN(pthread_mutex_unlock(&state->mutex));
+
+        // Delete it
+        r = http_io_bulk_delete_chunk(state->priv, block_nums, count);
+
+        // Record any error
+        pthread_mutex_lock(&state->mutex);
+        if (r != 0 && state->error == 0)
+            state->error = r;
+    }
+    CHECK_RETURN(pthread_mutex_unlock(&state->mutex));
+    return NULL;
+}
+
+/*
+ * Delete up to DELETE_BLOCKS_CHUNK blocks using a single DeleteObjects request.
+ *
+ * The request as a whole is retried like any other. In addition, if only some of the keys fail with
+ * a transient error, just those keys are retried (in a new request), using the same backoff schedule.
+ */
+static int
+http_io_bulk_delete_chunk(struct http_io_private *priv, const s3b_block_t *block_nums, u_int num_blocks)
+{
+    struct http_io_conf *const config = priv->config;
+    s3b_block_t retry_list[DELETE_BLOCKS_CHUNK];
     char urlbuf[URL_BUF_SIZE(config)];
+    struct timespec delay;
     size_t max_object_name;
+    size_t max_object_elem;
+    size_t max_payload;
+    size_t payload_len;
+    u_int retry_pause = 0;
+    u_int total_pause = 0;
     struct http_io io;
-    char *buf = NULL;
+    char *buf;
+    u_int i;
     int r;
 
+    // Sanity check
+    assert(num_blocks <= DELETE_BLOCKS_CHUNK);
+
     // Set URL
     snvprintf(urlbuf, sizeof(urlbuf), "%s?delete", config->vhostURL);
 
     // Initialize XML query
     if ((r = http_io_xml_io_init(priv, &io, HTTP_POST, urlbuf)) != 0)
         return r;
+    io.block_list = retry_list;
 
     // Calculate the maximum length of one object name
     max_object_name = strlen(config->prefix) + S3B_BLOCK_NUM_DIGITS
       + strlen(BLOCK_HASH_PREFIX_SEPARATOR) + S3B_BLOCK_NUM_DIGITS + 1;           // [PREFIX]([HASH][SEPARATOR])?[BLOCK]
 
-    // Delete blocks in chunks of DELETE_BLOCKS_CHUNK
-    while (num_blocks > 0) {
-        const int count = num_blocks <= DELETE_BLOCKS_CHUNK ? num_blocks : DELETE_BLOCKS_CHUNK;
-        size_t max_object_elem;
-        size_t max_payload;
-        size_t payload_len;
-        char *new_buf;
-        u_int i;
-
-        // Calculate upper bound on size of query payload
-        max_object_elem = strlen(DELETE_ELEM_OBJECT) + 2                                            // <Object>
-          + strlen(DELETE_ELEM_KEY) + 2 + max_object_name + strlen(DELETE_ELEM_KEY) + 3             //   <Key>xxx</Key>
-          + strlen(DELETE_ELEM_OBJECT) + 3;                                                         // </Object>
-        max_payload = strlen(DELETE_ELEM_DELETE) + 2                                                // <Delete>
-          + (count * max_object_elem)                                                               //   <Object>...
-          + strlen(DELETE_ELEM_DELETE) + 3                                                          // </Delete>
-          + 2;                                                                                      // nul byte, plus one extra
+    // Calculate upper bound on size of query payload
+    max_object_elem = strlen(DELETE_ELEM_OBJECT) + 2                                            // <Object>
+      + strlen(DELETE_ELEM_KEY) + 2 + max_object_name + strlen(DELETE_ELEM_KEY) + 3             //   <Key>xxx</Key>
+      + strlen(DELETE_ELEM_OBJECT) + 3;                                                         // </Object>
+    max_payload = strlen(DELETE_ELEM_DELETE) + 2                                                // <Delete>
+      + (num_blocks * max_object_elem)                                                          //   <Object>...
+      + strlen(DELETE_ELEM_DELETE) + 3                                                          // </Delete>
+      + 2;                                                                                      // nul byte, plus one extra
+
+    // Allocate buffer
+    if ((buf = malloc(max_payload)) == NULL) {
+        r = errno;
+        (*config->log)(LOG_ERR, "malloc: %s", strerror(r));
+        goto done;
+    }
 
-        // Allocate buffer
-        if ((new_buf = realloc(buf, max_payload)) == NULL) {
-            r = errno;
-            (*config->log)(LOG_ERR, "realloc: %s", strerror(r));
-            break;
-        }
-        buf = new_buf;
+    // Delete blocks, then retry any keys that failed with a transient error
+    while (1) {
 
         // Build XML payload
         payload_len = snvprintf(buf, max_payload, "<%s>", DELETE_ELEM_DELETE);
-        for (i = 0; i < count; i++) {
+        for (i = 0; i < num_blocks; i++) {
             const s3b_block_t block_num = block_nums[i];
             char block_hash_buf[S3B_BLOCK_NUM_DIGITS + strlen(BLOCK_HASH_PREFIX_SEPARATOR) + 1];
             char object_buf[max_object_name + 1];
@@ -2088,14 +2976,38 @@ http_io_bulk_zero(struct s3backer_store *const s3b, const s3b_block_t *block_num
         io.bufs.wrremain = payload_len;
 
         // Perform operation
+        io.num_blocks = 0;
         if ((r = http_io_xml_io_exec(priv, &io, http_io_bulk_delete_elem_end)) != 0)
             break;
 
-        // Advance
-        block_nums += count;
-        num_blocks -= count;
+        // Any keys to retry?
+        if (io.num_blocks == 0)
+            break;
+
+        // Retry with exponential backoff up to max total pause limit
+        if (total_pause >= config->max_retry_pause) {
+            (*config->log)(LOG_ERR, "giving up on bulk delete of %u block(s)", io.num_blocks);
+            r = EIO;
+            break;
+        }
+        retry_pause = retry_pause > 0 ? retry_pause * 2 : config->initial_retry_pause;
+        if (total_pause + retry_pause > config->max_retry_pause)
+            retry_pause = config->max_retry_pause - total_pause;
+        total_pause += retry_pause;
+        pthread_mutex_lock(&priv->mutex);
+        priv->stats.num_retries++;
+        priv->stats.retry_delay += retry_pause;
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+        delay.tv_sec = retry_pause / 1000;
+        delay.tv_nsec = (retry_pause % 1000) * 1000000;
+        nanosleep(&delay, NULL);
+
+        // The keys to retry become the new block list
+        block_nums = retry_list;
+        num_blocks = io.num_blocks;
     }
 
+done:
     // Done
     http_io_xml_io_destroy(priv, &io);
     free(buf);
@@ -2129,13 +3041,35 @@ http_io_bulk_delete_elem_end(void *arg, const XML_Char *name)
         goto done;
     }
 
-    // Handle end of <DeleteResult>/<Error>
+    // Handle end of <DeleteResult>/<Error>; if the error is transient, remember the block so it can be retried
     if (strcmp(io->xml_path, "/" DELETE_ELEM_DELETE_RESULT "/" DELETE_ELEM_ERROR) == 0) {
-        (*config->log)(LOG_ERR, "bulk delete error: key=\"%s\" code=\"%s\" message=\"%s\"",
-          io->bulk_delete_err_key != NULL ? io->bulk_delete_err_key : "(none)",
-          io->bulk_delete_err_code != NULL ? io->bulk_delete_err_code : "(none)",
-          io->bulk_delete_err_msg != NULL ? io->bulk_delete_err_msg : "(none)");
-        io->handler_error = EIO;
+        s3b_block_t hash_value;
+        s3b_block_t block_num;
+
+        if (io->bulk_delete_err_code != NULL
+          && find_string_in_table(bulk_delete_retry_codes, io->bulk_delete_err_code)
+          && io->bulk_delete_err_key != NULL
+          && http_io_parse_block(config->prefix, config->num_blocks,
+            config->blockHashPrefix, io->bulk_delete_err_key, &hash_value, &block_num) == 0
+          && io->num_blocks < DELETE_BLOCKS_CHUNK) {
+            (*config->log)(LOG_WARNING, "bulk delete error (will retry): key=\"%s\" code=\"%s\"",
+              io->bulk_delete_err_key, io->bulk_delete_err_code);
+            io->block_list[io->num_blocks++] = block_num;
+        } else {
+            (*config->log)(LOG_ERR, "bulk delete error: key=\"%s\" code=\"%s\" message=\"%s\"",
+              io->bulk_delete_err_key != NULL ? io->bulk_delete_err_key : "(none)",
+              io->bulk_delete_err_code != NULL ? io->bulk_delete_err_code : "(none)",
+              io->bulk_delete_err_msg != NULL ? io->bulk_delete_err_msg : "(none)");
+            io->handler_error = EIO;
+        }
+
+        // Reset for the next <Error>
+        free(io->bulk_delete_err_key);
+        free(io->bulk_delete_err_code);
+        free(io->bulk_delete_err_msg);
+        io->bulk_delete_err_key = NULL;
+        io->bulk_delete_err_code = NULL;
+        io->bulk_delete_err_msg = NULL;
         goto done;
     }
 
@@ -2257,6 +3191,12 @@ http_io_xml_io_destroy(struct http_io_private *const priv, struct http_io *io)
     io->xml_path = NULL;
     free(io->xml_text);
     io->xml_text = NULL;
+    free(io->bulk_delete_err_key);
+    io->bulk_delete_err_key = NULL;
+    free(io->bulk_delete_err_code);
+    io->bulk_delete_err_code = NULL;
+    free(io->bulk_delete_err_msg);
+    io->bulk_delete_err_msg = NULL;
 }
 
 /*
@@ -2268,245 +3208,1420 @@ http_io_perform_io(struct http_io_private *priv, struct http_io *io, http_io_cur
     struct http_io_conf *const config = priv->config;
     struct timespec delay;
     CURLcode curl_code;
-    u_int retry_pause = 0;
-    u_int total_pause;
-    long http_code;
-    int may_cache;
-    double clen;
-    int attempt;
+    u_int deadline;
     CURL *curl;
+    int r;
 
     // Debug
     if (config->debug)
         (*config->log)(LOG_DEBUG, "%s %s", io->method, io->url);
 
     // Make attempts
-    for (attempt = 0, total_pause = 0; 1; attempt++, total_pause += retry_pause) {
-
-        // Acquire and initialize CURL instance
-        if ((curl = http_io_acquire_curl(priv, io)) == NULL)
-            return EIO;
-        (*prepper)(curl, io);
-
-        // Reset error payload capture
-        io->http_status = 0;
-        assert(io->error_payload == NULL);
-        assert(io->error_payload_len == 0);
-
-        // Perform HTTP operation and check result
-        if (attempt > 0)
-            (*config->log)(LOG_INFO, "retrying query (attempt #%d): %s %s", attempt + 1, io->method, io->url);
-        io->curl = curl;
-        curl_code = curl_easy_perform(curl);
-        io->curl = NULL;
+    for (io->attempt = 0, io->total_pause = 0, io->retry_pause = 0; 1; ) {
+
+        // Wait for the rate limiters
+        http_io_rate_sleep(priv, io);
+
+        // Hedge the first attempt of a block read if appropriate
+        if (io->attempt == 0 && (deadline = http_io_hedge_deadline(priv, io)) != 0) {
+            if ((r = http_io_hedged_attempt(priv, io, prepper, deadline)) != HTTP_ATTEMPT_RETRY)
+                return r;
+        } else {
+
+            // Acquire and initialize CURL instance
+            if ((curl = http_io_attempt_start(priv, io, prepper)) == NULL)
+                return EIO;
+
+            // Perform HTTP operation
+            io->curl = curl;
+            curl_code = curl_easy_perform(curl);
+            io->curl = NULL;
+
+            // Check result
+            if ((r = http_io_attempt_finish(priv, io, curl, curl_code)) != HTTP_ATTEMPT_RETRY)
+                return r;
+        }
+
+        // Retry with exponential backoff up to max total pause limit
+        if ((r = http_io_retry_pause(priv, io)) != 0)
+            return r;
+        delay.tv_sec = io->retry_pause / 1000;
+        delay.tv_nsec = (io->retry_pause % 1000) * 1000000;
+        nanosleep(&delay, NULL);            // TODO: check for EINTR
+    }
+}
+
+/*
+ * Acquire and prepare a CURL instance for the next attempt at an HTTP operation.
+ *
+ * Returns NULL on failure.
+ */
+static CURL *
+http_io_attempt_start(struct http_io_private *priv, struct http_io *io, http_io_curl_prepper_t *prepper)
+{
+    struct http_io_conf *const config = priv->config;
+    CURL *curl;
+
+    // Acquire and initialize CURL instance
+    if ((curl = http_io_acquire_curl(priv, io)) == NULL)
+        return NULL;
+    (*prepper)(curl, io);
+
+    // Reset error payload capture
+    io->http_status = 0;
+    assert(io->error_payload == NULL);
+    assert(io->error_payload_len == 0);
+
+    // Debug
+    if (io->attempt > 0)
+        (*config->log)(LOG_INFO, "retrying query (attempt #%d): %s %s", io->attempt + 1, io->method, io->url);
+
+    // Done
+    return curl;
+}
+
+/*
+ * Check the result of an attempt at an HTTP operation and release the CURL instance.
+ *
+ * Returns zero on success, an error code on (permanent) failure, or HTTP_ATTEMPT_RETRY if the operation should be retried.
+ */
+static int
+http_io_attempt_finish(struct http_io_private *priv, struct http_io *io, CURL *curl, CURLcode curl_code)
+{
+    struct http_io_conf *const config = priv->config;
+    long http_code;
+    int may_cache;
+    double clen;
+
+    // Find out what the HTTP result code was (if any)
+    switch (curl_code) {
+    case CURLE_HTTP_RETURNED_ERROR:                         // should never happen (we no longer use CURLOPT_FAILONERROR)
+    case 0:
+        if (curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code) != 0)
+            http_code = 999;                                // this should never happen
+        break;
+    default:
+        http_code = -1;
+        break;
+    }
+
+    // Charge the bytes transferred against the bandwidth limit
+    http_io_rate_charge(priv, curl);
+
+    // Pretend like the CURLOPT_FAILONERROR option was used
+    if (curl_code == 0 && http_code >= HTTP_STATUS_ERROR_MINIMUM)
+        curl_code = CURLE_HTTP_RETURNED_ERROR;
+
+    // In the case of a DELETE, treat an HTTP_NOT_FOUND error as successful
+    if (curl_code == CURLE_HTTP_RETURNED_ERROR
+      && http_code == HTTP_NOT_FOUND
+      && strcmp(io->method, HTTP_DELETE) == 0)
+        curl_code = 0;
+
+    // Handle success
+    if (curl_code == 0) {
+        double curl_time;
+        int r = 0;
+
+        // Discard any error payload (e.g., 404 Not Found from DELETE)
+        http_io_free_error_payload(io);
+
+        // Extra debug logging
+        if (config->debug)
+            (*config->log)(LOG_DEBUG, "success: %s %s", io->method, io->url);
+
+        // Extract timing info
+        if ((curl_code = curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &curl_time)) != CURLE_OK) {
+            (*config->log)(LOG_ERR, "can't get cURL timing: %s", curl_easy_strerror(curl_code));
+            curl_time = 0.0;
+        }
+
+        // Extract content-length (if required)
+        if (io->content_lengthp != NULL) {
+            if ((curl_code = curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &clen)) == CURLE_OK)
+                *io->content_lengthp = (u_int)clen;
+            else {
+                (*config->log)(LOG_ERR, "can't get content-length: %s", curl_easy_strerror(curl_code));
+                r = ENXIO;
+            }
+        }
+
+        // Update stats
+        pthread_mutex_lock(&priv->mutex);
+        if (strcmp(io->method, HTTP_GET) == 0)
+            latency_record(&priv->stats.http_gets, curl_time);
+        else if (strcmp(io->method, HTTP_PUT) == 0)
+            latency_record(&priv->stats.http_puts, curl_time);
+        else if (strcmp(io->method, HTTP_DELETE) == 0)
+            latency_record(&priv->stats.http_deletes, curl_time);
+        else if (strcmp(io->method, HTTP_HEAD) == 0)
+            latency_record(&priv->stats.http_heads, curl_time);
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+
+        // Done
+        http_io_release_curl(priv, &curl, r == 0);
+        return r;
+    }
+
+    // Determine whether we think it's safe to re-use the curl handle after an error
+    may_cache = http_io_safe_to_cache_curl_handle(curl_code, http_code);
+
+    // Free the curl handle (and don't cache it if connection might be broken)
+    http_io_release_curl(priv, &curl, may_cache);
+
+    // Handle errors
+    switch (curl_code) {
+    case CURLE_ABORTED_BY_CALLBACK:
+        if (config->debug)
+            (*config->log)(LOG_DEBUG, "write aborted: %s %s", io->method, io->url);
+        pthread_mutex_lock(&priv->mutex);
+        priv->stats.http_canceled_writes++;
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+        http_io_free_error_payload(io);
+        return ECONNABORTED;
+    case CURLE_OPERATION_TIMEDOUT:
+        (*config->log)(LOG_NOTICE, "operation timeout: %s %s", io->method, io->url);
+        pthread_mutex_lock(&priv->mutex);
+        priv->stats.curl_timeouts++;
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+        break;
+    case CURLE_HTTP_RETURNED_ERROR:                 // special handling for some specific HTTP codes
+        switch (http_code) {
+        case HTTP_NOT_FOUND:
+            if (config->debug)
+                (*config->log)(LOG_DEBUG, "rec'd %ld response: %s %s", http_code, io->method, io->url);
+            http_io_free_error_payload(io);
+            return ENOENT;
+        case HTTP_UNAUTHORIZED:
+            (*config->log)(LOG_ERR, "rec'd %ld response: %s %s", http_code, io->method, io->url);
+            pthread_mutex_lock(&priv->mutex);
+            priv->stats.http_unauthorized++;
+            CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+            http_io_log_error_payload(io);
+            http_io_free_error_payload(io);
+            return EACCES;
+        case HTTP_FORBIDDEN:
+            (*config->log)(LOG_ERR, "rec'd %ld response: %s %s", http_code, io->method, io->url);
+            pthread_mutex_lock(&priv->mutex);
+            priv->stats.http_forbidden++;
+            CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+            http_io_log_error_payload(io);
+            http_io_free_error_payload(io);
+            return EPERM;
+        case HTTP_PRECONDITION_FAILED:
+            (*config->log)(LOG_INFO, "rec'd stale content: %s %s", io->method, io->url);
+            pthread_mutex_lock(&priv->mutex);
+            priv->stats.http_stale++;
+            CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+            break;
+        case HTTP_MOVED_PERMANENTLY:
+        case HTTP_FOUND:
+        case HTTP_TEMPORARY_REDIRECT:
+        case HTTP_PERMANENT_REDIRECT:
+            (*config->log)(LOG_ERR, "rec'd %ld redirect: %s %s", http_code, io->method, io->url);
+            (*config->log)(LOG_ERR, "hint: you may need the \"--vhost\" and/or \"--region\" flags");
+            pthread_mutex_lock(&priv->mutex);
+            priv->stats.http_redirect++;
+            CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+            break;
+        case HTTP_NOT_MODIFIED:
+            if (io->expect_304) {
+                if (config->debug)
+                    (*config->log)(LOG_DEBUG, "rec'd %ld response: %s %s", http_code, io->method, io->url);
+                return EEXIST;
+            }
+            // FALLTHROUGH
+        default:
+            (*config->log)(LOG_ERR, "rec'd %ld response: %s %s", http_code, io->method, io->url);
+            pthread_mutex_lock(&priv->mutex);
+            switch (http_code / 100) {
+            case 3:
+                priv->stats.http_3xx_error++;
+                break;
+            case 4:
+                priv->stats.http_4xx_error++;
+                break;
+            case 5:
+                priv->stats.http_5xx_error++;
+                break;
+            default:
+                priv->stats.http_other_error++;
+                break;
+            }
+            CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+            http_io_log_error_payload(io);
+            if (http_code == HTTP_SERVICE_UNAVAILABLE)
+                http_io_rate_slowdown(priv, io);
+            break;
+        }
+        break;
+    default:
+        (*config->log)(LOG_ERR, "operation failed: %s (%s)", curl_easy_strerror(curl_code),
+          io->total_pause >= config->max_retry_pause ? "final attempt" : "will retry");
+        pthread_mutex_lock(&priv->mutex);
+        switch (curl_code) {
+        case CURLE_OUT_OF_MEMORY:
+            priv->stats.curl_out_of_memory++;
+            break;
+        case CURLE_COULDNT_CONNECT:
+            priv->stats.curl_connect_failed++;
+            break;
+        case CURLE_COULDNT_RESOLVE_HOST:
+            priv->stats.curl_host_unknown++;
+            break;
+        default:
+            priv->stats.curl_other_error++;
+            break;
+        }
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+        break;
+    }
+
+    // Free any error payload
+    http_io_free_error_payload(io);
+
+    // Try again
+    return HTTP_ATTEMPT_RETRY;
+}
+
+/*
+ * Determine how long to pause before retrying a failed HTTP operation, using exponential backoff
+ * up to the maximum total pause limit. The pause is stored in io->retry_pause.
+ *
+ * Returns zero to retry, or EIO if we should give up.
+ */
+static int
+http_io_retry_pause(struct http_io_private *priv, struct http_io *io)
+{
+    struct http_io_conf *const config = priv->config;
+
+    // Give up if we have already paused too long
+    if (io->total_pause >= config->max_retry_pause) {
+        (*config->log)(LOG_ERR, "giving up on: %s %s", io->method, io->url);
+        return EIO;
+    }
+
+    // Calculate next pause
+    io->retry_pause = io->retry_pause > 0 ? io->retry_pause * 2 : config->initial_retry_pause;
+    if (io->total_pause + io->retry_pause > config->max_retry_pause)
+        io->retry_pause = config->max_retry_pause - io->total_pause;
+    io->total_pause += io->retry_pause;
+    io->attempt++;
+
+    // Update retry stats
+    pthread_mutex_lock(&priv->mutex);
+    priv->stats.num_retries++;
+    priv->stats.retry_delay += io->retry_pause;
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+
+    // Done
+    return 0;
+}
+
+/*
+ * Initialize a rate limiter allowing "per_second" units per second, or unlimited if zero.
+ */
+static void
+http_io_rate_init(struct http_io_rate *rate, double per_second, uint64_t now)
+{
+    memset(rate, 0, sizeof(*rate));
+    rate->limit = per_second / 1000.0;
+    rate->rate = rate->limit;
+    rate->tat = (double)now;
+    rate->updated = now;
+}
+
+/*
+ * Find the request rate limiter that applies to an operation.
+ *
+ * S3 partitions a bucket by object name prefix and applies its request rate limits to each partition
+ * separately, so with --blockHashPrefix we limit ranges of block hash prefixes independently. Requests
+ * that don't involve a block are charged to whichever range io->block_num happens to map to.
+ */
+static struct http_io_rate *
+http_io_rate_bucket(struct http_io_private *priv, struct http_io *io)
+{
+    if (priv->num_request_rates == 1)
+        return &priv->request_rate[0];
+    return &priv->request_rate[http_io_block_hash_prefix(io->block_num) >> (sizeof(s3b_block_t) * 8 - RATE_BUCKET_BITS)];
+}
+
+/*
+ * Gradually restore the rate after a slowdown (additive increase).
+ *
+ * This assumes the mutex is held.
+ */
+static void
+http_io_rate_recover(struct http_io_rate *rate, uint64_t now)
+{
+    if (now > rate->updated && rate->rate < rate->limit) {
+        rate->rate += rate->limit * RATE_RECOVERY * (double)(now - rate->updated) / 1000.0;
+        if (rate->rate > rate->limit)
+            rate->rate = rate->limit;
+    }
+    rate->updated = now;
+}
+
+/*
+ * Reserve a request from the rate limiters for an operation that wants to start at time "when" (in milliseconds),
+ * and return the time at which it may actually start.
+ *
+ * If "optional" is true and the operation would have to wait, nothing is reserved and zero is returned.
+ */
+static uint64_t
+http_io_rate_reserve(struct http_io_private *priv, struct http_io *io, uint64_t when, int optional)
+{
+    struct http_io_conf *const config = priv->config;
+    struct http_io_rate *const rate = http_io_rate_bucket(priv, io);
+    uint64_t now;
+    double start;
+
+    // Anything to do?
+    if (config->max_request_rate == 0 && config->max_total_speed == 0)
+        return when;
+
+    // Find the earliest time at which both limiters have room
+    now = http_io_get_time_millis();
+    start = (double)when;
+    pthread_mutex_lock(&priv->mutex);
+    if (rate->limit > 0) {
+        http_io_rate_recover(rate, now);
+        if (rate->tat - RATE_BURST_MILLIS > start)
+            start = rate->tat - RATE_BURST_MILLIS;
+    }
+    if (priv->bandwidth.limit > 0 && priv->bandwidth.tat - RATE_BURST_MILLIS > start)
+        start = priv->bandwidth.tat - RATE_BURST_MILLIS;
+
+    // Caller doesn't want to wait?
+    if (optional && start > (double)when) {
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+        return 0;
+    }
+
+    // Take one request; bandwidth is charged afterward, once we know how many bytes were transferred
+    if (rate->limit > 0)
+        rate->tat = (rate->tat > start ? rate->tat : start) + 1.0 / rate->rate;
+
+    // Update stats
+    if (start > (double)when) {
+        priv->stats.rate_limit_waits++;
+        priv->stats.rate_limit_delay += (uint64_t)(start - (double)when);
+    }
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+
+    // Done
+    return (uint64_t)start;
+}
+
+/*
+ * Wait until the rate limiters allow an operation to proceed.
+ */
+static void
+http_io_rate_sleep(struct http_io_private *priv, struct http_io *io)
+{
+    struct timespec delay;
+    uint64_t start;
+    uint64_t now;
+
+    now = http_io_get_time_millis();
+    if ((start = http_io_rate_reserve(priv, io, now, 0)) <= now)
+        return;
+    delay.tv_sec = (start - now) / 1000;
+    delay.tv_nsec = ((start - now) % 1000) * 1000000;
+    nanosleep(&delay, NULL);
+}
+
+/*
+ * Charge the bytes transferred by an attempt against the aggregate bandwidth limit.
+ */
+static void
+http_io_rate_charge(struct http_io_private *priv, CURL *curl)
+{
+    struct http_io_rate *const rate = &priv->bandwidth;
+#if LIBCURL_VERSION_NUM >= 0x073700
+    curl_off_t up;
+    curl_off_t down;
+#else
+    double up;
+    double down;
+#endif
+    uint64_t now;
+
+    // Anything to do?
+    if (rate->limit == 0)
+        return;
+
+    // Get transfer sizes
+#if LIBCURL_VERSION_NUM >= 0x073700
+    if (curl_easy_getinfo(curl, CURLINFO_SIZE_UPLOAD_T, &up) != CURLE_OK)
+        up = 0;
+    if (curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &down) != CURLE_OK)
+        down = 0;
+#else
+    if (curl_easy_getinfo(curl, CURLINFO_SIZE_UPLOAD, &up) != CURLE_OK)
+        up = 0;
+    if (curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD, &down) != CURLE_OK)
+        down = 0;
+#endif
+
+    // Charge them
+    now = http_io_get_time_millis();
+    pthread_mutex_lock(&priv->mutex);
+    rate->tat = (rate->tat > (double)now ? rate->tat : (double)now) + ((double)up + (double)down) / rate->rate;
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+}
+
+/*
+ * Back off after a 503 Slow Down response (multiplicative decrease).
+ *
+ * A burst of concurrent requests that overshoots the limit typically yields a burst of 503's,
+ * so we only decrease the rate once per RATE_SLOWDOWN_HOLDOFF milliseconds.
+ */
+static void
+http_io_rate_slowdown(struct http_io_private *priv, struct http_io *io)
+{
+    struct http_io_conf *const config = priv->config;
+    struct http_io_rate *const rate = http_io_rate_bucket(priv, io);
+    double new_rate = 0;
+    uint64_t now;
+
+    // Anything to do?
+    if (rate->limit == 0)
+        return;
+
+    // Decrease rate
+    now = http_io_get_time_millis();
+    pthread_mutex_lock(&priv->mutex);
+    http_io_rate_recover(rate, now);
+    if (now - rate->slowdown >= RATE_SLOWDOWN_HOLDOFF) {
+        rate->rate *= RATE_SLOWDOWN_FACTOR;
+        if (rate->rate < rate->limit * RATE_MIN_FRACTION)
+            rate->rate = rate->limit * RATE_MIN_FRACTION;
+        rate->slowdown = now;
+        new_rate = rate->rate * 1000.0;
+        priv->stats.rate_limit_slowdowns++;
+    }
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+
+    // Log it
+    if (new_rate != 0)
+        (*config->log)(LOG_NOTICE, "rec'd slow down response; reducing request rate to %.1f/sec", new_rate);
+}
+
+/*
+ * Determine whether the first attempt of this operation should be hedged, and if so, after how many milliseconds.
+ *
+ * Only block reads are hedged, and only once we have enough GET latency samples to estimate the configured percentile.
+ *
+ * Returns zero to not hedge.
+ */
+static u_int
+http_io_hedge_deadline(struct http_io_private *priv, struct http_io *io)
+{
+    struct http_io_conf *const config = priv->config;
+    double deadline = 0.0;
+
+    // Is this operation eligible?
+    if (!io->hedge || config->hedge_percentile == 0)
+        return 0;
+
+    // Estimate the latency percentile
+    pthread_mutex_lock(&priv->mutex);
+    priv->hedge_eligible++;
+    if (priv->stats.http_gets.count >= HEDGE_MIN_SAMPLES)
+        deadline = latency_percentile(&priv->stats.http_gets, config->hedge_percentile);
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+
+    // Done
+    return deadline > 0.0 ? (u_int)(deadline * 1000.0) + 1 : 0;
+}
+
+/*
+ * Perform one attempt of an operation. If it has not completed after "deadline" milliseconds, and the hedge
+ * budget allows it, issue an identical second request and use the response from whichever finishes first.
+ *
+ * Returns the same values as http_io_attempt_finish().
+ */
+static int
+http_io_hedged_attempt(struct http_io_private *priv, struct http_io *io, http_io_curl_prepper_t *prepper, u_int deadline)
+{
+    struct http_io_conf *const config = priv->config;
+    struct http_io hedge;
+    struct http_io *winner = NULL;
+    CURL *curls[2] = { NULL, NULL };
+    CURLcode curl_code = CURLE_OK;
+    CURLMcode mcode;
+    CURLM *multi;
+    CURLMsg *msg;
+    uint64_t start_time;
+    uint64_t now;
+    int hedge_tried = 0;
+    int running;
+    int timeout;
+    int left;
+    int i;
+
+    // Create our own multi handle (curl_easy_perform() does the same thing internally); the hedge
+    // request should not be multiplexed over the same (possibly slow) connection as the primary
+    if ((multi = curl_multi_init()) == NULL) {
+        (*config->log)(LOG_ERR, "curl_multi_init() failed");
+        return EIO;
+    }
+#ifdef CURLPIPE_MULTIPLEX
+    curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_NOTHING);
+#endif
+
+    // Start the primary request
+    if ((curls[0] = http_io_attempt_start(priv, io, prepper)) == NULL) {
+        curl_multi_cleanup(multi);
+        return EIO;
+    }
+    io->curl = curls[0];
+    if ((mcode = curl_multi_add_handle(multi, curls[0])) != CURLM_OK) {
+        (*config->log)(LOG_ERR, "curl_multi_add_handle: %s", curl_multi_strerror(mcode));
+        goto fail;
+    }
+    start_time = http_io_get_time_millis();
+
+    // Wait for a response, hedging once the deadline passes
+    while (1) {
+
+        // Make progress and check for a completed request
+        if ((mcode = curl_multi_perform(multi, &running)) != CURLM_OK) {
+            (*config->log)(LOG_ERR, "curl_multi_perform: %s", curl_multi_strerror(mcode));
+            goto fail;
+        }
+        while ((msg = curl_multi_info_read(multi, &left)) != NULL) {
+            if (msg->msg == CURLMSG_DONE && winner == NULL) {
+                winner = msg->easy_handle == curls[0] ? io : &hedge;
+                curl_code = msg->data.result;
+            }
+        }
+        if (winner != NULL)
+            break;
+
+        // Time to hedge?
+        timeout = 1000;
+        if (!hedge_tried) {
+            now = http_io_get_time_millis();
+            if (now - start_time < deadline)
+                timeout = (int)(deadline - (now - start_time));
+            else {
+                hedge_tried = 1;
+
+                // Check the budget
+                pthread_mutex_lock(&priv->mutex);
+                if (priv->hedge_issued * 100 >= priv->hedge_eligible * config->hedge_budget)
+                    hedge_tried = -1;
+                CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+
+                // Don't hedge if doing so would have to wait for the rate limiters
+                if (hedge_tried == 1 && http_io_rate_reserve(priv, io, now, 1) == 0)
+                    hedge_tried = -1;
+                if (hedge_tried == 1) {
+                    pthread_mutex_lock(&priv->mutex);
+                    priv->hedge_issued++;
+                    priv->stats.http_hedged_gets++;
+                    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+                }
+
+                // Start the hedge request, which gets its own receive buffer and response state
+                if (hedge_tried == 1) {
+                    memcpy(&hedge, io, sizeof(hedge));
+                    hedge.curl = NULL;
+                    hedge.error_payload = NULL;
+                    hedge.error_payload_len = 0;
+                    if ((hedge.dest = block_buf_alloc(io->buf_size)) == NULL) {
+                        pthread_mutex_lock(&priv->mutex);
+                        priv->stats.out_of_memory_errors++;
+                        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+                    } else if ((curls[1] = http_io_attempt_start(priv, &hedge, prepper)) == NULL)
+                        block_buf_free(hedge.dest);
+                    else {
+                        hedge.curl = curls[1];
+                        if ((mcode = curl_multi_add_handle(multi, curls[1])) != CURLM_OK) {
+                            (*config->log)(LOG_ERR, "curl_multi_add_handle: %s", curl_multi_strerror(mcode));
+                            http_io_release_curl(priv, &curls[1], 0);
+                            http_io_free_error_payload(&hedge);
+                            block_buf_free(hedge.dest);
+                        } else if (config->debug)
+                            (*config->log)(LOG_DEBUG, "hedging after %ums: %s %s", deadline, io->method, io->url);
+                    }
+                    if (curls[1] == NULL)
+                        continue;                                   // make sure we call curl_multi_perform() again
+                }
+            }
+        }
+
+        // Wait for activity
+        if ((mcode = curl_multi_wait(multi, NULL, 0, timeout, NULL)) != CURLM_OK) {
+            (*config->log)(LOG_ERR, "curl_multi_wait: %s", curl_multi_strerror(mcode));
+            goto fail;
+        }
+    }
+
+    // Detach both requests and abandon the loser; its connection is still busy, so don't cache it
+    for (i = 0; i < 2; i++) {
+        if (curls[i] != NULL)
+            curl_multi_remove_handle(multi, curls[i]);
+    }
+    curl_multi_cleanup(multi);
+    if (curls[1] != NULL) {
+        struct http_io *const loser = winner == io ? &hedge : io;
+
+        http_io_release_curl(priv, &curls[winner == io ? 1 : 0], 0);
+        http_io_free_error_payload(loser);
+        block_buf_free(loser->dest);
+        if (winner == &hedge) {
+            memcpy(io, &hedge, sizeof(*io));
+            curls[0] = curls[1];
+            pthread_mutex_lock(&priv->mutex);
+            priv->stats.http_hedge_wins++;
+            CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+        }
+    }
+    io->curl = NULL;
+
+    // Check result
+    return http_io_attempt_finish(priv, io, curls[0], curl_code);
+
+fail:
+    if (curls[1] != NULL) {
+        http_io_free_error_payload(&hedge);
+        block_buf_free(hedge.dest);
+    }
+    for (i = 0; i < 2; i++) {
+        if (curls[i] != NULL) {
+            curl_multi_remove_handle(multi, curls[i]);
+            http_io_release_curl(priv, &curls[i], 0);
+        }
+    }
+    curl_multi_cleanup(multi);
+    io->curl = NULL;
+    http_io_free_error_payload(io);
+    return HTTP_ATTEMPT_RETRY;
+}
+
+/****************************************************************************
+ *                          ASYNCHRONOUS I/O ENGINE                         *
+ ****************************************************************************/
+
+static int
+http_io_start_loops(struct http_io_private *priv)
+{
+    struct http_io_conf *const config = priv->config;
+    struct http_io_loop *loop;
+    u_int num_loops;
+    int r;
+
+    // Sanity check
+    assert(priv->loops == NULL);
+
+    // Allocate loops
+    if ((priv->loops = calloc(config->event_threads, sizeof(*priv->loops))) == NULL)
+        return errno;
+
+    // Initialize and start each loop
+    for (num_loops = 0; num_loops < config->event_threads; num_loops++) {
+        loop = &priv->loops[num_loops];
+        loop->priv = priv;
+        TAILQ_INIT(&loop->pending);
+        if ((loop->multi = curl_multi_init()) == NULL) {
+            r = ENOMEM;
+            goto fail0;
+        }
+#ifdef CURLPIPE_MULTIPLEX
+        curl_multi_setopt(loop->multi, CURLMOPT_PIPELINING, config->http_11 ? CURLPIPE_NOTHING : CURLPIPE_MULTIPLEX);
+#endif
+        if (pipe(loop->wakeup) == -1) {
+            r = errno;
+            goto fail1;
+        }
+        (void)fcntl(loop->wakeup[0], F_SETFL, O_NONBLOCK);
+        (void)fcntl(loop->wakeup[1], F_SETFL, O_NONBLOCK);
+        (void)fcntl(loop->wakeup[0], F_SETFD, FD_CLOEXEC);
+        (void)fcntl(loop->wakeup[1], F_SETFD, FD_CLOEXEC);
+        if ((r = pthread_mutex_init(&loop->mutex, NULL)) != 0)
+            goto fail2;
+        if ((r = pthread_create(&loop->thread, NULL, http_io_loop_main, loop)) != 0)
+            goto fail3;
+        continue;
+
+        // Clean up partially initialized loop
+fail3:
+        pthread_mutex_destroy(&loop->mutex);
+fail2:
+        close(loop->wakeup[0]);
+        close(loop->wakeup[1]);
+fail1:
+        curl_multi_cleanup(loop->multi);
+fail0:
+        priv->num_loops = num_loops;
+        http_io_stop_loops(priv);
+        return r;
+    }
+    priv->num_loops = num_loops;
+
+    // Done
+    (*config->log)(LOG_DEBUG, "started %u event loop thread(s)", priv->num_loops);
+    return 0;
+}
+
+static void
+http_io_stop_loops(struct http_io_private *priv)
+{
+    struct http_io_conf *const config = priv->config;
+    struct http_io_loop *loops;
+    struct http_io_loop *loop;
+    u_int num_loops;
+    u_int i;
+    int r;
+
+    // Detach loops so no new operations can be submitted; anything already submitted is on some loop's pending list
+    pthread_mutex_lock(&priv->mutex);
+    loops = priv->loops;
+    num_loops = priv->num_loops;
+    priv->loops = NULL;
+    priv->num_loops = 0;
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+
+    // Anything to do?
+    if (loops == NULL)
+        return;
+
+    // Tell loops to exit once they are idle
+    for (i = 0; i < num_loops; i++) {
+        loop = &loops[i];
+        pthread_mutex_lock(&loop->mutex);
+        loop->shutdown = 1;
+        CHECK_RETURN(pthread_mutex_unlock(&loop->mutex));
+        http_io_loop_wakeup(loop);
+    }
+
+    // Reap loop threads and free resources
+    for (i = 0; i < num_loops; i++) {
+        loop = &loops[i];
+        if ((r = pthread_join(loop->thread, NULL)) != 0)
+            (*config->log)(LOG_ERR, "pthread_join: %s", strerror(r));
+        assert(TAILQ_EMPTY(&loop->pending));
+        assert(loop->num_active == 0);
+        pthread_mutex_destroy(&loop->mutex);
+        close(loop->wakeup[0]);
+        close(loop->wakeup[1]);
+        curl_multi_cleanup(loop->multi);
+    }
+    free(loops);
+}
+
+static int
+http_io_start_xforms(struct http_io_private *priv)
+{
+    struct http_io_conf *const config = priv->config;
+    struct http_io_xform *xform;
+    u_int num_xforms;
+    int r;
+
+    // Sanity check
+    assert(priv->xforms == NULL);
+
+    // Initialize queue
+    TAILQ_INIT(&priv->xform_queue);
+    priv->xform_shutdown = 0;
+    if ((r = pthread_mutex_init(&priv->xform_mutex, NULL)) != 0)
+        return r;
+    if ((r = pthread_cond_init(&priv->xform_work, NULL)) != 0) {
+        pthread_mutex_destroy(&priv->xform_mutex);
+        return r;
+    }
+
+    // Allocate threads
+    if ((priv->xforms = calloc(config->transform_threads, sizeof(*priv->xforms))) == NULL) {
+        r = errno;
+        pthread_cond_destroy(&priv->xform_work);
+        pthread_mutex_destroy(&priv->xform_mutex);
+        return r;
+    }
+
+    // Initialize and start each thread; the scratch buffer is big enough for anything http_io_read_start() will accept
+    for (num_xforms = 0; num_xforms < config->transform_threads; num_xforms++) {
+        xform = &priv->xforms[num_xforms];
+        xform->priv = priv;
+        xform->scratch_size = comp_bound(config->block_size) + 2 * EVP_MAX_IV_LENGTH;
+        if ((xform->scratch = block_buf_alloc(xform->scratch_size)) == NULL) {
+            r = errno;
+            goto fail;
+        }
+        if ((r = pthread_create(&xform->thread, NULL, http_io_xform_main, xform)) != 0) {
+            block_buf_free(xform->scratch);
+            goto fail;
+        }
+    }
+    priv->num_xforms = num_xforms;
+
+    // Done
+    (*config->log)(LOG_DEBUG, "started %u transform thread(s)", priv->num_xforms);
+    return 0;
+
+fail:
+    priv->num_xforms = num_xforms;
+    http_io_stop_xforms(priv);
+    return r;
+}
+
+static void
+http_io_stop_xforms(struct http_io_private *priv)
+{
+    struct http_io_conf *const config = priv->config;
+    u_int i;
+    int r;
+
+    // Anything to do?
+    if (priv->xforms == NULL)
+        return;
+
+    // Tell threads to exit once the queue is empty
+    pthread_mutex_lock(&priv->xform_mutex);
+    priv->xform_shutdown = 1;
+    pthread_cond_broadcast(&priv->xform_work);
+    CHECK_RETURN(pthread_mutex_unlock(&priv->xform_mutex));
+
+    // Reap threads and free resources
+    for (i = 0; i < priv->num_xforms; i++) {
+        struct http_io_xform *const xform = &priv->xforms[i];
+
+        if ((r = pthread_join(xform->thread, NULL)) != 0)
+            (*config->log)(LOG_ERR, "pthread_join: %s", strerror(r));
+        block_buf_free(xform->scratch);
+    }
+    assert(TAILQ_EMPTY(&priv->xform_queue));
+    pthread_cond_destroy(&priv->xform_work);
+    pthread_mutex_destroy(&priv->xform_mutex);
+    free(priv->xforms);
+    priv->xforms = NULL;
+    priv->num_xforms = 0;
+}
+
+/*
+ * Hand an operation off to the transform threads, which will invoke "xform" with parameter "r".
+ */
+static void
+http_io_xform_queue(struct http_io_private *priv, struct http_io_op *op, http_io_xform_t *xform, int r)
+{
+    op->xform = xform;
+    op->xform_r = r;
+    pthread_mutex_lock(&priv->xform_mutex);
+    TAILQ_INSERT_TAIL(&priv->xform_queue, op, link);
+    pthread_cond_signal(&priv->xform_work);
+    CHECK_RETURN(pthread_mutex_unlock(&priv->xform_mutex));
+}
+
+/*
+ * Transform thread main routine.
+ */
+static void *
+http_io_xform_main(void *arg)
+{
+    struct http_io_xform *const xform = arg;
+    struct http_io_private *const priv = xform->priv;
+    struct http_io_op *op;
+
+    // Process queued operations until told to exit
+    pthread_mutex_lock(&priv->xform_mutex);
+    while (1) {
+        if ((op = TAILQ_FIRST(&priv->xform_queue)) != NULL) {
+            TAILQ_REMOVE(&priv->xform_queue, op, link);
+            CHECK_RETURN(pthread_mutex_unlock(&priv->xform_mutex));
+            (*op->xform)(xform, op, op->xform_r);
+            pthread_mutex_lock(&priv->xform_mutex);
+            continue;
+        }
+        if (priv->xform_shutdown)
+            break;
+        pthread_cond_wait(&priv->xform_work, &priv->xform_mutex);
+    }
+    CHECK_RETURN(pthread_mutex_unlock(&priv->xform_mutex));
+    return NULL;
+}
+
+/*
+ * Event loop thread main routine.
+ */
+static void *
+http_io_loop_main(void *arg)
+{
+    struct http_io_loop *const loop = arg;
+    struct http_io_private *const priv = loop->priv;
+    struct http_io_conf *const config = priv->config;
+    struct curl_waitfd waitfd;
+    struct http_io_op *next;
+    struct http_io_op *op;
+    CURLMcode mcode;
+    CURLcode curl_code;
+    uint64_t now;
+    int timeout;
+    int running;
+    int msgs_left;
+    CURLMsg *msg;
+    CURL *curl;
+    char *ptr;
+    char buf[64];
+
+    // Loop until told to stop
+    pthread_mutex_lock(&loop->mutex);
+    while (1) {
+
+        // Start any operations that are ready to go, and calculate how long until the next one is
+        now = http_io_get_time_millis();
+        timeout = 1000;
+        for (op = TAILQ_FIRST(&loop->pending); op != NULL; op = next) {
+            next = TAILQ_NEXT(op, link);
+            if (op->start_time > now) {
+                if (op->start_time - now < (uint64_t)timeout)
+                    timeout = (int)(op->start_time - now);
+                continue;
+            }
+            TAILQ_REMOVE(&loop->pending, op, link);
+            CHECK_RETURN(pthread_mutex_unlock(&loop->mutex));
+            http_io_loop_start_op(loop, op);
+            pthread_mutex_lock(&loop->mutex);
+            next = TAILQ_FIRST(&loop->pending);             // list may have changed while unlocked
+        }
+
+        // Time to exit?
+        if (loop->shutdown && loop->num_active == 0 && TAILQ_EMPTY(&loop->pending))
+            break;
+        CHECK_RETURN(pthread_mutex_unlock(&loop->mutex));
+
+        // Drive transfers
+        if ((mcode = curl_multi_perform(loop->multi, &running)) != CURLM_OK)
+            (*config->log)(LOG_ERR, "curl_multi_perform: %s", curl_multi_strerror(mcode));
+
+        // Handle completed transfers
+        while ((msg = curl_multi_info_read(loop->multi, &msgs_left)) != NULL) {
+            if (msg->msg != CURLMSG_DONE)
+                continue;
+            curl = msg->easy_handle;
+            curl_code = msg->data.result;
+            curl_easy_getinfo(curl, CURLINFO_PRIVATE, &ptr);
+            op = (struct http_io_op *)ptr;
+            curl_multi_remove_handle(loop->multi, curl);        // note: this invalidates "msg"
+            http_io_loop_finish_op(loop, op, curl, curl_code);
+        }
+
+        // Wait for something to happen
+        memset(&waitfd, 0, sizeof(waitfd));
+        waitfd.fd = loop->wakeup[0];
+        waitfd.events = CURL_WAIT_POLLIN;
+        if ((mcode = curl_multi_wait(loop->multi, &waitfd, 1, timeout, NULL)) != CURLM_OK)
+            (*config->log)(LOG_ERR, "curl_multi_wait: %s", curl_multi_strerror(mcode));
+        if (waitfd.revents != 0) {
+            while (read(loop->wakeup[0], buf, sizeof(buf)) > 0)
+                ;
+        }
+
+        // Relock
+        pthread_mutex_lock(&loop->mutex);
+    }
+    CHECK_RETURN(pthread_mutex_unlock(&loop->mutex));
+
+    // Done
+    return NULL;
+}
+
+/*
+ * Start the next attempt of an operation. This is invoked only from the event loop thread.
+ */
+static void
+http_io_loop_start_op(struct http_io_loop *loop, struct http_io_op *op)
+{
+    struct http_io_private *const priv = loop->priv;
+    struct http_io_conf *const config = priv->config;
+    struct http_io *const io = op->io;
+    CURLMcode mcode;
+    CURL *curl;
+
+    // Acquire and initialize CURL instance
+    if ((curl = http_io_attempt_start(priv, io, op->prepper)) == NULL) {
+        (*op->done)(op, EIO);
+        return;
+    }
+    curl_easy_setopt(curl, CURLOPT_PRIVATE, (char *)op);
+#ifdef CURLPIPE_MULTIPLEX
+    if (!config->http_11)
+        curl_easy_setopt(curl, CURLOPT_PIPEWAIT, (long)1);      // prefer waiting for a multiplexed stream
+#endif
+
+    // Add to our multi handle
+    io->curl = curl;
+    if ((mcode = curl_multi_add_handle(loop->multi, curl)) != CURLM_OK) {
+        (*config->log)(LOG_ERR, "curl_multi_add_handle: %s", curl_multi_strerror(mcode));
+        io->curl = NULL;
+        http_io_release_curl(priv, &curl, 0);
+        (*op->done)(op, EIO);
+        return;
+    }
+    loop->num_active++;
+}
+
+/*
+ * Handle a completed attempt of an operation. This is invoked only from the event loop thread.
+ */
+static void
+http_io_loop_finish_op(struct http_io_loop *loop, struct http_io_op *op, CURL *curl, CURLcode curl_code)
+{
+    struct http_io_private *const priv = loop->priv;
+    struct http_io *const io = op->io;
+    int r;
+
+    // Update state
+    assert(loop->num_active > 0);
+    loop->num_active--;
+    io->curl = NULL;
+
+    // Check result; if we need to retry, put the operation back on the pending list with a delayed start time
+    if ((r = http_io_attempt_finish(priv, io, curl, curl_code)) == HTTP_ATTEMPT_RETRY
+      && (r = http_io_retry_pause(priv, io)) == 0) {
+        op->start_time = http_io_rate_reserve(priv, io, http_io_get_time_millis() + io->retry_pause, 0);
+        pthread_mutex_lock(&loop->mutex);
+        TAILQ_INSERT_TAIL(&loop->pending, op, link);
+        CHECK_RETURN(pthread_mutex_unlock(&loop->mutex));
+        return;
+    }
+
+    // Operation is complete
+    (*op->done)(op, r);
+}
+
+static void
+http_io_loop_wakeup(struct http_io_loop *loop)
+{
+    const char ch = 0;
+    ssize_t r;
+
+    r = write(loop->wakeup[1], &ch, 1);         // if pipe is full, a wakeup is already pending
+    (void)r;
+}
+
+/*
+ * Hand an operation off to one of the event loops. The completion callback will be invoked
+ * exactly once from the event loop thread, unless an error is returned.
+ */
+static int
+http_io_submit(struct http_io_private *priv, struct http_io_op *op)
+{
+    struct http_io_conf *const config = priv->config;
+    struct http_io_loop *loop;
+
+    // Debug
+    if (config->debug)
+        (*config->log)(LOG_DEBUG, "%s %s", op->io->method, op->io->url);
+
+    // Initialize retry state
+    op->io->attempt = 0;
+    op->io->total_pause = 0;
+    op->io->retry_pause = 0;
+    op->start_time = http_io_rate_reserve(priv, op->io, http_io_get_time_millis(), 0);
+
+    // Choose a loop and add to its pending list; we hold "mutex" throughout so http_io_stop_loops() can't intervene
+    pthread_mutex_lock(&priv->mutex);
+    if (priv->loops == NULL) {
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+        return ENOTCONN;
+    }
+    loop = &priv->loops[priv->next_loop++ % priv->num_loops];
+    pthread_mutex_lock(&loop->mutex);
+    TAILQ_INSERT_TAIL(&loop->pending, op, link);
+    CHECK_RETURN(pthread_mutex_unlock(&loop->mutex));
+    http_io_loop_wakeup(loop);
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+    return 0;
+}
+
+/*
+ * Read multiple blocks using the asynchronous I/O engine.
+ */
+static int
+http_io_async_read_blocks(struct http_io_private *priv, s3b_block_t block_num, u_int num_blocks, void *dest)
+{
+    struct http_io_conf *const config = priv->config;
+    const size_t urlbuf_size = URL_BUF_SIZE(config);
+    struct http_io_read_req *reqs = NULL;
+    struct http_io_batch batch;
+    char *urlbufs = NULL;
+    u_int i;
+    int r;
+
+    // Sanity check
+    if (config->block_size == 0 || block_num + num_blocks < block_num || block_num + num_blocks > config->num_blocks)
+        return EINVAL;
+    if (num_blocks == 0)
+        return 0;
+
+    // Allocate requests
+    if ((reqs = calloc(num_blocks, sizeof(*reqs))) == NULL || (urlbufs = malloc(num_blocks * urlbuf_size)) == NULL) {
+        r = errno;
+        (*config->log)(LOG_ERR, "malloc: %s", strerror(r));
+        pthread_mutex_lock(&priv->mutex);
+        priv->stats.out_of_memory_errors++;
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+        free(reqs);
+        return r;
+    }
+
+    // Initialize batch; we hold one reference ourselves until all requests have been submitted
+    memset(&batch, 0, sizeof(batch));
+    batch.priv = priv;
+    if ((r = pthread_cond_init(&batch.done, NULL)) != 0)
+        goto done;
+    batch.remaining = 1;
+
+    // Submit requests
+    for (i = 0; i < num_blocks; i++) {
+        struct http_io_read_req *const req = &reqs[i];
+        char *const block_dest = (char *)dest + (size_t)i * config->block_size;
+
+        // Handle blocks known to be empty
+        if (http_io_read_empty(priv, block_num + i, block_dest, config->block_size, NULL))
+            continue;
+
+        // Prepare request
+        if ((r = http_io_read_start(priv, req, urlbufs + i * urlbuf_size, urlbuf_size,
+          block_num + i, block_dest, NULL, NULL, 0)) != 0) {
+            pthread_mutex_lock(&priv->mutex);
+            batch.error = batch.error != 0 ? batch.error : r;
+            CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+            break;
+        }
+        req->batch = &batch;
+        req->op.io = &req->io;
+        req->op.prepper = http_io_read_prepper;
+        req->op.done = http_io_async_read_done;
+        req->op.arg = req;
+
+        // Submit it
+        pthread_mutex_lock(&priv->mutex);
+        batch.remaining++;
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+        if ((r = http_io_submit(priv, &req->op)) != 0)
+            http_io_async_read_done(&req->op, r);
+    }
+
+    // Wait for all requests to complete
+    pthread_mutex_lock(&priv->mutex);
+    batch.remaining--;
+    while (batch.remaining > 0)
+        pthread_cond_wait(&batch.done, &priv->mutex);
+    r = batch.error;
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+    pthread_cond_destroy(&batch.done);
+
+done:
+    // Clean up
+    free(urlbufs);
+    free(reqs);
+    return r;
+}
+
+/*
+ * Write multiple blocks using the asynchronous I/O engine.
+ */
+static int
+http_io_async_write_blocks(struct http_io_private *priv, s3b_block_t block_num, u_int num_blocks, const void *src,
+  u_char *etags, check_cancel_t *check_cancel, void *check_cancel_arg)
+{
+    struct http_io_conf *const config = priv->config;
+    const size_t urlbuf_size = URL_BUF_SIZE(config);
+    struct http_io_write_req *reqs = NULL;
+    struct http_io_batch batch;
+    char *urlbufs = NULL;
+    u_int i;
+    int r;
+
+    // Sanity check
+    if (config->block_size == 0 || block_num + num_blocks < block_num || block_num + num_blocks > config->num_blocks)
+        return EINVAL;
+    if (num_blocks == 0)
+        return 0;
+
+    // Allocate requests
+    if ((reqs = calloc(num_blocks, sizeof(*reqs))) == NULL || (urlbufs = malloc(num_blocks * urlbuf_size)) == NULL) {
+        r = errno;
+        (*config->log)(LOG_ERR, "malloc: %s", strerror(r));
+        pthread_mutex_lock(&priv->mutex);
+        priv->stats.out_of_memory_errors++;
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+        free(reqs);
+        return r;
+    }
+
+    // Initialize batch; we hold one reference ourselves until all requests have been submitted
+    memset(&batch, 0, sizeof(batch));
+    batch.priv = priv;
+    batch.check_cancel = check_cancel;
+    batch.check_cancel_arg = check_cancel_arg;
+    if ((r = pthread_cond_init(&batch.done, NULL)) != 0)
+        goto done;
+    batch.remaining = 1;
+
+    // Submit requests
+    for (i = 0; i < num_blocks; i++) {
+        struct http_io_write_req *const req = &reqs[i];
+        const void *block_src = src != NULL ? (const char *)src + (size_t)i * config->block_size : NULL;
+        u_char *const block_etag = etags != NULL ? etags + (size_t)i * MD5_DIGEST_LENGTH : NULL;
+
+        // Detect zero blocks (if not done already by upper layer)
+        if (block_src != NULL && block_is_zeros(block_src))
+            block_src = NULL;
+
+        // Skip zero blocks known to be empty
+        if (http_io_write_empty(priv, block_num + i, block_src, block_etag))
+            continue;
+
+        // Hand off encoding and submission to the transform threads, if any
+        if (priv->xforms != NULL) {
+            req->batch = &batch;
+            req->block_num = block_num + i;
+            req->src = block_src;
+            req->caller_etag = block_etag;
+            req->urlbuf = urlbufs + i * urlbuf_size;
+            req->op.arg = req;
+            pthread_mutex_lock(&priv->mutex);
+            batch.remaining++;
+            CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+            http_io_xform_queue(priv, &req->op, http_io_async_write_xform, 0);
+            continue;
+        }
 
-        // Find out what the HTTP result code was (if any)
-        switch (curl_code) {
-        case CURLE_HTTP_RETURNED_ERROR:                         // should never happen (we no longer use CURLOPT_FAILONERROR)
-        case 0:
-            if (curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code) != 0)
-                http_code = 999;                                // this should never happen
-            break;
-        default:
-            http_code = -1;
+        // Prepare request
+        if ((r = http_io_write_start(priv, req, urlbufs + i * urlbuf_size, urlbuf_size,
+          block_num + i, block_src, block_etag, check_cancel, check_cancel_arg)) != 0) {
+            pthread_mutex_lock(&priv->mutex);
+            batch.error = batch.error != 0 ? batch.error : r;
+            CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
             break;
         }
+        req->batch = &batch;
+        req->op.io = &req->io;
+        req->op.prepper = http_io_write_prepper;
+        req->op.done = http_io_async_write_done;
+        req->op.arg = req;
 
-        // Pretend like the CURLOPT_FAILONERROR option was used
-        if (curl_code == 0 && http_code >= HTTP_STATUS_ERROR_MINIMUM)
-            curl_code = CURLE_HTTP_RETURNED_ERROR;
-
-        // In the case of a DELETE, treat an HTTP_NOT_FOUND error as successful
-        if (curl_code == CURLE_HTTP_RETURNED_ERROR
-          && http_code == HTTP_NOT_FOUND
-          && strcmp(io->method, HTTP_DELETE) == 0)
-            curl_code = 0;
+        // Submit it
+        pthread_mutex_lock(&priv->mutex);
+        batch.remaining++;
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+        if ((r = http_io_submit(priv, &req->op)) != 0)
+            http_io_async_write_done(&req->op, r);
+    }
 
-        // Handle success
-        if (curl_code == 0) {
-            double curl_time;
-            int r = 0;
+    // Wait for all requests to complete
+    pthread_mutex_lock(&priv->mutex);
+    batch.remaining--;
+    while (batch.remaining > 0)
+        pthread_cond_wait(&batch.done, &priv->mutex);
+    r = batch.error;
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+    pthread_cond_destroy(&batch.done);
 
-            // Discard any error payload (e.g., 404 Not Found from DELETE)
-            http_io_free_error_payload(io);
+done:
+    // Clean up
+    free(urlbufs);
+    free(reqs);
+    return r;
+}
 
-            // Extra debug logging
-            if (config->debug)
-                (*config->log)(LOG_DEBUG, "success: %s %s", io->method, io->url);
+/*
+ * Completion callbacks for asynchronous block reads and writes. The response is
+ * decoded (or the encoded upload buffer freed) here, in the event loop thread,
+ * unless there are transform threads, in which case reads are decoded there.
+ */
+static void
+http_io_async_read_done(struct http_io_op *op, int r)
+{
+    struct http_io_read_req *const req = op->arg;
+    struct http_io_private *const priv = req->batch->priv;
 
-            // Extract timing info
-            if ((curl_code = curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME, &curl_time)) != CURLE_OK) {
-                (*config->log)(LOG_ERR, "can't get cURL timing: %s", curl_easy_strerror(curl_code));
-                curl_time = 0.0;
-            }
+    if (priv->xforms != NULL) {
+        http_io_xform_queue(priv, op, http_io_async_read_xform, r);
+        return;
+    }
+    r = http_io_read_finish(priv, req, r);
+    http_io_batch_complete(priv, req->batch, r);
+}
 
-            // Extract content-length (if required)
-            if (io->content_lengthp != NULL) {
-                if ((curl_code = curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &clen)) == CURLE_OK)
-                    *io->content_lengthp = (u_int)clen;
-                else {
-                    (*config->log)(LOG_ERR, "can't get content-length: %s", curl_easy_strerror(curl_code));
-                    r = ENXIO;
-                }
-            }
+static void
+http_io_async_write_done(struct http_io_op *op, int r)
+{
+    struct http_io_write_req *const req = op->arg;
+    struct http_io_private *const priv = req->batch->priv;
 
-            // Update stats
-            pthread_mutex_lock(&priv->mutex);
-            if (strcmp(io->method, HTTP_GET) == 0) {
-                priv->stats.http_gets.count++;
-                priv->stats.http_gets.time += curl_time;
-            } else if (strcmp(io->method, HTTP_PUT) == 0) {
-                priv->stats.http_puts.count++;
-                priv->stats.http_puts.time += curl_time;
-            } else if (strcmp(io->method, HTTP_DELETE) == 0) {
-                priv->stats.http_deletes.count++;
-                priv->stats.http_deletes.time += curl_time;
-            } else if (strcmp(io->method, HTTP_HEAD) == 0) {
-                priv->stats.http_heads.count++;
-                priv->stats.http_heads.time += curl_time;
-            }
-            CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+    r = http_io_write_finish(priv, req, r);
+    http_io_batch_complete(priv, req->batch, r);
+}
 
-            // Done
-            http_io_release_curl(priv, &curl, r == 0);
-            return r;
-        }
+/*
+ * Transform functions for asynchronous block reads and writes, invoked in a transform thread.
+ */
+static void
+http_io_async_read_xform(struct http_io_xform *xform, struct http_io_op *op, int r)
+{
+    struct http_io_read_req *const req = op->arg;
+    struct http_io_private *const priv = req->batch->priv;
 
-        // Determine whether we think it's safe to re-use the curl handle after an error
-        may_cache = http_io_safe_to_cache_curl_handle(curl_code, http_code);
+    req->scratch = xform->scratch;
+    req->scratch_size = xform->scratch_size;
+    r = http_io_read_finish(priv, req, r);
+    http_io_batch_complete(priv, req->batch, r);
+}
 
-        // Free the curl handle (and don't cache it if connection might be broken)
-        http_io_release_curl(priv, &curl, may_cache);
+static void
+http_io_async_write_xform(struct http_io_xform *xform, struct http_io_op *op, int r)
+{
+    struct http_io_write_req *const req = op->arg;
+    struct http_io_private *const priv = req->batch->priv;
+    struct http_io_conf *const config = priv->config;
 
-        // Handle errors
-        switch (curl_code) {
-        case CURLE_ABORTED_BY_CALLBACK:
-            if (config->debug)
-                (*config->log)(LOG_DEBUG, "write aborted: %s %s", io->method, io->url);
-            pthread_mutex_lock(&priv->mutex);
-            priv->stats.http_canceled_writes++;
-            CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
-            http_io_free_error_payload(io);
-            return ECONNABORTED;
-        case CURLE_OPERATION_TIMEDOUT:
-            (*config->log)(LOG_NOTICE, "operation timeout: %s %s", io->method, io->url);
-            pthread_mutex_lock(&priv->mutex);
-            priv->stats.curl_timeouts++;
-            CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
-            break;
-        case CURLE_HTTP_RETURNED_ERROR:                 // special handling for some specific HTTP codes
-            switch (http_code) {
-            case HTTP_NOT_FOUND:
-                if (config->debug)
-                    (*config->log)(LOG_DEBUG, "rec'd %ld response: %s %s", http_code, io->method, io->url);
-                http_io_free_error_payload(io);
-                return ENOENT;
-            case HTTP_UNAUTHORIZED:
-                (*config->log)(LOG_ERR, "rec'd %ld response: %s %s", http_code, io->method, io->url);
-                pthread_mutex_lock(&priv->mutex);
-                priv->stats.http_unauthorized++;
-                CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
-                http_io_log_error_payload(io);
-                http_io_free_error_payload(io);
-                return EACCES;
-            case HTTP_FORBIDDEN:
-                (*config->log)(LOG_ERR, "rec'd %ld response: %s %s", http_code, io->method, io->url);
-                pthread_mutex_lock(&priv->mutex);
-                priv->stats.http_forbidden++;
-                CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
-                http_io_log_error_payload(io);
-                http_io_free_error_payload(io);
-                return EPERM;
-            case HTTP_PRECONDITION_FAILED:
-                (*config->log)(LOG_INFO, "rec'd stale content: %s %s", io->method, io->url);
-                pthread_mutex_lock(&priv->mutex);
-                priv->stats.http_stale++;
-                CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
-                break;
-            case HTTP_MOVED_PERMANENTLY:
-            case HTTP_FOUND:
-            case HTTP_TEMPORARY_REDIRECT:
-            case HTTP_PERMANENT_REDIRECT:
-                (*config->log)(LOG_ERR, "rec'd %ld redirect: %s %s", http_code, io->method, io->url);
-                (*config->log)(LOG_ERR, "hint: you may need the \"--vhost\" and/or \"--region\" flags");
-                pthread_mutex_lock(&priv->mutex);
-                priv->stats.http_redirect++;
-                CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
-                break;
-            case HTTP_NOT_MODIFIED:
-                if (io->expect_304) {
-                    if (config->debug)
-                        (*config->log)(LOG_DEBUG, "rec'd %ld response: %s %s", http_code, io->method, io->url);
-                    return EEXIST;
-                }
-                // FALLTHROUGH
-            default:
-                (*config->log)(LOG_ERR, "rec'd %ld response: %s %s", http_code, io->method, io->url);
-                pthread_mutex_lock(&priv->mutex);
-                switch (http_code / 100) {
-                case 3:
-                    priv->stats.http_3xx_error++;
-                    break;
-                case 4:
-                    priv->stats.http_4xx_error++;
-                    break;
-                case 5:
-                    priv->stats.http_5xx_error++;
-                    break;
-                default:
-                    priv->stats.http_other_error++;
-                    break;
-                }
-                CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
-                http_io_log_error_payload(io);
-                break;
-            }
-            break;
-        default:
-            (*config->log)(LOG_ERR, "operation failed: %s (%s)", curl_easy_strerror(curl_code),
-              total_pause >= config->max_retry_pause ? "final attempt" : "will retry");
-            pthread_mutex_lock(&priv->mutex);
-            switch (curl_code) {
-            case CURLE_OUT_OF_MEMORY:
-                priv->stats.curl_out_of_memory++;
-                break;
-            case CURLE_COULDNT_CONNECT:
-                priv->stats.curl_connect_failed++;
-                break;
-            case CURLE_COULDNT_RESOLVE_HOST:
-                priv->stats.curl_host_unknown++;
-                break;
-            default:
-                priv->stats.curl_other_error++;
-                break;
-            }
-            CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
-            break;
-        }
+    // Sanity check
+    assert(r == 0);
 
-        // Free any error payload
-        http_io_free_error_payload(io);
+    // Encode the block and prepare the request
+    if ((r = http_io_write_start(priv, req, req->urlbuf, URL_BUF_SIZE(config),
+      req->block_num, req->src, req->caller_etag, req->batch->check_cancel, req->batch->check_cancel_arg)) != 0) {
+        http_io_batch_complete(priv, req->batch, r);
+        return;
+    }
+    req->op.io = &req->io;
+    req->op.prepper = http_io_write_prepper;
+    req->op.done = http_io_async_write_done;
+    req->op.arg = req;
+
+    // Submit it
+    if ((r = http_io_submit(priv, &req->op)) != 0)
+        http_io_async_write_done(&req->op, r);
+}
 
-        // Retry with exponential backoff up to max total pause limit
-        if (total_pause >= config->max_retry_pause)
-            break;
-        retry_pause = retry_pause > 0 ? retry_pause * 2 : config->initial_retry_pause;
-        if (total_pause + retry_pause > config->max_retry_pause)
-            retry_pause = config->max_retry_pause - total_pause;
-        delay.tv_sec = retry_pause / 1000;
-        delay.tv_nsec = (retry_pause % 1000) * 1000000;
-        nanosleep(&delay, NULL);            // TODO: check for EINTR
+/*
+ * Record the completion of one operation in a batch.
+ */
+static void
+http_io_batch_complete(struct http_io_private *priv, struct http_io_batch *batch, int r)
+{
+    pthread_mutex_lock(&priv->mutex);
+    if (r != 0 && batch->error == 0)
+        batch->error = r;
+    assert(batch->remaining > 0);
+    if (--batch->remaining == 0)
+        pthread_cond_signal(&batch->done);
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+}
 
-        // Update retry stats
-        pthread_mutex_lock(&priv->mutex);
-        priv->stats.num_retries++;
-        priv->stats.retry_delay += retry_pause;
-        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
-    }
+static uint64_t
+http_io_get_time_millis(void)
+{
+    struct timeval tv;
 
-    // Give up
-    (*config->log)(LOG_ERR, "giving up on: %s %s", io->method, io->url);
-    return EIO;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000 + (uint64_t)tv.tv_usec / 1000;
 }
 
 /*
@@ -2681,6 +4796,8 @@ http_io_add_auth4(struct http_io_private *priv, struct http_io *const io, time_t
     char access_id[128];
     char access_key[128];
     char *iam_token = NULL;
+    u_int cred_generation;
+    int have_sigkey;
     struct tm tm;
     char *p;
     int r;
@@ -2690,10 +4807,16 @@ http_io_add_auth4(struct http_io_private *priv, struct http_io *const io, time_t
     hash_ctx = EVP_MD_CTX_new();
     assert(hash_ctx != NULL);
 
-    // Snapshot current credentials
+    // Format date
+    strftime(datebuf, sizeof(datebuf), AWS_DATE_BUF_FMT, gmtime_r(&now, &tm));
+
+    // Snapshot current credentials and cached signing key (if still valid for today)
     pthread_mutex_lock(&priv->mutex);
     snvprintf(access_id, sizeof(access_id), "%s", config->accessId);
     snvprintf(access_key, sizeof(access_key), "%s%s", ACCESS_KEY_PREFIX, config->accessKey);
+    cred_generation = priv->cred_generation;
+    if ((have_sigkey = memcmp(priv->sigkey_date, datebuf, sizeof(priv->sigkey_date)) == 0))
+        memcpy(hmac_result, priv->sigkey, sizeof(hmac_result));
     if (config->iam_token != NULL && (iam_token = strdup(config->iam_token)) == NULL) {
         r = errno;
         CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
@@ -2720,16 +4843,19 @@ http_io_add_auth4(struct http_io_private *priv, struct http_io *const io, time_t
         query_params_len = 0;
     }
 
-    // Format date
-    strftime(datebuf, sizeof(datebuf), AWS_DATE_BUF_FMT, gmtime_r(&now, &tm));
-
 /****** Hash Payload and Add Header ******/
 
-    EVP_DigestInit_ex(hash_ctx, EVP_sha256(), NULL);
-    if (payload != NULL)
-        EVP_DigestUpdate(hash_ctx, payload, plen);
-    EVP_DigestFinal_ex(hash_ctx, payload_hash, &payload_hash_len);
-    http_io_prhex(payload_hash_buf, payload_hash, payload_hash_len);
+    if (config->unsigned_payload)
+        snvprintf(payload_hash_buf, sizeof(payload_hash_buf), "%s", UNSIGNED_PAYLOAD);
+    else if (io->payload_sha256 != NULL)
+        http_io_prhex(payload_hash_buf, io->payload_sha256, SHA256_DIGEST_LENGTH);
+    else {
+        EVP_DigestInit_ex(hash_ctx, EVP_sha256(), NULL);
+        if (payload != NULL)
+            EVP_DigestUpdate(hash_ctx, payload, plen);
+        EVP_DigestFinal_ex(hash_ctx, payload_hash, &payload_hash_len);
+        http_io_prhex(payload_hash_buf, payload_hash, payload_hash_len);
+    }
 
     io->headers = http_io_add_header(priv, io->headers, "%s: %s", CONTENT_SHA256_HEADER, payload_hash_buf);
 
@@ -2857,40 +4983,56 @@ http_io_add_auth4(struct http_io_private *priv, struct http_io *const io, time_t
 
 /****** Derive Signing Key ******/
 
-    // Do nested HMAC's
-    if ((hmac_ctx = hmac_new_sha256(priv->hmac, access_key, strlen(access_key))) == NULL) {
-        r = errno;
-        goto fail;
-    }
+    // Do nested HMAC's, unless we already have the signing key for today
+    if (!have_sigkey) {
+        if ((hmac_ctx = hmac_new_sha256(priv->hmac, access_key, strlen(access_key))) == NULL) {
+            r = errno;
+            goto fail;
+        }
 #if DEBUG_AUTHENTICATION
-    (*config->log)(LOG_DEBUG, "auth: access_key = \"%s\"", access_key);
+        (*config->log)(LOG_DEBUG, "auth: access_key = \"%s\"", access_key);
 #endif
-    hmac_update(hmac_ctx, (const u_char *)datebuf, 8);
-    hmac_final(hmac_ctx, hmac_result);
+        hmac_update(hmac_ctx, (const u_char *)datebuf, 8);
+        hmac_final(hmac_ctx, hmac_result);
 #if DEBUG_AUTHENTICATION
-    http_io_prhex(hmac_buf, hmac_result, sizeof(hmac_result));
-    (*config->log)(LOG_DEBUG, "auth: HMAC[%.8s] = %s", datebuf, hmac_buf);
+        http_io_prhex(hmac_buf, hmac_result, sizeof(hmac_result));
+        (*config->log)(LOG_DEBUG, "auth: HMAC[%.8s] = %s", datebuf, hmac_buf);
 #endif
-    hmac_reset(hmac_ctx, hmac_result, sizeof(hmac_result));
-    hmac_update(hmac_ctx, (const u_char *)config->region, strlen(config->region));
-    hmac_final(hmac_ctx, hmac_result);
+        hmac_reset(hmac_ctx, hmac_result, sizeof(hmac_result));
+        hmac_update(hmac_ctx, (const u_char *)config->region, strlen(config->region));
+        hmac_final(hmac_ctx, hmac_result);
 #if DEBUG_AUTHENTICATION
-    http_io_prhex(hmac_buf, hmac_result, sizeof(hmac_result));
-    (*config->log)(LOG_DEBUG, "auth: HMAC[%s] = %s", config->region, hmac_buf);
+        http_io_prhex(hmac_buf, hmac_result, sizeof(hmac_result));
+        (*config->log)(LOG_DEBUG, "auth: HMAC[%s] = %s", config->region, hmac_buf);
 #endif
-    hmac_reset(hmac_ctx, hmac_result, sizeof(hmac_result));
-    hmac_update(hmac_ctx, (const u_char *)S3_SERVICE_NAME, strlen(S3_SERVICE_NAME));
-    hmac_final(hmac_ctx, hmac_result);
+        hmac_reset(hmac_ctx, hmac_result, sizeof(hmac_result));
+        hmac_update(hmac_ctx, (const u_char *)S3_SERVICE_NAME, strlen(S3_SERVICE_NAME));
+        hmac_final(hmac_ctx, hmac_result);
 #if DEBUG_AUTHENTICATION
-    http_io_prhex(hmac_buf, hmac_result, sizeof(hmac_result));
-    (*config->log)(LOG_DEBUG, "auth: HMAC[%s] = %sn", S3_SERVICE_NAME, hmac_buf);
+        http_io_prhex(hmac_buf, hmac_result, sizeof(hmac_result));
+        (*config->log)(LOG_DEBUG, "auth: HMAC[%s] = %sn", S3_SERVICE_NAME, hmac_buf);
 #endif
-    hmac_reset(hmac_ctx, hmac_result, sizeof(hmac_result));
-    hmac_update(hmac_ctx, (const u_char *)SIGNATURE_TERMINATOR, strlen(SIGNATURE_TERMINATOR));
-    hmac_final(hmac_ctx, hmac_result);
+        hmac_reset(hmac_ctx, hmac_result, sizeof(hmac_result));
+        hmac_update(hmac_ctx, (const u_char *)SIGNATURE_TERMINATOR, strlen(SIGNATURE_TERMINATOR));
+        hmac_final(hmac_ctx, hmac_result);
 #if DEBUG_AUTHENTICATION
-    http_io_prhex(hmac_buf, hmac_result, sizeof(hmac_result));
-    (*config->log)(LOG_DEBUG, "auth: HMAC[%s] = %s", SIGNATURE_TERMINATOR, hmac_buf);
+        http_io_prhex(hmac_buf, hmac_result, sizeof(hmac_result));
+        (*config->log)(LOG_DEBUG, "auth: HMAC[%s] = %s", SIGNATURE_TERMINATOR, hmac_buf);
+#endif
+
+        // Cache the signing key, unless the credentials changed in the meantime
+        pthread_mutex_lock(&priv->mutex);
+        if (priv->cred_generation == cred_generation) {
+            memcpy(priv->sigkey, hmac_result, sizeof(priv->sigkey));
+            memcpy(priv->sigkey_date, datebuf, sizeof(priv->sigkey_date));
+        }
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+    }
+#if DEBUG_AUTHENTICATION
+    else {
+        http_io_prhex(hmac_buf, hmac_result, sizeof(hmac_result));
+        (*config->log)(LOG_DEBUG, "auth: using cached signing key %s", hmac_buf);
+    }
 #endif
 
 /****** Sign the String To Sign ******/
@@ -2898,7 +5040,12 @@ http_io_add_auth4(struct http_io_private *priv, struct http_io *const io, time_t
 #if DEBUG_AUTHENTICATION
     *sigbuf = '\0';
 #endif
-    hmac_reset(hmac_ctx, hmac_result, sizeof(hmac_result));
+    if (hmac_ctx != NULL)
+        hmac_reset(hmac_ctx, hmac_result, sizeof(hmac_result));
+    else if ((hmac_ctx = hmac_new_sha256(priv->hmac, hmac_result, sizeof(hmac_result))) == NULL) {
+        r = errno;
+        goto fail;
+    }
     hmac_update(hmac_ctx, (const u_char *)SIGNATURE_ALGORITHM, strlen(SIGNATURE_ALGORITHM));
     hmac_update(hmac_ctx, (const u_char *)"\n", 1);
 #if DEBUG_AUTHENTICATION
@@ -3108,6 +5255,11 @@ http_io_acquire_curl(struct http_io_private *priv, struct http_io *io)
         curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
     if (config->http_11)
         curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+#if LIBCURL_VERSION_NUM >= 0x072f00
+    else
+        curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+#endif
+    curl_easy_setopt(curl, CURLOPT_SHARE, priv->share);
     return curl;
 }
 
@@ -3254,6 +5406,168 @@ http_io_release_curl(struct http_io_private *priv, CURL **curlp, int may_cache)
     CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
 }
 
+/*
+ * Create the cURL share handle used by all of our CURL instances. This lets every handle
+ * use the same DNS cache and TLS session cache.
+ *
+ * We don't share the connection cache: libcurl documents CURL_LOCK_DATA_CONNECT as not safe
+ * to use from multiple threads concurrently, and our handles are driven by many threads at once.
+ */
+static int
+http_io_share_create(struct http_io_private *priv)
+{
+    struct http_io_conf *const config = priv->config;
+    CURLSHcode scode;
+    int nlocks;
+    int r;
+
+    // Initialize locks
+    for (nlocks = 0; nlocks < CURL_LOCK_DATA_LAST; nlocks++) {
+        if ((r = pthread_mutex_init(&priv->share_locks[nlocks], NULL)) != 0)
+            goto fail0;
+    }
+
+    // Create share handle
+    if ((priv->share = curl_share_init()) == NULL) {
+        (*config->log)(LOG_ERR, "curl_share_init() failed");
+        r = ENOMEM;
+        goto fail0;
+    }
+    curl_share_setopt(priv->share, CURLSHOPT_LOCKFUNC, http_io_share_lock);
+    curl_share_setopt(priv->share, CURLSHOPT_UNLOCKFUNC, http_io_share_unlock);
+    curl_share_setopt(priv->share, CURLSHOPT_USERDATA, priv);
+
+    // Share DNS and TLS sessions
+    if ((scode = curl_share_setopt(priv->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS)) != CURLSHE_OK
+      || (scode = curl_share_setopt(priv->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION)) != CURLSHE_OK) {
+        (*config->log)(LOG_ERR, "curl_share_setopt: %s", curl_share_strerror(scode));
+        r = EINVAL;
+        goto fail1;
+    }
+
+    // Done
+    return 0;
+
+fail1:
+    curl_share_cleanup(priv->share);
+    priv->share = NULL;
+fail0:
+    while (nlocks > 0)
+        pthread_mutex_destroy(&priv->share_locks[--nlocks]);
+    return r;
+}
+
+/*
+ * Destroy the cURL share handle. All CURL instances using it must have been cleaned up already.
+ */
+static void
+http_io_share_destroy(struct http_io_private *priv)
+{
+    struct http_io_conf *const config = priv->config;
+    CURLSHcode scode;
+    int i;
+
+    if ((scode = curl_share_cleanup(priv->share)) != CURLSHE_OK)
+        (*config->log)(LOG_ERR, "curl_share_cleanup: %s", curl_share_strerror(scode));
+    priv->share = NULL;
+    for (i = 0; i < CURL_LOCK_DATA_LAST; i++)
+        pthread_mutex_destroy(&priv->share_locks[i]);
+}
+
+static void
+http_io_share_lock(CURL *curl, curl_lock_data data, curl_lock_access access, void *arg)
+{
+    struct http_io_private *const priv = arg;
+
+    pthread_mutex_lock(&priv->share_locks[data]);
+}
+
+static void
+http_io_share_unlock(CURL *curl, curl_lock_data data, void *arg)
+{
+    struct http_io_private *const priv = arg;
+
+    CHECK_RETURN(pthread_mutex_unlock(&priv->share_locks[data]));
+}
+
+/*
+ * Open "prewarm_connections" connections to the server in parallel, so that DNS resolution,
+ * TCP connection setup, and the TLS handshake are already done before real traffic arrives.
+ *
+ * Each thread sends an unauthenticated HEAD request for block zero; the HTTP status doesn't matter.
+ * The resulting DNS and TLS session cache entries are kept in our share handle, and each CURL instance
+ * (along with its open connection) is added to our pool for reuse. Errors are not fatal.
+ */
+static void
+http_io_prewarm_connections(struct http_io_private *priv)
+{
+    struct http_io_conf *const config = priv->config;
+    pthread_t *threads;
+    u_int num_threads;
+    u_int num_ok;
+    void *result;
+    int r;
+
+    // Start threads
+    if ((threads = calloc(config->prewarm_connections, sizeof(*threads))) == NULL) {
+        (*config->log)(LOG_ERR, "can't prewarm connections: %s", strerror(errno));
+        return;
+    }
+    for (num_threads = 0; num_threads < config->prewarm_connections; num_threads++) {
+        if ((r = pthread_create(&threads[num_threads], NULL, http_io_prewarm_main, priv)) != 0) {
+            (*config->log)(LOG_ERR, "can't prewarm connections: pthread_create: %s", strerror(r));
+            break;                                      // just proceed with the threads we have
+        }
+    }
+
+    // Wait for them all to complete
+    for (num_ok = 0; num_threads > 0; ) {
+        if ((r = pthread_join(threads[--num_threads], &result)) != 0) {
+            (*config->log)(LOG_ERR, "pthread_join: %s", strerror(r));
+            continue;
+        }
+        if (result != NULL)
+            num_ok++;
+    }
+    if (config->debug)
+        (*config->log)(LOG_DEBUG, "prewarmed %u of %u connections", num_ok, config->prewarm_connections);
+
+    // Clean up
+    free(threads);
+}
+
+/*
+ * Open one connection for http_io_prewarm_connections(). Returns non-NULL if we got any HTTP response at all.
+ */
+static void *
+http_io_prewarm_main(void *arg)
+{
+    struct http_io_private *const priv = arg;
+    struct http_io_conf *const config = priv->config;
+    char urlbuf[URL_BUF_SIZE(config)];
+    struct http_io io;
+    long http_code = 0;
+    CURL *curl;
+
+    // Construct URL for the first block
+    http_io_get_block_url(urlbuf, sizeof(urlbuf), config, 0);
+    memset(&io, 0, sizeof(io));
+    io.url = urlbuf;
+
+    // Perform request
+    if ((curl = http_io_acquire_curl(priv, &io)) == NULL)
+        return NULL;
+    curl_easy_setopt(curl, CURLOPT_NOBODY, (long)1);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, (long)0);
+    if (curl_easy_perform(curl) != CURLE_OK
+      || curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code) != CURLE_OK)
+        http_code = 0;
+
+    // Release CURL instance; keep it only if we got a response
+    http_io_release_curl(priv, &curl, http_code != 0);
+    return http_code != 0 ? priv : NULL;
+}
+
 static int
 http_io_reader_error_check(struct http_io *const io, const void *ptr, size_t len)
 {
@@ -3446,6 +5760,59 @@ http_io_authsig(struct http_io_private *priv, s3b_block_t block_num, const u_cha
     hmac_free(ctx);
 }
 
+/*
+ * Compute the MD5 and (optionally) SHA-256 digests of a payload in a single pass,
+ * alternating between the two digests one small chunk at a time so the data is only read from memory once.
+ */
+static void
+http_io_hash_payload(const void *data, size_t len, u_char *md5, u_char *sha256)
+{
+    EVP_MD_CTX *md5_ctx;
+    EVP_MD_CTX *sha256_ctx = NULL;
+    size_t chunk;
+    u_int hash_len;
+    int r;
+
+#ifdef NDEBUG
+    // Avoid unused variable warning
+    (void)r;
+#endif
+
+    // Initialize digests
+    md5_ctx = EVP_MD_CTX_new();
+    assert(md5_ctx != NULL);
+    r = EVP_DigestInit_ex(md5_ctx, EVP_md5(), NULL);
+    assert(r != 0);
+    if (sha256 != NULL) {
+        sha256_ctx = EVP_MD_CTX_new();
+        assert(sha256_ctx != NULL);
+        r = EVP_DigestInit_ex(sha256_ctx, EVP_sha256(), NULL);
+        assert(r != 0);
+    }
+
+    // Digest data
+    while (len > 0) {
+        chunk = len < PAYLOAD_HASH_CHUNK ? len : PAYLOAD_HASH_CHUNK;
+        EVP_DigestUpdate(md5_ctx, data, chunk);
+        if (sha256_ctx != NULL)
+            EVP_DigestUpdate(sha256_ctx, data, chunk);
+        data = (const u_char *)data + chunk;
+        len -= chunk;
+    }
+
+    // Finalize digests
+    r = EVP_DigestFinal_ex(md5_ctx, md5, &hash_len);
+    assert(r != 0);
+    assert(hash_len == MD5_DIGEST_LENGTH);
+    EVP_MD_CTX_free(md5_ctx);
+    if (sha256_ctx != NULL) {
+        r = EVP_DigestFinal_ex(sha256_ctx, sha256, &hash_len);
+        assert(r != 0);
+        assert(hash_len == SHA256_DIGEST_LENGTH);
+        EVP_MD_CTX_free(sha256_ctx);
+    }
+}
+
 static void
 update_hmac_from_header(struct hmac_ctx *const ctx, struct http_io *const io,
   const char *name, int value_only, char *sigbuf, size_t sigbuflen)
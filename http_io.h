@@ -56,6 +56,9 @@
 #define SSE_AES256                          "AES256"
 #define SSE_AWS_KMS                         "aws:kms"
 
+// Forward decl's
+struct sbitmap;
+
 // Configuration info structure for http_io store
 struct http_io_conf {
     char                    *accessId;
@@ -79,73 +82,86 @@ struct http_io_conf {
     int                     debug;
     int                     debug_http;
     int                     http_11;                    // restrict to HTTP 1.1
+    int                     unsigned_payload;           // don't include payload hash in AWS version 4 signatures
+    u_int                   hedge_percentile;           // hedge block reads slower than this GET percentile; zero to disable
+    u_int                   hedge_budget;               // max hedged reads as a percentage of all block reads
     int                     quiet;
     const struct comp_alg   *compress_alg;              // compression algorithm, or NULL for none
     void                    *compress_level;            // compression level info
     int                     vhost;                      // use virtual host style URL
-    bitmap_t                *nonzero_bitmap;            // is set to NULL by http_io_create()
+    struct sbitmap          *nonzero_bitmap;            // is set to NULL by http_io_create()
     int                     blockHashPrefix;
     int                     insecure;
     u_int                   block_size;
     s3b_block_t             num_blocks;
+    s3b_block_t             file_blocks;                // blocks advertised in the file size meta-data (excludes dedup index)
     int                     list_blocks_threads;
+    u_int                   io_threads;
+    u_int                   event_threads;              // zero means no asynchronous I/O engine
+    u_int                   transform_threads;          // zero means no transform thread pool
+    u_int                   prewarm_connections;        // connections to open at startup
     u_int                   timeout;
     u_int                   initial_retry_pause;
     u_int                   max_retry_pause;
     uintmax_t               max_speed[2];
+    u_int                   max_request_rate;           // max requests/sec (per prefix range if blockHashPrefix); zero for none
+    uintmax_t               max_total_speed;            // max aggregate bits/sec; zero for none
     log_func_t              *log;
     const char              *sse;
     const char              *sse_key_id;
 };
 
 // Statistics structure for http_io store
-struct http_io_evst {
-    u_int               count;                      // number of occurrences
-    double              time;                       // total time taken
-};
-
 struct http_io_stats {
 
     // Block stats
-    u_int               normal_blocks_read;
-    u_int               normal_blocks_written;
-    u_int               zero_blocks_read;
-    u_int               zero_blocks_written;
-    u_int               empty_blocks_read;          // only when nonzero_bitmap != NULL
-    u_int               empty_blocks_written;       // only when nonzero_bitmap != NULL
+    uint64_t            normal_blocks_read;
+    uint64_t            normal_blocks_written;
+    uint64_t            zero_blocks_read;
+    uint64_t            partial_blocks_read;        // read using range GETs
+    uint64_t            zero_blocks_written;
+    uint64_t            empty_blocks_read;          // only when nonzero_bitmap != NULL
+    uint64_t            empty_blocks_written;       // only when nonzero_bitmap != NULL
 
     // HTTP transfer stats
-    struct http_io_evst http_heads;                 // total successful
-    struct http_io_evst http_gets;                  // total successful
-    struct http_io_evst http_puts;                  // total successful
-    struct http_io_evst http_deletes;               // total successful
-    u_int               http_unauthorized;
-    u_int               http_forbidden;
-    u_int               http_stale;
-    u_int               http_redirect;
-    u_int               http_verified;
-    u_int               http_mismatch;
-    u_int               http_5xx_error;
-    u_int               http_4xx_error;
-    u_int               http_3xx_error;
-    u_int               http_other_error;
-    u_int               http_canceled_writes;
+    struct latency_hist http_heads;                 // total successful
+    struct latency_hist http_gets;                  // total successful
+    struct latency_hist http_puts;                  // total successful
+    struct latency_hist http_deletes;               // total successful
+    uint64_t            http_unauthorized;
+    uint64_t            http_forbidden;
+    uint64_t            http_stale;
+    uint64_t            http_redirect;
+    uint64_t            http_verified;
+    uint64_t            http_mismatch;
+    uint64_t            http_5xx_error;
+    uint64_t            http_4xx_error;
+    uint64_t            http_3xx_error;
+    uint64_t            http_other_error;
+    uint64_t            http_canceled_writes;
+    uint64_t            http_hedged_gets;           // duplicate GETs issued for slow block reads
+    uint64_t            http_hedge_wins;            // duplicate GETs that finished first
 
     // CURL stats
-    u_int               curl_handles_created;
-    u_int               curl_handles_reused;
-    u_int               curl_timeouts;
-    u_int               curl_connect_failed;
-    u_int               curl_host_unknown;
-    u_int               curl_out_of_memory;
-    u_int               curl_other_error;
+    uint64_t            curl_handles_created;
+    uint64_t            curl_handles_reused;
+    uint64_t            curl_timeouts;
+    uint64_t            curl_connect_failed;
+    uint64_t            curl_host_unknown;
+    uint64_t            curl_out_of_memory;
+    uint64_t            curl_other_error;
 
     // Retry stats
-    u_int               num_retries;
+    uint64_t            num_retries;
     uint64_t            retry_delay;
 
+    // Rate limiting stats
+    uint64_t            rate_limit_waits;           // requests delayed by --maxRequestRate or --maxTotalSpeed
+    uint64_t            rate_limit_delay;           // total delay in milliseconds
+    uint64_t            rate_limit_slowdowns;       // request rate decreases due to 503 responses
+
     // Misc
-    u_int               out_of_memory_errors;
+    uint64_t            out_of_memory_errors;
 };
 
 // http_io.c
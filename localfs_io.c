@@ -0,0 +1,753 @@
+
+/*
+ * s3backer - FUSE-based single file backing store via Amazon S3
+ *
+ * Copyright 2008-2020 Archie L. Cobbs <archie.cobbs@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations including
+ * the two.
+ *
+ * You must obey the GNU General Public License in all respects for all
+ * of the code used other than OpenSSL. If you modify file(s) with this
+ * exception, you may extend this exception to your version of the
+ * file(s), but you are not obligated to do so. If you do not wish to do
+ * so, delete this exception statement from your version. If you delete
+ * this exception statement from all source files in the program, then
+ * also delete it here.
+ */
+
+#include "s3backer.h"
+#include "localfs_io.h"
+#include "util.h"
+
+/*
+ * Local file (or block device) implementation of s3backer_store.
+ *
+ * Block N is stored at offset N * block_size of a single file, so there is no per-block metadata and
+ * contiguous ranges of blocks are read and written with a single system call. All I/O is done using
+ * positional reads and writes, so any number of threads can be doing I/O at the same time without locking.
+ *
+ * Zero blocks are stored as holes when possible (or, with preallocation, as unwritten extents), which
+ * also gives us cheap implementations of survey_non_zero() and block_status() via SEEK_DATA/SEEK_HOLE.
+ *
+ * With O_DIRECT, transfers to or from buffers that are not suitably aligned go through a bounce buffer.
+ * The block size must be a multiple of DIRECT_ALIGN, and we don't support partial block writes (which
+ * would require an unlocked read-modify-write of the surrounding range), so writes never overlap.
+ *
+ * Mount tokens are not stored; instead, we hold an exclusive flock(2) on the file while it's open.
+ */
+
+// fallocate(2) stuff
+#if HAVE_DECL_FALLOCATE && HAVE_DECL_FALLOC_FL_PUNCH_HOLE && HAVE_DECL_FALLOC_FL_KEEP_SIZE
+#define USE_FALLOCATE           1
+#endif
+
+// Alignment required for O_DIRECT buffers, offsets, and lengths
+#define DIRECT_ALIGN            LOCALFS_IO_DIRECT_ALIGN
+
+// Round up to a multiple of a power of two
+#define ROUNDUP2(x, y)          (((x) + (y) - 1) & ~((y) - 1))
+
+// Max number of blocks reported to the survey callback at once
+#define SURVEY_BATCH            1024
+
+// Internal state
+struct localfs_io_private {
+    struct localfs_io_conf      *config;
+    struct localfs_io_stats     stats;
+    pthread_mutex_t             mutex;                  // protects "stats"
+    int                         fd;
+    int                         direct;                 // file was opened with O_DIRECT
+    int                         use_seek_data;          // SEEK_DATA/SEEK_HOLE are supported
+    volatile int                shutdown;
+};
+
+// s3backer_store functions
+static int localfs_io_create_threads(struct s3backer_store *s3b);
+static int localfs_io_meta_data(struct s3backer_store *s3b, off_t *file_sizep, u_int *block_sizep);
+static int localfs_io_set_mount_token(struct s3backer_store *s3b, int32_t *old_valuep, int32_t new_value);
+static int localfs_io_read_block(struct s3backer_store *s3b, s3b_block_t block_num, void *dest,
+  u_char *actual_etag, const u_char *expect_etag, int strict);
+static int localfs_io_read_block_part(struct s3backer_store *s3b, s3b_block_t block_num, u_int off, u_int len, void *dest);
+static int localfs_io_write_block(struct s3backer_store *s3b, s3b_block_t block_num, const void *src, u_char *etag,
+  check_cancel_t *check_cancel, void *check_cancel_arg);
+static int localfs_io_write_block_part(struct s3backer_store *s3b, s3b_block_t block_num, u_int off, u_int len,
+  const void *src);
+static int localfs_io_read_blocks(struct s3backer_store *s3b, s3b_block_t block_num, u_int num_blocks, void *dest);
+static int localfs_io_write_blocks(struct s3backer_store *s3b, s3b_block_t block_num, u_int num_blocks, const void *src,
+    u_char *etags, check_cancel_t *check_cancel, void *check_cancel_arg);
+static int localfs_io_flush_blocks(struct s3backer_store *s3b, const s3b_block_t *block_nums, u_int num_blocks, long timeout);
+static int localfs_io_survey_non_zero(struct s3backer_store *s3b, const struct survey_params *params);
+static int localfs_io_block_status(struct s3backer_store *s3b, s3b_block_t block_num, s3b_block_t max_blocks,
+  int *zerop, s3b_block_t *num_blocksp);
+static int localfs_io_shutdown(struct s3backer_store *s3b);
+static void localfs_io_destroy(struct s3backer_store *s3b);
+
+// Internal functions
+static int localfs_io_pread(struct localfs_io_private *priv, off_t offset, void *dest, size_t len);
+static int localfs_io_pwrite(struct localfs_io_private *priv, off_t offset, const void *src, size_t len);
+static int localfs_io_zero(struct localfs_io_private *priv, off_t offset, size_t len);
+static int localfs_io_check_etag(struct localfs_io_private *priv, s3b_block_t block_num, const void *data,
+  u_char *actual_etag, const u_char *expect_etag, int strict);
+static int localfs_io_is_aligned(struct localfs_io_private *priv, const void *buf, off_t offset, size_t len);
+
+/*
+ * Constructor
+ *
+ * On error, returns NULL and sets `errno'.
+ */
+struct s3backer_store *
+localfs_io_create(struct localfs_io_conf *config)
+{
+    const off_t size = (off_t)config->num_blocks * config->block_size;
+    struct s3backer_store *s3b;
+    struct localfs_io_private *priv;
+    struct stat sb;
+    int flags;
+    int r;
+
+    // Initialize structures
+    if ((s3b = calloc(1, sizeof(*s3b))) == NULL) {
+        r = errno;
+        goto fail0;
+    }
+    s3b->create_threads = localfs_io_create_threads;
+    s3b->meta_data = localfs_io_meta_data;
+    s3b->set_mount_token = localfs_io_set_mount_token;
+    s3b->read_block = localfs_io_read_block;
+    s3b->read_block_part = localfs_io_read_block_part;
+    s3b->write_block = localfs_io_write_block;
+    s3b->read_blocks = localfs_io_read_blocks;
+    s3b->write_blocks = localfs_io_write_blocks;
+    s3b->bulk_zero = generic_bulk_zero;
+    s3b->flush_blocks = localfs_io_flush_blocks;
+    s3b->survey_non_zero = localfs_io_survey_non_zero;
+    s3b->block_status = localfs_io_block_status;
+    s3b->shutdown = localfs_io_shutdown;
+    s3b->destroy = localfs_io_destroy;
+    if ((priv = calloc(1, sizeof(*priv))) == NULL) {
+        r = errno;
+        goto fail1;
+    }
+    priv->config = config;
+    if ((r = pthread_mutex_init(&priv->mutex, NULL)) != 0)
+        goto fail2;
+    s3b->data = priv;
+
+    // Open file
+    flags = (config->read_only ? O_RDONLY : O_RDWR | O_CREAT) | O_CLOEXEC;
+#ifdef O_DIRECT
+    if (config->direct_io) {
+        if (config->block_size % DIRECT_ALIGN != 0) {
+            r = EINVAL;
+            (*config->log)(LOG_ERR, "O_DIRECT requires a block size that is a multiple of %u", DIRECT_ALIGN);
+            goto fail3;
+        }
+        flags |= O_DIRECT;
+        priv->direct = 1;
+    }
+#else
+    if (config->direct_io)
+        (*config->log)(LOG_WARNING, "O_DIRECT is not supported on this platform; ignoring");
+#endif
+    if (!priv->direct)
+        s3b->write_block_part = localfs_io_write_block_part;
+    if ((priv->fd = open(config->path, flags, 0644)) == -1) {
+        r = errno;
+        (*config->log)(LOG_ERR, "can't open %s: %s", config->path, strerror(r));
+        goto fail3;
+    }
+
+    // Lock it so no other instance can use it at the same time
+    if (flock(priv->fd, (config->read_only ? LOCK_SH : LOCK_EX) | LOCK_NB) == -1) {
+        r = errno == EWOULDBLOCK ? EBUSY : errno;
+        (*config->log)(LOG_ERR, "can't lock %s: %s", config->path, strerror(r));
+        goto fail4;
+    }
+
+    // Check size, extending (and optionally preallocating) regular files as needed
+    if (fstat(priv->fd, &sb) == -1) {
+        r = errno;
+        (*config->log)(LOG_ERR, "can't stat %s: %s", config->path, strerror(r));
+        goto fail4;
+    }
+    if (S_ISREG(sb.st_mode)) {
+        if (sb.st_size < size && !config->read_only && ftruncate(priv->fd, size) == -1) {
+            r = errno;
+            (*config->log)(LOG_ERR, "can't extend %s to %ju bytes: %s", config->path, (uintmax_t)size, strerror(r));
+            goto fail4;
+        }
+#if USE_FALLOCATE
+        if (config->preallocate && !config->read_only && fallocate(priv->fd, FALLOC_FL_KEEP_SIZE, 0, size) == -1) {
+            r = errno;
+            (*config->log)(LOG_ERR, "can't preallocate %s: %s", config->path, strerror(r));
+            goto fail4;
+        }
+#endif
+    } else if (S_ISBLK(sb.st_mode)) {
+        off_t dev_size;
+
+        if ((dev_size = lseek(priv->fd, 0, SEEK_END)) == (off_t)-1) {
+            r = errno;
+            (*config->log)(LOG_ERR, "can't determine size of %s: %s", config->path, strerror(r));
+            goto fail4;
+        }
+        if (dev_size < size) {
+            (*config->log)(LOG_ERR, "%s: device is too small (%ju < %ju bytes)",
+              config->path, (uintmax_t)dev_size, (uintmax_t)size);
+            r = EINVAL;
+            goto fail4;
+        }
+    } else {
+        (*config->log)(LOG_ERR, "%s: not a regular file or block device", config->path);
+        r = EINVAL;
+        goto fail4;
+    }
+
+    // See if we can find holes (preallocated unwritten extents may be reported as data, but that's still correct)
+#ifdef SEEK_DATA
+    if (S_ISREG(sb.st_mode))
+        priv->use_seek_data = lseek(priv->fd, 0, SEEK_DATA) != (off_t)-1 || errno == ENXIO;
+#endif
+
+    // Done
+    return s3b;
+
+fail4:
+    close(priv->fd);
+fail3:
+    pthread_mutex_destroy(&priv->mutex);
+fail2:
+    free(priv);
+fail1:
+    free(s3b);
+fail0:
+    (*config->log)(LOG_ERR, "localfs_io creation failed: %s", strerror(r));
+    errno = r;
+    return NULL;
+}
+
+static int
+localfs_io_create_threads(struct s3backer_store *s3b)
+{
+    return 0;
+}
+
+static int
+localfs_io_meta_data(struct s3backer_store *s3b, off_t *file_sizep, u_int *block_sizep)
+{
+    return 0;
+}
+
+static int
+localfs_io_set_mount_token(struct s3backer_store *s3b, int32_t *old_valuep, int32_t new_value)
+{
+    if (old_valuep != NULL)
+        *old_valuep = 0;
+    return 0;
+}
+
+static int
+localfs_io_shutdown(struct s3backer_store *const s3b)
+{
+    struct localfs_io_private *const priv = s3b->data;
+
+    priv->shutdown = 1;
+    return 0;
+}
+
+static void
+localfs_io_destroy(struct s3backer_store *const s3b)
+{
+    struct localfs_io_private *const priv = s3b->data;
+
+    close(priv->fd);
+    pthread_mutex_destroy(&priv->mutex);
+    free(priv);
+    free(s3b);
+}
+
+void
+localfs_io_get_stats(struct s3backer_store *s3b, struct localfs_io_stats *stats)
+{
+    struct localfs_io_private *const priv = s3b->data;
+
+    pthread_mutex_lock(&priv->mutex);
+    memcpy(stats, &priv->stats, sizeof(*stats));
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+}
+
+void
+localfs_io_clear_stats(struct s3backer_store *s3b)
+{
+    struct localfs_io_private *const priv = s3b->data;
+
+    pthread_mutex_lock(&priv->mutex);
+    memset(&priv->stats, 0, sizeof(priv->stats));
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+}
+
+static int
+localfs_io_read_block(struct s3backer_store *const s3b, s3b_block_t block_num, void *dest,
+  u_char *actual_etag, const u_char *expect_etag, int strict)
+{
+    struct localfs_io_private *const priv = s3b->data;
+    struct localfs_io_conf *const config = priv->config;
+    int r;
+
+    // Logging
+    if (config->debug)
+        (*config->log)(LOG_DEBUG, "localfs_io: read %0*jx", S3B_BLOCK_NUM_DIGITS, (uintmax_t)block_num);
+
+    // Read block
+    if ((r = localfs_io_pread(priv, (off_t)block_num * config->block_size, dest, config->block_size)) != 0)
+        return r;
+    pthread_mutex_lock(&priv->mutex);
+    priv->stats.blocks_read++;
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+
+    // Handle ETags
+    return localfs_io_check_etag(priv, block_num, dest, actual_etag, expect_etag, strict);
+}
+
+static int
+localfs_io_read_block_part(struct s3backer_store *s3b, s3b_block_t block_num, u_int off, u_int len, void *dest)
+{
+    struct localfs_io_private *const priv = s3b->data;
+    struct localfs_io_conf *const config = priv->config;
+
+    assert(off <= config->block_size);
+    assert(len <= config->block_size - off);
+    return localfs_io_pread(priv, (off_t)block_num * config->block_size + off, dest, len);
+}
+
+static int
+localfs_io_write_block(struct s3backer_store *const s3b, s3b_block_t block_num, const void *src, u_char *caller_etag,
+  check_cancel_t *check_cancel, void *check_cancel_arg)
+{
+    struct localfs_io_private *const priv = s3b->data;
+    struct localfs_io_conf *const config = priv->config;
+    const off_t offset = (off_t)block_num * config->block_size;
+    int r;
+
+    // Check for zero block
+    if (src != NULL && block_is_zeros(src))
+        src = NULL;
+
+    // Logging
+    if (config->debug) {
+        (*config->log)(LOG_DEBUG, "localfs_io: write %0*jx%s",
+          S3B_BLOCK_NUM_DIGITS, (uintmax_t)block_num, src == NULL ? " (zero block)" : "");
+    }
+
+    // Write block
+    if ((r = src != NULL ?
+      localfs_io_pwrite(priv, offset, src, config->block_size) : localfs_io_zero(priv, offset, config->block_size)) != 0)
+        return r;
+
+    // Update stats
+    pthread_mutex_lock(&priv->mutex);
+    if (src != NULL)
+        priv->stats.blocks_written++;
+    else
+        priv->stats.zero_blocks_written++;
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+
+    // Return MD5 to caller
+    if (caller_etag != NULL) {
+        if (src != NULL)
+            md5_quick(src, config->block_size, caller_etag);
+        else
+            memset(caller_etag, 0, MD5_DIGEST_LENGTH);
+    }
+
+    // Done
+    return 0;
+}
+
+static int
+localfs_io_write_block_part(struct s3backer_store *s3b, s3b_block_t block_num, u_int off, u_int len, const void *src)
+{
+    struct localfs_io_private *const priv = s3b->data;
+    struct localfs_io_conf *const config = priv->config;
+
+    assert(off <= config->block_size);
+    assert(len <= config->block_size - off);
+    if (src == NULL)                                            // NULL means write zeros
+        return localfs_io_zero(priv, (off_t)block_num * config->block_size + off, len);
+    return localfs_io_pwrite(priv, (off_t)block_num * config->block_size + off, src, len);
+}
+
+static int
+localfs_io_read_blocks(struct s3backer_store *s3b, s3b_block_t block_num, u_int num_blocks, void *dest)
+{
+    struct localfs_io_private *const priv = s3b->data;
+    struct localfs_io_conf *const config = priv->config;
+    int r;
+
+    // Read all blocks at once
+    if ((r = localfs_io_pread(priv, (off_t)block_num * config->block_size, dest, (size_t)num_blocks * config->block_size)) != 0)
+        return r;
+
+    // Update stats
+    pthread_mutex_lock(&priv->mutex);
+    priv->stats.blocks_read += num_blocks;
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+    return 0;
+}
+
+static int
+localfs_io_write_blocks(struct s3backer_store *s3b, s3b_block_t block_num, u_int num_blocks, const void *src,
+  u_char *etags, check_cancel_t *check_cancel, void *check_cancel_arg)
+{
+    struct localfs_io_private *const priv = s3b->data;
+    struct localfs_io_conf *const config = priv->config;
+    const off_t offset = (off_t)block_num * config->block_size;
+    const size_t len = (size_t)num_blocks * config->block_size;
+    u_int i;
+    int r;
+
+    // Write all blocks at once
+    if ((r = src != NULL ? localfs_io_pwrite(priv, offset, src, len) : localfs_io_zero(priv, offset, len)) != 0)
+        return r;
+
+    // Update stats
+    pthread_mutex_lock(&priv->mutex);
+    if (src != NULL)
+        priv->stats.blocks_written += num_blocks;
+    else
+        priv->stats.zero_blocks_written += num_blocks;
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+
+    // Compute ETags if requested
+    if (etags != NULL) {
+        for (i = 0; i < num_blocks; i++) {
+            const char *const data = src != NULL ? (const char *)src + (size_t)i * config->block_size : NULL;
+            u_char *const etag = etags + i * MD5_DIGEST_LENGTH;
+
+            if (data == NULL || block_is_zeros(data))
+                memset(etag, 0, MD5_DIGEST_LENGTH);
+            else
+                md5_quick(data, config->block_size, etag);
+        }
+    }
+
+    // Done
+    return 0;
+}
+
+static int
+localfs_io_flush_blocks(struct s3backer_store *s3b, const s3b_block_t *block_nums, u_int num_blocks, long timeout)
+{
+    struct localfs_io_private *const priv = s3b->data;
+    struct localfs_io_conf *const config = priv->config;
+    int r;
+
+    // Anything to do?
+    if (config->read_only || (block_nums != NULL && num_blocks == 0))
+        return 0;
+
+    // Sync data (this is all or nothing, so the block list doesn't matter)
+    if (fdatasync(priv->fd) == -1) {
+        r = errno;
+        (*config->log)(LOG_ERR, "can't fsync %s: %s", config->path, strerror(r));
+        return r;
+    }
+    pthread_mutex_lock(&priv->mutex);
+    priv->stats.flushes++;
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+    return 0;
+}
+
+static int
+localfs_io_survey_non_zero(struct s3backer_store *s3b, const struct survey_params *params)
+{
+    struct localfs_io_private *const priv = s3b->data;
+    struct localfs_io_conf *const config = priv->config;
+    s3b_block_t block_nums[SURVEY_BATCH];
+    s3b_block_t block_num;
+    s3b_block_t num_zero;
+    u_int num_batch = 0;
+    int zero;
+    int r;
+
+    // Report every block that's not in a hole
+    for (block_num = 0; block_num < config->num_blocks; block_num += num_zero) {
+        if (priv->shutdown)
+            return ECANCELED;
+        if ((r = localfs_io_block_status(s3b, block_num, config->num_blocks - block_num, &zero, &num_zero)) != 0)
+            return r;
+        if (zero)
+            continue;
+        while (num_zero-- > 0) {
+            block_nums[num_batch++] = block_num++;
+            if (num_batch == SURVEY_BATCH) {
+                if ((r = (*params->callback)(params->arg, block_nums, num_batch)) != 0)
+                    return r;
+                num_batch = 0;
+            }
+        }
+        num_zero = 0;
+    }
+    if (num_batch > 0 && (r = (*params->callback)(params->arg, block_nums, num_batch)) != 0)
+        return r;
+    if (params->progress != NULL && config->num_blocks > 0
+      && (r = (*params->progress)(params->arg, 0, config->num_blocks - 1)) != 0)
+        return r;
+
+    // Done
+    return 0;
+}
+
+/*
+ * Report holes as blocks that are known to be zero.
+ */
+static int
+localfs_io_block_status(struct s3backer_store *s3b, s3b_block_t block_num, s3b_block_t max_blocks,
+  int *zerop, s3b_block_t *num_blocksp)
+{
+    struct localfs_io_private *const priv = s3b->data;
+    struct localfs_io_conf *const config = priv->config;
+    const off_t offset = (off_t)block_num * config->block_size;
+    const off_t limit = offset + (off_t)max_blocks * config->block_size;
+    off_t next;
+
+    // Sanity check
+    assert(max_blocks > 0);
+
+    // If we can't find holes, we don't know anything
+    if (!priv->use_seek_data) {
+        *zerop = 0;
+        *num_blocksp = max_blocks;
+        return 0;
+    }
+
+#ifdef SEEK_DATA
+    // Find the next data at or after this block; blocks strictly before it (if any) are in a hole
+    if ((next = lseek(priv->fd, offset, SEEK_DATA)) == (off_t)-1) {
+        if (errno != ENXIO)
+            return errno;
+        next = limit;                                           // the rest of the file is a hole
+    }
+    if (next > limit)
+        next = limit;
+    if (next - offset >= (off_t)config->block_size) {
+        *zerop = 1;
+        *num_blocksp = (s3b_block_t)((next - offset) / config->block_size);
+        return 0;
+    }
+
+    // This block contains data; find the next hole that contains at least one whole block
+    *zerop = 0;
+    if ((next = lseek(priv->fd, offset, SEEK_HOLE)) == (off_t)-1)
+        return errno;
+    next = ROUNDUP2(next, (off_t)config->block_size);
+    if (next > limit)
+        next = limit;
+    if (next < offset + (off_t)config->block_size)
+        next = offset + (off_t)config->block_size;
+    *num_blocksp = (s3b_block_t)((next - offset) / config->block_size);
+    return 0;
+#else
+    (void)next;
+    (void)limit;
+    return ENOTSUP;
+#endif
+}
+
+/*
+ * Read data, via an aligned bounce buffer if necessary.
+ */
+static int
+localfs_io_pread(struct localfs_io_private *priv, off_t offset, void *dest, size_t len)
+{
+    struct localfs_io_conf *const config = priv->config;
+    void *buf = dest;
+    size_t total;
+    ssize_t r;
+
+    // Allocate bounce buffer if needed
+    if (!localfs_io_is_aligned(priv, dest, offset, len)) {
+        const off_t aoff = offset & ~(off_t)(DIRECT_ALIGN - 1);
+        const size_t alen = ROUNDUP2((size_t)(offset - aoff) + len, (size_t)DIRECT_ALIGN);
+        int r2;
+
+        if ((r2 = posix_memalign(&buf, DIRECT_ALIGN, alen)) != 0)
+            return r2;
+        if ((r2 = localfs_io_pread(priv, aoff, buf, alen)) == 0)
+            memcpy(dest, (char *)buf + (offset - aoff), len);
+        free(buf);
+        pthread_mutex_lock(&priv->mutex);
+        priv->stats.bounce_copies++;
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+        return r2;
+    }
+
+    // Read data
+    for (total = 0; total < len; total += r) {
+        if ((r = pread(priv->fd, (char *)buf + total, len - total, offset + total)) == -1) {
+            if (errno == EINTR) {
+                r = 0;
+                continue;
+            }
+            r = errno;
+            (*config->log)(LOG_ERR, "can't read %s: %s", config->path, strerror((int)r));
+            return (int)r;
+        }
+        if (r == 0) {                                           // past EOF, e.g., a smaller file
+            memset((char *)buf + total, 0, len - total);
+            break;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Write data, via an aligned bounce buffer if necessary.
+ */
+static int
+localfs_io_pwrite(struct localfs_io_private *priv, off_t offset, const void *src, size_t len)
+{
+    struct localfs_io_conf *const config = priv->config;
+    size_t total;
+    ssize_t r;
+
+    // Use a bounce buffer if needed, which requires a read-modify-write for unaligned file ranges
+    if (!localfs_io_is_aligned(priv, src, offset, len)) {
+        const off_t aoff = offset & ~(off_t)(DIRECT_ALIGN - 1);
+        const size_t alen = ROUNDUP2((size_t)(offset - aoff) + len, (size_t)DIRECT_ALIGN);
+        void *buf;
+        int r2;
+
+        if ((r2 = posix_memalign(&buf, DIRECT_ALIGN, alen)) != 0)
+            return r2;
+        if ((aoff == offset && alen == len) || (r2 = localfs_io_pread(priv, aoff, buf, alen)) == 0) {
+            memcpy((char *)buf + (offset - aoff), src, len);
+            r2 = localfs_io_pwrite(priv, aoff, buf, alen);
+        }
+        free(buf);
+        pthread_mutex_lock(&priv->mutex);
+        priv->stats.bounce_copies++;
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+        return r2;
+    }
+
+    // Write data
+    for (total = 0; total < len; total += r) {
+        if ((r = pwrite(priv->fd, (const char *)src + total, len - total, offset + total)) == -1) {
+            if (errno == EINTR) {
+                r = 0;
+                continue;
+            }
+            r = errno;
+            (*config->log)(LOG_ERR, "can't write %s: %s", config->path, strerror((int)r));
+            return (int)r;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Zero a range of blocks, deallocating the space if we can (unless preallocating).
+ */
+static int
+localfs_io_zero(struct localfs_io_private *priv, off_t offset, size_t len)
+{
+    struct localfs_io_conf *const config = priv->config;
+    size_t chunk;
+    int r;
+
+#if USE_FALLOCATE
+    // Try to let the filesystem do it
+#ifdef FALLOC_FL_ZERO_RANGE
+    if (config->preallocate) {
+        if (fallocate(priv->fd, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE, offset, len) == 0)
+            return 0;
+    } else
+#endif
+    if (fallocate(priv->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len) == 0)
+        return 0;
+    if (errno != EOPNOTSUPP && errno != ENOSYS && errno != EINVAL) {
+        r = errno;
+        (*config->log)(LOG_ERR, "can't zero range in %s: %s", config->path, strerror(r));
+        return r;
+    }
+#endif
+
+    // Write zeros the old-fashioned way
+    for (; len > 0; offset += chunk, len -= chunk) {
+        chunk = len < config->block_size ? len : config->block_size;
+        if ((r = localfs_io_pwrite(priv, offset, zero_block, chunk)) != 0)
+            return r;
+    }
+    return 0;
+}
+
+/*
+ * Compute the ETag of data read and compare it with the expected ETag.
+ *
+ * We use the same convention as test_io: it's the MD5 of the data, or all zeros for a zero block.
+ */
+static int
+localfs_io_check_etag(struct localfs_io_private *priv, s3b_block_t block_num, const void *data,
+  u_char *actual_etag, const u_char *expect_etag, int strict)
+{
+    struct localfs_io_conf *const config = priv->config;
+    u_char md5[MD5_DIGEST_LENGTH];
+
+    // Anything to do?
+    if (actual_etag == NULL && expect_etag == NULL)
+        return 0;
+
+    // Compute ETag
+    if (block_is_zeros(data))
+        memset(md5, 0, MD5_DIGEST_LENGTH);
+    else
+        md5_quick(data, config->block_size, md5);
+    if (actual_etag != NULL)
+        memcpy(actual_etag, md5, MD5_DIGEST_LENGTH);
+
+    // Check expected ETag
+    if (expect_etag != NULL) {
+        const int match = memcmp(md5, expect_etag, MD5_DIGEST_LENGTH) == 0;
+
+        if (strict) {
+            if (!match) {
+                (*config->log)(LOG_ERR, "%s: wrong MD5 checksum for block %0*jx", config->path,
+                  S3B_BLOCK_NUM_DIGITS, (uintmax_t)block_num);
+                return EINVAL;
+            }
+        } else if (match)
+            return EEXIST;
+    }
+    return 0;
+}
+
+/*
+ * Determine whether a transfer can be done directly, without a bounce buffer.
+ */
+static int
+localfs_io_is_aligned(struct localfs_io_private *priv, const void *buf, off_t offset, size_t len)
+{
+    if (!priv->direct)
+        return 1;
+    return ((uintptr_t)buf % DIRECT_ALIGN) == 0 && (offset % DIRECT_ALIGN) == 0 && (len % DIRECT_ALIGN) == 0;
+}
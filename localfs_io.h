@@ -0,0 +1,64 @@
+
+/*
+ * s3backer - FUSE-based single file backing store via Amazon S3
+ *
+ * Copyright 2008-2020 Archie L. Cobbs <archie.cobbs@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations including
+ * the two.
+ *
+ * You must obey the GNU General Public License in all respects for all
+ * of the code used other than OpenSSL. If you modify file(s) with this
+ * exception, you may extend this exception to your version of the
+ * file(s), but you are not obligated to do so. If you do not wish to do
+ * so, delete this exception statement from your version. If you delete
+ * this exception statement from all source files in the program, then
+ * also delete it here.
+ */
+
+// Alignment required with O_DIRECT; the block size must be a multiple of this
+#define LOCALFS_IO_DIRECT_ALIGN     4096
+
+// Configuration info structure for localfs_io store
+struct localfs_io_conf {
+    u_int               block_size;
+    s3b_block_t         num_blocks;
+    const char          *path;                  // file or block device holding the blocks
+    int                 direct_io;              // open with O_DIRECT
+    int                 preallocate;            // allocate the whole file up front and keep it allocated
+    int                 read_only;
+    log_func_t          *log;
+    int                 debug;
+};
+
+// Statistics structure for localfs_io store
+struct localfs_io_stats {
+    uint64_t            blocks_read;
+    uint64_t            blocks_written;
+    uint64_t            zero_blocks_written;
+    uint64_t            bounce_copies;          // O_DIRECT transfers that needed an aligned bounce buffer
+    uint64_t            flushes;
+};
+
+// localfs_io.c
+extern struct s3backer_store *localfs_io_create(struct localfs_io_conf *config);
+extern void localfs_io_get_stats(struct s3backer_store *s3b, struct localfs_io_stats *stats);
+extern void localfs_io_clear_stats(struct s3backer_store *s3b);
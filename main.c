@@ -37,10 +37,12 @@
 #include "s3backer.h"
 #include "block_cache.h"
 #include "ec_protect.h"
+#include "dedup.h"
 #include "zero_cache.h"
 #include "fuse_ops.h"
 #include "http_io.h"
 #include "test_io.h"
+#include "localfs_io.h"
 #include "s3b_config.h"
 #include "erase.h"
 #include "reset.h"
@@ -0,0 +1,483 @@
+
+/*
+ * s3backer - FUSE-based single file backing store via Amazon S3
+ *
+ * Copyright 2008-2020 Archie L. Cobbs <archie.cobbs@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations including
+ * the two.
+ *
+ * You must obey the GNU General Public License in all respects for all
+ * of the code used other than OpenSSL. If you modify file(s) with this
+ * exception, you may extend this exception to your version of the
+ * file(s), but you are not obligated to do so. If you do not wish to do
+ * so, delete this exception statement from your version. If you delete
+ * this exception statement from all source files in the program, then
+ * also delete it here.
+ */
+
+#include "s3backer.h"
+#include "fuse_ops.h"
+#include "metrics.h"
+#include "util.h"
+
+/*
+ * Minimal HTTP server exposing s3backer statistics in the Prometheus text exposition format.
+ *
+ * One thread accepts connections on a UNIX socket or TCP port and answers each request with a fresh
+ * snapshot of all the layer statistics. Scrapes are rare, so requests are handled one at a time.
+ */
+
+#define METRICS_LISTEN_BACKLOG      8
+#define METRICS_REQUEST_MAX         4096
+#define METRICS_IO_TIMEOUT          5               // seconds
+#define METRICS_DEFAULT_HOST        "127.0.0.1"
+#define METRICS_CONTENT_TYPE        "text/plain; version=0.0.4"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL                0
+#endif
+
+// Response body under construction
+struct metrics_buf {
+    char    *buf;
+    size_t  len;
+    size_t  bufsiz;
+    int     memerr;                                 // we got a memory error
+};
+
+// Server state
+struct metrics_server {
+    struct metrics_conf     *config;
+    int                     listen_fd;
+    int                     wakeup[2];              // pipe used to wake up the server thread on shutdown
+    int                     unix_socket;            // listening on a UNIX socket (remove it on shutdown)
+    pthread_t               thread;
+};
+
+// Internal functions
+static int metrics_listen(struct metrics_conf *config);
+static void *metrics_main(void *arg);
+static void metrics_serve(struct metrics_conf *config, int fd);
+static int metrics_send(int fd, const char *buf, size_t len);
+static printer_t metrics_printer;
+
+// Internal variables
+static struct metrics_server *the_server;
+
+/****************************************************************************
+ *                      PUBLIC FUNCTION DEFINITIONS                         *
+ ****************************************************************************/
+
+int
+metrics_start(struct metrics_conf *config)
+{
+    struct metrics_server *server;
+    int r;
+
+    // Sanity check
+    assert(config != NULL);
+    assert(config->address != NULL);
+    assert(config->print_metrics != NULL);
+    if (the_server != NULL)
+        return EALREADY;
+
+    // Initialize server
+    if ((server = calloc(1, sizeof(*server))) == NULL) {
+        r = errno;
+        (*config->log)(LOG_ERR, "calloc(): %s", strerror(r));
+        goto fail0;
+    }
+    server->config = config;
+    server->unix_socket = *config->address == '/';
+    if (pipe(server->wakeup) == -1) {
+        r = errno;
+        (*config->log)(LOG_ERR, "pipe(): %s", strerror(r));
+        goto fail1;
+    }
+    (void)fcntl(server->wakeup[0], F_SETFD, FD_CLOEXEC);
+    (void)fcntl(server->wakeup[1], F_SETFD, FD_CLOEXEC);
+
+    // Open listening socket
+    if ((server->listen_fd = metrics_listen(config)) == -1) {
+        r = errno;
+        goto fail2;
+    }
+
+    // Start server thread
+    if ((r = pthread_create(&server->thread, NULL, metrics_main, server)) != 0) {
+        (*config->log)(LOG_ERR, "pthread_create: %s", strerror(r));
+        goto fail3;
+    }
+
+    // Done
+    (*config->log)(LOG_INFO, "serving metrics on %s", config->address);
+    the_server = server;
+    return 0;
+
+fail3:
+    close(server->listen_fd);
+    if (server->unix_socket)
+        (void)unlink(config->address);
+fail2:
+    close(server->wakeup[0]);
+    close(server->wakeup[1]);
+fail1:
+    free(server);
+fail0:
+    return r;
+}
+
+void
+metrics_stop(void)
+{
+    struct metrics_server *const server = the_server;
+    const char ch = 0;
+
+    // Sanity check
+    if (server == NULL)
+        return;
+    the_server = NULL;
+
+    // Wake up the server thread and wait for it to exit
+    while (write(server->wakeup[1], &ch, 1) == -1 && errno == EINTR)
+        ;
+    CHECK_RETURN(pthread_join(server->thread, NULL));
+
+    // Clean up
+    close(server->listen_fd);
+    if (server->unix_socket)
+        (void)unlink(server->config->address);
+    close(server->wakeup[0]);
+    close(server->wakeup[1]);
+    free(server);
+}
+
+/*
+ * Output a counter metric.
+ */
+void
+metrics_counter(void *prarg, printer_t *printer, const char *name, const char *help, uint64_t value)
+{
+    (*printer)(prarg, "# HELP %s %s\n# TYPE %s counter\n%s %ju\n", name, help, name, name, (uintmax_t)value);
+}
+
+/*
+ * Output a gauge metric.
+ */
+void
+metrics_gauge(void *prarg, printer_t *printer, const char *name, const char *help, double value)
+{
+    (*printer)(prarg, "# HELP %s %s\n# TYPE %s gauge\n%s %.17g\n", name, help, name, name, value);
+}
+
+/*
+ * Output a latency histogram as a Prometheus histogram with cumulative buckets in seconds.
+ */
+void
+metrics_histogram(void *prarg, printer_t *printer, const char *name, const char *help, const struct latency_hist *hist)
+{
+    uint64_t total = 0;
+    u_int i;
+
+    (*printer)(prarg, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+    for (i = 0; i < LATENCY_BUCKETS - 1; i++) {
+        total += hist->buckets[i];
+        (*printer)(prarg, "%s_bucket{le=\"%g\"} %ju\n", name, latency_bound(i + 1), (uintmax_t)total);
+    }
+    total += hist->buckets[LATENCY_BUCKETS - 1];
+    (*printer)(prarg, "%s_bucket{le=\"+Inf\"} %ju\n", name, (uintmax_t)total);
+    (*printer)(prarg, "%s_sum %.9f\n", name, hist->time);
+    (*printer)(prarg, "%s_count %ju\n", name, (uintmax_t)total);
+}
+
+/****************************************************************************
+ *                    INTERNAL FUNCTION DEFINITIONS                         *
+ ****************************************************************************/
+
+/*
+ * Create and bind the listening socket.
+ *
+ * Returns the socket, or -1 with errno set on error.
+ */
+static int
+metrics_listen(struct metrics_conf *config)
+{
+    struct addrinfo hints;
+    struct addrinfo *res;
+    struct sockaddr_un sun;
+    const char *port;
+    char host[256];
+    const int on = 1;
+    int fd;
+    int r;
+
+    // Handle UNIX socket
+    if (*config->address == '/') {
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        if (strlen(config->address) >= sizeof(sun.sun_path)) {
+            (*config->log)(LOG_ERR, "metrics socket path \"%s\" is too long", config->address);
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        snvprintf(sun.sun_path, sizeof(sun.sun_path), "%s", config->address);
+        if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+            r = errno;
+            (*config->log)(LOG_ERR, "socket(): %s", strerror(r));
+            goto fail0;
+        }
+        (void)unlink(config->address);
+        if (bind(fd, (struct sockaddr *)&sun, sizeof(sun)) == -1) {
+            r = errno;
+            (*config->log)(LOG_ERR, "bind(\"%s\"): %s", config->address, strerror(r));
+            goto fail1;
+        }
+        goto listen;
+    }
+
+    // Parse [HOST:]PORT
+    if ((port = strrchr(config->address, ':')) != NULL) {
+        if (port - config->address >= sizeof(host)) {
+            (*config->log)(LOG_ERR, "invalid metrics address \"%s\"", config->address);
+            errno = EINVAL;
+            return -1;
+        }
+        snvprintf(host, sizeof(host), "%.*s", (int)(port - config->address), config->address);
+        port++;
+    } else {
+        snvprintf(host, sizeof(host), "%s", METRICS_DEFAULT_HOST);
+        port = config->address;
+    }
+
+    // Resolve address
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if ((r = getaddrinfo(*host != '\0' ? host : NULL, port, &hints, &res)) != 0) {
+        (*config->log)(LOG_ERR, "invalid metrics address \"%s\": %s", config->address, gai_strerror(r));
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Create and bind socket
+    if ((fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) == -1) {
+        r = errno;
+        (*config->log)(LOG_ERR, "socket(): %s", strerror(r));
+        freeaddrinfo(res);
+        goto fail0;
+    }
+    (void)setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(fd, res->ai_addr, res->ai_addrlen) == -1) {
+        r = errno;
+        (*config->log)(LOG_ERR, "bind(\"%s\"): %s", config->address, strerror(r));
+        freeaddrinfo(res);
+        goto fail1;
+    }
+    freeaddrinfo(res);
+
+listen:
+    // Start listening
+    if (listen(fd, METRICS_LISTEN_BACKLOG) == -1) {
+        r = errno;
+        (*config->log)(LOG_ERR, "listen(\"%s\"): %s", config->address, strerror(r));
+        goto fail2;
+    }
+    (void)fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+
+fail2:
+    if (*config->address == '/')
+        (void)unlink(config->address);
+fail1:
+    close(fd);
+fail0:
+    errno = r;
+    return -1;
+}
+
+/*
+ * Server thread: accept and answer requests until woken up.
+ */
+static void *
+metrics_main(void *arg)
+{
+    struct metrics_server *const server = arg;
+    struct metrics_conf *const config = server->config;
+    struct pollfd fds[2];
+    int fd;
+
+    // Loop
+    while (1) {
+
+        // Wait for a connection or shutdown
+        memset(fds, 0, sizeof(fds));
+        fds[0].fd = server->listen_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = server->wakeup[0];
+        fds[1].events = POLLIN;
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            (*config->log)(LOG_ERR, "metrics: poll(): %s", strerror(errno));
+            break;
+        }
+        if (fds[1].revents != 0)
+            break;
+        if ((fds[0].revents & POLLIN) == 0)
+            continue;
+
+        // Accept connection and answer it
+        if ((fd = accept(server->listen_fd, NULL, NULL)) == -1) {
+            if (errno != EINTR && errno != ECONNABORTED && errno != EAGAIN)
+                (*config->log)(LOG_WARNING, "metrics: accept(): %s", strerror(errno));
+            continue;
+        }
+        metrics_serve(config, fd);
+        close(fd);
+    }
+
+    // Done
+    return NULL;
+}
+
+/*
+ * Read one HTTP request and send back the current metrics.
+ *
+ * The request itself is only checked for its method; any path returns the metrics.
+ */
+static void
+metrics_serve(struct metrics_conf *config, int fd)
+{
+    struct metrics_buf mbuf;
+    struct timeval tv;
+    char request[METRICS_REQUEST_MAX];
+    char header[256];
+    size_t len = 0;
+    ssize_t nread;
+    int head_only;
+    int hlen;
+
+    // Don't let a stuck client hang the server
+    memset(&tv, 0, sizeof(tv));
+    tv.tv_sec = METRICS_IO_TIMEOUT;
+    (void)setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    (void)setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    // Read the request header
+    while (len < sizeof(request) - 1) {
+        if ((nread = recv(fd, request + len, sizeof(request) - 1 - len, 0)) == -1) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        if (nread == 0)
+            break;
+        len += nread;
+        request[len] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL)
+            break;
+    }
+    request[len] = '\0';
+
+    // Check method
+    head_only = strncmp(request, "HEAD ", 5) == 0;
+    if (!head_only && strncmp(request, "GET ", 4) != 0) {
+        hlen = snvprintf(header, sizeof(header),
+          "HTTP/1.0 405 Method Not Allowed\r\nAllow: GET, HEAD\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        (void)metrics_send(fd, header, hlen);
+        return;
+    }
+
+    // Generate metrics
+    memset(&mbuf, 0, sizeof(mbuf));
+    (*config->print_metrics)(&mbuf, metrics_printer);
+    if (mbuf.memerr) {
+        hlen = snvprintf(header, sizeof(header),
+          "HTTP/1.0 500 Internal Server Error\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        (void)metrics_send(fd, header, hlen);
+        goto done;
+    }
+
+    // Send response
+    hlen = snvprintf(header, sizeof(header),
+      "HTTP/1.0 200 OK\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+      METRICS_CONTENT_TYPE, mbuf.len);
+    if (metrics_send(fd, header, hlen) == 0 && !head_only)
+        (void)metrics_send(fd, mbuf.buf, mbuf.len);
+
+done:
+    free(mbuf.buf);
+}
+
+static int
+metrics_send(int fd, const char *buf, size_t len)
+{
+    ssize_t nwrote;
+
+    while (len > 0) {
+        if ((nwrote = send(fd, buf, len, MSG_NOSIGNAL)) == -1) {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+        buf += nwrote;
+        len -= nwrote;
+    }
+    return 0;
+}
+
+static void
+metrics_printer(void *prarg, const char *fmt, ...)
+{
+    struct metrics_buf *const mbuf = prarg;
+    va_list args;
+    char *new_buf;
+    size_t new_bufsiz;
+    size_t remain;
+    int added;
+
+    // Bail if no memory
+    if (mbuf->memerr)
+        return;
+
+again:
+    // Append to string buffer
+    remain = mbuf->bufsiz - mbuf->len;
+    va_start(args, fmt);
+    added = vsnprintf(mbuf->buf != NULL ? mbuf->buf + mbuf->len : NULL, remain, fmt, args);
+    va_end(args);
+    if (added + 1 <= remain) {
+        mbuf->len += added;
+        return;
+    }
+
+    // We need a bigger buffer
+    new_bufsiz = ((mbuf->bufsiz + added + 4095) / 4096) * 4096;
+    if ((new_buf = realloc(mbuf->buf, new_bufsiz)) == NULL) {
+        mbuf->memerr = 1;
+        return;
+    }
+    mbuf->buf = new_buf;
+    mbuf->bufsiz = new_bufsiz;
+    goto again;
+}
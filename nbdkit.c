@@ -39,10 +39,12 @@
 #include "block_cache.h"
 #include "block_part.h"
 #include "ec_protect.h"
+#include "dedup.h"
 #include "zero_cache.h"
 #include "fuse_ops.h"
 #include "http_io.h"
 #include "test_io.h"
+#include "localfs_io.h"
 #include "s3b_config.h"
 #include "util.h"
 #include "nbdkit.h"
@@ -65,8 +67,19 @@ static struct s3backer_store *s3b;
 static struct fuse_ops_private *fuse_priv;
 static int pre_fork_pid;
 
+// Group commit state for FUA writes
+static pthread_mutex_t fua_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t fua_cond = PTHREAD_COND_INITIALIZER;
+static struct block_list fua_pending;   // blocks waiting for the next group flush
+static uint64_t fua_batch = 1;          // number of the batch now collecting blocks in 'fua_pending'
+static uint64_t fua_done;               // number of the last batch whose flush has completed
+static uint64_t fua_error_batch;        // number of the last batch whose flush failed
+static int fua_error;                   // error from the last batch whose flush failed
+static int fua_flushing;                // a batch flush is in progress
+
 // Internal functions
 static int s3b_nbd_flush_blocks(const struct boundary_info *info);
+static void s3b_nbd_group_flush(void);
 static void s3b_nbd_logger(int level, const char *fmt, ...);
 static int handle_unknown_option(void *data, const char *arg, int key, struct fuse_args *outargs);
 
@@ -82,9 +95,13 @@ static int s3b_nbd_plugin_pread(void *handle, void *bufp, uint32_t size, uint64_
 static int s3b_nbd_plugin_pwrite(void *handle, const void *bufp, uint32_t size, uint64_t offset, uint32_t flags);
 static int s3b_nbd_plugin_trim(void *handle, uint32_t size, uint64_t offset, uint32_t flags);
 static int s3b_nbd_plugin_flush(void *handle, uint32_t flags);
+static int s3b_nbd_plugin_cache(void *handle, uint32_t size, uint64_t offset, uint32_t flags);
+static int s3b_nbd_plugin_extents(void *handle, uint32_t size, uint64_t offset, uint32_t flags, struct nbdkit_extents *extents);
 static int s3b_nbd_plugin_can_multi_conn(void *handle);
 static int s3b_nbd_plugin_can_fua(void *handle);
 static int s3b_nbd_plugin_can_cache(void *handle);
+static int s3b_nbd_plugin_can_fast_zero(void *handle);
+static int s3b_nbd_plugin_can_extents(void *handle);
 static void s3b_nbd_plugin_unload(void);
 
 #define PLUGIN_HELP                                                                                                 \
@@ -110,8 +127,8 @@ static struct nbdkit_plugin plugin = {
     .can_flush=             NULL,
     .can_trim=              NULL,
     .can_zero=              NULL,
-    .can_fast_zero=         NULL,
-    .can_extents=           NULL,
+    .can_fast_zero=         s3b_nbd_plugin_can_fast_zero,
+    .can_extents=           s3b_nbd_plugin_can_extents,
     .can_fua=               s3b_nbd_plugin_can_fua,
     .can_cache=             s3b_nbd_plugin_can_cache,
     .is_rotational=         NULL,
@@ -134,8 +151,8 @@ static struct nbdkit_plugin plugin = {
     .pwrite=                s3b_nbd_plugin_pwrite,
     .trim=                  s3b_nbd_plugin_trim,
     .flush=                 s3b_nbd_plugin_flush,
-    .cache=                 NULL,
-    .extents=               NULL,
+    .cache=                 s3b_nbd_plugin_cache,
+    .extents=               s3b_nbd_plugin_extents,
     .zero=                  s3b_nbd_plugin_trim,    // for us, "trim" and "zero" are the same thing
     .close=                 NULL,
 
@@ -346,14 +363,12 @@ s3b_nbd_plugin_pread(void *handle, void *buf, uint32_t size, uint64_t offset, ui
         nbdkit_set_error(r);
         return -1;
     }
-    while (info.mid_block_count-- > 0) {
-        if ((r = (*fuse_priv->s3b->read_block)(fuse_priv->s3b, info.mid_block_start, info.mid_data, NULL, NULL, 0)) != 0) {
-            nbdkit_error("error reading block %0*jx: %m", S3B_BLOCK_NUM_DIGITS, (uintmax_t)info.mid_block_start);
-            nbdkit_set_error(r);
-            return -1;
-        }
-        info.mid_block_start++;
-        info.mid_data += config->block_size;
+    if (info.mid_block_count > 0
+      && (r = read_block_range(fuse_priv->s3b, config->block_size, info.mid_block_start, info.mid_block_count, info.mid_data)) != 0) {
+        nbdkit_error("error reading %ju block(s) starting at %0*jx: %m",
+          (uintmax_t)info.mid_block_count, S3B_BLOCK_NUM_DIGITS, (uintmax_t)info.mid_block_start);
+        nbdkit_set_error(r);
+        return -1;
     }
     if (info.footer.length > 0 && (r = block_part_read_block_part(fuse_priv->s3b, fuse_priv->block_part, &info.footer)) != 0) {
         nbdkit_error("error reading block %0*jx: %m", S3B_BLOCK_NUM_DIGITS, (uintmax_t)info.footer.block);
@@ -369,7 +384,6 @@ static int
 s3b_nbd_plugin_pwrite(void *handle, const void *buf, uint32_t size, uint64_t offset, uint32_t flags)
 {
     struct boundary_info info;
-    size_t i;
     int r;
 
     // Calculate what bits to write, then write them
@@ -378,14 +392,11 @@ s3b_nbd_plugin_pwrite(void *handle, const void *buf, uint32_t size, uint64_t off
         nbdkit_error("error writing block %0*jx: %m", S3B_BLOCK_NUM_DIGITS, (uintmax_t)info.header.block);
         goto fail;
     }
-    for (i = 0; i < info.mid_block_count; i++) {
-        const s3b_block_t block_num = info.mid_block_start + i;
-
-        if ((r = (*fuse_priv->s3b->write_block)(fuse_priv->s3b, block_num, info.mid_data, NULL, NULL, NULL)) != 0) {
-            nbdkit_error("error writing block %0*jx: %m", S3B_BLOCK_NUM_DIGITS, (uintmax_t)block_num);
-            goto fail;
-        }
-        info.mid_data += config->block_size;
+    if (info.mid_block_count > 0
+      && (r = write_block_range(fuse_priv->s3b, config->block_size, info.mid_block_start, info.mid_block_count, info.mid_data)) != 0) {
+        nbdkit_error("error writing %ju block(s) starting at %0*jx: %m",
+          (uintmax_t)info.mid_block_count, S3B_BLOCK_NUM_DIGITS, (uintmax_t)info.mid_block_start);
+        goto fail;
     }
     if (info.footer.length > 0 && (r = block_part_write_block_part(fuse_priv->s3b, fuse_priv->block_part, &info.footer)) != 0) {
         nbdkit_error("error writing block %0*jx: %m", S3B_BLOCK_NUM_DIGITS, (uintmax_t)info.footer.block);
@@ -475,19 +486,91 @@ fail:
     return -1;
 }
 
+/*
+ * Have the block cache read the blocks in the background; we don't wait for that to happen.
+ */
+static int
+s3b_nbd_plugin_cache(void *handle, uint32_t size, uint64_t offset, uint32_t flags)
+{
+    const u_int block_bits = fuse_priv->block_bits;
+    const s3b_block_t start_block = (s3b_block_t)(offset >> block_bits);
+    const s3b_block_t end_block = (s3b_block_t)((offset + size + config->block_size - 1) >> block_bits);
+    int r;
+
+    // Prefetch blocks
+    if ((r = (*fuse_priv->s3b->prefetch_blocks)(fuse_priv->s3b, start_block, end_block - start_block)) != 0) {
+        nbdkit_error("error prefetching %ju block(s) starting at %0*jx: %s",
+          (uintmax_t)(end_block - start_block), S3B_BLOCK_NUM_DIGITS, (uintmax_t)start_block, strerror(r));
+        nbdkit_set_error(r);
+        return -1;
+    }
+
+    // Done
+    return 0;
+}
+
+/*
+ * Report runs of blocks known to be zero as holes, and everything else as data.
+ *
+ * Extents are always whole blocks, so the first and last may extend beyond the requested range; nbdkit trims them.
+ */
+static int
+s3b_nbd_plugin_extents(void *handle, uint32_t size, uint64_t offset, uint32_t flags, struct nbdkit_extents *extents)
+{
+    const u_int block_bits = fuse_priv->block_bits;
+    const s3b_block_t end_block = (s3b_block_t)((offset + size + config->block_size - 1) >> block_bits);
+    s3b_block_t block_num;
+    s3b_block_t num_blocks;
+    int zero;
+    int r;
+
+    // Report each run of blocks having the same status, stopping after one if that's all the client wants
+    for (block_num = (s3b_block_t)(offset >> block_bits); block_num < end_block; block_num += num_blocks) {
+        if ((r = (*fuse_priv->s3b->block_status)(fuse_priv->s3b, block_num, end_block - block_num, &zero, &num_blocks)) != 0) {
+            nbdkit_error("error getting status of block %0*jx: %s", S3B_BLOCK_NUM_DIGITS, (uintmax_t)block_num, strerror(r));
+            nbdkit_set_error(r);
+            return -1;
+        }
+        if (nbdkit_add_extent(extents, (uint64_t)block_num << block_bits, (uint64_t)num_blocks << block_bits,
+          zero ? NBDKIT_EXTENT_HOLE | NBDKIT_EXTENT_ZERO : 0) == -1)
+            return -1;
+        if ((flags & NBDKIT_FLAG_REQ_ONE) != 0)
+            break;
+    }
+
+    // Done
+    return 0;
+}
+
 static int
 s3b_nbd_plugin_can_fua(void *handle)
 {
     return NBDKIT_FUA_NATIVE;
 }
 
-// Pre-loading the cache is supported when the block cache is enabled
+// Pre-loading the cache is supported natively if the block cache can prefetch, otherwise by reading
 static int
 s3b_nbd_plugin_can_cache(void *handle)
 {
+    if (fuse_priv->s3b->prefetch_blocks != NULL)
+        return NBDKIT_CACHE_NATIVE;
     return config->block_cache.cache_size > 0 ? NBDKIT_CACHE_EMULATE : NBDKIT_CACHE_NONE;
 }
 
+// Zeroing whole blocks uses "bulk_zero" and never transfers any data, so it's never slower than writing
+static int
+s3b_nbd_plugin_can_fast_zero(void *handle)
+{
+    return 1;
+}
+
+// Extents are supported if the top layer can tell us which blocks are known to be zero
+static int
+s3b_nbd_plugin_can_extents(void *handle)
+{
+    return fuse_priv->s3b->block_status != NULL;
+}
+
 // Since we have no per-connection state, the same client may open multiple connections
 static int
 s3b_nbd_plugin_can_multi_conn(void *handle)
@@ -497,36 +580,86 @@ s3b_nbd_plugin_can_multi_conn(void *handle)
 
 ////////////// Internal functions
 
+/*
+ * Flush the blocks written by a FUA request.
+ *
+ * Concurrent FUA requests (from any connection) are group committed: each adds its blocks to the batch now
+ * being collected, and one of them flushes the whole batch with a single flush_blocks() while the others wait;
+ * meanwhile, newly arriving requests collect in the next batch. If a flush fails, all requests in that batch
+ * and any earlier batch still waiting get the error. The latter is conservative, but errors here are rare.
+ */
 static int
 s3b_nbd_flush_blocks(const struct boundary_info *const info)
 {
-    s3b_block_t *blocks;
-    u_int num_blocks;
+    uint64_t my_batch;
     size_t i;
-    int r;
+    int r = 0;
 
-    // Build block list
-    if ((blocks = malloc((2 + info->mid_block_count) * sizeof(*blocks))) == NULL) {
-        nbdkit_error("malloc: %m");
-        return errno;
-    }
-    num_blocks = 0;
+    // Add our blocks to the batch being collected
+    pthread_mutex_lock(&fua_mutex);
+    my_batch = fua_batch;
     if (info->header.length > 0)
-        blocks[num_blocks++] = info->header.block;
-    for (i = 0; i < info->mid_block_count; i++)
-        blocks[num_blocks++] = info->mid_block_start + i;
-    if (info->footer.length > 0)
-        blocks[num_blocks++] = info->footer.block;
+        r = block_list_append(&fua_pending, info->header.block);
+    for (i = 0; i < info->mid_block_count && r == 0; i++)
+        r = block_list_append(&fua_pending, info->mid_block_start + i);
+    if (info->footer.length > 0 && r == 0)
+        r = block_list_append(&fua_pending, info->footer.block);
+    if (r != 0) {
+        CHECK_RETURN(pthread_mutex_unlock(&fua_mutex));
+        nbdkit_error("can't allocate block list: %s", strerror(r));
+        return r;
+    }
 
-    // Flush blocks
-    if ((r = (*fuse_priv->s3b->flush_blocks)(fuse_priv->s3b, blocks, num_blocks, 0)) != 0)      // TODO: timeout?
-        nbdkit_error("error flushing %u block(s): %s", num_blocks, strerror(r));
+    // Wait for our batch to be flushed, flushing it ourselves if nobody else is flushing
+    while (fua_done < my_batch) {
+        if (fua_flushing)
+            pthread_cond_wait(&fua_cond, &fua_mutex);
+        else
+            s3b_nbd_group_flush();
+    }
 
     // Done
-    free(blocks);
+    r = fua_error_batch >= my_batch ? fua_error : 0;
+    CHECK_RETURN(pthread_mutex_unlock(&fua_mutex));
     return r;
 }
 
+/*
+ * Flush the batch of blocks being collected and start a new batch.
+ *
+ * This assumes fua_mutex is held. Note fua_mutex is temporarily released.
+ */
+static void
+s3b_nbd_group_flush(void)
+{
+    struct block_list list;
+    uint64_t batch;
+    int r;
+
+    // Claim the batch
+    assert(!fua_flushing);
+    list = fua_pending;
+    block_list_init(&fua_pending);
+    batch = fua_batch++;
+    fua_flushing = 1;
+
+    // Flush blocks
+    CHECK_RETURN(pthread_mutex_unlock(&fua_mutex));
+    if ((r = (*fuse_priv->s3b->flush_blocks)(fuse_priv->s3b, list.blocks, list.num_blocks, 0)) != 0)  // TODO: timeout?
+        nbdkit_error("error flushing %u block(s): %s", (u_int)list.num_blocks, strerror(r));
+    block_list_free(&list);
+    pthread_mutex_lock(&fua_mutex);
+
+    // Record completion and wake up waiters
+    if (r != 0) {
+        fua_error_batch = batch;
+        fua_error = r;
+    }
+    fua_done = batch;
+    fua_flushing = 0;
+    pthread_cond_broadcast(&fua_cond);
+}
+
 static void
 s3b_nbd_logger(int level, const char *fmt, ...)
 {
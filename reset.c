@@ -37,10 +37,12 @@
 #include "s3backer.h"
 #include "block_cache.h"
 #include "ec_protect.h"
+#include "dedup.h"
 #include "zero_cache.h"
 #include "fuse_ops.h"
 #include "http_io.h"
 #include "test_io.h"
+#include "localfs_io.h"
 #include "s3b_config.h"
 #include "reset.h"
 #include "dcache.h"
@@ -59,8 +61,14 @@ s3backer_reset(struct s3b_config *config)
         warnx("resetting mount token for %s", config->description);
 
     // Create temporary lower layer
-    if ((s3b = config->test ? test_io_create(&config->test_io) : http_io_create(&config->http_io)) == NULL) {
-        warnx(config->test ? "test_io_create" : "http_io_create");
+    if (config->test)
+        s3b = test_io_create(&config->test_io);
+    else if (config->localfs)
+        s3b = localfs_io_create(&config->localfs_io);
+    else
+        s3b = http_io_create(&config->http_io);
+    if (s3b == NULL) {
+        warnx(config->test ? "test_io_create" : config->localfs ? "localfs_io_create" : "http_io_create");
         goto fail;
     }
 
@@ -38,12 +38,15 @@
 #include "block_cache.h"
 #include "zero_cache.h"
 #include "ec_protect.h"
+#include "dedup.h"
 #include "fuse_ops.h"
 #include "http_io.h"
 #include "test_io.h"
+#include "localfs_io.h"
 #include "s3b_config.h"
 #include "dcache.h"
 #include "compress.h"
+#include "metrics.h"
 #include "util.h"
 
 /****************************************************************************
@@ -81,11 +84,33 @@
 #define S3BACKER_DEFAULT_BLOCK_CACHE_WRITE_DELAY    250             // 250ms
 #define S3BACKER_DEFAULT_BLOCK_CACHE_TIMEOUT        0
 #define S3BACKER_DEFAULT_BLOCK_CACHE_MAX_DIRTY      0
+#define S3BACKER_DEFAULT_BLOCK_CACHE_WRITE_COALESCE 1               // disabled
+#define S3BACKER_DEFAULT_BLOCK_CACHE_SHARDS         1
+#define S3BACKER_DEFAULT_BLOCK_CACHE_EVICTION       BLOCK_CACHE_EVICTION_LRU
+#define S3BACKER_DEFAULT_BLOCK_CACHE_PREFETCH_THREADS 4
+#define S3BACKER_BLOCK_CACHE_HOT_SUFFIX             ".hot"
+#define S3BACKER_DEFAULT_TEST_LATENCY_DIST          TEST_IO_LATENCY_FIXED
+#define S3BACKER_DEFAULT_DEDUP_TABLE_SIZE           65536
 #define S3BACKER_DEFAULT_READ_AHEAD                 4
 #define S3BACKER_DEFAULT_READ_AHEAD_TRIGGER         2
+#define S3BACKER_DEFAULT_READ_AHEAD_MAX             32
+#define S3BACKER_DEFAULT_READ_AHEAD_STREAMS         4
 #define S3BACKER_DEFAULT_COMPRESSION                "deflate"
+#if ZSTD
+#define S3BACKER_DEFAULT_BLOCK_CACHE_COMPRESSION    "zstd"
+#else
+#define S3BACKER_DEFAULT_BLOCK_CACHE_COMPRESSION    "deflate"
+#endif
+#define S3BACKER_BLOCK_CACHE_COMPRESSION_LEVEL      "1"                 // favor speed
 #define S3BACKER_DEFAULT_ENCRYPTION                 "AES-128-CBC"
 #define S3BACKER_DEFAULT_LIST_BLOCKS_THREADS        16
+#define S3BACKER_DEFAULT_IO_THREADS                 16
+#define S3BACKER_DEFAULT_EVENT_THREADS              0
+#define S3BACKER_DEFAULT_TRANSFORM_THREADS          0
+#define S3BACKER_DEFAULT_PREWARM_CONNECTIONS        0
+#define S3BACKER_DEFAULT_HEDGE_PERCENTILE           0
+#define S3BACKER_DEFAULT_HEDGE_BUDGET               5
+#define S3BACKER_DEFAULT_BUFFER_POOL_SIZE           32
 
 // Macro for quoting stuff
 #define s3bquote0(x)                    #x
@@ -104,6 +129,7 @@
  ****************************************************************************/
 
 static print_stats_t s3b_config_print_stats;
+static print_stats_t s3b_config_print_metrics;
 static clear_stats_t s3b_config_clear_stats;
 
 static void insert_fuse_arg(int pos, const char *arg);
@@ -137,6 +163,22 @@ static const char *const s3_auth_types[] = {
     NULL
 };
 
+// Valid block cache eviction policies
+static const char *const block_cache_evictions[] = {
+    BLOCK_CACHE_EVICTION_LRU,
+    BLOCK_CACHE_EVICTION_2Q,
+    NULL
+};
+
+// Valid test mode latency distributions
+static const char *const test_io_latency_dists[] = {
+    TEST_IO_LATENCY_FIXED,
+    TEST_IO_LATENCY_UNIFORM,
+    TEST_IO_LATENCY_EXPONENTIAL,
+    TEST_IO_LATENCY_PARETO,
+    NULL
+};
+
 // Valid S3 storage classes
 static const char *const s3_storage_classes[] = {
     STORAGE_CLASS_STANDARD,
@@ -169,6 +211,12 @@ static struct s3b_config config = {
         .initial_retry_pause=   S3BACKER_DEFAULT_INITIAL_RETRY_PAUSE,
         .max_retry_pause=       S3BACKER_DEFAULT_MAX_RETRY_PAUSE,
         .list_blocks_threads=   S3BACKER_DEFAULT_LIST_BLOCKS_THREADS,
+        .io_threads=            S3BACKER_DEFAULT_IO_THREADS,
+        .event_threads=         S3BACKER_DEFAULT_EVENT_THREADS,
+        .prewarm_connections=   S3BACKER_DEFAULT_PREWARM_CONNECTIONS,
+        .hedge_percentile=      S3BACKER_DEFAULT_HEDGE_PERCENTILE,
+        .hedge_budget=          S3BACKER_DEFAULT_HEDGE_BUDGET,
+        .transform_threads=     S3BACKER_DEFAULT_TRANSFORM_THREADS,
     },
 
     // "Eventual consistency" protection config
@@ -178,15 +226,31 @@ static struct s3b_config config = {
         .cache_size=            S3BACKER_DEFAULT_MD5_CACHE_SIZE,
     },
 
+    // Deduplication config
+    .dedup= {
+        .table_size=            S3BACKER_DEFAULT_DEDUP_TABLE_SIZE,
+    },
+
+    // Test mode config
+    .test_io= {
+        .latency_dist=          S3BACKER_DEFAULT_TEST_LATENCY_DIST,
+    },
+
     // Block cache config
     .block_cache= {
         .cache_size=            S3BACKER_DEFAULT_BLOCK_CACHE_SIZE,
         .num_threads=           S3BACKER_DEFAULT_BLOCK_CACHE_NUM_THREADS,
         .write_delay=           S3BACKER_DEFAULT_BLOCK_CACHE_WRITE_DELAY,
         .max_dirty=             S3BACKER_DEFAULT_BLOCK_CACHE_MAX_DIRTY,
+        .write_coalesce=        S3BACKER_DEFAULT_BLOCK_CACHE_WRITE_COALESCE,
         .timeout=               S3BACKER_DEFAULT_BLOCK_CACHE_TIMEOUT,
+        .num_shards=            S3BACKER_DEFAULT_BLOCK_CACHE_SHARDS,
+        .eviction=              S3BACKER_DEFAULT_BLOCK_CACHE_EVICTION,
+        .prefetch_threads=      S3BACKER_DEFAULT_BLOCK_CACHE_PREFETCH_THREADS,
         .read_ahead=            S3BACKER_DEFAULT_READ_AHEAD,
         .read_ahead_trigger=    S3BACKER_DEFAULT_READ_AHEAD_TRIGGER,
+        .read_ahead_max=        S3BACKER_DEFAULT_READ_AHEAD_MAX,
+        .read_ahead_streams=    S3BACKER_DEFAULT_READ_AHEAD_STREAMS,
     },
 
     // FUSE operations config
@@ -198,6 +262,7 @@ static struct s3b_config config = {
 
     // Common/global stuff
     .block_size=            0,
+    .buffer_pool_size=      S3BACKER_DEFAULT_BUFFER_POOL_SIZE,
     .file_size=             0,
     .bucket=                NULL,
     .prefix=                S3BACKER_DEFAULT_PREFIX,
@@ -245,15 +310,62 @@ static const struct fuse_opt option_list[] = {
         .templ=     "--authVersion=%s",
         .offset=    offsetof(struct s3b_config, http_io.authVersion),
     },
+    {
+        .templ=     "--dedup",
+        .offset=    offsetof(struct s3b_config, use_dedup),
+        .value=     1
+    },
+    {
+        .templ=     "--dedupTableSize=%u",
+        .offset=    offsetof(struct s3b_config, dedup.table_size),
+    },
+    {
+        .templ=     "--localfsDirectIO",
+        .offset=    offsetof(struct s3b_config, localfs_io.direct_io),
+        .value=     1
+    },
+    {
+        .templ=     "--localfsPreallocate",
+        .offset=    offsetof(struct s3b_config, localfs_io.preallocate),
+        .value=     1
+    },
     {
         .templ=     "--listBlocks",
         .offset=    offsetof(struct s3b_config, list_blocks),
         .value=     1
     },
+    {
+        .templ=     "--listBlocksCheckpoint=%s",
+        .offset=    offsetof(struct s3b_config, zero_cache.checkpoint_file),
+    },
     {
         .templ=     "--listBlocksThreads=%d",
         .offset=    offsetof(struct s3b_config, http_io.list_blocks_threads),
     },
+    {
+        .templ=     "--ioThreads=%u",
+        .offset=    offsetof(struct s3b_config, http_io.io_threads),
+    },
+    {
+        .templ=     "--eventThreads=%u",
+        .offset=    offsetof(struct s3b_config, http_io.event_threads),
+    },
+    {
+        .templ=     "--transformThreads=%u",
+        .offset=    offsetof(struct s3b_config, http_io.transform_threads),
+    },
+    {
+        .templ=     "--prewarmConnections=%u",
+        .offset=    offsetof(struct s3b_config, http_io.prewarm_connections),
+    },
+    {
+        .templ=     "--hedgePercentile=%u",
+        .offset=    offsetof(struct s3b_config, http_io.hedge_percentile),
+    },
+    {
+        .templ=     "--hedgeBudget=%u",
+        .offset=    offsetof(struct s3b_config, http_io.hedge_budget),
+    },
     {
         .templ=     "--baseURL=%s",
         .offset=    offsetof(struct s3b_config, http_io.baseURL),
@@ -274,6 +386,14 @@ static const struct fuse_opt option_list[] = {
         .templ=     "--blockCacheSize=%u",
         .offset=    offsetof(struct s3b_config, block_cache.cache_size),
     },
+    {
+        .templ=     "--blockCacheEviction=%s",
+        .offset=    offsetof(struct s3b_config, block_cache.eviction),
+    },
+    {
+        .templ=     "--blockCacheShards=%u",
+        .offset=    offsetof(struct s3b_config, block_cache.num_shards),
+    },
     {
         .templ=     "--blockCacheSync",
         .offset=    offsetof(struct s3b_config, block_cache.synchronous),
@@ -291,6 +411,27 @@ static const struct fuse_opt option_list[] = {
         .templ=     "--blockCacheWriteDelay=%u",
         .offset=    offsetof(struct s3b_config, block_cache.write_delay),
     },
+    {
+        .templ=     "--blockCacheWriteCoalesce=%u",
+        .offset=    offsetof(struct s3b_config, block_cache.write_coalesce),
+    },
+    {
+        .templ=     "--blockCachePriorityBlocks=%u",
+        .offset=    offsetof(struct s3b_config, block_cache.priority_blocks),
+    },
+    {
+        .templ=     "--blockCachePriorityThreads=%u",
+        .offset=    offsetof(struct s3b_config, block_cache.priority_threads),
+    },
+    {
+        .templ=     "--blockCacheBackgroundThreads=%u",
+        .offset=    offsetof(struct s3b_config, block_cache.background_threads),
+    },
+    {
+        .templ=     "--blockCachePartialWrites",
+        .offset=    offsetof(struct s3b_config, block_cache.partial_writes),
+        .value=     1
+    },
     {
         .templ=     "--blockCacheMaxDirty=%u",
         .offset=    offsetof(struct s3b_config, block_cache.max_dirty),
@@ -308,6 +449,31 @@ static const struct fuse_opt option_list[] = {
         .templ=     "--readAheadTrigger=%u",
         .offset=    offsetof(struct s3b_config, block_cache.read_ahead_trigger),
     },
+    {
+        .templ=     "--readAheadMax=%u",
+        .offset=    offsetof(struct s3b_config, block_cache.read_ahead_max),
+    },
+    {
+        .templ=     "--readAheadStreams=%u",
+        .offset=    offsetof(struct s3b_config, block_cache.read_ahead_streams),
+    },
+    {
+        .templ=     "--blockCacheCompressedSize=%s",
+        .offset=    offsetof(struct s3b_config, block_cache_compressed_size_str),
+    },
+    {
+        .templ=     "--blockCacheCompressedAlg=%s",
+        .offset=    offsetof(struct s3b_config, block_cache_compressed_alg),
+    },
+    {
+        .templ=     "--blockCacheRangeReadMax=%u",
+        .offset=    offsetof(struct s3b_config, block_cache.range_read_max),
+    },
+    {
+        .templ=     "--blockCacheRangeReadFetch",
+        .offset=    offsetof(struct s3b_config, block_cache.range_read_fetch),
+        .value=     1
+    },
     {
         .templ=     "--blockCacheNumProtected=%u",
         .offset=    offsetof(struct s3b_config, block_cache.num_protected),
@@ -316,6 +482,19 @@ static const struct fuse_opt option_list[] = {
         .templ=     "--blockCacheFile=%s",
         .offset=    offsetof(struct s3b_config, block_cache.cache_file),
     },
+    {
+        .templ=     "--blockCacheHotFile=%s",
+        .offset=    offsetof(struct s3b_config, block_cache.hot_file),
+    },
+    {
+        .templ=     "--blockCachePrefetch",
+        .offset=    offsetof(struct s3b_config, block_cache_prefetch),
+        .value=     1
+    },
+    {
+        .templ=     "--blockCachePrefetchThreads=%u",
+        .offset=    offsetof(struct s3b_config, block_cache.prefetch_threads),
+    },
     {
         .templ=     "--blockCacheNoVerify",
         .offset=    offsetof(struct s3b_config, block_cache.no_verify),
@@ -326,10 +505,38 @@ static const struct fuse_opt option_list[] = {
         .offset=    offsetof(struct s3b_config, block_cache.fadvise),
         .value=     1
     },
+    {
+        .templ=     "--blockCacheFileEncoded",
+        .offset=    offsetof(struct s3b_config, block_cache.store_encoded),
+        .value=     1
+    },
+    {
+        .templ=     "--blockCacheFileIndex",
+        .offset=    offsetof(struct s3b_config, block_cache.use_index),
+        .value=     1
+    },
+    {
+        .templ=     "--blockCacheFileMmap",
+        .offset=    offsetof(struct s3b_config, block_cache.use_mmap),
+        .value=     1
+    },
+    {
+        .templ=     "--blockCacheFileUring",
+        .offset=    offsetof(struct s3b_config, block_cache.use_io_uring),
+        .value=     1
+    },
+    {
+        .templ=     "--backend=%s",
+        .offset=    offsetof(struct s3b_config, backend),
+    },
     {
         .templ=     "--blockSize=%s",
         .offset=    offsetof(struct s3b_config, block_size_str),
     },
+    {
+        .templ=     "--bufferPoolSize=%u",
+        .offset=    offsetof(struct s3b_config, buffer_pool_size),
+    },
     {
         .templ=     "--maxUploadSpeed=%s",
         .offset=    offsetof(struct s3b_config, max_speed_str[HTTP_UPLOAD]),
@@ -338,6 +545,14 @@ static const struct fuse_opt option_list[] = {
         .templ=     "--maxDownloadSpeed=%s",
         .offset=    offsetof(struct s3b_config, max_speed_str[HTTP_DOWNLOAD]),
     },
+    {
+        .templ=     "--maxTotalSpeed=%s",
+        .offset=    offsetof(struct s3b_config, max_total_speed_str),
+    },
+    {
+        .templ=     "--maxRequestRate=%u",
+        .offset=    offsetof(struct s3b_config, http_io.max_request_rate),
+    },
     {
         .templ=     "--md5CacheSize=%u",
         .offset=    offsetof(struct s3b_config, ec_protect.cache_size),
@@ -361,6 +576,11 @@ static const struct fuse_opt option_list[] = {
         .offset=    offsetof(struct s3b_config, http_io.http_11),
         .value=     1
     },
+    {
+        .templ=     "--unsignedPayload",
+        .offset=    offsetof(struct s3b_config, http_io.unsigned_payload),
+        .value=     1
+    },
     {
         .templ=     "--quiet",
         .offset=    offsetof(struct s3b_config, quiet),
@@ -442,6 +662,10 @@ static const struct fuse_opt option_list[] = {
         .templ=     "--statsFilename=%s",
         .offset=    offsetof(struct s3b_config, fuse_ops.stats_filename),
     },
+    {
+        .templ=     "--metricsSocket=%s",
+        .offset=    offsetof(struct s3b_config, fuse_ops.metrics_socket),
+    },
     {
         .templ=     "--storageClass=%s",
         .offset=    offsetof(struct s3b_config, http_io.storage_class),
@@ -514,6 +738,14 @@ static const struct fuse_opt option_list[] = {
         .offset=    offsetof(struct s3b_config, test_io.discard_data),
         .value=     1
     },
+    {
+        .templ=     "--test-latency=%u",
+        .offset=    offsetof(struct s3b_config, test_io.latency),
+    },
+    {
+        .templ=     "--test-latency-dist=%s",
+        .offset=    offsetof(struct s3b_config, test_io.latency_dist),
+    },
     {
         .templ=     "--timeout=%u",
         .offset=    offsetof(struct s3b_config, http_io.timeout),
@@ -551,8 +783,10 @@ static const char *const s3backer_fuse_defaults[] = {
 struct s3backer_store *block_cache_store;
 struct s3backer_store *zero_cache_store;
 struct s3backer_store *ec_protect_store;
+struct s3backer_store *dedup_store;
 struct s3backer_store *http_io_store;
 struct s3backer_store *test_io_store;
+struct s3backer_store *localfs_io_store;
 
 /****************************************************************************
  *                      PUBLIC FUNCTION DEFINITIONS                         *
@@ -683,6 +917,7 @@ s3backer_get_config2(int argc, char **argv, int nbd, int parse_only, fuse_opt_pr
 
     // Set up fuse_ops callbacks
     config.fuse_ops.print_stats = s3b_config_print_stats;
+    config.fuse_ops.print_metrics = s3b_config_print_metrics;
     config.fuse_ops.clear_stats = s3b_config_clear_stats;
     config.fuse_ops.s3bconf = &config;
 
@@ -729,16 +964,20 @@ s3backer_create_store(struct s3b_config *conf)
     int r;
 
     // Sanity check
-    if (http_io_store != NULL || test_io_store != NULL) {
+    if (http_io_store != NULL || test_io_store != NULL || localfs_io_store != NULL) {
         errno = EINVAL;
         return NULL;
     }
 
-    // Create HTTP (or test) layer
+    // Create HTTP (or test, or local filesystem) layer
     if (conf->test) {
         if ((test_io_store = test_io_create(&conf->test_io)) == NULL)
             return NULL;
         store = test_io_store;
+    } else if (conf->localfs) {
+        if ((localfs_io_store = localfs_io_create(&conf->localfs_io)) == NULL)
+            return NULL;
+        store = localfs_io_store;
     } else {
         if ((http_io_store = http_io_create(&conf->http_io)) == NULL)
             return NULL;
@@ -759,6 +998,13 @@ s3backer_create_store(struct s3b_config *conf)
         store = block_cache_store;
     }
 
+    // Create deduplication layer (if desired)
+    if (conf->use_dedup) {
+        if ((dedup_store = dedup_create(&conf->dedup, store)) == NULL)
+            goto fail_with_errno;
+        store = dedup_store;
+    }
+
     // Create zero block cache
     if ((zero_cache_store = zero_cache_create(&conf->zero_cache, store)) == NULL)
         goto fail_with_errno;
@@ -800,8 +1046,10 @@ fail:
     block_cache_store = NULL;
     zero_cache_store = NULL;
     ec_protect_store = NULL;
+    dedup_store = NULL;
     http_io_store = NULL;
     test_io_store = NULL;
+    localfs_io_store = NULL;
     errno = r;
     return NULL;
 }
@@ -831,25 +1079,34 @@ s3b_cleanup(void)
     FORCE_FREE(config.http_io.sse);
     FORCE_FREE(config.http_io.sse_key_id);
     FORCE_FREE(config.block_cache.cache_file);
+    FORCE_FREE(config.block_cache.hot_file);
+    FORCE_FREE(config.zero_cache.checkpoint_file);
+    FORCE_FREE2(config.block_cache.eviction, S3BACKER_DEFAULT_BLOCK_CACHE_EVICTION);
+    FORCE_FREE2(config.test_io.latency_dist, S3BACKER_DEFAULT_TEST_LATENCY_DIST);
     FORCE_FREE(config.block_size_str);
     FORCE_FREE(config.max_speed_str[HTTP_UPLOAD]);
     FORCE_FREE(config.max_speed_str[HTTP_DOWNLOAD]);
+    FORCE_FREE(config.max_total_speed_str);
     FORCE_FREE2(config.prefix, S3BACKER_DEFAULT_PREFIX);
     FORCE_FREE(config.http_io.default_ce);
     FORCE_FREE(config.http_io.vhostURL);
     FORCE_FREE(config.file_size_str);
     FORCE_FREE2(config.fuse_ops.filename, S3BACKER_DEFAULT_FILENAME);
     FORCE_FREE2(config.fuse_ops.stats_filename, S3BACKER_DEFAULT_STATS_FILENAME);
+    FORCE_FREE(config.fuse_ops.metrics_socket);
     FORCE_FREE(config.http_io.storage_class);
     FORCE_FREE(config.http_io.cacert);
     FORCE_FREE2(config.compress_alg, S3BACKER_DEFAULT_COMPRESSION);
     FORCE_FREE(config.compress_level);
+    FORCE_FREE(config.block_cache_compressed_size_str);
+    FORCE_FREE(config.block_cache_compressed_alg);
     FORCE_FREE(config.http_io.encryption);
     FORCE_FREE(config.http_io.password);
     FORCE_FREE(config.password_file);
 
     // Config params
     FORCE_FREE(config.bucket);
+    FORCE_FREE(config.backend);
     FORCE_FREE(config.mount);
 
     // Misc
@@ -859,6 +1116,10 @@ s3b_cleanup(void)
         (*config.http_io.compress_alg->lfree)(config.http_io.compress_level);
         config.http_io.compress_level = NULL;
     }
+    if (config.block_cache.compressed_alg != NULL) {
+        (*config.block_cache.compressed_alg->lfree)(config.block_cache.compressed_level);
+        config.block_cache.compressed_level = NULL;
+    }
 
     // Done
     memset(&config, 0, sizeof(config));
@@ -872,17 +1133,26 @@ static void
 s3b_config_print_stats(void *prarg, printer_t *printer)
 {
     struct http_io_stats http_io_stats;
+    struct localfs_io_stats localfs_io_stats;
     struct ec_protect_stats ec_protect_stats;
+    struct dedup_stats dedup_stats;
     struct zero_cache_stats zero_cache_stats;
     struct block_cache_stats block_cache_stats;
+    struct block_buf_stats block_buf_stats;
     double curl_reuse_ratio = 0.0;
-    u_int total_oom = 0;
-    u_int total_curls;
+    u_int block_buf_idle;
+    u_int block_buf_in_use;
+    uint64_t total_oom = 0;
+    uint64_t total_curls;
 
     // Get HTTP stats
     if (http_io_store != NULL)
         http_io_get_stats(http_io_store, &http_io_stats);
 
+    // Get local filesystem stats
+    if (localfs_io_store != NULL)
+        localfs_io_get_stats(localfs_io_store, &localfs_io_stats);
+
     // Get zero cache stats
     if (zero_cache_store != NULL)
         zero_cache_get_stats(zero_cache_store, &zero_cache_stats);
@@ -891,59 +1161,90 @@ s3b_config_print_stats(void *prarg, printer_t *printer)
     if (ec_protect_store != NULL)
         ec_protect_get_stats(ec_protect_store, &ec_protect_stats);
 
+    // Get dedup stats
+    if (dedup_store != NULL)
+        dedup_get_stats(dedup_store, &dedup_stats);
+
     // Get block cache stats
     if (block_cache_store != NULL)
         block_cache_get_stats(block_cache_store, &block_cache_stats);
 
+    // Get block buffer pool stats (the per-thread counts are approximate, so don't let "in use" go negative)
+    block_buf_get_stats(&block_buf_stats);
+    block_buf_idle = block_buf_stats.num_idle + block_buf_stats.num_cached;
+    block_buf_in_use = block_buf_stats.num_total > block_buf_idle ? block_buf_stats.num_total - block_buf_idle : 0;
+
     // Print stats in human-readable form
     if (http_io_store != NULL) {
-        (*printer)(prarg, "%-28s %u\n", "http_normal_blocks_read", http_io_stats.normal_blocks_read);
-        (*printer)(prarg, "%-28s %u\n", "http_normal_blocks_written", http_io_stats.normal_blocks_written);
-        (*printer)(prarg, "%-28s %u\n", "http_zero_blocks_read", http_io_stats.zero_blocks_read);
-        (*printer)(prarg, "%-28s %u\n", "http_zero_blocks_written", http_io_stats.zero_blocks_written);
+        (*printer)(prarg, "%-28s %ju\n", "http_normal_blocks_read", (uintmax_t)http_io_stats.normal_blocks_read);
+        (*printer)(prarg, "%-28s %ju\n", "http_normal_blocks_written", (uintmax_t)http_io_stats.normal_blocks_written);
+        (*printer)(prarg, "%-28s %ju\n", "http_zero_blocks_read", (uintmax_t)http_io_stats.zero_blocks_read);
+        (*printer)(prarg, "%-28s %ju\n", "http_partial_blocks_read", (uintmax_t)http_io_stats.partial_blocks_read);
+        (*printer)(prarg, "%-28s %ju\n", "http_zero_blocks_written", (uintmax_t)http_io_stats.zero_blocks_written);
         if (config.list_blocks) {
-            (*printer)(prarg, "%-28s %u\n", "http_empty_blocks_read", http_io_stats.empty_blocks_read);
-            (*printer)(prarg, "%-28s %u\n", "http_empty_blocks_written", http_io_stats.empty_blocks_written);
+            (*printer)(prarg, "%-28s %ju\n", "http_empty_blocks_read", (uintmax_t)http_io_stats.empty_blocks_read);
+            (*printer)(prarg, "%-28s %ju\n", "http_empty_blocks_written", (uintmax_t)http_io_stats.empty_blocks_written);
         }
-        (*printer)(prarg, "%-28s %u\n", "http_gets", http_io_stats.http_gets.count);
-        (*printer)(prarg, "%-28s %u\n", "http_puts", http_io_stats.http_puts.count);
-        (*printer)(prarg, "%-28s %u\n", "http_deletes", http_io_stats.http_deletes.count);
+        (*printer)(prarg, "%-28s %ju\n", "http_gets", (uintmax_t)http_io_stats.http_gets.count);
+        (*printer)(prarg, "%-28s %ju\n", "http_puts", (uintmax_t)http_io_stats.http_puts.count);
+        (*printer)(prarg, "%-28s %ju\n", "http_deletes", (uintmax_t)http_io_stats.http_deletes.count);
         (*printer)(prarg, "%-28s %.3f sec\n", "http_avg_get_time", http_io_stats.http_gets.count > 0 ?
           http_io_stats.http_gets.time / http_io_stats.http_gets.count : 0.0);
         (*printer)(prarg, "%-28s %.3f sec\n", "http_avg_put_time", http_io_stats.http_puts.count > 0 ?
           http_io_stats.http_puts.time / http_io_stats.http_puts.count : 0.0);
         (*printer)(prarg, "%-28s %.3f sec\n", "http_avg_delete_time", http_io_stats.http_deletes.count > 0 ?
           http_io_stats.http_deletes.time / http_io_stats.http_deletes.count : 0.0);
-        (*printer)(prarg, "%-28s %u\n", "http_unauthorized", http_io_stats.http_unauthorized);
-        (*printer)(prarg, "%-28s %u\n", "http_forbidden", http_io_stats.http_forbidden);
-        (*printer)(prarg, "%-28s %u\n", "http_stale", http_io_stats.http_stale);
-        (*printer)(prarg, "%-28s %u\n", "http_redirect", http_io_stats.http_redirect);
-        (*printer)(prarg, "%-28s %u\n", "http_verified", http_io_stats.http_verified);
-        (*printer)(prarg, "%-28s %u\n", "http_mismatch", http_io_stats.http_mismatch);
-        (*printer)(prarg, "%-28s %u\n", "http_5xx_error", http_io_stats.http_5xx_error);
-        (*printer)(prarg, "%-28s %u\n", "http_4xx_error", http_io_stats.http_4xx_error);
-        (*printer)(prarg, "%-28s %u\n", "http_3xx_error", http_io_stats.http_3xx_error);
-        (*printer)(prarg, "%-28s %u\n", "http_other_error", http_io_stats.http_other_error);
-        (*printer)(prarg, "%-28s %u\n", "http_canceled_writes", http_io_stats.http_canceled_writes);
-        (*printer)(prarg, "%-28s %u\n", "http_num_retries", http_io_stats.num_retries);
+        (*printer)(prarg, "%-28s %.3f sec\n", "http_p50_get_time", latency_percentile(&http_io_stats.http_gets, 50));
+        (*printer)(prarg, "%-28s %.3f sec\n", "http_p99_get_time", latency_percentile(&http_io_stats.http_gets, 99));
+        (*printer)(prarg, "%-28s %.3f sec\n", "http_p50_put_time", latency_percentile(&http_io_stats.http_puts, 50));
+        (*printer)(prarg, "%-28s %.3f sec\n", "http_p99_put_time", latency_percentile(&http_io_stats.http_puts, 99));
+        if (config.http_io.hedge_percentile != 0) {
+            (*printer)(prarg, "%-28s %ju\n", "http_hedged_gets", (uintmax_t)http_io_stats.http_hedged_gets);
+            (*printer)(prarg, "%-28s %ju\n", "http_hedge_wins", (uintmax_t)http_io_stats.http_hedge_wins);
+        }
+        (*printer)(prarg, "%-28s %ju\n", "http_unauthorized", (uintmax_t)http_io_stats.http_unauthorized);
+        (*printer)(prarg, "%-28s %ju\n", "http_forbidden", (uintmax_t)http_io_stats.http_forbidden);
+        (*printer)(prarg, "%-28s %ju\n", "http_stale", (uintmax_t)http_io_stats.http_stale);
+        (*printer)(prarg, "%-28s %ju\n", "http_redirect", (uintmax_t)http_io_stats.http_redirect);
+        (*printer)(prarg, "%-28s %ju\n", "http_verified", (uintmax_t)http_io_stats.http_verified);
+        (*printer)(prarg, "%-28s %ju\n", "http_mismatch", (uintmax_t)http_io_stats.http_mismatch);
+        (*printer)(prarg, "%-28s %ju\n", "http_5xx_error", (uintmax_t)http_io_stats.http_5xx_error);
+        (*printer)(prarg, "%-28s %ju\n", "http_4xx_error", (uintmax_t)http_io_stats.http_4xx_error);
+        (*printer)(prarg, "%-28s %ju\n", "http_3xx_error", (uintmax_t)http_io_stats.http_3xx_error);
+        (*printer)(prarg, "%-28s %ju\n", "http_other_error", (uintmax_t)http_io_stats.http_other_error);
+        (*printer)(prarg, "%-28s %ju\n", "http_canceled_writes", (uintmax_t)http_io_stats.http_canceled_writes);
+        (*printer)(prarg, "%-28s %ju\n", "http_num_retries", (uintmax_t)http_io_stats.num_retries);
         (*printer)(prarg, "%-28s %ju.%03u sec\n", "http_total_retry_delay",
           (uintmax_t)(http_io_stats.retry_delay / 1000), (u_int)(http_io_stats.retry_delay % 1000));
+        if (config.http_io.max_request_rate != 0 || config.http_io.max_total_speed != 0) {
+            (*printer)(prarg, "%-28s %ju\n", "http_rate_limit_waits", (uintmax_t)http_io_stats.rate_limit_waits);
+            (*printer)(prarg, "%-28s %ju.%03u sec\n", "http_rate_limit_delay",
+              (uintmax_t)(http_io_stats.rate_limit_delay / 1000), (u_int)(http_io_stats.rate_limit_delay % 1000));
+            (*printer)(prarg, "%-28s %ju\n", "http_rate_limit_slowdowns", (uintmax_t)http_io_stats.rate_limit_slowdowns);
+        }
         total_curls = http_io_stats.curl_handles_created + http_io_stats.curl_handles_reused;
         if (total_curls > 0)
             curl_reuse_ratio = (double)http_io_stats.curl_handles_reused / (double)total_curls;
         (*printer)(prarg, "%-28s %.4f\n", "curl_handle_reuse_ratio", curl_reuse_ratio);
-        (*printer)(prarg, "%-28s %u\n", "curl_timeouts", http_io_stats.curl_timeouts);
-        (*printer)(prarg, "%-28s %u\n", "curl_connect_failed", http_io_stats.curl_connect_failed);
-        (*printer)(prarg, "%-28s %u\n", "curl_host_unknown", http_io_stats.curl_host_unknown);
-        (*printer)(prarg, "%-28s %u\n", "curl_out_of_memory", http_io_stats.curl_out_of_memory);
-        (*printer)(prarg, "%-28s %u\n", "curl_other_error", http_io_stats.curl_other_error);
+        (*printer)(prarg, "%-28s %ju\n", "curl_timeouts", (uintmax_t)http_io_stats.curl_timeouts);
+        (*printer)(prarg, "%-28s %ju\n", "curl_connect_failed", (uintmax_t)http_io_stats.curl_connect_failed);
+        (*printer)(prarg, "%-28s %ju\n", "curl_host_unknown", (uintmax_t)http_io_stats.curl_host_unknown);
+        (*printer)(prarg, "%-28s %ju\n", "curl_out_of_memory", (uintmax_t)http_io_stats.curl_out_of_memory);
+        (*printer)(prarg, "%-28s %ju\n", "curl_other_error", (uintmax_t)http_io_stats.curl_other_error);
         total_oom += http_io_stats.out_of_memory_errors;
     }
+    if (localfs_io_store != NULL) {
+        (*printer)(prarg, "%-28s %ju\n", "localfs_blocks_read", (uintmax_t)localfs_io_stats.blocks_read);
+        (*printer)(prarg, "%-28s %ju\n", "localfs_blocks_written", (uintmax_t)localfs_io_stats.blocks_written);
+        (*printer)(prarg, "%-28s %ju\n", "localfs_zero_blocks_written", (uintmax_t)localfs_io_stats.zero_blocks_written);
+        (*printer)(prarg, "%-28s %ju\n", "localfs_bounce_copies", (uintmax_t)localfs_io_stats.bounce_copies);
+        (*printer)(prarg, "%-28s %ju\n", "localfs_flushes", (uintmax_t)localfs_io_stats.flushes);
+    }
     if (block_cache_store != NULL) {
         double read_hit_ratio = 0.0;
         double write_hit_ratio = 0.0;
-        u_int total_reads;
-        u_int total_writes;
+        uint64_t total_reads;
+        uint64_t total_writes;
 
         total_reads = block_cache_stats.read_hits + block_cache_stats.read_misses;
         if (total_reads != 0)
@@ -954,31 +1255,353 @@ s3b_config_print_stats(void *prarg, printer_t *printer)
         (*printer)(prarg, "%-28s %u blocks\n", "block_cache_current_size", block_cache_stats.current_size);
         (*printer)(prarg, "%-28s %u blocks\n", "block_cache_initial_size", block_cache_stats.initial_size);
         (*printer)(prarg, "%-28s %.8f\n", "block_cache_dirty_ratio", block_cache_stats.dirty_ratio);
-        (*printer)(prarg, "%-28s %u\n", "block_cache_read_hits", block_cache_stats.read_hits);
-        (*printer)(prarg, "%-28s %u\n", "block_cache_read_misses", block_cache_stats.read_misses);
+        (*printer)(prarg, "%-28s %ju\n", "block_cache_read_hits", (uintmax_t)block_cache_stats.read_hits);
+        (*printer)(prarg, "%-28s %ju\n", "block_cache_read_misses", (uintmax_t)block_cache_stats.read_misses);
         (*printer)(prarg, "%-28s %.8f\n", "block_cache_read_hit_ratio", read_hit_ratio);
-        (*printer)(prarg, "%-28s %u\n", "block_cache_write_hits", block_cache_stats.write_hits);
-        (*printer)(prarg, "%-28s %u\n", "block_cache_write_misses", block_cache_stats.write_misses);
+        (*printer)(prarg, "%-28s %ju\n", "block_cache_write_hits", (uintmax_t)block_cache_stats.write_hits);
+        (*printer)(prarg, "%-28s %ju\n", "block_cache_write_misses", (uintmax_t)block_cache_stats.write_misses);
         (*printer)(prarg, "%-28s %.8f\n", "block_cache_write_hit_ratio", write_hit_ratio);
-        (*printer)(prarg, "%-28s %u\n", "block_cache_verified", block_cache_stats.verified);
-        (*printer)(prarg, "%-28s %u\n", "block_cache_mismatch", block_cache_stats.mismatch);
+        (*printer)(prarg, "%-28s %ju\n", "block_cache_verified", (uintmax_t)block_cache_stats.verified);
+        (*printer)(prarg, "%-28s %ju\n", "block_cache_mismatch", (uintmax_t)block_cache_stats.mismatch);
+        (*printer)(prarg, "%-28s %ju\n", "block_cache_read_ahead_hits", (uintmax_t)block_cache_stats.read_ahead_hits);
+        (*printer)(prarg, "%-28s %ju\n", "block_cache_read_ahead_late", (uintmax_t)block_cache_stats.read_ahead_late);
+        (*printer)(prarg, "%-28s %ju\n", "block_cache_read_ahead_wasted", (uintmax_t)block_cache_stats.read_ahead_wasted);
+        (*printer)(prarg, "%-28s %ju\n", "block_cache_evictions", (uintmax_t)block_cache_stats.evictions);
+        if (config.block_cache.write_coalesce > 1) {
+            (*printer)(prarg, "%-28s %ju\n", "block_cache_coalesced_writes", (uintmax_t)block_cache_stats.coalesced_writes);
+            (*printer)(prarg, "%-28s %ju\n", "block_cache_coalesced_blocks", (uintmax_t)block_cache_stats.coalesced_blocks);
+        }
+        (*printer)(prarg, "%-28s %ju\n", "block_cache_flush_writebacks", (uintmax_t)block_cache_stats.flush_writebacks);
+        if (config.block_cache.priority_blocks != 0)
+            (*printer)(prarg, "%-28s %ju\n", "block_cache_priority_writes", (uintmax_t)block_cache_stats.priority_writebacks);
+        if (config.block_cache.partial_writes) {
+            (*printer)(prarg, "%-28s %ju\n", "block_cache_partial_writes", (uintmax_t)block_cache_stats.partial_writes);
+            (*printer)(prarg, "%-28s %ju\n", "block_cache_partial_fills", (uintmax_t)block_cache_stats.partial_fills);
+            (*printer)(prarg, "%-28s %ju\n", "block_cache_partial_skips", (uintmax_t)block_cache_stats.partial_skips);
+        }
+        if (config.block_cache.compressed_size != 0) {
+            const double ratio = block_cache_stats.ctier_bytes > 0 ?
+              (double)block_cache_stats.ctier_data_bytes / (double)block_cache_stats.ctier_bytes : 0.0;
+
+            (*printer)(prarg, "%-28s %u\n", "block_cache_ctier_blocks", block_cache_stats.ctier_blocks);
+            (*printer)(prarg, "%-28s %ju\n", "block_cache_ctier_bytes", (uintmax_t)block_cache_stats.ctier_bytes);
+            (*printer)(prarg, "%-28s %.2f\n", "block_cache_ctier_ratio", ratio);
+            (*printer)(prarg, "%-28s %ju\n", "block_cache_ctier_hits", (uintmax_t)block_cache_stats.ctier_hits);
+            (*printer)(prarg, "%-28s %ju\n", "block_cache_ctier_stores", (uintmax_t)block_cache_stats.ctier_stores);
+            (*printer)(prarg, "%-28s %ju\n", "block_cache_ctier_rejects", (uintmax_t)block_cache_stats.ctier_rejects);
+            (*printer)(prarg, "%-28s %ju\n", "block_cache_ctier_evictions", (uintmax_t)block_cache_stats.ctier_evictions);
+        }
+        if (config.block_cache.store_encoded) {
+            (*printer)(prarg, "%-28s %ju\n", "block_cache_encoded_stores", (uintmax_t)block_cache_stats.encoded_stores);
+            (*printer)(prarg, "%-28s %ju\n", "block_cache_encoded_decodes", (uintmax_t)block_cache_stats.encoded_decodes);
+        }
+        if (config.block_cache.range_read_max != 0) {
+            (*printer)(prarg, "%-28s %ju\n", "block_cache_range_reads", (uintmax_t)block_cache_stats.range_reads);
+            (*printer)(prarg, "%-28s %ju\n", "block_cache_range_fetches", (uintmax_t)block_cache_stats.range_fetches);
+        }
+        if (config.block_cache.hot_file != NULL)
+            (*printer)(prarg, "%-28s %ju\n", "block_cache_prefetches", (uintmax_t)block_cache_stats.prefetches);
+        (*printer)(prarg, "%-28s %.3f sec\n", "block_cache_p99_miss_time", latency_percentile(&block_cache_stats.miss_reads, 99));
+        (*printer)(prarg, "%-28s %.3f sec\n", "block_cache_p99_writeback", latency_percentile(&block_cache_stats.writebacks, 99));
+        if (strcmp(config.block_cache.eviction, BLOCK_CACHE_EVICTION_2Q) == 0) {
+            double recent_hit_ratio = 0.0;
+            double frequent_hit_ratio = 0.0;
+            double ghost_hit_ratio = 0.0;
+
+            if (total_reads != 0) {
+                recent_hit_ratio = (double)block_cache_stats.recent_hits / (double)total_reads;
+                frequent_hit_ratio = (double)block_cache_stats.frequent_hits / (double)total_reads;
+            }
+            if (block_cache_stats.read_misses != 0)
+                ghost_hit_ratio = (double)block_cache_stats.ghost_hits / (double)block_cache_stats.read_misses;
+            (*printer)(prarg, "%-28s %ju\n", "block_cache_recent_hits", (uintmax_t)block_cache_stats.recent_hits);
+            (*printer)(prarg, "%-28s %.8f\n", "block_cache_recent_hit_ratio", recent_hit_ratio);
+            (*printer)(prarg, "%-28s %ju\n", "block_cache_frequent_hits", (uintmax_t)block_cache_stats.frequent_hits);
+            (*printer)(prarg, "%-28s %.8f\n", "block_cache_frequent_hit_ratio", frequent_hit_ratio);
+            (*printer)(prarg, "%-28s %ju\n", "block_cache_ghost_hits", (uintmax_t)block_cache_stats.ghost_hits);
+            (*printer)(prarg, "%-28s %.8f\n", "block_cache_ghost_hit_ratio", ghost_hit_ratio);
+        }
         total_oom += block_cache_stats.out_of_memory_errors;
     }
     if (zero_cache_store != NULL) {
         (*printer)(prarg, "%-28s %ju blocks\n", "zero_block_cache_size", (uintmax_t)zero_cache_stats.current_cache_size);
-        (*printer)(prarg, "%-28s %u\n", "zero_block_cache_read_hits", zero_cache_stats.read_hits);
-        (*printer)(prarg, "%-28s %u\n", "zero_block_cache_write_hits", zero_cache_stats.write_hits);
+        (*printer)(prarg, "%-28s %zu bytes\n", "zero_block_cache_memory", zero_cache_stats.bitmap_memory);
+        (*printer)(prarg, "%-28s %ju\n", "zero_block_cache_read_hits", (uintmax_t)zero_cache_stats.read_hits);
+        (*printer)(prarg, "%-28s %ju\n", "zero_block_cache_write_hits", (uintmax_t)zero_cache_stats.write_hits);
+    }
+    if (dedup_store != NULL) {
+        (*printer)(prarg, "%-28s %ju blocks\n", "dedup_shared_blocks", (uintmax_t)dedup_stats.shared_blocks);
+        (*printer)(prarg, "%-28s %u\n", "dedup_table_entries", dedup_stats.table_entries);
+        (*printer)(prarg, "%-28s %ju\n", "dedup_writes", (uintmax_t)dedup_stats.dedup_writes);
+        (*printer)(prarg, "%-28s %ju\n", "dedup_unchanged_writes", (uintmax_t)dedup_stats.unchanged_writes);
+        (*printer)(prarg, "%-28s %ju\n", "dedup_relocated_writes", (uintmax_t)dedup_stats.relocated_writes);
+        (*printer)(prarg, "%-28s %ju\n", "dedup_index_flushes", (uintmax_t)dedup_stats.index_flushes);
+        (*printer)(prarg, "%-28s %ju\n", "dedup_index_blocks_written", (uintmax_t)dedup_stats.index_blocks_written);
+        total_oom += dedup_stats.out_of_memory_errors;
     }
     if (ec_protect_store != NULL) {
         (*printer)(prarg, "%-28s %u blocks\n", "md5_cache_current_size", ec_protect_stats.current_cache_size);
-        (*printer)(prarg, "%-28s %u\n", "md5_cache_data_hits", ec_protect_stats.cache_data_hits);
+        (*printer)(prarg, "%-28s %ju\n", "md5_cache_data_hits", (uintmax_t)ec_protect_stats.cache_data_hits);
         (*printer)(prarg, "%-28s %ju.%03u sec\n", "md5_cache_full_delays",
           (uintmax_t)(ec_protect_stats.cache_full_delay / 1000), (u_int)(ec_protect_stats.cache_full_delay % 1000));
         (*printer)(prarg, "%-28s %ju.%03u sec\n", "md5_cache_write_delays",
           (uintmax_t)(ec_protect_stats.repeated_write_delay / 1000), (u_int)(ec_protect_stats.repeated_write_delay % 1000));
         total_oom += ec_protect_stats.out_of_memory_errors;
     }
-    (*printer)(prarg, "%-28s %u\n", "out_of_memory_errors", total_oom);
+    (*printer)(prarg, "%-28s %zu bytes\n", "block_buf_size", block_buf_stats.buf_size);
+    (*printer)(prarg, "%-28s %u\n", "block_buf_total", block_buf_stats.num_total);
+    (*printer)(prarg, "%-28s %u\n", "block_buf_in_use", block_buf_in_use);
+    (*printer)(prarg, "%-28s %u\n", "block_buf_idle", block_buf_stats.num_idle);
+    (*printer)(prarg, "%-28s %u\n", "block_buf_thread_cached", block_buf_stats.num_cached);
+    (*printer)(prarg, "%-28s %ju\n", "block_buf_thread_hits", block_buf_stats.thread_hits);
+    (*printer)(prarg, "%-28s %ju\n", "block_buf_pool_hits", block_buf_stats.pool_hits);
+    (*printer)(prarg, "%-28s %ju\n", "block_buf_misses", block_buf_stats.misses);
+    (*printer)(prarg, "%-28s %ju\n", "block_buf_oversize", block_buf_stats.oversize);
+    (*printer)(prarg, "%-28s %ju\n", "out_of_memory_errors", (uintmax_t)total_oom);
+}
+
+static void
+s3b_config_print_metrics(void *prarg, printer_t *printer)
+{
+    struct http_io_stats http_io_stats;
+    struct localfs_io_stats localfs_io_stats;
+    struct ec_protect_stats ec_protect_stats;
+    struct dedup_stats dedup_stats;
+    struct zero_cache_stats zero_cache_stats;
+    struct block_cache_stats block_cache_stats;
+    struct block_buf_stats block_buf_stats;
+    uint64_t total_oom = 0;
+    u_int block_buf_idle;
+
+    // Get HTTP stats
+    if (http_io_store != NULL)
+        http_io_get_stats(http_io_store, &http_io_stats);
+
+    // Get local filesystem stats
+    if (localfs_io_store != NULL)
+        localfs_io_get_stats(localfs_io_store, &localfs_io_stats);
+
+    // Get zero cache stats
+    if (zero_cache_store != NULL)
+        zero_cache_get_stats(zero_cache_store, &zero_cache_stats);
+
+    // Get EC protection stats
+    if (ec_protect_store != NULL)
+        ec_protect_get_stats(ec_protect_store, &ec_protect_stats);
+
+    // Get dedup stats
+    if (dedup_store != NULL)
+        dedup_get_stats(dedup_store, &dedup_stats);
+
+    // Get block cache stats
+    if (block_cache_store != NULL)
+        block_cache_get_stats(block_cache_store, &block_cache_stats);
+
+    // Get block buffer pool stats
+    block_buf_get_stats(&block_buf_stats);
+    block_buf_idle = block_buf_stats.num_idle + block_buf_stats.num_cached;
+
+    // Print stats in Prometheus text format
+    if (http_io_store != NULL) {
+        metrics_counter(prarg, printer, "s3backer_http_normal_blocks_read_total",
+          "Non-zero blocks read from the server", http_io_stats.normal_blocks_read);
+        metrics_counter(prarg, printer, "s3backer_http_normal_blocks_written_total",
+          "Non-zero blocks written to the server", http_io_stats.normal_blocks_written);
+        metrics_counter(prarg, printer, "s3backer_http_zero_blocks_read_total",
+          "Zero blocks read from the server", http_io_stats.zero_blocks_read);
+        metrics_counter(prarg, printer, "s3backer_http_partial_blocks_read_total",
+          "Parts of blocks read from the server using range GETs", http_io_stats.partial_blocks_read);
+        metrics_counter(prarg, printer, "s3backer_http_zero_blocks_written_total",
+          "Zero blocks written (deleted) on the server", http_io_stats.zero_blocks_written);
+        metrics_histogram(prarg, printer, "s3backer_http_head_seconds",
+          "Successful HTTP HEAD request latency", &http_io_stats.http_heads);
+        metrics_histogram(prarg, printer, "s3backer_http_get_seconds",
+          "Successful HTTP GET request latency", &http_io_stats.http_gets);
+        metrics_histogram(prarg, printer, "s3backer_http_put_seconds",
+          "Successful HTTP PUT request latency", &http_io_stats.http_puts);
+        metrics_histogram(prarg, printer, "s3backer_http_delete_seconds",
+          "Successful HTTP DELETE request latency", &http_io_stats.http_deletes);
+        metrics_counter(prarg, printer, "s3backer_http_hedged_gets_total",
+          "Duplicate GETs issued for slow block reads", http_io_stats.http_hedged_gets);
+        metrics_counter(prarg, printer, "s3backer_http_hedge_wins_total",
+          "Duplicate GETs that finished first", http_io_stats.http_hedge_wins);
+        metrics_counter(prarg, printer, "s3backer_http_unauthorized_total",
+          "HTTP 401 responses", http_io_stats.http_unauthorized);
+        metrics_counter(prarg, printer, "s3backer_http_forbidden_total",
+          "HTTP 403 responses", http_io_stats.http_forbidden);
+        metrics_counter(prarg, printer, "s3backer_http_stale_total",
+          "Stale data detected", http_io_stats.http_stale);
+        metrics_counter(prarg, printer, "s3backer_http_redirect_total",
+          "HTTP redirect responses", http_io_stats.http_redirect);
+        metrics_counter(prarg, printer, "s3backer_http_verified_total",
+          "Block reads verified against the expected MD5", http_io_stats.http_verified);
+        metrics_counter(prarg, printer, "s3backer_http_mismatch_total",
+          "Block reads not matching the expected MD5", http_io_stats.http_mismatch);
+        metrics_counter(prarg, printer, "s3backer_http_5xx_errors_total",
+          "HTTP 5xx responses", http_io_stats.http_5xx_error);
+        metrics_counter(prarg, printer, "s3backer_http_4xx_errors_total",
+          "HTTP 4xx responses", http_io_stats.http_4xx_error);
+        metrics_counter(prarg, printer, "s3backer_http_3xx_errors_total",
+          "HTTP 3xx responses", http_io_stats.http_3xx_error);
+        metrics_counter(prarg, printer, "s3backer_http_other_errors_total",
+          "Other HTTP errors", http_io_stats.http_other_error);
+        metrics_counter(prarg, printer, "s3backer_http_canceled_writes_total",
+          "Block writes canceled by a newer write", http_io_stats.http_canceled_writes);
+        metrics_counter(prarg, printer, "s3backer_http_retries_total",
+          "HTTP operations retried", http_io_stats.num_retries);
+        metrics_counter(prarg, printer, "s3backer_http_retry_delay_milliseconds_total",
+          "Total time spent pausing before retries", http_io_stats.retry_delay);
+        metrics_counter(prarg, printer, "s3backer_http_rate_limit_waits_total",
+          "HTTP requests delayed by rate limiting", http_io_stats.rate_limit_waits);
+        metrics_counter(prarg, printer, "s3backer_http_rate_limit_delay_milliseconds_total",
+          "Total time requests were delayed by rate limiting", http_io_stats.rate_limit_delay);
+        metrics_counter(prarg, printer, "s3backer_http_rate_limit_slowdowns_total",
+          "Request rate decreases due to 503 responses", http_io_stats.rate_limit_slowdowns);
+        metrics_counter(prarg, printer, "s3backer_curl_handles_created_total",
+          "CURL handles created", http_io_stats.curl_handles_created);
+        metrics_counter(prarg, printer, "s3backer_curl_handles_reused_total",
+          "CURL handles reused", http_io_stats.curl_handles_reused);
+        metrics_counter(prarg, printer, "s3backer_curl_timeouts_total",
+          "CURL operation timeouts", http_io_stats.curl_timeouts);
+        metrics_counter(prarg, printer, "s3backer_curl_connect_failed_total",
+          "CURL connection failures", http_io_stats.curl_connect_failed);
+        metrics_counter(prarg, printer, "s3backer_curl_host_unknown_total",
+          "CURL host name resolution failures", http_io_stats.curl_host_unknown);
+        metrics_counter(prarg, printer, "s3backer_curl_out_of_memory_total",
+          "CURL out of memory errors", http_io_stats.curl_out_of_memory);
+        metrics_counter(prarg, printer, "s3backer_curl_other_errors_total",
+          "Other CURL errors", http_io_stats.curl_other_error);
+        total_oom += http_io_stats.out_of_memory_errors;
+    }
+    if (localfs_io_store != NULL) {
+        metrics_counter(prarg, printer, "s3backer_localfs_blocks_read_total",
+          "Blocks read from the local file", localfs_io_stats.blocks_read);
+        metrics_counter(prarg, printer, "s3backer_localfs_blocks_written_total",
+          "Non-zero blocks written to the local file", localfs_io_stats.blocks_written);
+        metrics_counter(prarg, printer, "s3backer_localfs_zero_blocks_written_total",
+          "Zero blocks written to the local file", localfs_io_stats.zero_blocks_written);
+        metrics_counter(prarg, printer, "s3backer_localfs_bounce_copies_total",
+          "Direct I/O transfers that required an aligned bounce buffer", localfs_io_stats.bounce_copies);
+        metrics_counter(prarg, printer, "s3backer_localfs_flushes_total",
+          "Local file data syncs", localfs_io_stats.flushes);
+    }
+    if (block_cache_store != NULL) {
+        metrics_gauge(prarg, printer, "s3backer_block_cache_blocks",
+          "Blocks currently in the block cache", (double)block_cache_stats.current_size);
+        metrics_gauge(prarg, printer, "s3backer_block_cache_dirty_ratio",
+          "Fraction of the block cache that is dirty", block_cache_stats.dirty_ratio);
+        metrics_counter(prarg, printer, "s3backer_block_cache_read_hits_total",
+          "Block cache read hits", block_cache_stats.read_hits);
+        metrics_counter(prarg, printer, "s3backer_block_cache_read_misses_total",
+          "Block cache read misses", block_cache_stats.read_misses);
+        metrics_counter(prarg, printer, "s3backer_block_cache_write_hits_total",
+          "Block cache write hits", block_cache_stats.write_hits);
+        metrics_counter(prarg, printer, "s3backer_block_cache_write_misses_total",
+          "Block cache write misses", block_cache_stats.write_misses);
+        metrics_counter(prarg, printer, "s3backer_block_cache_verified_total",
+          "Cache file blocks verified at startup", block_cache_stats.verified);
+        metrics_counter(prarg, printer, "s3backer_block_cache_mismatch_total",
+          "Cache file blocks found stale at startup", block_cache_stats.mismatch);
+        metrics_counter(prarg, printer, "s3backer_block_cache_read_ahead_hits_total",
+          "Read-ahead blocks that were ready in time", block_cache_stats.read_ahead_hits);
+        metrics_counter(prarg, printer, "s3backer_block_cache_read_ahead_late_total",
+          "Read-ahead blocks that were still being read", block_cache_stats.read_ahead_late);
+        metrics_counter(prarg, printer, "s3backer_block_cache_read_ahead_wasted_total",
+          "Read-ahead blocks evicted before being used", block_cache_stats.read_ahead_wasted);
+        metrics_counter(prarg, printer, "s3backer_block_cache_evictions_total",
+          "Clean blocks evicted to make room", block_cache_stats.evictions);
+        metrics_counter(prarg, printer, "s3backer_block_cache_coalesced_writes_total",
+          "Writebacks of multiple adjacent blocks at once", block_cache_stats.coalesced_writes);
+        metrics_counter(prarg, printer, "s3backer_block_cache_coalesced_blocks_total",
+          "Blocks written back as part of a coalesced writeback", block_cache_stats.coalesced_blocks);
+        metrics_counter(prarg, printer, "s3backer_block_cache_flush_writebacks_total",
+          "Blocks written back because a thread was waiting to flush them", block_cache_stats.flush_writebacks);
+        metrics_counter(prarg, printer, "s3backer_block_cache_priority_writebacks_total",
+          "Priority blocks written back in the background", block_cache_stats.priority_writebacks);
+        metrics_counter(prarg, printer, "s3backer_block_cache_partial_writes_total",
+          "Write misses that didn't read the block first", block_cache_stats.partial_writes);
+        metrics_counter(prarg, printer, "s3backer_block_cache_partial_fills_total",
+          "Partially written blocks whose missing sectors were read later", block_cache_stats.partial_fills);
+        metrics_counter(prarg, printer, "s3backer_block_cache_partial_skips_total",
+          "Partially written blocks filled in entirely by writes", block_cache_stats.partial_skips);
+        metrics_gauge(prarg, printer, "s3backer_block_cache_compressed_blocks",
+          "Evicted blocks currently stored compressed", (double)block_cache_stats.ctier_blocks);
+        metrics_gauge(prarg, printer, "s3backer_block_cache_compressed_bytes",
+          "Memory used by compressed blocks", (double)block_cache_stats.ctier_bytes);
+        metrics_gauge(prarg, printer, "s3backer_block_cache_compressed_data_bytes",
+          "Uncompressed size of compressed blocks", (double)block_cache_stats.ctier_data_bytes);
+        metrics_counter(prarg, printer, "s3backer_block_cache_compressed_hits_total",
+          "Read misses satisfied by decompressing a block", block_cache_stats.ctier_hits);
+        metrics_counter(prarg, printer, "s3backer_block_cache_compressed_stores_total",
+          "Evicted blocks compressed and stored", block_cache_stats.ctier_stores);
+        metrics_counter(prarg, printer, "s3backer_block_cache_compressed_rejects_total",
+          "Evicted blocks that didn't compress well enough to store", block_cache_stats.ctier_rejects);
+        metrics_counter(prarg, printer, "s3backer_block_cache_compressed_evictions_total",
+          "Compressed blocks discarded to make room", block_cache_stats.ctier_evictions);
+        metrics_counter(prarg, printer, "s3backer_block_cache_encoded_stores_total",
+          "Blocks stored in the cache file in encoded form", block_cache_stats.encoded_stores);
+        metrics_counter(prarg, printer, "s3backer_block_cache_encoded_decodes_total",
+          "Cache file reads that required decoding a block", block_cache_stats.encoded_decodes);
+        metrics_counter(prarg, printer, "s3backer_block_cache_range_reads_total",
+          "Read misses served by reading only part of the block", block_cache_stats.range_reads);
+        metrics_counter(prarg, printer, "s3backer_block_cache_range_fetches_total",
+          "Blocks read in full in the background after a range read", block_cache_stats.range_fetches);
+        metrics_counter(prarg, printer, "s3backer_block_cache_prefetches_total",
+          "Blocks prefetched in the background", block_cache_stats.prefetches);
+        metrics_counter(prarg, printer, "s3backer_block_cache_ghost_hits_total",
+          "Read misses on recently evicted blocks (2Q only)", block_cache_stats.ghost_hits);
+        metrics_histogram(prarg, printer, "s3backer_block_cache_miss_read_seconds",
+          "Latency of underlying reads on a block cache miss", &block_cache_stats.miss_reads);
+        metrics_histogram(prarg, printer, "s3backer_block_cache_writeback_seconds",
+          "Latency of dirty block writebacks", &block_cache_stats.writebacks);
+        if (config.block_cache.cache_file != NULL) {
+            metrics_histogram(prarg, printer, "s3backer_block_cache_file_read_seconds",
+              "Latency of cache file reads", &block_cache_stats.dcache_reads);
+            metrics_histogram(prarg, printer, "s3backer_block_cache_file_write_seconds",
+              "Latency of cache file writes", &block_cache_stats.dcache_writes);
+        }
+        total_oom += block_cache_stats.out_of_memory_errors;
+    }
+    if (zero_cache_store != NULL) {
+        metrics_gauge(prarg, printer, "s3backer_zero_cache_blocks",
+          "Blocks known to be zero", (double)zero_cache_stats.current_cache_size);
+        metrics_gauge(prarg, printer, "s3backer_zero_cache_memory_bytes",
+          "Memory used by the zero block cache", (double)zero_cache_stats.bitmap_memory);
+        metrics_counter(prarg, printer, "s3backer_zero_cache_read_hits_total",
+          "Reads of known zero blocks", zero_cache_stats.read_hits);
+        metrics_counter(prarg, printer, "s3backer_zero_cache_write_hits_total",
+          "Redundant writes of zero blocks", zero_cache_stats.write_hits);
+    }
+    if (dedup_store != NULL) {
+        metrics_gauge(prarg, printer, "s3backer_dedup_shared_blocks",
+          "Blocks stored in another block's slot", (double)dedup_stats.shared_blocks);
+        metrics_counter(prarg, printer, "s3backer_dedup_writes_total",
+          "Writes satisfied by referencing existing content", dedup_stats.dedup_writes);
+        metrics_counter(prarg, printer, "s3backer_dedup_unchanged_writes_total",
+          "Writes of content identical to the block's current content", dedup_stats.unchanged_writes);
+        metrics_counter(prarg, printer, "s3backer_dedup_relocated_writes_total",
+          "Writes redirected to a free slot to preserve shared content", dedup_stats.relocated_writes);
+        metrics_counter(prarg, printer, "s3backer_dedup_index_blocks_written_total",
+          "Dedup index blocks written", dedup_stats.index_blocks_written);
+        total_oom += dedup_stats.out_of_memory_errors;
+    }
+    if (ec_protect_store != NULL) {
+        metrics_gauge(prarg, printer, "s3backer_md5_cache_blocks",
+          "Blocks currently in the MD5 cache", (double)ec_protect_stats.current_cache_size);
+        metrics_counter(prarg, printer, "s3backer_md5_cache_data_hits_total",
+          "Reads satisfied from the MD5 cache", ec_protect_stats.cache_data_hits);
+        metrics_histogram(prarg, printer, "s3backer_md5_cache_delay_seconds",
+          "Write delays due to a full MD5 cache or repeated writes", &ec_protect_stats.write_delays);
+        total_oom += ec_protect_stats.out_of_memory_errors;
+    }
+    metrics_gauge(prarg, printer, "s3backer_block_buf_total",
+      "Pooled block buffers allocated", (double)block_buf_stats.num_total);
+    metrics_gauge(prarg, printer, "s3backer_block_buf_idle",
+      "Idle pooled block buffers", (double)block_buf_idle);
+    metrics_counter(prarg, printer, "s3backer_block_buf_misses_total",
+      "Block buffer allocations requiring a new buffer", block_buf_stats.misses);
+    metrics_counter(prarg, printer, "s3backer_out_of_memory_errors_total",
+      "Out of memory errors", total_oom);
 }
 
 static void
@@ -988,10 +1611,18 @@ s3b_config_clear_stats(void)
     if (http_io_store != NULL)
         http_io_clear_stats(http_io_store);
 
+    // Clear local filesystem stats
+    if (localfs_io_store != NULL)
+        localfs_io_clear_stats(localfs_io_store);
+
     // Clear EC protection stats
     if (ec_protect_store != NULL)
         ec_protect_clear_stats(ec_protect_store);
 
+    // Clear dedup stats
+    if (dedup_store != NULL)
+        dedup_clear_stats(dedup_store);
+
     // Clear zero block cache stats
     if (zero_cache_store != NULL)
         zero_cache_clear_stats(zero_cache_store);
@@ -999,6 +1630,9 @@ s3b_config_clear_stats(void)
     // Clear block cache stats
     if (block_cache_store != NULL)
         block_cache_clear_stats(block_cache_store);
+
+    // Clear block buffer pool stats
+    block_buf_clear_stats();
 }
 
 static void
@@ -1153,6 +1787,8 @@ validate_config(int parse_only)
     off_t auto_file_size;
     u_int auto_block_size;
     off_t big_num_blocks;
+    s3b_block_t dedup_index_size = 0;
+    int file_size_from_stat = 0;
     uintmax_t value;
     const char *s;
     char blockSizeBuf[64];
@@ -1182,6 +1818,35 @@ validate_config(int parse_only)
           S3BACKER_DEFAULT_FILE_MODE_READ_ONLY : S3BACKER_DEFAULT_FILE_MODE;
     }
 
+    // Select backend
+    if (config.backend != NULL) {
+        if (strcmp(config.backend, "test") == 0)
+            config.test = 1;
+        else if (strcmp(config.backend, "localfs") == 0) {
+            if (config.test) {
+                warnx("flags `--test' and `--backend=localfs' are mutually exclusive");
+                return -1;
+            }
+            config.localfs = 1;
+        } else if (strcmp(config.backend, "s3") == 0) {
+            if (config.test) {
+                warnx("flags `--test' and `--backend=s3' are mutually exclusive");
+                return -1;
+            }
+        } else {
+            warnx("invalid backend `%s'", config.backend);
+            return -1;
+        }
+    }
+    if (config.use_dedup && config.dedup.table_size == 0) {
+        warnx("invalid zero value for `--dedupTableSize'");
+        return -1;
+    }
+    if (!config.localfs && (config.localfs_io.direct_io || config.localfs_io.preallocate)) {
+        warnx("the `--localfsDirectIO' and `--localfsPreallocate' flags require `--backend=localfs'");
+        return -1;
+    }
+
     // If no accessId specified, default to first in accessFile
     if (config.http_io.accessId == NULL && config.accessFile != NULL)
         search_access_for(config.accessFile, NULL, &config.http_io.accessId, NULL);
@@ -1189,7 +1854,7 @@ validate_config(int parse_only)
         config.http_io.accessId = NULL;
 
     // If no accessId, only read operations will succeed
-    if (!config.test && config.http_io.accessId == NULL
+    if (!config.test && !config.localfs && config.http_io.accessId == NULL
       && !config.fuse_ops.read_only && !customBaseURL && config.http_io.ec2iam_role == NULL) {
         warnx("warning: no `accessId' specified; only read operations will succeed");
         warnx("you can eliminate this warning by providing the `--readOnly' flag");
@@ -1235,8 +1900,22 @@ validate_config(int parse_only)
         return -1;
     }
 
-    // Check bucket/testdir; extract prefix from bucket if slash is present
-    if (!config.test) {
+    // Check bucket/testdir/file; extract prefix from bucket if slash is present
+    if (config.localfs) {
+        if (config.bucket == NULL) {
+            warnx("no local file specified");
+            return -1;
+        }
+        if (!config.nbd && !config.foreground && *config.bucket != '/') {
+            warnx("%s: absolute pathname required for local file unless `-f' flag is used", config.bucket);
+            return -1;
+        }
+        if (stat(config.bucket, &sb) == 0 && S_ISDIR(sb.st_mode)) {
+            errno = EISDIR;
+            warn("%s", config.bucket);
+            return -1;
+        }
+    } else if (!config.test) {
         if (config.bucket == NULL) {
             warnx("no S3 bucket specified");
             return -1;
@@ -1490,6 +2169,28 @@ validate_config(int parse_only)
         config.http_io.compress_level = level;
     }
 
+    // Parse compressed block cache tier size and compression algorithm, if any
+    if (config.block_cache_compressed_size_str != NULL) {
+        if (parse_size_string(config.block_cache_compressed_size_str,
+          "compressed block cache size", sizeof(size_t), &value) == -1)
+            return -1;
+        config.block_cache.compressed_size = value;
+    }
+    if (config.block_cache.compressed_size != 0) {
+        const char *const name = config.block_cache_compressed_alg != NULL ?
+          config.block_cache_compressed_alg : S3BACKER_DEFAULT_BLOCK_CACHE_COMPRESSION;
+        const struct comp_alg *calg;
+
+        if ((calg = comp_find(name)) == NULL) {
+            warnx("unknown compression algorithm `%s'", name);
+            return -1;
+        }
+        if ((config.block_cache.compressed_level = (*calg->lparse)(S3BACKER_BLOCK_CACHE_COMPRESSION_LEVEL)) == NULL)
+            return -1;
+        config.block_cache.compressed_alg = calg;
+    } else if (config.block_cache_compressed_alg != NULL)
+        warnx("flag `%s' has no effect without `%s'", "--blockCacheCompressedAlg", "--blockCacheCompressedSize");
+
     // Disable md5 cache when in read only mode
     if (config.fuse_ops.read_only) {
         config.ec_protect.cache_size = 0;
@@ -1548,12 +2249,23 @@ validate_config(int parse_only)
             return -1;
         }
     }
+    if (config.max_total_speed_str != NULL) {
+        if (parse_size_string(config.max_total_speed_str, "max total speed", sizeof(uintmax_t), &value) == -1)
+            return -1;
+        config.http_io.max_total_speed = value;
+    }
 
     // Check block cache config
     if (config.block_cache.cache_size > 0 && config.block_cache.num_threads <= 0) {
         warnx("invalid block cache thread pool size %u", config.block_cache.num_threads);
         return -1;
     }
+    if (config.block_cache.read_ahead > 0 && config.block_cache.read_ahead_streams < 1) {
+        warnx("invalid readAheadStreams %u", config.block_cache.read_ahead_streams);
+        return -1;
+    }
+    if (config.block_cache.read_ahead_max < config.block_cache.read_ahead)
+        config.block_cache.read_ahead_max = config.block_cache.read_ahead;
     if (config.block_cache.write_delay > 0 && config.block_cache.synchronous) {
         warnx("`--blockCacheSync' requires setting `--blockCacheWriteDelay=0'");
         return -1;
@@ -1572,6 +2284,102 @@ validate_config(int parse_only)
         warnx("`--blockCacheRecoverDirtyBlocks' requires specifying `--blockCacheFile'");
         return -1;
     }
+    if (config.block_cache_prefetch && config.block_cache.hot_file == NULL) {
+        char *hot_file;
+
+        if (config.block_cache.cache_file == NULL) {
+            warnx("`--blockCachePrefetch' requires `--blockCacheFile' or `--blockCacheHotFile'");
+            return -1;
+        }
+        if (asprintf(&hot_file, "%s%s", config.block_cache.cache_file, S3BACKER_BLOCK_CACHE_HOT_SUFFIX) == -1)
+            err(1, "asprintf");
+        config.block_cache.hot_file = hot_file;
+    }
+    if (config.block_cache.hot_file != NULL && config.block_cache.prefetch_threads == 0) {
+        warnx("`--blockCachePrefetchThreads' must be at least one");
+        return -1;
+    }
+    if (config.block_cache.use_io_uring) {
+#if !(HAVE_LIBURING_H && HAVE_LIBURING)
+        warnx("`--blockCacheFileUring' is not supported (s3backer was built without liburing)");
+        return -1;
+#endif
+        if (config.block_cache.use_mmap) {
+            warnx("`--blockCacheFileUring' is incompatible with `--blockCacheFileMmap'");
+            return -1;
+        }
+    }
+    if (!find_string_in_table(test_io_latency_dists, config.test_io.latency_dist)) {
+        warnx("illegal test mode latency distribution `%s'", config.test_io.latency_dist);
+        return -1;
+    }
+    if (!find_string_in_table(block_cache_evictions, config.block_cache.eviction)) {
+        warnx("illegal block cache eviction policy `%s'", config.block_cache.eviction);
+        return -1;
+    }
+    if (config.block_cache.num_shards < 1) {
+        warnx("invalid block cache shard count %u", config.block_cache.num_shards);
+        return -1;
+    }
+    if (config.block_cache.cache_size > 0 && config.block_cache.num_shards > 1) {
+        if (config.block_cache.cache_file != NULL) {
+            warnx("`--blockCacheShards' is incompatible with `--blockCacheFile'");
+            return -1;
+        }
+        if (config.block_cache.hot_file != NULL) {
+            warnx("`--blockCacheShards' is incompatible with `--blockCacheHotFile' and `--blockCachePrefetch'");
+            return -1;
+        }
+        if (config.block_cache.num_shards > config.block_cache.cache_size) {
+            warnx("`--blockCacheShards' must not exceed the block cache size");
+            return -1;
+        }
+        if (config.block_cache.num_shards > config.block_cache.num_threads) {
+            warnx("`--blockCacheShards' must not exceed `--blockCacheThreads'");
+            return -1;
+        }
+        if (config.block_cache.priority_threads != 0 && config.block_cache.num_shards > config.block_cache.priority_threads) {
+            warnx("`--blockCacheShards' must not exceed `--blockCachePriorityThreads'");
+            return -1;
+        }
+        if (config.block_cache.background_threads != 0
+          && config.block_cache.num_shards > config.block_cache.background_threads) {
+            warnx("`--blockCacheShards' must not exceed `--blockCacheBackgroundThreads'");
+            return -1;
+        }
+    }
+    if (config.block_cache.write_coalesce < 1 || config.block_cache.write_coalesce > BLOCK_CACHE_MAX_WRITE_COALESCE) {
+        warnx("`--blockCacheWriteCoalesce' must be between 1 and %u", BLOCK_CACHE_MAX_WRITE_COALESCE);
+        return -1;
+    }
+    if (config.block_cache.compressed_size != 0 && config.block_cache.cache_file != NULL) {
+        warnx("`--blockCacheCompressedSize' is incompatible with `--blockCacheFile'");
+        return -1;
+    }
+    if (config.block_cache.partial_writes && config.block_cache.cache_file != NULL) {
+        warnx("`--blockCachePartialWrites' is incompatible with `--blockCacheFile'");
+        return -1;
+    }
+    if (config.block_cache.store_encoded && config.block_cache.cache_file == NULL) {
+        warnx("`--blockCacheFileEncoded' requires `--blockCacheFile'");
+        return -1;
+    }
+    if (config.block_cache.range_read_fetch && config.block_cache.range_read_max == 0) {
+        warnx("`--blockCacheRangeReadFetch' requires `--blockCacheRangeReadMax'");
+        return -1;
+    }
+    if (config.block_cache.range_read_max != 0 && config.compress_alg != NULL)
+        warnx("`--blockCacheRangeReadMax' has no effect when blocks are compressed or encrypted");
+    if (config.block_cache.priority_threads > config.block_cache.num_threads) {
+        warnx("`--blockCachePriorityThreads' must not be greater than `--blockCacheThreads'");
+        return -1;
+    }
+    if (config.block_cache.background_threads > config.block_cache.num_threads) {
+        warnx("`--blockCacheBackgroundThreads' must not be greater than `--blockCacheThreads'");
+        return -1;
+    }
+    if (config.block_cache.priority_threads != 0 && config.block_cache.priority_blocks == 0)
+        warnx("`--blockCachePriorityThreads' has no effect without `--blockCachePriorityBlocks'");
     if (config.block_cache.num_protected > config.block_cache.cache_size)
         warnx("`--blockCacheNumProtected' is larger than cache size; this may cause performance problems");
 
@@ -1596,6 +2404,26 @@ validate_config(int parse_only)
         warnx("invalid listBlocksThreads %u", config.http_io.list_blocks_threads);
         return -1;
     }
+    if (config.zero_cache.checkpoint_file != NULL && !config.list_blocks) {
+        warnx("`--listBlocksCheckpoint' requires specifying `--listBlocks'");
+        return -1;
+    }
+
+    // Check multi-block I/O threads
+    if (config.http_io.io_threads < 1) {
+        warnx("invalid ioThreads %u", config.http_io.io_threads);
+        return -1;
+    }
+
+    // Check hedged read parameters
+    if (config.http_io.hedge_percentile >= 100) {
+        warnx("invalid hedgePercentile %u", config.http_io.hedge_percentile);
+        return -1;
+    }
+    if (config.http_io.hedge_budget < 1 || config.http_io.hedge_budget > 100) {
+        warnx("invalid hedgeBudget %u", config.http_io.hedge_budget);
+        return -1;
+    }
 
     // Configure logging module
     log_enable_debug = config.debug;
@@ -1603,6 +2431,8 @@ validate_config(int parse_only)
     // Format descriptive string of what we're mounting
     if (config.test)
         snvprintf(config.description, sizeof(config.description), "%s%s/%s", "file://", config.bucket, config.prefix);
+    else if (config.localfs)
+        snvprintf(config.description, sizeof(config.description), "%s%s", "file://", config.bucket);
     else if (config.http_io.vhost)
         snvprintf(config.description, sizeof(config.description), "%s%s", config.http_io.baseURL, config.prefix);
     else
@@ -1616,8 +2446,12 @@ validate_config(int parse_only)
      * Read the first block (if any) to determine existing file and block size,
      * and compare with configured sizes (if given).
      */
-    if (config.test)
+    if (config.test || config.localfs)
         config.no_auto_detect = 1;
+    if (config.localfs && config.file_size == 0 && stat(config.bucket, &sb) == 0 && S_ISREG(sb.st_mode)) {
+        config.file_size = sb.st_size;
+        file_size_from_stat = 1;
+    }
     if (config.no_auto_detect)
         r = ENOENT;
     else {
@@ -1717,18 +2551,44 @@ validate_config(int parse_only)
     }
     config.num_blocks = (s3b_block_t)big_num_blocks;
 
+    // Reserve space for the deduplication index after the data blocks
+    if (config.use_dedup) {
+        if (file_size_from_stat) {                      // the local file already includes the index
+            config.num_blocks = dedup_data_blocks(config.block_size, config.num_blocks);
+            config.file_size = (off_t)config.num_blocks * config.block_size;
+        }
+        dedup_index_size = dedup_index_blocks(config.block_size, config.num_blocks);
+        if (config.num_blocks + (off_t)dedup_index_size >= ((off_t)1 << (sizeof(config.num_blocks) * 8))) {
+            warnx("more than 2^%d blocks including dedup index: decrease file size or increase block size",
+              (int)(sizeof(config.num_blocks) * 8));
+            return -1;
+        }
+    }
+
     // Allocate zero block
     if (init_zero_block(config.block_size) == -1) {
         warn("init_zero_block");
         return -1;
     }
 
+    // Initialize block buffer pool; buffers must be big enough for a compressed and encrypted block
+    if ((r = block_buf_init(comp_bound(config.block_size) + 2 * EVP_MAX_IV_LENGTH, config.buffer_pool_size)) != 0) {
+        warnx("block_buf_init: %s", strerror(r));
+        return -1;
+    }
+
     // Check block size vs. encryption block size
     if (config.http_io.encryption != NULL && config.block_size % EVP_MAX_IV_LENGTH != 0) {
         warnx("block size must be at least %u when encryption is enabled", EVP_MAX_IV_LENGTH);
         return -1;
     }
 
+    // Check block size vs. O_DIRECT alignment
+    if (config.localfs_io.direct_io && config.block_size % LOCALFS_IO_DIRECT_ALIGN != 0) {
+        warnx("block size must be at least %u with `--localfsDirectIO'", LOCALFS_IO_DIRECT_ALIGN);
+        return -1;
+    }
+
     // Check that MD5 cache won't eventually deadlock
     if (config.ec_protect.cache_size > 0
       && config.ec_protect.cache_time == 0
@@ -1790,22 +2650,65 @@ validate_config(int parse_only)
     config.http_io.debug = config.debug;
     config.http_io.quiet = config.quiet;
     config.http_io.block_size = config.block_size;
-    config.http_io.num_blocks = config.num_blocks;
+    config.http_io.num_blocks = config.num_blocks + dedup_index_size;
+    config.http_io.file_blocks = config.num_blocks;
     config.zero_cache.block_size = config.block_size;
     config.zero_cache.num_blocks = config.num_blocks;
     config.zero_cache.list_blocks = config.list_blocks;
+    config.zero_cache.bucket = config.bucket;
+    config.zero_cache.prefix = config.prefix;
+    config.zero_cache.blockHashPrefix = config.blockHashPrefix;
     config.ec_protect.block_size = config.block_size;
+    config.ec_protect.io_threads = config.http_io.io_threads;
+    config.dedup.block_size = config.block_size;
+    config.dedup.num_blocks = config.num_blocks;
+    config.dedup.io_threads = config.http_io.io_threads;
     config.fuse_ops.block_size = config.block_size;
     config.fuse_ops.num_blocks = config.num_blocks;
     config.test_io.debug = config.debug;
     config.test_io.block_size = config.block_size;
-    config.test_io.num_blocks = config.num_blocks;
+    config.test_io.num_blocks = config.num_blocks + dedup_index_size;
     config.test_io.prefix = config.prefix;
     config.test_io.bucket = config.bucket;
     config.test_io.blockHashPrefix = config.blockHashPrefix;
+    config.localfs_io.debug = config.debug;
+    config.localfs_io.block_size = config.block_size;
+    config.localfs_io.num_blocks = config.num_blocks + dedup_index_size;
+    config.localfs_io.path = config.bucket;
+    config.localfs_io.read_only = config.fuse_ops.read_only;
+
+    /*
+     * Refuse to use a deduplicated disk without `--dedup', because blocks stored in another block's slot would
+     * silently read back the wrong data. Its dedup header block is in the slot just past the data blocks; for
+     * a local file whose size we got from stat(2), the file includes the index, so look where it would be.
+     */
+    if (!config.use_dedup && !config.test && !config.erase && !config.reset && !config.force
+      && (!config.localfs || file_size_from_stat)) {
+        s3b_block_t probe_block = config.num_blocks;
+
+        if (config.localfs) {
+            probe_block = dedup_data_blocks(config.block_size, config.num_blocks);
+            if ((s3b = localfs_io_create(&config.localfs_io)) == NULL)
+                err(1, "localfs_io_create");
+        } else {
+            config.http_io.num_blocks = config.num_blocks + 1;
+            if ((s3b = http_io_create(&config.http_io)) == NULL)
+                err(1, "http_io_create");
+        }
+        r = dedup_probe(s3b, config.block_size, probe_block);
+        (*s3b->shutdown)(s3b);
+        (*s3b->destroy)(s3b);
+        config.http_io.num_blocks = config.num_blocks;
+        if (r == EEXIST)
+            errx(1, "error: %s was created with `--dedup' and must always be used with it", config.description);
+        if (r != 0) {
+            errno = r;
+            err(1, "error checking for a dedup index");
+        }
+    }
 
     // Check whether already mounted, and if so, compare mount token against on-disk cache (if any)
-    if (!config.test && !config.erase && !config.reset) {
+    if (!config.test && !config.localfs && !config.erase && !config.reset) {
         int32_t mount_token;
         int conflict;
 
@@ -1894,7 +2797,10 @@ dump_config(const struct s3b_config *const c)
     int i;
 
     (*c->log)(LOG_DEBUG, "s3backer config:");
+    (*c->log)(LOG_DEBUG, "%24s: %s", "backend", c->test ? "test" : c->localfs ? "localfs" : "s3");
     (*c->log)(LOG_DEBUG, "%24s: %s", "test mode", c->test ? "true" : "false");
+    if (c->test && c->test_io.latency > 0)
+        (*c->log)(LOG_DEBUG, "%24s: %ums (%s)", "test latency", c->test_io.latency, c->test_io.latency_dist);
     (*c->log)(LOG_DEBUG, "%24s: %s", "directIO", c->fuse_ops.direct_io ? "true" : "false");
     (*c->log)(LOG_DEBUG, "%24s: \"%s\"", "accessId", c->http_io.accessId != NULL ? c->http_io.accessId : "");
     (*c->log)(LOG_DEBUG, "%24s: \"%s\"", "accessKey", c->http_io.accessKey != NULL ? "****" : "");
@@ -1904,16 +2810,31 @@ dump_config(const struct s3b_config *const c)
     (*c->log)(LOG_DEBUG, "%24s: %s", "authVersion", c->http_io.authVersion);
     (*c->log)(LOG_DEBUG, "%24s: \"%s\"", "baseURL", c->http_io.baseURL);
     (*c->log)(LOG_DEBUG, "%24s: \"%s\"", "region", c->http_io.region);
-    (*c->log)(LOG_DEBUG, "%24s: \"%s\"", c->test ? "testdir" : "bucket", c->bucket);
+    (*c->log)(LOG_DEBUG, "%24s: \"%s\"", c->test ? "testdir" : c->localfs ? "file" : "bucket", c->bucket);
+    if (c->localfs) {
+        (*c->log)(LOG_DEBUG, "%24s: %s", "localfsDirectIO", c->localfs_io.direct_io ? "true" : "false");
+        (*c->log)(LOG_DEBUG, "%24s: %s", "localfsPreallocate", c->localfs_io.preallocate ? "true" : "false");
+    }
     (*c->log)(LOG_DEBUG, "%24s: \"%s\"", "prefix", c->prefix);
     (*c->log)(LOG_DEBUG, "%24s: %s", "blockHashPrefix", c->blockHashPrefix ? "true" : "false");
+    (*c->log)(LOG_DEBUG, "%24s: %u", "buffer_pool_size", c->buffer_pool_size);
     (*c->log)(LOG_DEBUG, "%24s: \"%s\"", "defaultContentEncoding",
       c->http_io.default_ce != NULL ? c->http_io.default_ce : "(none)");
     (*c->log)(LOG_DEBUG, "%24s: %s", "list_blocks", c->list_blocks ? "true" : "false");
     (*c->log)(LOG_DEBUG, "%24s: %d", "list_blocks_threads", c->http_io.list_blocks_threads);
+    (*c->log)(LOG_DEBUG, "%24s: \"%s\"", "list_blocks_checkpoint",
+      c->zero_cache.checkpoint_file != NULL ? c->zero_cache.checkpoint_file : "");
+    (*c->log)(LOG_DEBUG, "%24s: %u", "io_threads", c->http_io.io_threads);
+    (*c->log)(LOG_DEBUG, "%24s: %u", "event_threads", c->http_io.event_threads);
+    (*c->log)(LOG_DEBUG, "%24s: %u", "transform_threads", c->http_io.transform_threads);
+    (*c->log)(LOG_DEBUG, "%24s: %u", "prewarm_connections", c->http_io.prewarm_connections);
+    (*c->log)(LOG_DEBUG, "%24s: %u", "hedge_percentile", c->http_io.hedge_percentile);
+    (*c->log)(LOG_DEBUG, "%24s: %u%%", "hedge_budget", c->http_io.hedge_budget);
     (*c->log)(LOG_DEBUG, "%24s: \"%s\"", "mount", c->mount);
     (*c->log)(LOG_DEBUG, "%24s: \"%s\"", "filename", c->fuse_ops.filename);
     (*c->log)(LOG_DEBUG, "%24s: \"%s\"", "stats_filename", c->fuse_ops.stats_filename);
+    (*c->log)(LOG_DEBUG, "%24s: \"%s\"", "metrics_socket",
+      c->fuse_ops.metrics_socket != NULL ? c->fuse_ops.metrics_socket : "");
     (*c->log)(LOG_DEBUG, "%24s: %s (%u)", "block_size", c->block_size_str != NULL ? c->block_size_str : "-", c->block_size);
     (*c->log)(LOG_DEBUG, "%24s: %s (%jd)", "file_size", c->file_size_str != NULL ? c->file_size_str : "-", (intmax_t)c->file_size);
     (*c->log)(LOG_DEBUG, "%24s: %jd", "num_blocks", (intmax_t)c->num_blocks);
@@ -1929,7 +2850,11 @@ dump_config(const struct s3b_config *const c)
     (*c->log)(LOG_DEBUG, "%24s: %s bps (%ju)", "max_download",
       c->max_speed_str[HTTP_DOWNLOAD] != NULL ? c->max_speed_str[HTTP_DOWNLOAD] : "-",
       c->http_io.max_speed[HTTP_DOWNLOAD]);
+    (*c->log)(LOG_DEBUG, "%24s: %s bps (%ju)", "max_total_speed",
+      c->max_total_speed_str != NULL ? c->max_total_speed_str : "-", c->http_io.max_total_speed);
+    (*c->log)(LOG_DEBUG, "%24s: %u/sec", "max_request_rate", c->http_io.max_request_rate);
     (*c->log)(LOG_DEBUG, "%24s: %s", "http_11", c->http_io.http_11 ? "true" : "false");
+    (*c->log)(LOG_DEBUG, "%24s: %s", "unsigned_payload", c->http_io.unsigned_payload ? "true" : "false");
     (*c->log)(LOG_DEBUG, "%24s: %us", "timeout", c->http_io.timeout);
     (*c->log)(LOG_DEBUG, "%24s: \"%s\"", "sse", c->http_io.sse);
     (*c->log)(LOG_DEBUG, "%24s: \"%s\"", "sse-key-id", c->http_io.sse_key_id);
@@ -1938,19 +2863,44 @@ dump_config(const struct s3b_config *const c)
     (*c->log)(LOG_DEBUG, "%24s: %ums", "min_write_delay", c->ec_protect.min_write_delay);
     (*c->log)(LOG_DEBUG, "%24s: %ums", "md5_cache_time", c->ec_protect.cache_time);
     (*c->log)(LOG_DEBUG, "%24s: %u entries", "md5_cache_size", c->ec_protect.cache_size);
+    (*c->log)(LOG_DEBUG, "%24s: %s", "dedup", c->use_dedup ? "true" : "false");
+    (*c->log)(LOG_DEBUG, "%24s: %u entries", "dedup_table_size", c->dedup.table_size);
     (*c->log)(LOG_DEBUG, "%24s: %u entries", "block_cache_size", c->block_cache.cache_size);
     (*c->log)(LOG_DEBUG, "%24s: %u threads", "block_cache_threads", c->block_cache.num_threads);
+    (*c->log)(LOG_DEBUG, "%24s: %u", "block_cache_shards", c->block_cache.num_shards);
+    (*c->log)(LOG_DEBUG, "%24s: \"%s\"", "block_cache_eviction", c->block_cache.eviction);
     (*c->log)(LOG_DEBUG, "%24s: %ums", "block_cache_timeout", c->block_cache.timeout);
     (*c->log)(LOG_DEBUG, "%24s: %ums", "block_cache_write_delay", c->block_cache.write_delay);
     (*c->log)(LOG_DEBUG, "%24s: %u blocks", "block_cache_max_dirty", c->block_cache.max_dirty);
+    (*c->log)(LOG_DEBUG, "%24s: %u blocks", "block_cache_write_coalesce", c->block_cache.write_coalesce);
+    (*c->log)(LOG_DEBUG, "%24s: %u blocks", "block_cache_priority_blocks", c->block_cache.priority_blocks);
+    (*c->log)(LOG_DEBUG, "%24s: %u threads", "block_cache_priority_threads", c->block_cache.priority_threads);
+    (*c->log)(LOG_DEBUG, "%24s: %u threads", "block_cache_background_threads", c->block_cache.background_threads);
+    (*c->log)(LOG_DEBUG, "%24s: %s", "block_cache_partial_writes", c->block_cache.partial_writes ? "true" : "false");
+    (*c->log)(LOG_DEBUG, "%24s: %s (%ju)", "block_cache_compressed",
+      c->block_cache_compressed_size_str != NULL ? c->block_cache_compressed_size_str : "-",
+      (uintmax_t)c->block_cache.compressed_size);
+    (*c->log)(LOG_DEBUG, "%24s: %s", "block_cache_compressed_alg",
+      c->block_cache.compressed_alg != NULL ? c->block_cache.compressed_alg->name : "-");
+    (*c->log)(LOG_DEBUG, "%24s: %u bytes", "block_cache_range_read_max", c->block_cache.range_read_max);
+    (*c->log)(LOG_DEBUG, "%24s: %s", "block_cache_range_fetch", c->block_cache.range_read_fetch ? "true" : "false");
     (*c->log)(LOG_DEBUG, "%24s: %s", "block_cache_sync", c->block_cache.synchronous ? "true" : "false");
     (*c->log)(LOG_DEBUG, "%24s: %s", "recover_dirty_blocks", c->block_cache.recover_dirty_blocks ? "true" : "false");
     (*c->log)(LOG_DEBUG, "%24s: %u blocks", "read_ahead", c->block_cache.read_ahead);
     (*c->log)(LOG_DEBUG, "%24s: %u blocks", "read_ahead_trigger", c->block_cache.read_ahead_trigger);
+    (*c->log)(LOG_DEBUG, "%24s: %u blocks", "read_ahead_max", c->block_cache.read_ahead_max);
+    (*c->log)(LOG_DEBUG, "%24s: %u", "read_ahead_streams", c->block_cache.read_ahead_streams);
     (*c->log)(LOG_DEBUG, "%24s: \"%s\"", "block_cache_cache_file",
       c->block_cache.cache_file != NULL ? c->block_cache.cache_file : "");
+    (*c->log)(LOG_DEBUG, "%24s: \"%s\"", "block_cache_hot_file",
+      c->block_cache.hot_file != NULL ? c->block_cache.hot_file : "");
+    (*c->log)(LOG_DEBUG, "%24s: %u", "block_cache_prefetch_threads", c->block_cache.prefetch_threads);
     (*c->log)(LOG_DEBUG, "%24s: %s", "block_cache_no_verify", c->block_cache.no_verify ? "true" : "false");
     (*c->log)(LOG_DEBUG, "%24s: %s", "fadvise", c->block_cache.fadvise ? "true" : "false");
+    (*c->log)(LOG_DEBUG, "%24s: %s", "block_cache_index", c->block_cache.use_index ? "true" : "false");
+    (*c->log)(LOG_DEBUG, "%24s: %s", "block_cache_encoded", c->block_cache.store_encoded ? "true" : "false");
+    (*c->log)(LOG_DEBUG, "%24s: %s", "block_cache_mmap", c->block_cache.use_mmap ? "true" : "false");
+    (*c->log)(LOG_DEBUG, "%24s: %s", "block_cache_io_uring", c->block_cache.use_io_uring ? "true" : "false");
     if (!c->nbd) {
         (*c->log)(LOG_DEBUG, "fuse_main arguments:");
         for (i = 0; i < c->fuse_args.argc; i++)
@@ -1967,6 +2917,7 @@ usage(void)
     fprintf(stderr, "\ts3backer [options] bucket[/subdir] /mount/point\n");
     fprintf(stderr, "\ts3backer --nbd [options] bucket[/subdir] /dev/nbdX\n");
     fprintf(stderr, "\ts3backer --test [options] directory /mount/point\n");
+    fprintf(stderr, "\ts3backer --backend=localfs [options] file /mount/point\n");
     fprintf(stderr, "\ts3backer --erase [options] bucket[/subdir]\n");
     fprintf(stderr, "\ts3backer --reset-mounted-flag [options] bucket[/subdir]\n");
     fprintf(stderr, "Options:\n");
@@ -1986,52 +2937,91 @@ usage(void)
     fprintf(stderr, "\n");
     fprintf(stderr, "\t--%-27s %s\n", "accessEC2IAM=ROLE", "Acquire S3 credentials from EC2 machine via IAM role");
     fprintf(stderr, "\t--%-27s %s\n", "baseURL=URL", "Base URL for all requests");
+    fprintf(stderr, "\t--%-27s %s\n", "backend=TYPE", "Data store backend: `s3' (default), `test', or `localfs'");
+    fprintf(stderr, "\t--%-27s %s\n", "blockCacheEviction=TYPE", "Block cache eviction policy; one of:");
+    fprintf(stderr, "\t  %-27s ", "");
+    for (sptr = block_cache_evictions; *sptr != NULL; sptr++)
+        fprintf(stderr, "%s%s", sptr != block_cache_evictions ? ", " : "  ", *sptr);
+    fprintf(stderr, "\n");
+    fprintf(stderr, "\t--%-27s %s\n", "blockCacheBackgroundThreads=NUM", "Max threads writing back non-priority blocks");
+    fprintf(stderr, "\t--%-27s %s\n", "blockCacheCompressedAlg=ALG", "Compression algorithm for compressed block cache");
+    fprintf(stderr, "\t--%-27s %s\n", "blockCacheCompressedSize=SIZE", "Memory for compressed copies of evicted blocks");
     fprintf(stderr, "\t--%-27s %s\n", "blockCacheFile=FILE", "Block cache persistent file");
+    fprintf(stderr, "\t--%-27s %s\n", "blockCacheHotFile=FILE", "Save hot block list here and prefetch it on startup");
     fprintf(stderr, "\t--%-27s %s\n", "blockCacheMaxDirty=NUM", "Block cache maximum number of dirty blocks");
     fprintf(stderr, "\t--%-27s %s\n", "blockCacheNoVerify", "Disable verification of data loaded from cache file");
+    fprintf(stderr, "\t--%-27s %s\n", "blockCachePartialWrites", "Don't read blocks before writing part of them");
+    fprintf(stderr, "\t--%-27s %s\n", "blockCachePrefetch", "Same as `--blockCacheHotFile' with cache file + \"" S3BACKER_BLOCK_CACHE_HOT_SUFFIX "\"");
+    fprintf(stderr, "\t--%-27s %s\n", "blockCachePrefetchThreads=NUM", "Max threads prefetching blocks in background");
+    fprintf(stderr, "\t--%-27s %s\n", "blockCachePriorityBlocks=NUM", "Give the first NUM blocks priority writeback");
+    fprintf(stderr, "\t--%-27s %s\n", "blockCachePriorityThreads=NUM", "Max threads writing back priority blocks");
     fprintf(stderr, "\t--%-27s %s\n", "blockCacheFileAdvise", "Use posix_fadvise(2) after reading from cache file");
+    fprintf(stderr, "\t--%-27s %s\n", "blockCacheFileEncoded", "Keep blocks compressed/encrypted in cache file");
+    fprintf(stderr, "\t--%-27s %s\n", "blockCacheFileIndex", "Write cache file index on shutdown for fast restart");
+    fprintf(stderr, "\t--%-27s %s\n", "blockCacheFileMmap", "Access cache file via mmap(2)");
+    fprintf(stderr, "\t--%-27s %s\n", "blockCacheFileUring", "Access cache file via io_uring(7)");
+    fprintf(stderr, "\t--%-27s %s\n", "blockCacheRangeReadFetch", "Read whole block in background after range read");
+    fprintf(stderr, "\t--%-27s %s\n", "blockCacheRangeReadMax=NUM", "Max bytes to read from uncached block via range read");
+    fprintf(stderr, "\t--%-27s %s\n", "blockCacheShards=NUM", "Number of independently locked block cache shards");
     fprintf(stderr, "\t--%-27s %s\n", "blockCacheSize=NUM", "Block cache size (in number of blocks)");
     fprintf(stderr, "\t--%-27s %s\n", "blockCacheSync", "Block cache performs all writes synchronously");
     fprintf(stderr, "\t--%-27s %s\n", "blockCacheRecoverDirtyBlocks", "Recover dirty cache file blocks on startup");
     fprintf(stderr, "\t--%-27s %s\n", "blockCacheThreads=NUM", "Block cache write-back thread pool size");
     fprintf(stderr, "\t--%-27s %s\n", "blockCacheTimeout=MILLIS", "Block cache entry timeout (zero = infinite)");
+    fprintf(stderr, "\t--%-27s %s\n", "blockCacheWriteCoalesce=NUM", "Max adjacent dirty blocks to write back together");
     fprintf(stderr, "\t--%-27s %s\n", "blockCacheWriteDelay=MILLIS", "Block cache maximum write-back delay");
     fprintf(stderr, "\t--%-27s %s\n", "blockCacheNumProtected=NUM", "Preferentially retain NUM blocks in the block cache");
     fprintf(stderr, "\t--%-27s %s\n", "blockSize=SIZE", "Block size (with optional suffix 'K', 'M', 'G', etc.)");
     fprintf(stderr, "\t--%-27s %s\n", "blockHashPrefix", "Prepend hash to block names for even distribution");
+    fprintf(stderr, "\t--%-27s %s\n", "bufferPoolSize=NUM", "Keep up to NUM idle block buffers for reuse");
     fprintf(stderr, "\t--%-27s %s\n", "cacert=FILE", "Specify SSL certificate authority file");
     fprintf(stderr, "\t--%-27s %s\n", "compress[=LEVEL]", "Enable block compression, with 1=fast up to 9=small");
     fprintf(stderr, "\t--%-27s %s\n", "configFile=FILE", "Substitute command line flags and arguments read from FILE");
     fprintf(stderr, "\t--%-27s %s\n", "debug", "Enable logging of debug messages");
     fprintf(stderr, "\t--%-27s %s\n", "debug-http", "Print HTTP headers to standard output");
+    fprintf(stderr, "\t--%-27s %s\n", "dedup", "Store identical blocks only once");
+    fprintf(stderr, "\t--%-27s %s\n", "dedupTableSize=NUM", "Remember the contents of this many blocks for dedup");
     fprintf(stderr, "\t--%-27s %s\n", "directIO", "Disable kernel caching of the backed file");
     fprintf(stderr, "\t--%-27s %s\n", "encrypt[=CIPHER]", "Enable encryption (implies `--compress')");
     fprintf(stderr, "\t--%-27s %s\n", "erase", "Erase all blocks in the filesystem");
+    fprintf(stderr, "\t--%-27s %s\n", "eventThreads=NUM", "Drive multi-block HTTP I/O from this many event loops");
     fprintf(stderr, "\t--%-27s %s\n", "fileMode=MODE", "Permissions of backed file in filesystem");
     fprintf(stderr, "\t--%-27s %s\n", "filename=NAME", "Name of backed file in filesystem");
     fprintf(stderr, "\t--%-27s %s\n", "force", "Ignore different auto-detected block and file sizes");
+    fprintf(stderr, "\t--%-27s %s\n", "hedgeBudget=PERCENT", "Max hedged block reads as a percentage of all reads");
+    fprintf(stderr, "\t--%-27s %s\n", "hedgePercentile=NUM", "Hedge block reads slower than this GET latency percentile");
     fprintf(stderr, "\t--%-27s %s\n", "help", "Show this information and exit");
     fprintf(stderr, "\t--%-27s %s\n", "http11", "Restrict to HTTP version 1.1");
     fprintf(stderr, "\t--%-27s %s\n", "initialRetryPause=MILLIS", "Initial retry pause after stale data or server error");
     fprintf(stderr, "\t--%-27s %s\n", "insecure", "Don't verify SSL server identity");
+    fprintf(stderr, "\t--%-27s %s\n", "ioThreads=NUM", "Max threads for each multi-block read or write");
     fprintf(stderr, "\t--%-27s %s\n", "keyLength", "Override generated cipher key length");
     fprintf(stderr, "\t--%-27s %s\n", "listBlocks", "Auto-detect non-empty blocks at startup");
+    fprintf(stderr, "\t--%-27s %s\n", "listBlocksCheckpoint=FILE", "Save and resume the block survey using FILE");
     fprintf(stderr, "\t--%-27s %s\n", "listBlocksThreads", "List blocks in parallel using this many threads");
+    fprintf(stderr, "\t--%-27s %s\n", "localfsDirectIO", "With the localfs backend, bypass the kernel page cache");
+    fprintf(stderr, "\t--%-27s %s\n", "localfsPreallocate", "With the localfs backend, preallocate the whole file");
     fprintf(stderr, "\t--%-27s %s\n", "maxDownloadSpeed=BITSPERSEC", "Max download bandwidth for a single read");
+    fprintf(stderr, "\t--%-27s %s\n", "maxRequestRate=NUM", "Max HTTP requests per second (per prefix range)");
     fprintf(stderr, "\t--%-27s %s\n", "maxRetryPause=MILLIS", "Max total pause after stale data or server error");
+    fprintf(stderr, "\t--%-27s %s\n", "maxTotalSpeed=BITSPERSEC", "Max total bandwidth for all transfers");
     fprintf(stderr, "\t--%-27s %s\n", "maxUploadSpeed=BITSPERSEC", "Max upload bandwidth for a single write");
     fprintf(stderr, "\t--%-27s %s\n", "md5CacheSize=NUM", "Max size of MD5 cache (zero = disabled)");
     fprintf(stderr, "\t--%-27s %s\n", "md5CacheTime=MILLIS", "Expire time for MD5 cache (zero = infinite)");
+    fprintf(stderr, "\t--%-27s %s\n", "metricsSocket=ADDR", "Serve Prometheus metrics on UNIX socket or [HOST:]PORT");
     fprintf(stderr, "\t--%-27s %s\n", "minWriteDelay=MILLIS", "Minimum time between same block writes");
     fprintf(stderr, "\t--%-27s %s\n", "nbd", "Run as an NBD server instead of a FUSE filesystem");
     fprintf(stderr, "\t--%-27s %s\n", "no-vhost", "Disable virtual hosted style requests");
     fprintf(stderr, "\t--%-27s %s\n", "password=PASSWORD", "Encrypt using PASSWORD");
     fprintf(stderr, "\t--%-27s %s\n", "passwordFile=FILE", "Encrypt using password read from FILE");
     fprintf(stderr, "\t--%-27s %s\n", "prefix=STRING", "Prefix for resource names within bucket");
+    fprintf(stderr, "\t--%-27s %s\n", "prewarmConnections=NUM", "Open this many server connections at startup");
     fprintf(stderr, "\t--%-27s %s\n", "defaultContentEncoding=STRING", "Default HTTP Content-Encoding if none given");
     fprintf(stderr, "\t--%-27s %s\n", "quiet", "Omit progress output at startup");
     fprintf(stderr, "\t--%-27s %s\n", "readAhead=NUM", "Number of blocks to read-ahead");
     fprintf(stderr, "\t--%-27s %s\n", "readAheadTrigger=NUM", "# of sequentially read blocks to trigger read-ahead");
+    fprintf(stderr, "\t--%-27s %s\n", "readAheadMax=NUM", "Max blocks of adaptive read-ahead per stream");
+    fprintf(stderr, "\t--%-27s %s\n", "readAheadStreams=NUM", "Max # of concurrent read-ahead streams");
     fprintf(stderr, "\t--%-27s %s\n", "readOnly", "Return `Read-only file system' error for write attempts");
     fprintf(stderr, "\t--%-27s %s\n", "region=region", "Specify AWS region");
     fprintf(stderr, "\t--%-27s %s\n", "reset-mounted-flag", "Reset `already mounted' flag in the filesystem");
@@ -2045,8 +3035,16 @@ usage(void)
     fprintf(stderr, "\t--%-27s %s\n", "test-delays", "In test mode, introduce random I/O delays");
     fprintf(stderr, "\t--%-27s %s\n", "test-discard", "In test mode, discard data and perform no I/O operations");
     fprintf(stderr, "\t--%-27s %s\n", "test-errors", "In test mode, introduce random I/O errors");
+    fprintf(stderr, "\t--%-27s %s\n", "test-latency=MILLIS", "In test mode, add this much mean latency to each I/O");
+    fprintf(stderr, "\t--%-27s %s\n", "test-latency-dist=TYPE", "In test mode, distribution of added latency; one of:");
+    fprintf(stderr, "\t  %-27s ", "");
+    for (sptr = test_io_latency_dists; *sptr != NULL; sptr++)
+        fprintf(stderr, "%s%s", sptr != test_io_latency_dists ? ", " : "  ", *sptr);
+    fprintf(stderr, "\n");
     fprintf(stderr, "\t--%-27s %s\n", "timeout=SECONDS", "Max time allowed for one HTTP operation");
     fprintf(stderr, "\t--%-27s %s\n", "timeout=SECONDS", "Specify HTTP operation timeout");
+    fprintf(stderr, "\t--%-27s %s\n", "transformThreads=NUM", "Encode/decode blocks for event loops using this many threads");
+    fprintf(stderr, "\t--%-27s %s\n", "unsignedPayload", "Don't sign block content hashes (AWS auth version 4)");
     fprintf(stderr, "\t--%-27s %s\n", "version", "Show version information and exit");
     fprintf(stderr, "\t--%-27s %s\n", "vhost", "Use virtual host bucket style URL for all requests");
     fprintf(stderr, "Default values:\n");
@@ -2055,13 +3053,22 @@ usage(void)
     fprintf(stderr, "\t--%-27s \"%s\"\n", "accessType", S3BACKER_DEFAULT_ACCESS_TYPE);
     fprintf(stderr, "\t--%-27s \"%s\"\n", "authVersion", S3BACKER_DEFAULT_AUTH_VERSION);
     fprintf(stderr, "\t--%-27s \"%s\"\n", "baseURL", "http://s3." S3_DOMAIN "/");
+    fprintf(stderr, "\t--%-27s \"%s\"\n", "blockCacheEviction", S3BACKER_DEFAULT_BLOCK_CACHE_EVICTION);
+    fprintf(stderr, "\t--%-27s %u\n", "blockCachePrefetchThreads", S3BACKER_DEFAULT_BLOCK_CACHE_PREFETCH_THREADS);
+    fprintf(stderr, "\t--%-27s %u\n", "blockCacheShards", S3BACKER_DEFAULT_BLOCK_CACHE_SHARDS);
     fprintf(stderr, "\t--%-27s %u\n", "blockCacheSize", S3BACKER_DEFAULT_BLOCK_CACHE_SIZE);
     fprintf(stderr, "\t--%-27s %u\n", "blockCacheThreads", S3BACKER_DEFAULT_BLOCK_CACHE_NUM_THREADS);
     fprintf(stderr, "\t--%-27s %u\n", "blockCacheTimeout", S3BACKER_DEFAULT_BLOCK_CACHE_TIMEOUT);
+    fprintf(stderr, "\t--%-27s %u\n", "blockCacheWriteCoalesce", S3BACKER_DEFAULT_BLOCK_CACHE_WRITE_COALESCE);
     fprintf(stderr, "\t--%-27s %u\n", "blockCacheWriteDelay", S3BACKER_DEFAULT_BLOCK_CACHE_WRITE_DELAY);
     fprintf(stderr, "\t--%-27s %d\n", "blockSize", S3BACKER_DEFAULT_BLOCKSIZE);
+    fprintf(stderr, "\t--%-27s %u\n", "bufferPoolSize", S3BACKER_DEFAULT_BUFFER_POOL_SIZE);
+    fprintf(stderr, "\t--%-27s %u\n", "dedupTableSize", S3BACKER_DEFAULT_DEDUP_TABLE_SIZE);
+    fprintf(stderr, "\t--%-27s %u\n", "eventThreads", S3BACKER_DEFAULT_EVENT_THREADS);
     fprintf(stderr, "\t--%-27s \"%s\"\n", "filename", S3BACKER_DEFAULT_FILENAME);
+    fprintf(stderr, "\t--%-27s %u\n", "hedgeBudget", S3BACKER_DEFAULT_HEDGE_BUDGET);
     fprintf(stderr, "\t--%-27s %u\n", "initialRetryPause", S3BACKER_DEFAULT_INITIAL_RETRY_PAUSE);
+    fprintf(stderr, "\t--%-27s %u\n", "ioThreads", S3BACKER_DEFAULT_IO_THREADS);
     fprintf(stderr, "\t--%-27s %u\n", "listBlocksThreads", S3BACKER_DEFAULT_LIST_BLOCKS_THREADS);
     fprintf(stderr, "\t--%-27s %u\n", "md5CacheSize", S3BACKER_DEFAULT_MD5_CACHE_SIZE);
     fprintf(stderr, "\t--%-27s %u\n", "md5CacheTime", S3BACKER_DEFAULT_MD5_CACHE_TIME);
@@ -2070,11 +3077,15 @@ usage(void)
     fprintf(stderr, "\t--%-27s %u\n", "maxRetryPause", S3BACKER_DEFAULT_MAX_RETRY_PAUSE);
     fprintf(stderr, "\t--%-27s %u\n", "minWriteDelay", S3BACKER_DEFAULT_MIN_WRITE_DELAY);
     fprintf(stderr, "\t--%-27s \"%s\"\n", "prefix", S3BACKER_DEFAULT_PREFIX);
+    fprintf(stderr, "\t--%-27s %u\n", "prewarmConnections", S3BACKER_DEFAULT_PREWARM_CONNECTIONS);
     fprintf(stderr, "\t--%-27s %u\n", "readAhead", S3BACKER_DEFAULT_READ_AHEAD);
     fprintf(stderr, "\t--%-27s %u\n", "readAheadTrigger", S3BACKER_DEFAULT_READ_AHEAD_TRIGGER);
+    fprintf(stderr, "\t--%-27s %u\n", "readAheadMax", S3BACKER_DEFAULT_READ_AHEAD_MAX);
+    fprintf(stderr, "\t--%-27s %u\n", "readAheadStreams", S3BACKER_DEFAULT_READ_AHEAD_STREAMS);
     fprintf(stderr, "\t--%-27s \"%s\"\n", "region", S3BACKER_DEFAULT_REGION);
     fprintf(stderr, "\t--%-27s \"%s\"\n", "statsFilename", S3BACKER_DEFAULT_STATS_FILENAME);
     fprintf(stderr, "\t--%-27s %u\n", "timeout", S3BACKER_DEFAULT_TIMEOUT);
+    fprintf(stderr, "\t--%-27s %u\n", "transformThreads", S3BACKER_DEFAULT_TRANSFORM_THREADS);
     fprintf(stderr, "FUSE options (partial list):\n");
     fprintf(stderr, "\t%-29s %s\n", "-o nonempty", "Allows mount over a non-empty directory");
     fprintf(stderr, "\t%-29s %s\n", "-o uid=UID", "Set user ID");
@@ -42,14 +42,17 @@ struct s3b_config {
     struct fuse_ops_conf        fuse_ops;
     struct zero_cache_conf      zero_cache;
     struct ec_protect_conf      ec_protect;
+    struct dedup_conf           dedup;
     struct http_io_conf         http_io;
     struct test_io_conf         test_io;
+    struct localfs_io_conf      localfs_io;
 
     // Common/global stuff
     const char                  *accessFile;
     const char                  *mount;
     char                        description[768];
     u_int                       block_size;
+    u_int                       buffer_pool_size;
     off_t                       file_size;
     s3b_block_t                 num_blocks;
     const char                  *bucket;
@@ -63,6 +66,9 @@ struct s3b_config {
     int                         quiet;
     int                         force;
     int                         test;
+    int                         localfs;
+    int                         use_dedup;
+    const char                  *backend;
     int                         ssl;
     int                         nbd;
     int                         no_auto_detect;
@@ -75,9 +81,13 @@ struct s3b_config {
     const char                  *block_size_str;
     const char                  *password_file;
     const char                  *max_speed_str[2];
+    const char                  *max_total_speed_str;
     const char                  *compress_alg;
     const char                  *compress_level;
     int                         compress_flag;
+    const char                  *block_cache_compressed_size_str;
+    const char                  *block_cache_compressed_alg;
+    int                         block_cache_prefetch;
     int                         encrypt;
 };
 
@@ -38,11 +38,16 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/mman.h>
 #if HAVE_SYS_STATVFS_H
 #include <sys/statvfs.h>
 #endif
 #include <sys/queue.h>
 #include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
 #if HAVE_DECL_PRCTL
 #include <sys/prctl.h>
 #endif
@@ -81,6 +86,9 @@
 #include <time.h>
 #include <unistd.h>
 #include <limits.h>
+#include <math.h>
+#include <netdb.h>
+#include <poll.h>
 #include <signal.h>
 
 #include <openssl/bio.h>
@@ -93,6 +101,19 @@
 #include <zlib.h>
 #include <fuse.h>
 
+#if HAVE_LIBURING_H && HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+// Vector instructions for zero block detection
+#if defined(__GNUC__) && defined(__x86_64__)
+#define ZEROS_X86               1
+#include <immintrin.h>
+#elif defined(__GNUC__) && defined(__aarch64__)
+#define ZEROS_NEON              1
+#include <arm_neon.h>
+#endif
+
 #ifdef __APPLE__
 extern char **environ;
 #endif
@@ -133,6 +154,41 @@ typedef void        log_func_t(int level, const char *fmt, ...) __attribute__ ((
 // Interactive non-zero block list callback function type. Returns zero for success, else positive errno to abort.
 typedef int         block_list_func_t(void *arg, const s3b_block_t *block_nums, u_int num_blocks);
 
+// Non-zero survey progress callback function type. Returns zero for success, else positive errno to abort.
+typedef int         block_range_func_t(void *arg, s3b_block_t min_block, s3b_block_t max_block);
+
+// A range of blocks from "min" (inclusive) to "max" (inclusive)
+struct block_range {
+    s3b_block_t     min;
+    s3b_block_t     max;
+};
+
+// Non-zero block survey parameters; see survey_non_zero()
+struct survey_params {
+    block_list_func_t           *callback;          // receives blocks that are, or could possibly be, non-zero
+    block_range_func_t          *progress;          // if not NULL, receives ranges of blocks whose survey is complete
+    void                        *arg;               // argument for "callback" and "progress"
+    const struct block_range    *skip;              // sorted, disjoint ranges of blocks that need not be surveyed
+    u_int                       num_skip;           // number of ranges in "skip"
+};
+
+// Number of latency histogram buckets; bucket boundaries grow by a factor of 2^(1/4) from 1ms up to ~49s
+#define LATENCY_BUCKETS     64
+
+// Latency histogram; see latency_record()
+struct latency_hist {
+    uint64_t        count;                          // number of occurrences
+    double          time;                           // total time taken in seconds
+    uint64_t        buckets[LATENCY_BUCKETS];       // bucket zero counts latencies under 1ms
+};
+
+// Header preceding the encoded data of a block returned by read_block_encoded()
+struct encoded_header {
+    uint32_t        length;                         // length of the encoded data that follows this header
+    char            encoding[32];                   // the block's Content-Encoding
+    u_char          hmac[SHA_DIGEST_LENGTH];        // the block's signature (if encrypted)
+} __attribute__ ((packed));
+
 // Block write cancel check function type
 typedef int         check_cancel_t(void *arg, s3b_block_t block_num);
 
@@ -153,6 +209,8 @@ struct s3backer_store {
      *      o block_read_part
      *      o block_write
      *      o block_write_part
+     *      o read_blocks
+     *      o write_blocks
      *
      * It should be invoked after the initial process fork() because it may create pthreads.
      *
@@ -225,6 +283,32 @@ struct s3backer_store {
      */
     int         (*read_block_part)(struct s3backer_store *s3b, s3b_block_t block_num, u_int off, u_int len, void *dest);
 
+    /*
+     * Read one block, leaving it in the form in which it is stored (i.e., still compressed and/or encrypted).
+     *
+     * The 'dest' buffer has room for one block. If the block is stored encoded, and the encoded data preceded
+     * by a struct encoded_header fits within one block, then that is what is returned and *encodedp is set to 1.
+     * Otherwise, the block is returned decoded as with read_block() and *encodedp is set to 0.
+     *
+     * Other parameters are as with read_block().
+     *
+     * This is an optional function; if not supported, this hook may be null.
+     *
+     * Returns zero on success or a (positive) errno value on error.
+     * May return ENOTCONN if create_threads() has not yet been invoked.
+     */
+    int         (*read_block_encoded)(struct s3backer_store *s3b, s3b_block_t block_num, void *dest, int *encodedp,
+                  u_char *actual_etag, const u_char *expect_etag, int strict);
+
+    /*
+     * Decode a block previously returned by read_block_encoded() with *encodedp set to 1.
+     *
+     * This is an optional function, but it must be supported if read_block_encoded() is.
+     *
+     * Returns zero on success or a (positive) errno value on error.
+     */
+    int         (*decode_block)(struct s3backer_store *s3b, s3b_block_t block_num, const void *src, void *dest);
+
     /*
      * Write one block.
      *
@@ -252,6 +336,39 @@ struct s3backer_store {
      */
     int         (*write_block_part)(struct s3backer_store *s3b, s3b_block_t block_num, u_int off, u_int len, const void *src);
 
+    /*
+     * Read a range of contiguous blocks. Never-written-to blocks will return all zeros.
+     *
+     * This is equivalent to invoking read_block() for each block in the range (with no ETags), except
+     * that implementations are free to perform the individual reads concurrently and in any order.
+     *
+     * This is an optional function; if not supported, this hook may be null.
+     *
+     * Returns zero on success or a (positive) errno value on error. On error, the contents of 'dest' are undefined.
+     * May return ENOTCONN if create_threads() has not yet been invoked.
+     */
+    int         (*read_blocks)(struct s3backer_store *s3b, s3b_block_t block_num, u_int num_blocks, void *dest);
+
+    /*
+     * Write a range of contiguous blocks.
+     *
+     * Passing src == NULL is equivalent to passing blocks containing all zeros.
+     *
+     * If etags != NULL, it must have room for num_blocks * MD5_DIGEST_LENGTH bytes; on success, the ETag of each
+     * block is stored there in order, as write_block() would report it.
+     *
+     * This is equivalent to invoking write_block() for each block in the range with the given check_cancel
+     * and check_cancel_arg (which may be NULL), except that implementations are free to perform the individual
+     * writes concurrently and in any order.
+     *
+     * This is an optional function; if not supported, this hook may be null.
+     *
+     * Returns zero on success or a (positive) errno value on error. On error, some blocks may have been written.
+     * May return ENOTCONN if create_threads() has not yet been invoked.
+     */
+    int         (*write_blocks)(struct s3backer_store *s3b, s3b_block_t block_num, u_int num_blocks, const void *src,
+                  u_char *etags, check_cancel_t *check_cancel, void *check_cancel_arg);
+
     /*
      * Bulk block zeroing (i.e., deletion).
      *
@@ -283,7 +400,12 @@ struct s3backer_store {
      * The callback must be invoked for all blocks which could possibly be non-zero. Note: the same block
      * may be reported more than once to "callback".
      *
-     * If "callback" ever returns a non-zero value, survey should be aborted and an error returned.
+     * If "progress" is not NULL, it may be invoked with a range of blocks to indicate that every block in that
+     * range which could possibly be non-zero has already been reported to "callback". Implementations that can't
+     * tell are not required to report any progress. Blocks in any of the "skip" ranges need not be surveyed
+     * (but may be anyway).
+     *
+     * If "callback" or "progress" ever returns a non-zero value, survey should be aborted and an error returned.
      *
      * It's possible for "shutdown" to be invoked before this method returns; if so, the survey should be aborted
      * and ECANCELED returned.
@@ -292,7 +414,34 @@ struct s3backer_store {
      *
      * Returns zero on success or a (positive) errno value on error.
      */
-    int         (*survey_non_zero)(struct s3backer_store *s3b, block_list_func_t *callback, void *arg);
+    int         (*survey_non_zero)(struct s3backer_store *s3b, const struct survey_params *params);
+
+    /*
+     * Determine whether the blocks starting at "block_num" are known to be zero.
+     *
+     * On success, *zerop is set to non-zero if block "block_num" is known for certain to read back as all zeros,
+     * or zero if its status is unknown (it might or might not be zero), and *num_blocksp is set to the number of
+     * consecutive blocks, starting with "block_num" and not exceeding "max_blocks", that share the same status.
+     *
+     * The result is only a snapshot; writes occurring concurrently may change it.
+     *
+     * This is an optional function; if not supported, this hook may be null.
+     *
+     * Returns zero on success or a (positive) errno value on error.
+     */
+    int         (*block_status)(struct s3backer_store *s3b, s3b_block_t block_num, s3b_block_t max_blocks,
+                  int *zerop, s3b_block_t *num_blocksp);
+
+    /*
+     * Hint that the specified blocks will be read soon, so they should be read into the cache in the background.
+     *
+     * This function does not wait for any reads to happen, and some or all of the blocks may be ignored.
+     *
+     * This is an optional function; if not supported, this hook may be null.
+     *
+     * Returns zero on success or a (positive) errno value on error.
+     */
+    int         (*prefetch_blocks)(struct s3backer_store *s3b, s3b_block_t block_num, u_int num_blocks);
 
     /*
      * Shutdown this instance. Sync any dirty data to the underlying data store (as required).
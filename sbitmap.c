@@ -0,0 +1,398 @@
+
+/*
+ * s3backer - FUSE-based single file backing store via Amazon S3
+ *
+ * Copyright 2008-2020 Archie L. Cobbs <archie.cobbs@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations including
+ * the two.
+ *
+ * You must obey the GNU General Public License in all respects for all
+ * of the code used other than OpenSSL. If you modify file(s) with this
+ * exception, you may extend this exception to your version of the
+ * file(s), but you are not obligated to do so. If you do not wish to do
+ * so, delete this exception statement from your version. If you delete
+ * this exception statement from all source files in the program, then
+ * also delete it here.
+ */
+
+#include "s3backer.h"
+#include "sbitmap.h"
+#include "util.h"
+
+/*
+ * Leaves are 32K bits (4K bytes) each. For the largest possible device (2^32 blocks) that's 128K leaves,
+ * so the top level array and summaries together cost about 2MB, versus 512MB for a flat bitmap.
+ */
+
+// Definitions
+#define LEAF_SHIFT          15
+#define LEAF_BITS           ((s3b_block_t)1 << LEAF_SHIFT)
+#define LEAF_MASK           (LEAF_BITS - 1)
+#define WORD_BITS           (sizeof(bitmap_t) * 8)
+#define LEAF_WORDS          (LEAF_BITS / WORD_BITS)
+
+// One leaf; if "bits" is NULL, the leaf is uniform: all clear if count is zero, otherwise all set
+struct sbitmap_leaf {
+    bitmap_t            *bits;
+    s3b_block_t         count;              // number of set bits in this leaf
+};
+
+// Sparse bitmap structure
+struct sbitmap {
+    s3b_block_t         num_bits;
+    size_t              num_leaves;
+    int                 safe_value;
+    s3b_block_t         count;              // total number of set bits
+    size_t              num_mixed;          // number of leaves with allocated storage
+    bitmap_t            *any_set;           // summary: 1 = leaf has at least one set bit
+    bitmap_t            *any_clear;         // summary: 1 = leaf has at least one clear bit
+    struct sbitmap_leaf leaves[0];
+};
+
+// Internal functions
+static s3b_block_t sbitmap_leaf_size(const struct sbitmap *bitmap, size_t index);
+static s3b_block_t sbitmap_leaf_find(const struct sbitmap *bitmap, size_t index, s3b_block_t offset, int value);
+static int sbitmap_leaf_split(struct sbitmap *bitmap, size_t index);
+static void sbitmap_leaf_fill(struct sbitmap *bitmap, size_t index, int value);
+static void sbitmap_leaf_normalize(struct sbitmap *bitmap, size_t index);
+static size_t sbitmap_scan(const bitmap_t *words, size_t num_bits, size_t start, int value);
+
+/*
+ * Create a new sparse bitmap with all bits initialized to "value".
+ *
+ * Returns NULL and sets errno on failure.
+ */
+struct sbitmap *
+sbitmap_create(s3b_block_t num_bits, int value, int safe_value)
+{
+    const size_t num_leaves = (num_bits >> LEAF_SHIFT) + ((num_bits & LEAF_MASK) != 0);
+    struct sbitmap *bitmap;
+    size_t i;
+    int r;
+
+    // Allocate structure
+    if ((bitmap = calloc(1, sizeof(*bitmap) + num_leaves * sizeof(*bitmap->leaves))) == NULL)
+        return NULL;
+    bitmap->num_bits = num_bits;
+    bitmap->num_leaves = num_leaves;
+    bitmap->safe_value = safe_value != 0;
+
+    // Allocate summaries
+    if ((bitmap->any_set = bitmap_init(num_leaves, value != 0)) == NULL)
+        goto fail;
+    if ((bitmap->any_clear = bitmap_init(num_leaves, value == 0)) == NULL)
+        goto fail;
+
+    // Initialize leaves (all uniform)
+    if (value) {
+        for (i = 0; i < num_leaves; i++)
+            bitmap->leaves[i].count = sbitmap_leaf_size(bitmap, i);
+        bitmap->count = num_bits;
+    }
+
+    // Done
+    return bitmap;
+
+fail:
+    r = errno;
+    bitmap_free(&bitmap->any_set);
+    free(bitmap);
+    errno = r;
+    return NULL;
+}
+
+void
+sbitmap_free(struct sbitmap **bitmapp)
+{
+    struct sbitmap *const bitmap = *bitmapp;
+    size_t i;
+
+    if (bitmap == NULL)
+        return;
+    for (i = 0; i < bitmap->num_leaves; i++)
+        free(bitmap->leaves[i].bits);
+    bitmap_free(&bitmap->any_set);
+    bitmap_free(&bitmap->any_clear);
+    free(bitmap);
+    *bitmapp = NULL;
+}
+
+int
+sbitmap_test(const struct sbitmap *bitmap, s3b_block_t bit)
+{
+    const struct sbitmap_leaf *const leaf = &bitmap->leaves[bit >> LEAF_SHIFT];
+
+    assert(bit < bitmap->num_bits);
+    if (leaf->bits == NULL)
+        return leaf->count != 0;
+    return bitmap_test(leaf->bits, bit & LEAF_MASK);
+}
+
+void
+sbitmap_set(struct sbitmap *bitmap, s3b_block_t bit, int value)
+{
+    const size_t index = bit >> LEAF_SHIFT;
+    struct sbitmap_leaf *const leaf = &bitmap->leaves[index];
+    const s3b_block_t offset = bit & LEAF_MASK;
+
+    // Sanity check
+    assert(bit < bitmap->num_bits);
+    value = value != 0;
+
+    // If leaf is uniform, we may need to split it
+    if (leaf->bits == NULL) {
+        if ((leaf->count != 0) == value)
+            return;
+        if (sbitmap_leaf_split(bitmap, index) != 0) {
+            if (value == bitmap->safe_value)
+                sbitmap_leaf_fill(bitmap, index, value);
+            return;
+        }
+    }
+
+    // Update bit
+    if (bitmap_test(leaf->bits, offset) == value)
+        return;
+    bitmap_set(leaf->bits, offset, value);
+    if (value) {
+        leaf->count++;
+        bitmap->count++;
+    } else {
+        leaf->count--;
+        bitmap->count--;
+    }
+    sbitmap_leaf_normalize(bitmap, index);
+}
+
+// Set "num_bits" consecutive bits starting at "bit"; leaves entirely within the range are filled without splitting
+void
+sbitmap_set_range(struct sbitmap *bitmap, s3b_block_t bit, s3b_block_t num_bits, int value)
+{
+    assert(bit <= bitmap->num_bits && num_bits <= bitmap->num_bits - bit);
+    while (num_bits > 0) {
+        const size_t index = bit >> LEAF_SHIFT;
+        const s3b_block_t offset = bit & LEAF_MASK;
+        const s3b_block_t size = sbitmap_leaf_size(bitmap, index);
+        const s3b_block_t chunk = size - offset < num_bits ? size - offset : num_bits;
+        s3b_block_t i;
+
+        if (chunk == size)
+            sbitmap_leaf_fill(bitmap, index, value != 0);
+        else {
+            for (i = 0; i < chunk; i++)
+                sbitmap_set(bitmap, bit + i, value);
+        }
+        bit += chunk;
+        num_bits -= chunk;
+    }
+}
+
+// Returns the total number of set bits
+s3b_block_t
+sbitmap_count(const struct sbitmap *bitmap)
+{
+    return bitmap->count;
+}
+
+// Returns the first bit at or after "bit" equal to "value", or bitmap->num_bits if there is none
+s3b_block_t
+sbitmap_find_next(const struct sbitmap *bitmap, s3b_block_t bit, int value)
+{
+    s3b_block_t offset;
+    size_t index;
+
+    // Sanity check
+    if (bit >= bitmap->num_bits)
+        return bitmap->num_bits;
+    value = value != 0;
+
+    // Check the remainder of the first leaf
+    index = bit >> LEAF_SHIFT;
+    if ((offset = sbitmap_leaf_find(bitmap, index, bit & LEAF_MASK, value)) != LEAF_BITS)
+        return bit - (bit & LEAF_MASK) + offset;
+
+    // Use the summary to skip directly to the next leaf containing a matching bit
+    index = sbitmap_scan(value ? bitmap->any_set : bitmap->any_clear, bitmap->num_leaves, index + 1, 1);
+    if (index == bitmap->num_leaves)
+        return bitmap->num_bits;
+    offset = sbitmap_leaf_find(bitmap, index, 0, value);
+    assert(offset != LEAF_BITS);
+    return ((s3b_block_t)index << LEAF_SHIFT) + offset;
+}
+
+// Returns the number of consecutive bits, starting at "bit" and not exceeding max_bits, equal to bit "bit"
+s3b_block_t
+sbitmap_run_length(const struct sbitmap *bitmap, s3b_block_t bit, s3b_block_t max_bits)
+{
+    const s3b_block_t end = sbitmap_find_next(bitmap, bit, !sbitmap_test(bitmap, bit));
+
+    return end - bit < max_bits ? end - bit : max_bits;
+}
+
+/*
+ * OR "src" into "dst", which must have the same number of bits.
+ *
+ * Returns the number of set bits in "dst" afterward.
+ */
+s3b_block_t
+sbitmap_or(struct sbitmap *dst, const struct sbitmap *src)
+{
+    size_t index;
+    size_t i;
+
+    assert(dst->num_bits == src->num_bits);
+    for (index = 0; index < dst->num_leaves; index++) {
+        const struct sbitmap_leaf *const sleaf = &src->leaves[index];
+        struct sbitmap_leaf *const dleaf = &dst->leaves[index];
+        s3b_block_t count;
+
+        // Handle the easy cases
+        if (sleaf->count == 0 || (dleaf->bits == NULL && dleaf->count != 0))
+            continue;
+        if (sleaf->bits == NULL) {
+            sbitmap_leaf_fill(dst, index, 1);
+            continue;
+        }
+
+        // Source leaf is mixed; ensure destination leaf has storage
+        if (dleaf->bits == NULL && sbitmap_leaf_split(dst, index) != 0) {
+            if (dst->safe_value)
+                sbitmap_leaf_fill(dst, index, 1);
+            continue;
+        }
+
+        // OR the words together
+        count = 0;
+        for (i = 0; i < LEAF_WORDS; i++)
+            count += popcount32(dleaf->bits[i] |= sleaf->bits[i]);
+        dst->count += count - dleaf->count;
+        dleaf->count = count;
+        sbitmap_leaf_normalize(dst, index);
+    }
+    return dst->count;
+}
+
+// Returns the approximate number of bytes of memory used
+size_t
+sbitmap_memory(const struct sbitmap *bitmap)
+{
+    return sizeof(*bitmap) + bitmap->num_leaves * sizeof(*bitmap->leaves)
+      + 2 * bitmap_size(bitmap->num_leaves) * sizeof(bitmap_t)
+      + bitmap->num_mixed * LEAF_WORDS * sizeof(bitmap_t);
+}
+
+// Returns the number of valid bits in the specified leaf (only the last leaf can be short)
+static s3b_block_t
+sbitmap_leaf_size(const struct sbitmap *bitmap, size_t index)
+{
+    if (index + 1 < bitmap->num_leaves || (bitmap->num_bits & LEAF_MASK) == 0)
+        return LEAF_BITS;
+    return bitmap->num_bits & LEAF_MASK;
+}
+
+// Returns the offset of the first bit at or after "offset" in the leaf equal to "value", or LEAF_BITS if none
+static s3b_block_t
+sbitmap_leaf_find(const struct sbitmap *bitmap, size_t index, s3b_block_t offset, int value)
+{
+    const struct sbitmap_leaf *const leaf = &bitmap->leaves[index];
+    const s3b_block_t size = sbitmap_leaf_size(bitmap, index);
+    size_t found;
+
+    if (leaf->bits == NULL)
+        return (leaf->count != 0) == value ? offset : LEAF_BITS;
+    found = sbitmap_scan(leaf->bits, size, offset, value);
+    return found < size ? (s3b_block_t)found : LEAF_BITS;
+}
+
+// Give a uniform leaf its own storage; returns errno value on failure
+static int
+sbitmap_leaf_split(struct sbitmap *bitmap, size_t index)
+{
+    struct sbitmap_leaf *const leaf = &bitmap->leaves[index];
+    const s3b_block_t size = sbitmap_leaf_size(bitmap, index);
+    bitmap_t *bits;
+
+    assert(leaf->bits == NULL);
+    if ((bits = calloc(LEAF_WORDS, sizeof(*bits))) == NULL)
+        return errno;
+    if (leaf->count != 0) {                                 // set only the valid bits so padding bits stay clear
+        memset(bits, 0xff, (size / WORD_BITS) * sizeof(*bits));
+        if (size % WORD_BITS != 0)
+            bits[size / WORD_BITS] = ((bitmap_t)1 << (size % WORD_BITS)) - 1;
+    }
+    leaf->bits = bits;
+    bitmap->num_mixed++;
+    return 0;
+}
+
+// Make a leaf uniform with all bits equal to "value"
+static void
+sbitmap_leaf_fill(struct sbitmap *bitmap, size_t index, int value)
+{
+    struct sbitmap_leaf *const leaf = &bitmap->leaves[index];
+    const s3b_block_t count = value ? sbitmap_leaf_size(bitmap, index) : 0;
+
+    if (leaf->bits != NULL) {
+        free(leaf->bits);
+        leaf->bits = NULL;
+        bitmap->num_mixed--;
+    }
+    bitmap->count += count - leaf->count;
+    leaf->count = count;
+    sbitmap_leaf_normalize(bitmap, index);
+}
+
+// Release storage for a leaf that has become uniform, and update the summaries
+static void
+sbitmap_leaf_normalize(struct sbitmap *bitmap, size_t index)
+{
+    struct sbitmap_leaf *const leaf = &bitmap->leaves[index];
+    const s3b_block_t size = sbitmap_leaf_size(bitmap, index);
+
+    if (leaf->bits != NULL && (leaf->count == 0 || leaf->count == size)) {
+        free(leaf->bits);
+        leaf->bits = NULL;
+        bitmap->num_mixed--;
+    }
+    bitmap_set(bitmap->any_set, index, leaf->count != 0);
+    bitmap_set(bitmap->any_clear, index, leaf->count != size);
+}
+
+// Returns the first bit at or after "start" in a flat bitmap equal to "value", or num_bits if there is none
+static size_t
+sbitmap_scan(const bitmap_t *words, size_t num_bits, size_t start, int value)
+{
+    size_t index;
+    bitmap_t word;
+
+    for (index = start / WORD_BITS; index * WORD_BITS < num_bits; index++) {
+        word = value ? words[index] : ~words[index];
+        if (index == start / WORD_BITS)
+            word &= ~(bitmap_t)0 << (start % WORD_BITS);
+        if (word != 0) {
+            const size_t found = index * WORD_BITS + ffs((int)word) - 1;
+
+            return found < num_bits ? found : num_bits;
+        }
+    }
+    return num_bits;
+}
@@ -0,0 +1,66 @@
+
+/*
+ * s3backer - FUSE-based single file backing store via Amazon S3
+ *
+ * Copyright 2008-2020 Archie L. Cobbs <archie.cobbs@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of portions of this program with the
+ * OpenSSL library under certain conditions as described in each
+ * individual source file, and distribute linked combinations including
+ * the two.
+ *
+ * You must obey the GNU General Public License in all respects for all
+ * of the code used other than OpenSSL. If you modify file(s) with this
+ * exception, you may extend this exception to your version of the
+ * file(s), but you are not obligated to do so. If you do not wish to do
+ * so, delete this exception statement from your version. If you delete
+ * this exception statement from all source files in the program, then
+ * also delete it here.
+ */
+
+/*
+ * Sparse two-level bitmap.
+ *
+ * The bits are divided into fixed size leaves. A leaf whose bits are all the same takes no memory beyond its
+ * slot in the top level array; only "mixed" leaves allocate storage. Two summary bitmaps, with one bit per leaf,
+ * record which leaves contain any set bits and which contain any clear bits, so searches can skip uniform
+ * stretches without visiting them.
+ *
+ * Splitting a uniform leaf requires allocating memory. If that fails, the change is resolved in favor of the
+ * bitmap's "safe" value (given at creation time): either the entire leaf is set to the safe value (when the safe
+ * value is the one being written), or the change is dropped (leaving the bit at the safe value). So callers should
+ * choose as the safe value whichever bit value is the conservative answer.
+ *
+ * No locking is done; callers must provide their own.
+ */
+
+// Declarations
+struct sbitmap;
+
+// sbitmap.c
+extern struct sbitmap *sbitmap_create(s3b_block_t num_bits, int value, int safe_value);
+extern void sbitmap_free(struct sbitmap **bitmapp);
+extern int sbitmap_test(const struct sbitmap *bitmap, s3b_block_t bit);
+extern void sbitmap_set(struct sbitmap *bitmap, s3b_block_t bit, int value);
+extern void sbitmap_set_range(struct sbitmap *bitmap, s3b_block_t bit, s3b_block_t num_bits, int value);
+extern s3b_block_t sbitmap_count(const struct sbitmap *bitmap);
+extern s3b_block_t sbitmap_find_next(const struct sbitmap *bitmap, s3b_block_t bit, int value);
+extern s3b_block_t sbitmap_run_length(const struct sbitmap *bitmap, s3b_block_t bit, s3b_block_t max_bits);
+extern s3b_block_t sbitmap_or(struct sbitmap *dst, const struct sbitmap *src);
+extern size_t sbitmap_memory(const struct sbitmap *bitmap);
@@ -42,6 +42,12 @@
 // Do we want random errors?
 #define RANDOM_ERROR_PERCENT    0
 
+// Pareto shape parameter for injected latency; values close to one give a heavier tail
+#define PARETO_ALPHA            1.5
+
+// Cap on injected latency, as a multiple of the mean
+#define MAX_LATENCY_FACTOR      100
+
 // Internal state
 struct test_io_private {
     struct test_io_conf         *config;
@@ -60,10 +66,13 @@ static int test_io_read_block(struct s3backer_store *s3b, s3b_block_t block_num,
 static int test_io_write_block(struct s3backer_store *s3b, s3b_block_t block_num, const void *src, u_char *etag,
   check_cancel_t *check_cancel, void *check_cancel_arg);
 static int test_io_flush_blocks(struct s3backer_store *s3b, const s3b_block_t *block_nums, u_int num_blocks, long timeout);
-static int test_io_survey_non_zero(struct s3backer_store *s3b, block_list_func_t *callback, void *arg);
+static int test_io_survey_non_zero(struct s3backer_store *s3b, const struct survey_params *params);
 static int test_io_shutdown(struct s3backer_store *s3b);
 static void test_io_destroy(struct s3backer_store *s3b);
 
+// Internal functions
+static void test_io_delay(struct test_io_conf *config);
+
 /*
  * Constructor
  *
@@ -109,7 +118,7 @@ test_io_create(struct test_io_conf *config)
         goto fail4;
 
     // Random initialization
-    if (config->random_delays || config->random_errors)
+    if (config->random_delays || config->random_errors || config->latency > 0)
         srandom((u_int)time(NULL));
 
     // Done
@@ -232,8 +241,7 @@ test_io_read_block(struct s3backer_store *const s3b, s3b_block_t block_num, void
         (*config->log)(LOG_DEBUG, "test_io: read %0*jx started", S3B_BLOCK_NUM_DIGITS, (uintmax_t)block_num);
 
     // Random delay
-    if (config->random_delays)
-        usleep((random() % 200) * 1000);
+    test_io_delay(config);
 
     // Detect overlapping reads and/or writes
     pthread_mutex_lock(&priv->mutex);
@@ -406,8 +414,7 @@ test_io_write_block(struct s3backer_store *const s3b, s3b_block_t block_num, con
     }
 
     // Random delay
-    if (config->random_delays)
-        usleep((random() % 200) * 1000);
+    test_io_delay(config);
 
     // Detect overlapping reads and/or writes
     pthread_mutex_lock(&priv->mutex);
@@ -497,7 +504,7 @@ done:
 }
 
 static int
-test_io_survey_non_zero(struct s3backer_store *s3b, block_list_func_t *callback, void *arg)
+test_io_survey_non_zero(struct s3backer_store *s3b, const struct survey_params *params)
 {
     struct test_io_private *const priv = s3b->data;
     struct test_io_conf *const config = priv->config;
@@ -520,7 +527,7 @@ test_io_survey_non_zero(struct s3backer_store *s3b, block_list_func_t *callback,
     for (i = 0; (dent = readdir(dir)) != NULL; i++) {
         if (http_io_parse_block(config->prefix, config->num_blocks,
           config->blockHashPrefix, dent->d_name, &hash_value, &block_num) == 0) {
-            if ((r = (*callback)(arg, &block_num, 1)) != 0)
+            if ((r = (*params->callback)(params->arg, &block_num, 1)) != 0)
                 break;
         }
         if (priv->shutdown) {
@@ -535,3 +542,36 @@ test_io_survey_non_zero(struct s3backer_store *s3b, block_list_func_t *callback,
     // Done
     return r;
 }
+
+/*
+ * Sleep for a random delay, if configured.
+ *
+ * With --test-latency, the delay is drawn from the configured distribution having the configured mean.
+ */
+static void
+test_io_delay(struct test_io_conf *config)
+{
+    const double mean = config->latency;
+    double millis;
+    double u;
+
+    // Old-style random delays
+    if (config->random_delays)
+        usleep((random() % 200) * 1000);
+
+    // Injected latency
+    if (config->latency == 0)
+        return;
+    u = ((double)random() + 1.0) / ((double)RAND_MAX + 2.0);            // uniform in (0, 1)
+    if (strcmp(config->latency_dist, TEST_IO_LATENCY_UNIFORM) == 0)
+        millis = 2.0 * mean * u;
+    else if (strcmp(config->latency_dist, TEST_IO_LATENCY_EXPONENTIAL) == 0)
+        millis = -mean * log(u);
+    else if (strcmp(config->latency_dist, TEST_IO_LATENCY_PARETO) == 0)
+        millis = mean * (PARETO_ALPHA - 1.0) / PARETO_ALPHA * pow(u, -1.0 / PARETO_ALPHA);
+    else
+        millis = mean;
+    if (millis > mean * MAX_LATENCY_FACTOR)
+        millis = mean * MAX_LATENCY_FACTOR;
+    usleep((useconds_t)(millis * 1000.0));
+}
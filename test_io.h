@@ -34,6 +34,12 @@
  * also delete it here.
  */
 
+// Injected latency distributions
+#define TEST_IO_LATENCY_FIXED           "fixed"
+#define TEST_IO_LATENCY_UNIFORM         "uniform"
+#define TEST_IO_LATENCY_EXPONENTIAL     "exponential"
+#define TEST_IO_LATENCY_PARETO          "pareto"
+
 // Configuration info structure for test_io store
 struct test_io_conf {
     u_int               block_size;
@@ -44,6 +50,8 @@ struct test_io_conf {
     int                 blockHashPrefix;
     int                 random_errors;
     int                 random_delays;
+    u_int               latency;                // mean injected latency in milliseconds, or zero for none
+    const char          *latency_dist;          // distribution of injected latency
     int                 discard_data;
     int                 debug;
 };
@@ -38,15 +38,57 @@
 #include "block_cache.h"
 #include "zero_cache.h"
 #include "ec_protect.h"
+#include "dedup.h"
 #include "fuse_ops.h"
 #include "http_io.h"
 #include "test_io.h"
+#include "localfs_io.h"
 #include "s3b_config.h"
 #include "util.h"
 
 // Definitions
 #define MAX_CHILD_PROCESSES     10
 
+// Block buffer pool
+#define BLOCK_BUF_ALIGN         64                      // alignment of returned buffers (one cache line)
+#define BLOCK_BUF_THREAD_CACHE  2                       // max idle buffers cached by each thread
+#define BLOCK_BUF_MAGIC         0x7b0f5a21              // header tag for pooled buffers
+#define BLOCK_BUF_MAGIC_ONEOFF  0x7b0f5a22              // header tag for oversize buffers not from the pool
+
+// State shared by the threads performing one parallel_read_blocks() or parallel_write_blocks() operation
+struct parallel_io {
+    struct s3backer_store   *s3b;
+    u_int                   block_size;
+    s3b_block_t             block_num;          // first block in range
+    u_int                   num_blocks;         // number of blocks in range
+    char                    *dest;              // destination buffer (reads)
+    const char              *src;               // source buffer, or NULL for zeros (writes)
+    u_char                  *etags;             // where to store block ETags, or NULL (writes)
+    check_cancel_t          *check_cancel;      // write check-for-cancel callback, or NULL (writes)
+    void                    *check_cancel_arg;  // write check-for-cancel callback argument (writes)
+    int                     write;              // this is a write operation
+    int                     locking;            // multiple threads are involved, so 'mutex' must be used
+    pthread_mutex_t         mutex;              // protects 'next' and 'error'
+    u_int                   next;               // index of next block to be claimed
+    int                     error;              // first error encountered, if any
+};
+
+// Header preceding each buffer returned by block_buf_alloc(), padded out to BLOCK_BUF_ALIGN bytes
+struct block_buf_hdr {
+    uint32_t                magic;
+    struct block_buf_hdr    *next;                      // next idle buffer in the shared pool
+};
+#define BLOCK_BUF_HDR_SIZE      ((sizeof(struct block_buf_hdr) + BLOCK_BUF_ALIGN - 1) & ~(size_t)(BLOCK_BUF_ALIGN - 1))
+
+// Per-thread cache of idle buffers; only the owning thread touches bufs[], so no locking is needed
+struct block_buf_cache {
+    TAILQ_ENTRY(block_buf_cache) link;                  // entry in block_buf_caches
+    struct block_buf_hdr    *bufs[BLOCK_BUF_THREAD_CACHE];
+    u_int                   num_bufs;
+    uintmax_t               hits;
+};
+TAILQ_HEAD(block_buf_cache_list, block_buf_cache);
+
 // Size suffixes
 struct size_suffix {
     const char  *suffix;
@@ -95,6 +137,20 @@ int daemonized;
 const void *zero_block;
 static size_t zero_block_size;
 
+// Zero detection kernels; each scans a cache line at a time and bails out at the first non-zero one
+typedef int zeros_func_t(const void *data, size_t len);
+static zeros_func_t mem_is_zeros_generic;
+#if ZEROS_X86
+static zeros_func_t mem_is_zeros_sse2;
+static zeros_func_t mem_is_zeros_avx2 __attribute__ ((__target__ ("avx2")));
+static zeros_func_t *zeros_func = mem_is_zeros_sse2;        // SSE2 is always available on x86_64
+#elif ZEROS_NEON
+static zeros_func_t mem_is_zeros_neon;
+static zeros_func_t *zeros_func = mem_is_zeros_neon;        // NEON is always available on aarch64
+#else
+static zeros_func_t *zeros_func = mem_is_zeros_generic;
+#endif
+
 // stderr logging mutex
 static pthread_mutex_t stderr_log_mutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -102,8 +158,25 @@ static pthread_mutex_t stderr_log_mutex = PTHREAD_MUTEX_INITIALIZER;
 static struct child_proc child_procs[MAX_CHILD_PROCESSES];
 static int num_child_procs;
 
+// Block buffer pool state (all protected by block_buf_mutex, except block_buf_size which is set once up front)
+static pthread_mutex_t block_buf_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t block_buf_key;
+static size_t block_buf_size;
+static u_int block_buf_max_idle;
+static struct block_buf_hdr *block_buf_idle;
+static struct block_buf_cache_list block_buf_caches = TAILQ_HEAD_INITIALIZER(block_buf_caches);
+static struct block_buf_stats block_buf_stats;
+static uintmax_t block_buf_exited_hits;                 // thread_hits from caches of threads that have exited
+static uintmax_t block_buf_hits_base;                   // thread_hits total as of the last block_buf_clear_stats()
+
 // Internal functions
 static pid_t fork_off(const char *executable, char **argv);
+static int parallel_io_run(struct parallel_io *pio, u_int max_threads);
+static void *parallel_io_main(void *arg);
+static struct block_buf_hdr *block_buf_new(size_t size, uint32_t magic);
+static struct block_buf_cache *block_buf_get_cache(void);
+static void block_buf_release(struct block_buf_hdr *hdr);
+static void block_buf_cache_free(void *arg);
 
 /****************************************************************************
  *                      PUBLIC FUNCTION DEFINITIONS                         *
@@ -290,6 +363,30 @@ bitmap_not(bitmap_t *bitmap, s3b_block_t num_blocks)
         bitmap[i] = ~bitmap[i];
 }
 
+// Returns the number of consecutive bits, starting at block_num and not exceeding max_blocks, equal to bit block_num
+s3b_block_t
+bitmap_run_length(const bitmap_t *bitmap, s3b_block_t block_num, s3b_block_t max_blocks)
+{
+    const int bits_per_word = sizeof(*bitmap) * 8;
+    const bitmap_t fill = bitmap_test(bitmap, block_num) ? ~(bitmap_t)0 : 0;
+    size_t index = block_num / bits_per_word;
+    int bit = block_num % bits_per_word;
+    s3b_block_t count = 0;
+    bitmap_t diff;
+
+    // Scan a word at a time for the first bit that differs
+    while (count < max_blocks) {
+        if ((diff = (bitmap[index] ^ fill) >> bit) != 0) {
+            count += ffs((int)diff) - 1;
+            break;
+        }
+        count += bits_per_word - bit;
+        bit = 0;
+        index++;
+    }
+    return count < max_blocks ? count : max_blocks;
+}
+
 // https://stackoverflow.com/q/109023/263801
 int
 popcount32(uint32_t value)
@@ -300,6 +397,90 @@ popcount32(uint32_t value)
      return (int)((value * 0x01010101) >> 24);
 }
 
+/*
+ * Get the current time in seconds from a monotonic clock, for measuring latencies.
+ */
+double
+monotonic_time(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/*
+ * Record an occurrence taking "seconds" in a latency histogram. Caller must provide any locking.
+ *
+ * Bucket zero counts latencies under 1ms; bucket N > 0 starts at latency_bound(N).
+ */
+void
+latency_record(struct latency_hist *hist, double seconds)
+{
+    const uint64_t quarter_millis = seconds > 0.0 ? (uint64_t)(seconds * 4000.0) : 0;
+    u_int bucket = 0;
+    int bit;
+
+    hist->count++;
+    hist->time += seconds;
+    if (quarter_millis >= 4) {
+        for (bit = 2; (quarter_millis >> (bit + 1)) != 0; bit++)
+            ;
+        bucket = 1 + 4 * (bit - 2) + (u_int)((quarter_millis >> (bit - 2)) & 3);
+        if (bucket >= LATENCY_BUCKETS)
+            bucket = LATENCY_BUCKETS - 1;
+    }
+    hist->buckets[bucket]++;
+}
+
+void
+latency_merge(struct latency_hist *dst, const struct latency_hist *src)
+{
+    u_int i;
+
+    dst->count += src->count;
+    dst->time += src->time;
+    for (i = 0; i < LATENCY_BUCKETS; i++)
+        dst->buckets[i] += src->buckets[i];
+}
+
+/*
+ * Get the lower bound (in seconds) of a latency histogram bucket.
+ */
+double
+latency_bound(u_int bucket)
+{
+    if (bucket == 0)
+        return 0.0;
+    bucket--;
+    return (double)((uint64_t)(4 + bucket % 4) << (bucket / 4)) / 4000.0;
+}
+
+/*
+ * Estimate the given latency percentile (in seconds) from a latency histogram.
+ *
+ * The result is the upper bound of the bucket containing the percentile, or zero if there are no samples.
+ */
+double
+latency_percentile(const struct latency_hist *hist, u_int percentile)
+{
+    uint64_t threshold;
+    uint64_t total = 0;
+    uint64_t sum = 0;
+    u_int i;
+
+    for (i = 0; i < LATENCY_BUCKETS; i++)
+        total += hist->buckets[i];
+    if (total == 0)
+        return 0.0;
+    threshold = (total * percentile + 99) / 100;
+    for (i = 0; i < LATENCY_BUCKETS - 1; i++) {
+        if ((sum += hist->buckets[i]) >= threshold)
+            return latency_bound(i + 1);
+    }
+    return latency_bound(LATENCY_BUCKETS - 1);
+}
+
 int
 init_zero_block(u_int block_size)
 {
@@ -307,6 +488,13 @@ init_zero_block(u_int block_size)
     if ((zero_block = calloc(1, block_size)) == NULL)
         return -1;
     zero_block_size = block_size;
+
+    // Pick the best zero detection kernel for this CPU (we're still single threaded here)
+#if ZEROS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        zeros_func = mem_is_zeros_avx2;
+#endif
     return 0;
 }
 
@@ -315,9 +503,88 @@ block_is_zeros(const void *data)
 {
     assert(zero_block != NULL);
     assert(zero_block_size > 0);
-    return data == zero_block || memcmp(data, zero_block, zero_block_size) == 0;
+    return data == zero_block || (*zeros_func)(data, zero_block_size);
+}
+
+// Determine whether "len" bytes at "data" are all zero; only the data itself is read
+int
+mem_is_zeros(const void *data, size_t len)
+{
+    return (*zeros_func)(data, len);
 }
 
+static int
+mem_is_zeros_generic(const void *data, size_t len)
+{
+    const u_char *ptr = data;
+    uint64_t words[8];
+    uint64_t bits;
+    int i;
+
+    for (; len >= sizeof(words); ptr += sizeof(words), len -= sizeof(words)) {
+        memcpy(words, ptr, sizeof(words));                  // avoids any alignment assumptions
+        for (bits = 0, i = 0; i < 8; i++)
+            bits |= words[i];
+        if (bits != 0)
+            return 0;
+    }
+    while (len-- > 0) {
+        if (*ptr++ != 0)
+            return 0;
+    }
+    return 1;
+}
+
+#if ZEROS_X86
+static int
+mem_is_zeros_sse2(const void *data, size_t len)
+{
+    const char *ptr = data;
+    const __m128i zero = _mm_setzero_si128();
+    __m128i bits;
+
+    for (; len >= 64; ptr += 64, len -= 64) {
+        bits = _mm_or_si128(
+          _mm_or_si128(_mm_loadu_si128((const __m128i *)ptr), _mm_loadu_si128((const __m128i *)(ptr + 16))),
+          _mm_or_si128(_mm_loadu_si128((const __m128i *)(ptr + 32)), _mm_loadu_si128((const __m128i *)(ptr + 48))));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(bits, zero)) != 0xffff)
+            return 0;
+    }
+    return mem_is_zeros_generic(ptr, len);
+}
+
+__attribute__ ((__target__ ("avx2")))
+static int
+mem_is_zeros_avx2(const void *data, size_t len)
+{
+    const char *ptr = data;
+    __m256i bits;
+
+    for (; len >= 64; ptr += 64, len -= 64) {
+        bits = _mm256_or_si256(_mm256_loadu_si256((const __m256i *)ptr), _mm256_loadu_si256((const __m256i *)(ptr + 32)));
+        if (!_mm256_testz_si256(bits, bits))
+            return 0;
+    }
+    return mem_is_zeros_generic(ptr, len);
+}
+#endif
+
+#if ZEROS_NEON
+static int
+mem_is_zeros_neon(const void *data, size_t len)
+{
+    const uint8_t *ptr = data;
+    uint8x16_t bits;
+
+    for (; len >= 64; ptr += 64, len -= 64) {
+        bits = vorrq_u8(vorrq_u8(vld1q_u8(ptr), vld1q_u8(ptr + 16)), vorrq_u8(vld1q_u8(ptr + 32), vld1q_u8(ptr + 48)));
+        if (vmaxvq_u8(bits) != 0)
+            return 0;
+    }
+    return mem_is_zeros_generic(ptr, len);
+}
+#endif
+
 void
 block_list_init(struct block_list *list)
 {
@@ -348,6 +615,235 @@ block_list_free(struct block_list *list)
     memset(list, 0, sizeof(*list));
 }
 
+/*
+ * Initialize the shared pool of block-sized buffers.
+ *
+ * Every buffer in the pool has length "size", which should cover the largest buffer any layer needs for one block
+ * (i.e., including compression and encryption overhead). Buffers are recycled through a small per-thread cache first,
+ * then through the shared pool, which keeps at most "max_idle" idle buffers; anything beyond that goes back to the system.
+ *
+ * This must be invoked before any other threads are started. Until then, block_buf_alloc() just allocates one-off buffers.
+ */
+int
+block_buf_init(size_t size, u_int max_idle)
+{
+    int r;
+
+    assert(block_buf_size == 0);
+    if ((r = pthread_key_create(&block_buf_key, block_buf_cache_free)) != 0)
+        return r;
+    block_buf_max_idle = max_idle;
+    block_buf_size = size;
+    return 0;
+}
+
+/*
+ * Allocate a buffer of at least "size" bytes, aligned to a cache line.
+ *
+ * The buffer must be freed via block_buf_free(), which is also true for oversize requests not served by the pool.
+ *
+ * Returns NULL and sets errno on failure.
+ */
+void *
+block_buf_alloc(size_t size)
+{
+    struct block_buf_cache *cache;
+    struct block_buf_hdr *hdr;
+
+    // Handle oversize requests (including all requests if the pool is not initialized)
+    if (size > block_buf_size || block_buf_size == 0) {
+        pthread_mutex_lock(&block_buf_mutex);
+        block_buf_stats.oversize++;
+        CHECK_RETURN(pthread_mutex_unlock(&block_buf_mutex));
+        if ((hdr = block_buf_new(size, BLOCK_BUF_MAGIC_ONEOFF)) == NULL)
+            return NULL;
+        goto done;
+    }
+
+    // Try this thread's cache
+    if ((cache = block_buf_get_cache()) != NULL && cache->num_bufs > 0) {
+        hdr = cache->bufs[--cache->num_bufs];
+        cache->hits++;
+        goto done;
+    }
+
+    // Try the shared pool
+    pthread_mutex_lock(&block_buf_mutex);
+    if ((hdr = block_buf_idle) != NULL) {
+        block_buf_idle = hdr->next;
+        block_buf_stats.num_idle--;
+        block_buf_stats.pool_hits++;
+        CHECK_RETURN(pthread_mutex_unlock(&block_buf_mutex));
+        goto done;
+    }
+    block_buf_stats.misses++;
+    block_buf_stats.num_total++;
+    CHECK_RETURN(pthread_mutex_unlock(&block_buf_mutex));
+
+    // Allocate a new buffer
+    if ((hdr = block_buf_new(block_buf_size, BLOCK_BUF_MAGIC)) == NULL) {
+        const int r = errno;
+
+        pthread_mutex_lock(&block_buf_mutex);
+        block_buf_stats.num_total--;
+        CHECK_RETURN(pthread_mutex_unlock(&block_buf_mutex));
+        errno = r;
+        return NULL;
+    }
+
+done:
+    // Done
+    return (char *)hdr + BLOCK_BUF_HDR_SIZE;
+}
+
+/*
+ * Free a buffer returned by block_buf_alloc(). It's OK if buf is NULL.
+ */
+void
+block_buf_free(void *buf)
+{
+    struct block_buf_cache *cache;
+    struct block_buf_hdr *hdr;
+
+    // Sanity check
+    if (buf == NULL)
+        return;
+    hdr = (struct block_buf_hdr *)(void *)((char *)buf - BLOCK_BUF_HDR_SIZE);
+
+    // Oversize buffers go straight back to the system
+    if (hdr->magic == BLOCK_BUF_MAGIC_ONEOFF) {
+        free(hdr);
+        return;
+    }
+    assert(hdr->magic == BLOCK_BUF_MAGIC);
+
+    // Keep it in this thread's cache if there's room, otherwise return it to the shared pool
+    if ((cache = block_buf_get_cache()) != NULL && cache->num_bufs < BLOCK_BUF_THREAD_CACHE) {
+        cache->bufs[cache->num_bufs++] = hdr;
+        return;
+    }
+    pthread_mutex_lock(&block_buf_mutex);
+    block_buf_release(hdr);
+    CHECK_RETURN(pthread_mutex_unlock(&block_buf_mutex));
+}
+
+/*
+ * Get block buffer pool statistics.
+ *
+ * The per-thread cache counts are read without synchronizing with their owning threads, so they are approximate.
+ */
+void
+block_buf_get_stats(struct block_buf_stats *stats)
+{
+    struct block_buf_cache *cache;
+
+    pthread_mutex_lock(&block_buf_mutex);
+    memcpy(stats, &block_buf_stats, sizeof(*stats));
+    stats->buf_size = block_buf_size;
+    stats->max_idle = block_buf_max_idle;
+    stats->num_cached = 0;
+    stats->thread_hits = block_buf_exited_hits;
+    TAILQ_FOREACH(cache, &block_buf_caches, link) {
+        stats->num_cached += cache->num_bufs;
+        stats->thread_hits += cache->hits;
+    }
+    stats->thread_hits -= block_buf_hits_base;
+    CHECK_RETURN(pthread_mutex_unlock(&block_buf_mutex));
+}
+
+void
+block_buf_clear_stats(void)
+{
+    struct block_buf_cache *cache;
+
+    pthread_mutex_lock(&block_buf_mutex);
+    block_buf_stats.pool_hits = 0;
+    block_buf_stats.misses = 0;
+    block_buf_stats.oversize = 0;
+    block_buf_hits_base = block_buf_exited_hits;
+    TAILQ_FOREACH(cache, &block_buf_caches, link)
+        block_buf_hits_base += cache->hits;
+    CHECK_RETURN(pthread_mutex_unlock(&block_buf_mutex));
+}
+
+// Allocate a new buffer from the system, returning its header
+static struct block_buf_hdr *
+block_buf_new(size_t size, uint32_t magic)
+{
+    struct block_buf_hdr *hdr;
+    void *mem;
+    int r;
+
+    if ((r = posix_memalign(&mem, BLOCK_BUF_ALIGN, BLOCK_BUF_HDR_SIZE + size)) != 0) {
+        errno = r;
+        return NULL;
+    }
+    hdr = mem;
+    hdr->magic = magic;
+    hdr->next = NULL;
+    return hdr;
+}
+
+// Get (creating if necessary) the current thread's buffer cache; returns NULL if none can be had
+static struct block_buf_cache *
+block_buf_get_cache(void)
+{
+    struct block_buf_cache *cache;
+    const int errno_save = errno;
+
+    // Already have one?
+    if ((cache = pthread_getspecific(block_buf_key)) != NULL)
+        return cache;
+
+    // Create a new one; it's not an error if we can't, the thread just goes without
+    if ((cache = calloc(1, sizeof(*cache))) == NULL)
+        goto fail;
+    if (pthread_setspecific(block_buf_key, cache) != 0) {
+        free(cache);
+        goto fail;
+    }
+
+    // Register it so stats can see it
+    pthread_mutex_lock(&block_buf_mutex);
+    TAILQ_INSERT_TAIL(&block_buf_caches, cache, link);
+    CHECK_RETURN(pthread_mutex_unlock(&block_buf_mutex));
+    return cache;
+
+fail:
+    errno = errno_save;
+    return NULL;
+}
+
+// Return a pooled buffer to the shared pool, or to the system if the pool already has enough idle buffers.
+// This assumes block_buf_mutex is held.
+static void
+block_buf_release(struct block_buf_hdr *hdr)
+{
+    if (block_buf_stats.num_idle < block_buf_max_idle) {
+        hdr->next = block_buf_idle;
+        block_buf_idle = hdr;
+        block_buf_stats.num_idle++;
+        return;
+    }
+    block_buf_stats.num_total--;
+    free(hdr);
+}
+
+// Thread-specific data destructor: give a departing thread's cached buffers back to the shared pool
+static void
+block_buf_cache_free(void *arg)
+{
+    struct block_buf_cache *const cache = arg;
+
+    pthread_mutex_lock(&block_buf_mutex);
+    TAILQ_REMOVE(&block_buf_caches, cache, link);
+    block_buf_exited_hits += cache->hits;
+    while (cache->num_bufs > 0)
+        block_buf_release(cache->bufs[--cache->num_bufs]);
+    CHECK_RETURN(pthread_mutex_unlock(&block_buf_mutex));
+    free(cache);
+}
+
 int
 generic_bulk_zero(struct s3backer_store *s3b, const s3b_block_t *block_nums, u_int num_blocks)
 {
@@ -360,6 +856,159 @@ generic_bulk_zero(struct s3backer_store *s3b, const s3b_block_t *block_nums, u_i
     return 0;
 }
 
+/*
+ * Read a range of contiguous blocks, using the store's read_blocks() if supported, otherwise one block at a time.
+ */
+int
+read_block_range(struct s3backer_store *s3b, u_int block_size, s3b_block_t block_num, u_int num_blocks, void *dest)
+{
+    if (s3b->read_blocks != NULL)
+        return (*s3b->read_blocks)(s3b, block_num, num_blocks, dest);
+    return parallel_read_blocks(s3b, block_size, 1, block_num, num_blocks, dest);
+}
+
+/*
+ * Write a range of contiguous blocks, using the store's write_blocks() if supported, otherwise one block at a time.
+ */
+int
+write_block_range(struct s3backer_store *s3b, u_int block_size, s3b_block_t block_num, u_int num_blocks, const void *src)
+{
+    if (s3b->write_blocks != NULL)
+        return (*s3b->write_blocks)(s3b, block_num, num_blocks, src, NULL, NULL, NULL);
+    return parallel_write_blocks(s3b, block_size, 1, block_num, num_blocks, src, NULL, NULL, NULL);
+}
+
+/*
+ * Read a range of contiguous blocks by invoking read_block() for each block, using up to
+ * 'max_threads' threads (including the calling thread) to perform the reads concurrently.
+ */
+int
+parallel_read_blocks(struct s3backer_store *s3b, u_int block_size, u_int max_threads,
+  s3b_block_t block_num, u_int num_blocks, void *dest)
+{
+    struct parallel_io pio;
+
+    memset(&pio, 0, sizeof(pio));
+    pio.s3b = s3b;
+    pio.block_size = block_size;
+    pio.block_num = block_num;
+    pio.num_blocks = num_blocks;
+    pio.dest = dest;
+    return parallel_io_run(&pio, max_threads);
+}
+
+/*
+ * Write a range of contiguous blocks by invoking write_block() for each block, using up to
+ * 'max_threads' threads (including the calling thread) to perform the writes concurrently.
+ */
+int
+parallel_write_blocks(struct s3backer_store *s3b, u_int block_size, u_int max_threads,
+  s3b_block_t block_num, u_int num_blocks, const void *src, u_char *etags, check_cancel_t *check_cancel,
+  void *check_cancel_arg)
+{
+    struct parallel_io pio;
+
+    memset(&pio, 0, sizeof(pio));
+    pio.s3b = s3b;
+    pio.block_size = block_size;
+    pio.block_num = block_num;
+    pio.num_blocks = num_blocks;
+    pio.src = src;
+    pio.etags = etags;
+    pio.check_cancel = check_cancel;
+    pio.check_cancel_arg = check_cancel_arg;
+    pio.write = 1;
+    return parallel_io_run(&pio, max_threads);
+}
+
+static int
+parallel_io_run(struct parallel_io *pio, u_int max_threads)
+{
+    pthread_t *threads = NULL;
+    u_int num_threads = 0;
+    int r;
+
+    // Handle the trivial case inline
+    if (max_threads > pio->num_blocks)
+        max_threads = pio->num_blocks;
+    if (max_threads <= 1) {
+        parallel_io_main(pio);
+        return pio->error;
+    }
+
+    // Initialize mutex
+    if ((r = pthread_mutex_init(&pio->mutex, NULL)) != 0)
+        return r;
+    pio->locking = 1;
+
+    // Start helper threads; if we can't create as many as we wanted, just make do with what we have
+    if ((threads = malloc((max_threads - 1) * sizeof(*threads))) != NULL) {
+        while (num_threads < max_threads - 1) {
+            if (pthread_create(&threads[num_threads], NULL, parallel_io_main, pio) != 0)
+                break;
+            num_threads++;
+        }
+    }
+
+    // Help out ourselves
+    parallel_io_main(pio);
+
+    // Wait for helper threads to finish
+    while (num_threads > 0)
+        CHECK_RETURN(pthread_join(threads[--num_threads], NULL));
+    free(threads);
+
+    // Done
+    pthread_mutex_destroy(&pio->mutex);
+    return pio->error;
+}
+
+static void *
+parallel_io_main(void *arg)
+{
+    struct parallel_io *const pio = arg;
+    s3b_block_t block_num;
+    size_t offset;
+    u_int index;
+    int r;
+
+    while (1) {
+
+        // Claim the next block, unless we're done or there has been an error
+        if (pio->locking)
+            pthread_mutex_lock(&pio->mutex);
+        if (pio->next == pio->num_blocks || pio->error != 0) {
+            if (pio->locking)
+                CHECK_RETURN(pthread_mutex_unlock(&pio->mutex));
+            break;
+        }
+        index = pio->next++;
+        if (pio->locking)
+            CHECK_RETURN(pthread_mutex_unlock(&pio->mutex));
+
+        // Read or write the block
+        block_num = pio->block_num + index;
+        offset = (size_t)index * pio->block_size;
+        if (pio->write)
+            r = (*pio->s3b->write_block)(pio->s3b, block_num, pio->src != NULL ? pio->src + offset : NULL,
+              pio->etags != NULL ? pio->etags + (size_t)index * MD5_DIGEST_LENGTH : NULL,
+              pio->check_cancel, pio->check_cancel_arg);
+        else
+            r = (*pio->s3b->read_block)(pio->s3b, block_num, pio->dest + offset, NULL, NULL, 0);
+
+        // Record the first error, if any
+        if (r != 0) {
+            if (pio->locking)
+                pthread_mutex_lock(&pio->mutex);
+            if (pio->error == 0)
+                pio->error = r;
+            if (pio->locking)
+                CHECK_RETURN(pthread_mutex_unlock(&pio->mutex));
+        }
+    }
+    return NULL;
+}
+
 void
 syslog_logger(int level, const char *fmt, ...)
 {
@@ -821,8 +1470,10 @@ set_config_log(struct s3b_config *config, log_func_t *log)
     config->http_io.log = log;
     config->zero_cache.log = log;
     config->ec_protect.log = log;
+    config->dedup.log = log;
     config->fuse_ops.log = log;
     config->test_io.log = log;
+    config->localfs_io.log = log;
 }
 
 // Hashing stuff
@@ -1029,3 +1680,27 @@ md5_quick(const void *data, size_t len, u_char *result)
     assert(md5_len == MD5_DIGEST_LENGTH);
     EVP_MD_CTX_free(ctx);
 }
+
+void
+sha256_quick(const void *data, size_t len, u_char *result)
+{
+    EVP_MD_CTX *ctx;
+    u_int sha256_len;
+    int r;
+
+    ctx = EVP_MD_CTX_new();
+    assert(ctx != NULL);
+    r = EVP_DigestInit_ex(ctx, EVP_sha256(), NULL);
+    assert(r != 0);
+    r = EVP_DigestUpdate(ctx, data, len);
+    assert(r != 0);
+    r = EVP_DigestFinal_ex(ctx, result, &sha256_len);
+    assert(r != 0);
+    assert(sha256_len == SHA256_DIGEST_LENGTH);
+    EVP_MD_CTX_free(ctx);
+#ifdef NDEBUG
+    // Avoid unused variable warning
+    (void)r;
+    (void)sha256_len;
+#endif
+}
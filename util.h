@@ -79,6 +79,19 @@ struct child_proc {
     int         wstatus;
 };
 
+// Block buffer pool statistics
+struct block_buf_stats {
+    size_t          buf_size;               // size of each pooled buffer (zero if pool not initialized)
+    u_int           max_idle;               // max idle buffers kept in the shared pool
+    u_int           num_total;              // pooled buffers currently allocated from the system
+    u_int           num_idle;               // idle buffers in the shared pool
+    u_int           num_cached;             // idle buffers in per-thread caches
+    uintmax_t       thread_hits;            // allocations satisfied from a per-thread cache
+    uintmax_t       pool_hits;              // allocations satisfied from the shared pool
+    uintmax_t       misses;                 // allocations requiring a new buffer from the system
+    uintmax_t       oversize;               // allocations too large for the pool
+};
+
 // Globals
 extern int log_enable_debug;
 extern int daemonized;
@@ -92,6 +105,7 @@ extern void syslog_logger(int level, const char *fmt, ...) __attribute__ ((__for
 extern void stderr_logger(int level, const char *fmt, ...) __attribute__ ((__format__ (__printf__, 2, 3)));
 extern int find_string_in_table(const char *const *table, const char *value);
 extern int block_is_zeros(const void *data);
+extern int mem_is_zeros(const void *data, size_t len);
 extern int snvprintf(char *buf, int bufsize, const char *format, ...) __attribute__ ((__format__ (__printf__, 3, 4)));
 extern char *prefix_log_format(int level, const char *fmt);
 extern void calculate_boundary_info(struct boundary_info *info, u_int block_size, const void *buf, size_t size, off_t offset);
@@ -102,6 +116,13 @@ extern int init_zero_block(u_int block_size);
 extern void set_config_log(struct s3b_config *config, log_func_t *log);
 extern int popcount32(uint32_t value);
 
+// Latency histograms
+extern double monotonic_time(void);
+extern void latency_record(struct latency_hist *hist, double seconds);
+extern void latency_merge(struct latency_hist *dst, const struct latency_hist *src);
+extern double latency_bound(u_int bucket);
+extern double latency_percentile(const struct latency_hist *hist, u_int percentile);
+
 // Versions of <err.h> that work properly even when daemonized
 extern void daemon_debug(const struct s3b_config *config, const char *fmt, ...)
     __attribute__ ((__format__ (__printf__, 2, 3)));
@@ -130,14 +151,30 @@ extern void bitmap_and(bitmap_t *dst, const bitmap_t *src, s3b_block_t num_block
 extern void bitmap_or(bitmap_t *dst, const bitmap_t *src, s3b_block_t num_blocks);
 extern size_t bitmap_or2(bitmap_t *dst, const bitmap_t *src, s3b_block_t num_blocks);
 extern void bitmap_not(bitmap_t *bitmap, s3b_block_t num_blocks);
+extern s3b_block_t bitmap_run_length(const bitmap_t *bitmap, s3b_block_t block_num, s3b_block_t max_blocks);
 
 // Block lists
 extern void block_list_init(struct block_list *list);
 extern int block_list_append(struct block_list *list, s3b_block_t block_num);
 extern void block_list_free(struct block_list *list);
 
+// Block buffer pool
+extern int block_buf_init(size_t size, u_int max_idle);
+extern void *block_buf_alloc(size_t size);
+extern void block_buf_free(void *buf);
+extern void block_buf_get_stats(struct block_buf_stats *stats);
+extern void block_buf_clear_stats(void);
+
 // Generic s3backer_store functions
 extern int generic_bulk_zero(struct s3backer_store *s3b, const s3b_block_t *block_nums, u_int num_blocks);
+extern int read_block_range(struct s3backer_store *s3b, u_int block_size, s3b_block_t block_num, u_int num_blocks, void *dest);
+extern int write_block_range(struct s3backer_store *s3b, u_int block_size, s3b_block_t block_num, u_int num_blocks,
+    const void *src);
+extern int parallel_read_blocks(struct s3backer_store *s3b, u_int block_size, u_int max_threads,
+    s3b_block_t block_num, u_int num_blocks, void *dest);
+extern int parallel_write_blocks(struct s3backer_store *s3b, u_int block_size, u_int max_threads,
+    s3b_block_t block_num, u_int num_blocks, const void *src, u_char *etags, check_cancel_t *check_cancel,
+    void *check_cancel_arg);
 
 // Hashing
 struct hmac_engine;
@@ -154,3 +191,4 @@ extern int hmac_result_length(struct hmac_ctx *ctx);
 extern void hmac_free(struct hmac_ctx *ctx);
 
 extern void md5_quick(const void *data, size_t len, u_char *result);
+extern void sha256_quick(const void *data, size_t len, u_char *result);
@@ -36,6 +36,7 @@
 
 #include "s3backer.h"
 #include "zero_cache.h"
+#include "sbitmap.h"
 #include "util.h"
 
 /*
@@ -45,6 +46,8 @@
  * block cache can get blown out. This layer sits "on top" of the block cach layer and
  * caches zero blocks so the regular block cache doesn't have to deal with them as much.
  * Because only one bit is used for each block, we can cover the entire s3backer file.
+ * The bitmaps are sparse (see sbitmap.h), so long runs of blocks with the same status
+ * cost almost nothing; memory grows with the number of mixed regions, not the file size.
  *
  * This layer caches the following bit of information for each block: whether it is known
  * for certain that the block is zero. If the bit is 1, the block is known to be zero; if
@@ -66,23 +69,62 @@
  * flip those bits in the survey bitmap as well. Therefore at the end of the survey, only
  * the truly zero blocks should remain in the survey bitmap. This bitmap is then OR'd into
  * the main zero bitmap.
+ *
+ * Lower layers may also report survey progress, i.e., ranges of blocks for which every possibly
+ * non-zero block has already been reported. Those portions of the survey bitmap are OR'd into
+ * the main zero bitmap right away, so the cache becomes useful long before the survey finishes.
+ * We keep track of the completed ranges as we go.
+ *
+ * If a checkpoint file is configured, on shutdown we save the main zero bitmap and the completed
+ * ranges to it. On the next startup we load them back in, delete the file, and survey only the
+ * ranges not yet completed (if any). Because the file is deleted once loaded, an unclean shutdown
+ * means the next startup surveys from scratch. This assumes nothing else modifies the bucket
+ * between mounts. The header records a hash of the bucket, prefix, and block naming mode, so a
+ * checkpoint file left over from some other filesystem is never applied to this one.
+ *
+ * Checkpoint file format:
+ *
+ *  [ struct checkpoint_header ]
+ *  struct block_range for each completed range
+ *  s3b_block_t length of each run of bits in the main zero bitmap (alternating, starting with 0's)
  */
 
+// Definitions
+#define CHECKPOINT_SIGNATURE        0x7a63f0d5
+#define CHECKPOINT_SUFFIX           ".new"
+
+// Checkpoint file header
+struct checkpoint_header {
+    uint32_t                    signature;
+    uint32_t                    header_size;
+    uint32_t                    block_size;
+    s3b_block_t                 num_blocks;
+    uint32_t                    num_ranges;
+    uint32_t                    num_runs;
+    u_char                      identity[SHA256_DIGEST_LENGTH];     // see zero_cache_identity()
+    uint32_t                    crc;            // CRC-32 of everything after the header
+} __attribute__ ((packed));
+
 // Internal state
 struct zero_cache_private {
     struct zero_cache_conf      *config;
     struct s3backer_store       *inner;         // underlying s3backer store
-    bitmap_t                    *zeros;         // 1 = known to be zero, 0 = unknown
+    struct sbitmap              *zeros;         // 1 = known to be zero, 0 = unknown
     pthread_mutex_t             mutex;
     struct zero_cache_stats     stats;
     volatile int                stopping;
 
     // Survey thread info
     int                         thread_started; // the survey thread was started
-    bitmap_t                    *survey_zeros;  // 1 = might still be zero, 0 = might not be zero; NULL if no survey running
+    struct sbitmap              *survey_zeros;  // 1 = might still be zero, 0 = might not be zero; NULL if no survey running
     pthread_t                   survey_thread;  // the survey thread
-    pthread_mutex_t             survey_mutex;   // this protects "survey_zeros" during the survey
+    pthread_mutex_t             survey_mutex;   // this protects "survey_zeros" and "survey_done" during the survey
     uintmax_t                   survey_count;
+    struct block_range          *survey_done;   // sorted, disjoint ranges of blocks whose survey has completed
+    u_int                       num_survey_done;
+    u_int                       survey_done_alloc;
+    struct block_range          *survey_skip;   // copy of "survey_done" when the survey started
+    u_int                       num_survey_skip;
 };
 
 // s3backer_store functions
@@ -95,9 +137,15 @@ static int zero_cache_write_block(struct s3backer_store *s3b, s3b_block_t block_
   check_cancel_t *check_cancel, void *check_cancel_arg);
 static int zero_cache_read_block_part(struct s3backer_store *s3b, s3b_block_t block_num, u_int off, u_int len, void *dest);
 static int zero_cache_write_block_part(struct s3backer_store *s3b, s3b_block_t block_num, u_int off, u_int len, const void *src);
+static int zero_cache_read_blocks(struct s3backer_store *s3b, s3b_block_t block_num, u_int num_blocks, void *dest);
+static int zero_cache_write_blocks(struct s3backer_store *s3b, s3b_block_t block_num, u_int num_blocks, const void *src,
+    u_char *etags, check_cancel_t *check_cancel, void *check_cancel_arg);
 static int zero_cache_flush_blocks(struct s3backer_store *s3b, const s3b_block_t *block_nums, u_int num_blocks, long timeout);
 static int zero_cache_bulk_zero(struct s3backer_store *const s3b, const s3b_block_t *block_nums, u_int num_blocks);
-static int zero_cache_survey_non_zero(struct s3backer_store *s3b, block_list_func_t *callback, void *arg);
+static int zero_cache_survey_non_zero(struct s3backer_store *s3b, const struct survey_params *params);
+static int zero_cache_block_status(struct s3backer_store *s3b, s3b_block_t block_num, s3b_block_t max_blocks,
+  int *zerop, s3b_block_t *num_blocksp);
+static int zero_cache_prefetch_blocks(struct s3backer_store *s3b, s3b_block_t block_num, u_int num_blocks);
 static int zero_cache_shutdown(struct s3backer_store *s3b);
 static void zero_cache_destroy(struct s3backer_store *s3b);
 
@@ -105,6 +153,12 @@ static void zero_cache_destroy(struct s3backer_store *s3b);
 static void zero_cache_update_block(struct zero_cache_private *const priv, s3b_block_t block_num, int zero);
 static void *zero_cache_survey_main(void *arg);
 static block_list_func_t zero_cache_survey_callback;
+static block_range_func_t zero_cache_survey_progress;
+static int zero_cache_add_survey_done(struct zero_cache_private *priv, s3b_block_t min, s3b_block_t max);
+static int zero_cache_survey_complete(struct zero_cache_private *priv);
+static int zero_cache_identity(struct zero_cache_private *priv, u_char *result);
+static void zero_cache_load_checkpoint(struct zero_cache_private *priv);
+static void zero_cache_save_checkpoint(struct zero_cache_private *priv);
 
 // Special all-zeros MD5 value signifying a zeroed block
 static const u_char zero_etag[MD5_DIGEST_LENGTH];
@@ -136,9 +190,14 @@ zero_cache_create(struct zero_cache_conf *config, struct s3backer_store *inner)
         s3b->read_block_part = zero_cache_read_block_part;
     if (inner->write_block_part != NULL)
         s3b->write_block_part = zero_cache_write_block_part;
+    s3b->read_blocks = zero_cache_read_blocks;
+    s3b->write_blocks = zero_cache_write_blocks;
     s3b->flush_blocks = zero_cache_flush_blocks;
     s3b->bulk_zero = zero_cache_bulk_zero;
     s3b->survey_non_zero = zero_cache_survey_non_zero;
+    s3b->block_status = zero_cache_block_status;
+    if (inner->prefetch_blocks != NULL)
+        s3b->prefetch_blocks = zero_cache_prefetch_blocks;
     s3b->shutdown = zero_cache_shutdown;
     s3b->destroy = zero_cache_destroy;
     if ((priv = calloc(1, sizeof(*priv))) == NULL) {
@@ -154,7 +213,7 @@ zero_cache_create(struct zero_cache_conf *config, struct s3backer_store *inner)
         goto fail3;
 
     // Initialize bit map
-    if ((priv->zeros = bitmap_init(config->num_blocks, 0)) == NULL) {
+    if ((priv->zeros = sbitmap_create(config->num_blocks, 0, 0)) == NULL) {
         r = errno;
         (*config->log)(LOG_ERR, "calloc(): %s", strerror(r));
         goto fail4;
@@ -183,6 +242,7 @@ zero_cache_create_threads(struct s3backer_store *s3b)
 {
     struct zero_cache_private *const priv = s3b->data;
     struct zero_cache_conf *const config = priv->config;
+    u_int i;
     int r;
 
     // Propagate to lower layer
@@ -192,23 +252,49 @@ zero_cache_create_threads(struct s3backer_store *s3b)
     // Anything to do? (was "--listBlocks" specified)
     if (!config->list_blocks)
         return 0;
-    (*config->log)(LOG_INFO, "starting non-zero block survey");
 
     // Lock mutex
     pthread_mutex_lock(&priv->mutex);
 
-    // Initialize survey bitmap (to all 1's)
+    // Resume from checkpoint, if any
+    if (config->checkpoint_file != NULL) {
+        zero_cache_load_checkpoint(priv);
+        if (zero_cache_survey_complete(priv)) {
+            (*config->log)(LOG_INFO, "non-zero block survey already completed according to checkpoint");
+            CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+            return 0;
+        }
+    }
+    (*config->log)(LOG_INFO, "%s non-zero block survey", priv->num_survey_done > 0 ? "resuming" : "starting");
+
+    // Initialize survey bitmap (to all 1's, except for any already completed ranges)
     assert(priv->survey_zeros == NULL);
-    if ((priv->survey_zeros = bitmap_init(config->num_blocks, 1)) == NULL) {
+    if ((priv->survey_zeros = sbitmap_create(config->num_blocks, 1, 0)) == NULL) {
         r = errno;
         (*config->log)(LOG_ERR, "malloc(): %s", strerror(r));
         goto fail1;
     }
+    for (i = 0; i < priv->num_survey_done; i++) {
+        const struct block_range *const range = &priv->survey_done[i];
+
+        sbitmap_set_range(priv->survey_zeros, range->min, range->max - range->min + 1, 0);
+    }
+
+    // Tell lower layers to skip the already completed ranges
+    if (priv->num_survey_done > 0) {
+        if ((priv->survey_skip = malloc(priv->num_survey_done * sizeof(*priv->survey_skip))) == NULL) {
+            r = errno;
+            (*config->log)(LOG_ERR, "malloc(): %s", strerror(r));
+            goto fail2;
+        }
+        memcpy(priv->survey_skip, priv->survey_done, priv->num_survey_done * sizeof(*priv->survey_skip));
+        priv->num_survey_skip = priv->num_survey_done;
+    }
 
     // Create survey thread
     if ((r = pthread_create(&priv->survey_thread, NULL, zero_cache_survey_main, priv)) != 0) {
         (*config->log)(LOG_ERR, "pthread_create(): %s", strerror(r));
-        goto fail2;
+        goto fail3;
     }
     priv->thread_started = 1;
 
@@ -218,8 +304,12 @@ zero_cache_create_threads(struct s3backer_store *s3b)
     // Done
     return 0;
 
+fail3:
+    free(priv->survey_skip);
+    priv->survey_skip = NULL;
+    priv->num_survey_skip = 0;
 fail2:
-    bitmap_free(&priv->survey_zeros);
+    sbitmap_free(&priv->survey_zeros);
 fail1:
     CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
     return r;
@@ -230,24 +320,37 @@ zero_cache_survey_main(void *arg)
 {
     struct zero_cache_private *const priv = arg;
     struct zero_cache_conf *const config = priv->config;
+    struct survey_params params;
     uintmax_t survey_count;
     int r;
 
     // Perform survey
-    r = (*priv->inner->survey_non_zero)(priv->inner, zero_cache_survey_callback, priv);
+    memset(&params, 0, sizeof(params));
+    params.callback = zero_cache_survey_callback;
+    params.progress = zero_cache_survey_progress;
+    params.arg = priv;
+    params.skip = priv->survey_skip;
+    params.num_skip = priv->num_survey_skip;
+    r = (*priv->inner->survey_non_zero)(priv->inner, &params);
 
     // Lock main mutex
     pthread_mutex_lock(&priv->mutex);
 
     // Apply results (only if we completed the survey with no error)
     pthread_mutex_lock(&priv->survey_mutex);
-    if (r == 0)
-        priv->stats.current_cache_size = bitmap_or2(priv->zeros, priv->survey_zeros, config->num_blocks);
+    if (r == 0) {
+        sbitmap_or(priv->zeros, priv->survey_zeros);
+        priv->num_survey_done = 0;
+        (void)zero_cache_add_survey_done(priv, 0, config->num_blocks - 1);
+    }
     survey_count = priv->survey_count;
     CHECK_RETURN(pthread_mutex_unlock(&priv->survey_mutex));
 
     // Finish up
-    bitmap_free(&priv->survey_zeros);
+    sbitmap_free(&priv->survey_zeros);
+    free(priv->survey_skip);
+    priv->survey_skip = NULL;
+    priv->num_survey_skip = 0;
 
     // Unlock main mutex
     CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
@@ -273,9 +376,9 @@ zero_cache_survey_callback(void *arg, const s3b_block_t *block_nums, u_int num_b
     while (num_blocks-- > 0) {
         const s3b_block_t block_num = *block_nums++;
 
-        if (!bitmap_test(priv->survey_zeros, block_num))
+        if (!sbitmap_test(priv->survey_zeros, block_num))
             continue;                                           // already reported to us
-        bitmap_set(priv->survey_zeros, block_num, 0);
+        sbitmap_set(priv->survey_zeros, block_num, 0);
         priv->survey_count++;
     }
     CHECK_RETURN(pthread_mutex_unlock(&priv->survey_mutex));
@@ -284,6 +387,323 @@ zero_cache_survey_callback(void *arg, const s3b_block_t *block_nums, u_int num_b
     return 0;
 }
 
+/*
+ * Every block in the range that is still set in the survey bitmap is now known to be zero,
+ * so we can go ahead and mark it so in the main bitmap without waiting for the entire survey.
+ */
+static int
+zero_cache_survey_progress(void *arg, s3b_block_t min_block, s3b_block_t max_block)
+{
+    struct zero_cache_private *const priv = arg;
+    struct zero_cache_conf *const config = priv->config;
+    s3b_block_t block_num;
+    s3b_block_t run;
+    int r;
+
+    // Check for shutdown
+    if (priv->stopping)
+        return ECANCELED;
+
+    // Sanity check
+    if (min_block > max_block || max_block >= config->num_blocks)
+        return EINVAL;
+
+    // Lock both mutexes
+    pthread_mutex_lock(&priv->mutex);
+    pthread_mutex_lock(&priv->survey_mutex);
+    assert(priv->survey_zeros != NULL);
+
+    // Apply each run of blocks still set in the survey bitmap
+    for (block_num = min_block; (block_num = sbitmap_find_next(priv->survey_zeros, block_num, 1)) <= max_block; ) {
+        run = sbitmap_run_length(priv->survey_zeros, block_num, max_block - block_num + 1);
+        sbitmap_set_range(priv->zeros, block_num, run, 1);
+        block_num += run;
+    }
+
+    // Record completed range
+    r = zero_cache_add_survey_done(priv, min_block, max_block);
+
+    // Unlock both mutexes
+    CHECK_RETURN(pthread_mutex_unlock(&priv->survey_mutex));
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+
+    // Done
+    return r;
+}
+
+// Add a range to "survey_done", merging with any overlapping or adjacent ranges. This assumes survey_mutex is held.
+static int
+zero_cache_add_survey_done(struct zero_cache_private *priv, s3b_block_t min, s3b_block_t max)
+{
+    struct zero_cache_conf *const config = priv->config;
+    struct block_range *new_done;
+    u_int new_alloc;
+    u_int first;
+    u_int last;
+    int r;
+
+    // Sanity check (note "max + 1" can't overflow, because max < num_blocks)
+    assert(min <= max && max < config->num_blocks);
+
+    // Find the ranges that overlap or are adjacent to the new range, and merge them into it
+    for (first = 0; first < priv->num_survey_done && priv->survey_done[first].max + 1 < min; first++)
+        ;
+    for (last = first; last < priv->num_survey_done && priv->survey_done[last].min <= max + 1; last++) {
+        if (priv->survey_done[last].min < min)
+            min = priv->survey_done[last].min;
+        if (priv->survey_done[last].max > max)
+            max = priv->survey_done[last].max;
+    }
+
+    // If there was nothing to merge with, make room to insert a new range
+    if (last == first) {
+        if (priv->num_survey_done == priv->survey_done_alloc) {
+            new_alloc = priv->survey_done_alloc > 0 ? 2 * priv->survey_done_alloc : 16;
+            if ((new_done = realloc(priv->survey_done, new_alloc * sizeof(*new_done))) == NULL) {
+                r = errno;
+                (*config->log)(LOG_ERR, "realloc(): %s", strerror(r));
+                return r;
+            }
+            priv->survey_done = new_done;
+            priv->survey_done_alloc = new_alloc;
+        }
+        memmove(priv->survey_done + first + 1, priv->survey_done + first,
+          (priv->num_survey_done - first) * sizeof(*priv->survey_done));
+        priv->num_survey_done++;
+        last = first + 1;
+    }
+
+    // Replace ranges [first, last) with the merged range
+    priv->survey_done[first].min = min;
+    priv->survey_done[first].max = max;
+    memmove(priv->survey_done + first + 1, priv->survey_done + last,
+      (priv->num_survey_done - last) * sizeof(*priv->survey_done));
+    priv->num_survey_done -= last - first - 1;
+    return 0;
+}
+
+// Determine whether the survey has covered every block
+static int
+zero_cache_survey_complete(struct zero_cache_private *priv)
+{
+    struct zero_cache_conf *const config = priv->config;
+
+    return priv->num_survey_done == 1
+      && priv->survey_done[0].min == 0 && priv->survey_done[0].max == config->num_blocks - 1;
+}
+
+/*
+ * Compute the hash identifying this filesystem in the checkpoint file.
+ */
+static int
+zero_cache_identity(struct zero_cache_private *priv, u_char *result)
+{
+    struct zero_cache_conf *const config = priv->config;
+    char *buf;
+    int len;
+
+    if ((len = asprintf(&buf, "%s%c%s%c%d", config->bucket != NULL ? config->bucket : "", '\0',
+      config->prefix != NULL ? config->prefix : "", '\0', config->blockHashPrefix)) == -1) {
+        (*config->log)(LOG_ERR, "asprintf(): %s", strerror(errno));
+        return ENOMEM;
+    }
+    sha256_quick(buf, len, result);
+    free(buf);
+    return 0;
+}
+
+/*
+ * Load the checkpoint file, if any, into the main zero bitmap and "survey_done", then delete it.
+ * If the file is not valid, we just start over. This assumes mutex is held.
+ */
+static void
+zero_cache_load_checkpoint(struct zero_cache_private *priv)
+{
+    struct zero_cache_conf *const config = priv->config;
+    struct checkpoint_header header;
+    u_char identity[SHA256_DIGEST_LENGTH];
+    struct block_range *ranges = NULL;
+    struct sbitmap *zeros = NULL;
+    s3b_block_t *runs = NULL;
+    s3b_block_t block_num;
+    uLong crc;
+    FILE *fp;
+    u_int i;
+
+    // Open file
+    if ((fp = fopen(config->checkpoint_file, "r")) == NULL) {
+        if (errno != ENOENT)
+            (*config->log)(LOG_ERR, "can't open checkpoint file `%s': %s", config->checkpoint_file, strerror(errno));
+        return;
+    }
+
+    // Read and verify header
+    if (fread(&header, sizeof(header), 1, fp) != 1)
+        goto invalid;
+    if (header.signature != CHECKPOINT_SIGNATURE || header.header_size != sizeof(header)
+      || header.num_ranges > config->num_blocks || header.num_runs > config->num_blocks + (uintmax_t)1)
+        goto invalid;
+    if (header.block_size != config->block_size || header.num_blocks != config->num_blocks) {
+        (*config->log)(LOG_ERR, "checkpoint file `%s' has the wrong block size and/or size; ignoring it",
+          config->checkpoint_file);
+        goto done;
+    }
+    if (zero_cache_identity(priv, identity) != 0)
+        goto done;
+    if (memcmp(header.identity, identity, sizeof(identity)) != 0) {
+        (*config->log)(LOG_ERR, "checkpoint file `%s' belongs to a different bucket and/or prefix; ignoring it",
+          config->checkpoint_file);
+        goto done;
+    }
+
+    // Read ranges and runs
+    if ((ranges = malloc(((size_t)header.num_ranges + 1) * sizeof(*ranges))) == NULL
+      || (runs = malloc(((size_t)header.num_runs + 1) * sizeof(*runs))) == NULL) {
+        (*config->log)(LOG_ERR, "malloc(): %s", strerror(errno));
+        goto done;
+    }
+    if (fread(ranges, sizeof(*ranges), header.num_ranges, fp) != header.num_ranges
+      || fread(runs, sizeof(*runs), header.num_runs, fp) != header.num_runs)
+        goto invalid;
+    crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, (const Bytef *)ranges, header.num_ranges * sizeof(*ranges));
+    crc = crc32(crc, (const Bytef *)runs, header.num_runs * sizeof(*runs));
+    if ((uint32_t)crc != header.crc)
+        goto invalid;
+
+    // Rebuild zero bitmap
+    if ((zeros = sbitmap_create(config->num_blocks, 0, 0)) == NULL) {
+        (*config->log)(LOG_ERR, "calloc(): %s", strerror(errno));
+        goto done;
+    }
+    for (block_num = 0, i = 0; i < header.num_runs; block_num += runs[i++]) {
+        if (runs[i] > config->num_blocks - block_num)
+            goto invalid;
+        if ((i & 1) != 0)
+            sbitmap_set_range(zeros, block_num, runs[i], 1);
+    }
+    if (block_num != config->num_blocks)
+        goto invalid;
+
+    // Rebuild completed ranges
+    for (i = 0; i < header.num_ranges; i++) {
+        if (ranges[i].min > ranges[i].max || ranges[i].max >= config->num_blocks)
+            goto invalid;
+        if (zero_cache_add_survey_done(priv, ranges[i].min, ranges[i].max) != 0) {
+            priv->num_survey_done = 0;
+            goto done;
+        }
+    }
+
+    // Install zero bitmap
+    sbitmap_free(&priv->zeros);
+    priv->zeros = zeros;
+    zeros = NULL;
+    (*config->log)(LOG_INFO, "loaded checkpoint file `%s' with %ju known zero blocks",
+      config->checkpoint_file, (uintmax_t)sbitmap_count(priv->zeros));
+    goto done;
+
+invalid:
+    (*config->log)(LOG_ERR, "checkpoint file `%s' is invalid; ignoring it", config->checkpoint_file);
+    priv->num_survey_done = 0;
+
+done:
+    // Delete the file; once we start modifying blocks, it's no longer valid
+    fclose(fp);
+    if (unlink(config->checkpoint_file) == -1)
+        (*config->log)(LOG_ERR, "can't delete checkpoint file `%s': %s", config->checkpoint_file, strerror(errno));
+    sbitmap_free(&zeros);
+    free(runs);
+    free(ranges);
+}
+
+/*
+ * Save the main zero bitmap and "survey_done" to the checkpoint file. This assumes mutex is held
+ * and that no survey is running.
+ */
+static void
+zero_cache_save_checkpoint(struct zero_cache_private *priv)
+{
+    struct zero_cache_conf *const config = priv->config;
+    struct checkpoint_header header;
+    struct block_list runs;
+    s3b_block_t block_num;
+    s3b_block_t run;
+    char *temp_file;
+    uLong crc;
+    FILE *fp;
+    int value;
+    int r;
+
+    // Anything to save?
+    assert(priv->survey_zeros == NULL);
+    if (priv->num_survey_done == 0)
+        return;
+
+    // Encode zero bitmap as alternating runs, starting with a (possibly empty) run of 0's
+    block_list_init(&runs);
+    for (block_num = 0, value = 0; block_num < config->num_blocks; block_num += run, value = !value) {
+        run = sbitmap_test(priv->zeros, block_num) == value ?
+          sbitmap_run_length(priv->zeros, block_num, config->num_blocks - block_num) : 0;
+        if ((r = block_list_append(&runs, run)) != 0) {
+            (*config->log)(LOG_ERR, "can't write checkpoint file `%s': %s", config->checkpoint_file, strerror(r));
+            goto fail0;
+        }
+    }
+
+    // Build header
+    memset(&header, 0, sizeof(header));
+    header.signature = CHECKPOINT_SIGNATURE;
+    header.header_size = sizeof(header);
+    header.block_size = config->block_size;
+    header.num_blocks = config->num_blocks;
+    header.num_ranges = priv->num_survey_done;
+    header.num_runs = runs.num_blocks;
+    if (zero_cache_identity(priv, header.identity) != 0)
+        goto fail0;
+    crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, (const Bytef *)priv->survey_done, header.num_ranges * sizeof(*priv->survey_done));
+    crc = crc32(crc, (const Bytef *)runs.blocks, header.num_runs * sizeof(*runs.blocks));
+    header.crc = (uint32_t)crc;
+
+    // Write to a temporary file, then rename it into place
+    if (asprintf(&temp_file, "%s%s", config->checkpoint_file, CHECKPOINT_SUFFIX) == -1) {
+        (*config->log)(LOG_ERR, "can't write checkpoint file `%s': %s", config->checkpoint_file, strerror(errno));
+        goto fail0;
+    }
+    if ((fp = fopen(temp_file, "w")) == NULL) {
+        (*config->log)(LOG_ERR, "can't create file `%s': %s", temp_file, strerror(errno));
+        goto fail1;
+    }
+    if (fwrite(&header, sizeof(header), 1, fp) != 1
+      || fwrite(priv->survey_done, sizeof(*priv->survey_done), header.num_ranges, fp) != header.num_ranges
+      || fwrite(runs.blocks, sizeof(*runs.blocks), header.num_runs, fp) != header.num_runs
+      || fflush(fp) != 0
+      || fsync(fileno(fp)) == -1) {
+        (*config->log)(LOG_ERR, "error writing `%s': %s", temp_file, strerror(errno));
+        (void)fclose(fp);
+        goto fail2;
+    }
+    if (fclose(fp) != 0) {
+        (*config->log)(LOG_ERR, "error closing `%s': %s", temp_file, strerror(errno));
+        goto fail2;
+    }
+    if (rename(temp_file, config->checkpoint_file) == -1) {
+        (*config->log)(LOG_ERR, "can't rename `%s' to `%s': %s", temp_file, config->checkpoint_file, strerror(errno));
+        goto fail2;
+    }
+    (*config->log)(LOG_INFO, "wrote checkpoint file `%s' with %ju known zero blocks",
+      config->checkpoint_file, (uintmax_t)sbitmap_count(priv->zeros));
+    goto fail1;
+
+fail2:
+    (void)unlink(temp_file);
+fail1:
+    free(temp_file);
+fail0:
+    block_list_free(&runs);
+}
+
 static int
 zero_cache_meta_data(struct s3backer_store *s3b, off_t *file_sizep, u_int *block_sizep)
 {
@@ -327,7 +747,18 @@ zero_cache_shutdown(struct s3backer_store *const s3b)
     CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
 
     // Propagate to lower layer
-    return (*priv->inner->shutdown)(priv->inner);
+    if ((r = (*priv->inner->shutdown)(priv->inner)) != 0)
+        return r;
+
+    // Save checkpoint, now that everything has been written
+    if (config->checkpoint_file != NULL) {
+        pthread_mutex_lock(&priv->mutex);
+        zero_cache_save_checkpoint(priv);
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+    }
+
+    // Done
+    return 0;
 }
 
 static void
@@ -345,17 +776,72 @@ zero_cache_destroy(struct s3backer_store *const s3b)
     CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
     pthread_mutex_destroy(&priv->mutex);
     assert(priv->survey_zeros == NULL);
-    bitmap_free(&priv->zeros);
+    sbitmap_free(&priv->zeros);
+    free(priv->survey_done);
     free(priv);
     free(s3b);
 }
 
 static int
-zero_cache_survey_non_zero(struct s3backer_store *s3b, block_list_func_t *callback, void *arg)
+zero_cache_survey_non_zero(struct s3backer_store *s3b, const struct survey_params *params)
 {
     return ENOTSUP;
 }
 
+/*
+ * Since we sit on top of all the other layers, every write passes through us before it reaches the block cache
+ * (where it may sit dirty for a while), and we mark a block as no longer known zero before passing the write down.
+ * So our bitmap alone decides the answer here.
+ */
+static int
+zero_cache_block_status(struct s3backer_store *s3b, s3b_block_t block_num, s3b_block_t max_blocks,
+  int *zerop, s3b_block_t *num_blocksp)
+{
+    struct zero_cache_private *const priv = s3b->data;
+    struct zero_cache_conf *const config = priv->config;
+
+    // Sanity check
+    if (max_blocks == 0 || block_num >= config->num_blocks || max_blocks > config->num_blocks - block_num)
+        return EINVAL;
+
+    // Find the run of blocks sharing the status of the first block
+    pthread_mutex_lock(&priv->mutex);
+    *zerop = sbitmap_test(priv->zeros, block_num);
+    *num_blocksp = sbitmap_run_length(priv->zeros, block_num, max_blocks);
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+    return 0;
+}
+
+/*
+ * Pass down the prefetch, skipping any blocks known to be zero, as we will never need to read those.
+ */
+static int
+zero_cache_prefetch_blocks(struct s3backer_store *s3b, s3b_block_t block_num, u_int num_blocks)
+{
+    struct zero_cache_private *const priv = s3b->data;
+    struct zero_cache_conf *const config = priv->config;
+    s3b_block_t run;
+    int zero;
+    int r;
+
+    // Sanity check
+    if (block_num >= config->num_blocks || num_blocks > config->num_blocks - block_num)
+        return EINVAL;
+
+    // Prefetch each run of blocks not known to be zero
+    while (num_blocks > 0) {
+        pthread_mutex_lock(&priv->mutex);
+        zero = sbitmap_test(priv->zeros, block_num);
+        run = sbitmap_run_length(priv->zeros, block_num, num_blocks);
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+        if (!zero && (r = (*priv->inner->prefetch_blocks)(priv->inner, block_num, (u_int)run)) != 0)
+            return r;
+        block_num += run;
+        num_blocks -= run;
+    }
+    return 0;
+}
+
 static int
 zero_cache_read_block(struct s3backer_store *const s3b, s3b_block_t block_num, void *dest,
   u_char *actual_etag, const u_char *expect_etag, int strict)
@@ -366,7 +852,7 @@ zero_cache_read_block(struct s3backer_store *const s3b, s3b_block_t block_num, v
 
     // Check for the case where we are reading a block that is already known to be zero
     pthread_mutex_lock(&priv->mutex);
-    if (bitmap_test(priv->zeros, block_num)) {
+    if (sbitmap_test(priv->zeros, block_num)) {
         priv->stats.read_hits++;
         CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
         if (expect_etag != NULL && strict && memcmp(expect_etag, zero_etag, MD5_DIGEST_LENGTH) != 0)
@@ -408,7 +894,7 @@ zero_cache_write_block(struct s3backer_store *const s3b, s3b_block_t block_num,
 
     // Handle the case where we know this block is zero
     pthread_mutex_lock(&priv->mutex);
-    if (bitmap_test(priv->zeros, block_num)) {
+    if (sbitmap_test(priv->zeros, block_num)) {
         if (known_zero) {                                       // ok, it's still zero -> return immediately
             priv->stats.write_hits++;
             CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
@@ -447,7 +933,7 @@ zero_cache_read_block_part(struct s3backer_store *s3b, s3b_block_t block_num, u_
 
     // Check for the case where we are reading a block that is already known to be zero
     pthread_mutex_lock(&priv->mutex);
-    if (bitmap_test(priv->zeros, block_num)) {
+    if (sbitmap_test(priv->zeros, block_num)) {
         priv->stats.read_hits++;
         CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
         memset(dest, 0, len);
@@ -473,11 +959,11 @@ zero_cache_write_block_part(struct s3backer_store *s3b, s3b_block_t block_num, u
     assert(off + len <= config->block_size);
 
     // Check whether data is all zeros
-    data_is_zeros = src == NULL || memcmp(src, zero_block, len) == 0;
+    data_is_zeros = src == NULL || mem_is_zeros(src, len);
 
     // Handle the case where we know this block is zero
     pthread_mutex_lock(&priv->mutex);
-    if (bitmap_test(priv->zeros, block_num)) {
+    if (sbitmap_test(priv->zeros, block_num)) {
         if (data_is_zeros) {                                    // ok, it's still zero -> return immediately
             priv->stats.write_hits++;
             CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
@@ -491,6 +977,156 @@ zero_cache_write_block_part(struct s3backer_store *s3b, s3b_block_t block_num, u
     return (*priv->inner->write_block_part)(priv->inner, block_num, off, len, src);
 }
 
+/*
+ * Read a range of blocks. Blocks known to be zero are filled in directly; each run of
+ * the remaining blocks is passed down to the lower layer as a single multi-block read.
+ */
+static int
+zero_cache_read_blocks(struct s3backer_store *s3b, s3b_block_t block_num, u_int num_blocks, void *dest)
+{
+    struct zero_cache_private *const priv = s3b->data;
+    struct zero_cache_conf *const config = priv->config;
+    char *known_zero;
+    u_int run_start;
+    u_int i;
+    int r = 0;
+
+    // Allocate known zero flags
+    if ((known_zero = malloc(num_blocks)) == NULL) {
+        r = errno;
+        (*config->log)(LOG_ERR, "malloc(): %s", strerror(r));
+        return r;
+    }
+
+    // Fill in blocks we know are already zero
+    pthread_mutex_lock(&priv->mutex);
+    for (i = 0; i < num_blocks; i++) {
+        if ((known_zero[i] = sbitmap_test(priv->zeros, block_num + i)) != 0)
+            priv->stats.read_hits++;
+    }
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+    for (i = 0; i < num_blocks; i++) {
+        if (known_zero[i])
+            memset((char *)dest + (size_t)i * config->block_size, 0, config->block_size);
+    }
+
+    // Read each run of blocks not known to be zero
+    for (i = 0; i < num_blocks; ) {
+        char *run_dest;
+
+        // Find the next run
+        while (i < num_blocks && known_zero[i])
+            i++;
+        if (i == num_blocks)
+            break;
+        run_start = i;
+        while (i < num_blocks && !known_zero[i])
+            i++;
+
+        // Perform the actual read
+        run_dest = (char *)dest + (size_t)run_start * config->block_size;
+        if ((r = read_block_range(priv->inner, config->block_size, block_num + run_start, i - run_start, run_dest)) != 0)
+            break;
+
+        // Update cache
+        pthread_mutex_lock(&priv->mutex);
+        while (run_start < i) {
+            zero_cache_update_block(priv, block_num + run_start, block_is_zeros(run_dest));
+            run_dest += config->block_size;
+            run_start++;
+        }
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+    }
+
+    // Done
+    free(known_zero);
+    return r;
+}
+
+/*
+ * Write a range of blocks. Zero blocks that are already known to be zero are omitted; each
+ * run of the remaining blocks is passed down to the lower layer as a single multi-block write.
+ */
+static int
+zero_cache_write_blocks(struct s3backer_store *s3b, s3b_block_t block_num, u_int num_blocks, const void *src,
+  u_char *etags, check_cancel_t *check_cancel, void *check_cancel_arg)
+{
+    struct zero_cache_private *const priv = s3b->data;
+    struct zero_cache_conf *const config = priv->config;
+    char *data_is_zeros;
+    char *skip;
+    u_int run_start;
+    u_int i;
+    int r = 0;
+
+    // Skipped blocks would need their ETags reported individually, so do that the simple way; likewise for cancel checks
+    if (etags != NULL || check_cancel != NULL)
+        return parallel_write_blocks(s3b, config->block_size, 1, block_num, num_blocks, src, etags,
+          check_cancel, check_cancel_arg);
+
+    // Allocate per-block flags
+    if ((data_is_zeros = malloc(2 * num_blocks)) == NULL) {
+        r = errno;
+        (*config->log)(LOG_ERR, "malloc(): %s", strerror(r));
+        return r;
+    }
+    skip = data_is_zeros + num_blocks;
+
+    // Detect zero blocks
+    for (i = 0; i < num_blocks; i++)
+        data_is_zeros[i] = src == NULL || block_is_zeros((const char *)src + (size_t)i * config->block_size);
+
+    // Handle the blocks we know are zero
+    pthread_mutex_lock(&priv->mutex);
+    for (i = 0; i < num_blocks; i++) {
+        skip[i] = 0;
+        if (!sbitmap_test(priv->zeros, block_num + i))
+            continue;
+        if (data_is_zeros[i]) {                                 // ok, it's still zero -> nothing to do
+            priv->stats.write_hits++;
+            skip[i] = 1;
+            continue;
+        }
+        zero_cache_update_block(priv, block_num + i, 0);        // be conservative and say we are no longer sure
+    }
+    CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+
+    // Write each run of blocks that need writing
+    for (i = 0; i < num_blocks; ) {
+        const char *run_src;
+        int r2;
+
+        // Find the next run
+        while (i < num_blocks && skip[i])
+            i++;
+        if (i == num_blocks)
+            break;
+        run_start = i;
+        while (i < num_blocks && !skip[i])
+            i++;
+
+        // Perform the actual write
+        run_src = src != NULL ? (const char *)src + (size_t)run_start * config->block_size : NULL;
+        r2 = write_block_range(priv->inner, config->block_size, block_num + run_start, i - run_start, run_src);
+
+        // Update cache; if there was an error, be conservative and say we are no longer sure about any of them
+        pthread_mutex_lock(&priv->mutex);
+        while (run_start < i) {
+            zero_cache_update_block(priv, block_num + run_start, r2 == 0 && data_is_zeros[run_start]);
+            run_start++;
+        }
+        CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
+        if (r2 != 0) {
+            r = r2;
+            break;
+        }
+    }
+
+    // Done
+    free(data_is_zeros);
+    return r;
+}
+
 static int
 zero_cache_bulk_zero(struct s3backer_store *const s3b, const s3b_block_t *block_nums, u_int num_blocks)
 {
@@ -513,7 +1149,7 @@ zero_cache_bulk_zero(struct s3backer_store *const s3b, const s3b_block_t *block_
     while (num_blocks-- > 0) {
         const s3b_block_t block_num = *block_nums++;
 
-        if (bitmap_test(priv->zeros, block_num))
+        if (sbitmap_test(priv->zeros, block_num))
             priv->stats.write_hits++;
         else
             edited_block_nums[edited_num_blocks++] = block_num;
@@ -549,6 +1185,8 @@ zero_cache_get_stats(struct s3backer_store *s3b, struct zero_cache_stats *stats)
 
     pthread_mutex_lock(&priv->mutex);
     memcpy(stats, &priv->stats, sizeof(*stats));
+    stats->current_cache_size = sbitmap_count(priv->zeros);
+    stats->bitmap_memory = sbitmap_memory(priv->zeros);
     CHECK_RETURN(pthread_mutex_unlock(&priv->mutex));
 }
 
@@ -568,15 +1206,12 @@ static void
 zero_cache_update_block(struct zero_cache_private *const priv, s3b_block_t block_num, int zero)
 {
     // If non-zero, ensure any ongoing survey doesn't overwrite this change when it completes
-    if (priv->survey_zeros != NULL && !zero)
-        bitmap_set(priv->survey_zeros, block_num, 0);
+    if (priv->survey_zeros != NULL && !zero) {
+        pthread_mutex_lock(&priv->survey_mutex);
+        sbitmap_set(priv->survey_zeros, block_num, 0);
+        CHECK_RETURN(pthread_mutex_unlock(&priv->survey_mutex));
+    }
 
     // Update bitmap
-    if (bitmap_test(priv->zeros, block_num) == zero)
-        return;
-    bitmap_set(priv->zeros, block_num, zero);
-    if (zero)
-        priv->stats.current_cache_size++;
-    else
-        priv->stats.current_cache_size--;
+    sbitmap_set(priv->zeros, block_num, zero);
 }
@@ -39,14 +39,19 @@ struct zero_cache_conf {
     u_int               block_size;
     s3b_block_t         num_blocks;
     int                 list_blocks;
+    const char          *checkpoint_file;       // survey checkpoint file, or NULL for none
+    const char          *bucket;                // these identify the filesystem in the checkpoint file
+    const char          *prefix;
+    int                 blockHashPrefix;
     log_func_t          *log;
 };
 
 // Statistics structure for zero_cache store
 struct zero_cache_stats {
     s3b_block_t         current_cache_size;
-    u_int               read_hits;
-    u_int               write_hits;
+    size_t              bitmap_memory;
+    uint64_t            read_hits;
+    uint64_t            write_hits;
 };
 
 // zero_cache.c